@@ -47,18 +47,39 @@
              MTP=0 # multiple kernel threads per process
            PIPES=0 # pipe(2) functionality
          SHADOWD=0 # shadow page cleanup
+            SWAP=0 # page anonymous memory out to the second disk (needs NDISKS=2)
+            ZRAM=0 # page anonymous memory out compressed into memory, before swap
+             KSM=0 # merge identical anonymous pages in the background
+        KPREEMPT=0 # preempt kernel threads in long operations (sched_cond_resched)
+ COMPRESS_KERNEL=0 # compress the boot image, which stage2 expands (needs python)
 
 # Boolean options specified in this specified in this file that should be
 # included as definitions at compile time
-        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT PIPES "
+        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT PIPES SWAP ZRAM KSM KPREEMPT COMPRESS_KERNEL "
 # As above, but not booleans
-        COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE BOCHS_INSTALL_DIR "
+        COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE BOCHS_INSTALL_DIR SWAP_BLOCKS ZRAM_PAGES RAMDISK_PAGES STRIPE_DISKS STRIPE_BLOCKS STRIPE_MEMBER_BLOCKS "
 
 # Parameters for the hard disk we build (must be compatible!)
 # If the FS is too big for the disk, BAD things happen!
         DISK_BLOCKS=2048 # For fsmaker
         DISK_INODES=240 # for fsmaker
 
+# Size of the swap area on the second disk, in pages (the disk must be
+# at least this big)
+        SWAP_BLOCKS=8192
+# Most memory compressed pages may take with ZRAM, in pages
+        ZRAM_PAGES=1024
+# Size of the ram disk, /dev/ram0 (formatted as s5fs at boot), in pages,
+# or 0 for none
+        RAMDISK_PAGES=0
+# Number of disks, the last ones, to stripe /dev/md0 across (at least 2,
+# or 0 for none; not the swap disk), how many blocks go to each of them
+# in turn, and how many blocks each has (for the file system made on a
+# blank /dev/md0 at boot)
+        STRIPE_DISKS=0
+        STRIPE_BLOCKS=16
+        STRIPE_MEMBER_BLOCKS=2048
+
 # Debug message behavior. Note that this can be changed at runtime by
 # modifying the dbg_modes global variable.
 # All debug statements
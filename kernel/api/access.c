@@ -8,6 +8,7 @@
 #include "mm/page.h"
 #include "mm/mm.h"
 #include "mm/kmalloc.h"
+#include "mm/slab.h"
 
 #include "proc/proc.h"
 
@@ -16,30 +17,114 @@
 #include "api/access.h"
 #include "api/syscall.h"
 
+#include "util/init.h"
+
+/* How many argstrs user_vecdup reads from user space at a time */
+#define ACCESS_VEC_BATCH        16
+
+/* Buffers for user_path, MAXPATHLEN bytes each */
+static slab_allocator_t *path_allocator = NULL;
+
+static __attribute__((unused)) void
+access_init(void)
+{
+        path_allocator = slab_allocator_create("path", MAXPATHLEN);
+        KASSERT(NULL != path_allocator);
+}
+init_func(access_init);
+
+/*
+ * The exception table: each entry names an instruction which may fault
+ * on a user address and where to continue if the fault cannot be
+ * resolved. The entries are collected into their own section by the
+ * linker (see link.ld), between these symbols.
+ */
+typedef struct access_extable {
+        uintptr_t ae_insn;
+        uintptr_t ae_fixup;
+} access_extable_t;
+
+extern access_extable_t kernel_start_extable[];
+extern access_extable_t kernel_end_extable[];
+
+uintptr_t
+access_fixup(uintptr_t eip)
+{
+        access_extable_t *ae;
+
+        for (ae = kernel_start_extable; ae < kernel_end_extable; ae++) {
+                if (ae->ae_insn == eip)
+                        return ae->ae_fixup;
+        }
+        return 0;
+}
+
+/*
+ * Copies nbytes from src to dst, one of which is in user space, and
+ * returns the number of bytes which could NOT be copied. A fault on the
+ * user address which the page fault handler cannot resolve resumes at
+ * the fixup with the count of bytes left still in %ecx.
+ */
+static size_t
+access_copy(void *dst, const void *src, size_t nbytes)
+{
+        int d0, d1;
+
+        __asm__ volatile(
+                "1:     rep; movsb\n"
+                "2:\n"
+                ".section .fixup,\"ax\"\n"
+                "3:     jmp 2b\n"
+                ".previous\n"
+                ".section .extable,\"a\"\n"
+                "       .align 4\n"
+                "       .long 1b, 3b\n"
+                ".previous\n"
+                : "=c"(nbytes), "=&D"(d0), "=&S"(d1)
+                : "0"(nbytes), "1"(dst), "2"(src)
+                : "memory");
+        return nbytes;
+}
+
+/* Whether [uaddr, uaddr + nbytes) lies within user space at all */
+static int
+access_ok(const void *uaddr, size_t nbytes)
+{
+        uintptr_t start = (uintptr_t) uaddr;
+
+        return start >= USER_MEM_LOW && start <= USER_MEM_HIGH
+               && nbytes <= USER_MEM_HIGH - start;
+}
+
 /* copy_to_user and copy_from_user are used to copy to and from the
- * user space of the current process.  They first check that the range
- * of addresses has valid mappings, then call vmmap_read/write.
+ * user space of the current process.  Rather than first checking the
+ * range against the vmmap, they copy directly and let the page fault
+ * handler map pages in as they are touched; a fault it cannot resolve
+ * (an address which is not mapped, or not with the right protection)
+ * is caught by the exception table and ends the copy with -EFAULT.
+ * Only the bounds of user space are checked beforehand, so that no
+ * user pointer can reach kernel memory.
  */
 int copy_from_user(void *kaddr, const void *uaddr, size_t nbytes)
 {
-        if (!range_perm(curproc, uaddr, nbytes, PROT_READ)) {
+        if (!access_ok(uaddr, nbytes) || 0 != access_copy(kaddr, uaddr, nbytes)) {
                 return -EFAULT;
         }
-        return vmmap_read(curproc->p_vmmap, uaddr, kaddr, nbytes);
+        return 0;
 }
 
 int copy_to_user(void *uaddr, const void *kaddr, size_t nbytes)
 {
-        if (!range_perm(curproc, uaddr, nbytes, PROT_WRITE)) {
+        if (!access_ok(uaddr, nbytes) || 0 != access_copy(uaddr, kaddr, nbytes)) {
                 return -EFAULT;
         }
-        return vmmap_write(curproc->p_vmmap, uaddr, kaddr, nbytes);
+        return 0;
 }
 
 /* Like strndup(), but gets the string from user space, ensuring
  * that the entire string (up to its length) has valid mappings.
  * The resulting string can be freed with kfree().
- * This function may block (as vmmap_read may block)
+ * This function may block (as faulting in the user's pages may block)
  */
 char *user_strdup(argstr_t *ustr)
 {
@@ -58,54 +143,102 @@ char *user_strdup(argstr_t *ustr)
         return kstr;
 }
 
+/* Like user_strdup, but for a pathname: the copy is made into a buffer
+ * of MAXPATHLEN bytes taken from a cache of them rather than kmalloc'd,
+ * and must be freed with user_path_free. Fails with ENAMETOOLONG if the
+ * path does not fit. */
+char *user_path(argstr_t *ustr)
+{
+        char *kstr;
+        int ret;
+
+        if (ustr->as_len >= MAXPATHLEN) {
+                curthr->kt_errno = ENAMETOOLONG;
+                return NULL;
+        }
+        if (NULL == (kstr = (char *) slab_obj_alloc(path_allocator))) {
+                curthr->kt_errno = ENOMEM;
+                return NULL;
+        }
+        if (0 > (ret = copy_from_user(kstr, ustr->as_str, ustr->as_len + 1))) {
+                curthr->kt_errno = -ret;
+                slab_obj_free(path_allocator, kstr);
+                return NULL;
+        }
+        kstr[ustr->as_len] = '\0';
+        return kstr;
+}
+
+/* Frees a path from user_path, if it is not NULL */
+void user_path_free(char *path)
+{
+        if (NULL != path)
+                slab_obj_free(path_allocator, path);
+}
+
 /* Copies in an entire vector of strings from user space, similarly to
- * user_strdup. The vector of strings and each string can be
- * freed (separately) with kfree */
+ * user_strdup, into a single allocation: the vector of pointers followed
+ * by the strings, all freed by one kfree of the vector. The argstrs are
+ * read a batch at a time, once to size the allocation and again to copy
+ * the strings; one which has grown in between fails with EFAULT. */
 char **user_vecdup(argvec_t *uvec)
 {
+        argstr_t batch[ACCESS_VEC_BATCH];
         char **kvec = NULL;
-        argstr_t *temp_kvec = NULL;
-        size_t i;
+        char *kstr;
+        size_t i, j, n, total, left;
         int ret;
 
-        if (NULL == (temp_kvec = (argstr_t *) kmalloc((uvec->av_len + 1) * sizeof(argstr_t)))) {
-                ret = -ENOMEM;
+        if (uvec->av_len >= ((size_t) -1) / sizeof(char *) - 1) {
+                ret = -E2BIG;
                 goto fail;
         }
-        if (NULL == (kvec = (char **) kmalloc((uvec->av_len + 1) * sizeof(char *)))) {
-                ret = -ENOMEM;
-                goto fail;
+        total = (uvec->av_len + 1) * sizeof(char *);
+        for (i = 0; i < uvec->av_len; i += n) {
+                n = MIN(ACCESS_VEC_BATCH, uvec->av_len - i);
+                if (0 > (ret = copy_from_user(batch, uvec->av_vec + i, n * sizeof(argstr_t))))
+                        goto fail;
+                for (j = 0; j < n; j++) {
+                        if (batch[j].as_len >= ((size_t) -1) - total) {
+                                ret = -E2BIG;
+                                goto fail;
+                        }
+                        total += batch[j].as_len + 1;
+                }
         }
-        /* Copy over the array of argstrs */
-        if (0 > (ret = copy_from_user(temp_kvec, uvec->av_vec,
-                                      (uvec->av_len + 1) * sizeof(argstr_t)))) {
+
+        if (NULL == (kvec = (char **) kmalloc(total))) {
+                ret = -ENOMEM;
                 goto fail;
         }
-
-        /* For each arstr in temp_kvec, user_strdup a copy and put in kvec */
-        for (i = 0; i < uvec->av_len; i++) {
-                if (NULL == (kvec[i] = user_strdup(&temp_kvec[i]))) {
-                        /* Need to clean up all allocated stuff; errno set in strdup */
-                        ret = -curthr->kt_errno;
+        kstr = (char *) (kvec + uvec->av_len + 1);
+        left = total - (uvec->av_len + 1) * sizeof(char *);
+        for (i = 0; i < uvec->av_len; i += n) {
+                n = MIN(ACCESS_VEC_BATCH, uvec->av_len - i);
+                if (0 > (ret = copy_from_user(batch, uvec->av_vec + i, n * sizeof(argstr_t))))
                         goto fail;
+                for (j = 0; j < n; j++) {
+                        size_t len = batch[j].as_len + 1;
+
+                        if (len > left) {
+                                ret = -EFAULT;
+                                goto fail;
+                        }
+                        if (0 > (ret = copy_from_user(kstr, batch[j].as_str, len)))
+                                goto fail;
+                        kstr[len - 1] = '\0';
+                        kvec[i + j] = kstr;
+                        kstr += len;
+                        left -= len;
                 }
         }
         /* Add null entry */
         kvec[uvec->av_len] = NULL;
-        kfree(temp_kvec);
         return kvec;
 
 fail:
-        if (kvec != NULL) {
-                for (i = 0; kvec[i] != NULL; i++) {
-                        if (kvec[i] != NULL) {
-                                kfree(kvec[i]);
-                        }
-                }
+        if (NULL != kvec)
                 kfree(kvec);
-        }
-        kfree(temp_kvec);
-
         curthr->kt_errno = -ret;
         return NULL;
 }
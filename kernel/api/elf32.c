@@ -6,7 +6,12 @@
 #include "mm/tlb.h"
 #include "mm/pagetable.h"
 #include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
 
+#include "vm/kdata.h"
+#include "vm/pagefault.h"
 #include "vm/vmmap.h"
 
 #include "api/elf.h"
@@ -14,6 +19,7 @@
 
 #include "util/init.h"
 #include "util/debug.h"
+#include "util/list.h"
 #include "util/string.h"
 
 #include "fs/file.h"
@@ -296,6 +302,225 @@ static void _elf32_calc_progbounds(Elf32_Ehdr *header, char *pht, void **low, vo
                 *high = (void *) curhigh;
 }
 
+/* The exec cache: the checked ELF header, program header table, program
+ * bounds and interpreter name of the files most recently executed (or
+ * loaded as interpreters), so that running the same program again does
+ * not read or check any of them. Entries hold no reference on their
+ * vnodes; one is valid only while its vnode's vn_wgen is the one it was
+ * read at, which no other vnode or contents of the file can have. */
+#define ELF32_CACHE_NENTRIES 8
+
+typedef struct elf32_cache {
+        vnode_t         *ec_vnode;      /* NULL if unused */
+        uint32_t        ec_wgen;
+        Elf32_Ehdr      ec_header;
+        char            *ec_pht;
+        size_t          ec_phtsize;
+        void            *ec_low;
+        void            *ec_high;
+        char            *ec_interpname; /* NULL if there is no interpreter */
+        list_link_t     ec_link;        /* on elf32_cache_lru */
+} elf32_cache_t;
+
+static elf32_cache_t elf32_cache[ELF32_CACHE_NENTRIES];
+static list_t elf32_cache_lru;          /* most recently used first */
+
+static elf32_cache_t *_elf32_cache_lookup(vnode_t *vn)
+{
+        elf32_cache_t *ec;
+
+        list_iterate_begin(&elf32_cache_lru, ec, elf32_cache_t, ec_link) {
+                if (vn == ec->ec_vnode && vn->vn_wgen == ec->ec_wgen) {
+                        list_remove(&ec->ec_link);
+                        list_insert_head(&elf32_cache_lru, &ec->ec_link);
+                        return ec;
+                }
+        } list_iterate_end();
+        return NULL;
+}
+
+/* Frees what the entry holds and marks it unused */
+static void _elf32_cache_clear(elf32_cache_t *ec)
+{
+        if (NULL != ec->ec_pht)
+                kfree(ec->ec_pht);
+        if (NULL != ec->ec_interpname)
+                kfree(ec->ec_interpname);
+        ec->ec_vnode = NULL;
+        ec->ec_pht = NULL;
+        ec->ec_interpname = NULL;
+}
+
+static uint32_t _elf32_cache_count(void)
+{
+        uint32_t n = 0;
+        int i;
+
+        for (i = 0; i < ELF32_CACHE_NENTRIES; i++)
+                n += (NULL != elf32_cache[i].ec_pht);
+        return n;
+}
+
+/* The exec cache's shrinker: frees the nr least recently used entries.
+ * The unused entries are left where they are, as the insert below takes
+ * the least recently used whether or not it is in use. */
+static int _elf32_cache_shrink(int nr)
+{
+        elf32_cache_t *ec;
+        int n = 0;
+
+        list_iterate_reverse(&elf32_cache_lru, ec, elf32_cache_t, ec_link) {
+                if (n < nr && NULL != ec->ec_pht) {
+                        _elf32_cache_clear(ec);
+                        n++;
+                }
+        } list_iterate_end();
+        return n;
+}
+
+static slab_shrinker_t elf32_cache_shrinker = {
+        .ss_name = "exec",
+        .ss_count = _elf32_cache_count,
+        .ss_scan = _elf32_cache_shrink
+};
+
+/* Replaces the least recently used entry (or any stale one for vn) with
+ * the given headers of vn as of stamp wgen. If memory is short the
+ * headers just are not cached. */
+static void _elf32_cache_insert(vnode_t *vn, uint32_t wgen, const Elf32_Ehdr *header,
+                                const char *pht, size_t phtsize, void *low, void *high,
+                                const char *interpname)
+{
+        elf32_cache_t *ec, *victim = NULL;
+
+        list_iterate_begin(&elf32_cache_lru, ec, elf32_cache_t, ec_link) {
+                if (vn == ec->ec_vnode)
+                        victim = ec;
+        } list_iterate_end();
+        if (NULL == victim)
+                victim = list_tail(&elf32_cache_lru, elf32_cache_t, ec_link);
+
+        _elf32_cache_clear(victim);
+        list_remove(&victim->ec_link);
+        list_insert_head(&elf32_cache_lru, &victim->ec_link);
+
+        if (NULL == (victim->ec_pht = kmalloc(phtsize)))
+                return;
+        if (NULL != interpname
+            && NULL == (victim->ec_interpname = kmalloc(strlen(interpname) + 1))) {
+                kfree(victim->ec_pht);
+                victim->ec_pht = NULL;
+                return;
+        }
+        memcpy(victim->ec_pht, pht, phtsize);
+        if (NULL != interpname)
+                strcpy(victim->ec_interpname, interpname);
+        victim->ec_header = *header;
+        victim->ec_phtsize = phtsize;
+        victim->ec_low = low;
+        victim->ec_high = high;
+        victim->ec_wgen = wgen;
+        victim->ec_vnode = vn;
+}
+
+/* Gets the ELF header of the file open as fd (whose vnode is vn), a
+ * kmalloc'd copy of its program header table (of size *phtsize), its
+ * program bounds and, if it has one, the kmalloc'd, null-terminated name
+ * of its interpreter (NULL if it has none), from the exec cache if they
+ * are there and otherwise from the file. interp is as for
+ * _elf32_load_ehdr.
+ * Returns 0 on success, -errno on failure, in which case nothing is left
+ * allocated. */
+static int _elf32_load_headers(int fd, vnode_t *vn, int interp, Elf32_Ehdr *header,
+                               char **pht, size_t *phtsize, void **low, void **high,
+                               char **interpname)
+{
+        uint32_t wgen = vn->vn_wgen;
+        Elf32_Phdr *phinterp;
+        elf32_cache_t *ec;
+        int err;
+
+        *pht = NULL;
+        *interpname = NULL;
+
+        if (NULL != (ec = _elf32_cache_lookup(vn))) {
+                dbg(DBG_ELF, "ELF headers of vnode 0x%p found in the exec cache\n", vn);
+                /* the cached header passed the interpreter check at least */
+                if (ET_EXEC != ec->ec_header.e_type && !interp) {
+                        dbg(DBG_ELF, "ELF load failed: not exectuable ELF\n");
+                        return -ENOEXEC;
+                }
+                if (NULL == (*pht = kmalloc(ec->ec_phtsize)))
+                        return -ENOMEM;
+                if (NULL != ec->ec_interpname
+                    && NULL == (*interpname = kmalloc(strlen(ec->ec_interpname) + 1))) {
+                        kfree(*pht);
+                        *pht = NULL;
+                        return -ENOMEM;
+                }
+                memcpy(*pht, ec->ec_pht, ec->ec_phtsize);
+                if (NULL != ec->ec_interpname)
+                        strcpy(*interpname, ec->ec_interpname);
+                *header = ec->ec_header;
+                *phtsize = ec->ec_phtsize;
+                *low = ec->ec_low;
+                *high = ec->ec_high;
+                return 0;
+        }
+
+        /* Load and verify the ELF header */
+        if (0 > (err = _elf32_load_ehdr(fd, header, interp))) {
+                return err;
+        }
+        *phtsize = header->e_phentsize * header->e_phnum;
+        if (NULL == (*pht = kmalloc(*phtsize))) {
+                err = -ENOMEM;
+                goto fail;
+        }
+        /* Read in the program header table */
+        if (0 > (err = _elf32_load_phtable(fd, header, *pht, *phtsize))) {
+                goto fail;
+        }
+        /* Check if program requires an interpreter */
+        if (0 > (err = _elf32_find_phinterp(header, *pht, &phinterp))) {
+                goto fail;
+        }
+
+        /* if one is requested read its file name from the binary */
+        if (NULL != phinterp) {
+                if (0 > (err = do_lseek(fd, phinterp->p_offset, SEEK_SET))) {
+                        goto fail;
+                } else if (NULL == (*interpname = kmalloc(phinterp->p_filesz + 1))) {
+                        err = -ENOMEM;
+                        goto fail;
+                } else if (0 > (err = do_read(fd, *interpname, phinterp->p_filesz))) {
+                        goto fail;
+                }
+                if (err != (int)phinterp->p_filesz) {
+                        err = -ENOEXEC;
+                        goto fail;
+                }
+                (*interpname)[phinterp->p_filesz] = '\0';
+        }
+
+        /* Calculate program bounds for future reference */
+        _elf32_calc_progbounds(header, *pht, low, high);
+
+        _elf32_cache_insert(vn, wgen, header, *pht, *phtsize, *low, *high, *interpname);
+        return 0;
+
+fail:
+        if (NULL != *pht) {
+                kfree(*pht);
+                *pht = NULL;
+        }
+        if (NULL != *interpname) {
+                kfree(*interpname);
+                *interpname = NULL;
+        }
+        return err;
+}
+
 /* Calculates the total size of all the arguments that need to be placed on the
  * user stack before execution can begin. See Intel i386 ELF supplement pp 54-59
  * Returns total size on success. Returns the number of non-NULL entries in
@@ -346,95 +571,165 @@ static size_t _elf32_calc_argsize(char *const argv[], char *const envp[], Elf32_
         return size;
 }
 
-/* Copies the arguments that must be on the stack prior to execution onto the
- * user stack. This should never fail.
+/* A place on the new user stack to write to, straight into its pages:
+ * the page being written is looked up in the stack's object once, and
+ * pinned while the cursor is on it */
+typedef struct elf32_cursor {
+        vmmap_t         *ec_map;
+        char            *ec_uaddr;      /* where the next write goes */
+        uint32_t         ec_vfn;        /* of the page at ec_pf */
+        pframe_t        *ec_pf;         /* or NULL */
+} elf32_cursor_t;
+
+static void _elf32_cursor_init(elf32_cursor_t *ec, vmmap_t *map, char *uaddr)
+{
+        ec->ec_map = map;
+        ec->ec_uaddr = uaddr;
+        ec->ec_pf = NULL;
+}
+
+static void _elf32_cursor_release(elf32_cursor_t *ec)
+{
+        if (NULL != ec->ec_pf) {
+                pframe_unpin(ec->ec_pf);
+                ec->ec_pf = NULL;
+        }
+}
+
+/* Writes len bytes of buf at the cursor, advancing it */
+static int _elf32_cursor_write(elf32_cursor_t *ec, const void *buf, size_t len)
+{
+        const char *src = (const char *) buf;
+
+        while (0 < len) {
+                uint32_t vfn = ADDR_TO_PN(ec->ec_uaddr);
+                size_t off = PAGE_OFFSET(ec->ec_uaddr);
+                size_t n = MIN(len, PAGE_SIZE - off);
+
+                if (NULL == ec->ec_pf || vfn != ec->ec_vfn) {
+                        vmarea_t *vma = vmmap_lookup(ec->ec_map, vfn);
+                        pframe_t *pf;
+                        int ret;
+
+                        KASSERT(NULL != vma);
+                        _elf32_cursor_release(ec);
+                        if (0 > (ret = pframe_lookup(vma->vma_obj, vfn - vma->vma_start + vma->vma_off,
+                                                     1, &pf)))
+                                return ret;
+                        if (0 > (ret = pframe_dirty(pf)))
+                                return ret;
+                        pframe_pin(pf);
+                        ec->ec_vfn = vfn;
+                        ec->ec_pf = pf;
+                }
+                memcpy((char *) ec->ec_pf->pf_addr + off, src, n);
+                ec->ec_uaddr += n;
+                src += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/* Writes the arguments that must be on the stack prior to execution onto
+ * the user stack, straight into its pages: one cursor writes argc, the
+ * vector pointers and the vectors, a second the strings and program
+ * header table they point to, which follow.
  * arglow:   low address on the user stack where we should start the copying
- * argsize:  total size of everything to go on the stack
- * buf:      a kernel buffer at least as big as argsize (for convenience)
  * argv, envp, auxv: various vectors of stuff (to go on the stack)
  * argc, envc, auxc: number of non-NULL entries in argv, envp, auxv,
  *                   respectively (to avoid recomputing them)
  * phtsize: the size of the program header table (to avoid recomputing)
  * c.f. Intel i386 ELF supplement pp 54-59
  */
-static void _elf32_load_args(vmmap_t *map, void *arglow, size_t argsize, char *buf,
-                             char *const argv[], char *const envp[], Elf32_auxv_t *auxv,
-                             int argc, int envc, int auxc, int phtsize)
+static int _elf32_load_args(vmmap_t *map, void *arglow,
+                            char *const argv[], char *const envp[], Elf32_auxv_t *auxv,
+                            int argc, int envc, int auxc, int phtsize)
 {
-        int i;
-
-        /* Copy argc */
-        *((int *) buf) = argc;
+        elf32_cursor_t vec, str;
+        char *vvecstart, *vecs[3];
+        char *null = NULL;
+        int i, ret;
 
         /* Calculate where the strings / tables pointed to by the vectors start */
         size_t veclen = (argc + 1 + envc + 1) * sizeof(char *) + (auxc + 1) * sizeof(Elf32_auxv_t);
 
-        char *vecstart = buf + sizeof(int) + 3 * sizeof(void *); /* Beginning of argv (in kernel buffer) */
+        vvecstart = ((char *)arglow) + sizeof(int) + 3 * sizeof(void *); /* Beginning of argv (in user space) */
+        _elf32_cursor_init(&vec, map, arglow);
+        _elf32_cursor_init(&str, map, vvecstart + veclen);
 
-        char *vvecstart = ((char *)arglow) + sizeof(int) + 3 * sizeof(void *); /* Beginning of argv (in user space) */
-
-        char *strstart = vecstart + veclen; /* Beginning of first string pointed to by argv
-                                                                                   (in kernel buffer) */
+        /* argc, and pointers to argv, envp and auxv */
+        vecs[0] = vvecstart;
+        vecs[1] = vvecstart + (argc + 1) * sizeof(char *);
+        vecs[2] = vvecstart + (argc + 1 + envc + 1) * sizeof(char *);
+        if (0 > (ret = _elf32_cursor_write(&vec, &argc, sizeof(int)))
+            || 0 > (ret = _elf32_cursor_write(&vec, vecs, sizeof(vecs))))
+                goto done;
 
-        /* Beginning of first string pointed to by argv (in user space) */
-        char *vstrstart = vvecstart + veclen;
+        /* argv along with every string in it, remembering that the vector
+         * holds the virtual address of each string */
+        for (i = 0; i < argc; i++) {
+                char *vstr = str.ec_uaddr;
 
-        /* Copy over pointer to argv */
-        *(char **)(buf + 4) = vvecstart;
-        /* Copy over pointer to envp */
-        *(char **)(buf + 8) = vvecstart + (argc + 1) * sizeof(char *);
-        /* Copy over pointer to auxv */
-        *(char **)(buf + 12) = vvecstart + (argc + 1 + envc + 1) * sizeof(char *);
+                if (0 > (ret = _elf32_cursor_write(&str, argv[i], strlen(argv[i]) + 1))
+                    || 0 > (ret = _elf32_cursor_write(&vec, &vstr, sizeof(char *))))
+                        goto done;
+        }
+        if (0 > (ret = _elf32_cursor_write(&vec, &null, sizeof(char *))))
+                goto done;
 
-        /* Copy over argv along with every string in it */
-        for (i = 0; i < argc; i++) {
-                size_t len = strlen(argv[i]) + 1;
-                strcpy(strstart, argv[i]);
-                /* Remember that we need to use the virtual address of the string */
-                *(char **) vecstart = vstrstart;
-                strstart += len;
-                vstrstart += len;
-                vecstart += sizeof(char *);
-        }
-        /* null terminator of argv */
-        *(char **) vecstart = NULL;
-        vecstart += sizeof(char *);
-
-        /* Copy over envp along with every string in it */
+        /* envp along with every string in it */
         for (i = 0; i < envc; i++) {
-                size_t len = strlen(envp[i]) + 1;
-                strcpy(strstart, envp[i]);
-                /* Remember that we need to use the virtual address of the string */
-                *(char **) vecstart = vstrstart;
-                strstart += len;
-                vstrstart += len;
-                vecstart += sizeof(char *);
-        }
-        /* null terminator of envp */
-        *(char **) vecstart = NULL;
-        vecstart += sizeof(char *);
-
-        /* Copy over auxv along with the program header (if we find it) */
+                char *vstr = str.ec_uaddr;
+
+                if (0 > (ret = _elf32_cursor_write(&str, envp[i], strlen(envp[i]) + 1))
+                    || 0 > (ret = _elf32_cursor_write(&vec, &vstr, sizeof(char *))))
+                        goto done;
+        }
+        if (0 > (ret = _elf32_cursor_write(&vec, &null, sizeof(char *))))
+                goto done;
+
+        /* auxv along with the program header (if we find it) */
         for (i = 0; i < auxc; i++) {
-                /* Copy over the auxv entry */
-                memcpy(vecstart, &auxv[i], sizeof(Elf32_auxv_t));
-                /* Check if it points to the program header */
-                if (auxv[i].a_type == AT_PHDR) {
-                        /* Copy over the program header table */
-                        memcpy(strstart, auxv[i].a_un.a_ptr, phtsize);
-                        /* And modify the address */
-                        ((Elf32_auxv_t *)vecstart)->a_un.a_ptr = vstrstart;
+                Elf32_auxv_t aux = auxv[i];
+
+                if (aux.a_type == AT_PHDR) {
+                        void *vpht = str.ec_uaddr;
+
+                        if (0 > (ret = _elf32_cursor_write(&str, auxv[i].a_un.a_ptr, phtsize)))
+                                goto done;
+                        aux.a_un.a_ptr = vpht;
                 }
-                vecstart += sizeof(Elf32_auxv_t);
+                if (0 > (ret = _elf32_cursor_write(&vec, &aux, sizeof(aux))))
+                        goto done;
         }
-        /* null terminator of auxv */
-        ((Elf32_auxv_t *)vecstart)->a_type = NULL;
+        {
+                Elf32_auxv_t aux;
 
-        /* Finally, we're done copying into the kernel buffer. Now just copy the
-         * kernel buffer into user space */
-        int ret = vmmap_write(map, arglow, buf, argsize);
-        /* If this failed, we must have set up the address space wrong... */
-        KASSERT(0 == ret);
+                memset(&aux, 0, sizeof(aux));
+                aux.a_type = AT_NULL;
+                ret = _elf32_cursor_write(&vec, &aux, sizeof(aux));
+        }
+
+done:
+        _elf32_cursor_release(&vec);
+        _elf32_cursor_release(&str);
+        return ret;
+}
+
+/* Maps the pages of the (now current) address space from the one holding
+ * lo up to the one holding hi - 1, so that the stack the new program
+ * starts on does not fault straight away. Best effort: a page which
+ * cannot be mapped now just faults as usual. */
+static void _elf32_prefault(void *lo, void *hi)
+{
+        uint32_t vfn;
+
+        for (vfn = ADDR_TO_PN(lo); vfn <= ADDR_TO_PN((char *) hi - 1); vfn++) {
+                vmarea_t *vma = vmmap_lookup(curproc->p_vmmap, vfn);
+
+                if (NULL != vma)
+                        pagefault_map(vma, vfn, 1);
+        }
 }
 
 
@@ -454,15 +749,20 @@ static int _elf32_load(const char *filename, int fd, char *const argv[],
         file_t *interpfile = NULL;
         char *interppht = NULL;
         Elf32_auxv_t *auxv = NULL;
-        char *argbuf = NULL;
+        char *interpinterpname = NULL;
 
         uintptr_t entry;
 
         file = fget(fd);
         KASSERT(NULL != file);
 
-        /* Load and verify the ELF header */
-        if (0 > (err = _elf32_load_ehdr(fd, &header, 0))) {
+        /* Get the ELF header, program header table, program bounds and
+         * interpreter (from the exec cache if we ran this recently) */
+        size_t phtsize;
+        void *proglow;
+        void *proghigh;
+        if (0 > (err = _elf32_load_headers(fd, file->f_vnode, 0, &header, &pht, &phtsize,
+                                           &proglow, &proghigh, &interpname))) {
                 goto done;
         }
 
@@ -471,51 +771,22 @@ static int _elf32_load(const char *filename, int fd, char *const argv[],
                 goto done;
         }
 
-        size_t phtsize = header.e_phentsize * header.e_phnum;
-        if (NULL == (pht = kmalloc(phtsize))) {
-                err = -ENOMEM;
-                goto done;
-        }
-        /* Read in the program header table */
-        if (0 > (err = _elf32_load_phtable(fd, &header, pht, phtsize))) {
+        /* The kernel data page goes in first, so that the interpreter,
+         * which is put as high as it will fit, ends up below it. */
+        if (0 > (err = kdata_map(map)))
                 goto done;
-        }
+
         /* Load the segments in the program header table */
         if (0 > (err = _elf32_map_progsegs(file->f_vnode, map, &header, pht, 0))) {
                 goto done;
         }
 
-        Elf32_Phdr *phinterp = NULL;
-        /* Check if program requires an interpreter */
-        if (0 > (err = _elf32_find_phinterp(&header, pht, &phinterp))) {
-                goto done;
-        }
-
-        /* Calculate program bounds for future reference */
-        void *proglow;
-        void *proghigh;
-        _elf32_calc_progbounds(&header, pht, &proglow, &proghigh);
-
         entry = (uintptr_t) header.e_entry;
 
         /* if an interpreter was requested load it */
-        if (NULL != phinterp) {
-                /* read the file name of the interpreter from the binary */
-                if (0 > (err = do_lseek(fd, phinterp->p_offset, SEEK_SET))) {
-                        goto done;
-                } else if (NULL == (interpname = kmalloc(phinterp->p_filesz))) {
-                        err = -ENOMEM;
-                        goto done;
-                } else if (0 > (err = do_read(fd, interpname, phinterp->p_filesz))) {
-                        goto done;
-                }
-                if (err != (int)phinterp->p_filesz) {
-                        err = -ENOEXEC;
-                        goto done;
-                }
-
+        if (NULL != interpname) {
                 /* open the interpreter */
-                dbgq(DBG_ELF, "ELF Interpreter: %*s\n", phinterp->p_filesz, interpname);
+                dbgq(DBG_ELF, "ELF Interpreter: %s\n", interpname);
                 if (0 > (interpfd = do_open(interpname, O_RDONLY))) {
                         err = interpfd;
                         goto done;
@@ -526,34 +797,23 @@ static int _elf32_load(const char *filename, int fd, char *const argv[],
                 interpfile = fget(interpfd);
                 KASSERT(NULL != interpfile);
 
-                /* Load and verify the interpreter ELF header */
-                if (0 > (err = _elf32_load_ehdr(interpfd, &interpheader, 1))) {
-                        goto done;
-                }
-                size_t interpphtsize = interpheader.e_phentsize * interpheader.e_phnum;
-                if (NULL == (interppht = kmalloc(interpphtsize))) {
-                        err = -ENOMEM;
-                        goto done;
-                }
-                /* Read in the program header table */
-                if (0 > (err = _elf32_load_phtable(interpfd, &interpheader, interppht, interpphtsize))) {
+                /* Get the interpreter's headers and program bounds */
+                size_t interpphtsize;
+                void *interplow;
+                void *interphigh;
+                if (0 > (err = _elf32_load_headers(interpfd, interpfile->f_vnode, 1, &interpheader,
+                                                   &interppht, &interpphtsize, &interplow,
+                                                   &interphigh, &interpinterpname))) {
                         goto done;
                 }
 
                 /* Interpreter shouldn't itself need an interpreter */
-                Elf32_Phdr *interpphinterp;
-                if (0 > (err = _elf32_find_phinterp(&interpheader, interppht, &interpphinterp))) {
-                        goto done;
-                }
-                if (NULL != interpphinterp) {
+                if (NULL != interpinterpname) {
                         err = -EINVAL;
                         goto done;
                 }
 
                 /* Calculate the interpreter program size */
-                void *interplow;
-                void *interphigh;
-                _elf32_calc_progbounds(&interpheader, interppht, &interplow, &interphigh);
                 uint32_t interpnpages = ADDR_TO_PN(PAGE_ALIGN_UP(interphigh)) - ADDR_TO_PN(interplow);
 
                 /* Find space for the interpreter */
@@ -622,35 +882,39 @@ static int _elf32_load(const char *filename, int fd, char *const argv[],
                 auxv->a_type = AT_NULL;
         }
 
-        /* Allocate a stack. We put the stack immediately below the program text.
-         * (in the Intel x86 ELF supplement pp 59 "example stack", that is where the
-         * stack is located). I suppose we can add this "extra page for magic data" too */
-        uint32_t stack_lopage = ADDR_TO_PN(proglow) - (DEFAULT_STACK_SIZE / PAGE_SIZE) - 1;
-        err = vmmap_map(map, NULL, stack_lopage, (DEFAULT_STACK_SIZE / PAGE_SIZE) + 1,
-                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, 0, 0, NULL);
-        KASSERT(0 == err);
-        dbg(DBG_ELF, "Mapped stack at low addr 0x%p, size %#x\n",
-            PN_TO_ADDR(stack_lopage), DEFAULT_STACK_SIZE + PAGE_SIZE);
-
-
         /* Copy out arguments onto the user stack */
         int argc, envc, auxc;
         size_t argsize = _elf32_calc_argsize(argv, envp, auxv, phtsize, &argc, &envc, &auxc);
         /* Make sure it fits on the stack */
-        if (argsize >= DEFAULT_STACK_SIZE) {
+        if (argsize >= USER_STACK_MAX) {
                 err = -E2BIG;
                 goto done;
         }
-        /* Copy arguments into kernel buffer */
-        if (NULL == (argbuf = (char *) kmalloc(argsize))) {
-                err = -ENOMEM;
-                goto done;
-        }
+
+        /* Allocate a stack. We put the stack immediately below the program text.
+         * (in the Intel x86 ELF supplement pp 59 "example stack", that is where the
+         * stack is located). I suppose we can add this "extra page for magic data" too.
+         * It starts just big enough for the arguments, or USER_STACK_INIT, and
+         * grows down on faults below it to USER_STACK_MAX (see vmmap_grow_down):
+         * the pages of its object below the ones it starts with are the room it
+         * has to grow into. */
+        uint32_t stack_npages = (uint32_t) PAGE_ALIGN_UP(MAX(argsize, USER_STACK_INIT))
+                                / PAGE_SIZE + 1;
+        uint32_t stack_maxpages = USER_STACK_MAX / PAGE_SIZE + 1;
+        uint32_t stack_lopage = ADDR_TO_PN(proglow) - stack_npages;
+        err = vmmap_map(map, NULL, stack_lopage, stack_npages,
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_GROWSDOWN,
+                        (off_t)(stack_maxpages - stack_npages) * PAGE_SIZE, 0, NULL);
+        KASSERT(0 == err);
+        dbg(DBG_ELF, "Mapped stack at low addr 0x%p, size %#x\n",
+            PN_TO_ADDR(stack_lopage), stack_npages * PAGE_SIZE);
+
         /* Calculate where in user space we start putting the args. */
         void *arglow = (void *)((uintptr_t)(((char *) proglow) - argsize) & ~PTR_MASK);
         /* Copy everything into the user address space, modifying addresses in
          * argv, envp, and auxv to be user addresses as we go. */
-        _elf32_load_args(map, arglow, argsize, argbuf, argv, envp, auxv, argc, envc, auxc, phtsize);
+        if (0 > (err = _elf32_load_args(map, arglow, argv, envp, auxv, argc, envc, auxc, phtsize)))
+                goto done;
 
         dbg(DBG_ELF, "Past the point of no return. Swapping to map at 0x%p, setting brk to 0x%p\n", map, proghigh);
         /* the final threshold / What warm unspoken secrets will we learn? / Beyond
@@ -666,6 +930,11 @@ static int _elf32_load(const char *filename, int fd, char *const argv[],
         /* Flush the process pagetables and TLB */
         pt_unmap_range(curproc->p_pagedir, USER_MEM_LOW, USER_MEM_HIGH);
         tlb_flush_all();
+        tlb_shootdown(curproc->p_pagedir, USER_MEM_LOW,
+                      (USER_MEM_HIGH - USER_MEM_LOW) >> PAGE_SHIFT);
+        /* Map the top of the stack, down to the return address below the
+         * arguments */
+        _elf32_prefault((char *) arglow - 4, (char *) arglow + argsize);
 
         /* Set the process break and starting break (immediately after the mapped-in
          * text/data/bss from the executable) */
@@ -706,17 +975,23 @@ done:
         if (NULL != interppht) {
                 kfree(interppht);
         }
+        if (NULL != interpinterpname) {
+                kfree(interpinterpname);
+        }
         if (NULL != auxv) {
                 kfree(auxv);
         }
-        if (NULL != argbuf) {
-                kfree(argbuf);
-        }
         return err;
 }
 
 static __attribute__((unused)) void elf32_init(void)
 {
+        int i;
+
+        list_init(&elf32_cache_lru);
+        for (i = 0; i < ELF32_CACHE_NENTRIES; i++)
+                list_insert_tail(&elf32_cache_lru, &elf32_cache[i].ec_link);
+        slab_register_shrinker(&elf32_cache_shrinker);
         binfmt_add("ELF32", _elf32_load);
 }
 init_func(elf32_init);
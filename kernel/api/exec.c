@@ -1,8 +1,19 @@
+#include "globals.h"
+#include "errno.h"
+
 #include "util/debug.h"
 
 #include "main/interrupt.h"
 #include "main/gdt.h"
 
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
+#include "fs/file.h"
+
+#include "vm/vmmap.h"
+
 #include "api/exec.h"
 #include "api/binfmt.h"
 #include "api/syscall.h"
@@ -48,12 +59,11 @@ int do_execve(const char *filename, char *const *argv, char *const *envp, struct
         return 0;
 }
 
-void kernel_execve(const char *filename, char *const *argv, char *const *envp)
+/* Enters userland at eip with the stack at esp, with every other register
+ * zeroed. Does not return. */
+static void
+userland_start(uint32_t eip, uint32_t esp)
 {
-        uint32_t eip, esp;
-        int ret = binfmt_load(filename, argv, envp, &eip, &esp);
-        KASSERT(0 == ret); /* Should never fail to load the first binary */
-
         dbg(DBG_EXEC, "Entering userland with eip %#08x, esp %#08x\n", eip, esp);
 
         /* To enter userland, we build a set of saved registers to "trick" the processor
@@ -95,3 +105,108 @@ void kernel_execve(const char *filename, char *const *argv, char *const *envp)
         regs.r_esp = 0;
         userland_entry(&regs);
 }
+
+void kernel_execve(const char *filename, char *const *argv, char *const *envp)
+{
+        uint32_t eip, esp;
+        int ret = binfmt_load(filename, argv, envp, &eip, &esp);
+        KASSERT(0 == ret); /* Should never fail to load the first binary */
+
+        userland_start(eip, esp);
+}
+
+/* What a spawning process tells the child it creates, and learns back */
+typedef struct spawn {
+        const char      *sp_filename;
+        char *const     *sp_argv;
+        char *const     *sp_envp;
+        int              sp_ret;        /* what binfmt_load returned */
+        int              sp_done;       /* set once sp_ret is */
+        ktqueue_t        sp_waitq;      /* the parent waits here */
+} spawn_t;
+
+/* The first thread of a spawned process: loads the binary into the (empty)
+ * address space and enters it, or exits if it could not be loaded */
+static void *
+spawn_start(int arg1, void *arg2)
+{
+        spawn_t *sp = (spawn_t *) arg2;
+        uint32_t eip, esp;
+        int ret;
+
+        ret = binfmt_load(sp->sp_filename, sp->sp_argv, sp->sp_envp, &eip, &esp);
+
+        /* sp lives on the parent's stack, and must not be touched once the
+         * parent has been woken up */
+        sp->sp_ret = ret;
+        sp->sp_done = 1;
+        sched_broadcast_on(&sp->sp_waitq);
+
+        if (0 > ret)
+                do_exit(-ret);
+        userland_start(eip, esp);
+        return NULL;
+}
+
+/*
+ * Creates a child process running the given binary, without ever copying
+ * the caller's address space the way fork followed by execve does: the
+ * child starts out with an empty address space, the caller's open files
+ * and its working directory, and loads the binary itself before it first
+ * enters userland. The caller waits until the binary has been loaded, so
+ * that a failure to load it is reported here.
+ *
+ * Returns the pid of the child, or -errno if it could not be created or
+ * the binary could not be loaded (in which case the child is reaped).
+ */
+int
+do_spawn(const char *filename, char *const *argv, char *const *envp)
+{
+        spawn_t sp;
+        proc_t *p;
+        kthread_t *thr;
+        vmmap_t *map;
+        int fd, status;
+
+        /* binfmt_load replaces (and destroys) the old address space, so
+         * the child must have one, even if it is empty */
+        if (NULL == (map = vmmap_create()))
+                return -ENOMEM;
+        if (NULL == (p = proc_create((char *) filename))) {
+                vmmap_destroy(map);
+                return -ENOMEM;
+        }
+        if (NULL == p->p_vmmap) {
+                p->p_vmmap = map;
+                map->vmm_proc = p;
+        } else {
+                vmmap_destroy(map);
+        }
+
+        for (fd = 0; fd < NFILES; fd++) {
+                if (NULL != (p->p_files[fd] = curproc->p_files[fd]))
+                        fref(p->p_files[fd]);
+        }
+
+        sp.sp_filename = filename;
+        sp.sp_argv = argv;
+        sp.sp_envp = envp;
+        sp.sp_ret = 0;
+        sp.sp_done = 0;
+        sched_queue_init(&sp.sp_waitq);
+
+        /* as with the other threads created outside of fork, there is no
+         * way to take back a process which has no thread yet */
+        thr = kthread_create(p, spawn_start, 0, &sp);
+        KASSERT(NULL != thr);
+        sched_make_runnable(thr);
+
+        while (!sp.sp_done)
+                sched_sleep_on(&sp.sp_waitq);
+
+        if (0 > sp.sp_ret) {
+                do_waitpid(p->p_pid, 0, &status);
+                return sp.sp_ret;
+        }
+        return p->p_pid;
+}
@@ -2,16 +2,23 @@
 #include "globals.h"
 #include "errno.h"
 #include "types.h"
+#include "limits.h"
 
 #include "main/interrupt.h"
+#include "main/cpuid.h"
 
 #include "proc/proc.h"
 #include "proc/kthread.h"
+#include "proc/futex.h"
 
 #include "util/init.h"
+#include "util/math.h"
 #include "util/string.h"
 #include "util/debug.h"
+#include "util/printf.h"
 #include "util/list.h"
+#include "util/time.h"
+#include "util/timer.h"
 
 #include "mm/mman.h"
 #include "mm/mm.h"
@@ -19,7 +26,12 @@
 #include "mm/pframe.h"
 #include "mm/kmalloc.h"
 
+#include "fs/aio.h"
+#include "fs/shm.h"
+#include "fs/vfs.h"
 #include "fs/vfs_syscall.h"
+#include "fs/poll.h"
+#include "fs/uio.h"
 #include "fs/vnode.h"
 
 #include "test/kshell/kshell.h"
@@ -27,14 +39,48 @@
 #include "vm/brk.h"
 #include "vm/mmap.h"
 #include "vm/vmmap.h"
+#include "vm/pagefault.h"
 
 #include "api/syscall.h"
 #include "api/utsname.h"
 #include "api/access.h"
 #include "api/exec.h"
+#include "api/resource.h"
+#include "api/time.h"
+#include "api/trace.h"
+
+typedef struct syscall {
+        const char *sc_name;
+        int         sc_nargs;   /* how many arguments userland passes */
+        int       (*sc_func)(uint32_t args, regs_t *regs);
+        int         sc_flags;
+} syscall_t;
+
+/* Syscalls which do not return, or need the caller's registers, and so
+ * cannot be made from a batch */
+#define SC_NOBATCH 0x1
+
+/* The table covers SYS_syscall up to SYS_futex, then the two over
+ * 9000 */
+#define SYSCALL_NLOW            (SYS_shm_unlink + 1)
+#define SYSCALL_NHIGH           (SYS_dbgmodes - SYS_debug + 1)
+#define SYSCALL_HIGH(sysnum)    (SYSCALL_NLOW + (sysnum) - SYS_debug)
+
+/* How often each syscall is made, and how long it takes in cycles,
+ * sleeping included; ss_hist[i] counts the calls of 2^i to 2^(i+1)-1
+ * cycles. Only kept while syscall_stats_on. */
+#define SYSCALL_HIST_BUCKETS 32
+
+typedef struct syscall_stats {
+        uint32_t ss_count;
+        uint64_t ss_total;
+        uint32_t ss_hist[SYSCALL_HIST_BUCKETS];
+} syscall_stats_t;
+
+static syscall_stats_t syscall_stats[SYSCALL_NLOW + SYSCALL_NHIGH];
+static int syscall_stats_on = 0;
 
 static void syscall_handler(regs_t *regs);
-static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs);
 
 static __attribute__((unused)) void syscall_init(void)
 {
@@ -71,21 +117,195 @@ sys_write(write_args_t *arg)
 }
 
 /*
- * This is another tricly sys_* function that you will need to write.
- * It's pretty similar to sys_read(), but you don't need
- * to allocate a whole page, just a single dirent_t. call do_getdents in a
- * loop until you have read getdent_args_t->count bytes (or an error
- * occurs).  You should note that count is the number of bytes in the
- * buffer, not the number of dirents, which means that you'll need to loop
- * a max of something like count / sizeof(dirent_t) times.
+ * Reads as many whole dirents as fit in getdents_args_t->count bytes (a
+ * page's worth at most) with one call to do_getdents(), which asks the
+ * file system for all of them at once. Returns the number of bytes read.
  */
 static int
 sys_getdents(getdents_args_t *arg)
 {
-        NOT_YET_IMPLEMENTED("VM: sys_getdents");
+        getdents_args_t kargs;
+        dirent_t *dirs;
+        int count, ret, err;
+
+        if ((err = copy_from_user(&kargs, arg, sizeof(kargs))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        if (0 == (count = MIN(kargs.count, PAGE_SIZE) / sizeof(dirent_t))) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+        if (NULL == (dirs = page_alloc())) {
+                curthr->kt_errno = ENOMEM;
+                return -1;
+        }
+
+        if (0 < (ret = do_getdents(kargs.fd, dirs, count))) {
+                if ((err = copy_to_user(kargs.dirp, dirs, ret * sizeof(dirent_t))) < 0)
+                        ret = err;
+                else
+                        ret *= sizeof(dirent_t);
+        }
+        page_free(dirs);
+
+        if (0 > ret) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+/* The most bytes sys_rw_iov moves per call into the file system */
+#define SYS_IOV_BUFSIZE (4 * PAGE_SIZE)
+
+/*
+ * Shared by readv, writev, preadv, pwritev, pread and pwrite: moves data
+ * between the user buffers described by the (kernel) vector iov and file
+ * descriptor fd, at off if positional or else at the file position.
+ *
+ * The vector is gathered into (or scattered from) one kernel buffer with
+ * copy_from_user and copy_to_user, which fault the user's pages in as
+ * they go and fail on the first bad one, so the file system sees a
+ * single read or write of up to SYS_IOV_BUFSIZE bytes, taking its vnode
+ * lock once, instead of one per segment. Larger vectors are moved in
+ * several such pieces, stopping at the first short transfer.
+ *
+ * Returns the number of bytes moved, or -errno if nothing was.
+ */
+static int
+sys_rw_iov(int fd, struct iovec *iov, int iovcnt, off_t off, int positional,
+           int write)
+{
+        size_t total = 0, done = 0;
+        int i, seg = 0, ret = 0;
+        size_t segoff = 0;
+        char *buf;
+
+        /* the count is returned as an int */
+        for (i = 0; i < iovcnt; i++) {
+                if (iov[i].iov_len > (size_t) INT_MAX - total)
+                        return -EINVAL;
+                total += iov[i].iov_len;
+        }
+        if (positional && 0 > off)
+                return -EINVAL;
+
+        if (NULL == (buf = kmalloc(MAX(MIN(total, SYS_IOV_BUFSIZE), 1))))
+                return -ENOMEM;
+
+        do {
+                size_t n = MIN(total - done, SYS_IOV_BUFSIZE);
+                size_t copied;
+
+                if (write) {
+                        for (copied = 0; copied < n; segoff = 0, seg++) {
+                                size_t len = MIN(n - copied, iov[seg].iov_len - segoff);
+
+                                if (0 > (ret = copy_from_user(buf + copied,
+                                                              (char *) iov[seg].iov_base + segoff,
+                                                              len)))
+                                        goto out;
+                                copied += len;
+                                if (segoff + len < iov[seg].iov_len) {
+                                        segoff += len;
+                                        break;
+                                }
+                        }
+                        ret = positional ? do_pwrite(fd, buf, n, off + done)
+                              : do_write(fd, buf, n);
+                        if (0 >= ret)
+                                break;
+                } else {
+                        ret = positional ? do_pread(fd, buf, n, off + done)
+                              : do_read(fd, buf, n);
+                        if (0 >= ret)
+                                break;
+                        for (copied = 0; copied < (size_t) ret; segoff = 0, seg++) {
+                                size_t len = MIN((size_t) ret - copied,
+                                                 iov[seg].iov_len - segoff);
+                                int err;
+
+                                if (0 > (err = copy_to_user((char *) iov[seg].iov_base + segoff,
+                                                            buf + copied, len))) {
+                                        ret = err;
+                                        goto out;
+                                }
+                                copied += len;
+                                if (segoff + len < iov[seg].iov_len) {
+                                        segoff += len;
+                                        break;
+                                }
+                        }
+                }
+                done += ret;
+                if ((size_t) ret < n)
+                        break;
+        } while (done < total);
+
+out:
+        kfree(buf);
+        return (0 < done) ? (int) done : ret;
+}
+
+/* readv(2), writev(2), preadv(2) and pwritev(2) */
+static int
+sys_iov(iov_args_t *arg, int positional, int write)
+{
+        iov_args_t kern_args;
+        struct iovec *iov = NULL;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0)
+                goto err;
+        if (0 > kern_args.iovcnt || UIO_MAXIOV < kern_args.iovcnt) {
+                ret = -EINVAL;
+                goto err;
+        }
+        if (NULL == (iov = kmalloc(MAX(kern_args.iovcnt, 1) * sizeof(struct iovec)))) {
+                ret = -ENOMEM;
+                goto err;
+        }
+        if ((ret = copy_from_user(iov, kern_args.iov,
+                                  kern_args.iovcnt * sizeof(struct iovec))) < 0)
+                goto err;
+
+        if ((ret = sys_rw_iov(kern_args.fd, iov, kern_args.iovcnt, kern_args.off,
+                              positional, write)) < 0)
+                goto err;
+
+        kfree(iov);
+        return ret;
+
+err:
+        if (NULL != iov)
+                kfree(iov);
+        curthr->kt_errno = -ret;
         return -1;
 }
 
+/* pread(2) and pwrite(2) */
+static int
+sys_prw(pread_args_t *arg, int write)
+{
+        pread_args_t kern_args;
+        struct iovec iov;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        iov.iov_base = kern_args.buf;
+        iov.iov_len = kern_args.nbytes;
+        if ((ret = sys_rw_iov(kern_args.fd, &iov, 1, kern_args.off, 1, write)) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
 #ifdef __MOUNTING__
 static int sys_mount(mount_args_t *arg)
 {
@@ -101,22 +321,22 @@ static int sys_mount(mount_args_t *arg)
         }
 
         /* null is okay only for the source */
-        source = user_strdup(&kern_args.spec);
-        if (NULL == (target = user_strdup(&kern_args.dir))) {
-                kfree(source);
+        source = user_path(&kern_args.spec);
+        if (NULL == (target = user_path(&kern_args.dir))) {
+                user_path_free(source);
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
         if (NULL == (type = user_strdup(&kern_args.fstype))) {
-                kfree(source);
-                kfree(target);
+                user_path_free(source);
+                user_path_free(target);
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
 
         ret = do_mount(source, target, type);
-        kfree(source);
-        kfree(target);
+        user_path_free(source);
+        user_path_free(target);
         kfree(type);
 
         if (ret) {
@@ -138,13 +358,13 @@ static int sys_umount(argstr_t *input)
                 return -1;
         }
 
-        if (NULL == (target = user_strdup(&kstr))) {
+        if (NULL == (target = user_path(&kstr))) {
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
 
         ret = do_umount(target);
-        kfree(target);
+        user_path_free(target);
 
         if (ret) {
                 curthr->kt_errno = -ret;
@@ -203,14 +423,14 @@ static int sys_mkdir(mkdir_args_t *arg)
                 return -1;
         }
 
-        path = user_strdup(&kern_args.path);
+        path = user_path(&kern_args.path);
         if (!path) {
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
 
         err = do_mkdir(path);
-        kfree(path);
+        user_path_free(path);
         if (err < 0) {
                 curthr->kt_errno = -err;
                 return -1;
@@ -227,7 +447,7 @@ static int sys_rmdir(argstr_t *arg)
                 curthr->kt_errno = -err;
                 return -1;
         }
-        path = user_strdup(&kern_args);
+        path = user_path(&kern_args);
 
         if (!path) {
                 curthr->kt_errno = EINVAL;
@@ -235,7 +455,7 @@ static int sys_rmdir(argstr_t *arg)
         }
 
         err = do_rmdir(path);
-        kfree(path);
+        user_path_free(path);
         if (err < 0) {
                 curthr->kt_errno = -err;
                 return -1;
@@ -253,14 +473,39 @@ static int sys_unlink(argstr_t *arg)
                 return -1;
         }
 
-        path = user_strdup(&kern_args);
+        path = user_path(&kern_args);
         if (!path) {
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
 
         err = do_unlink(path);
-        kfree(path);
+        user_path_free(path);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
+static int sys_unlinkat(unlinkat_args_t *arg)
+{
+        unlinkat_args_t         kern_args;
+        char                    *path;
+        int                     err;
+
+        if ((err = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        path = user_path(&kern_args.path);
+        if (!path) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        err = do_unlinkat(kern_args.dirfd, path, kern_args.flags);
+        user_path_free(path);
         if (err < 0) {
                 curthr->kt_errno = -err;
                 return -1;
@@ -279,22 +524,22 @@ static int sys_link(link_args_t *arg)
                 return -1;
         }
 
-        to = user_strdup(&kern_args.to);
+        to = user_path(&kern_args.to);
         if (!to) {
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
 
-        from = user_strdup(&kern_args.from);
+        from = user_path(&kern_args.from);
         if (!from) {
                 curthr->kt_errno = EINVAL;
-                kfree(to);
+                user_path_free(to);
                 return -1;
         }
 
         err = do_link(from, to);
-        kfree(to);
-        kfree(from);
+        user_path_free(to);
+        user_path_free(from);
 
         if (err < 0) {
                 curthr->kt_errno = -err;
@@ -316,22 +561,22 @@ static int sys_rename(rename_args_t *arg)
                 return -1;
         }
 
-        oldname = user_strdup(&kern_args.oldname);
+        oldname = user_path(&kern_args.oldname);
         if (!oldname) {
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
 
-        newname = user_strdup(&kern_args.newname);
+        newname = user_path(&kern_args.newname);
         if (!newname) {
                 curthr->kt_errno = EINVAL;
-                kfree(oldname);
+                user_path_free(oldname);
                 return -1;
         }
 
         err = do_rename(oldname, newname);
-        kfree(newname);
-        kfree(oldname);
+        user_path_free(newname);
+        user_path_free(oldname);
 
         if (err < 0) {
                 curthr->kt_errno = -err;
@@ -350,14 +595,14 @@ static int sys_chdir(argstr_t *arg)
                 return -1;
         }
 
-        path = user_strdup(&kern_args);
+        path = user_path(&kern_args);
         if (!path) {
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
 
         err = do_chdir(path);
-        kfree(path);
+        user_path_free(path);
 
         if (err < 0) {
                 curthr->kt_errno = -err;
@@ -394,14 +639,39 @@ static int sys_open(open_args_t *arg)
                 return -1;
         }
 
-        path = user_strdup(&kern_args.filename);
+        path = user_path(&kern_args.filename);
         if (!path) {
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
 
         err = do_open(path, kern_args.flags);
-        kfree(path);
+        user_path_free(path);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
+static int sys_openat(openat_args_t *arg)
+{
+        openat_args_t           kern_args;
+        char                    *path;
+        int                     err;
+
+        if ((err = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        path = user_path(&kern_args.filename);
+        if (!path) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        err = do_openat(kern_args.dirfd, path, kern_args.flags);
+        user_path_free(path);
         if (err < 0) {
                 curthr->kt_errno = -err;
                 return -1;
@@ -426,419 +696,1564 @@ static int sys_munmap(munmap_args_t *args)
         return 0;
 }
 
-static void *sys_mmap(mmap_args_t *arg)
+/* mlock(2) if lock is set, munlock(2) otherwise */
+static int sys_mlock(mlock_args_t *args, int lock)
 {
-        mmap_args_t             kargs;
-        void                    *ret;
+        mlock_args_t            kargs;
         int                     err;
 
-        if (copy_from_user(&kargs, arg, sizeof(mmap_args_t)) < 0) {
+        if (copy_from_user(&kargs, args, sizeof(mlock_args_t))) {
                 curthr->kt_errno = EFAULT;
-                return MAP_FAILED;
+                return -1;
         }
 
-        err = do_mmap(kargs.mma_addr, kargs.mma_len, kargs.mma_prot,
-                      kargs.mma_flags, kargs.mma_fd, kargs.mma_off, &ret);
+        err = do_mlock(kargs.addr, kargs.len, lock);
         if (err < 0) {
                 curthr->kt_errno = -err;
-                return MAP_FAILED;
+                return -1;
         }
-        return ret;
+        return 0;
 }
 
-
-static pid_t sys_waitpid(waitpid_args_t *args)
+static int sys_madvise(madvise_args_t *args)
 {
-        int s, p;
-        waitpid_args_t kargs;
+        madvise_args_t          kargs;
+        int                     err;
 
-        if (0 > copy_from_user(&kargs, args, sizeof(kargs))) {
+        if (copy_from_user(&kargs, args, sizeof(madvise_args_t))) {
                 curthr->kt_errno = EFAULT;
                 return -1;
         }
 
-        if (0 > (p = do_waitpid(kargs.wpa_pid, kargs.wpa_options, &s))) {
-                curthr->kt_errno = -p;
+        err = do_madvise(kargs.addr, kargs.len, kargs.advice);
+        if (err < 0) {
+                curthr->kt_errno = -err;
                 return -1;
         }
+        return 0;
+}
 
-        if (NULL != kargs.wpa_status && 0 > copy_to_user(kargs.wpa_status, &s, sizeof(int))) {
-                curthr->kt_errno = EFAULT;
-                return -1;
-        }
+/* nice(2): makes every thread of the process inc nicer, returning the
+ * calling thread's new niceness */
+static int sys_nice(int inc)
+{
+        kthread_t *thr;
+        int ret = 0;
 
-        return p;
+        list_iterate_begin(&curproc->p_threads, thr, kthread_t, kt_plink) {
+                if (thr == curthr)
+                        ret = sched_nice(thr, inc);
+                else
+                        sched_nice(thr, inc);
+        } list_iterate_end();
+        return ret;
 }
 
-static void *sys_brk(void *addr)
+/* The process a scheduling syscall's pid names: 0 for the caller's */
+static proc_t *sched_syscall_proc(pid_t pid)
 {
-        void *ret;
+        if (0 == pid)
+                return curproc;
+        if (pid < 0)
+                return NULL;
+        return proc_lookup(pid);
+}
+
+/* sched_setaffinity(2): restricts every thread of a process to the
+ * processors in the mask */
+static int sys_sched_setaffinity(sched_setaffinity_args_t *args)
+{
+        sched_setaffinity_args_t kargs;
+        kthread_t *thr;
+        proc_t *p;
         int err;
 
-        if (0 == (err = do_brk(addr, &ret))) {
-                return ret;
-        } else {
+        if ((err = copy_from_user(&kargs, args, sizeof(kargs))) < 0) {
                 curthr->kt_errno = -err;
-                return (void *) - 1;
+                return -1;
+        }
+        if (NULL == (p = sched_syscall_proc(kargs.pid))) {
+                curthr->kt_errno = ESRCH;
+                return -1;
+        }
+        if (!sched_affinity_valid(kargs.mask)) {
+                curthr->kt_errno = EINVAL;
+                return -1;
         }
+        list_iterate_begin(&p->p_threads, thr, kthread_t, kt_plink) {
+                sched_setaffinity(thr, kargs.mask);
+        } list_iterate_end();
+        return 0;
 }
 
-static void sys_sync(void)
+/* sched_getaffinity(2): the processors a process may run on (those of
+ * its first thread) */
+static int sys_sched_getaffinity(sched_getaffinity_args_t *args)
 {
-        pframe_clean_all();
-}
+        sched_getaffinity_args_t kargs;
+        uint32_t mask;
+        proc_t *p;
+        int err;
 
-static void sys_halt(void)
-{
-        proc_kill_all();
+        if ((err = copy_from_user(&kargs, args, sizeof(kargs))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        if (NULL == (p = sched_syscall_proc(kargs.pid)) || list_empty(&p->p_threads)) {
+                curthr->kt_errno = ESRCH;
+                return -1;
+        }
+        mask = sched_getaffinity(list_head(&p->p_threads, kthread_t, kt_plink));
+        if ((err = copy_to_user(kargs.mask, &mask, sizeof(mask))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
 }
 
-static int sys_stat(stat_args_t *arg)
+/* poll(2), the pollfds being copied in and their revents back out */
+static int sys_poll(poll_args_t *args)
 {
-        stat_args_t kern_args;
-        struct stat buf;
-        char *path;
-        int ret;
+        poll_args_t kargs;
+        struct pollfd *fds = NULL;
+        size_t len;
+        int err, n = 0;
 
-        if (copy_from_user(&kern_args, arg, sizeof(kern_args)) < 0) {
-                curthr->kt_errno = EFAULT;
+        if ((err = copy_from_user(&kargs, args, sizeof(kargs))) < 0) {
+                curthr->kt_errno = -err;
                 return -1;
         }
-
-        if ((path = user_strdup(&kern_args.path)) == NULL) {
+        if (NFILES < kargs.nfds) {
                 curthr->kt_errno = EINVAL;
                 return -1;
         }
-
-        ret = do_stat(path, &buf);
-
-        if (ret == 0) {
-                ret = copy_to_user(kern_args.buf, &buf, sizeof(struct stat));
+        len = kargs.nfds * sizeof(struct pollfd);
+        if (0 < len) {
+                if (NULL == (fds = kmalloc(len))) {
+                        curthr->kt_errno = ENOMEM;
+                        return -1;
+                }
+                if ((err = copy_from_user(fds, kargs.fds, len)) < 0)
+                        goto out;
         }
-
-        if (ret != 0) {
-                kfree(path);
-                curthr->kt_errno = -ret;
+        if ((n = err = do_poll(fds, kargs.nfds, kargs.timeout)) < 0)
+                goto out;
+        if (0 < len)
+                err = copy_to_user(kargs.fds, fds, len);
+out:
+        if (NULL != fds)
+                kfree(fds);
+        if (err < 0) {
+                curthr->kt_errno = -err;
                 return -1;
         }
-
-        kfree(path);
-        return 0;
+        return n;
 }
 
-static int sys_pipe(int arg[2])
+/* aio_setup, aio_read, aio_write, aio_error and aio_return, each of
+ * which passes its aiocb straight through */
+static int sys_aio(int sysnum, const struct aiocb *cb)
 {
-        int kern_args[2];
         int ret;
-        
-        ret = do_pipe(kern_args);
 
-        if (ret == 0) {
-                ret = copy_to_user(arg, kern_args, sizeof(kern_args));
+        switch (sysnum) {
+                case SYS_aio_setup:
+                        ret = do_aio_setup();
+                        break;
+                case SYS_aio_read:
+                        ret = do_aio_read(cb);
+                        break;
+                case SYS_aio_write:
+                        ret = do_aio_write(cb);
+                        break;
+                case SYS_aio_error:
+                        ret = do_aio_error(cb);
+                        break;
+                default:
+                        ret = do_aio_return(cb);
+                        break;
         }
-
-        if (ret != 0) {
+        if (ret < 0) {
                 curthr->kt_errno = -ret;
                 return -1;
         }
-        
-        return 0;
+        return ret;
 }
 
-static int sys_uname(struct utsname *arg)
+/* getrusage(2), which only knows about page faults */
+static int sys_getrusage(getrusage_args_t *args)
 {
-        static const char sysname[] = "Weenix";
-        static const char release[] = "1.2";
-        /* Version = last compilation time */
-        static const char version[] = "#1 " __DATE__ " " __TIME__;
-        static const char nodename[] = "";
-        static const char machine[] = "";
-        int ret = 0;
+        getrusage_args_t        kargs;
+        struct rusage           ru;
+        pagefault_stats_t      *stats;
+        int                     err;
 
-        ret = copy_to_user(arg->sysname, sysname, sizeof(sysname));
-        if (ret != 0) {
-                goto err;
-        }
-        ret = copy_to_user(arg->release, release, sizeof(release));
-        if (ret != 0) {
-                goto err;
-        }
-        ret = copy_to_user(arg->version, version, sizeof(version));
-        if (ret != 0) {
-                goto err;
-        }
-        ret = copy_to_user(arg->nodename, nodename, sizeof(nodename));
-        if (ret != 0) {
-                goto err;
+        if ((err = copy_from_user(&kargs, args, sizeof(kargs))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
         }
-        ret = copy_to_user(arg->machine, machine, sizeof(machine));
-        if (ret != 0) {
-                goto err;
+        if (RUSAGE_SELF != kargs.who) {
+                curthr->kt_errno = EINVAL;
+                return -1;
         }
-        return 0;
-err:
-        curthr->kt_errno = -ret;
-        return -1;
-}
 
-static int sys_fork(regs_t *regs)
-{
-        int ret = do_fork(regs);
-        if (ret < 0) {
-                curthr->kt_errno = -ret;
+        stats = &curproc->p_vmmap->vmm_faults;
+        memset(&ru, 0, sizeof(ru));
+        ru.ru_minflt = stats->pfs_count[PAGEFAULT_MINOR];
+        ru.ru_majflt = stats->pfs_count[PAGEFAULT_MAJOR];
+        ru.ru_cowflt = stats->pfs_count[PAGEFAULT_COW];
+        ru.ru_zeroflt = stats->pfs_count[PAGEFAULT_ZERO];
+        ru.ru_minflt_cycles = stats->pfs_cycles[PAGEFAULT_MINOR];
+        ru.ru_majflt_cycles = stats->pfs_cycles[PAGEFAULT_MAJOR];
+        ru.ru_cowflt_cycles = stats->pfs_cycles[PAGEFAULT_COW];
+        ru.ru_zeroflt_cycles = stats->pfs_cycles[PAGEFAULT_ZERO];
+
+        if ((err = copy_to_user(kargs.usage, &ru, sizeof(ru))) < 0) {
+                curthr->kt_errno = -err;
                 return -1;
         }
-        return ret;
+        return 0;
 }
 
-static void free_vector(char **vect)
+/* The clock ticks to sleep for a (valid, non-zero) time: plus one, as
+ * the first tick may be about to happen, and no more than timers can
+ * count (which is most of a year) */
+static uint32_t timespec_to_ticks(const struct timespec *ts)
 {
-        char **temp;
-        for (temp = vect; *temp; temp++)
-                kfree(*temp);
-        kfree(vect);
+        if (ts->tv_sec >= 0x7fffffff / (1000 / TICK_MSECS) - 2)
+                return 0x7fffffff - (1000 / TICK_MSECS);
+        return ts->tv_sec * (1000 / TICK_MSECS)
+               + MSECS_TO_TICKS((ts->tv_nsec + 999999) / 1000000) + 1;
 }
 
-static int sys_execve(execve_args_t *args, regs_t *regs)
+/* nanosleep(2), to the nearest clock tick (rounded up) */
+static int sys_nanosleep(nanosleep_args_t *args)
 {
-        execve_args_t kern_args;
-        char *kern_filename = NULL;
-        char **kern_argv = NULL;
-        char **kern_envp = NULL;
-        int err;
+        nanosleep_args_t        kargs;
+        struct timespec         req, rem;
+        ktqueue_t               q;
+        uint32_t                ticks, deadline, left;
+        int                     err;
 
-        if ((err = copy_from_user(&kern_args, args, sizeof(kern_args))) < 0) {
+        if ((err = copy_from_user(&kargs, args, sizeof(kargs))) < 0
+            || (err = copy_from_user(&req, kargs.req, sizeof(req))) < 0) {
                 curthr->kt_errno = -err;
-                goto cleanup;
+                return -1;
         }
-
-        /* copy the name of the executable */
-        if ((kern_filename = user_strdup(&kern_args.filename)) == NULL)
-                goto cleanup;
-
-        /* copy the argument list */
-        if (kern_args.argv.av_vec) {
-                if ((kern_argv = user_vecdup(&kern_args.argv)) == NULL)
-                        goto cleanup;
+        if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+                curthr->kt_errno = EINVAL;
+                return -1;
         }
-
-        /* copy the environment list */
-        if (kern_args.envp.av_vec) {
-                if ((kern_envp = user_vecdup(&kern_args.envp)) == NULL)
-                        goto cleanup;
+        if (0 == req.tv_sec && 0 == req.tv_nsec)
+                return 0;
+
+        ticks = timespec_to_ticks(&req);
+        deadline = jiffies + ticks;
+
+        sched_queue_init(&q);
+        if (-EINTR == sched_cancellable_sleep_on_timeout(&q, ticks)) {
+                if (NULL != kargs.rem) {
+                        left = deadline - jiffies;
+                        if ((int32_t) left < 0)
+                                left = 0;
+                        rem.tv_sec = left / (1000 / TICK_MSECS);
+                        rem.tv_nsec = (left % (1000 / TICK_MSECS)) * TICK_MSECS * 1000000;
+                        if ((err = copy_to_user(kargs.rem, &rem, sizeof(rem))) < 0) {
+                                curthr->kt_errno = -err;
+                                return -1;
+                        }
+                }
+                curthr->kt_errno = EINTR;
+                return -1;
         }
+        return 0;
+}
 
-        err = do_execve(kern_filename, kern_argv, kern_envp, regs);
-
-        curthr->kt_errno = -err;
+/* futex(2); the timeout is relative, to the nearest tick */
+static int sys_futex(futex_args_t *args)
+{
+        futex_args_t            kargs;
+        struct timespec         ts;
+        uint32_t                ticks = 0;
+        int                     err;
 
-cleanup:
-        if (kern_filename)
-                kfree(kern_filename);
-        if (kern_argv)
-                free_vector(kern_argv);
-        if (kern_envp)
-                free_vector(kern_envp);
-        if (curthr->kt_errno)
+        if ((err = copy_from_user(&kargs, args, sizeof(kargs))) < 0) {
+                curthr->kt_errno = -err;
                 return -1;
-        return 0;
+        }
+        switch (kargs.op) {
+                case FUTEX_WAIT:
+                        if (NULL != kargs.timeout) {
+                                if ((err = copy_from_user(&ts, kargs.timeout, sizeof(ts))) < 0) {
+                                        curthr->kt_errno = -err;
+                                        return -1;
+                                }
+                                if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+                                        curthr->kt_errno = EINVAL;
+                                        return -1;
+                                }
+                                if (0 == ts.tv_sec && 0 == ts.tv_nsec) {
+                                        curthr->kt_errno = ETIMEDOUT;
+                                        return -1;
+                                }
+                                ticks = timespec_to_ticks(&ts);
+                        }
+                        err = futex_wait(curproc->p_vmmap, kargs.uaddr, kargs.val, ticks);
+                        break;
+                case FUTEX_WAKE:
+                        err = futex_wake(curproc->p_vmmap, kargs.uaddr, (int)kargs.val);
+                        break;
+                default:
+                        err = -EINVAL;
+                        break;
+        }
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return err;
 }
 
-static int sys_debug(argstr_t *arg)
+/* aio_suspend(3), to the nearest clock tick (rounded up) */
+static int sys_aio_suspend(aio_suspend_args_t *args)
 {
-        argstr_t kern_args;
-        int      err;
-        char    *message;
+        aio_suspend_args_t      kargs;
+        const struct aiocb    **list = NULL;
+        struct timespec         ts;
+        int                     ticks = -1;
+        int                     err;
 
-        if ((err = copy_from_user(&kern_args, arg, sizeof(argstr_t))) < 0) {
+        if ((err = copy_from_user(&kargs, args, sizeof(kargs))) < 0)
+                goto fail;
+        if (0 > kargs.nent || AIO_MAX_REQS < kargs.nent) {
+                err = -EINVAL;
+                goto fail;
+        }
+        if (NULL != kargs.timeout) {
+                if ((err = copy_from_user(&ts, kargs.timeout, sizeof(ts))) < 0)
+                        goto fail;
+                if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+                        err = -EINVAL;
+                        goto fail;
+                }
+                ticks = (0 == ts.tv_sec && 0 == ts.tv_nsec) ? 0 : (int) timespec_to_ticks(&ts);
+        }
+        if (0 < kargs.nent) {
+                if (NULL == (list = kmalloc(kargs.nent * sizeof(*list)))) {
+                        err = -ENOMEM;
+                        goto fail;
+                }
+                if ((err = copy_from_user(list, kargs.list, kargs.nent * sizeof(*list))) < 0)
+                        goto fail;
+        }
+        err = do_aio_suspend(list, kargs.nent, ticks);
+fail:
+        if (NULL != list)
+                kfree(list);
+        if (err < 0) {
                 curthr->kt_errno = -err;
                 return -1;
         }
-        message = user_strdup(&kern_args);
-        dbg(DBG_USER, "%s\n", message);
-
-        kfree(message);
         return 0;
 }
 
-static int sys_kshell(int ttyid)
+/* shm_open(3), whose mode is ignored as that of every file is */
+static int sys_shm_open(open_args_t *arg)
 {
-        kshell_t *ksh;
-        int       err;
+        open_args_t             kern_args;
+        char                    *name;
+        int                     err;
 
-        /* Create a kshell on tty */
-        ksh = kshell_create(ttyid);
-        if (NULL == ksh) {
-                curthr->kt_errno = ENODEV;
+        if ((err = copy_from_user(&kern_args, arg, sizeof(open_args_t))) < 0) {
+                curthr->kt_errno = -err;
                 return -1;
         }
 
-        while ((err = kshell_execute_next(ksh)) > 0);
-        kshell_destroy(ksh);
-        if (err < 0) {
-                curthr->kt_errno = -err;
+        name = user_path(&kern_args.filename);
+        if (!name) {
+                curthr->kt_errno = EINVAL;
                 return -1;
         }
 
-        return 0;
+        err = do_shm_open(name, kern_args.flags);
+        user_path_free(name);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
 }
 
-/* Interrupt handler for syscalls */
-static void syscall_handler(regs_t *regs)
+static int sys_shm_unlink(argstr_t *arg)
 {
+        argstr_t                kern_args;
+        char                    *name;
+        int                     err;
 
-        /* The syscall number and the (user-address) pointer to the arguments.
-         * Pushed by userland when we trap into the kernel */
-        uint32_t sysnum = (uint32_t) regs->r_eax;
-        uint32_t args = (uint32_t) regs->r_edx;
+        if ((err = copy_from_user(&kern_args, arg, sizeof(argstr_t))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
 
-        dbg(DBG_SYSCALL, ">> pid %d, sysnum: %d (%x), arg: %d (%#08x)\n",
-            curproc->p_pid, sysnum, sysnum, args, args);
+        name = user_path(&kern_args);
+        if (!name) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
 
-        if (curthr->kt_cancelled) {
-                dbg(DBG_SYSCALL, "trap: CANCELLING: thread %p of proc %d "
-                    "(0x%p)\n", curthr, curproc->p_pid, curproc);
+        err = do_shm_unlink(name);
+        user_path_free(name);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
 
-                kthread_exit(curthr->kt_retval);
+static void *sys_mmap(mmap_args_t *arg)
+{
+        mmap_args_t             kargs;
+        void                    *ret;
+        int                     err;
+
+        if (copy_from_user(&kargs, arg, sizeof(mmap_args_t)) < 0) {
+                curthr->kt_errno = EFAULT;
+                return MAP_FAILED;
         }
 
-        dbginfo(DBG_VMMAP, vmmap_mapping_info, curproc->p_vmmap);
+        err = do_mmap(kargs.mma_addr, kargs.mma_len, kargs.mma_prot,
+                      kargs.mma_flags, kargs.mma_fd, kargs.mma_off, &ret);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return MAP_FAILED;
+        }
+        return ret;
+}
 
-        int ret = syscall_dispatch(sysnum, args, regs);
 
-        if (curthr->kt_cancelled) {
-                dbg(DBG_SYSCALL, "trap: CANCELLING: thread %p of proc %d "
-                    "(%p)\n", curthr, curproc->p_pid, curproc);
+static pid_t sys_waitpid(waitpid_args_t *args)
+{
+        int s, p;
+        waitpid_args_t kargs;
 
-                kthread_exit(curthr->kt_retval);
+        if (0 > copy_from_user(&kargs, args, sizeof(kargs))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
         }
 
-        dbg(DBG_SYSCALL, "<< pid %d, sysnum: %d (%x), returned: %d (%#x)\n",
-            curproc->p_pid, sysnum, sysnum, ret, ret);
-        regs->r_eax = ret; /* Return value goes in eax */
-}
+        if (0 > (p = do_waitpid(kargs.wpa_pid, kargs.wpa_options, &s))) {
+                curthr->kt_errno = -p;
+                return -1;
+        }
 
-static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
-{
-        switch (sysnum) {
-                case SYS_waitpid:
-                        return sys_waitpid((waitpid_args_t *)args);
+        if (NULL != kargs.wpa_status && 0 > copy_to_user(kargs.wpa_status, &s, sizeof(int))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
 
-                case SYS_exit:
-                        do_exit((int)args);
-                        panic("exit failed!\n");
-                        return 0;
+        return p;
+}
 
-                case SYS_thr_exit:
-                        kthread_exit((void *)args);
-                        panic("thr_exit failed!\n");
-                        return 0;
+static void *sys_brk(void *addr)
+{
+        void *ret;
+        int err;
 
-                case SYS_thr_yield:
-                        sched_make_runnable(curthr);
-                        sched_switch();
-                        return 0;
+        if (0 == (err = do_brk(addr, &ret))) {
+                return ret;
+        } else {
+                curthr->kt_errno = -err;
+                return (void *) - 1;
+        }
+}
 
-                case SYS_fork:
-                        return sys_fork(regs);
+static void sys_sync(void)
+{
+#ifdef __VFS__
+        vfs_sync();
+#endif
+        pframe_clean_all();
+}
 
-                case SYS_getpid:
-                        return curproc->p_pid;
+static int sys_fsync(int fd, int datasync)
+{
+        int err;
 
-                case SYS_sync:
-                        sys_sync();
-                        return 0;
+        if ((err = do_fsync(fd, datasync)) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
 
-#ifdef __MOUNTING__
-                case SYS_mount:
-                        return sys_mount((mount_args_t *) args);
+static int sys_fadvise(fadvise_args_t *args)
+{
+        fadvise_args_t kargs;
+        int err;
 
-                case SYS_umount:
-                        return sys_umount((argstr_t *) args);
-#endif
+        if ((err = copy_from_user(&kargs, args, sizeof(kargs))) < 0
+            || (err = do_fadvise(kargs.fd, kargs.off, kargs.len, kargs.advice)) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
 
-                case SYS_mmap:
-                        return (int) sys_mmap((mmap_args_t *) args);
+/* sendfile(2): the offset, if there is one, is copied in and back out */
+static int sys_sendfile(sendfile_args_t *args)
+{
+        sendfile_args_t kargs;
+        off_t off;
+        int ret;
 
-                case SYS_munmap:
-                        return sys_munmap((munmap_args_t *) args);
+        if ((ret = copy_from_user(&kargs, args, sizeof(kargs))) < 0
+            || (NULL != kargs.off && (ret = copy_from_user(&off, kargs.off, sizeof(off))) < 0))
+                goto fail;
+        if ((ret = do_sendfile(kargs.out_fd, kargs.in_fd,
+                               (NULL != kargs.off) ? &off : NULL, kargs.count)) < 0)
+                goto fail;
+        if (NULL != kargs.off && 0 < ret) {
+                int err;
+
+                if ((err = copy_to_user(kargs.off, &off, sizeof(off))) < 0) {
+                        ret = err;
+                        goto fail;
+                }
+        }
+        return ret;
+fail:
+        curthr->kt_errno = -ret;
+        return -1;
+}
 
-                case SYS_open:
-                        return sys_open((open_args_t *) args);
+/* copy_file_range(2): likewise for both offsets */
+static int sys_copy_file_range(copy_file_range_args_t *args)
+{
+        copy_file_range_args_t kargs;
+        off_t offin, offout;
+        int ret;
 
-                case SYS_close:
-                        return sys_close((int)args);
+        if ((ret = copy_from_user(&kargs, args, sizeof(kargs))) < 0
+            || (NULL != kargs.off_in
+                && (ret = copy_from_user(&offin, kargs.off_in, sizeof(offin))) < 0)
+            || (NULL != kargs.off_out
+                && (ret = copy_from_user(&offout, kargs.off_out, sizeof(offout))) < 0))
+                goto fail;
+        if (0 != kargs.flags) {
+                ret = -EINVAL;
+                goto fail;
+        }
+        if ((ret = do_copy_file_range(kargs.fd_in, (NULL != kargs.off_in) ? &offin : NULL,
+                                      kargs.fd_out, (NULL != kargs.off_out) ? &offout : NULL,
+                                      kargs.len)) < 0)
+                goto fail;
+        if (0 < ret) {
+                int err = 0;
+
+                if ((NULL != kargs.off_in
+                     && (err = copy_to_user(kargs.off_in, &offin, sizeof(offin))) < 0)
+                    || (NULL != kargs.off_out
+                        && (err = copy_to_user(kargs.off_out, &offout, sizeof(offout))) < 0)) {
+                        ret = err;
+                        goto fail;
+                }
+        }
+        return ret;
+fail:
+        curthr->kt_errno = -ret;
+        return -1;
+}
 
-                case SYS_read:
-                        return sys_read((read_args_t *)args);
+static void sys_halt(void)
+{
+        proc_kill_all();
+}
 
-                case SYS_write:
-                        return sys_write((write_args_t *)args);
+static int sys_stat(stat_args_t *arg)
+{
+        stat_args_t kern_args;
+        struct stat buf;
+        char *path;
+        int ret;
 
-                case SYS_dup:
-                        return sys_dup((int)args);
+        if (copy_from_user(&kern_args, arg, sizeof(kern_args)) < 0) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
 
-                case SYS_dup2:
-                        return sys_dup2((dup2_args_t *)args);
+        if ((path = user_path(&kern_args.path)) == NULL) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
 
-                case SYS_mkdir:
-                        return sys_mkdir((mkdir_args_t *)args);
+        ret = do_stat(path, &buf);
 
-                case SYS_rmdir:
-                        return sys_rmdir((argstr_t *)args);
+        if (ret == 0) {
+                ret = copy_to_user(kern_args.buf, &buf, sizeof(struct stat));
+        }
 
-                case SYS_unlink:
-                        return sys_unlink((argstr_t *)args);
+        if (ret != 0) {
+                user_path_free(path);
+                curthr->kt_errno = -ret;
+                return -1;
+        }
 
-                case SYS_link:
-                        return sys_link((link_args_t *)args);
+        user_path_free(path);
+        return 0;
+}
 
-                case SYS_rename:
-                        return sys_rename((rename_args_t *)args);
+static int sys_fcntl(fcntl_args_t *args)
+{
+        fcntl_args_t kargs;
+        int ret;
 
-                case SYS_chdir:
-                        return sys_chdir((argstr_t *)args);
+        if ((ret = copy_from_user(&kargs, args, sizeof(kargs))) < 0
+            || (ret = do_fcntl(kargs.fd, kargs.cmd, kargs.arg)) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
 
-                case SYS_getdents:
-                        return sys_getdents((getdents_args_t *)args);
+static int sys_fstat(fstat_args_t *arg)
+{
+        fstat_args_t kern_args;
+        struct stat buf;
+        int ret;
 
-                case SYS_brk:
-                        return (int) sys_brk((void *)args);
+        if (copy_from_user(&kern_args, arg, sizeof(kern_args)) < 0) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
 
-                case SYS_lseek:
-                        return sys_lseek((lseek_args_t *)args);
+        ret = do_fstat(kern_args.fd, &buf);
 
-                case SYS_halt:
-                        sys_halt();
-                        return -1;
+        if (ret == 0) {
+                ret = copy_to_user(kern_args.buf, &buf, sizeof(struct stat));
+        }
 
-                case SYS_set_errno:
-                        curthr->kt_errno = (int)args;
-                        return 0;
+        if (ret != 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return 0;
+}
 
-                case SYS_errno:
-                        return curthr->kt_errno;
+static int sys_fstatat(fstatat_args_t *arg)
+{
+        fstatat_args_t kern_args;
+        struct stat buf;
+        char *path;
+        int ret;
 
-                case SYS_execve:
-                        return sys_execve((execve_args_t *)args, regs);
+        if (copy_from_user(&kern_args, arg, sizeof(kern_args)) < 0) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
 
-                case SYS_stat:
-                        return sys_stat((stat_args_t *)args);
+        if ((path = user_path(&kern_args.path)) == NULL) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
 
-                case SYS_pipe:
-                        return sys_pipe((int *)args);
+        ret = do_fstatat(kern_args.dirfd, path, &buf, kern_args.flags);
+        user_path_free(path);
 
-                case SYS_uname:
-                        return sys_uname((struct utsname *)args);
+        if (ret == 0) {
+                ret = copy_to_user(kern_args.buf, &buf, sizeof(struct stat));
+        }
 
-                case SYS_debug:
-                        return sys_debug((argstr_t *)args);
-                case SYS_kshell:
-                        return sys_kshell((int)args);
-                default:
-                        dbg(DBG_ERROR, "ERROR: unknown system call: %d (args: %#08x)\n", sysnum, args);
-                        curthr->kt_errno = ENOSYS;
-                        return -1;
+        if (ret != 0) {
+                curthr->kt_errno = -ret;
+                return -1;
         }
+        return 0;
 }
 
+static int sys_pipe(int arg[2])
+{
+        int kern_args[2];
+        int ret;
+        
+        ret = do_pipe(kern_args);
+
+        if (ret == 0) {
+                ret = copy_to_user(arg, kern_args, sizeof(kern_args));
+        }
+
+        if (ret != 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        
+        return 0;
+}
+
+static int sys_splice(splice_args_t *arg)
+{
+        splice_args_t kern_args;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        if ((ret = do_splice(kern_args.fdin, kern_args.fdout, kern_args.len)) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        return ret;
+}
+
+static int sys_uname(struct utsname *arg)
+{
+        static const char sysname[] = "Weenix";
+        static const char release[] = "1.2";
+        /* Version = last compilation time */
+        static const char version[] = "#1 " __DATE__ " " __TIME__;
+        static const char nodename[] = "";
+        static const char machine[] = "";
+        int ret = 0;
+
+        ret = copy_to_user(arg->sysname, sysname, sizeof(sysname));
+        if (ret != 0) {
+                goto err;
+        }
+        ret = copy_to_user(arg->release, release, sizeof(release));
+        if (ret != 0) {
+                goto err;
+        }
+        ret = copy_to_user(arg->version, version, sizeof(version));
+        if (ret != 0) {
+                goto err;
+        }
+        ret = copy_to_user(arg->nodename, nodename, sizeof(nodename));
+        if (ret != 0) {
+                goto err;
+        }
+        ret = copy_to_user(arg->machine, machine, sizeof(machine));
+        if (ret != 0) {
+                goto err;
+        }
+        return 0;
+err:
+        curthr->kt_errno = -ret;
+        return -1;
+}
+
+static int sys_fork(regs_t *regs)
+{
+        int ret = do_fork(regs);
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+static int sys_execve(execve_args_t *args, regs_t *regs)
+{
+        execve_args_t kern_args;
+        char *kern_filename = NULL;
+        char **kern_argv = NULL;
+        char **kern_envp = NULL;
+        int err;
+
+        if ((err = copy_from_user(&kern_args, args, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -err;
+                goto cleanup;
+        }
+
+        /* copy the name of the executable */
+        if ((kern_filename = user_path(&kern_args.filename)) == NULL)
+                goto cleanup;
+
+        /* copy the argument list */
+        if (kern_args.argv.av_vec) {
+                if ((kern_argv = user_vecdup(&kern_args.argv)) == NULL)
+                        goto cleanup;
+        }
+
+        /* copy the environment list */
+        if (kern_args.envp.av_vec) {
+                if ((kern_envp = user_vecdup(&kern_args.envp)) == NULL)
+                        goto cleanup;
+        }
+
+        err = do_execve(kern_filename, kern_argv, kern_envp, regs);
+
+        curthr->kt_errno = -err;
+
+cleanup:
+        if (kern_filename)
+                user_path_free(kern_filename);
+        if (kern_argv)
+                kfree(kern_argv);
+        if (kern_envp)
+                kfree(kern_envp);
+        if (curthr->kt_errno)
+                return -1;
+        return 0;
+}
+
+/* spawn(2), which takes the same arguments as execve(2) */
+static int sys_spawn(execve_args_t *args)
+{
+        execve_args_t kern_args;
+        char *kern_filename = NULL;
+        char **kern_argv = NULL;
+        char **kern_envp = NULL;
+        int err, ret = -1;
+
+        if ((err = copy_from_user(&kern_args, args, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -err;
+                goto cleanup;
+        }
+
+        if ((kern_filename = user_path(&kern_args.filename)) == NULL)
+                goto cleanup;
+        if (kern_args.argv.av_vec) {
+                if ((kern_argv = user_vecdup(&kern_args.argv)) == NULL)
+                        goto cleanup;
+        }
+        if (kern_args.envp.av_vec) {
+                if ((kern_envp = user_vecdup(&kern_args.envp)) == NULL)
+                        goto cleanup;
+        }
+
+        if ((err = do_spawn(kern_filename, kern_argv, kern_envp)) < 0)
+                curthr->kt_errno = -err;
+        else
+                ret = err;
+
+cleanup:
+        if (kern_filename)
+                user_path_free(kern_filename);
+        if (kern_argv)
+                kfree(kern_argv);
+        if (kern_envp)
+                kfree(kern_envp);
+        return ret;
+}
+
+static int sys_debug(argstr_t *arg)
+{
+        argstr_t kern_args;
+        int      err;
+        char    *message;
+
+        if ((err = copy_from_user(&kern_args, arg, sizeof(argstr_t))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        message = user_strdup(&kern_args);
+        dbg(DBG_USER, "%s\n", message);
+
+        kfree(message);
+        return 0;
+}
+
+static int sys_dbgmodes(dbgmodes_args_t *arg)
+{
+        dbgmodes_args_t kern_args;
+        char            buf[512];
+        char           *modes;
+        size_t          len;
+        int             err;
+
+        if ((err = copy_from_user(&kern_args, arg, sizeof(dbgmodes_args_t))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        if (NULL != kern_args.dma_modes.as_str) {
+                if (NULL == (modes = user_strdup(&kern_args.dma_modes))) {
+                        curthr->kt_errno = EINVAL;
+                        return -1;
+                }
+                err = dbg_add_modes(modes);
+                kfree(modes);
+                if (err < 0) {
+                        curthr->kt_errno = -err;
+                        return -1;
+                }
+        }
+
+        if (NULL == kern_args.dma_buf)
+                return 0;
+        dbg_modes_info(NULL, buf, sizeof(buf));
+        len = strlen(buf) + 1;
+        if (len > kern_args.dma_len) {
+                curthr->kt_errno = ENAMETOOLONG;
+                return -1;
+        }
+        if ((err = copy_to_user(kern_args.dma_buf, buf, len)) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return len - 1;
+}
+
+static int sys_kshell(int ttyid)
+{
+        kshell_t *ksh;
+        int       err;
+
+        /* Create a kshell on tty */
+        ksh = kshell_create(ttyid);
+        if (NULL == ksh) {
+                curthr->kt_errno = ENODEV;
+                return -1;
+        }
+
+        while ((err = kshell_execute_next(ksh)) > 0);
+        kshell_destroy(ksh);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        return 0;
+}
+
+static int sc_batch(uint32_t args, regs_t *regs);
+
+/*
+ * The syscall table. Each entry unpacks the one argument userland passes
+ * (a value, or a pointer to the arguments) for its sys_ function.
+ */
+
+static int sc_waitpid(uint32_t args, regs_t *regs)
+{
+        return sys_waitpid((waitpid_args_t *)args);
+}
+
+static int sc_exit(uint32_t args, regs_t *regs)
+{
+        do_exit((int)args);
+        panic("exit failed!\n");
+        return 0;
+}
+
+static int sc_thr_exit(uint32_t args, regs_t *regs)
+{
+        kthread_exit((void *)args);
+        panic("thr_exit failed!\n");
+        return 0;
+}
+
+static int sc_thr_yield(uint32_t args, regs_t *regs)
+{
+        sched_make_runnable(curthr);
+        sched_switch();
+        return 0;
+}
+
+static int sc_fork(uint32_t args, regs_t *regs)
+{
+        return sys_fork(regs);
+}
+
+static int sc_getpid(uint32_t args, regs_t *regs)
+{
+        return curproc->p_pid;
+}
+
+/* In bytes, as the kernel data page has it in pages */
+static int sc_get_free_mem(uint32_t args, regs_t *regs)
+{
+        return (int) (page_free_count() * PAGE_SIZE);
+}
+
+static int sc_sync(uint32_t args, regs_t *regs)
+{
+        sys_sync();
+        return 0;
+}
+
+#ifdef __MOUNTING__
+static int sc_mount(uint32_t args, regs_t *regs)
+{
+        return sys_mount((mount_args_t *)args);
+}
+#endif
+
+#ifdef __MOUNTING__
+static int sc_umount(uint32_t args, regs_t *regs)
+{
+        return sys_umount((argstr_t *)args);
+}
+#endif
+
+static int sc_mmap(uint32_t args, regs_t *regs)
+{
+        return (int) sys_mmap((mmap_args_t *)args);
+}
+
+static int sc_munmap(uint32_t args, regs_t *regs)
+{
+        return sys_munmap((munmap_args_t *)args);
+}
+
+static int sc_mlock(uint32_t args, regs_t *regs)
+{
+        return sys_mlock((mlock_args_t *)args, 1);
+}
+
+static int sc_munlock(uint32_t args, regs_t *regs)
+{
+        return sys_mlock((mlock_args_t *)args, 0);
+}
+
+static int sc_madvise(uint32_t args, regs_t *regs)
+{
+        return sys_madvise((madvise_args_t *)args);
+}
+
+static int sc_getrusage(uint32_t args, regs_t *regs)
+{
+        return sys_getrusage((getrusage_args_t *)args);
+}
+
+static int sc_nice(uint32_t args, regs_t *regs)
+{
+        return sys_nice((int)args);
+}
+
+static int sc_nanosleep(uint32_t args, regs_t *regs)
+{
+        return sys_nanosleep((nanosleep_args_t *)args);
+}
+
+static int sc_futex(uint32_t args, regs_t *regs)
+{
+        return sys_futex((futex_args_t *)args);
+}
+
+static int sc_sched_setaffinity(uint32_t args, regs_t *regs)
+{
+        return sys_sched_setaffinity((sched_setaffinity_args_t *)args);
+}
+
+static int sc_sched_getaffinity(uint32_t args, regs_t *regs)
+{
+        return sys_sched_getaffinity((sched_getaffinity_args_t *)args);
+}
+
+static int sc_poll(uint32_t args, regs_t *regs)
+{
+        return sys_poll((poll_args_t *)args);
+}
+
+static int sc_open(uint32_t args, regs_t *regs)
+{
+        return sys_open((open_args_t *)args);
+}
+
+static int sc_close(uint32_t args, regs_t *regs)
+{
+        return sys_close((int)args);
+}
+
+static int sc_read(uint32_t args, regs_t *regs)
+{
+        return sys_read((read_args_t *)args);
+}
+
+static int sc_write(uint32_t args, regs_t *regs)
+{
+        return sys_write((write_args_t *)args);
+}
+
+static int sc_dup(uint32_t args, regs_t *regs)
+{
+        return sys_dup((int)args);
+}
+
+static int sc_dup2(uint32_t args, regs_t *regs)
+{
+        return sys_dup2((dup2_args_t *)args);
+}
+
+static int sc_mkdir(uint32_t args, regs_t *regs)
+{
+        return sys_mkdir((mkdir_args_t *)args);
+}
+
+static int sc_rmdir(uint32_t args, regs_t *regs)
+{
+        return sys_rmdir((argstr_t *)args);
+}
+
+static int sc_unlink(uint32_t args, regs_t *regs)
+{
+        return sys_unlink((argstr_t *)args);
+}
+
+static int sc_link(uint32_t args, regs_t *regs)
+{
+        return sys_link((link_args_t *)args);
+}
+
+static int sc_rename(uint32_t args, regs_t *regs)
+{
+        return sys_rename((rename_args_t *)args);
+}
+
+static int sc_chdir(uint32_t args, regs_t *regs)
+{
+        return sys_chdir((argstr_t *)args);
+}
+
+static int sc_getdents(uint32_t args, regs_t *regs)
+{
+        return sys_getdents((getdents_args_t *)args);
+}
+
+static int sc_brk(uint32_t args, regs_t *regs)
+{
+        return (int) sys_brk((void *)args);
+}
+
+static int sc_lseek(uint32_t args, regs_t *regs)
+{
+        return sys_lseek((lseek_args_t *)args);
+}
+
+static int sc_halt(uint32_t args, regs_t *regs)
+{
+        sys_halt();
+        return -1;
+}
+
+static int sc_set_errno(uint32_t args, regs_t *regs)
+{
+        curthr->kt_errno = (int)args;
+        return 0;
+}
+
+static int sc_errno(uint32_t args, regs_t *regs)
+{
+        return curthr->kt_errno;
+}
+
+static int sc_execve(uint32_t args, regs_t *regs)
+{
+        return sys_execve((execve_args_t *)args, regs);
+}
+
+static int sc_spawn(uint32_t args, regs_t *regs)
+{
+        return sys_spawn((execve_args_t *)args);
+}
+
+static int sc_stat(uint32_t args, regs_t *regs)
+{
+        return sys_stat((stat_args_t *)args);
+}
+
+static int sc_fstat(uint32_t args, regs_t *regs)
+{
+        return sys_fstat((fstat_args_t *)args);
+}
+
+static int sc_fcntl(uint32_t args, regs_t *regs)
+{
+        return sys_fcntl((fcntl_args_t *)args);
+}
+
+static int sc_fsync(uint32_t args, regs_t *regs)
+{
+        return sys_fsync((int)args, 0);
+}
+
+static int sc_fdatasync(uint32_t args, regs_t *regs)
+{
+        return sys_fsync((int)args, 1);
+}
+
+static int sc_fadvise(uint32_t args, regs_t *regs)
+{
+        return sys_fadvise((fadvise_args_t *)args);
+}
+
+static int sc_sendfile(uint32_t args, regs_t *regs)
+{
+        return sys_sendfile((sendfile_args_t *)args);
+}
+
+static int sc_copy_file_range(uint32_t args, regs_t *regs)
+{
+        return sys_copy_file_range((copy_file_range_args_t *)args);
+}
+
+static int sc_openat(uint32_t args, regs_t *regs)
+{
+        return sys_openat((openat_args_t *)args);
+}
+
+static int sc_fstatat(uint32_t args, regs_t *regs)
+{
+        return sys_fstatat((fstatat_args_t *)args);
+}
+
+static int sc_unlinkat(uint32_t args, regs_t *regs)
+{
+        return sys_unlinkat((unlinkat_args_t *)args);
+}
+
+static int sc_aio_setup(uint32_t args, regs_t *regs)
+{
+        return sys_aio(SYS_aio_setup, NULL);
+}
+
+static int sc_aio_read(uint32_t args, regs_t *regs)
+{
+        return sys_aio(SYS_aio_read, (const struct aiocb *)args);
+}
+
+static int sc_aio_write(uint32_t args, regs_t *regs)
+{
+        return sys_aio(SYS_aio_write, (const struct aiocb *)args);
+}
+
+static int sc_aio_error(uint32_t args, regs_t *regs)
+{
+        return sys_aio(SYS_aio_error, (const struct aiocb *)args);
+}
+
+static int sc_aio_return(uint32_t args, regs_t *regs)
+{
+        return sys_aio(SYS_aio_return, (const struct aiocb *)args);
+}
+
+static int sc_aio_suspend(uint32_t args, regs_t *regs)
+{
+        return sys_aio_suspend((aio_suspend_args_t *)args);
+}
+
+static int sc_shm_open(uint32_t args, regs_t *regs)
+{
+        return sys_shm_open((open_args_t *)args);
+}
+
+static int sc_shm_unlink(uint32_t args, regs_t *regs)
+{
+        return sys_shm_unlink((argstr_t *)args);
+}
+
+static int sc_pipe(uint32_t args, regs_t *regs)
+{
+        return sys_pipe((int *)args);
+}
+
+static int sc_splice(uint32_t args, regs_t *regs)
+{
+        return sys_splice((splice_args_t *)args);
+}
+
+static int sc_readv(uint32_t args, regs_t *regs)
+{
+        return sys_iov((iov_args_t *)args, 0, 0);
+}
+
+static int sc_writev(uint32_t args, regs_t *regs)
+{
+        return sys_iov((iov_args_t *)args, 0, 1);
+}
+
+static int sc_preadv(uint32_t args, regs_t *regs)
+{
+        return sys_iov((iov_args_t *)args, 1, 0);
+}
+
+static int sc_pwritev(uint32_t args, regs_t *regs)
+{
+        return sys_iov((iov_args_t *)args, 1, 1);
+}
+
+static int sc_pread(uint32_t args, regs_t *regs)
+{
+        return sys_prw((pread_args_t *)args, 0);
+}
+
+static int sc_pwrite(uint32_t args, regs_t *regs)
+{
+        return sys_prw((pread_args_t *)args, 1);
+}
+
+static int sc_uname(uint32_t args, regs_t *regs)
+{
+        return sys_uname((struct utsname *)args);
+}
+
+static int sc_debug(uint32_t args, regs_t *regs)
+{
+        return sys_debug((argstr_t *)args);
+}
+
+static int sc_kshell(uint32_t args, regs_t *regs)
+{
+        return sys_kshell((int)args);
+}
+
+static int sc_dbgmodes(uint32_t args, regs_t *regs)
+{
+        return sys_dbgmodes((dbgmodes_args_t *)args);
+}
+
+static const syscall_t syscall_table[SYSCALL_NLOW + SYSCALL_NHIGH] = {
+        [SYS_waitpid] = { "waitpid", 3, sc_waitpid },
+        [SYS_exit] = { "exit", 1, sc_exit, SC_NOBATCH },
+        [SYS_thr_exit] = { "thr_exit", 1, sc_thr_exit, SC_NOBATCH },
+        [SYS_thr_yield] = { "thr_yield", 0, sc_thr_yield },
+        [SYS_fork] = { "fork", 0, sc_fork, SC_NOBATCH },
+        [SYS_getpid] = { "getpid", 0, sc_getpid },
+        [SYS_get_free_mem] = { "get_free_mem", 0, sc_get_free_mem },
+        [SYS_sync] = { "sync", 0, sc_sync },
+#ifdef __MOUNTING__
+        [SYS_mount] = { "mount", 3, sc_mount },
+#endif
+#ifdef __MOUNTING__
+        [SYS_umount] = { "umount", 1, sc_umount },
+#endif
+        [SYS_mmap] = { "mmap", 6, sc_mmap },
+        [SYS_munmap] = { "munmap", 2, sc_munmap },
+        [SYS_mlock] = { "mlock", 2, sc_mlock },
+        [SYS_munlock] = { "munlock", 2, sc_munlock },
+        [SYS_madvise] = { "madvise", 3, sc_madvise },
+        [SYS_getrusage] = { "getrusage", 2, sc_getrusage },
+        [SYS_nice] = { "nice", 1, sc_nice },
+        [SYS_nanosleep] = { "nanosleep", 2, sc_nanosleep },
+        [SYS_batch] = { "batch", 3, sc_batch, SC_NOBATCH },
+        [SYS_futex] = { "futex", 4, sc_futex },
+        [SYS_sched_setaffinity] = { "sched_setaffinity", 2, sc_sched_setaffinity },
+        [SYS_sched_getaffinity] = { "sched_getaffinity", 2, sc_sched_getaffinity },
+        [SYS_poll] = { "poll", 3, sc_poll },
+        [SYS_fcntl] = { "fcntl", 3, sc_fcntl },
+        [SYS_fsync] = { "fsync", 1, sc_fsync },
+        [SYS_fdatasync] = { "fdatasync", 1, sc_fdatasync },
+        [SYS_fadvise] = { "fadvise", 1, sc_fadvise },
+        [SYS_sendfile] = { "sendfile", 1, sc_sendfile },
+        [SYS_copy_file_range] = { "copy_file_range", 1, sc_copy_file_range },
+        [SYS_openat] = { "openat", 4, sc_openat },
+        [SYS_fstatat] = { "fstatat", 4, sc_fstatat },
+        [SYS_unlinkat] = { "unlinkat", 3, sc_unlinkat },
+        [SYS_aio_setup] = { "aio_setup", 0, sc_aio_setup },
+        [SYS_aio_read] = { "aio_read", 1, sc_aio_read },
+        [SYS_aio_write] = { "aio_write", 1, sc_aio_write },
+        [SYS_aio_error] = { "aio_error", 1, sc_aio_error },
+        [SYS_aio_return] = { "aio_return", 1, sc_aio_return },
+        [SYS_aio_suspend] = { "aio_suspend", 3, sc_aio_suspend },
+        [SYS_shm_open] = { "shm_open", 3, sc_shm_open },
+        [SYS_shm_unlink] = { "shm_unlink", 1, sc_shm_unlink },
+        [SYS_open] = { "open", 3, sc_open },
+        [SYS_close] = { "close", 1, sc_close },
+        [SYS_read] = { "read", 3, sc_read },
+        [SYS_write] = { "write", 3, sc_write },
+        [SYS_dup] = { "dup", 1, sc_dup },
+        [SYS_dup2] = { "dup2", 2, sc_dup2 },
+        [SYS_mkdir] = { "mkdir", 2, sc_mkdir },
+        [SYS_rmdir] = { "rmdir", 1, sc_rmdir },
+        [SYS_unlink] = { "unlink", 1, sc_unlink },
+        [SYS_link] = { "link", 2, sc_link },
+        [SYS_rename] = { "rename", 2, sc_rename },
+        [SYS_chdir] = { "chdir", 1, sc_chdir },
+        [SYS_getdents] = { "getdents", 3, sc_getdents },
+        [SYS_brk] = { "brk", 1, sc_brk },
+        [SYS_lseek] = { "lseek", 3, sc_lseek },
+        [SYS_halt] = { "halt", 0, sc_halt, SC_NOBATCH },
+        [SYS_set_errno] = { "set_errno", 1, sc_set_errno },
+        [SYS_errno] = { "errno", 0, sc_errno },
+        [SYS_execve] = { "execve", 3, sc_execve, SC_NOBATCH },
+        [SYS_spawn] = { "spawn", 3, sc_spawn },
+        [SYS_stat] = { "stat", 2, sc_stat },
+        [SYS_fstat] = { "fstat", 2, sc_fstat },
+        [SYS_pipe] = { "pipe", 1, sc_pipe },
+        [SYS_splice] = { "splice", 3, sc_splice },
+        [SYS_readv] = { "readv", 3, sc_readv },
+        [SYS_writev] = { "writev", 3, sc_writev },
+        [SYS_preadv] = { "preadv", 4, sc_preadv },
+        [SYS_pwritev] = { "pwritev", 4, sc_pwritev },
+        [SYS_pread] = { "pread", 4, sc_pread },
+        [SYS_pwrite] = { "pwrite", 4, sc_pwrite },
+        [SYS_uname] = { "uname", 1, sc_uname },
+        [SYSCALL_HIGH(SYS_debug)] = { "debug", 1, sc_debug },
+        [SYSCALL_HIGH(SYS_kshell)] = { "kshell", 1, sc_kshell },
+        [SYSCALL_HIGH(SYS_dbgmodes)] = { "dbgmodes", 1, sc_dbgmodes },
+};
+
+static void syscall_account(syscall_stats_t *stats, uint64_t cycles)
+{
+        stats->ss_count++;
+        stats->ss_total += cycles;
+        stats->ss_hist[math_log2_bucket(cycles, SYSCALL_HIST_BUCKETS)]++;
+}
+
+void syscall_stats_enable(int on)
+{
+        syscall_stats_on = on;
+}
+
+void syscall_stats_reset(void)
+{
+        memset(syscall_stats, 0, sizeof(syscall_stats));
+}
+
+size_t syscall_stats_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        const syscall_stats_t *stats;
+        int i;
+
+        KASSERT(NULL == data);
+
+        iprintf(&buf, &size, "collecting: %s\n", syscall_stats_on ? "on" : "off");
+        iprintf(&buf, &size, "%-12s %4s %10s %12s\n",
+                "syscall", "args", "calls", "mean cycles");
+        for (i = 0; i < SYSCALL_NLOW + SYSCALL_NHIGH; ++i) {
+                stats = &syscall_stats[i];
+                if (0 == stats->ss_count)
+                        continue;
+                iprintf(&buf, &size, "%-12s %4d %10u %12u\n",
+                        syscall_table[i].sc_name, syscall_table[i].sc_nargs,
+                        stats->ss_count,
+                        math_average(stats->ss_total, stats->ss_count));
+                math_log2_info(&buf, &size, stats->ss_hist, SYSCALL_HIST_BUCKETS);
+        }
+
+        return size;
+}
+
+/* The syscall_table (and syscall_stats) index of a syscall, or -1 if
+ * there is no such syscall */
+static int syscall_index(uint32_t sysnum)
+{
+        int i = -1;
+
+        if (sysnum < SYSCALL_NLOW)
+                i = sysnum;
+        else if (sysnum >= SYS_debug && sysnum < SYS_debug + SYSCALL_NHIGH)
+                i = SYSCALL_HIGH(sysnum);
+        if (0 <= i && NULL == syscall_table[i].sc_func)
+                i = -1;
+        return i;
+}
+
+/* How many batch entries are copied in at a time */
+#define SYSBATCH_CHUNK 16
+
+/*
+ * Makes each of a user array of syscalls in turn, with one trap, and
+ * writes back what each returned. The arguments are user pointers as
+ * they would be for the syscall itself. Returns how many were made,
+ * which is short of the count only if SYSBATCH_STOP stopped it, or the
+ * thread was cancelled.
+ */
+static int sc_batch(uint32_t args, regs_t *regs)
+{
+        sysbatch_args_t kargs;
+        sysbatch_ent_t  ents[SYSBATCH_CHUNK];
+        int             done = 0;
+        int             stop = 0;
+        int             n, i, err;
+
+        if ((err = copy_from_user(&kargs, (void *)args, sizeof(kargs))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        if (0 > kargs.count) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        while (!stop && done < kargs.count) {
+                n = MIN(kargs.count - done, SYSBATCH_CHUNK);
+                if ((err = copy_from_user(ents, kargs.ents + done, n * sizeof(*ents))) < 0)
+                        goto fault;
+
+                for (i = 0; i < n; ++i) {
+                        int sc = syscall_index(ents[i].se_sysnum);
+
+                        curthr->kt_errno = 0;
+                        if (0 > sc || (syscall_table[sc].sc_flags & SC_NOBATCH)) {
+                                ents[i].se_ret = -1;
+                                ents[i].se_errno = ENOSYS;
+                        } else {
+                                ents[i].se_ret = syscall_table[sc].sc_func(ents[i].se_arg, regs);
+                                ents[i].se_errno = curthr->kt_errno;
+                        }
+                        if ((0 > ents[i].se_ret && (kargs.flags & SYSBATCH_STOP))
+                            || curthr->kt_cancelled) {
+                                stop = 1;
+                                n = i + 1;
+                                break;
+                        }
+                }
+
+                if ((err = copy_to_user(kargs.ents + done, ents, n * sizeof(*ents))) < 0)
+                        goto fault;
+                done += n;
+        }
+        curthr->kt_errno = 0;
+        return done;
+
+fault:
+        if (0 < done)
+                return done;
+        curthr->kt_errno = -err;
+        return -1;
+}
+
+/* Interrupt handler for syscalls */
+static void syscall_handler(regs_t *regs)
+{
+
+        /* The syscall number and the (user-address) pointer to the arguments.
+         * Pushed by userland when we trap into the kernel */
+        uint32_t sysnum = (uint32_t) regs->r_eax;
+        uint32_t args = (uint32_t) regs->r_edx;
+
+        dbg(DBG_SYSCALL, ">> pid %d, sysnum: %d (%x), arg: %d (%#08x)\n",
+            curproc->p_pid, sysnum, sysnum, args, args);
+
+        if (curthr->kt_cancelled) {
+                dbg(DBG_SYSCALL, "trap: CANCELLING: thread %p of proc %d "
+                    "(0x%p)\n", curthr, curproc->p_pid, curproc);
+
+                kthread_exit(curthr->kt_retval);
+        }
+
+        dbginfo(DBG_VMMAP, vmmap_mapping_info, curproc->p_vmmap);
+
+        int ret;
+        int i = syscall_index(sysnum);
+
+        TRACE(TRACE_SYSCALL_ENTER, sysnum, args, 0);
+
+        if (0 > i) {
+                dbg(DBG_ERROR, "ERROR: unknown system call: %d (args: %#08x)\n", sysnum, args);
+                curthr->kt_errno = ENOSYS;
+                ret = -1;
+        } else if (!syscall_stats_on) {
+                ret = syscall_table[i].sc_func(args, regs);
+        } else {
+                uint64_t start = cpuid_rdtsc();
+                ret = syscall_table[i].sc_func(args, regs);
+                syscall_account(&syscall_stats[i], cpuid_rdtsc() - start);
+        }
+
+        if (curthr->kt_cancelled) {
+                dbg(DBG_SYSCALL, "trap: CANCELLING: thread %p of proc %d "
+                    "(%p)\n", curthr, curproc->p_pid, curproc);
+
+                kthread_exit(curthr->kt_retval);
+        }
+
+        dbg(DBG_SYSCALL, "<< pid %d, sysnum: %d (%x), returned: %d (%#x)\n",
+            curproc->p_pid, sysnum, sysnum, ret, ret);
+        TRACE(TRACE_SYSCALL_EXIT, sysnum, ret, curthr->kt_errno);
+        regs->r_eax = ret; /* Return value goes in eax */
+        if (INTR_ERR_SYSENTER == regs->r_err)
+                regs->r_esi = curthr->kt_errno; /* and errno in esi */
+}
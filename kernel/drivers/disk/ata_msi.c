@@ -0,0 +1,68 @@
+/*
+ * Message signalled interrupts for the ATA controller. The prebuilt
+ * driver maps each channel's IOAPIC line to INTR_DISK_PRIMARY or
+ * INTR_DISK_SECONDARY, and registers its handlers for those. If the
+ * controller can send a message for each channel it is switched to MSI
+ * with the same two vectors, so that its completions go straight to the
+ * local APIC, on lines shared with nothing, and the driver's handlers
+ * are left as they are; the IOAPIC lines are masked.
+ *
+ * A channel in compatibility mode raises the legacy ISA interrupt
+ * whatever the controller's MSI settings, and a controller with one
+ * message would give both channels the same vector, so in either case
+ * (as with the emulated PIIX, which has no MSI at all) the lines are
+ * kept. There is no AHCI driver here to do the same for.
+ */
+
+#include "types.h"
+#include "kernel.h"
+
+#include "drivers/pci.h"
+
+#include "main/interrupt.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+
+#define PCI_CLASS_STORAGE       0x01
+#define PCI_SUBCLASS_IDE        0x01
+
+/* Set in the programming interface of a channel in native mode */
+#define PCI_IDE_NATIVE_PRIMARY          BIT(0)
+#define PCI_IDE_NATIVE_SECONDARY        BIT(2)
+#define PCI_IDE_NATIVE  (PCI_IDE_NATIVE_PRIMARY | PCI_IDE_NATIVE_SECONDARY)
+
+static __attribute__((unused)) void
+ata_msi_init(void)
+{
+        pcidev_t *dev;
+        uint8_t ipl;
+        int ret;
+
+        KASSERT(INTR_DISK_SECONDARY == INTR_DISK_PRIMARY + 1);
+
+        dev = pci_lookup(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, PCI_LOOKUP_WILDCARD);
+        if (NULL == dev)
+                return;
+        if (PCI_IDE_NATIVE != (dev->pci_interfaceid & PCI_IDE_NATIVE)) {
+                dbg(DBG_DISK, "ata: channels in compatibility mode, keeping IOAPIC interrupts\n");
+                return;
+        }
+
+        /* no interrupt may come in between, without the EOI for it */
+        ipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        ret = pci_msi_enable(dev, INTR_DISK_PRIMARY, 2);
+        if (0 == ret) {
+                intr_map_msi(INTR_DISK_PRIMARY);
+                intr_map_msi(INTR_DISK_SECONDARY);
+        }
+        intr_setipl(ipl);
+        if (0 > ret) {
+                dbg(DBG_DISK, "ata: no MSI for both channels (%d), keeping IOAPIC interrupts\n", ret);
+                return;
+        }
+        dbg(DBG_DISK, "ata: using MSI vectors 0x%x and 0x%x\n",
+            INTR_DISK_PRIMARY, INTR_DISK_SECONDARY);
+}
+init_func(ata_msi_init);
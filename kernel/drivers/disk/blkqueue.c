@@ -0,0 +1,342 @@
+/*
+ * Asynchronous block I/O request queues.
+ *
+ * Every disk gets a queue and a kernel thread ("blkqd<n>") which carries
+ * out the queue's requests one at a time using the device's (blocking)
+ * read_block and write_block functions. Submitting a request only links
+ * it onto the queue, so a thread can have several requests outstanding
+ * and requests from different threads are reordered before they reach
+ * the driver.
+ *
+ * The pending list is kept sorted by block number and served with a
+ * C-LOOK elevator: the next request is the first one at or after the
+ * block following the last transfer, and once there is none the head
+ * goes back to the lowest pending block. This sweeps the disk in one
+ * direction only, so no request waits for more than one sweep.
+ *
+ * The ATA driver can only DMA to or from one contiguous buffer, so the
+ * blocks of a scatter-gather request are gathered into (or scattered
+ * from) a staging buffer which each queue allocates once, when it is
+ * created. One request is still one ATA command however many pages it
+ * touches, and the callers do not need contiguous memory of their own.
+ */
+
+#include "types.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "drivers/dev.h"
+#include "drivers/blockdev.h"
+#include "drivers/disk/blkqueue.h"
+
+#include "mm/page.h"
+
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
+#include "util/init.h"
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+typedef struct blkqueue {
+        blockdev_t         *bq_bdev;
+        list_t              bq_pending;     /* sorted by br_block */
+        blocknum_t          bq_pos;         /* block after the last transfer */
+        ktqueue_t           bq_waitq;       /* the queue thread sleeps here */
+        proc_t             *bq_proc;
+        kthread_t          *bq_thr;
+        char               *bq_staging;     /* BLK_MAX_SEGS blocks */
+
+        /* Statistics, see blkqueue_info */
+        int                 bq_npending;
+        uint32_t            bq_nsubmitted;
+        uint32_t            bq_ncompleted;
+        uint32_t            bq_nsweeps;     /* times the head went back down */
+} blkqueue_t;
+
+static blkqueue_t blkqueues[__NDISKS__];
+
+static blkqueue_t *
+blkqueue_lookup(blockdev_t *bdev)
+{
+        int i;
+
+        for (i = 0; i < __NDISKS__; i++) {
+                if (bdev == blkqueues[i].bq_bdev && NULL != blkqueues[i].bq_thr)
+                        return &blkqueues[i];
+        }
+        return NULL;
+}
+
+static void
+blk_complete(blk_request_t *req, int err)
+{
+        blk_done_t callback = req->br_callback;
+
+        req->br_err = err;
+        req->br_done = 1;
+        sched_broadcast_on(&req->br_waitq);
+        if (NULL != callback)
+                callback(req);
+}
+
+static int
+blk_do_transfer(blockdev_t *bdev, int dir, char *buf, blocknum_t block, size_t count)
+{
+        if (BLK_READ == dir)
+                return bdev->bd_ops->read_block(bdev, buf, block, count);
+        else
+                return bdev->bd_ops->write_block(bdev, buf, block, count);
+}
+
+/*
+ * Carries out a request. A scatter-gather request goes through the
+ * staging buffer, if there is one, and is split into one transfer per
+ * block otherwise.
+ */
+static int
+blk_transfer(blk_request_t *req, char *staging)
+{
+        size_t i;
+        int ret;
+
+        if (NULL != req->br_buf || 1 == req->br_count) {
+                return blk_do_transfer(req->br_bdev, req->br_dir,
+                                       (NULL != req->br_buf) ? req->br_buf : req->br_segs[0],
+                                       req->br_block, req->br_count);
+        }
+
+        if (NULL == staging) {
+                for (i = 0; i < req->br_count; i++) {
+                        if ((ret = blk_do_transfer(req->br_bdev, req->br_dir, req->br_segs[i],
+                                                   req->br_block + i, 1)) < 0)
+                                return ret;
+                }
+                return 0;
+        }
+
+        if (BLK_WRITE == req->br_dir) {
+                for (i = 0; i < req->br_count; i++)
+                        memcpy(staging + i * BLOCK_SIZE, req->br_segs[i], BLOCK_SIZE);
+        }
+        ret = blk_do_transfer(req->br_bdev, req->br_dir, staging,
+                              req->br_block, req->br_count);
+        if (BLK_READ == req->br_dir && 0 <= ret) {
+                for (i = 0; i < req->br_count; i++)
+                        memcpy(req->br_segs[i], staging + i * BLOCK_SIZE, BLOCK_SIZE);
+        }
+        return ret;
+}
+
+/* C-LOOK: the first request at or after the head, else the lowest one */
+static blk_request_t *
+blkqueue_next(blkqueue_t *bq)
+{
+        blk_request_t *req;
+
+        KASSERT(!list_empty(&bq->bq_pending));
+
+        list_iterate_begin(&bq->bq_pending, req, blk_request_t, br_link) {
+                if (req->br_block >= bq->bq_pos)
+                        return req;
+        } list_iterate_end();
+
+        bq->bq_nsweeps++;
+        return list_head(&bq->bq_pending, blk_request_t, br_link);
+}
+
+static void *
+blkqueue_run(int arg1, void *arg2)
+{
+        blkqueue_t *bq = (blkqueue_t *) arg2;
+
+        while (1) {
+                blk_request_t *req;
+
+                /* a cancelled queue thread keeps going until its queue is
+                 * empty; only then does the sleep fail */
+                while (list_empty(&bq->bq_pending)) {
+                        if (sched_cancellable_sleep_on(&bq->bq_waitq))
+                                kthread_exit((void *) 0);
+                }
+
+                req = blkqueue_next(bq);
+                list_remove(&req->br_link);
+                bq->bq_npending--;
+                bq->bq_pos = req->br_block + req->br_count;
+
+                dbg(DBG_DISK, "blkqd: %s %u blocks at %u\n",
+                    (BLK_READ == req->br_dir) ? "reading" : "writing",
+                    req->br_count, req->br_block);
+                blk_complete(req, blk_transfer(req, bq->bq_staging));
+                bq->bq_ncompleted++;
+        }
+        return NULL;
+}
+
+static __attribute__((unused)) void
+blkqueue_init(void)
+{
+        char name[PROC_NAME_LEN];
+        int i;
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+
+        for (i = 0; i < __NDISKS__; i++) {
+                blkqueue_t *bq = &blkqueues[i];
+
+                if (NULL == (bq->bq_bdev = blockdev_lookup(MKDEVID(DISK_MAJOR, i))))
+                        continue;
+
+                list_init(&bq->bq_pending);
+                sched_queue_init(&bq->bq_waitq);
+                bq->bq_pos = 0;
+                /* without one, scatter-gather requests are split up */
+                bq->bq_staging = page_alloc_n(BLK_MAX_SEGS);
+
+                snprintf(name, sizeof(name), "blkqd%d", i);
+                bq->bq_proc = proc_create(name);
+                KASSERT(NULL != bq->bq_proc);
+                bq->bq_thr = kthread_create(bq->bq_proc, blkqueue_run, 0, bq);
+                KASSERT(NULL != bq->bq_thr);
+                sched_make_runnable(bq->bq_thr);
+        }
+}
+init_func(blkqueue_init);
+init_depends(sched_init);
+
+void
+blkqueue_shutdown(void)
+{
+        int i;
+
+        for (i = 0; i < __NDISKS__; i++) {
+                blkqueue_t *bq = &blkqueues[i];
+                pid_t pid;
+
+                if (NULL == bq->bq_thr)
+                        continue;
+
+                pid = bq->bq_proc->p_pid;
+                kthread_cancel(bq->bq_thr, (void *) 0);
+                KASSERT(pid == do_waitpid(pid, 0, NULL));
+                KASSERT(list_empty(&bq->bq_pending));
+                bq->bq_thr = NULL;
+                bq->bq_proc = NULL;
+                if (NULL != bq->bq_staging)
+                        page_free_n(bq->bq_staging, BLK_MAX_SEGS);
+                bq->bq_staging = NULL;
+        }
+}
+
+void
+blk_request_init(blk_request_t *req, blockdev_t *bdev, int dir,
+                 char *buf, blocknum_t block, size_t count)
+{
+        KASSERT(NULL != bdev && NULL != buf);
+        KASSERT(BLK_READ == dir || BLK_WRITE == dir);
+
+        req->br_bdev = bdev;
+        req->br_dir = dir;
+        req->br_buf = buf;
+        req->br_segs = NULL;
+        req->br_block = block;
+        req->br_count = count;
+        req->br_done = 0;
+        req->br_err = 0;
+        req->br_callback = NULL;
+        req->br_data = NULL;
+        sched_queue_init(&req->br_waitq);
+        list_link_init(&req->br_link);
+}
+
+void
+blk_request_init_sg(blk_request_t *req, blockdev_t *bdev, int dir,
+                    void **segs, blocknum_t block, size_t count)
+{
+        KASSERT(NULL != segs);
+        KASSERT(0 < count && count <= BLK_MAX_SEGS);
+
+        blk_request_init(req, bdev, dir, segs[0], block, count);
+        req->br_buf = NULL;
+        req->br_segs = segs;
+}
+
+void
+blk_submit(blk_request_t *req)
+{
+        blkqueue_t *bq;
+        blk_request_t *pending;
+
+        KASSERT(!list_link_is_linked(&req->br_link));
+
+        req->br_done = 0;
+        if (NULL == (bq = blkqueue_lookup(req->br_bdev))) {
+                blk_complete(req, blk_transfer(req, NULL));
+                return;
+        }
+
+        list_iterate_begin(&bq->bq_pending, pending, blk_request_t, br_link) {
+                if (pending->br_block > req->br_block) {
+                        list_insert_before(&pending->br_link, &req->br_link);
+                        goto queued;
+                }
+        } list_iterate_end();
+        list_insert_tail(&bq->bq_pending, &req->br_link);
+
+queued:
+        bq->bq_npending++;
+        bq->bq_nsubmitted++;
+        sched_broadcast_on(&bq->bq_waitq);
+}
+
+int
+blk_wait(blk_request_t *req)
+{
+        while (!req->br_done)
+                sched_sleep_on(&req->br_waitq);
+        return req->br_err;
+}
+
+int
+blk_rw(blockdev_t *bdev, int dir, char *buf, blocknum_t block, size_t count)
+{
+        blk_request_t req;
+
+        blk_request_init(&req, bdev, dir, buf, block, count);
+        blk_submit(&req);
+        return blk_wait(&req);
+}
+
+int
+blk_rw_sg(blockdev_t *bdev, int dir, void **segs, blocknum_t block, size_t count)
+{
+        blk_request_t req;
+
+        blk_request_init_sg(&req, bdev, dir, segs, block, count);
+        blk_submit(&req);
+        return blk_wait(&req);
+}
+
+size_t
+blkqueue_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        int i;
+
+        for (i = 0; i < __NDISKS__; i++) {
+                blkqueue_t *bq = &blkqueues[i];
+
+                if (NULL == bq->bq_thr)
+                        continue;
+                iprintf(&buf, &size, "blkqd%d: %d pending, %u submitted, "
+                        "%u completed, %u sweeps, head at %u\n", i,
+                        bq->bq_npending, bq->bq_nsubmitted,
+                        bq->bq_ncompleted, bq->bq_nsweeps, bq->bq_pos);
+        }
+        return size;
+}
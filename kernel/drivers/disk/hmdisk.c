@@ -0,0 +1,89 @@
+/*
+ * The high memory disk: block device MKDEVID(HMDISK_MAJOR, 0), whose
+ * blocks are the pages of high memory (see mm/highmem.h), the physical
+ * memory the kernel does not map. It is only there on a machine with
+ * more memory than the kernel can map, and is as big as what is left.
+ *
+ * Like the ram disk, a read or a write is a copy of each block, here
+ * through a kmap of its page, and nothing sleeps. With a file system on
+ * it (or striped across it), a working set bigger than the kernel's own
+ * memory is kept in memory after all, one copy away from the page cache
+ * instead of a disk request away.
+ */
+
+#include "types.h"
+#include "kernel.h"
+#include "errno.h"
+
+#include "drivers/dev.h"
+#include "drivers/blockdev.h"
+
+#include "mm/highmem.h"
+#include "mm/page.h"
+#include "mm/pagetable.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+
+static blockdev_t hmdisk;
+
+static int
+hmdisk_read_block(blockdev_t *bdev, char *buf, blocknum_t loc, size_t count)
+{
+        uintptr_t vaddr;
+        size_t i;
+
+        if (loc >= highmem_npages() || count > highmem_npages() - loc)
+                return -EINVAL;
+        for (i = 0; i < count; i++) {
+                vaddr = pt_kmap(highmem_page(loc + i));
+                memcpy(buf + i * BLOCK_SIZE, (void *) vaddr, BLOCK_SIZE);
+                pt_kunmap(vaddr);
+        }
+        return 0;
+}
+
+static int
+hmdisk_write_block(blockdev_t *bdev, const char *buf, blocknum_t loc, size_t count)
+{
+        uintptr_t vaddr;
+        size_t i;
+
+        if (loc >= highmem_npages() || count > highmem_npages() - loc)
+                return -EINVAL;
+        for (i = 0; i < count; i++) {
+                vaddr = pt_kmap(highmem_page(loc + i));
+                memcpy((void *) vaddr, buf + i * BLOCK_SIZE, BLOCK_SIZE);
+                pt_kunmap(vaddr);
+        }
+        return 0;
+}
+
+static blockdev_ops_t hmdisk_ops = {
+        .read_block = hmdisk_read_block,
+        .write_block = hmdisk_write_block
+};
+
+static __attribute__((unused)) void
+hmdisk_init(void)
+{
+        uintptr_t vaddr;
+        uint32_t i;
+
+        if (0 == highmem_npages())
+                return;
+        /* it reads as zeros until written, as the ram disk does */
+        for (i = 0; i < highmem_npages(); i++) {
+                vaddr = pt_kmap(highmem_page(i));
+                page_zero((void *) vaddr);
+                pt_kunmap(vaddr);
+        }
+
+        hmdisk.bd_id = MKDEVID(HMDISK_MAJOR, 0);
+        hmdisk.bd_ops = &hmdisk_ops;
+        if (0 > blockdev_register(&hmdisk))
+                panic("Could not register the high memory disk\n");
+        dbg(DBG_INIT, "High memory disk of %u blocks\n", highmem_npages());
+}
+init_func(hmdisk_init);
@@ -0,0 +1,82 @@
+/*
+ * A RAM disk: block device MKDEVID(RAMDISK_MAJOR, 0), of __RAMDISK_PAGES__
+ * blocks held in memory for as long as the kernel runs, so that the file
+ * systems and the page cache can be measured without a disk (or an
+ * emulated one) underneath. A read or a write is a copy of each block to
+ * or from its page; nothing sleeps.
+ *
+ * The pages are taken one at a time, as that much contiguous memory is
+ * unlikely to be free, and are found through a table of their addresses.
+ * There is no queue thread (blk_submit carries requests out at once for
+ * a device without one), since there is no seek order to keep.
+ */
+
+#include "types.h"
+#include "kernel.h"
+#include "errno.h"
+
+#include "drivers/dev.h"
+#include "drivers/blockdev.h"
+
+#include "mm/page.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+
+static blockdev_t ramdisk;
+static char **ramdisk_pages = NULL;
+static uint32_t ramdisk_nblocks = 0;
+
+static int
+ramdisk_read_block(blockdev_t *bdev, char *buf, blocknum_t loc, size_t count)
+{
+        size_t i;
+
+        if (loc >= ramdisk_nblocks || count > ramdisk_nblocks - loc)
+                return -EINVAL;
+        for (i = 0; i < count; i++)
+                memcpy(buf + i * BLOCK_SIZE, ramdisk_pages[loc + i], BLOCK_SIZE);
+        return 0;
+}
+
+static int
+ramdisk_write_block(blockdev_t *bdev, const char *buf, blocknum_t loc, size_t count)
+{
+        size_t i;
+
+        if (loc >= ramdisk_nblocks || count > ramdisk_nblocks - loc)
+                return -EINVAL;
+        for (i = 0; i < count; i++)
+                memcpy(ramdisk_pages[loc + i], buf + i * BLOCK_SIZE, BLOCK_SIZE);
+        return 0;
+}
+
+static blockdev_ops_t ramdisk_ops = {
+        .read_block = ramdisk_read_block,
+        .write_block = ramdisk_write_block
+};
+
+static __attribute__((unused)) void
+ramdisk_init(void)
+{
+#if 0 < __RAMDISK_PAGES__
+        uint32_t tpages = (__RAMDISK_PAGES__ * sizeof(char *) + PAGE_SIZE - 1) / PAGE_SIZE;
+
+        if (NULL == (ramdisk_pages = page_alloc_n(tpages)))
+                panic("Not enough memory for the ram disk's table\n");
+        for (ramdisk_nblocks = 0; ramdisk_nblocks < __RAMDISK_PAGES__; ramdisk_nblocks++) {
+                if (NULL == (ramdisk_pages[ramdisk_nblocks] = page_alloc()))
+                        panic("Not enough memory for a ram disk of %u pages\n",
+                              __RAMDISK_PAGES__);
+                page_zero(ramdisk_pages[ramdisk_nblocks]);
+        }
+
+        ramdisk.bd_id = MKDEVID(RAMDISK_MAJOR, 0);
+        ramdisk.bd_ops = &ramdisk_ops;
+        if (0 > blockdev_register(&ramdisk))
+                panic("Could not register the ram disk\n");
+        dbg(DBG_INIT, "Ram disk of %u blocks\n", ramdisk_nblocks);
+#endif
+}
+init_func(ramdisk_init);
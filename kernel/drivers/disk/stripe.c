@@ -0,0 +1,103 @@
+/*
+ * A striped (RAID-0) block device: MKDEVID(STRIPE_MAJOR, 0), made of the
+ * last __STRIPE_DISKS__ disks, which it takes over. Its blocks are dealt
+ * out to them __STRIPE_BLOCKS__ at a time in turn, so block b is in
+ * stripe s = b / __STRIPE_BLOCKS__, which is on member s % ndisks at
+ * (s / ndisks) * __STRIPE_BLOCKS__ + b % __STRIPE_BLOCKS__.
+ *
+ * A transfer is split at the stripe boundaries, and every piece is
+ * queued on its member's request queue (see blkqueue.c) before any is
+ * waited for, so that the members' queue threads carry them out side by
+ * side. The device itself has no queue: blk_submit calls into it in the
+ * submitter's thread, which is the one that waits for the pieces.
+ */
+
+#include "types.h"
+#include "kernel.h"
+#include "errno.h"
+
+#include "drivers/dev.h"
+#include "drivers/blockdev.h"
+#include "drivers/disk/blkqueue.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+
+/* Most pieces of a transfer in flight at once, each a request on the
+ * stack */
+#define STRIPE_MAX_PIECES       8
+
+static blockdev_t stripe;
+static blockdev_t *stripe_members[__NDISKS__];
+static int stripe_ndisks = 0;
+
+static int
+stripe_transfer(int dir, char *buf, blocknum_t loc, size_t count)
+{
+        blk_request_t pieces[STRIPE_MAX_PIECES];
+        int i, n, ret, err = 0;
+
+        while (0 < count) {
+                for (n = 0; n < STRIPE_MAX_PIECES && 0 < count; n++) {
+                        uint32_t s = loc / __STRIPE_BLOCKS__;
+                        uint32_t off = loc % __STRIPE_BLOCKS__;
+                        size_t len = MIN(count, (size_t) (__STRIPE_BLOCKS__ - off));
+
+                        blk_request_init(&pieces[n], stripe_members[s % stripe_ndisks], dir,
+                                         buf, (s / stripe_ndisks) * __STRIPE_BLOCKS__ + off, len);
+                        blk_submit(&pieces[n]);
+                        buf += len * BLOCK_SIZE;
+                        loc += len;
+                        count -= len;
+                }
+                for (i = 0; i < n; i++) {
+                        if (0 > (ret = blk_wait(&pieces[i])) && !err)
+                                err = ret;
+                }
+                if (err)
+                        return err;
+        }
+        return 0;
+}
+
+static int
+stripe_read_block(blockdev_t *bdev, char *buf, blocknum_t loc, size_t count)
+{
+        return stripe_transfer(BLK_READ, buf, loc, count);
+}
+
+static int
+stripe_write_block(blockdev_t *bdev, const char *buf, blocknum_t loc, size_t count)
+{
+        return stripe_transfer(BLK_WRITE, (char *) buf, loc, count);
+}
+
+static blockdev_ops_t stripe_ops = {
+        .read_block = stripe_read_block,
+        .write_block = stripe_write_block
+};
+
+static __attribute__((unused)) void
+stripe_init(void)
+{
+#if 1 < __STRIPE_DISKS__
+        int i;
+
+        KASSERT(__STRIPE_DISKS__ <= __NDISKS__ && 0 < __STRIPE_BLOCKS__);
+
+        for (i = __NDISKS__ - __STRIPE_DISKS__; i < __NDISKS__; i++) {
+                if (NULL == (stripe_members[stripe_ndisks++] = blockdev_lookup(MKDEVID(DISK_MAJOR, i)))) {
+                        dbg(DBG_INIT, "No disk %d to stripe across\n", i);
+                        return;
+                }
+        }
+
+        stripe.bd_id = MKDEVID(STRIPE_MAJOR, 0);
+        stripe.bd_ops = &stripe_ops;
+        if (0 > blockdev_register(&stripe))
+                panic("Could not register the striped disk\n");
+        dbg(DBG_INIT, "Striping across disks %d to %d, %d blocks at a time\n",
+            __NDISKS__ - __STRIPE_DISKS__, __NDISKS__ - 1, __STRIPE_BLOCKS__);
+#endif
+}
+init_func(stripe_init);
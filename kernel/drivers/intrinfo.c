@@ -0,0 +1,80 @@
+/*
+ * /dev/interrupts - a read-only byte device which reports how often each
+ * interrupt is taken and how long its handler takes (see
+ * intr_stats_info), in the same way as /dev/slabinfo.
+ */
+
+#include "types.h"
+#include "errno.h"
+
+#include "drivers/dev.h"
+#include "drivers/bytedev.h"
+
+#include "main/interrupt.h"
+
+#include "mm/page.h"
+
+#include "util/init.h"
+#include "util/debug.h"
+#include "util/string.h"
+
+/* The snapshot buffer, in pages */
+#define INTRINFO_NPAGES 2
+
+static int intrinfo_read(bytedev_t *dev, int offset, void *buf, int count);
+static int intrinfo_write(bytedev_t *dev, int offset, const void *buf, int count);
+
+static bytedev_ops_t intrinfo_dev_ops = {
+        intrinfo_read,
+        intrinfo_write,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+};
+
+static bytedev_t intrinfo_dev;
+
+static __attribute__((unused)) void
+intrinfo_init(void)
+{
+        intrinfo_dev.cd_id = MEM_INTRINFO_DEVID;
+        intrinfo_dev.cd_ops = &intrinfo_dev_ops;
+        list_link_init(&intrinfo_dev.cd_link);
+
+        if (0 > bytedev_register(&intrinfo_dev))
+                panic("Couldn't register /dev/interrupts\n");
+}
+init_func(intrinfo_init);
+
+static int
+intrinfo_read(bytedev_t *dev, int offset, void *buf, int count)
+{
+        char *snapshot;
+        int len;
+
+        KASSERT(0 <= offset);
+
+        if (NULL == (snapshot = page_alloc_n(INTRINFO_NPAGES)))
+                return -ENOMEM;
+
+        intr_stats_info(NULL, snapshot, INTRINFO_NPAGES * PAGE_SIZE);
+        len = strnlen(snapshot, INTRINFO_NPAGES * PAGE_SIZE);
+
+        if (offset >= len) {
+                count = 0;
+        } else {
+                if (count > len - offset)
+                        count = len - offset;
+                memcpy(buf, snapshot + offset, count);
+        }
+
+        page_free_n(snapshot, INTRINFO_NPAGES);
+        return count;
+}
+
+static int
+intrinfo_write(bytedev_t *dev, int offset, const void *buf, int count)
+{
+        return -EINVAL;
+}
@@ -0,0 +1,90 @@
+/*
+ * Message signalled interrupts, for the devices found by the prebuilt
+ * PCI code. A device with the MSI capability can be made to raise its
+ * interrupts by writing a message straight to a local APIC, with a
+ * vector of its own for each message it sends, rather than asserting a
+ * line which the IOAPIC, possibly shared with other devices, forwards.
+ * The messages are fixed delivery and edge triggered, to the boot
+ * processor, like the IOAPIC's redirections (see apic.c).
+ */
+
+#include "types.h"
+#include "kernel.h"
+#include "errno.h"
+
+#include "drivers/pci.h"
+
+#include "main/apic.h"
+
+#include "util/debug.h"
+
+uint8_t
+pci_find_capability(pcidev_t *dev, uint8_t id)
+{
+        uint8_t off;
+        int n;
+
+        if (!(pci_read_config(dev, PCI_STATUS, 2) & PCI_STATUS_CAPLIST))
+                return 0;
+        /* the list is bounded by the configuration space, in case it
+         * loops */
+        off = pci_read_config(dev, PCI_CAPLIST, 1) & ~0x3;
+        for (n = 0; 0 != off && n < 48; n++) {
+                if (id == pci_read_config(dev, off, 1))
+                        return off;
+                off = pci_read_config(dev, off + 1, 1) & ~0x3;
+        }
+        return 0;
+}
+
+int
+pci_msi_enable(pcidev_t *dev, uint8_t intr, int nvecs)
+{
+        uint8_t cap;
+        uint32_t ctl, cmd;
+        int log2;
+
+        KASSERT(0 < nvecs && 32 >= nvecs && 0 == (nvecs & (nvecs - 1)));
+        KASSERT(0 == intr % nvecs);
+
+        if (0 == (cap = pci_find_capability(dev, PCI_CAP_MSI)))
+                return -ENODEV;
+        log2 = 31 - __builtin_clz(nvecs);
+        ctl = pci_read_config(dev, cap + PCI_MSI_CONTROL, 2);
+        if (PCI_MSI_CTL_MMC(ctl) < (uint32_t) log2)
+                return -ERANGE;
+
+        /* message i is sent as intr + i, the low bits of the data */
+        pci_write_config(dev, cap + PCI_MSI_ADDR,
+                         PCI_MSI_ADDR_BASE | PCI_MSI_ADDR_DEST(apic_cpu_id(0)), 4);
+        if (ctl & PCI_MSI_CTL_64BIT) {
+                pci_write_config(dev, cap + PCI_MSI_ADDR_HI, 0, 4);
+                pci_write_config(dev, cap + PCI_MSI_DATA_64, intr, 2);
+        } else {
+                pci_write_config(dev, cap + PCI_MSI_DATA_32, intr, 2);
+        }
+        ctl &= ~PCI_MSI_CTL_MME_MASK;
+        ctl |= (log2 << PCI_MSI_CTL_MME_SHIFT) | PCI_MSI_CTL_ENABLE;
+        pci_write_config(dev, cap + PCI_MSI_CONTROL, ctl, 2);
+
+        cmd = pci_read_config(dev, PCI_COMMAND, 2);
+        pci_write_config(dev, PCI_COMMAND, cmd | PCI_CMD_INTXDISABLE, 2);
+
+        dbg(DBG_CORE, "pci %02x:%02x.%x: %d MSI vectors from 0x%x\n",
+            dev->pci_bus, dev->pci_device, dev->pci_func, nvecs, intr);
+        return 0;
+}
+
+void
+pci_msi_disable(pcidev_t *dev)
+{
+        uint8_t cap;
+        uint32_t ctl, cmd;
+
+        if (0 == (cap = pci_find_capability(dev, PCI_CAP_MSI)))
+                return;
+        ctl = pci_read_config(dev, cap + PCI_MSI_CONTROL, 2);
+        pci_write_config(dev, cap + PCI_MSI_CONTROL, ctl & ~PCI_MSI_CTL_ENABLE, 2);
+        cmd = pci_read_config(dev, PCI_COMMAND, 2);
+        pci_write_config(dev, PCI_COMMAND, cmd & ~PCI_CMD_INTXDISABLE, 2);
+}
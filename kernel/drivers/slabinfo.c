@@ -0,0 +1,83 @@
+/*
+ * /dev/slabinfo - a read-only byte device which reports the statistics
+ * kept by the slab allocators (see slab_allocators_info).
+ *
+ * Each read takes a fresh snapshot of the statistics and returns the
+ * part of it starting at the given offset, so reading the entire device
+ * sequentially returns one consistent snapshot as long as nothing is
+ * allocated in between reads.
+ */
+
+#include "types.h"
+#include "errno.h"
+
+#include "drivers/dev.h"
+#include "drivers/bytedev.h"
+
+#include "mm/page.h"
+#include "mm/slab.h"
+
+#include "util/init.h"
+#include "util/debug.h"
+#include "util/string.h"
+
+/* The snapshot buffer, in pages */
+#define SLABINFO_NPAGES 2
+
+static int slabinfo_read(bytedev_t *dev, int offset, void *buf, int count);
+static int slabinfo_write(bytedev_t *dev, int offset, const void *buf, int count);
+
+static bytedev_ops_t slabinfo_dev_ops = {
+        slabinfo_read,
+        slabinfo_write,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+};
+
+static bytedev_t slabinfo_dev;
+
+static __attribute__((unused)) void
+slabinfo_init(void)
+{
+        slabinfo_dev.cd_id = MEM_SLABINFO_DEVID;
+        slabinfo_dev.cd_ops = &slabinfo_dev_ops;
+        list_link_init(&slabinfo_dev.cd_link);
+
+        if (0 > bytedev_register(&slabinfo_dev))
+                panic("Couldn't register /dev/slabinfo\n");
+}
+init_func(slabinfo_init);
+
+static int
+slabinfo_read(bytedev_t *dev, int offset, void *buf, int count)
+{
+        char *snapshot;
+        int len;
+
+        KASSERT(0 <= offset);
+
+        if (NULL == (snapshot = page_alloc_n(SLABINFO_NPAGES)))
+                return -ENOMEM;
+
+        slab_allocators_info(NULL, snapshot, SLABINFO_NPAGES * PAGE_SIZE);
+        len = strnlen(snapshot, SLABINFO_NPAGES * PAGE_SIZE);
+
+        if (offset >= len) {
+                count = 0;
+        } else {
+                if (count > len - offset)
+                        count = len - offset;
+                memcpy(buf, snapshot + offset, count);
+        }
+
+        page_free_n(snapshot, SLABINFO_NPAGES);
+        return count;
+}
+
+static int
+slabinfo_write(bytedev_t *dev, int offset, const void *buf, int count)
+{
+        return -EINVAL;
+}
@@ -0,0 +1,96 @@
+/*
+ * /dev/sysstat - a byte device which reports how often each syscall is
+ * made and how long it takes (see syscall_stats_info), in the same way
+ * as /dev/sysstat. Writing "on", "off" or "reset" to it starts, stops
+ * or clears the collection.
+ */
+
+#include "types.h"
+#include "errno.h"
+
+#include "drivers/dev.h"
+#include "drivers/bytedev.h"
+
+#include "api/syscall.h"
+
+#include "mm/page.h"
+
+#include "util/init.h"
+#include "util/debug.h"
+#include "util/string.h"
+
+/* The snapshot buffer, in pages */
+#define SYSSTAT_NPAGES 4
+
+static int sysstat_read(bytedev_t *dev, int offset, void *buf, int count);
+static int sysstat_write(bytedev_t *dev, int offset, const void *buf, int count);
+
+static bytedev_ops_t sysstat_dev_ops = {
+        sysstat_read,
+        sysstat_write,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+};
+
+static bytedev_t sysstat_dev;
+
+static __attribute__((unused)) void
+sysstat_init(void)
+{
+        sysstat_dev.cd_id = MEM_SYSSTAT_DEVID;
+        sysstat_dev.cd_ops = &sysstat_dev_ops;
+        list_link_init(&sysstat_dev.cd_link);
+
+        if (0 > bytedev_register(&sysstat_dev))
+                panic("Couldn't register /dev/sysstat\n");
+}
+init_func(sysstat_init);
+
+static int
+sysstat_read(bytedev_t *dev, int offset, void *buf, int count)
+{
+        char *snapshot;
+        int len;
+
+        KASSERT(0 <= offset);
+
+        if (NULL == (snapshot = page_alloc_n(SYSSTAT_NPAGES)))
+                return -ENOMEM;
+
+        syscall_stats_info(NULL, snapshot, SYSSTAT_NPAGES * PAGE_SIZE);
+        len = strnlen(snapshot, SYSSTAT_NPAGES * PAGE_SIZE);
+
+        if (offset >= len) {
+                count = 0;
+        } else {
+                if (count > len - offset)
+                        count = len - offset;
+                memcpy(buf, snapshot + offset, count);
+        }
+
+        page_free_n(snapshot, SYSSTAT_NPAGES);
+        return count;
+}
+
+static int
+sysstat_write(bytedev_t *dev, int offset, const void *buf, int count)
+{
+        const char *cmd = buf;
+        int len = count;
+
+        /* echo adds a newline */
+        if (0 < len && '\n' == cmd[len - 1])
+                len--;
+
+        if (2 == len && !strncmp(cmd, "on", 2))
+                syscall_stats_enable(1);
+        else if (3 == len && !strncmp(cmd, "off", 3))
+                syscall_stats_enable(0);
+        else if (5 == len && !strncmp(cmd, "reset", 5))
+                syscall_stats_reset();
+        else
+                return -EINVAL;
+        return count;
+}
@@ -0,0 +1,82 @@
+/*
+ * /dev/trace - a byte device which holds the tracepoint rings (see
+ * api/trace.h), for usr/bin/trace to decode. Writing "on [class,...]",
+ * "off" or "reset" to it turns classes on, turns them all off, or
+ * empties the rings.
+ */
+
+#include "types.h"
+#include "errno.h"
+
+#include "drivers/dev.h"
+#include "drivers/bytedev.h"
+
+#include "api/trace.h"
+
+#include "util/init.h"
+#include "util/debug.h"
+#include "util/string.h"
+
+static int trace_dev_read(bytedev_t *dev, int offset, void *buf, int count);
+static int trace_dev_write(bytedev_t *dev, int offset, const void *buf, int count);
+
+static bytedev_ops_t trace_dev_ops = {
+        trace_dev_read,
+        trace_dev_write,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+};
+
+static bytedev_t trace_dev;
+
+static __attribute__((unused)) void
+trace_dev_init(void)
+{
+        trace_dev.cd_id = MEM_TRACE_DEVID;
+        trace_dev.cd_ops = &trace_dev_ops;
+        list_link_init(&trace_dev.cd_link);
+
+        if (0 > bytedev_register(&trace_dev))
+                panic("Couldn't register /dev/trace\n");
+}
+init_func(trace_dev_init);
+
+static int
+trace_dev_read(bytedev_t *dev, int offset, void *buf, int count)
+{
+        return trace_read(offset, buf, count);
+}
+
+static int
+trace_dev_write(bytedev_t *dev, int offset, const void *buf, int count)
+{
+        char cmd[128];
+        uint32_t classes;
+        int len = count;
+        int err;
+
+        if (len >= (int)sizeof(cmd))
+                return -EINVAL;
+        memcpy(cmd, buf, len);
+        /* echo adds a newline */
+        if (0 < len && '\n' == cmd[len - 1])
+                len--;
+        cmd[len] = '\0';
+
+        if (!strcmp(cmd, "on")) {
+                err = trace_enable((1 << TRACE_NCLASSES) - 1);
+        } else if (!strncmp(cmd, "on ", 3)) {
+                if (0 == (err = trace_parse(cmd + 3, &classes)))
+                        err = trace_enable(classes);
+        } else if (!strcmp(cmd, "off")) {
+                err = trace_enable(0);
+        } else if (!strcmp(cmd, "reset")) {
+                trace_reset();
+                err = 0;
+        } else {
+                err = -EINVAL;
+        }
+        return (0 > err) ? err : count;
+}
@@ -0,0 +1,193 @@
+/*
+ * The VGA text mode screen.
+ *
+ * The frame buffer is 32 KB, eight screenfuls and a bit, and the CRT
+ * controller shows whichever screenful starts at its start address.
+ * So scrolling (which the virtual terminals do by handing screen_putbuf
+ * the whole new screen) moves the start address down the buffer a few
+ * rows and writes the new rows, instead of the whole screen. Only
+ * once the window runs off the end of the buffer is the screen written
+ * out again, at the start.
+ *
+ * Writes to the frame buffer are slow, far slower than to memory, so a
+ * copy of what is on the screen is kept, and screen_putbuf only writes
+ * the rows which it changes.
+ */
+
+#include "types.h"
+#include "kernel.h"
+
+#include "main/io.h"
+#include "main/interrupt.h"
+
+#include "mm/page.h"
+#include "mm/pagetable.h"
+
+#include "drivers/tty/screen.h"
+#include "drivers/tty/virtterm.h"
+
+#include "util/string.h"
+
+#define SCREEN_PADDR            0xb8000
+#define SCREEN_NPAGES           8
+#define SCREEN_NCELLS           (SCREEN_NPAGES * PAGE_SIZE / sizeof(uint16_t))
+
+/* White on black */
+#define SCREEN_ATTRIB           0x0f
+#define SCREEN_CELL(c, attrib)  ((uint16_t)(uint8_t)(c) | ((attrib) << 8))
+
+#define CRTC_INDEX              0x3d4
+#define CRTC_DATA               0x3d5
+/* Each is followed by its low byte */
+#define CRTC_START_HIGH         0x0c
+#define CRTC_CURSOR_HIGH        0x0e
+
+static uint16_t *screen_vga;    /* the frame buffer */
+static uint32_t screen_origin;  /* the cell at the top left of the screen */
+static uint16_t screen_shadow[DISPLAY_SIZE];    /* what is showing */
+static uint8_t screen_cursor_x, screen_cursor_y;
+
+static void
+screen_crtc_write(uint8_t reg, uint16_t val)
+{
+        outb(CRTC_INDEX, reg);
+        outb(CRTC_DATA, val >> 8);
+        outb(CRTC_INDEX, reg + 1);
+        outb(CRTC_DATA, val & 0xff);
+}
+
+void
+screen_init(void)
+{
+        screen_vga = (uint16_t *) pt_phys_perm_map(SCREEN_PADDR, SCREEN_NPAGES);
+        screen_origin = 0;
+        screen_crtc_write(CRTC_START_HIGH, 0);
+        memcpy(screen_shadow, screen_vga, sizeof(screen_shadow));
+}
+
+void
+screen_move_cursor(uint8_t x, uint8_t y)
+{
+        screen_cursor_x = x;
+        screen_cursor_y = y;
+        screen_crtc_write(CRTC_CURSOR_HIGH, screen_origin + y * DISPLAY_WIDTH + x);
+}
+
+void
+screen_putchar_attrib(char c, uint8_t x, uint8_t y, uint8_t attrib)
+{
+        uint32_t i = y * DISPLAY_WIDTH + x;
+        uint16_t cell = SCREEN_CELL(c, attrib);
+
+        screen_shadow[i] = cell;
+        screen_vga[screen_origin + i] = cell;
+}
+
+void
+screen_putchar(char c, uint8_t x, uint8_t y)
+{
+        screen_putchar_attrib(c, x, y, SCREEN_ATTRIB);
+}
+
+/* Cell i of a new screen, given as characters (cells NULL) or cells */
+static inline uint16_t
+screen_cell(const char *chars, const uint16_t *cells, int i)
+{
+        return (NULL == cells) ? SCREEN_CELL(chars[i], SCREEN_ATTRIB) : cells[i];
+}
+
+/* If row new of the new screen is row old of what is showing */
+static int
+screen_row_same(const char *chars, const uint16_t *cells, int new, int old)
+{
+        int i;
+
+        for (i = 0; i < DISPLAY_WIDTH; i++) {
+                if (screen_cell(chars, cells, new * DISPLAY_WIDTH + i)
+                    != screen_shadow[old * DISPLAY_WIDTH + i])
+                        return 0;
+        }
+        return 1;
+}
+
+/*
+ * Shows a new screen. If it is the current one scrolled up by fewer
+ * rows than would have to be written otherwise, the start address is
+ * moved down that many rows and only those are written; either way,
+ * only the rows which differ from what is showing are written.
+ */
+static void
+screen_update(const char *chars, const uint16_t *cells)
+{
+        uint8_t oldipl = intr_getipl();
+        int dirty = 0, scroll, row, i;
+        int fresh = DISPLAY_HEIGHT;     /* rows from here on are unknown */
+
+        intr_setipl(IPL_HIGH);
+
+        for (row = 0; row < DISPLAY_HEIGHT; row++)
+                dirty += !screen_row_same(chars, cells, row, row);
+
+        for (scroll = 1; scroll < dirty; scroll++) {
+                for (row = 0; row + scroll < DISPLAY_HEIGHT; row++)
+                        if (!screen_row_same(chars, cells, row, row + scroll))
+                                break;
+                if (row + scroll == DISPLAY_HEIGHT)
+                        break;
+        }
+
+        if (scroll < dirty) {
+                /* forwards, as the copy overlaps */
+                for (i = 0; i < (DISPLAY_HEIGHT - scroll) * DISPLAY_WIDTH; i++)
+                        screen_shadow[i] = screen_shadow[i + scroll * DISPLAY_WIDTH];
+                screen_origin += scroll * DISPLAY_WIDTH;
+                fresh = DISPLAY_HEIGHT - scroll;
+                if (screen_origin + DISPLAY_SIZE > SCREEN_NCELLS) {
+                        /* off the end: start again at the top */
+                        screen_origin = 0;
+                        fresh = 0;
+                }
+        }
+
+        for (row = 0; row < DISPLAY_HEIGHT; row++) {
+                if (row < fresh && screen_row_same(chars, cells, row, row))
+                        continue;
+                for (i = row * DISPLAY_WIDTH; i < (row + 1) * DISPLAY_WIDTH; i++) {
+                        screen_shadow[i] = screen_cell(chars, cells, i);
+                        screen_vga[screen_origin + i] = screen_shadow[i];
+                }
+        }
+
+        if (scroll < dirty) {
+                screen_crtc_write(CRTC_START_HIGH, screen_origin);
+                screen_move_cursor(screen_cursor_x, screen_cursor_y);
+        }
+
+        intr_setipl(oldipl);
+}
+
+void
+screen_putbuf(const char *buf)
+{
+        screen_update(buf, NULL);
+}
+
+void
+screen_putbuf_attrib(const uint16_t *buf)
+{
+        screen_update(NULL, buf);
+}
+
+void
+screen_clear(void)
+{
+        uint8_t oldipl = intr_getipl();
+        int i;
+
+        intr_setipl(IPL_HIGH);
+        for (i = 0; i < DISPLAY_SIZE; i++) {
+                screen_shadow[i] = SCREEN_CELL(' ', SCREEN_ATTRIB);
+                screen_vga[screen_origin + i] = screen_shadow[i];
+        }
+        intr_setipl(oldipl);
+}
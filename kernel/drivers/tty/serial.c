@@ -0,0 +1,238 @@
+/*
+ * A tty driver for a 16550 UART, COM2, which appears as the tty after
+ * the virtual terminals (/dev/ttyS0). COM1 is left to the debug output
+ * (see util/debug.c).
+ *
+ * Both directions are interrupt driven, with the UART's 16-byte FIFOs
+ * on. Output goes into a ring, which the transmitter-empty interrupt
+ * sends a FIFO's worth at a time, so a write only waits if the ring is
+ * full. Input is handed to the line discipline from the receive
+ * interrupt, as the keyboard's is.
+ */
+
+#include "types.h"
+#include "kernel.h"
+
+#include "main/io.h"
+#include "main/interrupt.h"
+
+#include "drivers/bytedev.h"
+#include "drivers/tty/driver.h"
+#include "drivers/tty/ldisc.h"
+#include "drivers/tty/n_tty.h"
+#include "drivers/tty/tty.h"
+#include "drivers/tty/virtterm.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+
+#define SERIAL_PORT     0x2f8           /* COM2 */
+#define SERIAL_IRQ      3
+
+/* Registers, from the port */
+#define UART_DATA       0               /* receive / transmit */
+#define UART_IER        1               /* interrupt enable */
+#define UART_IIR        2               /* interrupt identification (read) */
+#define UART_FCR        2               /* FIFO control (write) */
+#define UART_LCR        3               /* line control */
+#define UART_MCR        4               /* modem control */
+#define UART_LSR        5               /* line status */
+#define UART_MSR        6               /* modem status */
+#define UART_SCRATCH    7
+
+#define IER_RX          0x01
+#define IER_TX          0x02
+#define IIR_NONE        0x01
+#define IIR_ID(iir)     ((iir) & 0x0e)
+#define IIR_MODEM       0x00
+#define IIR_TX          0x02
+#define IIR_RX          0x04
+#define IIR_LINE        0x06
+#define IIR_TIMEOUT     0x0c
+#define LSR_RX          0x01
+#define LSR_TX_EMPTY    0x20
+
+/* How many bytes the transmitter FIFO takes once empty */
+#define UART_FIFO       16
+
+#define SERIAL_RING_SIZE 1024
+
+typedef struct serial_tty {
+        tty_driver_t st_driver;
+        uint16_t     st_port;
+        char         st_ring[SERIAL_RING_SIZE];
+        uint32_t     st_head;   /* where the next byte goes */
+        uint32_t     st_tail;   /* the next byte to send */
+} serial_tty_t;
+
+static void serial_provide_char(tty_driver_t *ttyd, char c);
+static tty_driver_callback_t serial_register_callback_handler(
+        tty_driver_t *ttyd, tty_driver_callback_t callback, void *arg);
+static tty_driver_callback_t serial_unregister_callback_handler(
+        tty_driver_t *ttyd);
+static void *serial_block_io(tty_driver_t *ttyd);
+static void serial_unblock_io(tty_driver_t *ttyd, void *data);
+
+static tty_driver_ops_t serial_driver_ops = {
+        serial_provide_char,
+        serial_register_callback_handler,
+        serial_unregister_callback_handler,
+        serial_block_io,
+        serial_unblock_io
+};
+
+static serial_tty_t serial_tty;
+
+/* Moves bytes from the ring to the transmitter FIFO if it is empty.
+ * Called at IPL_HIGH. */
+static void
+serial_send(serial_tty_t *st)
+{
+        int n;
+
+        if (!(inb(st->st_port + UART_LSR) & LSR_TX_EMPTY))
+                return;
+        for (n = 0; n < UART_FIFO && st->st_tail != st->st_head; n++)
+                outb(st->st_port + UART_DATA, st->st_ring[st->st_tail++ % SERIAL_RING_SIZE]);
+}
+
+static void
+serial_provide_char(tty_driver_t *ttyd, char c)
+{
+        serial_tty_t *st = (serial_tty_t *) ttyd;
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        /* the only wait: until the transmitter has made room */
+        while (st->st_head - st->st_tail == SERIAL_RING_SIZE)
+                serial_send(st);
+        st->st_ring[st->st_head++ % SERIAL_RING_SIZE] = c;
+        serial_send(st);
+        intr_setipl(oldipl);
+}
+
+static tty_driver_callback_t
+serial_register_callback_handler(tty_driver_t *ttyd, tty_driver_callback_t callback,
+                                 void *arg)
+{
+        tty_driver_callback_t old = ttyd->ttd_callback;
+
+        ttyd->ttd_callback = callback;
+        ttyd->ttd_callback_arg = arg;
+        return old;
+}
+
+static tty_driver_callback_t
+serial_unregister_callback_handler(tty_driver_t *ttyd)
+{
+        tty_driver_callback_t old = ttyd->ttd_callback;
+
+        ttyd->ttd_callback = NULL;
+        ttyd->ttd_callback_arg = NULL;
+        return old;
+}
+
+static void *
+serial_block_io(tty_driver_t *ttyd)
+{
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        return (void *)(uintptr_t) oldipl;
+}
+
+static void
+serial_unblock_io(tty_driver_t *ttyd, void *data)
+{
+        intr_setipl((uint8_t)(uintptr_t) data);
+}
+
+static void
+serial_intr(regs_t *regs)
+{
+        serial_tty_t *st = &serial_tty;
+        uint8_t iir;
+        char c;
+
+        while (!((iir = inb(st->st_port + UART_IIR)) & IIR_NONE)) {
+                switch (IIR_ID(iir)) {
+                        case IIR_RX:
+                        case IIR_TIMEOUT:
+                                while (inb(st->st_port + UART_LSR) & LSR_RX) {
+                                        c = inb(st->st_port + UART_DATA);
+                                        /* terminals send CR for return */
+                                        if ('\r' == c)
+                                                c = '\n';
+                                        if (NULL != st->st_driver.ttd_callback)
+                                                st->st_driver.ttd_callback(
+                                                        st->st_driver.ttd_callback_arg, c);
+                                }
+                                break;
+                        case IIR_TX:
+                                serial_send(st);
+                                break;
+                        case IIR_LINE:
+                                inb(st->st_port + UART_LSR);
+                                break;
+                        case IIR_MODEM:
+                                inb(st->st_port + UART_MSR);
+                                break;
+                }
+        }
+}
+
+/* Hands a received character to the line discipline and sends back
+ * what it says to echo, as the virtual terminals' tty does */
+static void
+serial_receive(void *arg, char c)
+{
+        tty_device_t *tty = arg;
+        const char *echo;
+
+        echo = tty->tty_ldisc->ld_ops->receive_char(tty->tty_ldisc, c);
+        for (; NULL != echo && '\0' != *echo; echo++)
+                serial_provide_char(tty->tty_driver, *echo);
+}
+
+static __attribute__((unused)) void
+serial_init(void)
+{
+        serial_tty_t *st = &serial_tty;
+        tty_device_t *tty;
+        tty_ldisc_t *ldisc;
+
+        st->st_port = SERIAL_PORT;
+
+        /* nothing there if the scratch register does not hold a value */
+        outb(st->st_port + UART_SCRATCH, 0x5a);
+        if (0x5a != inb(st->st_port + UART_SCRATCH)) {
+                dbg(DBG_INIT, "No UART at 0x%x\n", st->st_port);
+                return;
+        }
+
+        outb(st->st_port + UART_IER, 0x00);
+        outb(st->st_port + UART_LCR, 0x80);     /* Enable DLAB (set baud rate divisor) */
+        outb(st->st_port + UART_DATA, 0x01);    /* Set divisor to 1 (lo byte) 115200 baud */
+        outb(st->st_port + UART_IER, 0x00);     /*                  (hi byte) */
+        outb(st->st_port + UART_LCR, 0x03);     /* 8 bits, no parity, one stop bit */
+        outb(st->st_port + UART_FCR, 0xc7);     /* Enable FIFO, clear them, with 14-byte threshold */
+        outb(st->st_port + UART_MCR, 0x0b);     /* DTR, RTS, and OUT2 to let it interrupt */
+
+        st->st_driver.ttd_ops = &serial_driver_ops;
+        st->st_driver.ttd_callback = NULL;
+        st->st_driver.ttd_callback_arg = NULL;
+
+        if (NULL == (tty = tty_create(&st->st_driver, vt_num_terminals())))
+                panic("Not enough memory to allocate serial tty\n");
+        serial_register_callback_handler(&st->st_driver, serial_receive, tty);
+        if (NULL == (ldisc = n_tty_create()))
+                panic("Not enough memory to allocate line discipline\n");
+        ldisc->ld_ops->attach(ldisc, tty);
+        if (0 > bytedev_register(&tty->tty_cdev))
+                panic("Error registering serial tty as byte device\n");
+
+        intr_register(INTR_SERIAL_TTY, serial_intr);
+        intr_map(SERIAL_IRQ, INTR_SERIAL_TTY);
+        outb(st->st_port + UART_IER, IER_RX | IER_TX);
+}
+init_func(serial_init);
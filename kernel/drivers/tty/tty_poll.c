@@ -0,0 +1,109 @@
+/*
+ * poll(2) on ttys. A tty can always be written, the drivers taking
+ * output as it comes (or waiting for room, as the serial one does), and
+ * can be read once the line discipline has a line cooked.
+ *
+ * The n_tty line discipline is only a prebuilt object, which knows
+ * nothing of polling, so the first poll of a tty puts a copy of its
+ * ldisc's ops in front of it whose receive_char wakes the tty's pollers
+ * after passing the character on. Which of the input buffer has been
+ * cooked is read out of struct n_tty, laid out below as the prebuilt
+ * n_tty.o lays it out.
+ */
+
+#include "types.h"
+#include "kernel.h"
+
+#include "main/interrupt.h"
+
+#include "drivers/tty/ldisc.h"
+#include "drivers/tty/n_tty.h"
+#include "drivers/tty/tty.h"
+
+#include "fs/poll.h"
+
+#include "mm/kmalloc.h"
+
+#include "proc/kmutex.h"
+#include "proc/sched.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+
+struct n_tty {
+        kmutex_t            ntty_rlock;
+        ktqueue_t           ntty_rwaitq;
+        char               *ntty_inbuf;
+        int                 ntty_rhead;         /* the next to be read */
+        int                 ntty_rawtail;
+        int                 ntty_ckdtail;       /* the end of the cooked lines */
+        tty_ldisc_t         ntty_ldisc;
+};
+
+typedef struct tty_poll {
+        tty_ldisc_t        *tp_ldisc;
+        pollhead_t          tp_poll;
+        list_link_t         tp_link;
+} tty_poll_t;
+
+static list_t tty_polls = { &tty_polls, &tty_polls };
+
+/* The ops of the n_tty ldiscs, and the copy put in front of them */
+static tty_ldisc_ops_t *tty_poll_orig_ops = NULL;
+static tty_ldisc_ops_t tty_poll_ops;
+
+static tty_poll_t *
+tty_poll_lookup(tty_ldisc_t *ldisc)
+{
+        tty_poll_t *tp;
+
+        list_iterate_begin(&tty_polls, tp, tty_poll_t, tp_link) {
+                if (tp->tp_ldisc == ldisc)
+                        return tp;
+        } list_iterate_end();
+        return NULL;
+}
+
+/* Called from the keyboard and serial interrupts */
+static const char *
+tty_poll_receive_char(tty_ldisc_t *ldisc, char c)
+{
+        const char *echo = tty_poll_orig_ops->receive_char(ldisc, c);
+        tty_poll_t *tp = tty_poll_lookup(ldisc);
+
+        KASSERT(NULL != tp);
+        poll_wakeup(&tp->tp_poll);
+        return echo;
+}
+
+int
+tty_poll(tty_device_t *tty, int events, struct poll_table *pt)
+{
+        tty_ldisc_t *ldisc = tty->tty_ldisc;
+        n_tty_t *ntty = CONTAINER_OF(ldisc, n_tty_t, ntty_ldisc);
+        tty_poll_t *tp;
+        uint8_t oldipl;
+
+        if (NULL == (tp = tty_poll_lookup(ldisc))) {
+                /* then it cannot be waited for */
+                if (NULL == (tp = kmalloc(sizeof(*tp))))
+                        return POLLERR;
+                tp->tp_ldisc = ldisc;
+                pollhead_init(&tp->tp_poll);
+
+                oldipl = intr_getipl();
+                intr_setipl(IPL_HIGH);
+                if (NULL == tty_poll_orig_ops) {
+                        tty_poll_orig_ops = ldisc->ld_ops;
+                        tty_poll_ops = *ldisc->ld_ops;
+                        tty_poll_ops.receive_char = tty_poll_receive_char;
+                }
+                KASSERT(tty_poll_orig_ops == ldisc->ld_ops);
+                list_insert_tail(&tty_polls, &tp->tp_link);
+                ldisc->ld_ops = &tty_poll_ops;
+                intr_setipl(oldipl);
+        }
+
+        poll_wait(pt, &tp->tp_poll);
+        return (ntty->ntty_rhead != ntty->ntty_ckdtail) ? (POLLIN | POLLOUT) : POLLOUT;
+}
@@ -0,0 +1,118 @@
+/*
+ * Input from the keyboard and serial interrupts, handed to the line
+ * discipline in thread context. The prebuilt tty code registers one
+ * callback with each driver, which feeds each character straight to
+ * n_tty's receive_char and echoes what it returns, all with interrupts
+ * blocked while the reader of the tty may be using the same buffers.
+ *
+ * Instead the driver calls tty_ring_intr, which only puts the character
+ * on a ring and queues the tty's work item. The ring has one producer,
+ * the interrupt, which only moves the head, and one consumer, the work
+ * item, which only moves the tail, so neither waits for the other or
+ * blocks interrupts. The work item passes everything on the ring to the
+ * tty's callback at once, however much was typed or pasted since it
+ * last ran, so a burst is dropped only if it overflows the ring.
+ */
+
+#include "types.h"
+#include "kernel.h"
+
+#include "drivers/bytedev.h"
+#include "drivers/tty/driver.h"
+#include "drivers/tty/tty.h"
+#include "drivers/tty/virtterm.h"
+
+#include "mm/kmalloc.h"
+
+#include "proc/workq.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+
+/* A power of two, so that the free-running indices wrap cleanly */
+#define TTY_RING_SIZE   1024
+
+/* The ends of the ring are only published once what they cover has
+ * been written or read */
+#define tty_ring_barrier()      __asm__ __volatile__("" ::: "memory")
+
+typedef struct tty_ring {
+        tty_driver_callback_t   tr_callback;    /* the tty's, which feeds n_tty */
+        void                   *tr_arg;
+        volatile uint32_t       tr_head;        /* moved by the interrupt */
+        volatile uint32_t       tr_tail;        /* moved by tr_work */
+        uint32_t                tr_ndropped;    /* with the ring full */
+        work_t                  tr_work;
+        char                    tr_buf[TTY_RING_SIZE];
+} tty_ring_t;
+
+static void
+tty_ring_intr(void *arg, char c)
+{
+        tty_ring_t *tr = (tty_ring_t *) arg;
+        uint32_t head = tr->tr_head;
+
+        if (TTY_RING_SIZE == head - tr->tr_tail) {
+                tr->tr_ndropped++;
+                return;
+        }
+        tr->tr_buf[head % TTY_RING_SIZE] = c;
+        tty_ring_barrier();
+        tr->tr_head = head + 1;
+        work_queue(&tr->tr_work);
+}
+
+static void
+tty_ring_drain(void *arg)
+{
+        tty_ring_t *tr = (tty_ring_t *) arg;
+        uint32_t head, tail = tr->tr_tail;
+
+        while (tail != (head = tr->tr_head)) {
+                tty_ring_barrier();
+                for (; tail != head; tail++)
+                        tr->tr_callback(tr->tr_arg, tr->tr_buf[tail % TTY_RING_SIZE]);
+                tty_ring_barrier();
+                tr->tr_tail = tail;
+        }
+}
+
+/* Puts a ring between the driver of the tty and the callback the tty
+ * registered with it */
+static void
+tty_ring_attach(tty_device_t *tty)
+{
+        tty_driver_t *ttyd = tty->tty_driver;
+        tty_ring_t *tr;
+        void *data;
+
+        if (NULL == ttyd->ttd_callback)
+                return;
+        if (NULL == (tr = kmalloc(sizeof(*tr))))
+                panic("Not enough memory for a tty input ring\n");
+        tr->tr_head = 0;
+        tr->tr_tail = 0;
+        tr->tr_ndropped = 0;
+        work_init(&tr->tr_work, tty_ring_drain, tr);
+
+        data = ttyd->ttd_ops->block_io(ttyd);
+        tr->tr_callback = ttyd->ttd_callback;
+        tr->tr_arg = ttyd->ttd_callback_arg;
+        ttyd->ttd_ops->register_callback_handler(ttyd, tty_ring_intr, tr);
+        ttyd->ttd_ops->unblock_io(ttyd, data);
+}
+
+static __attribute__((unused)) void
+tty_ring_init(void)
+{
+        bytedev_t *cdev;
+        int i;
+
+        /* the virtual terminals, and the serial tty after them */
+        for (i = 0; i <= vt_num_terminals(); i++) {
+                if (NULL != (cdev = bytedev_lookup(MKDEVID(TTY_MAJOR, i))))
+                        tty_ring_attach(CONTAINER_OF(cdev, tty_device_t, tty_cdev));
+        }
+}
+init_func(tty_ring_init);
+init_depends(serial_init);
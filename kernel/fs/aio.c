@@ -0,0 +1,651 @@
+#include "kernel.h"
+#include "errno.h"
+#include "globals.h"
+
+#include "api/access.h"
+
+#include "fs/aio.h"
+#include "fs/file.h"
+#include "fs/open.h"
+#include "fs/poll.h"
+#include "fs/stat.h"
+#include "fs/vfs.h"
+#include "fs/vfs_syscall.h"
+#include "fs/vnode.h"
+
+#include "mm/kmalloc.h"
+#include "mm/slab.h"
+
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+
+#include "util/debug.h"
+#include "util/hash.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/time.h"
+
+/*
+ * Asynchronous reads and writes. Requests are carried out by a pool of
+ * aiod workers, which read and write through the page cache as pread
+ * and pwrite do, so that the page fills and cleans they wait for are
+ * queued on the disk's request queue. With a worker to each request, a
+ * process which makes many requests has that many transfers queued at
+ * once, in C-LOOK order, without needing threads of its own.
+ *
+ * A worker is in another address space, so the data goes through a
+ * buffer in the kernel: a write's is copied in when it is made, and a
+ * read's out once its process sees that it has finished.
+ *
+ * A completion queue is a vnode of aiofs, which like pipefs is never
+ * mounted, and its requests are found by the address of their aiocb.
+ * A request holds a reference to the queue's vnode until it has been
+ * done. When the last file on a queue is closed its requests are
+ * dropped, but for those being done, which their workers free.
+ */
+
+/* How many transfers the workers can have going at once */
+#define AIO_NWORKERS    8
+
+#define AIO_READ        0
+#define AIO_WRITE       1
+
+#define AIO_QUEUED      0       /* on aio_pending */
+#define AIO_RUNNING     1       /* being done by a worker */
+#define AIO_DONE        2       /* and on aq_done until read from the queue */
+
+typedef struct aio_queue {
+        pid_t           aq_pid;         /* the process which made it */
+        htable_t        aq_reqs;        /* by the address of their aiocb */
+        list_t          aq_done;        /* finished, and not yet read */
+        int             aq_nfiles;      /* 0 once it is closed */
+        ktqueue_t       aq_waitq;       /* readers of the queue */
+        pollhead_t      aq_poll;
+} aio_queue_t;
+
+typedef struct aio_req {
+        hlink_t             ar_hlink;   /* on aq_reqs */
+        list_link_t         ar_link;    /* on aio_pending, then aq_done */
+        const struct aiocb *ar_ucb;
+        vnode_t            *ar_qvn;     /* the queue's, until it is done */
+        file_t             *ar_file;    /* likewise */
+        int                 ar_dir;     /* AIO_READ or AIO_WRITE */
+        int                 ar_state;
+        off_t               ar_off;
+        void               *ar_ubuf;
+        size_t              ar_nbytes;
+        char               *ar_buf;     /* the data, while in the kernel */
+        int                 ar_ret;     /* bytes moved or -errno, once done */
+} aio_req_t;
+
+#define VNODE_TO_AIOQ(vn)       ((aio_queue_t *)((vn)->vn_i))
+
+static void aio_read_vnode(vnode_t *vnode);
+static void aio_delete_vnode(vnode_t *vnode);
+static int  aio_query_vnode(vnode_t *vnode);
+
+static fs_ops_t aio_fsops = {
+        .read_vnode = aio_read_vnode,
+        .delete_vnode = aio_delete_vnode,
+        .query_vnode = aio_query_vnode,
+        .umount = NULL
+};
+
+static fs_t aio_fs = {
+        .fs_dev = "aio",
+        .fs_type = "aio",
+        .fs_op = &aio_fsops,
+        .fs_root = NULL,
+        .fs_i = NULL
+};
+
+static int aio_queue_read(vnode_t *vnode, off_t offset, void *buf, size_t len);
+static int aio_queue_read_nonblock(vnode_t *vnode, off_t offset, void *buf, size_t len);
+static int aio_queue_write(vnode_t *vnode, off_t offset, const void *buf, size_t len);
+static int aio_queue_poll(vnode_t *vnode, int events, struct poll_table *pt);
+static int aio_queue_stat(vnode_t *vnode, struct stat *ss);
+static int aio_queue_acquire(vnode_t *vnode, file_t *file);
+static int aio_queue_release(vnode_t *vnode, file_t *file);
+
+static vnode_ops_t aio_vops = {
+        .read = aio_queue_read,
+        .write = aio_queue_write,
+        .poll = aio_queue_poll,
+        .read_nonblock = aio_queue_read_nonblock,
+        .stat = aio_queue_stat,
+        .acquire = aio_queue_acquire,
+        .release = aio_queue_release
+};
+
+static slab_allocator_t *aio_queue_allocator = NULL;
+static slab_allocator_t *aio_req_allocator = NULL;
+static int next_qno = 0;
+
+static list_t aio_pending;             /* requests for the workers, FIFO */
+static ktqueue_t aio_waitq;            /* idle workers sleep on this */
+static ktqueue_t aio_done_waitq;       /* and aio_suspend on this */
+
+static proc_t *aio_procs[AIO_NWORKERS];
+static kthread_t *aio_thrs[AIO_NWORKERS];
+
+static void *aiod_run(int arg1, void *arg2);
+
+static __attribute__((unused)) void
+aio_init(void)
+{
+        int i;
+
+        aio_queue_allocator = slab_allocator_create("aioqueue", sizeof(aio_queue_t));
+        KASSERT(NULL != aio_queue_allocator);
+        aio_req_allocator = slab_allocator_create("aioreq", sizeof(aio_req_t));
+        KASSERT(NULL != aio_req_allocator);
+
+        list_init(&aio_pending);
+        sched_queue_init(&aio_waitq);
+        sched_queue_init(&aio_done_waitq);
+
+        /* without MTP each worker is a process of its own, as in workq */
+        for (i = 0; i < AIO_NWORKERS; i++) {
+                aio_procs[i] = proc_create("aiod");
+                KASSERT(NULL != aio_procs[i]);
+                aio_thrs[i] = kthread_create(aio_procs[i], aiod_run, i, NULL);
+                KASSERT(NULL != aio_thrs[i]);
+                sched_make_runnable(aio_thrs[i]);
+        }
+}
+init_func(aio_init);
+init_depends(vfs_init);
+
+void
+aio_shutdown(void)
+{
+        int i;
+
+        KASSERT(PID_IDLE == curproc->p_pid);
+        for (i = 0; i < AIO_NWORKERS; i++) {
+                KASSERT(NULL != aio_thrs[i]);
+                kthread_cancel(aio_thrs[i], (void *) 0);
+                aio_thrs[i] = NULL;
+        }
+        for (i = 0; i < AIO_NWORKERS; i++)
+                do_waitpid(aio_procs[i]->p_pid, 0, NULL);
+        KASSERT(list_empty(&aio_pending));
+}
+
+static void
+aio_req_free(aio_req_t *req)
+{
+        if (NULL != req->ar_buf)
+                kfree(req->ar_buf);
+        if (NULL != req->ar_file)
+                fput(req->ar_file);
+        slab_obj_free(aio_req_allocator, req);
+}
+
+/* Copies a finished read's data out, the first time its process, which
+ * must be curproc, sees that it has finished */
+static void
+aio_req_copyout(aio_req_t *req)
+{
+        KASSERT(AIO_DONE == req->ar_state);
+        if (NULL == req->ar_buf)
+                return;
+        if (0 < req->ar_ret && 0 > copy_to_user(req->ar_ubuf, req->ar_buf, req->ar_ret))
+                req->ar_ret = -EFAULT;
+        kfree(req->ar_buf);
+        req->ar_buf = NULL;
+}
+
+static aio_req_t *
+aio_req_find(aio_queue_t *q, const struct aiocb *ucb)
+{
+        aio_req_t *req;
+
+        htable_iterate_begin(&q->aq_reqs, hash_ptr(ucb), req, aio_req_t, ar_hlink) {
+                if (ucb == req->ar_ucb)
+                        return req;
+        } htable_iterate_end();
+        return NULL;
+}
+
+/* Takes the next request off the pending list, waiting for one if there
+ * is none, or returns NULL once the worker has been cancelled and the
+ * list is empty */
+static aio_req_t *
+aio_next(void)
+{
+        aio_req_t *req;
+
+        while (list_empty(&aio_pending)) {
+                if (0 > sched_cancellable_sleep_on(&aio_waitq))
+                        return NULL;
+        }
+        req = list_head(&aio_pending, aio_req_t, ar_link);
+        list_remove(&req->ar_link);
+        return req;
+}
+
+static void
+aio_do(aio_req_t *req)
+{
+        vnode_t *qvn = req->ar_qvn;
+        aio_queue_t *q = VNODE_TO_AIOQ(qvn);
+        int ret;
+
+        req->ar_state = AIO_RUNNING;
+        if (AIO_READ == req->ar_dir)
+                ret = file_pread(req->ar_file, req->ar_buf, req->ar_nbytes, req->ar_off);
+        else
+                ret = file_pwrite(req->ar_file, req->ar_buf, req->ar_nbytes, req->ar_off);
+
+        fput(req->ar_file);
+        req->ar_file = NULL;
+        req->ar_qvn = NULL;
+        req->ar_ret = ret;
+        req->ar_state = AIO_DONE;
+        if (AIO_WRITE == req->ar_dir && NULL != req->ar_buf) {
+                kfree(req->ar_buf);
+                req->ar_buf = NULL;
+        }
+
+        if (0 == q->aq_nfiles) {
+                /* the queue was closed while this was being done */
+                aio_req_free(req);
+        } else {
+                list_insert_tail(&q->aq_done, &req->ar_link);
+                sched_broadcast_on(&q->aq_waitq);
+                sched_broadcast_on(&aio_done_waitq);
+                poll_wakeup(&q->aq_poll);
+        }
+        vput(qvn);
+}
+
+static void *
+aiod_run(int arg1, void *arg2)
+{
+        aio_req_t *req;
+
+        while (NULL != (req = aio_next()))
+                aio_do(req);
+        return NULL;
+}
+
+/* The queue open as fd, held, which only the process which made it may
+ * use */
+static int
+aio_queue_get(int fd, file_t **res)
+{
+        file_t *file;
+
+        if (NULL == (file = fget(fd)))
+                return -EBADF;
+        if (&aio_vops != file->f_vnode->vn_ops
+            || VNODE_TO_AIOQ(file->f_vnode)->aq_pid != curproc->p_pid) {
+                fput(file);
+                return -EBADF;
+        }
+        *res = file;
+        return 0;
+}
+
+/* Finds the request made with ucb, in the queue it names, which is
+ * returned held in *qf */
+static int
+aio_lookup(const struct aiocb *ucb, file_t **qf, aio_req_t **res)
+{
+        int qfd, ret;
+
+        if (0 > (ret = copy_from_user(&qfd, &ucb->aio_queue, sizeof(qfd))))
+                return ret;
+        if (0 > (ret = aio_queue_get(qfd, qf)))
+                return ret;
+        if (NULL == (*res = aio_req_find(VNODE_TO_AIOQ((*qf)->f_vnode), ucb))) {
+                fput(*qf);
+                return -EINVAL;
+        }
+        return 0;
+}
+
+int
+do_aio_setup(void)
+{
+        aio_queue_t *q;
+        vnode_t *vn;
+        file_t *file;
+        int fd;
+
+        if (0 > (fd = get_empty_fd(curproc)))
+                return fd;
+        if (NULL == (q = slab_obj_alloc(aio_queue_allocator)))
+                return -ENOMEM;
+        q->aq_pid = curproc->p_pid;
+        htable_init(&q->aq_reqs);
+        list_init(&q->aq_done);
+        q->aq_nfiles = 0;
+        sched_queue_init(&q->aq_waitq);
+        pollhead_init(&q->aq_poll);
+
+        if (NULL == (vn = vget(&aio_fs, next_qno++))) {
+                slab_obj_free(aio_queue_allocator, q);
+                return -ENOMEM;
+        }
+        KASSERT(NULL == vn->vn_i);
+        vn->vn_i = q;
+
+        if (NULL == (file = fget(-1))) {
+                vput(vn);
+                return -ENOMEM;
+        }
+        /* the file takes vget's reference */
+        file->f_mode = FMODE_READ;
+        facq(file, vn);
+        curproc->p_files[fd] = file;
+        return fd;
+}
+
+static int
+aio_submit(const struct aiocb *ucb, int dir)
+{
+        struct aiocb cb;
+        aio_queue_t *q;
+        aio_req_t *req;
+        file_t *qf, *file;
+        int ret;
+
+        if (0 > (ret = copy_from_user(&cb, ucb, sizeof(cb))))
+                return ret;
+        if (0 > (ret = aio_queue_get(cb.aio_queue, &qf)))
+                return ret;
+        q = VNODE_TO_AIOQ(qf->f_vnode);
+
+        if (NULL != aio_req_find(q, ucb) || AIO_MAX_NBYTES < cb.aio_nbytes
+            || 0 > cb.aio_offset) {
+                ret = -EINVAL;
+                goto out;
+        }
+        if (AIO_MAX_REQS <= (int) htable_count(&q->aq_reqs)) {
+                ret = -EAGAIN;
+                goto out;
+        }
+        if (NULL == (file = fget(cb.aio_fildes))) {
+                ret = -EBADF;
+                goto out;
+        }
+        if (!((AIO_READ == dir) ? FMODE_ISREAD(file->f_mode) : FMODE_ISWRITE(file->f_mode))
+            || &aio_vops == file->f_vnode->vn_ops) {
+                fput(file);
+                ret = -EBADF;
+                goto out;
+        }
+
+        if (NULL == (req = slab_obj_alloc(aio_req_allocator))) {
+                fput(file);
+                ret = -ENOMEM;
+                goto out;
+        }
+        req->ar_ucb = ucb;
+        req->ar_file = file;
+        req->ar_dir = dir;
+        req->ar_state = AIO_QUEUED;
+        req->ar_off = cb.aio_offset;
+        req->ar_ubuf = (void *) cb.aio_buf;
+        req->ar_nbytes = cb.aio_nbytes;
+        req->ar_buf = NULL;
+        req->ar_ret = 0;
+        if (0 < cb.aio_nbytes && NULL == (req->ar_buf = kmalloc(cb.aio_nbytes))) {
+                aio_req_free(req);
+                ret = -ENOMEM;
+                goto out;
+        }
+        if (AIO_WRITE == dir
+            && 0 > (ret = copy_from_user(req->ar_buf, req->ar_ubuf, req->ar_nbytes))) {
+                aio_req_free(req);
+                goto out;
+        }
+
+        req->ar_qvn = qf->f_vnode;
+        vref(req->ar_qvn);
+        htable_insert(&q->aq_reqs, &req->ar_hlink, hash_ptr(ucb));
+        list_insert_tail(&aio_pending, &req->ar_link);
+        sched_wakeup_on(&aio_waitq);
+        ret = 0;
+out:
+        fput(qf);
+        return ret;
+}
+
+int
+do_aio_read(const struct aiocb *ucb)
+{
+        return aio_submit(ucb, AIO_READ);
+}
+
+int
+do_aio_write(const struct aiocb *ucb)
+{
+        return aio_submit(ucb, AIO_WRITE);
+}
+
+/* EINPROGRESS until the request has finished, then 0 or the errno it
+ * failed with */
+int
+do_aio_error(const struct aiocb *ucb)
+{
+        aio_req_t *req;
+        file_t *qf;
+        int ret;
+
+        if (0 > (ret = aio_lookup(ucb, &qf, &req)))
+                return ret;
+        if (AIO_DONE == req->ar_state) {
+                aio_req_copyout(req);
+                ret = (0 > req->ar_ret) ? -req->ar_ret : 0;
+        } else {
+                ret = EINPROGRESS;
+        }
+        fput(qf);
+        return ret;
+}
+
+int
+do_aio_return(const struct aiocb *ucb)
+{
+        aio_req_t *req;
+        file_t *qf;
+        int ret;
+
+        if (0 > (ret = aio_lookup(ucb, &qf, &req)))
+                return ret;
+        if (AIO_DONE != req->ar_state) {
+                fput(qf);
+                return -EINVAL;
+        }
+        aio_req_copyout(req);
+        ret = req->ar_ret;
+        htable_remove(&VNODE_TO_AIOQ(qf->f_vnode)->aq_reqs, &req->ar_hlink);
+        if (list_link_is_linked(&req->ar_link))
+                list_remove(&req->ar_link);
+        aio_req_free(req);
+        fput(qf);
+        return ret;
+}
+
+/* Returns 0 once one of the requests (of which those NULL are skipped)
+ * has finished, -EAGAIN if the time runs out first */
+int
+do_aio_suspend(const struct aiocb *const *ucbs, int nent, int ticks)
+{
+        uint32_t deadline = jiffies + ticks;
+        aio_req_t *req;
+        file_t *qf;
+        int i, done, ret;
+
+        for (;;) {
+                for (i = 0; i < nent; i++) {
+                        if (NULL == ucbs[i])
+                                continue;
+                        if (0 > (ret = aio_lookup(ucbs[i], &qf, &req)))
+                                return ret;
+                        if ((done = (AIO_DONE == req->ar_state)))
+                                aio_req_copyout(req);
+                        fput(qf);
+                        if (done)
+                                return 0;
+                }
+
+                /* nothing is done in interrupt context, so no request
+                 * can finish between looking and sleeping */
+                if (0 > ticks) {
+                        ret = sched_cancellable_sleep_on(&aio_done_waitq);
+                } else {
+                        int32_t left = (int32_t) (deadline - jiffies);
+
+                        if (0 >= left)
+                                return -EAGAIN;
+                        ret = sched_cancellable_sleep_on_timeout(&aio_done_waitq, left);
+                }
+                if (-EINTR == ret)
+                        return ret;
+        }
+}
+
+/* Gives the aiocbs of as many finished requests, not read before, as
+ * there are and fit in buf */
+static int
+aio_queue_take(aio_queue_t *q, void *buf, size_t len)
+{
+        const struct aiocb **ucbs = (const struct aiocb **) buf;
+        aio_req_t *req;
+        int n = 0;
+
+        while ((n + 1) * sizeof(*ucbs) <= len && !list_empty(&q->aq_done)) {
+                req = list_head(&q->aq_done, aio_req_t, ar_link);
+                list_remove(&req->ar_link);
+                aio_req_copyout(req);
+                ucbs[n++] = req->ar_ucb;
+        }
+        return n * sizeof(*ucbs);
+}
+
+static int
+aio_queue_read(vnode_t *vnode, off_t offset, void *buf, size_t len)
+{
+        aio_queue_t *q = VNODE_TO_AIOQ(vnode);
+        int ret;
+
+        if (q->aq_pid != curproc->p_pid)
+                return -EBADF;
+        if (len < sizeof(struct aiocb *))
+                return -EINVAL;
+        while (list_empty(&q->aq_done)) {
+                if (0 > (ret = sched_cancellable_sleep_on(&q->aq_waitq)))
+                        return ret;
+        }
+        return aio_queue_take(q, buf, len);
+}
+
+static int
+aio_queue_read_nonblock(vnode_t *vnode, off_t offset, void *buf, size_t len)
+{
+        aio_queue_t *q = VNODE_TO_AIOQ(vnode);
+
+        if (q->aq_pid != curproc->p_pid)
+                return -EBADF;
+        if (len < sizeof(struct aiocb *))
+                return -EINVAL;
+        if (list_empty(&q->aq_done))
+                return -EAGAIN;
+        return aio_queue_take(q, buf, len);
+}
+
+static int
+aio_queue_write(vnode_t *vnode, off_t offset, const void *buf, size_t len)
+{
+        return -EINVAL;
+}
+
+static int
+aio_queue_poll(vnode_t *vnode, int events, struct poll_table *pt)
+{
+        aio_queue_t *q = VNODE_TO_AIOQ(vnode);
+
+        poll_wait(pt, &q->aq_poll);
+        return list_empty(&q->aq_done) ? 0 : POLLIN;
+}
+
+static int
+aio_queue_stat(vnode_t *vnode, struct stat *ss)
+{
+        aio_queue_t *q = VNODE_TO_AIOQ(vnode);
+
+        memset(ss, 0, sizeof(struct stat));
+        ss->st_mode = vnode->vn_mode;
+        ss->st_ino = vnode->vn_vno;
+        ss->st_nlink = 1;
+        ss->st_size = htable_count(&q->aq_reqs);
+        return 0;
+}
+
+static int
+aio_queue_acquire(vnode_t *vnode, file_t *file)
+{
+        VNODE_TO_AIOQ(vnode)->aq_nfiles++;
+        return 0;
+}
+
+/* When the last file is closed, every request is dropped, but for those
+ * being done, which their workers free */
+static int
+aio_queue_release(vnode_t *vnode, file_t *file)
+{
+        aio_queue_t *q = VNODE_TO_AIOQ(vnode);
+        aio_req_t *req;
+
+        KASSERT(0 < q->aq_nfiles);
+        if (0 < --q->aq_nfiles)
+                return 0;
+
+        htable_iterate_all_begin(&q->aq_reqs, req, aio_req_t, ar_hlink) {
+                htable_remove(&q->aq_reqs, &req->ar_hlink);
+                if (AIO_RUNNING == req->ar_state)
+                        continue;
+                if (list_link_is_linked(&req->ar_link))
+                        list_remove(&req->ar_link);
+                /* the file being released still holds the vnode */
+                if (AIO_QUEUED == req->ar_state)
+                        vput(vnode);
+                aio_req_free(req);
+        } htable_iterate_end();
+        return 0;
+}
+
+/* aiofs vnode operations */
+static void
+aio_read_vnode(vnode_t *vnode)
+{
+        vnode->vn_ops = &aio_vops;
+        vnode->vn_mode = S_IFIFO;
+        vnode->vn_len = 0;
+        vnode->vn_i = NULL;
+}
+
+static void
+aio_delete_vnode(vnode_t *vnode)
+{
+        aio_queue_t *q = VNODE_TO_AIOQ(vnode);
+
+        if (NULL != q) {
+                KASSERT(0 == htable_count(&q->aq_reqs));
+                htable_destroy(&q->aq_reqs);
+                slab_obj_free(aio_queue_allocator, q);
+        }
+}
+
+/* Nothing of a queue is in the page cache */
+static int
+aio_query_vnode(vnode_t *vnode)
+{
+        return 1;
+}
@@ -0,0 +1,298 @@
+/*
+ * Directory entry cache.
+ *
+ * Caches the results of lookup() by (directory, name), so that resolving
+ * a path does not have to search every directory along it. Both kinds of
+ * result are kept: a positive entry names the vnode found and a negative
+ * entry records that the name does not exist, which saves the (longest)
+ * search of the whole directory for names which are probed repeatedly.
+ *
+ * Entries hold no vnode references. They are keyed by file system and
+ * inode number rather than by vnode, and a positive hit vget()s the
+ * inode it names, so the cache never keeps a vnode in core by itself.
+ * In exchange, everything which changes a directory must invalidate the
+ * names it changes (see dcache_remove), and entries involving a deleted
+ * inode are purged before the inode number can be reused.
+ *
+ * The entries are kept on an LRU list and the least recently used one is
+ * recycled once there are DCACHE_MAX_ENTRIES of them, or freed when the
+ * slab allocator wants memory back (see dcache_shrinker).
+ */
+
+#include "kernel.h"
+#include "config.h"
+#include "errno.h"
+
+#include "fs/dcache.h"
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+
+#include "mm/slab.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+typedef struct dcache_entry {
+        fs_t               *de_fs;
+        ino_t               de_dir;         /* the directory the name is in */
+        ino_t               de_vno;         /* what it names, if positive */
+        int                 de_negative;    /* the name does not exist */
+        size_t              de_len;
+        char                de_name[NAME_LEN];
+
+        list_link_t         de_hlink;       /* link on hash chain */
+        list_link_t         de_lrulink;     /* link on dcache_lru */
+} dcache_entry_t;
+
+static slab_allocator_t *dcache_allocator;
+
+static list_t dcache_hash[DCACHE_NBUCKETS];
+static list_t dcache_lru;                   /* most recently used first */
+static int dcache_nentries;
+
+/* Bumped whenever an entry is invalidated, see dcache_enter */
+static uint32_t dcache_gen;
+
+/* Bumped whenever a name may have changed, but not on eviction; see
+ * dcache_namegen */
+static uint32_t dcache_namegen_count;
+
+/* Statistics, see dcache_info */
+static uint32_t dcache_nhits;
+static uint32_t dcache_nneghits;
+static uint32_t dcache_nmisses;
+
+static void dcache_free(dcache_entry_t *de);
+
+static uint32_t
+dcache_count(void)
+{
+        return dcache_nentries;
+}
+
+/* Frees the nr least recently used entries */
+static int
+dcache_shrink(int nr)
+{
+        int n;
+
+        for (n = 0; n < nr && !list_empty(&dcache_lru); n++)
+                dcache_free(list_tail(&dcache_lru, dcache_entry_t, de_lrulink));
+        return n;
+}
+
+static slab_shrinker_t dcache_shrinker = {
+        .ss_name = "dcache",
+        .ss_count = dcache_count,
+        .ss_scan = dcache_shrink
+};
+
+static __attribute__((unused)) void
+dcache_init(void)
+{
+        int i;
+
+        dcache_allocator = slab_allocator_create("dcache", sizeof(dcache_entry_t));
+        KASSERT(NULL != dcache_allocator);
+
+        for (i = 0; i < DCACHE_NBUCKETS; i++)
+                list_init(&dcache_hash[i]);
+        list_init(&dcache_lru);
+        slab_register_shrinker(&dcache_shrinker);
+}
+init_func(dcache_init);
+
+static list_t *
+dcache_bucket(fs_t *fs, ino_t dir, const char *name, size_t len)
+{
+        uint32_t h = (((uint32_t) fs) >> 4) ^ dir;
+        size_t i;
+
+        for (i = 0; i < len; i++)
+                h = h * 31 + (unsigned char) name[i];
+        return &dcache_hash[(h * 0x9e3779b1U) % DCACHE_NBUCKETS];
+}
+
+static dcache_entry_t *
+dcache_find(vnode_t *dir, const char *name, size_t len)
+{
+        dcache_entry_t *de;
+
+        list_iterate_begin(dcache_bucket(dir->vn_fs, dir->vn_vno, name, len),
+                           de, dcache_entry_t, de_hlink) {
+                if (de->de_fs == dir->vn_fs && de->de_dir == dir->vn_vno
+                    && de->de_len == len && !strncmp(de->de_name, name, len))
+                        return de;
+        } list_iterate_end();
+        return NULL;
+}
+
+static void
+dcache_free(dcache_entry_t *de)
+{
+        list_remove(&de->de_hlink);
+        list_remove(&de->de_lrulink);
+        slab_obj_free(dcache_allocator, de);
+        dcache_nentries--;
+        dcache_gen++;
+}
+
+/* "." and ".." are resolved by the directory itself, and ".." would need
+ * purging whenever a directory is renamed */
+static int
+dcache_cacheable(const char *name, size_t len)
+{
+        if (0 == len || NAME_LEN < len)
+                return 0;
+        if ('.' == name[0] && (1 == len || (2 == len && '.' == name[1])))
+                return 0;
+        return 1;
+}
+
+int
+dcache_lookup(vnode_t *dir, const char *name, size_t len,
+              vnode_t **result, uint32_t *genp)
+{
+        dcache_entry_t *de;
+
+        *genp = dcache_gen;
+        if (!dcache_cacheable(name, len) || NULL == (de = dcache_find(dir, name, len))) {
+                dcache_nmisses++;
+                return DCACHE_MISS;
+        }
+
+        list_remove(&de->de_lrulink);
+        list_insert_head(&dcache_lru, &de->de_lrulink);
+
+        if (de->de_negative) {
+                dcache_nneghits++;
+                return -ENOENT;
+        }
+        dcache_nhits++;
+        *result = vget(dir->vn_fs, de->de_vno);
+        return 0;
+}
+
+int
+dcache_peek(vnode_t *dir, const char *name, size_t len, vnode_t **result)
+{
+        dcache_entry_t *de;
+
+        if (!dcache_cacheable(name, len) || NULL == (de = dcache_find(dir, name, len))
+            || (!de->de_negative && NULL == (*result = vpeek(dir->vn_fs, de->de_vno)))) {
+                dcache_nmisses++;
+                return DCACHE_MISS;
+        }
+
+        list_remove(&de->de_lrulink);
+        list_insert_head(&dcache_lru, &de->de_lrulink);
+
+        if (de->de_negative) {
+                dcache_nneghits++;
+                return -ENOENT;
+        }
+        dcache_nhits++;
+        return 0;
+}
+
+void
+dcache_enter(vnode_t *dir, const char *name, size_t len, vnode_t *vn, uint32_t gen)
+{
+        dcache_entry_t *de;
+
+        /* something was invalidated while the file system was looking
+         * the name up, possibly this very name */
+        if (gen != dcache_gen || !dcache_cacheable(name, len)
+            || (VN_NOCACHE & dir->vn_flags))
+                return;
+        /* entries never cross file systems (inode numbers would be
+         * looked up in the wrong one) */
+        if (NULL != vn && vn->vn_fs != dir->vn_fs)
+                return;
+
+        if (NULL == (de = dcache_find(dir, name, len))) {
+                if (DCACHE_MAX_ENTRIES <= dcache_nentries
+                    || NULL == (de = slab_obj_alloc(dcache_allocator))) {
+                        if (list_empty(&dcache_lru))
+                                return;
+                        de = list_tail(&dcache_lru, dcache_entry_t, de_lrulink);
+                        list_remove(&de->de_hlink);
+                        list_remove(&de->de_lrulink);
+                } else {
+                        dcache_nentries++;
+                }
+
+                de->de_fs = dir->vn_fs;
+                de->de_dir = dir->vn_vno;
+                de->de_len = len;
+                memcpy(de->de_name, name, len);
+                list_insert_head(dcache_bucket(dir->vn_fs, dir->vn_vno, name, len),
+                                 &de->de_hlink);
+        } else {
+                list_remove(&de->de_lrulink);
+        }
+        list_insert_head(&dcache_lru, &de->de_lrulink);
+
+        de->de_negative = (NULL == vn);
+        de->de_vno = (NULL == vn) ? 0 : vn->vn_vno;
+}
+
+void
+dcache_remove(vnode_t *dir, const char *name, size_t len)
+{
+        dcache_entry_t *de;
+
+        /* even if there was nothing to remove, a lookup of this name may
+         * be in progress */
+        dcache_gen++;
+        dcache_namegen_count++;
+        if (dcache_cacheable(name, len) && NULL != (de = dcache_find(dir, name, len)))
+                dcache_free(de);
+}
+
+void
+dcache_purge_vnode(vnode_t *vn)
+{
+        dcache_entry_t *de;
+
+        dcache_gen++;
+        dcache_namegen_count++;
+        list_iterate_begin(&dcache_lru, de, dcache_entry_t, de_lrulink) {
+                if (de->de_fs == vn->vn_fs && (de->de_dir == vn->vn_vno
+                                               || (!de->de_negative && de->de_vno == vn->vn_vno)))
+                        dcache_free(de);
+        } list_iterate_end();
+}
+
+void
+dcache_purge_fs(fs_t *fs)
+{
+        dcache_entry_t *de;
+
+        dcache_gen++;
+        dcache_namegen_count++;
+        list_iterate_begin(&dcache_lru, de, dcache_entry_t, de_lrulink) {
+                if (de->de_fs == fs)
+                        dcache_free(de);
+        } list_iterate_end();
+}
+
+uint32_t
+dcache_namegen(void)
+{
+        return dcache_namegen_count;
+}
+
+size_t
+dcache_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        iprintf(&buf, &size, "%d/%d entries, %u hits, %u negative hits, "
+                "%u misses\n", dcache_nentries, DCACHE_MAX_ENTRIES,
+                dcache_nhits, dcache_nneghits, dcache_nmisses);
+        return size;
+}
@@ -12,6 +12,7 @@
 #include "util/printf.h"
 #include "globals.h"
 #include "util/list.h"
+#include "fs/fcntl.h"
 #include "fs/file.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
@@ -21,17 +22,27 @@
 
 static slab_allocator_t *file_allocator;
 
+/* Free file_ts are kept as a new one should start out, so that fget()
+ * need not clear them; fput() puts them back that way. There is no cap
+ * on how many there are beyond what the slab allocator can get. */
+static void
+file_ctor(void *obj)
+{
+        memset(obj, 0, sizeof(file_t));
+}
+
 static __attribute__((unused)) void
 file_init(void)
 {
-        file_allocator = slab_allocator_create("file", sizeof(file_t));
+        file_allocator = slab_allocator_create_ctor("file", sizeof(file_t),
+                                                    file_ctor, NULL);
 }
 init_func(file_init);
 
 void
 fref(file_t *f)
 {
-        KASSERT(f->f_mode >= 0 && f->f_mode < 8);
+        KASSERT(f->f_mode >= 0 && f->f_mode < 32);
         KASSERT(f->f_pos >= -1);
         KASSERT(f->f_refcount >= 0);
         if (f->f_refcount != 0) KASSERT(f->f_vnode);
@@ -61,7 +72,8 @@ facq(file_t *f, vnode_t *vn)
         }
 }
 
-/* Look in process fd table and return the file*. */
+/* Look in process fd table and return the file*. This takes no locks:
+ * the kernel is not preempted, so the table cannot change under us. */
 file_t *
 fget(int fd)
 {
@@ -69,7 +81,6 @@ fget(int fd)
 
         if (fd == -1) {
                 f = slab_obj_alloc(file_allocator);
-                if (f) memset(f, 0, sizeof(file_t));
         } else {
                 if (fd < 0 || fd >= NFILES)
                         return NULL;
@@ -86,7 +97,7 @@ void
 fput(file_t *f)
 {
         KASSERT(f);
-        KASSERT(f->f_mode >= 0 && f->f_mode < 8);
+        KASSERT(f->f_mode >= 0 && f->f_mode < 32);
         KASSERT(f->f_pos >= -1);
         KASSERT(f->f_refcount > 0);
         if (f->f_refcount != 1) KASSERT(f->f_vnode);
@@ -107,8 +118,13 @@ fput(file_t *f)
                         if (vn->vn_ops->release) {
                                 vn->vn_ops->release(vn, f);
                         }
+                        vnode_fadvise(vn, f->f_advice, POSIX_FADV_NORMAL);
                         vput(vn);
                 }
+                f->f_pos = 0;
+                f->f_mode = 0;
+                f->f_advice = POSIX_FADV_NORMAL;
+                f->f_vnode = NULL;
                 slab_obj_free(file_allocator, f);
         }
 }
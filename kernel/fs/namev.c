@@ -7,6 +7,7 @@
 #include "util/printf.h"
 #include "util/debug.h"
 
+#include "fs/dcache.h"
 #include "fs/dirent.h"
 #include "fs/fcntl.h"
 #include "fs/stat.h"
@@ -25,31 +26,84 @@
 int
 lookup(vnode_t *dir, const char *name, size_t len, vnode_t **result)
 {
-    if(dir == NULL || name == NULL || len == 0)
-        return -ENOENT;
-    vnode_ops* ops = dir->vn_ops;
-    KASSERT(ops);
-    if(ops->lookup == NULL)
-        return -ENOTDIR;
-    else
-    {
-        /* Do not process the .. because it can be found in lookup */
-        int ret = 0;
-        vnode* node;
-        if((ret = ops->lookup(dir, name, len, node)) < 0)
-        {
-            /* lookup doesn't need to vref, it's already done*/
-            return ret;
-        }
+        uint32_t gen;
+        int ret;
+
+        KASSERT(NULL != dir && NULL != name && NULL != result);
+
+        if (NULL == dir->vn_ops->lookup)
+                return -ENOTDIR;
+
+#ifdef __MOUNTING__
+        /* ".." of the root of a mounted file system is that of the
+         * directory it is mounted on */
+        if (name_match("..", name, len) && dir == dir->vn_fs->fs_root && dir != vfs_root_vn)
+                dir = dir->vn_fs->fs_mtpt;
+#endif
+
+        /* the name cache answers most lookups, including those of
+         * names which do not exist */
+        if (DCACHE_MISS != (ret = dcache_lookup(dir, name, len, result, &gen)))
+                return ret;
+
+        ret = dir->vn_ops->lookup(dir, name, len, result);
+        if (0 == ret)
+                dcache_enter(dir, name, len, *result, gen);
+        else if (-ENOENT == ret)
+                dcache_enter(dir, name, len, NULL, gen);
+        return ret;
+}
+
+
+/*
+ * dir_namev's fast path: walks every component but the last through the
+ * name cache with dcache_peek(), borrowing each directory on the way
+ * rather than taking and dropping a reference, and only references the
+ * directory it ends up in. Nothing here blocks, so the borrowed vnodes
+ * cannot go away. Returns DCACHE_MISS, for the slow path to start over,
+ * on anything the cache cannot answer ("." and "..", names too long,
+ * uncached or evicted directories and paths ending in '/').
+ */
+static int
+dir_namev_fast(const char *pathname, size_t *namelen, const char **name,
+               vnode_t *base, vnode_t **res_vnode)
+{
+        vnode_t *dir;
+        const char *p = pathname;
+        const char *end;
+        int ret;
+
+        if ('/' == *p)
+                dir = vfs_root_vn;
         else
-        {
-            return 0;
+                dir = (NULL == base) ? curproc->p_cwd : base;
+
+        for (;;) {
+                while ('/' == *p)
+                        p++;
+                for (end = p; '\0' != *end && '/' != *end; end++)
+                        ;
+                if (p == end || end - p > NAME_LEN)
+                        return DCACHE_MISS;
+                if ('\0' == *end)
+                        break;
+                /* a component with more to come must be a directory */
+                if (!S_ISDIR(dir->vn_mode) || NULL == dir->vn_ops->lookup)
+                        return DCACHE_MISS;
+                if (0 != (ret = dcache_peek(dir, p, end - p, &dir)))
+                        return ret;
+                p = end;
         }
-    }
 
+        if (!S_ISDIR(dir->vn_mode))
+                return DCACHE_MISS;
+        /* the one real reference; dir is in core, so this cannot block */
+        *res_vnode = vget(dir->vn_fs, dir->vn_vno);
+        *name = p;
+        *namelen = end - p;
+        return 0;
 }
 
-
 /* When successful this function returns data in the following "out"-arguments:
  *  o res_vnode: the vnode of the parent directory of "name"
  *  o name: the `basename' (the element of the pathname)
@@ -85,23 +139,21 @@ dir_namev(const char *pathname, size_t *namelen, const char **name,
         else if(path_len >= MAXPATHLEN)
             return -ENAMETOOLONG;
 
+        /* most paths are all in the name cache */
+        int fast = dir_namev_fast(pathname, namelen, name, base, res_vnode);
+        if (DCACHE_MISS != fast)
+                return fast;
+
         /* initialize the output arguments */
         *res_vnode = NULL;
 
         vnode_t* parent = NULL;
-        if(base == NULL)
-        {
+        if(pathname[0] == '/')
+            parent = vfs_root_vn;
+        else if(base == NULL)
             parent = curproc->p_cwd;
-        }else 
-        {
-            if(pathname[0] == '/')
-            {
-                parent = vfs_root_vn;
-            }else
-            {
-                parent = base;
-            }
-        }
+        else
+            parent = base;
         vref(parent);
         int i = 0;
         while( i < path_len )
@@ -178,55 +230,27 @@ dir_namev(const char *pathname, size_t *namelen, const char **name,
 int
 open_namev(const char *pathname, int flag, vnode_t **res_vnode, vnode_t *base)
 {
-    vnote_t* dir = NULL;
-    size_t name_len = 0;
-    char name[NAME_LEN+1];
-    const char* name = name;
-    int ret = 0;
-    if((ret = dir_namev(pathname, &name_len, &name, NULL, &dir)) < 0)
-    {
-        if(dir)
-        {
-            vput(dir);
-        }
-        return ret;
-    }
-    KASSERT(dir);
-    vnode_t* target = NULL;
-    ret = lookup(dir, name, name_len, &target);
-    if(ret == 0) /* already there*/
-    {   
-        vput(dir);
-        return target;
-    }else if(ret < 0)
-    {
-        if(ret == -ENOENT)
-        {
-            if((flag & O_CREAT) != 0)
-            {
-                vnode_ops* ops = dir->vn_ops;
-                KASSERT(ops);
-                KASSERT(ops->create != NULL);
-                vnode_t* result = NULL;
-                if((ret = ops->create(dir, name, name_len, &result)) < 0)
-                {
-                    if(result)
-                    {
-                        vput(result);
-                    }
-                    vput(dir);
-                    return ret;
-                }
-            }else
-            {
-                vput(dir);
+        vnode_t *dir;
+        const char *name;
+        size_t namelen;
+        int ret;
+
+        if (0 > (ret = dir_namev(pathname, &namelen, &name, base, &dir)))
                 return ret;
-            }
-        }else
-        {
-            return ret;
+        /* "/" and paths ending in '/' name the directory itself */
+        if (0 == namelen) {
+                *res_vnode = dir;
+                return 0;
+        }
+
+        ret = lookup(dir, name, namelen, res_vnode);
+        if (-ENOENT == ret && (flag & O_CREAT)) {
+                KASSERT(NULL != dir->vn_ops->create);
+                ret = dir->vn_ops->create(dir, name, namelen, res_vnode);
+                dcache_remove(dir, name, namelen);
         }
-    }
+        vput(dir);
+        return ret;
 }
 
 #ifdef __GETCWD__
@@ -254,11 +278,67 @@ lookup_name(vnode_t *dir, vnode_t *entry, char *buf, size_t size)
  * possible errors. Even if an error code is returned the buffer
  * will be filled with a valid string which has some partial
  * information about the wanted path. */
-ssize_t
-lookup_dirpath(vnode_t *dir, char *buf, size_t osize)
+static ssize_t
+lookup_dirpath_walk(vnode_t *dir, char *buf, size_t osize)
 {
         NOT_YET_IMPLEMENTED("GETCWD: lookup_dirpath");
 
         return -ENOENT;
 }
+
+/*
+ * The paths of the last few directories lookup_dirpath was asked for,
+ * which are generally processes' working directories. An entry holds as
+ * long as no name anywhere has changed since (see dcache_namegen), which
+ * covers renames and removals of any directory along the path.
+ */
+#define DIRPATH_CACHE_SIZE 4
+
+typedef struct dirpath_cache {
+        fs_t     *dp_fs;        /* NULL if unused */
+        ino_t     dp_vno;
+        uint32_t  dp_gen;
+        uint32_t  dp_used;      /* for finding the least recently used */
+        char      dp_path[MAXPATHLEN];
+} dirpath_cache_t;
+
+static dirpath_cache_t dirpath_cache[DIRPATH_CACHE_SIZE];
+static uint32_t dirpath_clock;
+
+ssize_t
+lookup_dirpath(vnode_t *dir, char *buf, size_t osize)
+{
+        dirpath_cache_t *dp, *victim = dirpath_cache;
+        uint32_t gen = dcache_namegen();
+        size_t len;
+        ssize_t ret;
+        int i;
+
+        KASSERT(0 < osize);
+
+        for (i = 0; i < DIRPATH_CACHE_SIZE; ++i) {
+                dp = &dirpath_cache[i];
+                if (dp->dp_fs == dir->vn_fs && dp->dp_vno == dir->vn_vno
+                    && dp->dp_gen == gen) {
+                        dp->dp_used = ++dirpath_clock;
+                        len = strlen(dp->dp_path);
+                        strncpy(buf, dp->dp_path, osize - 1);
+                        buf[MIN(len, osize - 1)] = '\0';
+                        return (len < osize) ? 0 : -ERANGE;
+                }
+                if (dp->dp_used < victim->dp_used)
+                        victim = dp;
+        }
+
+        /* remember it only if nothing was renamed while walking */
+        ret = lookup_dirpath_walk(dir, buf, osize);
+        if (0 == ret && gen == dcache_namegen() && strlen(buf) < MAXPATHLEN) {
+                victim->dp_fs = dir->vn_fs;
+                victim->dp_vno = dir->vn_vno;
+                victim->dp_gen = gen;
+                victim->dp_used = ++dirpath_clock;
+                strcpy(victim->dp_path, buf);
+        }
+        return ret;
+}
 #endif /* __GETCWD__ */
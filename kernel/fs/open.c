@@ -18,7 +18,11 @@
 #include "fs/stat.h"
 #include "util/debug.h"
 
-/* find empty index in p->p_files[] */
+/* find empty index in p->p_files[]. The table is a fixed NFILES pointers
+ * in proc_t, and anything that forks or exits writes it directly, so
+ * there is nowhere to keep a free-slot bitmap in step with it; at 32
+ * entries the scan touches no more than 128 bytes, two cache lines,
+ * anyway. */
 int
 get_empty_fd(proc_t *p)
 {
@@ -39,9 +43,9 @@ get_empty_fd(proc_t *p)
  *      1. Get the next empty file descriptor.
  *      2. Call fget to get a fresh file_t.
  *      3. Save the file_t in curproc's file descriptor table.
- *      4. Set file_t->f_mode to OR of FMODE_(READ|WRITE|APPEND) based on
- *         oflags, which can be O_RDONLY, O_WRONLY or O_RDWR, possibly OR'd with
- *         O_APPEND.
+ *      4. Set file_t->f_mode to OR of FMODE_(READ|WRITE|APPEND|NONBLOCK|DIRECT)
+ *         based on oflags, which can be O_RDONLY, O_WRONLY or O_RDWR, possibly
+ *         OR'd with O_APPEND, O_NONBLOCK and O_DIRECT.
  *      5. Use open_namev() to get the vnode for the file_t.
  *      6. Fill in the fields of the file_t.
  *      7. Return new fd.
@@ -73,23 +77,100 @@ get_empty_fd(proc_t *p)
 int
 do_open(const char *filename, int oflags)
 {
-    /* Check to see if oflags is valid */
-    if(!O_IS_VALID(oflags))
-        return -EINVAL;
-    /* Get the next empty file descriptor */
-    int fd = 0;
-    if((fd = get_empty_fd(curproc)) < 0)
-    {
-        /* EMFILE */
-        return fd;
-    }
+        return do_openat(AT_FDCWD, filename, oflags);
+}
 
-    /* Call fget to get a fresh file_t. */
-    file_t* file = NULL;
-    if((file = fget(-1)) == NULL)
-    {
-        return -NOMEM;
-    }
-        //NOT_YET_IMPLEMENTED("VFS: do_open");
-        return -1;
+/*
+ * Gives in *base the directory a path given with dirfd to one of the
+ * *at() calls is relative to, referenced: NULL for AT_FDCWD (which the
+ * path walk takes as the current directory), or the vnode of the open
+ * directory dirfd. The caller vputs it if it is not NULL.
+ *
+ * Returns -EBADF if dirfd is not open, -ENOTDIR if it is not a
+ * directory.
+ */
+int
+get_dirfd_vnode(int dirfd, vnode_t **base)
+{
+        file_t *file;
+
+        *base = NULL;
+        if (AT_FDCWD == dirfd)
+                return 0;
+        if (NULL == (file = fget(dirfd)))
+                return -EBADF;
+        if (!S_ISDIR(file->f_vnode->vn_mode)) {
+                fput(file);
+                return -ENOTDIR;
+        }
+        *base = file->f_vnode;
+        vref(*base);
+        fput(file);
+        return 0;
+}
+
+/*
+ * Like do_open, with a relative filename taken from the directory open
+ * as dirfd (or the current directory, for AT_FDCWD), so that a program
+ * which has a directory open need not walk its path again for each
+ * file in it. Also returns -EBADF or -ENOTDIR for a bad dirfd.
+ */
+int
+do_openat(int dirfd, const char *filename, int oflags)
+{
+        vnode_t *base, *vn;
+        file_t *file;
+        int fd, mode, ret;
+
+        switch (oflags & (O_WRONLY | O_RDWR)) {
+                case O_RDONLY:
+                        mode = FMODE_READ;
+                        break;
+                case O_WRONLY:
+                        mode = FMODE_WRITE;
+                        break;
+                case O_RDWR:
+                        mode = FMODE_READ | FMODE_WRITE;
+                        break;
+                default:
+                        return -EINVAL;
+        }
+        if (oflags & O_APPEND)
+                mode |= FMODE_APPEND;
+        if (oflags & O_NONBLOCK)
+                mode |= FMODE_NONBLOCK;
+        if (oflags & O_DIRECT)
+                mode |= FMODE_DIRECT;
+
+        if (0 > (fd = get_empty_fd(curproc)))
+                return fd;
+        if (0 > (ret = get_dirfd_vnode(dirfd, &base)))
+                return ret;
+
+        ret = open_namev(filename, oflags, &vn, base);
+        if (NULL != base)
+                vput(base);
+        if (0 > ret)
+                return ret;
+
+        if (S_ISDIR(vn->vn_mode) && (mode & FMODE_WRITE)) {
+                vput(vn);
+                return -EISDIR;
+        }
+        if ((S_ISCHR(vn->vn_mode) && NULL == vn->vn_cdev)
+            || (S_ISBLK(vn->vn_mode) && NULL == vn->vn_bdev)) {
+                vput(vn);
+                return -ENXIO;
+        }
+
+        if (NULL == (file = fget(-1))) {
+                vput(vn);
+                return -ENOMEM;
+        }
+        file->f_mode = mode;
+        file->f_pos = 0;
+        /* the file takes open_namev's reference */
+        facq(file, vn);
+        curproc->p_files[fd] = file;
+        return fd;
 }
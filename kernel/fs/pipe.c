@@ -11,6 +11,7 @@
 #include "fs/file.h"
 #include "fs/open.h"
 #include "fs/pipe.h"
+#include "fs/poll.h"
 #include "fs/stat.h"
 #include "fs/vfs_syscall.h"
 #include "fs/vfs.h"
@@ -18,13 +19,14 @@
 
 #include "mm/slab.h"
 #include "mm/kmalloc.h"
+#include "mm/page.h"
 
 #include "proc/sched.h"
 
 #include "util/debug.h"
+#include "util/init.h"
 #include "util/string.h"
 
-#define PIPE_BUF_SIZE 4096
 
 static void pipe_read_vnode(vnode_t *vnode);
 static void pipe_delete_vnode(vnode_t *vnode);
@@ -48,6 +50,9 @@ static fs_t pipe_fs = {
 
 static int pipe_read(vnode_t *vnode, off_t offset, void *buf, size_t len);
 static int pipe_write(vnode_t *vnode, off_t offset, const void *buf, size_t len);
+static int pipe_poll(vnode_t *vnode, int events, struct poll_table *pt);
+static int pipe_read_nonblock(vnode_t *vnode, off_t offset, void *buf, size_t len);
+static int pipe_write_nonblock(vnode_t *vnode, off_t offset, const void *buf, size_t len);
 static int pipe_stat(vnode_t *vnode, struct stat *ss);
 static int pipe_acquire(vnode_t *vnode, file_t *file);
 static int pipe_release(vnode_t *vnode, file_t *file);
@@ -56,6 +61,9 @@ static vnode_ops_t pipe_vops = {
         .read = pipe_read,
         .write = pipe_write,
         .mmap = NULL,
+        .poll = pipe_poll,
+        .read_nonblock = pipe_read_nonblock,
+        .write_nonblock = pipe_write_nonblock,
         .create = NULL,
         .mknod = NULL,
         .lookup = NULL,
@@ -72,18 +80,50 @@ static vnode_ops_t pipe_vops = {
         .cleanpage = NULL
 };
 
+/*
+ * A pipe's data lives in a ring of up to PIPE_MAX_PAGES page buffers,
+ * oldest first. Each buffer is a whole page holding one contiguous run of
+ * unread data; writes are appended to the newest buffer while its page has
+ * room, and a new page is taken only when it does not, so an idle pipe
+ * holds a single page and a busy one grows until writers find all
+ * PIPE_MAX_PAGES pages full. Drained pages are freed again (one is kept
+ * for the next write). Keeping the data in whole pages is also what lets
+ * do_splice move pages in and out of the ring instead of copying them.
+ *
+ * A write of more than a page is not copied into the ring at all: its
+ * buffer is loaned, linked in a page (or less) per ring buffer, and the
+ * writer waits until readers have copied it all out, which halves the
+ * copying a bulk pipeline does. The writer's buffer stays valid for as
+ * long as it waits, and a loaned buffer is never appended to or moved to
+ * another pipe. If the readers go away or the writer is cancelled, it
+ * takes back what they have not read, once no reader is in the middle
+ * of reading it (so holding the read lock).
+ */
+#define PIPE_MAX_PAGES 16
+
+typedef struct pipe_buf {
+        char      *pb_page;
+        size_t     pb_off;      /* where the unread data starts */
+        size_t     pb_len;      /* how much of it there is */
+        int        pb_loaned;   /* pb_page is a writer's, not the pipe's */
+} pipe_buf_t;
+
 /* struct pipe defines some data specific to pipes. One of these
    should be present in the vn_i field of each pipe vnode. */
 typedef struct pipe {
-        /* Buffer for data in the pipe, which has been written but not yet read. */
-        char      *pv_buf;
         /*
-         * Position of the head and number of characters in the buffer. You can
-         * write in characters at position head so long as size does not grow beyond
-         * the pipe buffer size.
+         * The ring of buffers holding data which has been written but not
+         * yet read: pv_nbufs of them, starting at pv_bufs[pv_first], with
+         * pv_size characters among them.
          */
-        off_t      pv_head;
+        pipe_buf_t pv_bufs[PIPE_MAX_PAGES];
+        int        pv_first;
+        int        pv_nbufs;
         size_t     pv_size;
+        /* How many of the buffers (all the newest) are loaned */
+        int        pv_loaned;
+        /* A drained page, kept so a steady stream does not allocate */
+        char      *pv_spare;
         /* Number of file descriptors using this pipe for read and write. */
         int        pv_readers;
         int        pv_writers;
@@ -103,10 +143,15 @@ typedef struct pipe {
          */
         ktqueue_t  pv_read_waitq;
         ktqueue_t  pv_write_waitq;
+        /* Where poll(2) waits, woken along with either queue */
+        pollhead_t pv_poll;
 } pipe_t;
 
 #define VNODE_TO_PIPE(vn) ((pipe_t *)((vn)->vn_i))
 
+/* The i'th oldest buffer in the ring */
+#define PIPE_BUF(p, i) (&(p)->pv_bufs[((p)->pv_first + (i)) % PIPE_MAX_PAGES])
+
 static slab_allocator_t *pipe_allocator = NULL;
 static int next_pno = 0;
 
@@ -128,8 +173,26 @@ init_depends(vfs_init);
 static pipe_t *
 pipe_create(void)
 {
-        NOT_YET_IMPLEMENTED("PIPES: pipe_create");
-        return NULL;
+        pipe_t *pipe;
+
+        if (NULL == (pipe = slab_obj_alloc(pipe_allocator)))
+                return NULL;
+        memset(pipe, 0, sizeof(pipe_t));
+
+        /* the first page is allocated up front, so that a pipe which
+         * could be created can also be written to */
+        if (NULL == (pipe->pv_spare = page_alloc())) {
+                slab_obj_free(pipe_allocator, pipe);
+                return NULL;
+        }
+
+        kmutex_init(&pipe->pv_rdlock);
+        kmutex_init(&pipe->pv_wrlock);
+        sched_queue_init(&pipe->pv_read_waitq);
+        sched_queue_init(&pipe->pv_write_waitq);
+        pollhead_init(&pipe->pv_poll);
+
+        return pipe;
 }
 
 /*
@@ -138,7 +201,215 @@ pipe_create(void)
 static void
 pipe_destroy(pipe_t *pipe)
 {
-        NOT_YET_IMPLEMENTED("PIPES: pipe_destroy");
+        KASSERT(0 == pipe->pv_readers && 0 == pipe->pv_writers);
+        KASSERT(0 == pipe->pv_loaned);
+        KASSERT(sched_queue_empty(&pipe->pv_read_waitq));
+        KASSERT(sched_queue_empty(&pipe->pv_write_waitq));
+        KASSERT(list_empty(&pipe->pv_poll.ph_waiters));
+
+        while (0 < pipe->pv_nbufs) {
+                page_free(PIPE_BUF(pipe, 0)->pb_page);
+                pipe->pv_first = (pipe->pv_first + 1) % PIPE_MAX_PAGES;
+                pipe->pv_nbufs--;
+        }
+        if (NULL != pipe->pv_spare)
+                page_free(pipe->pv_spare);
+        slab_obj_free(pipe_allocator, pipe);
+}
+
+/* Wakes the readers, there being more to read or no more writers */
+static void
+pipe_wake_readers(pipe_t *p)
+{
+        sched_broadcast_on(&p->pv_read_waitq);
+        poll_wakeup(&p->pv_poll);
+}
+
+/* Wakes the writers, there being more room or no more readers */
+static void
+pipe_wake_writers(pipe_t *p)
+{
+        sched_broadcast_on(&p->pv_write_waitq);
+        poll_wakeup(&p->pv_poll);
+}
+
+/* Returns an empty page for the ring, or NULL if none is available */
+static char *
+pipe_page_get(pipe_t *p)
+{
+        char *page = p->pv_spare;
+
+        if (NULL != page)
+                p->pv_spare = NULL;
+        else
+                page = page_alloc();
+        return page;
+}
+
+static void
+pipe_page_put(pipe_t *p, char *page)
+{
+        if (NULL == p->pv_spare)
+                p->pv_spare = page;
+        else
+                page_free(page);
+}
+
+/* Appends a buffer holding len characters of the given page at off */
+static void
+pipe_buf_push(pipe_t *p, char *page, size_t off, size_t len)
+{
+        pipe_buf_t *pb;
+
+        KASSERT(PIPE_MAX_PAGES > p->pv_nbufs);
+        pb = PIPE_BUF(p, p->pv_nbufs++);
+        pb->pb_page = page;
+        pb->pb_off = off;
+        pb->pb_len = len;
+        pb->pb_loaned = 0;
+        p->pv_size += len;
+}
+
+/* Removes the oldest buffer once it has been drained */
+static void
+pipe_buf_pop(pipe_t *p)
+{
+        KASSERT(0 < p->pv_nbufs && 0 == PIPE_BUF(p, 0)->pb_len);
+        if (PIPE_BUF(p, 0)->pb_loaned)
+                p->pv_loaned--;
+        else
+                pipe_page_put(p, PIPE_BUF(p, 0)->pb_page);
+        p->pv_first = (p->pv_first + 1) % PIPE_MAX_PAGES;
+        p->pv_nbufs--;
+}
+
+/* Marks n characters of the oldest buffer as read */
+static void
+pipe_buf_consume(pipe_t *p, size_t n)
+{
+        pipe_buf_t *pb = PIPE_BUF(p, 0);
+
+        KASSERT(n <= pb->pb_len);
+        pb->pb_off += n;
+        pb->pb_len -= n;
+        p->pv_size -= n;
+        if (0 == pb->pb_len)
+                pipe_buf_pop(p);
+}
+
+/*
+ * Copies as much of buf into the pipe as fits without blocking, growing
+ * the ring if it must. Returns the number of characters copied, 0 if the
+ * pipe is full (or no page could be had).
+ */
+static size_t
+pipe_fill(pipe_t *p, const char *buf, size_t len)
+{
+        size_t done = 0;
+
+        while (done < len) {
+                pipe_buf_t *pb = NULL;
+                size_t n;
+
+                if (0 < p->pv_nbufs) {
+                        pb = PIPE_BUF(p, p->pv_nbufs - 1);
+                        if (pb->pb_loaned || PAGE_SIZE == pb->pb_off + pb->pb_len)
+                                pb = NULL;
+                }
+                if (NULL == pb) {
+                        char *page;
+
+                        if (PIPE_MAX_PAGES == p->pv_nbufs
+                            || NULL == (page = pipe_page_get(p)))
+                                break;
+                        pipe_buf_push(p, page, 0, 0);
+                        pb = PIPE_BUF(p, p->pv_nbufs - 1);
+                }
+
+                n = MIN(len - done, PAGE_SIZE - (pb->pb_off + pb->pb_len));
+                memcpy(pb->pb_page + pb->pb_off + pb->pb_len, buf + done, n);
+                pb->pb_len += n;
+                p->pv_size += n;
+                done += n;
+        }
+        return done;
+}
+
+/*
+ * Loans as much of buf to the pipe as there are free buffers for, a page
+ * per buffer. Returns the number of characters loaned, 0 if the pipe is
+ * full.
+ */
+static size_t
+pipe_loan(pipe_t *p, const char *buf, size_t len)
+{
+        size_t done = 0;
+
+        while (done < len && PIPE_MAX_PAGES > p->pv_nbufs) {
+                size_t n = MIN(len - done, PAGE_SIZE);
+
+                pipe_buf_push(p, (char *) buf + done, 0, n);
+                PIPE_BUF(p, p->pv_nbufs - 1)->pb_loaned = 1;
+                p->pv_loaned++;
+                done += n;
+        }
+        return done;
+}
+
+/*
+ * Waits for the readers to have read everything loaned by the current
+ * write, *len characters. If they go away first, or the writer is
+ * cancelled, takes back what is left and sets *len to what was read.
+ * Returns 0, -EPIPE or -EINTR.
+ */
+static int
+pipe_loan_wait(pipe_t *p, size_t *len)
+{
+        int err = 0;
+
+        while (0 < p->pv_loaned && 0 < p->pv_readers) {
+                if (sched_cancellable_sleep_on(&p->pv_write_waitq)) {
+                        err = -EINTR;
+                        break;
+                }
+        }
+        if (0 == p->pv_loaned)
+                return 0;
+
+        if (0 == err)
+                err = -EPIPE;
+        kmutex_lock(&p->pv_rdlock);
+        while (0 < p->pv_loaned) {
+                pipe_buf_t *pb = PIPE_BUF(p, p->pv_nbufs - 1);
+
+                KASSERT(pb->pb_loaned);
+                *len -= pb->pb_len;
+                p->pv_size -= pb->pb_len;
+                p->pv_nbufs--;
+                p->pv_loaned--;
+        }
+        kmutex_unlock(&p->pv_rdlock);
+        return err;
+}
+
+/*
+ * Copies up to len characters out of the pipe, returning how many there
+ * were.
+ */
+static size_t
+pipe_drain(pipe_t *p, char *buf, size_t len)
+{
+        size_t done = 0;
+
+        while (done < len && 0 < p->pv_nbufs) {
+                pipe_buf_t *pb = PIPE_BUF(p, 0);
+                size_t n = MIN(len - done, pb->pb_len);
+
+                memcpy(buf + done, pb->pb_page + pb->pb_off, n);
+                done += n;
+                pipe_buf_consume(p, n);
+        }
+        return done;
 }
 
 /* pipefs vnode operations */
@@ -185,8 +456,19 @@ pipe_query_vnode(vnode_t *vnode)
 static vnode_t *
 pget(void)
 {
-        NOT_YET_IMPLEMENTED("PIPES: pget");
-        return NULL;
+        vnode_t *vn;
+        pipe_t *pipe;
+
+        if (NULL == (vn = vget(&pipe_fs, next_pno++)))
+                return NULL;
+        KASSERT(NULL == vn->vn_i);
+
+        if (NULL == (pipe = pipe_create())) {
+                vput(vn);
+                return NULL;
+        }
+        vn->vn_i = pipe;
+        return vn;
 }
 
 /*
@@ -203,8 +485,47 @@ pget(void)
 int
 do_pipe(int pipefd[2])
 {
-        NOT_YET_IMPLEMENTED("PIPES: do_pipe");
-        return -ENOTSUP;
+        vnode_t *vn;
+        file_t *rf, *wf;
+        int rfd, wfd;
+
+        if (NULL == (vn = pget()))
+                return -ENOMEM;
+        if (NULL == (rf = fget(-1))) {
+                vput(vn);
+                return -ENOMEM;
+        }
+        if (NULL == (wf = fget(-1))) {
+                fput(rf);
+                vput(vn);
+                return -ENOMEM;
+        }
+
+        /* each file holds a reference to the vnode, the first being the
+         * one pget returned */
+        rf->f_mode = FMODE_READ;
+        facq(rf, vn);
+        vref(vn);
+        wf->f_mode = FMODE_WRITE;
+        facq(wf, vn);
+
+        if (0 > (rfd = get_empty_fd(curproc))) {
+                fput(wf);
+                fput(rf);
+                return rfd;
+        }
+        curproc->p_files[rfd] = rf;
+        if (0 > (wfd = get_empty_fd(curproc))) {
+                curproc->p_files[rfd] = NULL;
+                fput(wf);
+                fput(rf);
+                return wfd;
+        }
+        curproc->p_files[wfd] = wf;
+
+        pipefd[0] = rfd;
+        pipefd[1] = wfd;
+        return 0;
 }
 
 /*
@@ -223,8 +544,29 @@ do_pipe(int pipefd[2])
 static int
 pipe_read(vnode_t *vnode, off_t offset, void *buf, size_t len)
 {
-        NOT_YET_IMPLEMENTED("PIPES: pipe_read");
-        return -EINVAL;
+        pipe_t *p = VNODE_TO_PIPE(vnode);
+        size_t done = 0;
+
+        kmutex_lock(&p->pv_rdlock);
+        for (;;) {
+                size_t n = pipe_drain(p, (char *) buf + done, len - done);
+
+                if (0 < n)
+                        pipe_wake_writers(p);
+                done += n;
+                if (done == len || 0 == p->pv_writers)
+                        break;
+                if (sched_cancellable_sleep_on(&p->pv_read_waitq)) {
+                        if (0 == done) {
+                                kmutex_unlock(&p->pv_rdlock);
+                                return -EINTR;
+                        }
+                        break;
+                }
+        }
+        kmutex_unlock(&p->pv_rdlock);
+
+        return (int) done;
 }
 
 /*
@@ -239,8 +581,124 @@ pipe_read(vnode_t *vnode, off_t offset, void *buf, size_t len)
 static int
 pipe_write(vnode_t *vnode, off_t offset, const void *buf, size_t len)
 {
-        NOT_YET_IMPLEMENTED("PIPES: pipe_write");
-        return -EINVAL;
+        pipe_t *p = VNODE_TO_PIPE(vnode);
+        size_t done = 0;
+        int err = 0;
+
+        kmutex_lock(&p->pv_wrlock);
+        while (done < len) {
+                size_t n;
+
+                if (0 == p->pv_readers) {
+                        err = -EPIPE;
+                        break;
+                }
+
+                if (PAGE_SIZE < len)
+                        n = pipe_loan(p, (const char *) buf + done, len - done);
+                else
+                        n = pipe_fill(p, (const char *) buf + done, len - done);
+                if (0 < n) {
+                        pipe_wake_readers(p);
+                        if (PAGE_SIZE < len && 0 > (err = pipe_loan_wait(p, &n))) {
+                                done += n;
+                                break;
+                        }
+                        done += n;
+                        continue;
+                }
+
+                /* nothing fit: either the ring is full, in which case the
+                 * readers will make room, or there was no page for it */
+                if (0 == p->pv_nbufs) {
+                        err = -ENOMEM;
+                        break;
+                }
+                if (sched_cancellable_sleep_on(&p->pv_write_waitq)) {
+                        err = -EINTR;
+                        break;
+                }
+        }
+        kmutex_unlock(&p->pv_wrlock);
+
+        return (0 < done) ? (int) done : err;
+}
+
+/*
+ * A nonblocking read takes what is in the pipe, failing with EAGAIN if
+ * there is nothing (while there are writers) or another reader is in
+ * the middle of a read.
+ */
+static int
+pipe_read_nonblock(vnode_t *vnode, off_t offset, void *buf, size_t len)
+{
+        pipe_t *p = VNODE_TO_PIPE(vnode);
+        size_t n;
+
+        if (!kmutex_trylock(&p->pv_rdlock))
+                return -EAGAIN;
+        if (0 < (n = pipe_drain(p, buf, len)))
+                pipe_wake_writers(p);
+        kmutex_unlock(&p->pv_rdlock);
+
+        if (0 == n && 0 < len && 0 < p->pv_writers)
+                return -EAGAIN;
+        return (int) n;
+}
+
+/*
+ * A nonblocking write copies in what there is room for, never loaning
+ * its buffer (the writer would have to wait for that to be read), and
+ * fails with EAGAIN if there is no room at all or another writer is in
+ * the middle of a write.
+ */
+static int
+pipe_write_nonblock(vnode_t *vnode, off_t offset, const void *buf, size_t len)
+{
+        pipe_t *p = VNODE_TO_PIPE(vnode);
+        size_t n;
+
+        if (0 == p->pv_readers)
+                return -EPIPE;
+        if (!kmutex_trylock(&p->pv_wrlock))
+                return -EAGAIN;
+        if (0 < (n = pipe_fill(p, buf, len)))
+                pipe_wake_readers(p);
+        kmutex_unlock(&p->pv_wrlock);
+
+        if (0 == n && 0 < len)
+                return (0 == p->pv_nbufs) ? -ENOMEM : -EAGAIN;
+        return (int) n;
+}
+
+/*
+ * A pipe can be read without blocking if it has data or no writers (at
+ * the end of it), and written if a write would put something in the
+ * ring or no readers are left for it to fail on.
+ */
+static int
+pipe_poll(vnode_t *vnode, int events, struct poll_table *pt)
+{
+        pipe_t *p = VNODE_TO_PIPE(vnode);
+        pipe_buf_t *pb;
+        int revents = 0;
+
+        poll_wait(pt, &p->pv_poll);
+
+        if (0 < p->pv_size)
+                revents |= POLLIN;
+        if (0 == p->pv_writers)
+                revents |= POLLIN | POLLHUP;
+        if (0 == p->pv_readers) {
+                revents |= POLLOUT | POLLERR;
+        } else if (PIPE_MAX_PAGES > p->pv_nbufs) {
+                revents |= POLLOUT;
+        } else {
+                pb = PIPE_BUF(p, p->pv_nbufs - 1);
+                if (!pb->pb_loaned && PAGE_SIZE > pb->pb_off + pb->pb_len)
+                        revents |= POLLOUT;
+        }
+        return revents;
 }
 
 /*
@@ -251,8 +709,16 @@ pipe_write(vnode_t *vnode, off_t offset, const void *buf, size_t len)
 static int
 pipe_stat(vnode_t *vnode, struct stat *ss)
 {
-        NOT_YET_IMPLEMENTED("PIPES: pipe_stat");
-        return -EINVAL;
+        pipe_t *p = VNODE_TO_PIPE(vnode);
+
+        memset(ss, 0, sizeof(struct stat));
+        ss->st_mode = vnode->vn_mode;
+        ss->st_ino = vnode->vn_vno;
+        ss->st_nlink = 1;
+        ss->st_size = (int) p->pv_size;
+        ss->st_blksize = PAGE_SIZE;
+        ss->st_blocks = p->pv_nbufs;
+        return 0;
 }
 
 /*
@@ -264,7 +730,12 @@ pipe_stat(vnode_t *vnode, struct stat *ss)
 static int
 pipe_acquire(vnode_t *vnode, file_t *file)
 {
-        NOT_YET_IMPLEMENTED("PIPES: pipe_acquire");
+        pipe_t *p = VNODE_TO_PIPE(vnode);
+
+        if (FMODE_ISREAD(file->f_mode))
+                p->pv_readers++;
+        if (FMODE_ISWRITE(file->f_mode))
+                p->pv_writers++;
         return 0;
 }
 
@@ -277,6 +748,232 @@ pipe_acquire(vnode_t *vnode, file_t *file)
 static int
 pipe_release(vnode_t *vnode, file_t *file)
 {
-        NOT_YET_IMPLEMENTED("PIPES: pipe_release");
+        pipe_t *p = VNODE_TO_PIPE(vnode);
+
+        if (FMODE_ISREAD(file->f_mode)) {
+                KASSERT(0 < p->pv_readers);
+                if (0 == --p->pv_readers)
+                        pipe_wake_writers(p);
+        }
+        if (FMODE_ISWRITE(file->f_mode)) {
+                KASSERT(0 < p->pv_writers);
+                if (0 == --p->pv_writers)
+                        pipe_wake_readers(p);
+        }
         return 0;
 }
+
+/*
+ * Moves up to len characters out of the pipe p, whole buffers at a time,
+ * into the file f (which is not a pipe) at its current position. Waits
+ * only for the pipe to be non-empty, like a read which returns what is
+ * there; returns 0 once the pipe is empty and has no writers.
+ */
+static int
+splice_from_pipe(pipe_t *p, file_t *f, size_t len)
+{
+        vnode_t *vn = f->f_vnode;
+        size_t done = 0;
+        int err = 0;
+
+        kmutex_lock(&p->pv_rdlock);
+        while (0 == p->pv_size && 0 < p->pv_writers) {
+                if (sched_cancellable_sleep_on(&p->pv_read_waitq)) {
+                        kmutex_unlock(&p->pv_rdlock);
+                        return -EINTR;
+                }
+        }
+
+        if (FMODE_ISAPPEND(f->f_mode))
+                f->f_pos = vn->vn_len;
+
+        /* the oldest buffer stays put while the file is written, since
+         * only readers remove buffers and the read lock is held */
+        while (done < len && 0 < p->pv_nbufs) {
+                pipe_buf_t *pb = PIPE_BUF(p, 0);
+                size_t n = MIN(len - done, pb->pb_len);
+
+                if (0 >= (err = vn->vn_ops->write(vn, f->f_pos,
+                                                   pb->pb_page + pb->pb_off, n)))
+                        break;
+                f->f_pos += err;
+                done += err;
+                pipe_buf_consume(p, (size_t) err);
+                pipe_wake_writers(p);
+                if ((size_t) err < n)
+                        break;
+        }
+        kmutex_unlock(&p->pv_rdlock);
+
+        return (0 < done) ? (int) done : err;
+}
+
+/*
+ * Moves up to len characters from the file f (which is not a pipe) at its
+ * current position into the pipe p. The file is read straight into fresh
+ * pages which are then linked into the ring, so nothing is copied twice.
+ * Stops early at the end of the file, and waits for room like a write.
+ */
+static int
+splice_to_pipe(file_t *f, pipe_t *p, size_t len)
+{
+        vnode_t *vn = f->f_vnode;
+        size_t done = 0;
+        int err = 0;
+
+        kmutex_lock(&p->pv_wrlock);
+        while (done < len) {
+                size_t want = MIN(len - done, PAGE_SIZE);
+                char *page;
+
+                while (PIPE_MAX_PAGES == p->pv_nbufs && 0 < p->pv_readers) {
+                        if (sched_cancellable_sleep_on(&p->pv_write_waitq)) {
+                                err = -EINTR;
+                                goto out;
+                        }
+                }
+                if (0 == p->pv_readers) {
+                        err = -EPIPE;
+                        break;
+                }
+                if (NULL == (page = pipe_page_get(p))) {
+                        err = -ENOMEM;
+                        break;
+                }
+
+                /* only writers add buffers, so the free slot found above
+                 * is still free once the read returns */
+                err = vn->vn_ops->read(vn, f->f_pos, page, want);
+                if (0 >= err || 0 == p->pv_readers) {
+                        pipe_page_put(p, page);
+                        if (0 < err)
+                                err = -EPIPE;
+                        break;
+                }
+                f->f_pos += err;
+                done += err;
+                pipe_buf_push(p, page, 0, (size_t) err);
+                pipe_wake_readers(p);
+                if ((size_t) err < want)
+                        break;
+        }
+out:
+        kmutex_unlock(&p->pv_wrlock);
+
+        return (0 < done) ? (int) done : err;
+}
+
+/*
+ * Moves up to len characters from pipe in to pipe out. Whole buffers are
+ * relinked from one ring into the other; only a buffer which is split by
+ * len, or which finds no free slot, is copied. Waits like splice_from_pipe
+ * for in to be non-empty, but not for room in out.
+ */
+static int
+splice_pipes(pipe_t *in, pipe_t *out, size_t len)
+{
+        size_t done = 0;
+        int err = 0;
+
+        kmutex_lock(&in->pv_rdlock);
+        kmutex_lock(&out->pv_wrlock);
+        while (0 == in->pv_size && 0 < in->pv_writers) {
+                if (sched_cancellable_sleep_on(&in->pv_read_waitq)) {
+                        err = -EINTR;
+                        goto out;
+                }
+        }
+
+        while (done < len && 0 < in->pv_nbufs) {
+                pipe_buf_t *pb = PIPE_BUF(in, 0);
+                size_t n;
+
+                if (0 == out->pv_readers) {
+                        err = -EPIPE;
+                        break;
+                }
+                if (!pb->pb_loaned && pb->pb_len <= len - done
+                    && PIPE_MAX_PAGES > out->pv_nbufs) {
+                        /* hand the page over as it is */
+                        n = pb->pb_len;
+                        pipe_buf_push(out, pb->pb_page, pb->pb_off, n);
+                        in->pv_size -= n;
+                        in->pv_first = (in->pv_first + 1) % PIPE_MAX_PAGES;
+                        in->pv_nbufs--;
+                } else {
+                        n = pipe_fill(out, pb->pb_page + pb->pb_off,
+                                      MIN(len - done, pb->pb_len));
+                        if (0 == n)
+                                break;
+                        pipe_buf_consume(in, n);
+                }
+                done += n;
+        }
+
+        if (0 < done) {
+                pipe_wake_writers(in);
+                pipe_wake_readers(out);
+        }
+out:
+        kmutex_unlock(&out->pv_wrlock);
+        kmutex_unlock(&in->pv_rdlock);
+
+        return (0 < done) ? (int) done : err;
+}
+
+/*
+ * An implementation of the splice(2) system call: moves up to len
+ * characters from fdin to fdout without copying them through user
+ * space. At least one of the two must be a pipe; the other end, if it is
+ * not, is read or written at (and advances) its file position like
+ * read(2) or write(2). Returns the number of characters moved, which is
+ * 0 once fdin is a pipe which is empty and will stay so.
+ *
+ * Error cases:
+ *      o EBADF
+ *        fdin is not open for reading or fdout is not open for writing.
+ *      o EINVAL
+ *        Neither file is a pipe, both are the same pipe, or the one which
+ *        is not a pipe is a directory.
+ *      o EPIPE
+ *        fdout is a pipe which nobody can read.
+ */
+int
+do_splice(int fdin, int fdout, size_t len)
+{
+        file_t *in, *out;
+        int inpipe, outpipe;
+        int ret;
+
+        if (0 > fdin || NFILES <= fdin || 0 > fdout || NFILES <= fdout)
+                return -EBADF;
+        if (NULL == (in = fget(fdin)))
+                return -EBADF;
+        if (NULL == (out = fget(fdout))) {
+                fput(in);
+                return -EBADF;
+        }
+
+        inpipe = (&pipe_vops == in->f_vnode->vn_ops);
+        outpipe = (&pipe_vops == out->f_vnode->vn_ops);
+
+        if (!FMODE_ISREAD(in->f_mode) || !FMODE_ISWRITE(out->f_mode))
+                ret = -EBADF;
+        else if ((!inpipe && !outpipe) || in->f_vnode == out->f_vnode
+                 || S_ISDIR(in->f_vnode->vn_mode)
+                 || S_ISDIR(out->f_vnode->vn_mode))
+                ret = -EINVAL;
+        else if (0 == len)
+                ret = 0;
+        else if (inpipe && outpipe)
+                ret = splice_pipes(VNODE_TO_PIPE(in->f_vnode),
+                                   VNODE_TO_PIPE(out->f_vnode), len);
+        else if (inpipe)
+                ret = splice_from_pipe(VNODE_TO_PIPE(in->f_vnode), out, len);
+        else
+                ret = splice_to_pipe(in, VNODE_TO_PIPE(out->f_vnode), len);
+
+        fput(out);
+        fput(in);
+        return ret;
+}
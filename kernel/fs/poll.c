@@ -0,0 +1,172 @@
+#include "kernel.h"
+#include "errno.h"
+#include "globals.h"
+
+#include "fs/file.h"
+#include "fs/poll.h"
+#include "fs/vnode.h"
+
+#include "main/interrupt.h"
+
+#include "mm/kmalloc.h"
+
+#include "proc/sched.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/time.h"
+#include "util/timer.h"
+
+/*
+ * poll(2). A file whose vnode has no poll entry point (a regular file
+ * or a directory) is always ready to be read and written. The files
+ * are held for the whole call, so their pollheads stay where the
+ * waiters are linked.
+ */
+
+/* The events which a file reports whether or not they are asked for */
+#define POLL_ALWAYS     (POLLERR | POLLHUP | POLLNVAL)
+
+void
+pollhead_init(pollhead_t *ph)
+{
+        list_init(&ph->ph_waiters);
+}
+
+void
+poll_wait(poll_table_t *pt, pollhead_t *ph)
+{
+        poll_waiter_t *pw;
+        uint8_t oldipl;
+
+        if (NULL == pt)
+                return;
+        KASSERT(pt->pt_nwaiters < pt->pt_maxwaiters);
+
+        pw = &pt->pt_waiters[pt->pt_nwaiters++];
+        pw->pw_pt = pt;
+        /* poll_wakeup may be walking the list from an interrupt */
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        list_insert_tail(&ph->ph_waiters, &pw->pw_link);
+        intr_setipl(oldipl);
+}
+
+void
+poll_wakeup(pollhead_t *ph)
+{
+        poll_waiter_t *pw;
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        list_iterate_begin(&ph->ph_waiters, pw, poll_waiter_t, pw_link) {
+                pw->pw_pt->pt_woken = 1;
+                sched_broadcast_on(&pw->pw_pt->pt_q);
+        } list_iterate_end();
+        intr_setipl(oldipl);
+}
+
+/* Fills in the revents of each of the fds, whose files are in files,
+ * registering waiters with pt if it is not NULL. Returns how many have
+ * any. */
+static int
+poll_scan(struct pollfd *fds, file_t **files, nfds_t nfds, poll_table_t *pt)
+{
+        nfds_t i;
+        int n = 0;
+
+        for (i = 0; i < nfds; i++) {
+                vnode_t *vn;
+                int revents;
+
+                if (0 > fds[i].fd) {
+                        fds[i].revents = 0;
+                        continue;
+                }
+                if (NULL == files[i]) {
+                        fds[i].revents = POLLNVAL;
+                        n++;
+                        continue;
+                }
+                vn = files[i]->f_vnode;
+                if (NULL != vn->vn_ops->poll)
+                        revents = vn->vn_ops->poll(vn, fds[i].events, pt);
+                else
+                        revents = POLLIN | POLLOUT;
+                fds[i].revents = revents & (fds[i].events | POLL_ALWAYS);
+                if (0 != fds[i].revents)
+                        n++;
+        }
+        return n;
+}
+
+int
+do_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+        poll_table_t pt;
+        file_t **files;
+        uint32_t deadline = 0;
+        nfds_t i;
+        int n, err = 0;
+
+        if (NFILES < nfds)
+                return -EINVAL;
+
+        if (NULL == (files = kmalloc((nfds + 1) * sizeof(*files))))
+                return -ENOMEM;
+        sched_queue_init(&pt.pt_q);
+        pt.pt_woken = 0;
+        pt.pt_nwaiters = 0;
+        /* a file may wait on a pollhead for reading and one for writing */
+        pt.pt_maxwaiters = 2 * nfds;
+        if (NULL == (pt.pt_waiters = kmalloc((2 * nfds + 1) * sizeof(poll_waiter_t)))) {
+                kfree(files);
+                return -ENOMEM;
+        }
+
+        for (i = 0; i < nfds; i++)
+                files[i] = (0 > fds[i].fd) ? NULL : fget(fds[i].fd);
+
+        if (0 < timeout)
+                deadline = jiffies + MSECS_TO_TICKS(timeout);
+
+        /* the waiters are only registered the first time round; after
+         * that a wakeup means something may have changed */
+        n = poll_scan(fds, files, nfds, &pt);
+        while (0 == n && 0 != timeout) {
+                uint8_t oldipl = intr_getipl();
+                int32_t left = (int32_t) (deadline - jiffies);
+
+                if (0 < timeout && 0 >= left)
+                        break;
+                intr_setipl(IPL_HIGH);
+                if (!pt.pt_woken) {
+                        if (0 > timeout)
+                                err = sched_cancellable_sleep_on(&pt.pt_q);
+                        else
+                                err = sched_cancellable_sleep_on_timeout(&pt.pt_q, left);
+                }
+                pt.pt_woken = 0;
+                intr_setipl(oldipl);
+                if (-EINTR == err)
+                        break;
+                err = 0;
+                n = poll_scan(fds, files, nfds, NULL);
+        }
+
+        for (i = 0; i < (nfds_t) pt.pt_nwaiters; i++) {
+                uint8_t oldipl = intr_getipl();
+
+                intr_setipl(IPL_HIGH);
+                list_remove(&pt.pt_waiters[i].pw_link);
+                intr_setipl(oldipl);
+        }
+        for (i = 0; i < nfds; i++) {
+                if (NULL != files[i])
+                        fput(files[i]);
+        }
+        kfree(pt.pt_waiters);
+        kfree(files);
+
+        return (0 > err) ? err : n;
+}
@@ -0,0 +1,424 @@
+/*
+ * A file system with nothing stored in it: each file is made up, when it
+ * is read, by one of the debug info functions, for seeing the state of
+ * processes and memory without a debugger.
+ *
+ *    /proc/meminfo       the page allocator, page cache, swap and
+ *                        same-page merging
+ *    /proc/slabinfo      every slab allocator
+ *    /proc/kmallocinfo   what each caller of kmalloc holds
+ *    /proc/cachestat     page cache hits, misses and writeback by kind of
+ *                        object and by file system type
+ *    /proc/schedlat      how long threads wait for the processor and sleep
+ *    /proc/<pid>/maps    the areas of the process's address space
+ *    /proc/<pid>/stat    its state, faults, clock ticks and resident pages
+ *    /proc/<pid>/sched   how long its threads wait for the processor and sleep
+ *
+ * There are no inodes. A vnode number says which file it is: the low
+ * PROCFS_FILE_BITS are the file, and the rest one more than the pid, 0
+ * for files which are not of a process. A file of a process which has
+ * gone reads as -ENOENT.
+ *
+ * Processes come and go without the file system hearing of it, so its
+ * directories are VN_NOCACHE and lookups always come here.
+ */
+
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "fs/dirent.h"
+#include "fs/stat.h"
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/pagetable.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+
+#include "proc/proc.h"
+#include "proc/sched.h"
+
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+#include "vm/ksm.h"
+#include "vm/pagefault.h"
+#include "vm/swap.h"
+#include "vm/vmmap.h"
+
+#include "fs/procfs/procfs.h"
+
+#define PROCFS_FILE_BITS        3
+#define PROCFS_INO(pid, file)   ((((ino_t)(pid) + 1) << PROCFS_FILE_BITS) | (file))
+#define PROCFS_INO_PID(ino)     ((pid_t)((ino) >> PROCFS_FILE_BITS) - 1)
+#define PROCFS_INO_FILE(ino)    ((ino) & ((1 << PROCFS_FILE_BITS) - 1))
+
+/* The pid of files which are not of a process */
+#define PROCFS_NOPID            (-1)
+
+/* Files, as numbered in vnode numbers. Each directory is file 0. */
+#define PROCFS_DIR              0
+#define PROCFS_MEMINFO          1
+#define PROCFS_SLABINFO         2
+#define PROCFS_KMALLOCINFO      3
+#define PROCFS_CACHESTAT        4
+#define PROCFS_SCHEDLAT         5
+#define PROCFS_MAPS             1
+#define PROCFS_STAT             2
+#define PROCFS_SCHED            3
+
+#define PROCFS_ROOT_INO         PROCFS_INO(PROCFS_NOPID, PROCFS_DIR)
+
+/* Room for the text of a file, which is made up whole on every read */
+#define PROCFS_TEXT_PAGES       4
+#define PROCFS_TEXT_SIZE        (PROCFS_TEXT_PAGES * PAGE_SIZE)
+
+/* Offsets in the root directory: ".", "..", procfs_root_files and then
+ * a process directory at PROCFS_PID_OFF plus its pid, so that offsets
+ * stay the same while processes come and go */
+#define PROCFS_NFIXED(files)    (2 + (off_t)(sizeof(files) / sizeof((files)[0])))
+#define PROCFS_PID_OFF          PROCFS_NFIXED(procfs_root_files)
+
+typedef struct procfs_file {
+        const char *pf_name;
+        int         pf_file;
+        /* makes up the text, data being the process, or NULL */
+        size_t    (*pf_info)(const void *data, char *buf, size_t size);
+} procfs_file_t;
+
+static size_t procfs_meminfo(const void *data, char *buf, size_t size);
+static size_t procfs_maps(const void *data, char *buf, size_t size);
+static size_t procfs_stat_info(const void *data, char *buf, size_t size);
+
+static const procfs_file_t procfs_root_files[] = {
+        { "meminfo",  PROCFS_MEMINFO,  procfs_meminfo },
+        { "slabinfo", PROCFS_SLABINFO, slab_allocators_info },
+        { "kmallocinfo", PROCFS_KMALLOCINFO, kmalloc_tags_info },
+        { "cachestat", PROCFS_CACHESTAT, pframe_stat_info },
+        { "schedlat", PROCFS_SCHEDLAT, sched_latency_info }
+};
+
+static const procfs_file_t procfs_pid_files[] = {
+        { "maps", PROCFS_MAPS, procfs_maps },
+        { "stat", PROCFS_STAT, procfs_stat_info },
+        { "sched", PROCFS_SCHED, sched_latency_info }
+};
+
+/*
+ * Filesystem operations
+ */
+static void procfs_read_vnode(vnode_t *vn);
+static void procfs_delete_vnode(vnode_t *vn);
+static int procfs_query_vnode(vnode_t *vn);
+
+static fs_ops_t procfs_ops = {
+        .read_vnode   = procfs_read_vnode,
+        .delete_vnode = procfs_delete_vnode,
+        .query_vnode  = procfs_query_vnode,
+        .umount       = NULL
+};
+
+/*
+ * vnode operations
+ */
+static int procfs_read(vnode_t *file, off_t offset, void *buf, size_t count);
+static int procfs_lookup(vnode_t *dir, const char *name, size_t name_len,
+                         vnode_t **result);
+static int procfs_readdir(vnode_t *dir, off_t offset, struct dirent *d);
+static int procfs_stat(vnode_t *vn, struct stat *buf);
+
+static vnode_ops_t procfs_dir_vops = {
+        .read = NULL,
+        .write = NULL,
+        .mmap = NULL,
+        .create = NULL,
+        .mknod = NULL,
+        .lookup = procfs_lookup,
+        .link = NULL,
+        .unlink = NULL,
+        .mkdir = NULL,
+        .rmdir = NULL,
+        .readdir = procfs_readdir,
+        .readdirs = NULL,
+        .stat = procfs_stat,
+        .acquire = NULL,
+        .release = NULL,
+        .fillpage = NULL,
+        .dirtypage = NULL,
+        .cleanpage = NULL
+};
+
+static vnode_ops_t procfs_file_vops = {
+        .read = procfs_read,
+        .write = NULL,
+        .mmap = NULL,
+        .create = NULL,
+        .mknod = NULL,
+        .lookup = NULL,
+        .link = NULL,
+        .unlink = NULL,
+        .mkdir = NULL,
+        .rmdir = NULL,
+        .readdir = NULL,
+        .readdirs = NULL,
+        .stat = procfs_stat,
+        .acquire = NULL,
+        .release = NULL,
+        .fillpage = NULL,
+        .dirtypage = NULL,
+        .cleanpage = NULL
+};
+
+/*
+ * The files
+ */
+
+static size_t
+procfs_meminfo(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        size = pframe_info(NULL, buf, size);
+        size = page_zero_info(NULL, buf + (osize - size), size);
+        size = swap_info(NULL, buf + (osize - size), size);
+        size = ksm_info(NULL, buf + (osize - size), size);
+        return size;
+}
+
+static size_t
+procfs_maps(const void *data, char *buf, size_t osize)
+{
+        const proc_t *p = data;
+
+        /* a process which has exited but not been waited for */
+        if (NULL == p->p_vmmap) {
+                buf[0] = '\0';
+                return osize;
+        }
+        return vmmap_mapping_info(p->p_vmmap, buf, osize);
+}
+
+static size_t
+procfs_stat_info(const void *data, char *buf, size_t osize)
+{
+        const proc_t *p = data;
+        size_t size = osize;
+
+        iprintf(&buf, &size, "pid:    %d\n", p->p_pid);
+        iprintf(&buf, &size, "ppid:   %d\n", (NULL == p->p_pproc) ? 0 : p->p_pproc->p_pid);
+        iprintf(&buf, &size, "name:   %s\n", p->p_comm);
+        iprintf(&buf, &size, "state:  %s\n", (PROC_RUNNING == p->p_state) ? "running" : "dead");
+        if (NULL == p->p_vmmap)
+                return size;
+
+        iprintf(&buf, &size, "ticks:  %u\n", p->p_vmmap->vmm_ticks);
+        iprintf(&buf, &size, "rss:    %u pages\n", pt_resident(p->p_pagedir));
+        size = pagefault_info(&p->p_vmmap->vmm_faults, buf, size);
+        return size;
+}
+
+static const procfs_file_t *
+procfs_find_file(ino_t ino)
+{
+        const procfs_file_t *files = procfs_root_files;
+        uint32_t i, n = sizeof(procfs_root_files) / sizeof(procfs_root_files[0]);
+
+        if (PROCFS_NOPID != PROCFS_INO_PID(ino)) {
+                files = procfs_pid_files;
+                n = sizeof(procfs_pid_files) / sizeof(procfs_pid_files[0]);
+        }
+        for (i = 0; i < n; i++) {
+                if (files[i].pf_file == (int) PROCFS_INO_FILE(ino))
+                        return &files[i];
+        }
+        return NULL;
+}
+
+/* Returns the pid named by name, or -1 if it is not a pid */
+static pid_t
+procfs_parse_pid(const char *name, size_t len)
+{
+        pid_t pid = 0;
+        size_t i;
+
+        /* no leading zeros, so that each process has one name */
+        if (0 == len || len > 5 || ('0' == name[0] && 1 < len))
+                return -1;
+        for (i = 0; i < len; i++) {
+                if ('0' > name[i] || '9' < name[i])
+                        return -1;
+                pid = pid * 10 + (name[i] - '0');
+        }
+        return (PROC_MAX_COUNT > pid) ? pid : -1;
+}
+
+/*
+ * Function implementations
+ */
+
+int
+procfs_mount(struct fs *fs)
+{
+        fs->fs_i = NULL;
+        fs->fs_op = &procfs_ops;
+        fs->fs_root = vget(fs, PROCFS_ROOT_INO);
+        return 0;
+}
+
+static void
+procfs_read_vnode(vnode_t *vn)
+{
+        KASSERT(PROCFS_DIR == PROCFS_INO_FILE(vn->vn_vno)
+                || NULL != procfs_find_file(vn->vn_vno));
+
+        vn->vn_i = NULL;
+        vn->vn_len = 0;
+        if (PROCFS_DIR == PROCFS_INO_FILE(vn->vn_vno)) {
+                vn->vn_mode = S_IFDIR;
+                vn->vn_ops = &procfs_dir_vops;
+                vn->vn_flags |= VN_NOCACHE;
+        } else {
+                vn->vn_mode = S_IFREG;
+                vn->vn_ops = &procfs_file_vops;
+        }
+}
+
+static void
+procfs_delete_vnode(vnode_t *vn)
+{
+}
+
+/* There is nothing to keep a vnode for once it is not used */
+static int
+procfs_query_vnode(vnode_t *vn)
+{
+        return 0;
+}
+
+static int
+procfs_read(vnode_t *file, off_t offset, void *buf, size_t count)
+{
+        const procfs_file_t *pf = procfs_find_file(file->vn_vno);
+        pid_t pid = PROCFS_INO_PID(file->vn_vno);
+        proc_t *p = NULL;
+        char *text;
+        off_t len;
+
+        if (PROCFS_NOPID != pid && NULL == (p = proc_lookup(pid)))
+                return -ENOENT;
+        if (NULL == (text = page_alloc_n(PROCFS_TEXT_PAGES)))
+                return -ENOMEM;
+
+        text[0] = '\0';
+        pf->pf_info(p, text, PROCFS_TEXT_SIZE);
+        len = strnlen(text, PROCFS_TEXT_SIZE);
+        if (offset < len) {
+                len = MIN(len - offset, (off_t) count);
+                memcpy(buf, text + offset, len);
+        } else {
+                len = 0;
+        }
+
+        page_free_n(text, PROCFS_TEXT_PAGES);
+        return len;
+}
+
+static int
+procfs_lookup(vnode_t *dir, const char *name, size_t namelen, vnode_t **result)
+{
+        pid_t pid = PROCFS_INO_PID(dir->vn_vno);
+        const procfs_file_t *files = procfs_root_files;
+        uint32_t i, n = sizeof(procfs_root_files) / sizeof(procfs_root_files[0]);
+
+        if (PROCFS_NOPID != pid) {
+                if (NULL == proc_lookup(pid))
+                        return -ENOENT;
+                files = procfs_pid_files;
+                n = sizeof(procfs_pid_files) / sizeof(procfs_pid_files[0]);
+        }
+
+        if (name_match(".", name, namelen)) {
+                vref(dir);
+                *result = dir;
+                return 0;
+        }
+        if (name_match("..", name, namelen)) {
+                *result = vget(dir->vn_fs, PROCFS_ROOT_INO);
+                return 0;
+        }
+        for (i = 0; i < n; i++) {
+                if (name_match(files[i].pf_name, name, namelen)) {
+                        *result = vget(dir->vn_fs, PROCFS_INO(pid, files[i].pf_file));
+                        return 0;
+                }
+        }
+
+        if (PROCFS_NOPID == pid && -1 != (pid = procfs_parse_pid(name, namelen))
+            && NULL != proc_lookup(pid)) {
+                *result = vget(dir->vn_fs, PROCFS_INO(pid, PROCFS_DIR));
+                return 0;
+        }
+        return -ENOENT;
+}
+
+static int
+procfs_readdir(vnode_t *dir, off_t offset, struct dirent *d)
+{
+        pid_t pid = PROCFS_INO_PID(dir->vn_vno);
+        const procfs_file_t *files = procfs_root_files;
+        off_t nfixed = PROCFS_NFIXED(procfs_root_files);
+        proc_t *p, *next = NULL;
+
+        KASSERT(S_ISDIR(dir->vn_mode));
+
+        if (PROCFS_NOPID != pid) {
+                if (NULL == proc_lookup(pid))
+                        return 0;
+                files = procfs_pid_files;
+                nfixed = PROCFS_NFIXED(procfs_pid_files);
+        }
+
+        d->d_off = 0; /* unused */
+        if (0 == offset || 1 == offset) {
+                d->d_ino = (0 == offset) ? dir->vn_vno : PROCFS_ROOT_INO;
+                strcpy(d->d_name, (0 == offset) ? "." : "..");
+                return 1;
+        }
+        if (offset < nfixed) {
+                d->d_ino = PROCFS_INO(pid, files[offset - 2].pf_file);
+                strncpy(d->d_name, files[offset - 2].pf_name, NAME_LEN - 1);
+                d->d_name[NAME_LEN - 1] = '\0';
+                return 1;
+        }
+        if (PROCFS_NOPID != pid)
+                return 0;
+
+        /* the process with the lowest pid from offset's on, the process
+         * list not being in order */
+        list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                if (p->p_pid >= offset - PROCFS_PID_OFF
+                    && (NULL == next || p->p_pid < next->p_pid))
+                        next = p;
+        } list_iterate_end();
+        if (NULL == next)
+                return 0;
+
+        d->d_ino = PROCFS_INO(next->p_pid, PROCFS_DIR);
+        snprintf(d->d_name, sizeof(d->d_name), "%d", next->p_pid);
+        return PROCFS_PID_OFF + next->p_pid + 1 - offset;
+}
+
+static int
+procfs_stat(vnode_t *vn, struct stat *buf)
+{
+        memset(buf, 0, sizeof(struct stat));
+        buf->st_mode    = vn->vn_mode;
+        buf->st_ino     = (int) vn->vn_vno;
+        buf->st_nlink   = S_ISDIR(vn->vn_mode) ? 2 : 1;
+        buf->st_blksize = (int) PAGE_SIZE;
+        return 0;
+}
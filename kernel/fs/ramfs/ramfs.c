@@ -1,16 +1,20 @@
 /*
  * This is a special filesystem designed to be a test filesystem before s5fs has
  * been written.  It is an in-memory filesystem that supports almost all of the
- * vnode operations.  It has the following restrictions:
+ * vnode operations.
  *
- *    o File sizes are limited to a single page (8192 bytes) in order
- *      to keep the code simple.
+ *    o A file's data lives in page frames of an mmobj belonging to its
+ *      inode (not to its vnode, which may come and go), so files grow
+ *      one page at a time with no limit but memory. A page is pinned
+ *      the first time it is looked up, since there is nowhere to page
+ *      it out to, and pages never written are holes that read as zeros.
  *
- *    o There is no support for fillpage, etc. (since we don't have VM yet anyway)
+ *    o Directories are lists of entries in creation order (which is
+ *      what readdir walks), hashed by name for lookup. The hash table
+ *      grows with the directory.
  *
- *    o There is a maximum directory size limit
- *
- *    o There is a maximum number of files/directories limit
+ *    o Inodes are kept in a hash table by number, and numbers are never
+ *      reused.
  */
 
 #include "mm/mm.h"
@@ -25,6 +29,12 @@
 #include "fs/dirent.h"
 #include "util/debug.h"
 #include "mm/kmalloc.h"
+#include "mm/mmobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+#include "util/init.h"
+#include "util/list.h"
 
 #include "fs/ramfs/ramfs.h"
 
@@ -48,6 +58,7 @@ static fs_ops_t ramfs_ops = {
  */
 static int ramfs_read(vnode_t *file, off_t offset, void *buf, size_t count);
 static int ramfs_write(vnode_t *file, off_t offset, const void *buf, size_t count);
+static int ramfs_mmap(vnode_t *file, struct vmarea *vma, mmobj_t **ret);
 /* getpage */
 static int ramfs_create(vnode_t *dir, const char *name, size_t name_len,
                         vnode_t **result);
@@ -61,6 +72,7 @@ static int ramfs_unlink(vnode_t *dir, const char *name, size_t name_len);
 static int ramfs_mkdir(vnode_t *dir, const char *name, size_t name_len);
 static int ramfs_rmdir(vnode_t *dir, const char *name, size_t name_len);
 static int ramfs_readdir(vnode_t *dir, off_t offset, struct dirent *d);
+static int ramfs_readdirs(vnode_t *dir, off_t offset, struct dirent *d, int count);
 static int ramfs_stat(vnode_t *file, struct stat *buf);
 
 static vnode_ops_t ramfs_dir_vops = {
@@ -75,6 +87,7 @@ static vnode_ops_t ramfs_dir_vops = {
         .mkdir = ramfs_mkdir,
         .rmdir = ramfs_rmdir,
         .readdir = ramfs_readdir,
+        .readdirs = ramfs_readdirs,
         .stat = ramfs_stat,
         .acquire = NULL,
         .release = NULL,
@@ -86,7 +99,7 @@ static vnode_ops_t ramfs_dir_vops = {
 static vnode_ops_t ramfs_file_vops = {
         .read = ramfs_read,
         .write = ramfs_write,
-        .mmap = NULL,
+        .mmap = ramfs_mmap,
         .create = NULL,
         .mknod = NULL,
         .lookup = NULL,
@@ -108,9 +121,22 @@ static vnode_ops_t ramfs_file_vops = {
 typedef struct ramfs_inode {
         off_t     rf_size;       /* Total file size */
         ino_t     rf_ino;        /* Inode number */
-        char     *rf_mem;        /* Memory for this file (1 page) */
         int       rf_mode;       /* Type of file */
         int       rf_linkcount;  /* Number of links to this file */
+        devid_t   rf_devid;      /* For device special files */
+        int       rf_dead;       /* Freed, but for its mapped pages */
+
+        mmobj_t   rf_mmobj;      /* Pages of a regular file */
+
+        /* Entries of a directory, in order of creation, and hashed by
+         * name; rf_nextpos is the readdir offset of the next one */
+        list_t    rf_dirents;
+        list_t   *rf_dirhash;
+        uint32_t  rf_dirhash_nbuckets;
+        uint32_t  rf_ndirents;
+        off_t     rf_nextpos;
+
+        list_link_t rf_hlink;    /* link on rfs_ihash chain */
 } ramfs_inode_t;
 
 #define RAMFS_TYPE_DATA   0
@@ -122,69 +148,319 @@ typedef struct ramfs_inode {
         ((ramfs_inode_t *)(vn)->vn_i)
 #define VNODE_TO_RAMFS(vn) \
         ((ramfs_t *)(vn)->vn_fs->fs_i)
-#define VNODE_TO_DIRENT(vn) \
-        ((ramfs_dirent_t *)VNODE_TO_RAMFSINODE(vn)->rf_mem)
+#define MMOBJ_TO_RAMFSINODE(o) \
+        (CONTAINER_OF((o), ramfs_inode_t, rf_mmobj))
 
 /*
  * ramfs filesystem structure
  */
-#define RAMFS_MAX_FILES   64
+#define RAMFS_IHASH_NBUCKETS    64
 
 typedef struct ramfs {
-        ramfs_inode_t *rfs_inodes[RAMFS_MAX_FILES];  /* Array of all files */
+        list_t    rfs_ihash[RAMFS_IHASH_NBUCKETS];  /* All inodes, by number */
+        ino_t     rfs_nextino;
 } ramfs_t;
 
 /*
- * For directories, we simply store an array of (ino, name) pairs in the
- * memory portion of the inode.
+ * A directory entry. rd_pos is the entry's readdir offset, which stays
+ * the same while other entries come and go.
  */
 typedef struct ramfs_dirent {
-        int             rd_ino;   /* Inode number of this entry */
+        ino_t           rd_ino;   /* Inode number of this entry */
+        off_t           rd_pos;
         char            rd_name[NAME_LEN];   /* Name of this entry */
+        list_link_t     rd_link;  /* link on rf_dirents */
+        list_link_t     rd_hlink; /* link on rf_dirhash chain */
 } ramfs_dirent_t;
 
-#define RAMFS_MAX_DIRENT  ((off_t)(PAGE_SIZE/sizeof(ramfs_dirent_t)))
+/* A directory's hash table starts with RAMFS_DIRHASH_MIN buckets and
+ * doubles whenever it averages RAMFS_DIRHASH_LOAD entries per bucket */
+#define RAMFS_DIRHASH_MIN   8
+#define RAMFS_DIRHASH_LOAD  2
+
+/* What each entry adds to a directory's size */
+#define RAMFS_DIRENT_SIZE   ((off_t) sizeof(ramfs_dirent_t))
+
+static slab_allocator_t *ramfs_inode_allocator;
+static slab_allocator_t *ramfs_dirent_allocator;
+
+static __attribute__((unused)) void
+ramfs_init(void)
+{
+        ramfs_inode_allocator = slab_allocator_create("ramfs_inode", sizeof(ramfs_inode_t));
+        KASSERT(NULL != ramfs_inode_allocator);
+        ramfs_dirent_allocator = slab_allocator_create("ramfs_dirent", sizeof(ramfs_dirent_t));
+        KASSERT(NULL != ramfs_dirent_allocator);
+}
+init_func(ramfs_init);
+
+/*
+ * The mmobj holding a regular file's pages. References are only taken
+ * by its own resident pages and by mappings of it (see ramfs_mmap); the
+ * inode frees the pages itself when it goes away.
+ */
+static void ramfs_mmobj_ref(mmobj_t *o);
+static void ramfs_mmobj_put(mmobj_t *o);
+static int  ramfs_mmobj_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf);
+static int  ramfs_mmobj_fillpage(mmobj_t *o, pframe_t *pf);
+static int  ramfs_mmobj_dirtypage(mmobj_t *o, pframe_t *pf);
+static int  ramfs_mmobj_cleanpage(mmobj_t *o, pframe_t *pf);
+
+static mmobj_ops_t ramfs_mmobj_ops = {
+        .ref = ramfs_mmobj_ref,
+        .put = ramfs_mmobj_put,
+        .lookuppage = ramfs_mmobj_lookuppage,
+        .fillpage = ramfs_mmobj_fillpage,
+        .dirtypage = ramfs_mmobj_dirtypage,
+        .cleanpage = ramfs_mmobj_cleanpage
+};
+
+static void
+ramfs_mmobj_ref(mmobj_t *o)
+{
+        o->mmo_refcount++;
+}
+
+static void ramfs_destroy_inode(ramfs_inode_t *inode);
+
+static void
+ramfs_mmobj_put(mmobj_t *o)
+{
+        ramfs_inode_t *inode = MMOBJ_TO_RAMFSINODE(o);
+
+        KASSERT(0 < o->mmo_refcount);
+        o->mmo_refcount--;
+
+        /* the last mapping of a deleted file is gone */
+        if (inode->rf_dead && o->mmo_refcount == o->mmo_nrespages)
+                ramfs_destroy_inode(inode);
+}
+
+/* Every page looked up is about to hold data, so it is pinned (once) */
+static int
+ramfs_mmobj_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
+{
+        int ret;
+
+        if (0 > (ret = pframe_get(o, pagenum, pf)))
+                return ret;
+        if (!pframe_is_pinned(*pf))
+                pframe_pin(*pf);
+        return 0;
+}
+
+static int
+ramfs_mmobj_fillpage(mmobj_t *o, pframe_t *pf)
+{
+        page_zero(pf->pf_addr);
+        return 0;
+}
+
+static int
+ramfs_mmobj_dirtypage(mmobj_t *o, pframe_t *pf)
+{
+        return 0;
+}
+
+/* There is nowhere to write the page to */
+static int
+ramfs_mmobj_cleanpage(mmobj_t *o, pframe_t *pf)
+{
+        return 0;
+}
+
+/* Frees the pages of a file from page 'first' on */
+static void
+ramfs_free_pages(ramfs_inode_t *inode, uint32_t first)
+{
+        pframe_t *pf;
+
+        list_iterate_begin(&inode->rf_mmobj.mmo_respages, pf, pframe_t, pf_olink) {
+                if (pf->pf_pagenum < first)
+                        continue;
+                if (pframe_is_pinned(pf))
+                        pframe_unpin(pf);
+                pframe_free(pf);
+        } list_iterate_end();
+}
 
 /* Helper functions */
+static list_t *
+ramfs_ihash(ramfs_t *rfs, ino_t ino)
+{
+        return &rfs->rfs_ihash[ino % RAMFS_IHASH_NBUCKETS];
+}
+
+static ramfs_inode_t *
+ramfs_find_inode(ramfs_t *rfs, ino_t ino)
+{
+        ramfs_inode_t *inode;
+
+        list_iterate_begin(ramfs_ihash(rfs, ino), inode, ramfs_inode_t, rf_hlink) {
+                if (inode->rf_ino == ino)
+                        return inode;
+        } list_iterate_end();
+        return NULL;
+}
+
 static int
 ramfs_alloc_inode(fs_t *fs, int type, devid_t devid)
 {
         ramfs_t *rfs = (ramfs_t *) fs->fs_i;
+        ramfs_inode_t *inode;
+        uint32_t i;
+
         KASSERT((RAMFS_TYPE_DATA == type)
                 || (RAMFS_TYPE_DIR == type)
                 || (RAMFS_TYPE_CHR == type)
                 || (RAMFS_TYPE_BLK == type));
-        /* Find a free inode */
-        int i;
-        for (i = 0; i < RAMFS_MAX_FILES; i++) {
-                if (NULL == rfs->rfs_inodes[i]) {
-                        ramfs_inode_t *inode;
-                        if (NULL == (inode = kmalloc(sizeof(ramfs_inode_t)))) {
-                                return -ENOSPC;
-                        }
-
-                        if (RAMFS_TYPE_CHR == type || RAMFS_TYPE_BLK == type) {
-                                /* Don't need any space in memory, so put devid in here */
-                                inode->rf_mem = (char *) devid;
-                        } else {
-                                /* We allocate space for the file's contents immediately */
-                                if (NULL == (inode->rf_mem = page_alloc())) {
-                                        kfree(inode);
-                                        return -ENOSPC;
-                                }
-                                memset(inode->rf_mem, 0, PAGE_SIZE);
-                        }
-                        inode->rf_size = 0;
-                        inode->rf_ino = i;
-                        inode->rf_mode = type;
-                        inode->rf_linkcount = 1;
-
-                        /* Install in table and return */
-                        rfs->rfs_inodes[i] = inode;
-                        return i;
+
+        if (NULL == (inode = slab_obj_alloc(ramfs_inode_allocator)))
+                return -ENOSPC;
+
+        list_init(&inode->rf_dirents);
+        inode->rf_dirhash = NULL;
+        inode->rf_dirhash_nbuckets = 0;
+        if (RAMFS_TYPE_DIR == type) {
+                inode->rf_dirhash = kmalloc(RAMFS_DIRHASH_MIN * sizeof(list_t));
+                if (NULL == inode->rf_dirhash) {
+                        slab_obj_free(ramfs_inode_allocator, inode);
+                        return -ENOSPC;
                 }
+                inode->rf_dirhash_nbuckets = RAMFS_DIRHASH_MIN;
+                for (i = 0; i < RAMFS_DIRHASH_MIN; i++)
+                        list_init(&inode->rf_dirhash[i]);
         }
-        return -ENOSPC;
+        inode->rf_ndirents = 0;
+        inode->rf_nextpos = 0;
+        inode->rf_dead = 0;
+
+        mmobj_init(&inode->rf_mmobj, &ramfs_mmobj_ops);
+        inode->rf_devid = (RAMFS_TYPE_CHR == type || RAMFS_TYPE_BLK == type) ? devid : 0;
+        inode->rf_size = 0;
+        inode->rf_ino = rfs->rfs_nextino++;
+        inode->rf_mode = type;
+        inode->rf_linkcount = 1;
+
+        /* Install in table and return */
+        list_insert_head(ramfs_ihash(rfs, inode->rf_ino), &inode->rf_hlink);
+        return inode->rf_ino;
+}
+
+static void
+ramfs_free_inode(ramfs_inode_t *inode)
+{
+        ramfs_dirent_t *entry;
+
+        list_iterate_begin(&inode->rf_dirents, entry, ramfs_dirent_t, rd_link) {
+                list_remove(&entry->rd_link);
+                slab_obj_free(ramfs_dirent_allocator, entry);
+        } list_iterate_end();
+        if (NULL != inode->rf_dirhash)
+                kfree(inode->rf_dirhash);
+
+        list_remove(&inode->rf_hlink);
+
+        /* a mapping still uses the pages, see ramfs_mmobj_put */
+        if (inode->rf_mmobj.mmo_refcount > inode->rf_mmobj.mmo_nrespages) {
+                inode->rf_dead = 1;
+                return;
+        }
+        ramfs_destroy_inode(inode);
+}
+
+static void
+ramfs_destroy_inode(ramfs_inode_t *inode)
+{
+        inode->rf_dead = 0;
+        ramfs_free_pages(inode, 0);
+        KASSERT(0 == inode->rf_mmobj.mmo_nrespages);
+        KASSERT(0 == inode->rf_mmobj.mmo_refcount);
+        slab_obj_free(ramfs_inode_allocator, inode);
+}
+
+static uint32_t
+ramfs_name_hash(const char *name, size_t namelen)
+{
+        uint32_t h = 0;
+        size_t i;
+
+        for (i = 0; i < namelen; i++)
+                h = h * 31 + (unsigned char) name[i];
+        return h * 0x9e3779b1U;
+}
+
+static ramfs_dirent_t *
+ramfs_dir_find(ramfs_inode_t *dir, const char *name, size_t namelen)
+{
+        list_t *bucket = &dir->rf_dirhash[ramfs_name_hash(name, namelen)
+                                          % dir->rf_dirhash_nbuckets];
+        ramfs_dirent_t *entry;
+
+        list_iterate_begin(bucket, entry, ramfs_dirent_t, rd_hlink) {
+                if (name_match(entry->rd_name, name, namelen))
+                        return entry;
+        } list_iterate_end();
+        return NULL;
+}
+
+/* Doubles the number of hash buckets of a directory, if memory allows */
+static void
+ramfs_dir_grow(ramfs_inode_t *dir)
+{
+        uint32_t n = dir->rf_dirhash_nbuckets << 1;
+        ramfs_dirent_t *entry;
+        list_t *hash;
+        uint32_t i;
+
+        if (NULL == (hash = kmalloc(n * sizeof(list_t))))
+                return;
+        for (i = 0; i < n; i++)
+                list_init(&hash[i]);
+        list_iterate_begin(&dir->rf_dirents, entry, ramfs_dirent_t, rd_link) {
+                list_remove(&entry->rd_hlink);
+                list_insert_head(&hash[ramfs_name_hash(entry->rd_name, strlen(entry->rd_name)) % n],
+                                 &entry->rd_hlink);
+        } list_iterate_end();
+
+        kfree(dir->rf_dirhash);
+        dir->rf_dirhash = hash;
+        dir->rf_dirhash_nbuckets = n;
+}
+
+static int
+ramfs_dir_add(ramfs_inode_t *dir, const char *name, size_t name_len, ino_t ino)
+{
+        ramfs_dirent_t *entry;
+        size_t len = MIN(name_len, NAME_LEN - 1);
+
+        if (NULL == (entry = slab_obj_alloc(ramfs_dirent_allocator)))
+                return -ENOSPC;
+
+        entry->rd_ino = ino;
+        entry->rd_pos = dir->rf_nextpos++;
+        strncpy(entry->rd_name, name, len);
+        entry->rd_name[len] = '\0';
+        list_insert_tail(&dir->rf_dirents, &entry->rd_link);
+        list_insert_head(&dir->rf_dirhash[ramfs_name_hash(entry->rd_name, len)
+                                          % dir->rf_dirhash_nbuckets],
+                         &entry->rd_hlink);
+
+        dir->rf_ndirents++;
+        dir->rf_size += RAMFS_DIRENT_SIZE;
+        if (dir->rf_ndirents > RAMFS_DIRHASH_LOAD * dir->rf_dirhash_nbuckets)
+                ramfs_dir_grow(dir);
+        return 0;
+}
+
+static void
+ramfs_dir_remove(ramfs_inode_t *dir, ramfs_dirent_t *entry)
+{
+        list_remove(&entry->rd_link);
+        list_remove(&entry->rd_hlink);
+        slab_obj_free(ramfs_dirent_allocator, entry);
+        dir->rf_ndirents--;
+        dir->rf_size -= RAMFS_DIRENT_SIZE;
 }
 
 /*
@@ -194,13 +470,16 @@ ramfs_alloc_inode(fs_t *fs, int type, devid_t devid)
 int
 ramfs_mount(struct fs *fs)
 {
+        int i;
 
         /* Allocate filesystem */
         ramfs_t *rfs = kmalloc(sizeof(ramfs_t));
         if (NULL == rfs)
                 return -ENOMEM;
 
-        memset(rfs->rfs_inodes, 0, sizeof(rfs->rfs_inodes));
+        for (i = 0; i < RAMFS_IHASH_NBUCKETS; i++)
+                list_init(&rfs->rfs_ihash[i]);
+        rfs->rfs_nextino = 0;
 
         fs->fs_i = rfs;
         fs->fs_op = &ramfs_ops;
@@ -208,24 +487,18 @@ ramfs_mount(struct fs *fs)
         /* Set up root inode */
         int root_ino;
         if (0 > (root_ino = ramfs_alloc_inode(fs, RAMFS_TYPE_DIR, 0))) {
+                kfree(rfs);
                 return root_ino;
         }
         KASSERT(0 == root_ino);
-        ramfs_inode_t *root = rfs->rfs_inodes[root_ino];
+        ramfs_inode_t *root = ramfs_find_inode(rfs, root_ino);
 
         /* Set up '.' and '..' in the root directory */
-        ramfs_dirent_t *rootdent = (ramfs_dirent_t *) root->rf_mem;
-        rootdent->rd_ino = 0;
-        strcpy(rootdent->rd_name, ".");
-        rootdent++;
-        rootdent->rd_ino = 0;
-        strcpy(rootdent->rd_name, "..");
-
-        /* Increase root inode size accordingly */
-        root->rf_size = 2 * sizeof(ramfs_dirent_t);
-
-        /* Put the root in the inode table */
-        rfs->rfs_inodes[0] = root;
+        if (0 > ramfs_dir_add(root, ".", 1, 0) || 0 > ramfs_dir_add(root, "..", 2, 0)) {
+                ramfs_free_inode(root);
+                kfree(rfs);
+                return -ENOMEM;
+        }
 
         /* And vget the root vnode */
         fs->fs_root = vget(fs, 0);
@@ -237,7 +510,7 @@ static void
 ramfs_read_vnode(vnode_t *vn)
 {
         ramfs_t *rfs = VNODE_TO_RAMFS(vn);
-        ramfs_inode_t *inode = rfs->rfs_inodes[vn->vn_vno];
+        ramfs_inode_t *inode = ramfs_find_inode(rfs, vn->vn_vno);
         KASSERT(inode && inode->rf_ino == vn->vn_vno);
 
         inode->rf_linkcount++;
@@ -257,12 +530,12 @@ ramfs_read_vnode(vnode_t *vn)
                 case RAMFS_TYPE_CHR:
                         vn->vn_mode = S_IFCHR;
                         vn->vn_ops = NULL;
-                        vn->vn_devid = (devid_t)(inode->rf_mem);
+                        vn->vn_devid = inode->rf_devid;
                         break;
                 case RAMFS_TYPE_BLK:
                         vn->vn_mode = S_IFBLK;
                         vn->vn_ops = NULL;
-                        vn->vn_devid = (devid_t)(inode->rf_mem);
+                        vn->vn_devid = inode->rf_devid;
                         break;
                 default:
                         panic("inode %d has unknown/invalid type %d!!\n",
@@ -274,19 +547,10 @@ static void
 ramfs_delete_vnode(vnode_t *vn)
 {
         ramfs_inode_t *inode = VNODE_TO_RAMFSINODE(vn);
-        ramfs_t *rfs = VNODE_TO_RAMFS(vn);
 
         if (0 == --inode->rf_linkcount) {
-                KASSERT(rfs->rfs_inodes[vn->vn_vno] == inode);
-
-                rfs->rfs_inodes[vn->vn_vno] = NULL;
-                if (inode->rf_mode == RAMFS_TYPE_DATA
-                    || inode->rf_mode == RAMFS_TYPE_DIR) {
-                        page_free(inode->rf_mem);
-                }
-                /* otherwise, inode->rf_mem is a devid */
-
-                kfree(inode);
+                KASSERT(ramfs_find_inode(VNODE_TO_RAMFS(vn), vn->vn_vno) == inode);
+                ramfs_free_inode(inode);
         }
 }
 
@@ -302,21 +566,18 @@ ramfs_umount(fs_t *fs)
         /* We don't need to do any flushing or anything as everything is in memory.
          * Just free all of our allocated memory */
         ramfs_t *rfs = (ramfs_t *) fs->fs_i;
+        ramfs_inode_t *inode;
+        int i;
 
         vput(fs->fs_root);
 
         /* Free all the inodes */
-        int i;
-        for (i = 0; i < RAMFS_MAX_FILES; i++) {
-                if (NULL != rfs->rfs_inodes[i]) {
-                        if (NULL != rfs->rfs_inodes[i]->rf_mem
-                            && (rfs->rfs_inodes[i]->rf_mode == RAMFS_TYPE_DATA
-                                || rfs->rfs_inodes[i]->rf_mode == RAMFS_TYPE_DIR)) {
-                                page_free(rfs->rfs_inodes[i]->rf_mem);
-                        }
-                        kfree(rfs->rfs_inodes[i]);
-                }
+        for (i = 0; i < RAMFS_IHASH_NBUCKETS; i++) {
+                list_iterate_begin(&rfs->rfs_ihash[i], inode, ramfs_inode_t, rf_hlink) {
+                        ramfs_free_inode(inode);
+                } list_iterate_end();
         }
+        kfree(rfs);
 
         return 0;
 }
@@ -325,37 +586,24 @@ static int
 ramfs_create(vnode_t *dir, const char *name, size_t name_len, vnode_t **result)
 {
         vnode_t *vn;
-        off_t i;
-        ramfs_dirent_t *entry;
+        int ino, ret;
 
         KASSERT(0 != ramfs_lookup(dir, name, name_len, &vn));
 
-        /* Look for space in the directory */
-        entry = VNODE_TO_DIRENT(dir);
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (!entry->rd_name[0])
-                        break;
-        }
-
-        if (i == RAMFS_MAX_DIRENT) {
-                return -ENOSPC;
-        }
-
         /* Allocate an inode */
-        int ino;
         if (0 > (ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_DATA, 0))) {
                 return ino;
         }
 
-        /* Get a vnode, set entry in directory */
-        vn = vget(dir->vn_fs, (ino_t) ino);
-
-        entry->rd_ino = vn->vn_vno;
-        strncpy(entry->rd_name, name, MIN(name_len, NAME_LEN - 1));
-        entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
-
-        VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
+        /* Set entry in directory */
+        if (0 > (ret = ramfs_dir_add(VNODE_TO_RAMFSINODE(dir), name, name_len, ino))) {
+                ramfs_free_inode(ramfs_find_inode(VNODE_TO_RAMFS(dir), ino));
+                return ret;
+        }
+        dir->vn_len = VNODE_TO_RAMFSINODE(dir)->rf_size;
 
+        /* Get a vnode */
+        vn = vget(dir->vn_fs, (ino_t) ino);
         *result = vn;
 
         return 0;
@@ -366,23 +614,10 @@ static int
 ramfs_mknod(struct vnode *dir, const char *name, size_t name_len, int mode, devid_t devid)
 {
         vnode_t *vn;
-        off_t i;
-        ramfs_dirent_t *entry;
+        int ino, ret;
 
         KASSERT(0 != ramfs_lookup(dir, name, name_len, &vn));
 
-        /* Look for space in the directory */
-        entry = VNODE_TO_DIRENT(dir);
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (!entry->rd_name[0])
-                        break;
-        }
-
-        if (i == RAMFS_MAX_DIRENT) {
-                return -ENOSPC;
-        }
-
-        int ino;
         if (S_ISCHR(mode)) {
                 if (0 > (ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_CHR, devid))) {
                         return ino;
@@ -396,11 +631,11 @@ ramfs_mknod(struct vnode *dir, const char *name, size_t name_len, int mode, devi
         }
 
         /* Set entry in directory */
-        entry->rd_ino = ino;
-        strncpy(entry->rd_name, name, MIN(name_len, NAME_LEN - 1));
-        entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
-
-        VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
+        if (0 > (ret = ramfs_dir_add(VNODE_TO_RAMFSINODE(dir), name, name_len, ino))) {
+                ramfs_free_inode(ramfs_find_inode(VNODE_TO_RAMFS(dir), ino));
+                return ret;
+        }
+        dir->vn_len = VNODE_TO_RAMFSINODE(dir)->rf_size;
 
         return 0;
 }
@@ -408,18 +643,13 @@ ramfs_mknod(struct vnode *dir, const char *name, size_t name_len, int mode, devi
 static int
 ramfs_lookup(vnode_t *dir, const char *name, size_t namelen, vnode_t **result)
 {
-        off_t i;
-        ramfs_inode_t *inode = VNODE_TO_RAMFSINODE(dir);
-        ramfs_dirent_t *entry = (ramfs_dirent_t *)inode->rf_mem;
+        ramfs_dirent_t *entry;
 
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (name_match(entry->rd_name, name, namelen)) {
-                        *result = vget(dir->vn_fs, entry->rd_ino);
-                        return 0;
-                }
-        }
+        if (NULL == (entry = ramfs_dir_find(VNODE_TO_RAMFSINODE(dir), name, namelen)))
+                return -ENOENT;
 
-        return -ENOENT;
+        *result = vget(dir->vn_fs, entry->rd_ino);
+        return 0;
 }
 
 static int
@@ -427,29 +657,16 @@ ramfs_link(vnode_t *oldvnode, vnode_t *dir,
            const char *name, size_t name_len)
 {
         vnode_t *vn;
-        off_t i;
-        ramfs_dirent_t *entry;
+        int ret;
 
         KASSERT(oldvnode->vn_fs == dir->vn_fs);
         KASSERT(0 != ramfs_lookup(dir, name, name_len, &vn));
 
-        /* Look for space in the directory */
-        entry = VNODE_TO_DIRENT(dir);
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (!entry->rd_name[0])
-                        break;
-        }
-
-        if (i == RAMFS_MAX_DIRENT) {
-                return -ENOSPC;
-        }
-
         /* Set entry in parent */
-        entry->rd_ino = oldvnode->vn_vno;
-        strncpy(entry->rd_name, name, MIN(name_len, NAME_LEN - 1));
-        entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
-
-        VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
+        if (0 > (ret = ramfs_dir_add(VNODE_TO_RAMFSINODE(dir), name, name_len,
+                                     oldvnode->vn_vno)))
+                return ret;
+        dir->vn_len = VNODE_TO_RAMFSINODE(dir)->rf_size;
 
         /* Increase linkcount */
         VNODE_TO_RAMFSINODE(oldvnode)->rf_linkcount++;
@@ -461,7 +678,6 @@ ramfs_unlink(vnode_t *dir, const char *name, size_t namelen)
 {
         vnode_t *vn;
         int ret;
-        off_t i;
         ramfs_dirent_t *entry;
 
         ret = ramfs_lookup(dir, name, namelen, &vn);
@@ -469,15 +685,10 @@ ramfs_unlink(vnode_t *dir, const char *name, size_t namelen)
         KASSERT(!S_ISDIR(vn->vn_mode));
 
         /* And then remove the entry from the directory */
-        entry = VNODE_TO_DIRENT(dir);
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (name_match(entry->rd_name, name, namelen)) {
-                        entry->rd_name[0] = '\0';
-                        break;
-                }
-        }
-
-        VNODE_TO_RAMFSINODE(dir)->rf_size -= sizeof(ramfs_dirent_t);
+        entry = ramfs_dir_find(VNODE_TO_RAMFSINODE(dir), name, namelen);
+        KASSERT(NULL != entry);
+        ramfs_dir_remove(VNODE_TO_RAMFSINODE(dir), entry);
+        dir->vn_len = VNODE_TO_RAMFSINODE(dir)->rf_size;
 
         VNODE_TO_RAMFSINODE(vn)->rf_linkcount--;
         vput(vn);
@@ -489,45 +700,26 @@ static int
 ramfs_mkdir(vnode_t *dir, const char *name, size_t name_len)
 {
         vnode_t *vn;
-        off_t i;
-        ramfs_dirent_t *entry;
+        ramfs_inode_t *inode;
+        int ino, ret;
 
         KASSERT(0 != ramfs_lookup(dir, name, name_len, &vn));
 
-        /* Look for space in the directory */
-        entry = VNODE_TO_DIRENT(dir);
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (!entry->rd_name[0])
-                        break;
-        }
-
-        if (i == RAMFS_MAX_DIRENT) {
-                return -ENOSPC;
-        }
-
         /* Allocate an inode */
-        int ino;
         if (0 > (ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_DIR, 0))) {
                 return ino;
         }
-
-        /* Set entry in parent */
-        entry->rd_ino = ino;
-        strncpy(entry->rd_name, name, MIN(name_len, NAME_LEN - 1));
-        entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
-
-        VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
-
-        /* Set up '.' and '..' in the directory */
-        entry = (ramfs_dirent_t *) VNODE_TO_RAMFS(dir)->rfs_inodes[ino]->rf_mem;
-        entry->rd_ino = ino;
-        strcpy(entry->rd_name, ".");
-        entry++;
-        entry->rd_ino = dir->vn_vno;
-        strcpy(entry->rd_name, "..");
-
-        /* Increase inode size accordingly */
-        VNODE_TO_RAMFS(dir)->rfs_inodes[ino]->rf_size = 2 * sizeof(ramfs_dirent_t);
+        inode = ramfs_find_inode(VNODE_TO_RAMFS(dir), ino);
+
+        /* Set up '.' and '..' in the directory, then the entry in the
+         * parent */
+        if (0 > (ret = ramfs_dir_add(inode, ".", 1, ino))
+            || 0 > (ret = ramfs_dir_add(inode, "..", 2, dir->vn_vno))
+            || 0 > (ret = ramfs_dir_add(VNODE_TO_RAMFSINODE(dir), name, name_len, ino))) {
+                ramfs_free_inode(inode);
+                return ret;
+        }
+        dir->vn_len = VNODE_TO_RAMFSINODE(dir)->rf_size;
 
         return 0;
 }
@@ -537,7 +729,6 @@ ramfs_rmdir(vnode_t *dir, const char *name, size_t name_len)
 {
         vnode_t *vn;
         int ret;
-        off_t i;
         ramfs_dirent_t *entry;
 
         KASSERT(!name_match(".", name, name_len) &&
@@ -551,28 +742,18 @@ ramfs_rmdir(vnode_t *dir, const char *name, size_t name_len)
                 return -ENOTDIR;
         }
 
-        /* We have to make sure that this directory is empty */
-        entry = VNODE_TO_DIRENT(vn);
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (!strcmp(entry->rd_name, ".") ||
-                    !strcmp(entry->rd_name, ".."))
-                        continue;
-
-                if (entry->rd_name[0]) {
-                        vput(vn);
-                        return -ENOTEMPTY;
-                }
+        /* We have to make sure that this directory is empty (but for '.'
+         * and '..') */
+        if (2 < VNODE_TO_RAMFSINODE(vn)->rf_ndirents) {
+                vput(vn);
+                return -ENOTEMPTY;
         }
 
         /* Finally, remove the entry from the parent directory */
-        entry = VNODE_TO_DIRENT(dir);
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (name_match(entry->rd_name, name, name_len)) {
-                        entry->rd_name[0] = '\0';
-                        break;
-                }
-        }
-        VNODE_TO_RAMFSINODE(dir)->rf_size -= sizeof(ramfs_dirent_t);
+        entry = ramfs_dir_find(VNODE_TO_RAMFSINODE(dir), name, name_len);
+        KASSERT(NULL != entry);
+        ramfs_dir_remove(VNODE_TO_RAMFSINODE(dir), entry);
+        dir->vn_len = VNODE_TO_RAMFSINODE(dir)->rf_size;
 
         VNODE_TO_RAMFSINODE(vn)->rf_linkcount--;
         vput(vn);
@@ -583,63 +764,115 @@ ramfs_rmdir(vnode_t *dir, const char *name, size_t name_len)
 static int
 ramfs_read(vnode_t *file, off_t offset, void *buf, size_t count)
 {
-        int ret;
         ramfs_inode_t *inode = VNODE_TO_RAMFSINODE(file);
+        off_t end, pos, n;
+        pframe_t *pf;
 
         KASSERT(!S_ISDIR(file->vn_mode));
 
-        ret = MAX(0, MIN((off_t)count, inode->rf_size - offset));
-        memcpy(buf, inode->rf_mem + offset, ret);
+        end = MIN(offset + (off_t) count, inode->rf_size);
+        for (pos = offset; pos < end; pos += n) {
+                n = MIN(end - pos, (off_t)(PAGE_SIZE - PAGE_OFFSET(pos)));
+
+                /* data pages are pinned, so a page not in core is a hole */
+                pf = pframe_get_resident(&inode->rf_mmobj, ADDR_TO_PN(pos));
+                if (NULL == pf)
+                        memset((char *) buf + (pos - offset), 0, n);
+                else
+                        memcpy((char *) buf + (pos - offset),
+                               (char *) pf->pf_addr + PAGE_OFFSET(pos), n);
+        }
 
-        return ret;
+        return MAX(0, end - offset);
 }
 
 static int
 ramfs_write(vnode_t *file, off_t offset, const void *buf, size_t count)
 {
-        int ret;
         ramfs_inode_t *inode = VNODE_TO_RAMFSINODE(file);
+        off_t end = offset + (off_t) count;
+        off_t pos, n;
+        pframe_t *pf;
+        int ret;
 
         KASSERT(!S_ISDIR(file->vn_mode));
 
-        ret = MIN((off_t)count, (off_t)PAGE_SIZE - offset);
-        memcpy(inode->rf_mem + offset, buf, ret);
+        for (pos = offset; pos < end; pos += n) {
+                n = MIN(end - pos, (off_t)(PAGE_SIZE - PAGE_OFFSET(pos)));
+
+                ret = pframe_lookup(&inode->rf_mmobj, ADDR_TO_PN(pos), 1, &pf);
+                if (0 > ret) {
+                        if (pos == offset)
+                                return ret;
+                        break;
+                }
+                memcpy((char *) pf->pf_addr + PAGE_OFFSET(pos),
+                       (const char *) buf + (pos - offset), n);
+        }
 
         KASSERT(file->vn_len == inode->rf_size);
-        file->vn_len = MAX(file->vn_len, offset + ret);
+        file->vn_len = MAX(file->vn_len, pos);
         inode->rf_size = file->vn_len;
 
-        return ret;
+        return pos - offset;
+}
+
+/* A mapping of the file uses its pages directly, so it sees (and makes)
+ * the same changes as read and write */
+static int
+ramfs_mmap(vnode_t *file, struct vmarea *vma, mmobj_t **ret)
+{
+        mmobj_t *o = &VNODE_TO_RAMFSINODE(file)->rf_mmobj;
+
+        o->mmo_ops->ref(o);
+        *ret = o;
+        return 0;
 }
 
 static int
 ramfs_readdir(vnode_t *dir, off_t offset, struct dirent *d)
 {
-        int ret = 0;
-        ramfs_dirent_t *dir_entry, *targ_entry;
+        ramfs_dirent_t *entry;
 
         KASSERT(S_ISDIR(dir->vn_mode));
-        KASSERT(0 == offset % sizeof(ramfs_dirent_t));
 
-        dir_entry = VNODE_TO_DIRENT(dir);
-        dir_entry = (ramfs_dirent_t *)(((char *)dir_entry) + offset);
-        targ_entry = dir_entry;
+        list_iterate_begin(&VNODE_TO_RAMFSINODE(dir)->rf_dirents, entry,
+                           ramfs_dirent_t, rd_link) {
+                if (entry->rd_pos < offset)
+                        continue;
 
-        while ((offset < (off_t)(RAMFS_MAX_DIRENT * sizeof(ramfs_dirent_t))) && (!targ_entry->rd_name[0])) {
-                ++targ_entry;
-                offset += sizeof(ramfs_dirent_t);
-        }
+                d->d_ino = entry->rd_ino;
+                d->d_off = 0; /* unused */
+                strncpy(d->d_name, entry->rd_name, NAME_LEN - 1);
+                d->d_name[NAME_LEN - 1] = '\0';
+                return entry->rd_pos + 1 - offset;
+        } list_iterate_end();
 
-        if (offset >= (off_t)(RAMFS_MAX_DIRENT * sizeof(ramfs_dirent_t)))
-                return 0;
+        return 0;
+}
 
-        ret = sizeof(ramfs_dirent_t) + (targ_entry - dir_entry) * sizeof(ramfs_dirent_t);
+static int
+ramfs_readdirs(vnode_t *dir, off_t offset, struct dirent *d, int count)
+{
+        ramfs_dirent_t *entry;
+        int n = 0;
+
+        KASSERT(S_ISDIR(dir->vn_mode));
+
+        list_iterate_begin(&VNODE_TO_RAMFSINODE(dir)->rf_dirents, entry,
+                           ramfs_dirent_t, rd_link) {
+                if (entry->rd_pos < offset)
+                        continue;
+
+                d[n].d_ino = entry->rd_ino;
+                d[n].d_off = entry->rd_pos + 1;
+                strncpy(d[n].d_name, entry->rd_name, NAME_LEN - 1);
+                d[n].d_name[NAME_LEN - 1] = '\0';
+                if (++n == count)
+                        break;
+        } list_iterate_end();
 
-        d->d_ino = targ_entry->rd_ino;
-        d->d_off = 0; /* unused */
-        strncpy(d->d_name, targ_entry->rd_name, NAME_LEN - 1);
-        d->d_name[NAME_LEN - 1] = '\0';
-        return ret;
+        return n;
 }
 
 static int
@@ -651,12 +884,12 @@ ramfs_stat(vnode_t *file, struct stat *buf)
         buf->st_ino     = (int) file->vn_vno;
         buf->st_dev     = 0;
         if (file->vn_mode == S_IFCHR || file->vn_mode == S_IFBLK) {
-                buf->st_rdev  = (int) i->rf_mem;
+                buf->st_rdev  = (int) i->rf_devid;
         }
         buf->st_nlink   = i->rf_linkcount - 1;
         buf->st_size    = (int) i->rf_size;
         buf->st_blksize = (int) PAGE_SIZE;
-        buf->st_blocks  = 1;
+        buf->st_blocks  = i->rf_mmobj.mmo_nrespages;
 
         return 0;
 }
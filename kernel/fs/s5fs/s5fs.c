@@ -14,9 +14,11 @@
 #include "util/debug.h"
 
 #include "proc/kmutex.h"
+#include "proc/krwlock.h"
 
 #include "fs/s5fs/s5fs_subr.h"
 #include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_journal.h"
 #include "fs/dirent.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
@@ -25,6 +27,7 @@
 
 #include "drivers/dev.h"
 #include "drivers/blockdev.h"
+#include "drivers/disk/blkqueue.h"
 
 #include "mm/kmalloc.h"
 #include "mm/pframe.h"
@@ -44,10 +47,13 @@ static void s5fs_read_vnode(vnode_t *vnode);
 static void s5fs_delete_vnode(vnode_t *vnode);
 static int  s5fs_query_vnode(vnode_t *vnode);
 static int  s5fs_umount(fs_t *fs);
+static int  s5fs_sync(fs_t *fs);
 
 /* vnode_t entry points: */
 static int  s5fs_read(vnode_t *vnode, off_t offset, void *buf, size_t len);
 static int  s5fs_write(vnode_t *vnode, off_t offset, const void *buf, size_t len);
+static int  s5fs_read_direct(vnode_t *vnode, off_t offset, void *buf, size_t len);
+static int  s5fs_write_direct(vnode_t *vnode, off_t offset, const void *buf, size_t len);
 static int  s5fs_mmap(vnode_t *file, vmarea_t *vma, mmobj_t **ret);
 static int  s5fs_create(vnode_t *vdir, const char *name, size_t namelen, vnode_t **result);
 static int  s5fs_mknod(struct vnode *dir, const char *name, size_t namelen, int mode, devid_t devid);
@@ -57,17 +63,22 @@ static int  s5fs_unlink(vnode_t *vdir, const char *name, size_t namelen);
 static int  s5fs_mkdir(vnode_t *vdir, const char *name, size_t namelen);
 static int  s5fs_rmdir(vnode_t *parent, const char *name, size_t namelen);
 static int  s5fs_readdir(vnode_t *vnode, int offset, struct dirent *d);
+static int  s5fs_readdirs(vnode_t *vnode, off_t offset, struct dirent *d, int count);
 static int  s5fs_stat(vnode_t *vnode, struct stat *ss);
 static int  s5fs_release(vnode_t *vnode, file_t *file);
+static int  s5fs_fsync(vnode_t *vnode, int datasync);
 static int  s5fs_fillpage(vnode_t *vnode, off_t offset, void *pagebuf);
+static int  s5fs_fillpages(vnode_t *vnode, off_t offset, void **pagebufs, int npages);
 static int  s5fs_dirtypage(vnode_t *vnode, off_t offset);
 static int  s5fs_cleanpage(vnode_t *vnode, off_t offset, void *pagebuf);
+static int  s5fs_cleanpages(vnode_t *vnode, off_t offset, void **pagebufs, int npages);
 
 fs_ops_t s5fs_fsops = {
         s5fs_read_vnode,
         s5fs_delete_vnode,
         s5fs_query_vnode,
-        s5fs_umount
+        s5fs_umount,
+        s5fs_sync
 };
 
 /* vnode operations table for directory files: */
@@ -83,12 +94,16 @@ static vnode_ops_t s5fs_dir_vops = {
         .mkdir = s5fs_mkdir,
         .rmdir = s5fs_rmdir,
         .readdir = s5fs_readdir,
+        .readdirs = s5fs_readdirs,
         .stat = s5fs_stat,
         .acquire = NULL,
         .release = NULL,
         .fillpage = s5fs_fillpage,
+        .fillpages = s5fs_fillpages,
         .dirtypage = s5fs_dirtypage,
-        .cleanpage = s5fs_cleanpage
+        .cleanpage = s5fs_cleanpage,
+        .cleanpages = s5fs_cleanpages,
+        .fsync = s5fs_fsync
 };
 
 /* vnode operations table for regular files: */
@@ -96,6 +111,8 @@ static vnode_ops_t s5fs_file_vops = {
         .read = s5fs_read,
         .write = s5fs_write,
         .mmap = s5fs_mmap,
+        .read_direct = s5fs_read_direct,
+        .write_direct = s5fs_write_direct,
         .create = NULL,
         .mknod = NULL,
         .lookup = NULL,
@@ -108,8 +125,11 @@ static vnode_ops_t s5fs_file_vops = {
         .acquire = NULL,
         .release = NULL,
         .fillpage = s5fs_fillpage,
+        .fillpages = s5fs_fillpages,
         .dirtypage = s5fs_dirtypage,
-        .cleanpage = s5fs_cleanpage
+        .cleanpage = s5fs_cleanpage,
+        .cleanpages = s5fs_cleanpages,
+        .fsync = s5fs_fsync
 };
 
 /*
@@ -124,18 +144,24 @@ static vnode_ops_t s5fs_file_vops = {
 int
 s5fs_mount(struct fs *fs)
 {
-        int num;
+        int num, err;
         blockdev_t *dev;
         s5fs_t *s5;
         pframe_t *vp;
 
         KASSERT(fs);
 
-        if (sscanf(fs->fs_dev, "disk%d", &num) != 1) {
+        if (sscanf(fs->fs_dev, "disk%d", &num) == 1) {
+                dev = blockdev_lookup(MKDEVID(DISK_MAJOR, num));
+        } else if (sscanf(fs->fs_dev, "ram%d", &num) == 1) {
+                dev = blockdev_lookup(MKDEVID(RAMDISK_MAJOR, num));
+        } else if (sscanf(fs->fs_dev, "md%d", &num) == 1) {
+                dev = blockdev_lookup(MKDEVID(STRIPE_MAJOR, num));
+        } else {
                 return -EINVAL;
         }
 
-        if (!(dev = blockdev_lookup(MKDEVID(1, num)))) {
+        if (!dev) {
                 return -EINVAL;
         }
 
@@ -147,6 +173,7 @@ s5fs_mount(struct fs *fs)
 
         /*     init s5f_disk: */
         s5->s5f_bdev  = dev;
+        pframe_register_blockdev(dev->bd_mmobj.mmo_ops);
 
         /*     init s5f_super: */
         pframe_get(S5FS_TO_VMOBJ(s5), S5_SUPER_BLOCK, &vp);
@@ -163,12 +190,34 @@ s5fs_mount(struct fs *fs)
 
         pframe_pin(vp);
 
-        /*     init s5f_mutex: */
-        kmutex_init(&s5->s5f_mutex);
+        /*     init s5f_block_mutex, s5f_inode_mutex, s5f_sync_mutex: */
+        kmutex_init(&s5->s5f_block_mutex);
+        kmutex_init(&s5->s5f_inode_mutex);
+        kmutex_init(&s5->s5f_sync_mutex);
 
         /*     init s5f_fs: */
         s5->s5f_fs = fs;
 
+        /*     init s5f_itable: */
+        list_init(&s5->s5f_itable);
+        s5->s5f_itable_nblocks = 0;
+
+        /*     init s5f_journal, replaying it (which may change the
+         *     superblock and free list) before anything is read: */
+        if (0 > (err = s5_journal_mount(s5))) {
+                pframe_unpin(vp);
+                kfree(s5);
+                return err;
+        }
+        if (s5_check_super(s5->s5f_super)) {
+                s5_journal_umount(s5);
+                pframe_unpin(vp);
+                kfree(s5);
+                return -EINVAL;
+        }
+
+        /*     init s5f_freemap and s5f_imap, in the background: */
+        s5_maps_build(s5);
 
         /* Init the members of fs that we (the fs-implementation) are
          * responsible for initializing: */
@@ -179,6 +228,98 @@ s5fs_mount(struct fs *fs)
         return 0;
 }
 
+/*
+ * Makes an empty file system on the first nblocks blocks of dev, laid
+ * out as fsmaker's format lays one out with no journal: the superblock,
+ * then ninodes inodes, then the root directory (inode 0, holding just
+ * "." and "..") in the first block after them, then the free list. Used
+ * for the ram disk, which starts out blank.
+ *
+ * Returns 0 on success, -EINVAL if there are no inodes, -ENOSPC if the
+ * blocks cannot hold them and the root directory, -ENOMEM, or -errno if
+ * a block cannot be written.
+ */
+int
+s5fs_format(blockdev_t *dev, uint32_t nblocks, uint32_t ninodes)
+{
+        uint32_t freeblocks[S5_NBLKS_PER_FNODE - 1];
+        uint32_t next = (uint32_t) -1, nfree = 0;
+        uint32_t iblocks, block, i;
+        s5_super_t *super;
+        s5_inode_t *inode;
+        s5_dirent_t *dirent;
+        char *buf;
+        int ret = 0;
+
+        if (0 == ninodes)
+                return -EINVAL;
+        iblocks = (ninodes - 1) / S5_INODES_PER_BLOCK + 1;
+        if (iblocks + 2 > nblocks)
+                return -ENOSPC;
+        if (NULL == (buf = page_alloc()))
+                return -ENOMEM;
+
+        /* the free list, as fsmaker builds it: every S5_NBLKS_PER_FNODE'th
+         * block holds the node before it */
+        for (block = iblocks + 2; block < nblocks; block++) {
+                if (S5_NBLKS_PER_FNODE - 1 > nfree) {
+                        freeblocks[nfree++] = block;
+                        continue;
+                }
+                memset(buf, 0, S5_BLOCK_SIZE);
+                memcpy(buf, freeblocks, sizeof(freeblocks));
+                ((uint32_t *) buf)[S5_NBLKS_PER_FNODE - 1] = next;
+                if (0 > (ret = blk_rw(dev, BLK_WRITE, buf, block, 1)))
+                        goto out;
+                next = block;
+                nfree = 0;
+        }
+
+        memset(buf, 0, S5_BLOCK_SIZE);
+        dirent = (s5_dirent_t *) buf;
+        strcpy(dirent[0].s5d_name, ".");
+        strcpy(dirent[1].s5d_name, "..");
+        if (0 > (ret = blk_rw(dev, BLK_WRITE, buf, iblocks + 1, 1)))
+                goto out;
+
+        for (block = 1; block <= iblocks; block++) {
+                memset(buf, 0, S5_BLOCK_SIZE);
+                inode = (s5_inode_t *) buf;
+                for (i = (block - 1) * S5_INODES_PER_BLOCK;
+                     i < ninodes && i < block * S5_INODES_PER_BLOCK; i++, inode++) {
+                        inode->s5_number = i;
+                        inode->s5_type = S5_TYPE_FREE;
+                        inode->s5_next_free = (i + 1 < ninodes) ? i + 1 : (uint32_t) -1;
+                }
+                if (1 == block) {
+                        inode = (s5_inode_t *) buf;
+                        inode->s5_type = S5_TYPE_DIR;
+                        inode->s5_size = 2 * sizeof(s5_dirent_t);
+                        inode->s5_linkcount = 1;
+                        inode->s5_direct_blocks[0] = iblocks + 1;
+                }
+                if (0 > (ret = blk_rw(dev, BLK_WRITE, buf, block, 1)))
+                        goto out;
+        }
+
+        /* last, so that a failure leaves no file system behind */
+        memset(buf, 0, S5_BLOCK_SIZE);
+        super = (s5_super_t *) buf;
+        super->s5s_magic = S5_MAGIC;
+        super->s5s_free_inode = (1 < ninodes) ? 1 : (uint32_t) -1;
+        super->s5s_nfree = nfree;
+        memcpy(super->s5s_free_blocks, freeblocks, nfree * sizeof(uint32_t));
+        super->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] = next;
+        super->s5s_root_inode = 0;
+        super->s5s_num_inodes = ninodes;
+        super->s5s_version = S5_INLINE_VERSION;
+        ret = blk_rw(dev, BLK_WRITE, buf, S5_SUPER_BLOCK, 1);
+
+out:
+        page_free(buf);
+        return ret;
+}
+
 /* Implementation of fs_t entry points: */
 
 /*
@@ -208,6 +349,7 @@ s5fs_mount(struct fs *fs)
  *
  * Finally, the main idea is to do special initialization based on the
  * type of inode (i.e. regular, directory, char/block device, etc').
+ * Use S5_INODE_TYPE for that, as a small regular file may be inline.
  *
  */
 static void
@@ -254,7 +396,7 @@ s5fs_umount(fs_t *fs)
         s5fs_t *s5 = (s5fs_t *)fs->fs_i;
         blockdev_t *bd = s5->s5f_bdev;
         pframe_t *sbp;
-        int ret;
+        int ret, maps_err;
 
         if (s5fs_check_refcounts(fs)) {
                 dbg(DBG_PRINT, "s5fs_umount: WARNING: linkcount corruption "
@@ -271,6 +413,21 @@ s5fs_umount(fs_t *fs)
 
         vput(fs->fs_root);
 
+        /* nothing can allocate or free blocks or change inodes any more,
+         * once the bitmaps are there to write back */
+        maps_err = s5_maps_wait(s5);
+        if (0 == maps_err) {
+                s5_imap_sync(s5);
+                s5_imap_destroy(s5);
+        }
+        s5_inode_flush(s5, 1);
+        KASSERT(list_empty(&s5->s5f_itable));
+        if (0 == maps_err) {
+                s5_freemap_sync(s5);
+                s5_freemap_destroy(s5);
+        }
+        s5_journal_umount(s5);
+
         if (0 > (ret = pframe_get(S5FS_TO_VMOBJ(s5), S5_SUPER_BLOCK, &sbp))) {
                 panic("s5fs_umount: failed to pframe_get super block. "
                       "This should never happen (the page should already "
@@ -293,6 +450,23 @@ s5fs_umount(fs_t *fs)
 
 
 
+/*
+ * Write the free lists and the inode table back, then commit
+ * everything changed since the last sync to the journal, if there is
+ * one.
+ */
+static int
+s5fs_sync(fs_t *fs)
+{
+        int ret;
+
+        s5_imap_sync(FS_TO_S5FS(fs));
+        s5_inode_flush(FS_TO_S5FS(fs), 1);
+        if (0 > (ret = s5_freemap_sync(FS_TO_S5FS(fs))))
+                return ret;
+        return s5_journal_commit(FS_TO_S5FS(fs));
+}
+
 /* Implementation of vnode_t entry points: */
 
 /*
@@ -312,6 +486,13 @@ s5fs_umount(fs_t *fs)
  * DO NOT TRY to do fine grained locking your first time through,
  * as it will break, and you will cry.
  *
+ * The vnode mutexes are the only locks held while waiting for the disk.
+ * The s5fs_subr.c functions take the file system's own locks
+ * (s5f_block_mutex for the free block bitmap, s5f_inode_mutex for the
+ * inode free list) themselves, only around updates to in-core state, so
+ * operations on different files wait for the disk at the same time.
+ * Lock a vnode before either of those, never after.
+ *
  * Finally, you should read and understand the basic overview of
  * the s5fs_subr functions. All of the following functions might delegate,
  * and it will make your life easier if you know what is going on.
@@ -322,29 +503,61 @@ s5fs_umount(fs_t *fs)
 static int
 s5fs_read(vnode_t *vnode, off_t offset, void *buf, size_t len)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_read");
-        return -1;
+        int ret;
+
+        krwlock_read_lock(&vnode->vn_lock);
+        ret = s5_read_file(vnode, offset, buf, len);
+        krwlock_read_unlock(&vnode->vn_lock);
+        return ret;
 }
 
 /* Simply call s5_write_file. */
 static int
 s5fs_write(vnode_t *vnode, off_t offset, const void *buf, size_t len)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_write");
-        return -1;
+        int ret;
+
+        krwlock_write_lock(&vnode->vn_lock);
+        ret = s5_write_file(vnode, offset, buf, len);
+        krwlock_write_unlock(&vnode->vn_lock);
+        return ret;
+}
+
+/* Like s5fs_read and s5fs_write, for O_DIRECT. */
+static int
+s5fs_read_direct(vnode_t *vnode, off_t offset, void *buf, size_t len)
+{
+        int ret;
+
+        krwlock_read_lock(&vnode->vn_lock);
+        ret = s5_read_direct(vnode, offset, buf, len);
+        krwlock_read_unlock(&vnode->vn_lock);
+        return ret;
+}
+
+static int
+s5fs_write_direct(vnode_t *vnode, off_t offset, const void *buf, size_t len)
+{
+        int ret;
+
+        krwlock_write_lock(&vnode->vn_lock);
+        ret = s5_write_direct(vnode, offset, buf, len);
+        krwlock_write_unlock(&vnode->vn_lock);
+        return ret;
 }
 
 /* This function is deceptivly simple, just return the vnode's
  * mmobj_t through the ret variable. Remember to watch the
  * refcount.
  *
- * Don't worry about this until VM.
+ * A mapping shares its pages with read and write, which go through the
+ * same mmobj (see s5_read_file).
  */
 static int
 s5fs_mmap(vnode_t *file, vmarea_t *vma, mmobj_t **ret)
 {
-        NOT_YET_IMPLEMENTED("VM: s5fs_mmap");
-
+        file->vn_mmobj.mmo_ops->ref(&file->vn_mmobj);
+        *ret = &file->vn_mmobj;
         return 0;
 }
 
@@ -382,7 +595,8 @@ s5fs_mknod(vnode_t *dir, const char *name, size_t namelen, int mode, devid_t dev
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
- * You probably want to use s5_find_dirent() and vget().
+ * You probably want to use s5_find_dirent() and vget(), with base's
+ * vn_lock held shared.
  */
 int
 s5fs_lookup(vnode_t *base, const char *name, size_t namelen, vnode_t **result)
@@ -470,7 +684,7 @@ s5fs_rmdir(vnode_t *parent, const char *name, size_t namelen)
  * Here you need to use s5_read_file() to read a s5_dirent_t from a directory
  * and copy that data into the given dirent. The value of d_off is dependent on
  * your implementation and may or may not b e necessary.  Finally, return the
- * number of bytes read.
+ * number of bytes read. Hold the directory's vn_lock shared while reading.
  */
 static int
 s5fs_readdir(vnode_t *vnode, off_t offset, struct dirent *d)
@@ -479,6 +693,44 @@ s5fs_readdir(vnode_t *vnode, off_t offset, struct dirent *d)
         return -1;
 }
 
+/*
+ * See the comment in vnode.h for what is expected of this function.
+ *
+ * The entries are copied straight out of each directory block in turn,
+ * so that a whole block costs one pframe_get() and one trip through the
+ * vn_lock.
+ */
+static int
+s5fs_readdirs(vnode_t *vnode, off_t offset, struct dirent *d, int count)
+{
+        const s5_dirent_t *s5d;
+        pframe_t *pf;
+        off_t pos = offset;
+        int n = 0;
+        int ret = 0;
+
+        if (0 != offset % sizeof(s5_dirent_t))
+                return -EINVAL;
+
+        krwlock_read_lock(&vnode->vn_lock);
+        while (n < count && pos < vnode->vn_len) {
+                if (0 > (ret = pframe_get(&vnode->vn_mmobj, ADDR_TO_PN(pos), &pf)))
+                        break;
+                /* the rest of this block's entries, as many as fit */
+                do {
+                        s5d = (const s5_dirent_t *)((char *) pf->pf_addr + PAGE_OFFSET(pos));
+                        d[n].d_ino = s5d->s5d_inode;
+                        strncpy(d[n].d_name, s5d->s5d_name, S5_NAME_LEN - 1);
+                        d[n].d_name[S5_NAME_LEN - 1] = '\0';
+                        pos += sizeof(s5_dirent_t);
+                        d[n++].d_off = pos;
+                } while (n < count && pos < vnode->vn_len && 0 != PAGE_OFFSET(pos));
+        }
+        krwlock_read_unlock(&vnode->vn_lock);
+
+        return (0 < n) ? n : ret;
+}
+
 
 /*
  * See the comment in vnode.h for what is expected of this function.
@@ -496,54 +748,210 @@ s5fs_stat(vnode_t *vnode, struct stat *ss)
         return -1;
 }
 
+/*
+ * Called by fsync(2) once the file's pages are written back, which may
+ * have given them blocks. Writes back the free list and just this file's
+ * inode block, then commits them to the journal if there is one; if
+ * there is not, the block device's dirty pages (inode and indirect
+ * blocks, the superblock and the free list) are written back directly.
+ * s5fs inodes hold no times, so fdatasync has nothing less to write.
+ */
+static int
+s5fs_fsync(vnode_t *vnode, int datasync)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        int ret;
+
+        if (0 > (ret = s5_freemap_sync(fs)))
+                return ret;
+        s5_inode_sync(fs, VNODE_TO_S5INODE(vnode));
+        if (NULL != fs->s5f_journal)
+                return s5_journal_commit(fs);
+        return pframe_clean_obj(S5FS_TO_VMOBJ(fs));
+}
+
 
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
  * You'll probably want to use s5_seek_to_block and the device's
  * read_block function.
+ *
+ * An inline file's page comes from its inode (see s5_inline_read).
  */
 static int
 s5fs_fillpage(vnode_t *vnode, off_t offset, void *pagebuf)
 {
+        if (S5_IS_INLINE(VNODE_TO_S5INODE(vnode))) {
+                s5_inline_read(vnode, offset, pagebuf);
+                return 0;
+        }
         NOT_YET_IMPLEMENTED("S5FS: s5fs_fillpage");
         return -1;
 }
 
+/*
+ * Read several consecutive pages of a file at once. Pages whose blocks
+ * are contiguous on disk are read with a single scatter-gather request
+ * straight into their page frames; sparse pages go through
+ * s5fs_fillpage.
+ */
+static int
+s5fs_fillpages(vnode_t *vnode, off_t offset, void **pagebufs, int npages)
+{
+        blockdev_t *bd = VNODE_TO_S5FS(vnode)->s5f_bdev;
+        int blocks[READAHEAD_MAX_PAGES];
+        int i, j, ret;
+
+        KASSERT(0 < npages && npages <= READAHEAD_MAX_PAGES);
+        KASSERT(READAHEAD_MAX_PAGES <= BLK_MAX_SEGS);
+        KASSERT(S5_BLOCK_SIZE == PAGE_SIZE);
+
+        for (i = 0; i < npages; i++) {
+                if ((blocks[i] = s5_seek_to_block(vnode, offset + i * PAGE_SIZE, 0)) < 0)
+                        return blocks[i];
+        }
+
+        for (i = 0; i < npages; i = j) {
+                j = i + 1;
+                if (0 == blocks[i]) {
+                        ret = s5fs_fillpage(vnode, offset + i * PAGE_SIZE, pagebufs[i]);
+                } else {
+                        while (j < npages && blocks[j] == blocks[j - 1] + 1)
+                                j++;
+                        ret = blk_rw_sg(bd, BLK_READ, &pagebufs[i], blocks[i], j - i);
+                }
+                if (ret < 0)
+                        return ret;
+        }
+
+        return 0;
+}
+
 
 /*
  * if this offset is NOT within a sparse region of the file
  *     return 0;
  *
- * attempt to make the region containing this offset no longer
- * sparse
- *     - attempt to allocate a free block
+ * Otherwise make sure there will be a disk block for the page when it
+ * is written out, without picking one yet (delayed allocation):
+ *     - allocate the indirect blocks that will map it, if missing
+ *     - reserve a free block for it (vdirtypage only calls us for a
+ *       page which is not dirty yet, so it does not have one)
  *     - if no free blocks available, return -ENOSPC
- *     - associate this block with the inode; alter the inode as
- *       appropriate
- *         - dirty the page containing this inode
  *
- * Much of this can be done with s5_seek_to_block()
+ * The block itself is allocated by s5fs_cleanpage(s), so the pages
+ * written out together get blocks next to each other however the
+ * writes that dirtied them were ordered.
+ *
+ * The page of an inline file needs no block, being written back to the
+ * inode; a write which would take the file past what fits there moves
+ * it out first (see s5_inline_expand).
  */
 static int
 s5fs_dirtypage(vnode_t *vnode, off_t offset)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_dirtypage");
-        return -1;
+        int block;
+
+        if (S5_IS_INLINE(VNODE_TO_S5INODE(vnode))) {
+                KASSERT(0 == offset);
+                return 0;
+        }
+        if (0 > (block = s5_seek_to_block(vnode, offset, S5_MAP_INDIRECT)))
+                return block;
+        if (0 < block)
+                return 0;
+        return s5_reserve_block(vnode);
 }
 
 /*
- * Like fillpage, but for writing.
+ * Like fillpage, but for writing. A sparse page's reserved block is
+ * allocated now. Directory pages go through the journal first.
  */
 static int
 s5fs_cleanpage(vnode_t *vnode, off_t offset, void *pagebuf)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_cleanpage");
-        return -1;
+        int block, ret;
+
+        if (S5_IS_INLINE(VNODE_TO_S5INODE(vnode))) {
+                s5_inline_write(vnode, offset, pagebuf);
+                return 0;
+        }
+        if (0 > (block = s5_seek_to_block(vnode, offset, S5_MAP_RESERVED)))
+                return block;
+        KASSERT(0 < block);
+        if (S_ISDIR(vnode->vn_mode)
+            && 0 > (ret = s5_journal_prewrite(VNODE_TO_S5FS(vnode), &vnode->vn_mmobj,
+                                              ADDR_TO_PN(offset), 1)))
+                return ret;
+        return blk_rw(VNODE_TO_S5FS(vnode)->s5f_bdev, BLK_WRITE, pagebuf, block, 1);
+}
+
+/*
+ * Write back several consecutive pages of a file at once. Blocks are
+ * allocated for the sparse ones first (in order, so they follow each
+ * other on disk where there is room), then pages whose blocks are
+ * contiguous on disk are written with a single scatter-gather request
+ * straight from their page frames.
+ */
+static int
+s5fs_cleanpages(vnode_t *vnode, off_t offset, void **pagebufs, int npages)
+{
+        blockdev_t *bd = VNODE_TO_S5FS(vnode)->s5f_bdev;
+        int blocks[PFRAME_CLEAN_BATCH];
+        int i, j, ret;
+
+        KASSERT(0 < npages && npages <= PFRAME_CLEAN_BATCH);
+        KASSERT(PFRAME_CLEAN_BATCH <= BLK_MAX_SEGS);
+        KASSERT(S5_BLOCK_SIZE == PAGE_SIZE);
+
+        if (S5_IS_INLINE(VNODE_TO_S5INODE(vnode))) {
+                KASSERT(1 == npages);
+                return s5fs_cleanpage(vnode, offset, pagebufs[0]);
+        }
+
+        for (i = 0; i < npages; i++) {
+                blocks[i] = s5_seek_to_block(vnode, offset + i * PAGE_SIZE, S5_MAP_RESERVED);
+                if (blocks[i] < 0)
+                        return blocks[i];
+                KASSERT(0 < blocks[i]);
+        }
+        if (S_ISDIR(vnode->vn_mode)
+            && 0 > (ret = s5_journal_prewrite(VNODE_TO_S5FS(vnode), &vnode->vn_mmobj,
+                                              ADDR_TO_PN(offset), npages)))
+                return ret;
+
+        for (i = 0; i < npages; i = j) {
+                j = i + 1;
+                while (j < npages && blocks[j] == blocks[j - 1] + 1)
+                        j++;
+                if ((ret = blk_rw_sg(bd, BLK_WRITE, &pagebufs[i], blocks[i], j - i)) < 0)
+                        return ret;
+        }
+
+        return 0;
 }
 
 /* Diagnostic/Utility: */
 
+/*
+ * Whether the journal is clear of the inode blocks: after all of them,
+ * or in the data blocks of a single group.
+ */
+static int
+s5_journal_fits(s5_super_t *super)
+{
+        uint32_t start = super->s5s_journal_start;
+        uint32_t last = start + super->s5s_journal_nblocks - 1;
+        uint32_t g;
+
+        if (!S5_HAS_GROUPS(super))
+                return S5_INODE_BLOCK(super, super->s5s_num_inodes - 1) < start;
+        g = S5_BLOCK_GROUP(super, start);
+        return (1 <= start && S5_GROUP_DATA(super, g) <= start
+                && g == S5_BLOCK_GROUP(super, last));
+}
+
 /*
  * verify the superblock.
  * returns -1 if the superblock is corrupt, 0 if it is OK.
@@ -556,10 +964,28 @@ s5_check_super(s5_super_t *super)
                   || super->s5s_free_inode == (uint32_t) - 1)
               && super->s5s_root_inode < super->s5s_num_inodes))
                 return -1;
-        if (super->s5s_version != S5_CURRENT_VERSION) {
+        if (super->s5s_version < S5_CURRENT_VERSION
+            || super->s5s_version > S5_GROUPED_VERSION) {
                 dbg(DBG_PRINT, "Filesystem is version %d; "
-                    "only version %d is supported.\n",
-                    super->s5s_version, S5_CURRENT_VERSION);
+                    "only versions %d to %d are supported.\n",
+                    super->s5s_version, S5_CURRENT_VERSION,
+                    S5_GROUPED_VERSION);
+                return -1;
+        }
+        if (S5_HAS_GROUPS(super)
+            && (0 == super->s5s_group_ninodes
+                || 0 != super->s5s_group_ninodes % S5_INODES_PER_BLOCK
+                || S5_GROUP_IBLOCKS(super) >= super->s5s_group_nblocks)) {
+                dbg(DBG_PRINT, "Filesystem has bad groups (%u blocks, %u inodes).\n",
+                    super->s5s_group_nblocks, super->s5s_group_ninodes);
+                return -1;
+        }
+        if (0 != super->s5s_journal_nblocks
+            && (S5_JOURNAL_MIN_BLOCKS > super->s5s_journal_nblocks
+                || !s5_journal_fits(super))) {
+                dbg(DBG_PRINT, "Filesystem has a bad journal (blocks %u to %u).\n",
+                    super->s5s_journal_start,
+                    super->s5s_journal_start + super->s5s_journal_nblocks - 1);
                 return -1;
         }
         return 0;
@@ -0,0 +1,616 @@
+/*
+ * S5 metadata journal.
+ *
+ * The on-disk format is described in s5fs.h. Nothing is logged as it
+ * happens; instead, every block which has to go through the journal is
+ * left dirty in the page cache, exactly as without one, and the journal
+ * only takes care that none of them is written in place before it has
+ * been logged. A commit gathers all of them at once (so sync(2) makes
+ * one group commit of everything since the last one), writes them to
+ * the journal followed by a commit record, writes them in place and
+ * then retires the transaction. Anything else that is about to write
+ * one of them first commits, if anything has changed since the last
+ * commit:
+ *
+ *     - pageoutd (and anyone else) writing back metadata goes through
+ *       pframe_clean_batch, which calls s5_journal_preclean, since the
+ *       block device objects are not ours;
+ *     - directory pages are written back by s5fs_cleanpage(s), which
+ *       calls s5_journal_prewrite.
+ *
+ * "Changed" is tracked by j_dirty, which pframe_dirty sets (through
+ * s5_journal_dirtied) for metadata and s5_journal_touch for directory
+ * blocks. The blocks logged are copied first, so that the blocks
+ * written in place are exactly those in the journal. Their pages stay
+ * dirty (their flags belong to pframe.c), so writing them back later
+ * writes the same contents again, or newer ones, which set j_dirty and
+ * so are committed first.
+ *
+ * A commit is one transaction, logged S5_JOURNAL_BATCH blocks at a
+ * time, each batch behind a descriptor of its own, under a single
+ * commit record; nothing is written in place before that record is on
+ * the disk. Only the last batch is still in memory then, so the others
+ * are read back from the journal to be written in place. A commit which
+ * does not fit in the journal at all is made as several transactions,
+ * in block order, and is then not atomic; fsmaker's -J makes the
+ * journal bigger.
+ *
+ * Operations are not bracketed: a commit records the blocks as they are
+ * in memory at that moment, which may be halfway through an operation
+ * which blocked. Recovery therefore brings the file system back to the
+ * last commit (usually the last sync) rather than to the last complete
+ * operation.
+ */
+
+#include "kernel.h"
+#include "types.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+#include "proc/kmutex.h"
+
+#include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_subr.h"
+#include "fs/s5fs/s5fs_journal.h"
+#include "fs/stat.h"
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+
+#include "drivers/blockdev.h"
+#include "drivers/disk/blkqueue.h"
+
+#include "mm/kmalloc.h"
+#include "mm/mmobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+
+/* Most blocks logged behind one descriptor */
+#define S5_JOURNAL_BATCH        31
+
+typedef struct s5_journal {
+        s5fs_t             *j_fs;
+        kmutex_t            j_mutex;        /* held by a commit */
+        int                 j_dirty;        /* changed since the last commit */
+        int                 j_more;         /* the gather left blocks out */
+        uint32_t            j_seq;          /* of the next transaction */
+        uint32_t            j_start;
+        uint32_t            j_nblocks;
+        uint32_t            j_max;          /* most blocks per batch */
+
+        /* The batch being logged or written in place: home blocks
+         * (ascending), the pages they are copied from, and the copies
+         * (j_buf, after the descriptor in its first page) */
+        uint32_t            j_blocks[S5_JOURNAL_BATCH];
+        pframe_t           *j_pfs[S5_JOURNAL_BATCH];
+        char               *j_buf;          /* S5_JOURNAL_BATCH + 1 pages */
+        char               *j_rec;          /* the header or commit record */
+        blk_request_t       j_reqs[S5_JOURNAL_BATCH];
+
+        /* Statistics, see s5_journal_info */
+        uint32_t            j_ncommits;
+        uint32_t            j_ntransactions;
+        uint32_t            j_nsplit;       /* commits too big for the journal */
+        uint32_t            j_nlogged;
+        uint32_t            j_nreplayed;
+
+        list_link_t         j_link;         /* link on s5_journals */
+} s5_journal_t;
+
+static list_t s5_journals;
+static int s5_journal_hooked;
+
+static __attribute__((unused)) void
+s5_journal_init(void)
+{
+        list_init(&s5_journals);
+}
+init_func(s5_journal_init);
+
+static s5_journal_t *
+s5_journal_lookup(mmobj_t *o)
+{
+        s5_journal_t *j;
+
+        list_iterate_begin(&s5_journals, j, s5_journal_t, j_link) {
+                if (S5FS_TO_VMOBJ(j->j_fs) == o)
+                        return j;
+        } list_iterate_end();
+        return NULL;
+}
+
+static void
+s5_journal_dirtied(mmobj_t *o, pframe_t *pf)
+{
+        s5_journal_t *j = s5_journal_lookup(o);
+
+        if (NULL != j)
+                j->j_dirty = 1;
+}
+
+static int
+s5_journal_preclean(mmobj_t *o, pframe_t **pfs, int npages)
+{
+        s5_journal_t *j = s5_journal_lookup(o);
+
+        if (NULL == j)
+                return 0;
+        return s5_journal_prewrite(j->j_fs, o, pfs[0]->pf_pagenum, npages);
+}
+
+/* A page to be logged is dirty, or one of those about to be written */
+static int
+s5_journal_wanted(pframe_t *pf, mmobj_t *xobj, uint32_t xfirst, int xn)
+{
+        if (pf->pf_obj == xobj && pf->pf_pagenum - xfirst < (uint32_t) xn)
+                return 1;
+        return pframe_is_dirty(pf) && !pframe_is_busy(pf);
+}
+
+/* Keeps the 'max' lowest-numbered blocks at or above 'cursor' */
+static int
+s5_journal_select(s5_journal_t *j, int n, uint32_t max, uint32_t cursor,
+                  uint32_t block, pframe_t *pf)
+{
+        int i, k;
+
+        if (block < cursor)
+                return n;
+        for (i = n; 0 < i && j->j_blocks[i - 1] > block; i--)
+                ;
+        if (0 < i && j->j_blocks[i - 1] == block)
+                return n;
+        if ((uint32_t) i >= max) {
+                j->j_more = 1;
+                return n;
+        }
+        if ((uint32_t) n == max) {
+                j->j_more = 1;
+                n--;
+        }
+        for (k = n; k > i; k--) {
+                j->j_blocks[k] = j->j_blocks[k - 1];
+                j->j_pfs[k] = j->j_pfs[k - 1];
+        }
+        j->j_blocks[i] = block;
+        j->j_pfs[i] = pf;
+        return n + 1;
+}
+
+/*
+ * Picks up to 'max' blocks for the next batch. Does not block, so that
+ * the pages found stay put until they have been copied.
+ */
+static int
+s5_journal_gather(s5_journal_t *j, uint32_t max, uint32_t cursor,
+                  mmobj_t *xobj, uint32_t xfirst, int xn)
+{
+        s5fs_t *fs = j->j_fs;
+        vnode_t *vn;
+        pframe_t *pf;
+        int block, n = 0;
+
+        j->j_more = 0;
+        list_iterate_begin(&S5FS_TO_VMOBJ(fs)->mmo_respages, pf, pframe_t, pf_olink) {
+                if (s5_journal_wanted(pf, xobj, xfirst, xn))
+                        n = s5_journal_select(j, n, max, cursor, pf->pf_pagenum, pf);
+        } list_iterate_end();
+
+        list_iterate_begin(&fs->s5f_fs->fs_vnodes, vn, vnode_t, vn_link) {
+                if (!S_ISDIR(vn->vn_mode))
+                        continue;
+                list_iterate_begin(&vn->vn_mmobj.mmo_respages, pf, pframe_t, pf_olink) {
+                        if (!s5_journal_wanted(pf, xobj, xfirst, xn))
+                                continue;
+                        block = s5_map_resident(vn, (off_t) PN_TO_ADDR(pf->pf_pagenum));
+                        if (0 < block) {
+                                n = s5_journal_select(j, n, max, cursor, (uint32_t) block, pf);
+                        } else {
+                                /* it has to wait for the next commit */
+                                j->j_dirty = 1;
+                        }
+                } list_iterate_end();
+        } list_iterate_end();
+
+        return n;
+}
+
+/*
+ * Makes sure every dirty directory page has a disk block, so that the
+ * gather finds them all. The lists have to be searched again whenever
+ * this blocks.
+ */
+static int
+s5_journal_assign(s5_journal_t *j)
+{
+        fs_t *fs = j->j_fs->s5f_fs;
+        vnode_t *vn;
+        pframe_t *pf;
+        off_t off;
+        int block;
+
+restart:
+        list_iterate_begin(&fs->fs_vnodes, vn, vnode_t, vn_link) {
+                if (!S_ISDIR(vn->vn_mode))
+                        continue;
+                list_iterate_begin(&vn->vn_mmobj.mmo_respages, pf, pframe_t, pf_olink) {
+                        if (!pframe_is_dirty(pf) || pframe_is_busy(pf))
+                                continue;
+                        off = (off_t) PN_TO_ADDR(pf->pf_pagenum);
+                        if (0 < s5_map_resident(vn, off))
+                                continue;
+
+                        vn = vget(fs, vn->vn_vno);
+                        block = s5_seek_to_block(vn, off, S5_MAP_RESERVED);
+                        vput(vn);
+                        if (0 > block)
+                                return block;
+                        goto restart;
+                } list_iterate_end();
+        } list_iterate_end();
+        return 0;
+}
+
+/* Reads or writes a contiguous run of blocks of the journal buffer */
+static int
+s5_journal_rw_run(s5_journal_t *j, int dir, char *buf, uint32_t block, uint32_t count)
+{
+        blockdev_t *bd = j->j_fs->s5f_bdev;
+        uint32_t i, n;
+        int ret;
+
+        for (i = 0; i < count; i += n) {
+                n = MIN(count - i, BLK_MAX_SEGS);
+                if (0 > (ret = blk_rw(bd, dir, buf + i * S5_BLOCK_SIZE, block + i, n)))
+                        return ret;
+        }
+        return 0;
+}
+
+static int
+s5_journal_write_header(s5_journal_t *j)
+{
+        s5_jheader_t *h = (s5_jheader_t *) j->j_rec;
+
+        memset(j->j_rec, 0, S5_BLOCK_SIZE);
+        h->s5jh_magic = S5_JOURNAL_HEADER_MAGIC;
+        h->s5jh_seq = j->j_seq;
+        return blk_rw(j->j_fs->s5f_bdev, BLK_WRITE, j->j_rec, j->j_start, 1);
+}
+
+/* The last block of the journal, which only a commit record can use */
+static uint32_t
+s5_journal_end(s5_journal_t *j)
+{
+        return j->j_start + j->j_nblocks - 1;
+}
+
+/*
+ * Reads the descriptor of the batch of transaction j_seq at 'pos' into
+ * the first page of j_buf and its home blocks into j_blocks, and, if
+ * 'data', the copies into the pages after it. Returns how many blocks
+ * the batch has, or 0 if there is none there (there is the commit
+ * record, or something older).
+ */
+static int
+s5_journal_read_batch(s5_journal_t *j, uint32_t pos, int data)
+{
+        s5_jrecord_t *d = (s5_jrecord_t *) j->j_buf;
+        uint32_t n;
+        int ret;
+
+        if (0 > (ret = blk_rw(j->j_fs->s5f_bdev, BLK_READ, j->j_buf, pos, 1)))
+                return ret;
+        if (S5_JOURNAL_DESC_MAGIC != d->s5jr_magic || j->j_seq != d->s5jr_seq)
+                return 0;
+        n = d->s5jr_nblocks;
+        if (0 == n || n > j->j_max || pos + n >= s5_journal_end(j)) {
+                dbg(DBG_S5FS | DBG_ERROR, "journal transaction %u has a batch "
+                    "of %u blocks at %u, which cannot be\n", j->j_seq, n, pos);
+                return -EINVAL;
+        }
+
+        memcpy(j->j_blocks, d->s5jr_blocks, n * sizeof(uint32_t));
+        if (data && 0 > (ret = s5_journal_rw_run(j, BLK_READ, j->j_buf + S5_BLOCK_SIZE,
+                                                 pos + 1, n)))
+                return ret;
+        return (int) n;
+}
+
+/* Logs the 'n' gathered blocks, whose copies are in j_buf, at 'pos' */
+static int
+s5_journal_log(s5_journal_t *j, uint32_t pos, int n)
+{
+        s5_jrecord_t *d = (s5_jrecord_t *) j->j_buf;
+
+        memset(d, 0, S5_BLOCK_SIZE);
+        d->s5jr_magic = S5_JOURNAL_DESC_MAGIC;
+        d->s5jr_seq = j->j_seq;
+        d->s5jr_nblocks = n;
+        memcpy(d->s5jr_blocks, j->j_blocks, n * sizeof(uint32_t));
+        return s5_journal_rw_run(j, BLK_WRITE, j->j_buf, pos, n + 1);
+}
+
+/* Writes the 'n' copies in j_buf to their home blocks */
+static int
+s5_journal_write_home(s5_journal_t *j, int n)
+{
+        int i, err, ret = 0;
+
+        /* the blocks are sorted, so the queue sweeps across them once */
+        for (i = 0; i < n; i++) {
+                blk_request_init(&j->j_reqs[i], j->j_fs->s5f_bdev, BLK_WRITE,
+                                 j->j_buf + (i + 1) * S5_BLOCK_SIZE, j->j_blocks[i], 1);
+                blk_submit(&j->j_reqs[i]);
+        }
+        for (i = 0; i < n; i++) {
+                if (0 > (err = blk_wait(&j->j_reqs[i])) && 0 == ret)
+                        ret = err;
+        }
+        return ret;
+}
+
+/*
+ * Makes a transaction of as many of the blocks at or above *cursor as
+ * the journal holds: logs them a batch at a time, commits, writes them
+ * in place and retires the transaction, moving *cursor past them. Each
+ * step waits for the one before it to reach the disk.
+ */
+static int
+s5_journal_transact(s5_journal_t *j, uint32_t *cursor, mmobj_t *xobj, uint32_t xfirst, int xn)
+{
+        s5_jrecord_t *c = (s5_jrecord_t *) j->j_rec;
+        uint32_t pos = j->j_start + 1, last = 0, end = s5_journal_end(j);
+        uint32_t total = 0;
+        int i, n, nlast = 0, ret;
+
+        /* a batch at 'pos' has to leave a block for the commit record */
+        do {
+                if (end - pos < 2)
+                        break;
+                if (0 == (n = s5_journal_gather(j, MIN(j->j_max, end - pos - 1),
+                                                *cursor, xobj, xfirst, xn)))
+                        break;
+                for (i = 0; i < n; i++)
+                        memcpy(j->j_buf + (i + 1) * S5_BLOCK_SIZE, j->j_pfs[i]->pf_addr, S5_BLOCK_SIZE);
+                if (0 > (ret = s5_journal_log(j, pos, n)))
+                        return ret;
+                *cursor = j->j_blocks[n - 1] + 1;
+                total += n;
+                last = pos;
+                nlast = n;
+                pos += 1 + n;
+        } while (j->j_more);
+        if (0 == total)
+                return 0;
+
+        memset(c, 0, S5_BLOCK_SIZE);
+        c->s5jr_magic = S5_JOURNAL_COMMIT_MAGIC;
+        c->s5jr_seq = j->j_seq;
+        c->s5jr_nblocks = total;
+        if (0 > (ret = blk_rw(j->j_fs->s5f_bdev, BLK_WRITE, j->j_rec, pos, 1)))
+                return ret;
+
+        /* the last batch is still in j_buf, the others are read back */
+        if (0 > (ret = s5_journal_write_home(j, nlast)))
+                return ret;
+        for (pos = j->j_start + 1; pos < last; pos += 1 + n) {
+                if (0 >= (n = s5_journal_read_batch(j, pos, 1)))
+                        return (0 > n) ? n : -EIO;
+                if (0 > (ret = s5_journal_write_home(j, n)))
+                        return ret;
+        }
+
+        j->j_seq++;
+        if (0 > (ret = s5_journal_write_header(j)))
+                return ret;
+
+        j->j_ntransactions++;
+        j->j_nlogged += total;
+        return 0;
+}
+
+static int
+s5_journal_commit_pages(s5_journal_t *j, mmobj_t *xobj, uint32_t xfirst, int xn)
+{
+        uint32_t cursor = 0;
+        int ntrans = 0, ret = 0;
+
+        /* the inodes changed go in the same commit; pages being
+         * written for the caller cannot be waited for */
+        s5_inode_flush(j->j_fs, NULL == xobj);
+
+        kmutex_lock(&j->j_mutex);
+        if (!j->j_dirty)
+                goto out;
+
+        if (0 > (ret = s5_journal_assign(j)))
+                goto out;
+
+        /* from here on, a change means another commit is needed */
+        j->j_dirty = 0;
+        j->j_ncommits++;
+        do {
+                if (0 > (ret = s5_journal_transact(j, &cursor, xobj, xfirst, xn))) {
+                        dbg(DBG_S5FS | DBG_ERROR, "journal commit failed: %d\n", ret);
+                        j->j_dirty = 1;
+                        break;
+                }
+                ntrans++;
+        } while (j->j_more);
+
+        if (1 < ntrans) {
+                dbg(DBG_S5FS, "journal commit made as %d transactions\n", ntrans);
+                j->j_nsplit++;
+        }
+out:
+        kmutex_unlock(&j->j_mutex);
+        return ret;
+}
+
+int
+s5_journal_commit(s5fs_t *fs)
+{
+        if (NULL == fs->s5f_journal)
+                return 0;
+        return s5_journal_commit_pages(fs->s5f_journal, NULL, 0, 0);
+}
+
+int
+s5_journal_prewrite(s5fs_t *fs, mmobj_t *o, uint32_t pagenum, int npages)
+{
+        if (NULL == fs->s5f_journal)
+                return 0;
+        return s5_journal_commit_pages(fs->s5f_journal, o, pagenum, npages);
+}
+
+void
+s5_journal_touch(s5fs_t *fs)
+{
+        if (NULL != fs->s5f_journal)
+                fs->s5f_journal->j_dirty = 1;
+}
+
+/*
+ * Puts the blocks of the transaction in the journal, if it is complete,
+ * back into the page cache as dirty pages; the commit which follows
+ * writes them in place (logging them again, since the transaction is
+ * only retired once they are all there). The batches are walked twice,
+ * first to find the commit record, then to read the blocks.
+ */
+static int
+s5_journal_replay(s5_journal_t *j)
+{
+        s5_jrecord_t *c = (s5_jrecord_t *) j->j_rec;
+        pframe_t *pf;
+        uint32_t pos, end, total = 0;
+        int i, n, ret;
+
+        for (pos = j->j_start + 1; 0 < (n = s5_journal_read_batch(j, pos, 0)); pos += 1 + n)
+                total += n;
+        if (0 > n)
+                return n;
+        if (0 == total)
+                return 0;
+        if (0 > (ret = blk_rw(j->j_fs->s5f_bdev, BLK_READ, j->j_rec, pos, 1)))
+                return ret;
+        if (S5_JOURNAL_COMMIT_MAGIC != c->s5jr_magic || j->j_seq != c->s5jr_seq
+            || total != c->s5jr_nblocks)
+                return 0;
+
+        end = pos;
+        for (pos = j->j_start + 1; pos < end; pos += 1 + n) {
+                if (0 >= (n = s5_journal_read_batch(j, pos, 1)))
+                        return (0 > n) ? n : -EIO;
+                for (i = 0; i < n; i++) {
+                        pframe_get(S5FS_TO_VMOBJ(j->j_fs), j->j_blocks[i], &pf);
+                        KASSERT(pf && "because never fails for block_device vm_objects");
+                        memcpy(pf->pf_addr, j->j_buf + (i + 1) * S5_BLOCK_SIZE, S5_BLOCK_SIZE);
+                        pframe_dirty(pf);
+                }
+        }
+        j->j_nreplayed = total;
+        dbg(DBG_S5FS, "replayed journal transaction %u (%u blocks)\n", j->j_seq, total);
+
+        j->j_dirty = 1;
+        return s5_journal_commit_pages(j, NULL, 0, 0);
+}
+
+int
+s5_journal_mount(s5fs_t *fs)
+{
+        s5_super_t *s = fs->s5f_super;
+        s5_jheader_t *h;
+        s5_journal_t *j;
+        int ret;
+
+        fs->s5f_journal = NULL;
+        if (0 == s->s5s_journal_nblocks)
+                return 0;
+
+        if (NULL == (j = kmalloc(sizeof(s5_journal_t))))
+                return -ENOMEM;
+        memset(j, 0, sizeof(*j));
+        j->j_buf = page_alloc_n(S5_JOURNAL_BATCH + 1);
+        j->j_rec = page_alloc();
+        if (NULL == j->j_buf || NULL == j->j_rec) {
+                ret = -ENOMEM;
+                goto fail;
+        }
+        j->j_fs = fs;
+        kmutex_init(&j->j_mutex);
+        j->j_start = s->s5s_journal_start;
+        j->j_nblocks = s->s5s_journal_nblocks;
+        j->j_max = MIN(S5_JOURNAL_BATCH, j->j_nblocks - 3);
+
+        if (0 > (ret = blk_rw(fs->s5f_bdev, BLK_READ, j->j_rec, j->j_start, 1)))
+                goto fail;
+        h = (s5_jheader_t *) j->j_rec;
+        if (S5_JOURNAL_HEADER_MAGIC == h->s5jh_magic) {
+                j->j_seq = h->s5jh_seq;
+        } else {
+                j->j_seq = 1;
+                if (0 > (ret = s5_journal_write_header(j)))
+                        goto fail;
+        }
+
+        if (!s5_journal_hooked) {
+                pframe_register_dirtied(S5FS_TO_VMOBJ(fs)->mmo_ops, s5_journal_dirtied);
+                pframe_register_preclean(S5FS_TO_VMOBJ(fs)->mmo_ops, s5_journal_preclean);
+                s5_journal_hooked = 1;
+        }
+        list_insert_tail(&s5_journals, &j->j_link);
+        fs->s5f_journal = j;
+
+        if (0 > (ret = s5_journal_replay(j))) {
+                list_remove(&j->j_link);
+                fs->s5f_journal = NULL;
+                goto fail;
+        }
+        return 0;
+
+fail:
+        if (NULL != j->j_buf)
+                page_free_n(j->j_buf, S5_JOURNAL_BATCH + 1);
+        if (NULL != j->j_rec)
+                page_free(j->j_rec);
+        kfree(j);
+        return ret;
+}
+
+void
+s5_journal_umount(s5fs_t *fs)
+{
+        s5_journal_t *j = fs->s5f_journal;
+
+        if (NULL == j)
+                return;
+        s5_journal_commit(fs);
+
+        list_remove(&j->j_link);
+        fs->s5f_journal = NULL;
+        page_free_n(j->j_buf, S5_JOURNAL_BATCH + 1);
+        page_free(j->j_rec);
+        kfree(j);
+}
+
+size_t
+s5_journal_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        s5_journal_t *j;
+
+        list_iterate_begin(&s5_journals, j, s5_journal_t, j_link) {
+                iprintf(&buf, &size, "%s: %u commits (%u split), %u transactions, "
+                        "%u blocks logged, %u replayed, next %u%s\n",
+                        j->j_fs->s5f_fs->fs_dev, j->j_ncommits, j->j_nsplit,
+                        j->j_ntransactions, j->j_nlogged, j->j_nreplayed, j->j_seq,
+                        j->j_dirty ? " (dirty)" : "");
+        } list_iterate_end();
+        return size;
+}
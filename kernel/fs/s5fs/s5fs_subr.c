@@ -8,9 +8,12 @@
 #include "kernel.h"
 #include "util/debug.h"
 #include "mm/kmalloc.h"
+#include "mm/slab.h"
+#include "util/init.h"
 #include "globals.h"
 #include "proc/sched.h"
 #include "proc/kmutex.h"
+#include "proc/workq.h"
 #include "errno.h"
 #include "util/string.h"
 #include "util/printf.h"
@@ -18,13 +21,16 @@
 #include "mm/mmobj.h"
 #include "drivers/dev.h"
 #include "drivers/blockdev.h"
+#include "drivers/disk/blkqueue.h"
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
 #include "fs/s5fs/s5fs_subr.h"
 #include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_journal.h"
 #include "mm/mm.h"
 #include "mm/page.h"
+#include "util/bits.h"
 
 #define dprintf(...) dbg(DBG_S5FS, __VA_ARGS__)
 
@@ -42,48 +48,298 @@
 
 
 static void s5_free_block(s5fs_t *fs, int block);
-static int s5_alloc_block(s5fs_t *);
+static int s5_alloc_block(s5fs_t *, int goal, int reserved);
+static pframe_t *s5_dirindex_get(vnode_t *dir);
+static void s5_dirindex_drop(vnode_t *dir, pframe_t *xpf);
 
+#define S5_FREEMAP_WORDS(nblocks)       (((nblocks) + 31) >> 5)
+#define s5_freemap_test(fs, b)          bit_check((fs)->s5f_freemap, (b))
+#define s5_freemap_set(fs, b)           bit_set((fs)->s5f_freemap, (b))
+#define s5_freemap_clear(fs, b)         bit_clear((fs)->s5f_freemap, (b))
+
+/* The free inode bitmap works the same way (a set bit is a free inode) */
+#define s5_imap_test(fs, i)             bit_check((fs)->s5f_imap, (i))
+#define s5_imap_set(fs, i)              bit_set((fs)->s5f_imap, (i))
+#define s5_imap_clear(fs, i)            bit_clear((fs)->s5f_imap, (i))
+
+
+/* Most blocks the mapping cache (vn_map_*) remembers at once */
+#define S5_MAP_MAX_BLOCKS       S5_NIDIRECT_BLOCKS
+
+/*
+ * Returns the block a block pointer names, allocating one if the pointer
+ * is zero and 'alloc' (see s5_seek_to_block) says so, and returning 0
+ * if it does not. 'pf' is the pinned page of the indirect block holding
+ * the pointer, or NULL if the pointer is in the inode itself; either is
+ * dirtied if the pointer changes. A new indirect block ('indirect' set)
+ * is zeroed; a new data block is left for the caller to fill.
+ */
+static int
+s5_map_pointer(vnode_t *vnode, uint32_t *ptr, pframe_t *pf, int alloc,
+               int indirect, uint32_t goal)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        pframe_t *bpf;
+        int block, reserved;
+
+        if (0 != *ptr || S5_MAP_LOOKUP == alloc || (!indirect && S5_MAP_INDIRECT == alloc))
+                return (int) *ptr;
+
+        /* a file's first block goes in its inode's group */
+        if (0 == goal && S5_HAS_GROUPS(fs->s5f_super)) {
+                goal = S5_GROUP_DATA(fs->s5f_super,
+                                     S5_INODE_GROUP(fs->s5f_super, vnode->vn_vno));
+        }
+
+        reserved = (!indirect && S5_MAP_RESERVED == alloc && 0 < vnode->vn_nreserved);
+        if (0 > (block = s5_alloc_block(fs, (int) goal, reserved)))
+                return block;
+        if (reserved)
+                vnode->vn_nreserved--;
+        if (indirect) {
+                pframe_get(S5FS_TO_VMOBJ(fs), block, &bpf);
+                KASSERT(bpf && "because never fails for block_device vm_objects");
+                memset(bpf->pf_addr, 0, S5_BLOCK_SIZE);
+                pframe_dirty(bpf);
+        }
+
+        *ptr = (uint32_t) block;
+        if (NULL != pf)
+                pframe_dirty(pf);
+        else
+                s5_dirty_inode(fs, VNODE_TO_S5INODE(vnode));
+        return block;
+}
+
+/*
+ * Remembers the run of consecutive disk blocks which the indirect block
+ * 'ptrs' maps starting with file block 'lblock' (its entry 'i'), so
+ * that the rest of the run can be mapped without reading 'ptrs' again.
+ */
+static void
+s5_map_cache(vnode_t *vnode, uint32_t lblock, const uint32_t *ptrs, uint32_t i)
+{
+        uint32_t n = 1;
+
+        while (i + n < S5_NIDIRECT_BLOCKS && n < S5_MAP_MAX_BLOCKS
+               && ptrs[i + n] == ptrs[i] + n)
+                n++;
+        vnode->vn_map_lblock = lblock;
+        vnode->vn_map_pblock = ptrs[i];
+        vnode->vn_map_nblocks = n;
+}
 
 /*
  * Return the disk-block number for the given seek pointer (aka file
  * position).
  *
- * If the seek pointer refers to a sparse block, and alloc is false,
- * then return 0. If the seek pointer refers to a sparse block, and
- * alloc is true, then allocate a new disk block (and make the inode
- * point to it) and return it.
+ * If the seek pointer refers to a sparse block, and alloc is
+ * S5_MAP_LOOKUP, then return 0. If the seek pointer refers to a sparse
+ * block, and alloc is S5_MAP_ALLOC, then allocate a new disk block (and
+ * make the inode point to it) and return it. S5_MAP_RESERVED does the
+ * same, using up one of the blocks s5_reserve_block reserved for the
+ * vnode, and S5_MAP_INDIRECT only allocates the indirect blocks needed
+ * to map the block (returning 0 if the block itself is sparse).
+ * s5_alloc_block is given the block before it in the file as the goal,
+ * so that the file stays contiguous on disk.
  *
- * Be sure to handle indirect blocks!
+ * Blocks past the direct ones are mapped by the indirect block and then,
+ * on a S5_LARGEFILE_VERSION file system, by the double-indirect one.
+ * The run of consecutive disk blocks found through an indirect block is
+ * remembered in the vnode (vn_map_*), so mapping the rest of a large
+ * sequentially-laid-out file does not touch the indirect block again.
  *
- * If there is an error, return -errno.
+ * Indirect blocks are only allocated on behalf of a write, with the
+ * vnode's mutex held. Data blocks are allocated when their pages are
+ * cleaned (see s5fs_dirtypage), which may happen at any time; by then
+ * the indirect blocks above them exist, and nothing else sets the
+ * pointer to a page's block while that page is being cleaned. The map
+ * only ever grows while the vnode is in use, and a pointer is only set
+ * once the block it points to has been zeroed.
  *
- * You probably want to use pframe_get, pframe_pin, pframe_unpin, pframe_dirty.
+ * If there is an error, return -errno (-EFBIG past the largest file).
  */
 int
 s5_seek_to_block(vnode_t *vnode, off_t seekptr, int alloc)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_seek_to_block");
-        return -1;
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        uint32_t lblock = S5_DATA_BLOCK(seekptr);
+        uint32_t ndirect, rel, levels, i;
+        uint32_t *ptr;
+        pframe_t *pf = NULL;
+        int block;
+
+        KASSERT(0 <= seekptr);
+
+        /* an inline file has no blocks, and is moved to one before it
+         * is given any (see s5_inline_expand) */
+        if (S5_IS_INLINE(inode)) {
+                KASSERT(S5_MAP_LOOKUP == alloc);
+                return 0;
+        }
+
+        if (lblock - vnode->vn_map_lblock < vnode->vn_map_nblocks)
+                return (int)(vnode->vn_map_pblock + (lblock - vnode->vn_map_lblock));
+
+        ndirect = S5_HAS_DINDIRECT(fs->s5f_super) ? S5_DINDIRECT_SLOT : S5_NDIRECT_BLOCKS;
+        if (lblock < ndirect) {
+                return s5_map_pointer(vnode, &inode->s5_direct_blocks[lblock], NULL, alloc, 0,
+                                      (0 < lblock) ? inode->s5_direct_blocks[lblock - 1] : 0);
+        }
+
+        rel = lblock - ndirect;
+        if (rel < S5_NIDIRECT_BLOCKS) {
+                ptr = &inode->s5_indirect_block;
+                levels = 1;
+        } else if (S5_HAS_DINDIRECT(fs->s5f_super)
+                   && rel - S5_NIDIRECT_BLOCKS < S5_NIDIRECT_BLOCKS * S5_NIDIRECT_BLOCKS) {
+                rel -= S5_NIDIRECT_BLOCKS;
+                ptr = &inode->s5_direct_blocks[S5_DINDIRECT_SLOT];
+                levels = 2;
+        } else {
+                return -EFBIG;
+        }
+
+        /* walk down from the inode, one level of indirect blocks at a
+         * time; 'ptr' points into the page 'pf' (pinned) below the top */
+        block = s5_map_pointer(vnode, ptr, NULL, alloc, 1, inode->s5_direct_blocks[ndirect - 1]);
+        while (0 < block && 0 < levels) {
+                pframe_t *ipf;
+                uint32_t *ptrs;
+
+                pframe_get(S5FS_TO_VMOBJ(fs), block, &ipf);
+                KASSERT(ipf && "because never fails for block_device vm_objects");
+                pframe_pin(ipf);
+                if (NULL != pf)
+                        pframe_unpin(pf);
+                pf = ipf;
+                ptrs = (uint32_t *) pf->pf_addr;
+
+                levels--;
+                i = (0 < levels) ? rel / S5_NIDIRECT_BLOCKS : rel % S5_NIDIRECT_BLOCKS;
+                block = s5_map_pointer(vnode, &ptrs[i], pf, alloc, 0 < levels,
+                                       (0 < i && 0 != ptrs[i - 1]) ? ptrs[i - 1] : (uint32_t) block);
+                if (0 == levels && 0 < block) {
+                        s5_map_cache(vnode, lblock, ptrs, i);
+                }
+        }
+
+        if (NULL != pf)
+                pframe_unpin(pf);
+        return block;
 }
 
 
 /*
- * Locks the mutex for the whole file system
+ * Like s5_seek_to_block with S5_MAP_LOOKUP, but never blocks: returns
+ * -EAGAIN if an indirect block on the way is not resident (or is busy),
+ * and does not touch the mapping cache beyond reading it.
  */
-static void
-lock_s5(s5fs_t *fs)
+int
+s5_map_resident(vnode_t *vnode, off_t seekptr)
 {
-        kmutex_lock(&fs->s5f_mutex);
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        uint32_t lblock = S5_DATA_BLOCK(seekptr);
+        uint32_t ndirect, rel, levels, i, block;
+        pframe_t *pf;
+
+        if (S5_IS_INLINE(inode))
+                return 0;
+        if (lblock - vnode->vn_map_lblock < vnode->vn_map_nblocks)
+                return (int)(vnode->vn_map_pblock + (lblock - vnode->vn_map_lblock));
+
+        ndirect = S5_HAS_DINDIRECT(fs->s5f_super) ? S5_DINDIRECT_SLOT : S5_NDIRECT_BLOCKS;
+        if (lblock < ndirect)
+                return (int) inode->s5_direct_blocks[lblock];
+
+        rel = lblock - ndirect;
+        if (rel < S5_NIDIRECT_BLOCKS) {
+                block = inode->s5_indirect_block;
+                levels = 1;
+        } else if (S5_HAS_DINDIRECT(fs->s5f_super)
+                   && rel - S5_NIDIRECT_BLOCKS < S5_NIDIRECT_BLOCKS * S5_NIDIRECT_BLOCKS) {
+                rel -= S5_NIDIRECT_BLOCKS;
+                block = inode->s5_direct_blocks[S5_DINDIRECT_SLOT];
+                levels = 2;
+        } else {
+                return -EFBIG;
+        }
+
+        while (0 != block && 0 < levels) {
+                pf = pframe_get_resident(S5FS_TO_VMOBJ(fs), block);
+                if (NULL == pf || pframe_is_busy(pf))
+                        return -EAGAIN;
+                levels--;
+                i = (0 < levels) ? rel / S5_NIDIRECT_BLOCKS : rel % S5_NIDIRECT_BLOCKS;
+                block = ((uint32_t *) pf->pf_addr)[i];
+        }
+        return (int) block;
 }
 
+
 /*
- * Unlocks the mutex for the whole file system
+ * Inline files (S5_INLINE_VERSION and later, see s5fs.h) keep their
+ * data in the inode, and their one page is filled from and cleaned to
+ * it by s5_inline_read and s5_inline_write, without a block. Anything
+ * which would make the file bigger than S5_INLINE_MAX, or give it a
+ * block, moves the data out first with s5_inline_expand: page 0 is read
+ * in (from the inode) and dirtied once the inode no longer says the file
+ * is inline, so that the page gets a block like any other when it is
+ * cleaned.
  */
-static void
-unlock_s5(s5fs_t *fs)
+int
+s5_inline_expand(vnode_t *vnode)
 {
-        kmutex_unlock(&fs->s5f_mutex);
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        pframe_t *pf;
+        int ret;
+
+        if (!S5_IS_INLINE(inode))
+                return 0;
+        if (0 > (ret = pframe_get(&vnode->vn_mmobj, 0, &pf)))
+                return ret;
+        pframe_pin(pf);
+
+        inode->s5_type = S5_INODE_TYPE(inode);
+        memset(S5_INLINE_DATA(inode), 0, S5_INLINE_MAX);
+        s5_dirty_inode(fs, inode);
+        /* a page which was dirty while inline has no block reserved */
+        ret = pframe_is_dirty(pf) ? s5_reserve_block(vnode) : pframe_dirty(pf);
+        if (0 > ret) {
+                /* the page still has the data */
+                memcpy(S5_INLINE_DATA(inode), pf->pf_addr, S5_INLINE_MAX);
+                inode->s5_type |= S5_TYPE_INLINE;
+        }
+
+        pframe_unpin(pf);
+        return ret;
+}
+
+void
+s5_inline_read(vnode_t *vnode, off_t offset, void *pagebuf)
+{
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+
+        KASSERT(S5_IS_INLINE(inode));
+        memset(pagebuf, 0, PAGE_SIZE);
+        if (0 == offset)
+                memcpy(pagebuf, S5_INLINE_DATA(inode), MIN(inode->s5_size, S5_INLINE_MAX));
+}
+
+void
+s5_inline_write(vnode_t *vnode, off_t offset, const void *pagebuf)
+{
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        size_t len = (size_t) MIN(vnode->vn_len, (off_t) S5_INLINE_MAX);
+
+        KASSERT(S5_IS_INLINE(inode) && 0 == offset);
+        KASSERT(vnode->vn_len <= (off_t) S5_INLINE_MAX);
+        memcpy(S5_INLINE_DATA(inode), pagebuf, len);
+        memset(S5_INLINE_DATA(inode) + len, 0, S5_INLINE_MAX - len);
+        s5_dirty_inode(VNODE_TO_S5FS(vnode), inode);
 }
 
 
@@ -106,12 +362,47 @@ unlock_s5(s5fs_t *fs)
  * call to s5_seek_to_block().
  *
  * You will need pframe_dirty(), pframe_get(), memcpy().
+ *
+ * The bytes are copied straight into the vnode's pages (the same ones
+ * a mapping of the file uses); the file grows a page at a time, before
+ * each page is looked up, so that the page past the old end is filled
+ * like any other.
  */
 int
 s5_write_file(vnode_t *vnode, off_t seek, const char *bytes, size_t len)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_write_file");
-        return -1;
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        off_t end = seek + (off_t) len;
+        off_t pos, n, oldlen;
+        pframe_t *pf;
+        int ret = 0;
+
+        KASSERT(0 <= seek);
+
+        if (S5_IS_INLINE(inode) && end > (off_t) S5_INLINE_MAX
+            && 0 > (ret = s5_inline_expand(vnode)))
+                return ret;
+
+        for (pos = seek; pos < end; pos += n) {
+                n = MIN(end - pos, (off_t)(PAGE_SIZE - PAGE_OFFSET(pos)));
+
+                oldlen = vnode->vn_len;
+                if (pos + n > vnode->vn_len)
+                        vnode->vn_len = pos + n;
+                if (0 > (ret = pframe_get(&vnode->vn_mmobj, ADDR_TO_PN(pos), &pf))
+                    || 0 > (ret = pframe_dirty(pf))) {
+                        /* (nothing was written to the page) */
+                        vnode->vn_len = oldlen;
+                        break;
+                }
+                memcpy((char *) pf->pf_addr + PAGE_OFFSET(pos), bytes + (pos - seek), n);
+        }
+
+        if ((off_t) inode->s5_size != vnode->vn_len) {
+                inode->s5_size = vnode->vn_len;
+                s5_dirty_inode(VNODE_TO_S5FS(vnode), inode);
+        }
+        return (pos > seek) ? pos - seek : ret;
 }
 
 /*
@@ -133,36 +424,417 @@ s5_write_file(vnode_t *vnode, off_t seek, const char *bytes, size_t len)
  * data will be read than was requested.
  *
  * You probably want to use pframe_get(), memcpy().
+ *
+ * The bytes are copied straight out of the vnode's pages, with no
+ * buffer in between.
  */
 int
 s5_read_file(struct vnode *vnode, off_t seek, char *dest, size_t len)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_read_file");
-        return -1;
+        off_t end = MIN(seek + (off_t) len, vnode->vn_len);
+        off_t pos, n;
+        pframe_t *pf;
+        int ret;
+
+        KASSERT(0 <= seek);
+
+        for (pos = seek; pos < end; pos += n) {
+                n = MIN(end - pos, (off_t)(PAGE_SIZE - PAGE_OFFSET(pos)));
+
+                if (0 > (ret = pframe_get(&vnode->vn_mmobj, ADDR_TO_PN(pos), &pf)))
+                        return (pos > seek) ? pos - seek : ret;
+                memcpy(dest + (pos - seek), (char *) pf->pf_addr + PAGE_OFFSET(pos), n);
+        }
+        return MAX(0, end - seek);
+}
+
+/* The page of the file holding 'pos' if it is resident, once it is not
+ * busy */
+static pframe_t *
+s5_direct_page(vnode_t *vnode, off_t pos)
+{
+        pframe_t *pf;
+
+        while (NULL != (pf = pframe_get_resident(&vnode->vn_mmobj, ADDR_TO_PN(pos)))
+               && pframe_is_busy(pf))
+                pframe_wait_busy(pf);
+        return pf;
+}
+
+/*
+ * O_DIRECT versions of s5_read_file and s5_write_file, for whole blocks
+ * at a block boundary. A block whose page is resident is copied out of
+ * or into the page, which holds the newest data; the rest are moved
+ * straight between the disk and the caller's buffer, a run of blocks
+ * which are consecutive on disk at a time, without being cached. A page
+ * which is read in while a run is being written may have the old data,
+ * so the pages of the run are brought up to date afterwards.
+ */
+int
+s5_read_direct(vnode_t *vnode, off_t seek, char *dest, size_t len)
+{
+        blockdev_t *bd = VNODE_TO_S5FS(vnode)->s5f_bdev;
+        off_t end = MIN(seek + (off_t) len, vnode->vn_len);
+        off_t pos;
+        pframe_t *pf;
+        int block, ret;
+        uint32_t n;
+
+        KASSERT(0 <= seek && 0 == S5_DATA_OFFSET(seek) && 0 == S5_DATA_OFFSET(len));
+
+        /* an inline file is read through its page, there being no block */
+        if (S5_IS_INLINE(VNODE_TO_S5INODE(vnode)))
+                return s5_read_file(vnode, seek, dest, len);
+
+        for (pos = seek; pos < end; pos += (off_t) n * S5_BLOCK_SIZE) {
+                n = 1;
+                if (NULL != (pf = s5_direct_page(vnode, pos))) {
+                        memcpy(dest + (pos - seek), pf->pf_addr, S5_BLOCK_SIZE);
+                        continue;
+                }
+                if (0 > (block = s5_seek_to_block(vnode, pos, S5_MAP_LOOKUP)))
+                        return (pos > seek) ? pos - seek : block;
+                if (0 == block) {
+                        memset(dest + (pos - seek), 0, S5_BLOCK_SIZE);
+                        continue;
+                }
+
+                while (n < BLK_MAX_SEGS && pos + (off_t) n * S5_BLOCK_SIZE < end
+                       && NULL == pframe_get_resident(&vnode->vn_mmobj, ADDR_TO_PN(pos) + n)
+                       && block + (int) n == s5_seek_to_block(vnode, pos + (off_t) n * S5_BLOCK_SIZE,
+                                                              S5_MAP_LOOKUP))
+                        n++;
+                if (0 > (ret = blk_rw(bd, BLK_READ, dest + (pos - seek), block, n)))
+                        return (pos > seek) ? pos - seek : ret;
+        }
+        return MAX(0, end - seek);
+}
+
+int
+s5_write_direct(vnode_t *vnode, off_t seek, const char *bytes, size_t len)
+{
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        blockdev_t *bd = VNODE_TO_S5FS(vnode)->s5f_bdev;
+        off_t end = seek + (off_t) len;
+        off_t pos, oldlen;
+        pframe_t *pf;
+        int block, ret = 0;
+        uint32_t n, i;
+
+        KASSERT(0 <= seek && 0 == S5_DATA_OFFSET(seek) && 0 == S5_DATA_OFFSET(len));
+
+        /* whole blocks are always more than fits in the inode */
+        if (0 > (ret = s5_inline_expand(vnode)))
+                return ret;
+
+        for (pos = seek; pos < end; pos += (off_t) n * S5_BLOCK_SIZE) {
+                n = 1;
+                if (NULL != (pf = s5_direct_page(vnode, pos))) {
+                        /* as in s5_write_file */
+                        oldlen = vnode->vn_len;
+                        if (pos + S5_BLOCK_SIZE > vnode->vn_len)
+                                vnode->vn_len = pos + S5_BLOCK_SIZE;
+                        if (0 > (ret = pframe_dirty(pf))) {
+                                vnode->vn_len = oldlen;
+                                break;
+                        }
+                        memcpy(pf->pf_addr, bytes + (pos - seek), S5_BLOCK_SIZE);
+                        continue;
+                }
+                if (0 > (ret = block = s5_seek_to_block(vnode, pos, S5_MAP_ALLOC)))
+                        break;
+
+                while (n < BLK_MAX_SEGS && pos + (off_t) n * S5_BLOCK_SIZE < end
+                       && NULL == pframe_get_resident(&vnode->vn_mmobj, ADDR_TO_PN(pos) + n)
+                       && block + (int) n == s5_seek_to_block(vnode, pos + (off_t) n * S5_BLOCK_SIZE,
+                                                              S5_MAP_ALLOC))
+                        n++;
+                if (0 > (ret = blk_rw(bd, BLK_WRITE, (char *) bytes + (pos - seek), block, n)))
+                        break;
+                for (i = 0; i < n; i++) {
+                        if (NULL != (pf = s5_direct_page(vnode, pos + (off_t) i * S5_BLOCK_SIZE)))
+                                memcpy(pf->pf_addr, bytes + (pos - seek) + i * S5_BLOCK_SIZE,
+                                       S5_BLOCK_SIZE);
+                }
+                if (pos + (off_t) n * S5_BLOCK_SIZE > vnode->vn_len)
+                        vnode->vn_len = pos + (off_t) n * S5_BLOCK_SIZE;
+        }
+
+        if ((off_t) inode->s5_size != vnode->vn_len) {
+                inode->s5_size = vnode->vn_len;
+                s5_dirty_inode(VNODE_TO_S5FS(vnode), inode);
+        }
+        return (pos > seek) ? pos - seek : ret;
+}
+
+/*
+ * Walks the on-disk free block list, calling fn(fs, block, arg) for every
+ * block on it (including the blocks which hold the list itself, which are
+ * free too).
+ */
+static void
+s5_freelist_walk(s5fs_t *fs, void (*fn)(s5fs_t *fs, uint32_t block, void *arg),
+                 void *arg)
+{
+        s5_super_t *s = fs->s5f_super;
+        uint32_t next, i;
+        pframe_t *pf;
+
+        KASSERT(s->s5s_nfree < S5_NBLKS_PER_FNODE);
+
+        for (i = 0; i < s->s5s_nfree; i++)
+                fn(fs, s->s5s_free_blocks[i], arg);
+
+        next = s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1];
+        while ((uint32_t) -1 != next) {
+                uint32_t blocks[S5_NBLKS_PER_FNODE];
+
+                fn(fs, next, arg);
+
+                pframe_get(S5FS_TO_VMOBJ(fs), next, &pf);
+                KASSERT(pf);
+                memcpy(blocks, pf->pf_addr, sizeof(blocks));
+                for (i = 0; i < S5_NBLKS_PER_FNODE - 1; i++)
+                        fn(fs, blocks[i], arg);
+                next = blocks[S5_NBLKS_PER_FNODE - 1];
+        }
+}
+
+static void
+s5_freemap_max(s5fs_t *fs, uint32_t block, void *arg)
+{
+        uint32_t *max = (uint32_t *) arg;
+
+        if (block + 1 > *max)
+                *max = block + 1;
+}
+
+static void
+s5_freemap_mark(s5fs_t *fs, uint32_t block, void *arg)
+{
+        KASSERT(block < fs->s5f_freemap_nblocks);
+        KASSERT(!s5_freemap_test(fs, block) && "block is on the free list twice");
+        s5_freemap_set(fs, block);
+        fs->s5f_nfree++;
 }
 
 /*
- * Allocate a new disk-block off the block free list and return it. If
- * there are no free blocks, return -ENOSPC.
+ * Builds the in-core free block bitmap from the on-disk free list. Called
+ * once, by s5_maps_build's work item. The bitmap only needs to reach the highest free
+ * block, since no block above it can be freed without first having been
+ * allocated; it grows if a higher block is ever freed anyway.
+ *
+ * Returns 0 on success, -ENOMEM if the bitmap cannot be allocated.
+ */
+int
+s5_freemap_build(s5fs_t *fs)
+{
+        uint32_t nblocks = 1;
+
+        s5_freelist_walk(fs, s5_freemap_max, &nblocks);
+
+        fs->s5f_freemap = kmalloc(S5_FREEMAP_WORDS(nblocks) * sizeof(uint32_t));
+        if (NULL == fs->s5f_freemap)
+                return -ENOMEM;
+        memset(fs->s5f_freemap, 0, S5_FREEMAP_WORDS(nblocks) * sizeof(uint32_t));
+        fs->s5f_freemap_nblocks = S5_FREEMAP_WORDS(nblocks) << 5;
+        fs->s5f_nfree = 0;
+        fs->s5f_nreserved = 0;
+        fs->s5f_freemap_dirty = 0;
+
+        s5_freelist_walk(fs, s5_freemap_mark, NULL);
+        dprintf("%u free blocks below block %u\n", fs->s5f_nfree,
+                fs->s5f_freemap_nblocks);
+
+        return 0;
+}
+
+void
+s5_freemap_destroy(s5fs_t *fs)
+{
+        KASSERT(!fs->s5f_freemap_dirty && "free list was not written back");
+        kfree(fs->s5f_freemap);
+        fs->s5f_freemap = NULL;
+}
+
+/*
+ * Rewrites the on-disk free block list from the bitmap, if anything has
+ * been allocated or freed since it was last written. The blocks are
+ * pushed from the highest down, so the list hands out low blocks first
+ * to anything reading it. This dirties the superblock; the blocks
+ * holding the rest of the list are written out as they are filled in.
+ *
+ * s5f_block_mutex is dropped while a block of the list is read and
+ * written, so blocks can be allocated and freed meanwhile; that only
+ * leaves the bitmap dirty for the next sync. The block itself is kept
+ * out of the bitmap until it has been written, so that it cannot be
+ * handed out and written to by its new owner first. s5f_sync_mutex
+ * keeps two syncs from building the superblock's part of the list at
+ * once.
+ *
+ * This function may block.
+ */
+int
+s5_freemap_sync(s5fs_t *fs)
+{
+        s5_super_t *s = fs->s5f_super;
+        uint32_t blocks[S5_NBLKS_PER_FNODE];
+        uint32_t b;
+        pframe_t *pf;
+        int err, ret = 0, next;
+
+        if (0 > (err = s5_maps_wait(fs)))
+                return err;
+
+        kmutex_lock(&fs->s5f_sync_mutex);
+        kmutex_lock(&fs->s5f_block_mutex);
+
+        if (fs->s5f_freemap_dirty) {
+                fs->s5f_freemap_dirty = 0;
+                s->s5s_nfree = 0;
+                s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] = (uint32_t) -1;
+                for (b = fs->s5f_freemap_nblocks;
+                     0 <= (next = bitmap_find_prev_set(fs->s5f_freemap, b));) {
+                        b = (uint32_t) next;
+                        if ((S5_NBLKS_PER_FNODE - 1) != s->s5s_nfree) {
+                                s->s5s_free_blocks[s->s5s_nfree++] = b;
+                                continue;
+                        }
+
+                        /* the superblock is full, move its entries into
+                         * 'b' and make that the head of the list */
+                        memcpy(blocks, s->s5s_free_blocks, sizeof(blocks));
+                        s->s5s_nfree = 0;
+                        s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] = b;
+                        s5_freemap_clear(fs, b);
+                        fs->s5f_nfree--;
+                        kmutex_unlock(&fs->s5f_block_mutex);
+
+                        pframe_get(S5FS_TO_VMOBJ(fs), b, &pf);
+                        KASSERT(pf && "because never fails for block_device vm_objects");
+                        memcpy(pf->pf_addr, blocks, sizeof(blocks));
+                        pframe_dirty(pf);
+                        err = pframe_clean(pf);
+
+                        kmutex_lock(&fs->s5f_block_mutex);
+                        s5_freemap_set(fs, b);
+                        fs->s5f_nfree++;
+                        if (0 > err) {
+                                /* try again next time */
+                                fs->s5f_freemap_dirty = 1;
+                                ret = err;
+                        }
+                }
+                s5_dirty_super(fs);
+        }
+
+        kmutex_unlock(&fs->s5f_block_mutex);
+        kmutex_unlock(&fs->s5f_sync_mutex);
+        return ret;
+}
+
+/*
+ * Return the number of the first set bit at or after 'goal' in a bitmap
+ * of 'nbits' bits (a multiple of 32), wrapping around to the start, or
+ * -1 if there is none. Used for both the free block and the free inode
+ * bitmaps.
+ */
+static int
+s5_bitmap_find(const uint32_t *map, uint32_t nbits, uint32_t goal)
+{
+        int bit = bitmap_find_next_set(map, nbits, goal);
+
+        if (0 > bit)
+                bit = bitmap_find_next_set(map, nbits, 0);
+        return bit;
+}
+
+/*
+ * Allocate a new disk-block and return it. If there are no free blocks,
+ * return -ENOSPC.
  *
  * This will not initialize the contents of an allocated block; these
  * contents are undefined.
  *
- * If the super block's s5s_nfree is 0, you need to refill 
- * s5s_free_blocks and reset s5s_nfree.  You need to read the contents 
- * of this page using the pframe system in order to obtain the next set of
- * free block numbers.
+ * The first free block at or after 'goal' is used, so pass the block
+ * which precedes the one being allocated in the file (or 0 if there is
+ * none) to have files laid out contiguously on disk where possible.
  *
- * Don't forget to dirty the appropriate blocks!
+ * If 'reserved' is set, the block is one set aside by s5_reserve_block
+ * (which the caller has done the bookkeeping for); otherwise the blocks
+ * reserved for pages not yet written out are not handed out.
  *
- * You'll probably want to use lock_s5(), unlock_s5(), pframe_get(),
- * and s5_dirty_super()
+ * Only the in-core bitmap is updated; the on-disk free list is brought
+ * up to date by s5_freemap_sync.
  */
 static int
-s5_alloc_block(s5fs_t *fs)
+s5_alloc_block(s5fs_t *fs, int goal, int reserved)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_alloc_block");
-        return -1;
+        int blockno;
+
+        if (0 > (blockno = s5_maps_wait(fs)))
+                return blockno;
+
+        kmutex_lock(&fs->s5f_block_mutex);
+
+        if ((!reserved && fs->s5f_nfree <= fs->s5f_nreserved)
+            || 0 > (blockno = s5_bitmap_find(fs->s5f_freemap, fs->s5f_freemap_nblocks,
+                                             (uint32_t) goal))) {
+                kmutex_unlock(&fs->s5f_block_mutex);
+                return -ENOSPC;
+        }
+
+        if (reserved) {
+                KASSERT(0 < fs->s5f_nreserved);
+                fs->s5f_nreserved--;
+        }
+        s5_freemap_clear(fs, (uint32_t) blockno);
+        fs->s5f_nfree--;
+        fs->s5f_freemap_dirty = 1;
+
+        kmutex_unlock(&fs->s5f_block_mutex);
+
+        return blockno;
+}
+
+
+/*
+ * Sets a free block aside for a sparse page of the given file which has
+ * just been dirtied, so that a disk block can be picked for it when it
+ * is cleaned. Return -ENOSPC if every free block is already reserved.
+ */
+int
+s5_reserve_block(vnode_t *vnode)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        int ret;
+
+        if (0 > (ret = s5_maps_wait(fs)))
+                return ret;
+
+        kmutex_lock(&fs->s5f_block_mutex);
+        if (fs->s5f_nfree <= fs->s5f_nreserved) {
+                ret = -ENOSPC;
+        } else {
+                fs->s5f_nreserved++;
+                vnode->vn_nreserved++;
+        }
+        kmutex_unlock(&fs->s5f_block_mutex);
+        return ret;
+}
+
+/* Gives back the blocks reserved for a file whose pages will never be
+ * cleaned */
+static void
+s5_unreserve_blocks(vnode_t *vnode)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+
+        kmutex_lock(&fs->s5f_block_mutex);
+        KASSERT(vnode->vn_nreserved <= fs->s5f_nreserved);
+        fs->s5f_nreserved -= vnode->vn_nreserved;
+        vnode->vn_nreserved = 0;
+        kmutex_unlock(&fs->s5f_block_mutex);
 }
 
 
@@ -172,88 +844,439 @@ s5_alloc_block(s5fs_t *fs)
  *
  * This function may potentially block.
  *
- * The caller is responsible for ensuring that the block being placed on
- * the free list is actually free and is not resident.
+ * The caller is responsible for ensuring that the block being freed is
+ * actually in use and is not resident. Only the in-core bitmap is updated.
  */
 static void
 s5_free_block(s5fs_t *fs, int blockno)
 {
-        s5_super_t *s = fs->s5f_super;
+        uint32_t b = (uint32_t) blockno;
 
+        if (0 > s5_maps_wait(fs)) {
+                dbg(DBG_S5FS | DBG_ERROR, "no free block bitmap, "
+                    "leaking block %d\n", blockno);
+                return;
+        }
 
-        lock_s5(fs);
+        kmutex_lock(&fs->s5f_block_mutex);
 
-        KASSERT(S5_NBLKS_PER_FNODE > s->s5s_nfree);
+        while (b >= fs->s5f_freemap_nblocks) {
+                uint32_t nwords = S5_FREEMAP_WORDS(b + 1);
+                uint32_t *map;
+
+                /* kmalloc may have to reclaim memory, which can mean
+                 * writing pages out, so it is not called with the lock
+                 * held; the bitmap may have grown meanwhile */
+                kmutex_unlock(&fs->s5f_block_mutex);
+                map = kmalloc(nwords * sizeof(uint32_t));
+                kmutex_lock(&fs->s5f_block_mutex);
+
+                if (NULL == map) {
+                        dbg(DBG_S5FS | DBG_ERROR, "out of memory, "
+                            "leaking block %d\n", blockno);
+                        kmutex_unlock(&fs->s5f_block_mutex);
+                        return;
+                }
+                if (b < fs->s5f_freemap_nblocks) {
+                        kfree(map);
+                        break;
+                }
+                memset(map, 0, nwords * sizeof(uint32_t));
+                memcpy(map, fs->s5f_freemap,
+                       (fs->s5f_freemap_nblocks >> 5) * sizeof(uint32_t));
+                kfree(fs->s5f_freemap);
+                fs->s5f_freemap = map;
+                fs->s5f_freemap_nblocks = nwords << 5;
+        }
 
-        if ((S5_NBLKS_PER_FNODE - 1) == s->s5s_nfree) {
-                /* get the pframe where we will store the free block nums */
-                pframe_t *prev_free_blocks = NULL;
-                KASSERT(fs->s5f_bdev);
-                pframe_get(&fs->s5f_bdev->bd_mmobj, blockno, &prev_free_blocks);
-                KASSERT(prev_free_blocks->pf_addr);
+        KASSERT(!s5_freemap_test(fs, b) && "freeing a free block");
+        s5_freemap_set(fs, b);
+        fs->s5f_nfree++;
+        fs->s5f_freemap_dirty = 1;
 
-                /* copy from the superblock to the new block on disk */
-                memcpy(prev_free_blocks->pf_addr, (void *)(s->s5s_free_blocks),
-                       S5_NBLKS_PER_FNODE * sizeof(int));
-                pframe_dirty(prev_free_blocks);
+        kmutex_unlock(&fs->s5f_block_mutex);
+}
 
-                /* reset s->s5s_nfree and s->s5s_free_blocks */
-                s->s5s_nfree = 0;
-                s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] = blockno;
-        } else {
-                s->s5s_free_blocks[s->s5s_nfree++] = blockno;
+/*
+ * The in-core inode table: the inode blocks holding dirty inodes, with a
+ * bit for each dirty inode. An inode block's page is kept pinned while
+ * it is in the table, but is only dirtied when the table is written back
+ * (s5_inode_flush), so the page cache writes it once for all the inodes
+ * changed in the meantime rather than once each time pageoutd finds it
+ * dirty. The table is written back at sync and unmount time, before
+ * every journal commit, and a block at a time (the one dirtied longest
+ * ago) when it is full.
+ */
+typedef struct s5_iblock {
+        uint32_t            ib_block;
+        uint32_t            ib_dirty;       /* bit i: inode i of the block */
+        pframe_t           *ib_pf;          /* pinned */
+        list_link_t         ib_link;        /* link on s5f_itable */
+} s5_iblock_t;
+
+static slab_allocator_t *s5_iblock_allocator;
+
+static __attribute__((unused)) void
+s5_itable_init(void)
+{
+        s5_iblock_allocator = slab_allocator_create("s5iblock", sizeof(s5_iblock_t));
+        KASSERT(NULL != s5_iblock_allocator);
+}
+init_func(s5_itable_init);
+
+/* Dirties the page of an inode block in the table and drops it, unless
+ * the page is being cleaned right now, in which case it stays for next
+ * time */
+static int
+s5_iblock_writeback(s5fs_t *fs, s5_iblock_t *ib)
+{
+        int err;
+
+        if (pframe_is_busy(ib->ib_pf))
+                return -EBUSY;
+        err = pframe_dirty(ib->ib_pf);
+        KASSERT(!err && "shouldn\'t fail for a page belonging to a block device");
+        dprintf("writing back inode block %u (dirty inodes %08x)\n",
+                ib->ib_block, ib->ib_dirty);
+
+        pframe_unpin(ib->ib_pf);
+        list_remove(&ib->ib_link);
+        fs->s5f_itable_nblocks--;
+        slab_obj_free(s5_iblock_allocator, ib);
+        return 0;
+}
+
+/*
+ * Records that an inode has changed. The change is written back along
+ * with every other dirty inode in its block, see above.
+ *
+ * This function may block.
+ */
+void
+s5_dirty_inode(s5fs_t *fs, s5_inode_t *inode)
+{
+        uint32_t block = S5_INODE_BLOCK(fs->s5f_super, inode->s5_number);
+        s5_iblock_t *ib;
+        pframe_t *pf;
+        int err;
+
+        pframe_get(S5FS_TO_VMOBJ(fs), block, &pf);
+        KASSERT(pf);
+
+        /* nothing below blocks */
+        list_iterate_begin(&fs->s5f_itable, ib, s5_iblock_t, ib_link) {
+                if (ib->ib_block == block)
+                        goto found;
+        } list_iterate_end();
+
+        if (S5_ITABLE_MAX_BLOCKS <= fs->s5f_itable_nblocks) {
+                list_iterate_reverse(&fs->s5f_itable, ib, s5_iblock_t, ib_link) {
+                        if (0 == s5_iblock_writeback(fs, ib))
+                                goto room;
+                } list_iterate_end();
+        }
+room:
+        if (NULL == (ib = slab_obj_alloc(s5_iblock_allocator))) {
+                /* write it back on its own as it is */
+                err = pframe_dirty(pf);
+                KASSERT(!err && "shouldn\'t fail for a page belonging to a block device");
+                return;
         }
+        ib->ib_block = block;
+        ib->ib_dirty = 0;
+        ib->ib_pf = pf;
+        pframe_pin(pf);
+        list_insert_head(&fs->s5f_itable, &ib->ib_link);
+        fs->s5f_itable_nblocks++;
+
+found:
+        ib->ib_dirty |= 1U << S5_INODE_OFFSET(inode->s5_number);
+}
+
+/*
+ * Writes back the inode table: dirties the page of every inode block in
+ * it, once. A block whose page is being cleaned is waited for if 'wait'
+ * is set and left in the table otherwise (the caller may be the one
+ * cleaning it).
+ */
+void
+s5_inode_flush(s5fs_t *fs, int wait)
+{
+        s5_iblock_t *ib;
+
+restart:
+        list_iterate_begin(&fs->s5f_itable, ib, s5_iblock_t, ib_link) {
+                if (0 > s5_iblock_writeback(fs, ib) && wait) {
+                        sched_sleep_on(&ib->ib_pf->pf_waitq);
+                        goto restart;
+                }
+        } list_iterate_end();
+}
 
-        s5_dirty_super(fs);
+/*
+ * Writes back the block of the inode table holding 'inode', if it is
+ * there, waiting for its page if that is being cleaned. Used by fsync(2)
+ * to leave the rest of the table alone.
+ */
+void
+s5_inode_sync(s5fs_t *fs, s5_inode_t *inode)
+{
+        uint32_t block = S5_INODE_BLOCK(fs->s5f_super, inode->s5_number);
+        s5_iblock_t *ib;
 
-        unlock_s5(fs);
+restart:
+        list_iterate_begin(&fs->s5f_itable, ib, s5_iblock_t, ib_link) {
+                if (ib->ib_block != block)
+                        continue;
+                if (0 > s5_iblock_writeback(fs, ib)) {
+                        sched_sleep_on(&ib->ib_pf->pf_waitq);
+                        goto restart;
+                }
+                return;
+        } list_iterate_end();
 }
 
 /*
- * Creates a new inode from the free list and initializes its fields.
- * Uses S5_INODE_BLOCK to get the page from which to create the inode
+ * Builds the in-core free inode bitmap. Called once, by s5_maps_build's
+ * work item. The on-disk inode free list is only brought up to date
+ * lazily (see s5_imap_sync) and so may be stale after a crash; the
+ * inodes' types are what counts, so every inode block is read.
+ *
+ * Returns 0 on success, -ENOMEM if the bitmap cannot be allocated.
+ */
+int
+s5_imap_build(s5fs_t *fs)
+{
+        uint32_t ninodes = fs->s5f_super->s5s_num_inodes;
+        uint32_t nwords = S5_FREEMAP_WORDS(ninodes);
+        s5_inode_t *inodes;
+        pframe_t *pf;
+        uint32_t ino;
+
+        if (NULL == (fs->s5f_imap = kmalloc(nwords * sizeof(uint32_t))))
+                return -ENOMEM;
+        memset(fs->s5f_imap, 0, nwords * sizeof(uint32_t));
+        fs->s5f_imap_nbits = nwords << 5;
+        fs->s5f_nfree_inodes = 0;
+        fs->s5f_imap_dirty = 0;
+
+        for (ino = 0; ino < ninodes; ino++) {
+                pframe_get(S5FS_TO_VMOBJ(fs), S5_INODE_BLOCK(fs->s5f_super, ino), &pf);
+                KASSERT(pf && "because never fails for block_device vm_objects");
+                inodes = (s5_inode_t *) pf->pf_addr;
+                if (S5_TYPE_FREE == inodes[S5_INODE_OFFSET(ino)].s5_type) {
+                        s5_imap_set(fs, ino);
+                        fs->s5f_nfree_inodes++;
+                }
+        }
+        dprintf("%u of %u inodes free\n", fs->s5f_nfree_inodes, ninodes);
+
+        return 0;
+}
+
+void
+s5_imap_destroy(s5fs_t *fs)
+{
+        KASSERT(!fs->s5f_imap_dirty && "inode free list was not written back");
+        kfree(fs->s5f_imap);
+        fs->s5f_imap = NULL;
+}
+
+/* The work item queued by s5_maps_build */
+static void
+s5_maps_build_work(void *arg)
+{
+        s5fs_t *fs = (s5fs_t *) arg;
+        int err;
+
+        if (0 == (err = s5_freemap_build(fs))) {
+                if (0 > (err = s5_imap_build(fs)))
+                        s5_freemap_destroy(fs);
+        }
+        if (0 > err)
+                dbg(DBG_S5FS | DBG_ERROR, "cannot build the free bitmaps: "
+                    "%d, nothing can be allocated\n", err);
+
+        /* nothing touches fs after this, since a waiter may be about to
+         * unmount it. A work function is never preempted, so the waiters
+         * only run once it has returned */
+        fs->s5f_maps_err = err;
+        fs->s5f_maps_ready = 1;
+        sched_broadcast_on(&fs->s5f_maps_waitq);
+}
+
+/*
+ * Starts building the free block and free inode bitmaps in a worker
+ * thread; called by s5fs_mount once the journal has been replayed, so
+ * that mounting does not wait for the whole free list and inode table
+ * to be read.
+ */
+void
+s5_maps_build(s5fs_t *fs)
+{
+        fs->s5f_freemap = NULL;
+        fs->s5f_imap = NULL;
+        fs->s5f_maps_ready = 0;
+        fs->s5f_maps_err = 0;
+        sched_queue_init(&fs->s5f_maps_waitq);
+        work_init(&fs->s5f_maps_work, s5_maps_build_work, fs);
+        work_queue(&fs->s5f_maps_work);
+}
+
+/*
+ * Waits until the bitmaps have been built, which they usually have by
+ * the time anything is allocated.
+ *
+ * Returns 0 if they have been, or the error they could not be built
+ * with.
+ */
+int
+s5_maps_wait(s5fs_t *fs)
+{
+        while (!fs->s5f_maps_ready)
+                sched_sleep_on(&fs->s5f_maps_waitq);
+        return fs->s5f_maps_err;
+}
+
+/*
+ * Rewrites the on-disk inode free list from the bitmap, if an inode has
+ * been allocated or freed since it was last written: the free inodes are
+ * linked in ascending order from s5s_free_inode. Only the inodes whose
+ * link changes are dirtied, which the inode table then writes back a
+ * block at a time.
+ *
+ * This function may block.
+ */
+void
+s5_imap_sync(s5fs_t *fs)
+{
+        s5_super_t *s = fs->s5f_super;
+        uint32_t next = (uint32_t) -1;
+        uint32_t ino;
+        s5_inode_t *inode;
+        pframe_t *pf;
+
+        if (0 > s5_maps_wait(fs))
+                return;
+
+        kmutex_lock(&fs->s5f_sync_mutex);
+
+        if (fs->s5f_imap_dirty) {
+                fs->s5f_imap_dirty = 0;
+                for (ino = s->s5s_num_inodes; ino-- > 0;) {
+                        if (!s5_imap_test(fs, ino))
+                                continue;
+                        pframe_get(S5FS_TO_VMOBJ(fs), S5_INODE_BLOCK(fs->s5f_super, ino), &pf);
+                        KASSERT(pf && "because never fails for block_device vm_objects");
+                        /* an inode allocated while we waited sets
+                         * s5f_imap_dirty again, and is left out */
+                        if (!s5_imap_test(fs, ino))
+                                continue;
+
+                        inode = (s5_inode_t *) pf->pf_addr + S5_INODE_OFFSET(ino);
+                        if (inode->s5_next_free != next) {
+                                inode->s5_next_free = next;
+                                s5_dirty_inode(fs, inode);
+                        }
+                        next = ino;
+                }
+                if (s->s5s_free_inode != next) {
+                        s->s5s_free_inode = next;
+                        s5_dirty_super(fs);
+                }
+        }
+
+        kmutex_unlock(&fs->s5f_sync_mutex);
+}
+
+/*
+ * Picks the group for a new directory on a disk with groups, as FFS
+ * does: of the groups with at least the average number of free inodes,
+ * the one with the most free blocks, so that directories (and so the
+ * files in them) are spread over the disk rather than piling up in the
+ * parent's group. Returns the group's first inode.
+ *
+ * Called with s5f_inode_mutex held.
+ */
+static uint32_t
+s5_group_pick_dir(s5fs_t *fs)
+{
+        s5_super_t *s = fs->s5f_super;
+        uint32_t ngroups = S5_NGROUPS(s), g, start, end, best = 0;
+        uint32_t avg = MAX(fs->s5f_nfree_inodes / ngroups, 1);
+        int nfree, bestfree = -1;
+
+        kmutex_lock(&fs->s5f_block_mutex);
+        for (g = 0; g < ngroups; g++) {
+                start = g * s->s5s_group_ninodes;
+                end = MIN(start + s->s5s_group_ninodes, s->s5s_num_inodes);
+                if ((uint32_t) bitmap_weight_range(fs->s5f_imap, start, end - start) < avg)
+                        continue;
+                start = MIN(S5_GROUP_DATA(s, g), fs->s5f_freemap_nblocks);
+                end = MIN(S5_GROUP_START(s, g + 1), fs->s5f_freemap_nblocks);
+                nfree = bitmap_weight_range(fs->s5f_freemap, start, end - start);
+                if (nfree > bestfree) {
+                        bestfree = nfree;
+                        best = g;
+                }
+        }
+        kmutex_unlock(&fs->s5f_block_mutex);
+        return best * s->s5s_group_ninodes;
+}
+
+/*
+ * Creates a new inode and initializes its fields. The free inode bitmap
+ * is searched from the start of the inode block holding 'near' (pass
+ * the parent directory's inode number), so that inodes created together
+ * share blocks and, on a disk with groups, files go in their
+ * directory's group; a new directory is put in a group picked by
+ * s5_group_pick_dir instead. Uses S5_INODE_BLOCK to get the page from
+ * which to create the inode.
  *
  * This function may block.
  */
 int
-s5_alloc_inode(fs_t *fs, uint16_t type, devid_t devid)
+s5_alloc_inode(fs_t *fs, uint16_t type, devid_t devid, ino_t near)
 {
         s5fs_t *s5fs = FS_TO_S5FS(fs);
         pframe_t *inodep;
         s5_inode_t *inode;
-        int ret = -1;
+        int ino;
 
         KASSERT((S5_TYPE_DATA == type)
                 || (S5_TYPE_DIR == type)
                 || (S5_TYPE_CHR == type)
                 || (S5_TYPE_BLK == type));
 
+        /* new files start out in their inodes */
+        if (S5_TYPE_DATA == type && S5_HAS_INLINE(s5fs->s5f_super))
+                type |= S5_TYPE_INLINE;
 
-        lock_s5(s5fs);
+        if (0 > (ino = s5_maps_wait(s5fs)))
+                return ino;
 
-        if (s5fs->s5f_super->s5s_free_inode == (uint32_t) -1) {
-                unlock_s5(s5fs);
+        kmutex_lock(&s5fs->s5f_inode_mutex);
+        if (S5_TYPE_DIR == type && S5_HAS_GROUPS(s5fs->s5f_super))
+                near = (ino_t) s5_group_pick_dir(s5fs);
+        ino = s5_bitmap_find(s5fs->s5f_imap, s5fs->s5f_imap_nbits,
+                             (uint32_t) near - S5_INODE_OFFSET((uint32_t) near));
+        if (0 > ino) {
+                kmutex_unlock(&s5fs->s5f_inode_mutex);
                 return -ENOSPC;
         }
+        s5_imap_clear(s5fs, (uint32_t) ino);
+        s5fs->s5f_nfree_inodes--;
+        s5fs->s5f_imap_dirty = 1;
+        kmutex_unlock(&s5fs->s5f_inode_mutex);
 
-        pframe_get(&s5fs->s5f_bdev->bd_mmobj,
-                   S5_INODE_BLOCK(s5fs->s5f_super->s5s_free_inode),
-                   &inodep);
+        pframe_get(S5FS_TO_VMOBJ(s5fs), S5_INODE_BLOCK(s5fs->s5f_super, ino), &inodep);
         KASSERT(inodep);
-
-        inode = (s5_inode_t *)(inodep->pf_addr)
-                + S5_INODE_OFFSET(s5fs->s5f_super->s5s_free_inode);
-
-        KASSERT(inode->s5_number == s5fs->s5f_super->s5s_free_inode);
-
-        ret = inode->s5_number;
-
-        /* reset s5s_free_inode; remove the inode from the inode free list: */
-        s5fs->s5f_super->s5s_free_inode = inode->s5_next_free;
         pframe_pin(inodep);
-        s5_dirty_super(s5fs);
-        pframe_unpin(inodep);
 
+        inode = (s5_inode_t *)(inodep->pf_addr) + S5_INODE_OFFSET(ino);
+
+        KASSERT(inode->s5_number == (uint32_t) ino);
+        KASSERT(S5_TYPE_FREE == inode->s5_type);
 
         /* init the newly-allocated inode: */
         inode->s5_size = 0;
@@ -266,10 +1289,9 @@ s5_alloc_inode(fs_t *fs, uint16_t type, devid_t devid)
                 inode->s5_indirect_block = 0;
 
         s5_dirty_inode(s5fs, inode);
+        pframe_unpin(inodep);
 
-        unlock_s5(s5fs);
-
-        return ret;
+        return ino;
 }
 
 
@@ -287,17 +1309,26 @@ s5_alloc_inode(fs_t *fs, uint16_t type, devid_t devid)
 void
 s5_free_inode(vnode_t *vnode)
 {
-        uint32_t i;
+        pframe_t *xpf;
+        uint32_t i, ndirect;
         s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
         s5fs_t *fs = VNODE_TO_S5FS(vnode);
 
+        /* an inline file's data is not block pointers, and goes with it */
+        if (S5_IS_INLINE(inode)) {
+                memset(S5_INLINE_DATA(inode), 0, S5_INLINE_MAX);
+                inode->s5_type = S5_INODE_TYPE(inode);
+        }
+
         KASSERT((S5_TYPE_DATA == inode->s5_type)
                 || (S5_TYPE_DIR == inode->s5_type)
                 || (S5_TYPE_CHR == inode->s5_type)
                 || (S5_TYPE_BLK == inode->s5_type));
 
-        /* free any direct blocks */
-        for (i = 0; i < S5_NDIRECT_BLOCKS; ++i) {
+        /* free any direct blocks (on a S5_LARGEFILE_VERSION file system
+         * the last slot is the double-indirect block, freed below) */
+        ndirect = S5_HAS_DINDIRECT(fs->s5f_super) ? S5_DINDIRECT_SLOT : S5_NDIRECT_BLOCKS;
+        for (i = 0; i < ndirect; ++i) {
                 if (inode->s5_direct_blocks[i]) {
                         dprintf("freeing block %d\n", inode->s5_direct_blocks[i]);
                         s5_free_block(fs, inode->s5_direct_blocks[i]);
@@ -307,6 +1338,10 @@ s5_free_inode(vnode_t *vnode)
                 }
         }
 
+        /* an indexed directory's s5_indirect_block holds its index */
+        if (S5_TYPE_DIR == inode->s5_type && NULL != (xpf = s5_dirindex_get(vnode)))
+                s5_dirindex_drop(vnode, xpf);
+
         if (((S5_TYPE_DATA == inode->s5_type)
              || (S5_TYPE_DIR == inode->s5_type))
             && inode->s5_indirect_block) {
@@ -333,17 +1368,299 @@ s5_free_inode(vnode_t *vnode)
                 s5_free_block(fs, inode->s5_indirect_block);
         }
 
+        if (((S5_TYPE_DATA == inode->s5_type)
+             || (S5_TYPE_DIR == inode->s5_type))
+            && S5_NDIRECT_BLOCKS != ndirect
+            && inode->s5_direct_blocks[S5_DINDIRECT_SLOT]) {
+                pframe_t *dbp, *ibp;
+                uint32_t *d, *b, j;
+
+                pframe_get(S5FS_TO_VMOBJ(fs),
+                           (unsigned)inode->s5_direct_blocks[S5_DINDIRECT_SLOT],
+                           &dbp);
+                KASSERT(dbp
+                        && "because never fails for block_device "
+                        "vm_objects");
+                pframe_pin(dbp);
+
+                d = (uint32_t *)(dbp->pf_addr);
+                for (i = 0; i < S5_NIDIRECT_BLOCKS; ++i) {
+                        if (!d[i])
+                                continue;
+                        pframe_get(S5FS_TO_VMOBJ(fs), d[i], &ibp);
+                        KASSERT(ibp
+                                && "because never fails for block_device "
+                                "vm_objects");
+                        pframe_pin(ibp);
+                        b = (uint32_t *)(ibp->pf_addr);
+                        for (j = 0; j < S5_NIDIRECT_BLOCKS; ++j) {
+                                if (b[j])
+                                        s5_free_block(fs, b[j]);
+                        }
+                        pframe_unpin(ibp);
+                        s5_free_block(fs, d[i]);
+                        sched_cond_resched();
+                }
+
+                pframe_unpin(dbp);
+
+                s5_free_block(fs, inode->s5_direct_blocks[S5_DINDIRECT_SLOT]);
+                inode->s5_direct_blocks[S5_DINDIRECT_SLOT] = 0;
+        }
+        vnode->vn_map_nblocks = 0;
+        s5_unreserve_blocks(vnode);
+
         inode->s5_indirect_block = 0;
         inode->s5_type = S5_TYPE_FREE;
         s5_dirty_inode(fs, inode);
 
-        lock_s5(fs);
-        inode->s5_next_free = fs->s5f_super->s5s_free_inode;
-        fs->s5f_super->s5s_free_inode = inode->s5_number;
-        unlock_s5(fs);
+        /* the inode is linked into the on-disk free list by s5_imap_sync
+         * (and is found free by the next mount's s5_imap_build without) */
+        if (0 > s5_maps_wait(fs))
+                return;
+        kmutex_lock(&fs->s5f_inode_mutex);
+        KASSERT(!s5_imap_test(fs, inode->s5_number) && "freeing a free inode");
+        s5_imap_set(fs, inode->s5_number);
+        fs->s5f_nfree_inodes++;
+        fs->s5f_imap_dirty = 1;
+        kmutex_unlock(&fs->s5f_inode_mutex);
+}
+
+/*
+ * Directory hash indexes (S5_INDEXED_VERSION and later, see s5fs.h):
+ *
+ * A directory gets an index once it has S5_DIRINDEX_MIN entries (below
+ * that a linear search only reads a block or so) and loses it again once
+ * it has S5_DIRINDEX_MAX. s5_find_dirent, s5_remove_dirent and s5_link
+ * keep it up to date; nothing else changes directory entries.
+ */
+#define S5_DIRINDEX_MIN         S5_DIRENTS_PER_BLOCK
+
+/* where probing for a slot (or a hash) starts */
+#define S5_DIRINDEX_HOME(slot)  ((S5_DIRINDEX_HASH(slot) >> 16) % S5_DIRINDEX_NSLOTS)
+
+static uint32_t
+s5_name_hash(const char *name, size_t namelen)
+{
+        uint32_t h = 2166136261U;       /* FNV-1a */
+        size_t i;
+
+        for (i = 0; i < namelen; i++) {
+                h ^= (unsigned char) name[i];
+                h *= 16777619U;
+        }
+        return h;
+}
+
+/*
+ * Returns the pinned page holding the directory's index, or NULL if it has
+ * none. The caller must unpin it (and dirty it, if it changed the index).
+ * A directory which has outgrown its direct blocks uses
+ * s5_indirect_block as an indirect block; the magic number tells the two
+ * apart.
+ */
+static pframe_t *
+s5_dirindex_get(vnode_t *dir)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(dir);
+        s5_inode_t *inode = VNODE_TO_S5INODE(dir);
+        pframe_t *pf;
+
+        if (!S5_HAS_DIRINDEX(fs->s5f_super)
+            || S5_TYPE_DIR != inode->s5_type || 0 == inode->s5_indirect_block)
+                return NULL;
+        if (0 > pframe_get(S5FS_TO_VMOBJ(fs), inode->s5_indirect_block, &pf))
+                return NULL;
+        if (S5_DIRINDEX_MAGIC != ((s5_dirindex_t *) pf->pf_addr)->s5x_magic)
+                return NULL;
+        pframe_pin(pf);
+        return pf;
+}
+
+/* Frees a directory's index, given its pinned page from s5_dirindex_get */
+static void
+s5_dirindex_drop(vnode_t *dir, pframe_t *xpf)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(dir);
+        s5_inode_t *inode = VNODE_TO_S5INODE(dir);
+
+        /* so that the block is not mistaken for an index if it becomes
+         * someone's indirect block */
+        ((s5_dirindex_t *) xpf->pf_addr)->s5x_magic = 0;
+        pframe_dirty(xpf);
+        pframe_unpin(xpf);
 
+        s5_free_block(fs, inode->s5_indirect_block);
+        inode->s5_indirect_block = 0;
         s5_dirty_inode(fs, inode);
-        s5_dirty_super(fs);
+}
+
+static void
+s5_dirindex_insert(s5_dirindex_t *x, const char *name, size_t namelen, uint32_t entry)
+{
+        uint32_t h = S5_DIRINDEX_HASH(s5_name_hash(name, namelen));
+        uint32_t pos;
+
+        KASSERT(x->s5x_nentries < S5_DIRINDEX_NSLOTS);
+        for (pos = S5_DIRINDEX_HOME(h); 0 != x->s5x_slots[pos];
+             pos = (pos + 1) % S5_DIRINDEX_NSLOTS)
+                ;
+        x->s5x_slots[pos] = h | (entry + 1);
+        x->s5x_nentries++;
+}
+
+/*
+ * Empties a slot, moving later slots of the same probe sequence back so
+ * that no probe stops short of them (there are no tombstones).
+ */
+static void
+s5_dirindex_delete(s5_dirindex_t *x, uint32_t hole)
+{
+        uint32_t probe;
+
+        x->s5x_slots[hole] = 0;
+        x->s5x_nentries--;
+        for (probe = (hole + 1) % S5_DIRINDEX_NSLOTS; 0 != x->s5x_slots[probe];
+             probe = (probe + 1) % S5_DIRINDEX_NSLOTS) {
+                uint32_t home = S5_DIRINDEX_HOME(x->s5x_slots[probe]);
+
+                /* it can fill the hole unless its home is in (hole, probe] */
+                if ((hole < probe) ? (home <= hole || probe < home)
+                    : (home <= hole && probe < home)) {
+                        x->s5x_slots[hole] = x->s5x_slots[probe];
+                        x->s5x_slots[probe] = 0;
+                        hole = probe;
+                }
+        }
+}
+
+/* Points the slot of entry number 'from', named 'name', at entry 'to' */
+static void
+s5_dirindex_renumber(s5_dirindex_t *x, const char *name, size_t namelen,
+                     uint32_t from, uint32_t to)
+{
+        uint32_t h = S5_DIRINDEX_HASH(s5_name_hash(name, namelen));
+        uint32_t pos;
+
+        for (pos = S5_DIRINDEX_HOME(h); 0 != x->s5x_slots[pos];
+             pos = (pos + 1) % S5_DIRINDEX_NSLOTS) {
+                if (x->s5x_slots[pos] == (h | (from + 1))) {
+                        x->s5x_slots[pos] = h | (to + 1);
+                        return;
+                }
+        }
+        panic("s5fs: entry %u of a directory is missing from its index\n", from);
+}
+
+/* Reads entry number 'entry' of a directory */
+static int
+s5_read_dirent(vnode_t *dir, uint32_t entry, s5_dirent_t *d)
+{
+        int ret;
+
+        ret = s5_read_file(dir, entry * sizeof(s5_dirent_t), (char *) d,
+                           sizeof(s5_dirent_t));
+        if (0 > ret)
+                return ret;
+        if (sizeof(s5_dirent_t) != (size_t) ret)
+                return -EIO;
+        d->s5d_name[S5_NAME_LEN - 1] = '\0';
+        return 0;
+}
+
+/*
+ * Finds the entry named 'name' in a directory, through its index if
+ * 'xpf' is its index page and by reading every entry otherwise. Sets
+ * *entryp to the entry's number, *d to its contents and, if there is an
+ * index, *posp to its slot. Returns 0, -ENOENT or another -errno.
+ */
+static int
+s5_locate_dirent(vnode_t *dir, pframe_t *xpf, const char *name, size_t namelen,
+                 uint32_t *entryp, uint32_t *posp, s5_dirent_t *d)
+{
+        uint32_t entry, nentries;
+        int ret;
+
+        if (NULL != xpf) {
+                s5_dirindex_t *x = (s5_dirindex_t *) xpf->pf_addr;
+                uint32_t h = S5_DIRINDEX_HASH(s5_name_hash(name, namelen));
+                uint32_t pos;
+
+                for (pos = S5_DIRINDEX_HOME(h); 0 != x->s5x_slots[pos];
+                     pos = (pos + 1) % S5_DIRINDEX_NSLOTS) {
+                        if (S5_DIRINDEX_HASH(x->s5x_slots[pos]) != h)
+                                continue;
+                        entry = S5_DIRINDEX_ENTRY(x->s5x_slots[pos]) - 1;
+                        if (0 > (ret = s5_read_dirent(dir, entry, d)))
+                                return ret;
+                        if (name_match(d->s5d_name, name, namelen)) {
+                                *entryp = entry;
+                                *posp = pos;
+                                return 0;
+                        }
+                }
+                return -ENOENT;
+        }
+
+        nentries = dir->vn_len / sizeof(s5_dirent_t);
+        for (entry = 0; entry < nentries; entry++) {
+                if (0 > (ret = s5_read_dirent(dir, entry, d)))
+                        return ret;
+                if (name_match(d->s5d_name, name, namelen)) {
+                        *entryp = entry;
+                        return 0;
+                }
+        }
+        return -ENOENT;
+}
+
+/*
+ * Gives a directory which has none an index of its existing entries. If
+ * that fails for want of space, the directory just goes on being
+ * searched linearly.
+ */
+static void
+s5_dirindex_build(vnode_t *dir)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(dir);
+        s5_inode_t *inode = VNODE_TO_S5INODE(dir);
+        uint32_t entry, nentries = dir->vn_len / sizeof(s5_dirent_t);
+        s5_dirindex_t *x;
+        s5_dirent_t d;
+        pframe_t *xpf;
+        int block;
+
+        KASSERT(S5_HAS_DIRINDEX(fs->s5f_super));
+        KASSERT(S5_TYPE_DIR == inode->s5_type && 0 == inode->s5_indirect_block);
+
+        if (S5_DIRINDEX_MAX <= nentries)
+                return;
+        if (0 > (block = s5_alloc_block(fs, inode->s5_direct_blocks[0], 0)))
+                return;
+
+        pframe_get(S5FS_TO_VMOBJ(fs), block, &xpf);
+        KASSERT(xpf && "because never fails for block_device vm_objects");
+        pframe_pin(xpf);
+
+        x = (s5_dirindex_t *) xpf->pf_addr;
+        memset(x, 0, sizeof(*x));
+        x->s5x_magic = S5_DIRINDEX_MAGIC;
+        for (entry = 0; entry < nentries; entry++) {
+                if (0 > s5_read_dirent(dir, entry, &d)) {
+                        x->s5x_magic = 0;
+                        pframe_unpin(xpf);
+                        s5_free_block(fs, block);
+                        return;
+                }
+                if ('\0' != d.s5d_name[0])
+                        s5_dirindex_insert(x, d.s5d_name, strlen(d.s5d_name), entry);
+        }
+
+        pframe_dirty(xpf);
+        pframe_unpin(xpf);
+        inode->s5_indirect_block = block;
+        s5_dirty_inode(fs, inode);
+        dprintf("indexed the %u entries of directory %u\n", nentries, inode->s5_number);
 }
 
 /*
@@ -351,16 +1668,21 @@ s5_free_inode(vnode_t *vnode)
  * and return its inode number. If there is no entry with the given
  * name, return -ENOENT.
  *
- * You'll probably want to use s5_read_file and name_match
- *
- * You can either read one dirent at a time or optimize and read more.
- * Either is fine.
+ * If the directory has an index, only the entries whose hashes match
+ * the name are read.
  */
 int
 s5_find_dirent(vnode_t *vnode, const char *name, size_t namelen)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_find_dirent");
-        return -1;
+        pframe_t *xpf = s5_dirindex_get(vnode);
+        uint32_t entry, pos;
+        s5_dirent_t d;
+        int ret;
+
+        ret = s5_locate_dirent(vnode, xpf, name, namelen, &entry, &pos, &d);
+        if (NULL != xpf)
+                pframe_unpin(xpf);
+        return (0 > ret) ? ret : (int) d.s5d_inode;
 }
 
 /*
@@ -369,25 +1691,61 @@ s5_find_dirent(vnode_t *vnode, const char *name, size_t namelen)
  * -ENOENT.
  *
  * In order to ensure that the directory entries are contiguous in the
- * directory file, you will need to move the last directory entry into
- * the remove dirent's place.
+ * directory file, the last directory entry is moved into the removed
+ * dirent's place (and renumbered in the index, if there is one).
  *
  * When this function returns, the inode refcount on the removed file
- * should be decremented.
- *
- * It would be a nice extension to free blocks from the end of the
- * directory file which are no longer needed.
- *
- * Don't forget to dirty appropriate blocks!
- *
- * You probably want to use vget(), vput(), s5_read_file(),
- * s5_write_file(), and s5_dirty_inode().
+ * has been decremented.
  */
 int
 s5_remove_dirent(vnode_t *vnode, const char *name, size_t namelen)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_remove_dirent");
-        return -1;
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        pframe_t *xpf = s5_dirindex_get(vnode);
+        uint32_t entry, pos, last;
+        s5_dirent_t d, moved;
+        vnode_t *child;
+        int ret;
+
+        if (0 > (ret = s5_locate_dirent(vnode, xpf, name, namelen, &entry, &pos, &d)))
+                goto out;
+
+        last = vnode->vn_len / sizeof(s5_dirent_t) - 1;
+        if (entry != last) {
+                if (0 > (ret = s5_read_dirent(vnode, last, &moved)))
+                        goto out;
+                ret = s5_write_file(vnode, entry * sizeof(s5_dirent_t),
+                                    (char *) &moved, sizeof(moved));
+                if (0 > ret)
+                        goto out;
+        }
+        if (NULL != xpf) {
+                s5_dirindex_t *x = (s5_dirindex_t *) xpf->pf_addr;
+
+                s5_dirindex_delete(x, pos);
+                /* (unused entries left by other tools are not indexed) */
+                if (entry != last && '\0' != moved.s5d_name[0])
+                        s5_dirindex_renumber(x, moved.s5d_name, strlen(moved.s5d_name),
+                                             last, entry);
+                pframe_dirty(xpf);
+        }
+
+        inode->s5_size -= sizeof(s5_dirent_t);
+        vnode->vn_len = inode->s5_size;
+        s5_dirty_inode(fs, inode);
+
+        child = vget(vnode->vn_fs, d.s5d_inode);
+        VNODE_TO_S5INODE(child)->s5_linkcount--;
+        s5_dirty_inode(fs, VNODE_TO_S5INODE(child));
+        vput(child);
+        s5_journal_touch(fs);
+        ret = 0;
+
+out:
+        if (NULL != xpf)
+                pframe_unpin(xpf);
+        return ret;
 }
 
 /*
@@ -395,17 +1753,55 @@ s5_remove_dirent(vnode_t *vnode, const char *name, size_t namelen)
  * refers to the same file as 'child'.
  *
  * When this function returns, the inode refcount on the file that was linked to
- * should be incremented.
+ * has been incremented.
  *
- * Remember to incrament the ref counts appropriately
- *
- * You probably want to use s5_find_dirent(), s5_write_file(), and s5_dirty_inode().
+ * The new entry goes at the end of the directory, and into its index if
+ * it has one; a directory which has just become big enough gets one.
  */
 int
 s5_link(vnode_t *parent, vnode_t *child, const char *name, size_t namelen)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_link");
-        return -1;
+        s5fs_t *fs = VNODE_TO_S5FS(parent);
+        s5_inode_t *cinode = VNODE_TO_S5INODE(child);
+        uint32_t entry = parent->vn_len / sizeof(s5_dirent_t);
+        s5_dirent_t d;
+        pframe_t *xpf;
+        int ret;
+
+        if (S5_NAME_LEN <= namelen)
+                return -ENAMETOOLONG;
+        if (0 <= (ret = s5_find_dirent(parent, name, namelen)))
+                return -EEXIST;
+        if (-ENOENT != ret)
+                return ret;
+
+        memset(&d, 0, sizeof(d));
+        d.s5d_inode = child->vn_vno;
+        memcpy(d.s5d_name, name, namelen);
+        ret = s5_write_file(parent, entry * sizeof(s5_dirent_t), (char *) &d, sizeof(d));
+        if (0 > ret)
+                return ret;
+
+        cinode->s5_linkcount++;
+        s5_dirty_inode(fs, cinode);
+        s5_journal_touch(fs);
+
+        if (NULL != (xpf = s5_dirindex_get(parent))) {
+                s5_dirindex_t *x = (s5_dirindex_t *) xpf->pf_addr;
+
+                if (S5_DIRINDEX_MAX <= x->s5x_nentries + 1) {
+                        s5_dirindex_drop(parent, xpf);
+                } else {
+                        s5_dirindex_insert(x, name, namelen, entry);
+                        pframe_dirty(xpf);
+                        pframe_unpin(xpf);
+                }
+        } else if (S5_HAS_DIRINDEX(fs->s5f_super)
+                   && S5_DIRINDEX_MIN <= entry + 1 && entry + 1 < S5_DIRINDEX_MAX
+                   && 0 == VNODE_TO_S5INODE(parent)->s5_indirect_block) {
+                s5_dirindex_build(parent);
+        }
+        return 0;
 }
 
 /*
@@ -416,10 +1812,14 @@ s5_link(vnode_t *parent, vnode_t *child, const char *name, size_t namelen)
  * This is only used by s5fs_stat().
  *
  * You'll probably want to use pframe_get().
+ *
+ * An inline file has none.
  */
 int
 s5_inode_blocks(vnode_t *vnode)
 {
+        if (S5_IS_INLINE(VNODE_TO_S5INODE(vnode)))
+                return 0;
         NOT_YET_IMPLEMENTED("S5FS: s5_inode_blocks");
         return -1;
 }
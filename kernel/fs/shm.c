@@ -0,0 +1,315 @@
+#include "kernel.h"
+#include "errno.h"
+#include "globals.h"
+#include "config.h"
+
+#include "fs/fcntl.h"
+#include "fs/file.h"
+#include "fs/open.h"
+#include "fs/shm.h"
+#include "fs/stat.h"
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+
+#include "mm/mm.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+
+#include "vm/anon.h"
+#include "vm/vmmap.h"
+
+/*
+ * Named shared memory, as for shm_open(3). An object is a vnode of
+ * shmfs, which like aiofs is never mounted, and its pages are those of
+ * an anonymous object: the vnode's mmap hands out that one object, so
+ * each process which maps the name MAP_SHARED has the same pages in its
+ * address space and nothing is copied between them. Nothing but swap
+ * is behind them, so unlike a shared mapping of a file on s5fs they
+ * are never written back to a disk. read and write reach the same
+ * pages, through the page cache.
+ *
+ * The names are in shm_list, which holds a reference to each named
+ * vnode. shm_unlink drops it, after which the object lasts as long as
+ * it is open, and its pages as long as they are mapped. There is no
+ * ftruncate: an object is as long as it has been written or mapped,
+ * and reads as zeros where it has not been written.
+ */
+
+typedef struct shm {
+        list_link_t     sh_link;        /* on shm_list while it is named */
+        char            sh_name[NAME_LEN + 1];
+        vnode_t        *sh_vnode;
+        mmobj_t        *sh_obj;         /* the anonymous object of its pages */
+} shm_t;
+
+#define VNODE_TO_SHM(vn)        ((shm_t *)((vn)->vn_i))
+
+static void shm_read_vnode(vnode_t *vnode);
+static void shm_delete_vnode(vnode_t *vnode);
+static int  shm_query_vnode(vnode_t *vnode);
+
+static fs_ops_t shm_fsops = {
+        .read_vnode = shm_read_vnode,
+        .delete_vnode = shm_delete_vnode,
+        .query_vnode = shm_query_vnode,
+        .umount = NULL
+};
+
+static fs_t shm_fs = {
+        .fs_dev = "shm",
+        .fs_type = "shm",
+        .fs_op = &shm_fsops,
+        .fs_root = NULL,
+        .fs_i = NULL
+};
+
+static int shm_read(vnode_t *vnode, off_t offset, void *buf, size_t len);
+static int shm_write(vnode_t *vnode, off_t offset, const void *buf, size_t len);
+static int shm_mmap(vnode_t *vnode, vmarea_t *vma, mmobj_t **ret);
+static int shm_stat(vnode_t *vnode, struct stat *ss);
+
+static vnode_ops_t shm_vops = {
+        .read = shm_read,
+        .write = shm_write,
+        .mmap = shm_mmap,
+        .stat = shm_stat
+};
+
+static slab_allocator_t *shm_allocator = NULL;
+static list_t shm_list;
+static int next_shmno = 0;
+
+static __attribute__((unused)) void
+shm_init(void)
+{
+        shm_allocator = slab_allocator_create("shm", sizeof(shm_t));
+        KASSERT(NULL != shm_allocator);
+        list_init(&shm_list);
+}
+init_func(shm_init);
+init_depends(vfs_init);
+
+/* A name is a '/' and up to NAME_LEN characters, none of them a '/' */
+static int
+shm_name_check(const char *name)
+{
+        size_t len;
+
+        if ('/' != name[0] || NULL != strchr(name + 1, '/'))
+                return -EINVAL;
+        if (0 == (len = strlen(name + 1)))
+                return -EINVAL;
+        if (NAME_LEN < len)
+                return -ENAMETOOLONG;
+        return 0;
+}
+
+static shm_t *
+shm_lookup(const char *name)
+{
+        shm_t *sh;
+
+        list_iterate_begin(&shm_list, sh, shm_t, sh_link) {
+                if (0 == strcmp(sh->sh_name, name))
+                        return sh;
+        } list_iterate_end();
+        return NULL;
+}
+
+/* Makes the object called name, and returns its vnode with a reference
+ * for the caller as well as the one shm_list holds */
+static int
+shm_create(const char *name, vnode_t **res)
+{
+        vnode_t *vn;
+        shm_t *sh;
+
+        if (NULL == (sh = slab_obj_alloc(shm_allocator)))
+                return -ENOMEM;
+        if (NULL == (sh->sh_obj = anon_create())) {
+                slab_obj_free(shm_allocator, sh);
+                return -ENOMEM;
+        }
+        strcpy(sh->sh_name, name);
+
+        if (NULL == (vn = vget(&shm_fs, next_shmno++))) {
+                sh->sh_obj->mmo_ops->put(sh->sh_obj);
+                slab_obj_free(shm_allocator, sh);
+                return -ENOMEM;
+        }
+        KASSERT(NULL == vn->vn_i);
+        vn->vn_i = sh;
+        sh->sh_vnode = vn;
+        list_insert_tail(&shm_list, &sh->sh_link);
+        vref(vn);
+        *res = vn;
+        return 0;
+}
+
+int
+do_shm_open(const char *name, int oflags)
+{
+        vnode_t *vn;
+        file_t *file;
+        shm_t *sh;
+        int fd, mode, ret;
+
+        switch (oflags & (O_WRONLY | O_RDWR)) {
+                case O_RDONLY:
+                        mode = FMODE_READ;
+                        break;
+                case O_RDWR:
+                        mode = FMODE_READ | FMODE_WRITE;
+                        break;
+                default:
+                        return -EINVAL;
+        }
+        if (0 > (ret = shm_name_check(name)))
+                return ret;
+        name++;
+
+        if (0 > (fd = get_empty_fd(curproc)))
+                return fd;
+        if (NULL != (sh = shm_lookup(name))) {
+                if ((O_CREAT | O_EXCL) == (oflags & (O_CREAT | O_EXCL)))
+                        return -EEXIST;
+                vn = sh->sh_vnode;
+                vref(vn);
+        } else if (!(oflags & O_CREAT)) {
+                return -ENOENT;
+        } else if (0 > (ret = shm_create(name, &vn))) {
+                return ret;
+        }
+
+        if (NULL == (file = fget(-1))) {
+                vput(vn);
+                return -ENOMEM;
+        }
+        file->f_mode = mode;
+        file->f_pos = 0;
+        /* the file takes the reference got above */
+        facq(file, vn);
+        curproc->p_files[fd] = file;
+        return fd;
+}
+
+int
+do_shm_unlink(const char *name)
+{
+        shm_t *sh;
+        int ret;
+
+        if (0 > (ret = shm_name_check(name)))
+                return ret;
+        if (NULL == (sh = shm_lookup(name + 1)))
+                return -ENOENT;
+        list_remove(&sh->sh_link);
+        vput(sh->sh_vnode);
+        return 0;
+}
+
+/* Moves the bytes between buf and the object's pages, a page at a time */
+static int
+shm_transfer(vnode_t *vnode, off_t offset, void *buf, size_t len, int forwrite)
+{
+        shm_t *sh = VNODE_TO_SHM(vnode);
+        char *bytes = (char *) buf;
+        pframe_t *pf;
+        off_t pos, end = offset + len;
+        size_t n;
+        int ret = 0;
+
+        for (pos = offset; pos < end; pos += n) {
+                n = MIN(end - pos, (off_t)(PAGE_SIZE - PAGE_OFFSET(pos)));
+                if (0 > (ret = pframe_lookup(sh->sh_obj, ADDR_TO_PN(pos), forwrite, &pf))
+                    || (forwrite && 0 > (ret = pframe_dirty(pf))))
+                        break;
+                if (forwrite)
+                        memcpy((char *) pf->pf_addr + PAGE_OFFSET(pos), bytes + (pos - offset), n);
+                else
+                        memcpy(bytes + (pos - offset), (char *) pf->pf_addr + PAGE_OFFSET(pos), n);
+        }
+        if (forwrite && pos > vnode->vn_len)
+                vnode->vn_len = pos;
+        return (pos > offset) ? pos - offset : ret;
+}
+
+static int
+shm_read(vnode_t *vnode, off_t offset, void *buf, size_t len)
+{
+        if (offset >= vnode->vn_len)
+                return 0;
+        return shm_transfer(vnode, offset, buf, MIN(len, (size_t)(vnode->vn_len - offset)), 0);
+}
+
+static int
+shm_write(vnode_t *vnode, off_t offset, const void *buf, size_t len)
+{
+        return shm_transfer(vnode, offset, (void *) buf, len, 1);
+}
+
+/* Every mapping of the object is of its one anonymous object, which the
+ * caller refs; the object is as long as the furthest it is mapped */
+static int
+shm_mmap(vnode_t *vnode, vmarea_t *vma, mmobj_t **ret)
+{
+        off_t end = (off_t)(vma->vma_off + vma->vma_end - vma->vma_start) * PAGE_SIZE;
+
+        if (end > vnode->vn_len)
+                vnode->vn_len = end;
+        *ret = VNODE_TO_SHM(vnode)->sh_obj;
+        return 0;
+}
+
+static int
+shm_stat(vnode_t *vnode, struct stat *ss)
+{
+        shm_t *sh = VNODE_TO_SHM(vnode);
+
+        memset(ss, 0, sizeof(struct stat));
+        ss->st_mode = vnode->vn_mode;
+        ss->st_ino = vnode->vn_vno;
+        ss->st_nlink = list_link_is_linked(&sh->sh_link) ? 1 : 0;
+        ss->st_size = vnode->vn_len;
+        ss->st_blksize = PAGE_SIZE;
+        ss->st_blocks = sh->sh_obj->mmo_nrespages;
+        return 0;
+}
+
+/* shmfs vnode operations */
+static void
+shm_read_vnode(vnode_t *vnode)
+{
+        vnode->vn_ops = &shm_vops;
+        vnode->vn_mode = S_IFREG;
+        vnode->vn_len = 0;
+        vnode->vn_i = NULL;
+}
+
+static void
+shm_delete_vnode(vnode_t *vnode)
+{
+        shm_t *sh = VNODE_TO_SHM(vnode);
+
+        if (NULL != sh) {
+                KASSERT(!list_link_is_linked(&sh->sh_link));
+                sh->sh_obj->mmo_ops->put(sh->sh_obj);
+                slab_obj_free(shm_allocator, sh);
+        }
+}
+
+/* The vnode is kept while the object is named, which shm_list's
+ * reference sees to anyway */
+static int
+shm_query_vnode(vnode_t *vnode)
+{
+        shm_t *sh = VNODE_TO_SHM(vnode);
+
+        return NULL != sh && list_link_is_linked(&sh->sh_link);
+}
@@ -15,11 +15,13 @@
 #ifdef __S5FS__
 #include "fs/s5fs/s5fs.h"
 #endif
+#include "fs/dcache.h"
 #include "fs/vfs.h"
 #include "fs/file.h"
 #include "fs/vnode.h"
 #include "fs/vfs_syscall.h"
 #include "fs/ramfs/ramfs.h"
+#include "fs/procfs/procfs.h"
 
 #include "fs/stat.h"
 #include "fs/fcntl.h"
@@ -30,7 +32,13 @@
 vnode_t *vfs_root_vn;
 
 #ifdef __MOUNTING__
-/* The fs listed here are only the non-root file systems */
+/* The fs listed here are only the non-root file systems. Nothing looks
+ * a mount up in the list: the covered vnode's vn_mount names what is
+ * mounted on it (vget and vpeek follow it), and the root of a mounted
+ * file system names the vnode it covers in fs_mtpt (lookup follows that
+ * for ".."), so crossing a mount point costs no more than any other
+ * component, however many file systems are mounted. The list is only
+ * walked to sync and to unmount everything, and has no limit. */
 list_t mounted_fs_list;
 
 /*
@@ -56,8 +64,26 @@ list_t mounted_fs_list;
 int
 vfs_mount(struct vnode *mtpt, fs_t *fs)
 {
-        NOT_YET_IMPLEMENTED("MOUNTING: vfs_mount");
-        return -EINVAL;
+        KASSERT(NULL != mtpt && NULL != fs && NULL != fs->fs_root);
+
+        if (!S_ISDIR(mtpt->vn_mode))
+                return -ENOTDIR;
+        /* something is mounted here already, or mtpt is the root of a
+         * file system (which vget would not see past, as it only goes
+         * through one vn_mount) */
+        if (mtpt->vn_mount != mtpt || mtpt == mtpt->vn_fs->fs_root)
+                return -EBUSY;
+
+        /* vget now gives fs's root for mtpt, and so does the name cache,
+         * which goes through vget and vpeek for the vnodes it names */
+        vref(mtpt);
+        fs->fs_mtpt = mtpt;
+        mtpt->vn_mount = fs->fs_root;
+
+        /* newest first, so that vfs_shutdown unmounts a file system
+         * before the one it is mounted on */
+        list_insert_head(&mounted_fs_list, &fs->fs_link);
+        return 0;
 }
 
 /*
@@ -76,8 +102,33 @@ vfs_mount(struct vnode *mtpt, fs_t *fs)
 int
 vfs_umount(fs_t *fs)
 {
-        NOT_YET_IMPLEMENTED("MOUNTING: vfs_umount");
-        return -EINVAL;
+        vnode_t *mtpt = fs->fs_mtpt;
+        int ret;
+
+        KASSERT(fs != vfs_root_vn->vn_fs);
+        KASSERT(mtpt->vn_mount == fs->fs_root);
+
+        /* a file system mounted on one of fs's directories holds a
+         * reference to it, so is caught here too */
+        if (0 > (ret = vfs_is_in_use(fs)))
+                return ret;
+
+        dcache_purge_fs(fs);
+        vnode_inactive_purge(fs);
+
+        if (fs->fs_op->umount) {
+                if (0 > (ret = fs->fs_op->umount(fs)))
+                        return ret;
+        } else {
+                vput(fs->fs_root);
+        }
+        KASSERT(!vnode_inuse(fs));
+
+        mtpt->vn_mount = mtpt;
+        list_remove(&fs->fs_link);
+        vput(mtpt);
+        kfree(fs);
+        return 0;
 }
 #endif /* __MOUNTING__ */
 
@@ -110,6 +161,7 @@ vfs_init(void)
                 && "shouldn\'t be running out of memory this early in "
                 "the game");
         memset(fs, 0, sizeof(fs_t));
+        list_init(&fs->fs_vnodes);
         strcpy(fs->fs_type, VFS_ROOTFS_TYPE);
         if (VFS_ROOTFS_DEV) {
                 strcpy(fs->fs_dev, VFS_ROOTFS_DEV);
@@ -132,6 +184,7 @@ vfs_init(void)
 init_func(vfs_init);
 init_depends(vnode_init);
 init_depends(file_init);
+init_depends(workq_init);       /* s5fs_mount queues work */
 
 int
 vfs_shutdown()
@@ -166,6 +219,9 @@ vfs_shutdown()
                       "filesystem!!! This shouldn't happen!!\n");
         }
 
+        dcache_purge_fs(fs);
+        vnode_inactive_purge(fs);
+
         if (vn->vn_fs->fs_op->umount) {
                 ret = vn->vn_fs->fs_op->umount(fs);
         } else {
@@ -183,6 +239,26 @@ vfs_shutdown()
         return ret;
 }
 
+void
+vfs_sync(void)
+{
+        fs_t *fs;
+
+        if (NULL == vfs_root_vn)
+                return;
+
+#ifdef __MOUNTING__
+        list_iterate_begin(&mounted_fs_list, fs, fs_t, fs_link) {
+                if (fs->fs_op->sync)
+                        fs->fs_op->sync(fs);
+        } list_iterate_end();
+#endif
+
+        fs = vfs_root_vn->vn_fs;
+        if (fs->fs_op->sync)
+                fs->fs_op->sync(fs);
+}
+
 /*
  * Given an fs_t, we search through the list of known file systems
  * and call the proper mount function.
@@ -198,6 +274,7 @@ mountfunc(fs_t *fs)
                 { "s5fs", s5fs_mount },
 #endif
                 { "ramfs", ramfs_mount },
+                { "procfs", procfs_mount },
         };
         unsigned i;
 
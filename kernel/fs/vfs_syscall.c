@@ -9,6 +9,7 @@
 #include "kernel.h"
 #include "errno.h"
 #include "globals.h"
+#include "fs/dcache.h"
 #include "fs/vfs.h"
 #include "fs/file.h"
 #include "fs/vnode.h"
@@ -16,12 +17,78 @@
 #include "fs/open.h"
 #include "fs/fcntl.h"
 #include "fs/lseek.h"
+#include "fs/poll.h"
 #include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
 #include "util/string.h"
 #include "util/printf.h"
 #include "fs/stat.h"
 #include "util/debug.h"
 
+/* Whether a transfer of an O_DIRECT file can go past the page cache */
+#define FILE_DIRECT_OK(off, n)  (0 == PAGE_OFFSET(off) && 0 == PAGE_OFFSET(n))
+
+/*
+ * Reads and writes of a file at off, which do not wait if the file is
+ * nonblocking (see read_nonblock in vnode_ops_t), and go past the page
+ * cache if it is O_DIRECT and they are of whole pages (see read_direct).
+ */
+
+static int
+file_read(file_t *file, off_t off, void *buf, size_t nbytes)
+{
+        vnode_t *vn = file->f_vnode;
+        uint32_t pagenum;
+        pframe_t *pf;
+        int ret;
+
+        if (FMODE_ISNONBLOCK(file->f_mode)) {
+                if (NULL != vn->vn_ops->read_nonblock)
+                        return vn->vn_ops->read_nonblock(vn, off, buf, nbytes);
+                if (NULL != vn->vn_ops->poll
+                    && !(vn->vn_ops->poll(vn, POLLIN, NULL) & (POLLIN | POLLHUP | POLLERR)))
+                        return -EAGAIN;
+        }
+        if (FMODE_ISDIRECT(file->f_mode) && NULL != vn->vn_ops->read_direct
+            && FILE_DIRECT_OK(off, nbytes))
+                return vn->vn_ops->read_direct(vn, off, buf, nbytes);
+        ret = vn->vn_ops->read(vn, off, buf, nbytes);
+
+        /* drop-behind: a sequential reader is done with the pages it has
+         * read past, so they are the first ones pageoutd reclaims */
+        if (0 < ret && POSIX_FADV_SEQUENTIAL == file->f_advice) {
+                for (pagenum = ADDR_TO_PN(off); pagenum < ADDR_TO_PN(off + ret); pagenum++) {
+                        if (NULL != (pf = pframe_get_resident(&vn->vn_mmobj, pagenum)))
+                                pframe_deactivate(pf);
+                }
+        }
+        return ret;
+}
+
+static int
+file_write(file_t *file, off_t off, const void *buf, size_t nbytes)
+{
+        vnode_t *vn = file->f_vnode;
+        int ret;
+
+        if (FMODE_ISNONBLOCK(file->f_mode)) {
+                if (NULL != vn->vn_ops->write_nonblock)
+                        return vn->vn_ops->write_nonblock(vn, off, buf, nbytes);
+                if (NULL != vn->vn_ops->poll
+                    && !(vn->vn_ops->poll(vn, POLLOUT, NULL) & (POLLOUT | POLLERR)))
+                        return -EAGAIN;
+        }
+        if (FMODE_ISDIRECT(file->f_mode) && NULL != vn->vn_ops->write_direct
+            && FILE_DIRECT_OK(off, nbytes))
+                /* which dirties no more pages than were dirty */
+                return vn->vn_ops->write_direct(vn, off, buf, nbytes);
+        if (0 < (ret = vn->vn_ops->write(vn, off, buf, nbytes)))
+                /* with the file system's locks dropped */
+                pframe_throttle();
+        return ret;
+}
+
 /* To read a file:
  *      o fget(fd)
  *      o call its virtual read f_op
@@ -65,7 +132,7 @@ do_read(int fd, void *buf, size_t nbytes)
 
         KASSERT(ops);
         KASSERT(ops->read != NULL);
-        int byte_count = ops->read(vnode,file->f_pos, buf, nbytes);
+        int byte_count = file_read(file, file->f_pos, buf, nbytes);
         file->f_pos += byte_count;
         /* release */
         fput(file);
@@ -115,13 +182,224 @@ do_write(int fd, const void *buf, size_t nbytes)
         KASSERT(ops);
         KASSERT(ops->write != NULL);
 
-        int bytes_count = ops->write(file, file->f_pos, buf, nbytes);
+        int bytes_count = file_write(file, file->f_pos, buf, nbytes);
+        /* after the write, so that nothing read while it was going on is
+         * taken to be current */
+        vnode_modified(vnode);
         file->f_pos += bytes_count;
         fput(file);
 
         return bytes_count;
 }
 
+/*
+ * pread(2) and pwrite(2): like do_read and do_write, but at the given
+ * offset rather than the file position, which is left alone (so there is
+ * no appending either).
+ *
+ * Error cases, besides those of do_read and do_write:
+ *      o ESPIPE
+ *        fd refers to a pipe, which has no offsets.
+ *      o EINVAL
+ *        off is negative.
+ */
+static int
+prw_check(file_t *file, off_t off)
+{
+        if (S_ISDIR(file->f_vnode->vn_mode))
+                return -EISDIR;
+        if (S_ISFIFO(file->f_vnode->vn_mode))
+                return -ESPIPE;
+        if (0 > off)
+                return -EINVAL;
+        return 0;
+}
+
+/* do_pread and do_pwrite of a file which is already held, for aio */
+int
+file_pread(file_t *file, void *buf, size_t nbytes, off_t off)
+{
+        int ret;
+
+        if (!FMODE_ISREAD(file->f_mode))
+                return -EBADF;
+        if (0 == (ret = prw_check(file, off)))
+                ret = file_read(file, off, buf, nbytes);
+        return ret;
+}
+
+int
+file_pwrite(file_t *file, const void *buf, size_t nbytes, off_t off)
+{
+        int ret;
+
+        if (!FMODE_ISWRITE(file->f_mode))
+                return -EBADF;
+        if (0 == (ret = prw_check(file, off))) {
+                ret = file_write(file, off, buf, nbytes);
+                vnode_modified(file->f_vnode);
+        }
+        return ret;
+}
+
+int
+do_pread(int fd, void *buf, size_t nbytes, off_t off)
+{
+        file_t *file;
+        int ret;
+
+        if (0 > fd || NFILES <= fd || NULL == (file = fget(fd)))
+                return -EBADF;
+        ret = file_pread(file, buf, nbytes, off);
+        fput(file);
+
+        return ret;
+}
+
+int
+do_pwrite(int fd, const void *buf, size_t nbytes, off_t off)
+{
+        file_t *file;
+        int ret;
+
+        if (0 > fd || NFILES <= fd || NULL == (file = fget(fd)))
+                return -EBADF;
+        ret = file_pwrite(file, buf, nbytes, off);
+        fput(file);
+
+        return ret;
+}
+
+/*
+ * Writes up to len bytes of the regular file in, from *inpos, to out at
+ * *outpos (or at its end, if it is appended to), advancing both. The
+ * data is written to out straight from in's pages in the page cache,
+ * pinned while they are, so it is copied once rather than through a
+ * buffer. Stops at the end of in, or after a short write. Returns the
+ * number of bytes copied, or -errno if none were.
+ */
+static int
+file_copy(file_t *in, off_t *inpos, file_t *out, off_t *outpos, size_t len)
+{
+        vnode_t *vn = in->f_vnode;
+        size_t done = 0;
+        int ret = 0;
+
+        KASSERT(S_ISREG(vn->vn_mode));
+
+        while (done < len && *inpos < vn->vn_len) {
+                size_t n = MIN(len - done, PAGE_SIZE - PAGE_OFFSET(*inpos));
+                pframe_t *pf;
+
+                n = MIN(n, (size_t) (vn->vn_len - *inpos));
+                if (0 > (ret = pframe_lookup(&vn->vn_mmobj, ADDR_TO_PN(*inpos), 0, &pf)))
+                        break;
+                if (FMODE_ISAPPEND(out->f_mode))
+                        *outpos = out->f_vnode->vn_len;
+
+                pframe_pin(pf);
+                ret = file_write(out, *outpos, (char *) pf->pf_addr + PAGE_OFFSET(*inpos), n);
+                pframe_unpin(pf);
+                if (0 >= ret)
+                        break;
+                *inpos += ret;
+                *outpos += ret;
+                done += ret;
+                if ((size_t) ret < n)
+                        break;
+        }
+        if (0 < done)
+                vnode_modified(out->f_vnode);
+
+        return (0 < done) ? (int) done : ret;
+}
+
+/*
+ * sendfile(2): writes up to count bytes of the regular file infd to
+ * outfd, which may be any file open for writing, without copying them
+ * through user space (see file_copy). They are read from *off, which is
+ * advanced, if off is not NULL, and from (advancing) infd's file
+ * position otherwise. outfd's file position is advanced either way.
+ * Returns the number of bytes written, 0 at the end of infd.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        infd is not open for reading or outfd is not open for writing.
+ *      o EINVAL
+ *        infd is not a regular file, or *off is negative.
+ */
+int
+do_sendfile(int outfd, int infd, off_t *off, size_t count)
+{
+        file_t *in, *out;
+        int ret;
+
+        if (0 > infd || NFILES <= infd || NULL == (in = fget(infd)))
+                return -EBADF;
+        if (0 > outfd || NFILES <= outfd || NULL == (out = fget(outfd))) {
+                fput(in);
+                return -EBADF;
+        }
+
+        if (!FMODE_ISREAD(in->f_mode) || !FMODE_ISWRITE(out->f_mode))
+                ret = -EBADF;
+        else if (!S_ISREG(in->f_vnode->vn_mode) || (NULL != off && 0 > *off))
+                ret = -EINVAL;
+        else
+                ret = file_copy(in, (NULL != off) ? off : &in->f_pos, out, &out->f_pos, count);
+
+        fput(out);
+        fput(in);
+        return ret;
+}
+
+/*
+ * copy_file_range(2): copies up to len bytes between two regular files
+ * like do_sendfile, each of them at the given offset, which is advanced,
+ * if it is not NULL, and at (advancing) its file position otherwise.
+ * The two may be the same file, as long as the ranges do not overlap.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        infd is not open for reading, or outfd is not open for writing
+ *        or is appended to.
+ *      o EINVAL
+ *        Either is not a regular file, an offset is negative, or the
+ *        ranges overlap within one file.
+ */
+int
+do_copy_file_range(int infd, off_t *inoff, int outfd, off_t *outoff, size_t len)
+{
+        file_t *in, *out;
+        off_t *inpos, *outpos;
+        int ret;
+
+        if (0 > infd || NFILES <= infd || NULL == (in = fget(infd)))
+                return -EBADF;
+        if (0 > outfd || NFILES <= outfd || NULL == (out = fget(outfd))) {
+                fput(in);
+                return -EBADF;
+        }
+        inpos = (NULL != inoff) ? inoff : &in->f_pos;
+        outpos = (NULL != outoff) ? outoff : &out->f_pos;
+
+        if (!FMODE_ISREAD(in->f_mode) || !FMODE_ISWRITE(out->f_mode)
+            || FMODE_ISAPPEND(out->f_mode))
+                ret = -EBADF;
+        else if (!S_ISREG(in->f_vnode->vn_mode) || !S_ISREG(out->f_vnode->vn_mode)
+                 || 0 > *inpos || 0 > *outpos)
+                ret = -EINVAL;
+        else if (in->f_vnode == out->f_vnode
+                 && *inpos < *outpos + (off_t) len && *outpos < *inpos + (off_t) len)
+                ret = -EINVAL;
+        else
+                ret = file_copy(in, inpos, out, outpos, len);
+
+        fput(out);
+        fput(in);
+        return ret;
+}
+
 /*
  * Zero curproc->p_files[fd], and fput() the file. Return 0 on success
  *
@@ -297,6 +575,7 @@ do_mknod(const char *path, int mode, unsigned devid)
         }else
         {
             /* ret is -ENOENT*/
+            dcache_remove(dir, name, name_len);
             ret = target->
         }
 }
@@ -323,7 +602,7 @@ do_mkdir(const char *path)
     size_t name_len;
     char name[NAME_LEN+1];
     const char* nameptr = name;
-    vnote_t* dir = NULL;
+    vnode_t* dir = NULL;
     int ret = 0;
     if((ret = dir_namev(path, &name_len, nameptr, NULL, &dir)) < 0)
     {
@@ -344,6 +623,7 @@ do_mkdir(const char *path)
         vnode_ops_t* ops = node_file->vn_ops;
         KASSERT(ops);
         ret = ops->mkdir(dir, name, name_len);
+        dcache_remove(dir, name, name_len);
         if(dir)
             vput(dir);
         if(node_file)
@@ -378,57 +658,7 @@ do_mkdir(const char *path)
 int
 do_rmdir(const char *path)
 {
-    if(path == NULL || strlen(path) == 0)
-    {
-        return -ENOENT;
-    }
-    size_t name_len = 0;
-    vnode_t* node = NULL;
-    char name[NAME_LEN+1];
-    const char* nameptr = name;
-    /* TODO: base not sure*/
-    int ret = dir_namev(path,&name_len, nameptr, NULL, &node)；
-    if(ret < 0)
-    {
-        if(node)
-            vput(node);
-        return ret;
-    }
-
-    if(node == NULL)
-    {
-        return -ENOENT;
-    }
-    else if(!S_ISDIR(node->vn_mode))
-    {
-        if(node)
-        {
-            vput(node);
-        }
-        return -ENOTDIR;
-    }else if(strcmp(name,'.') == 0)
-    {
-        if(node)
-        {
-            vput(node);
-        }
-        return -EINVAL;
-    }else if(strcmp(name, '..') == 0)
-    {
-        if(node)
-        {
-            vput(node);
-        }
-        return -ENOTEMPTY;
-    }
-
-    
-    vnode_ops_t* ops = node->vn_ops;
-    KASSERT(ops != NULL);
-
-    ret = ops->rmdir(node, name, name_len);
-    vput(node);
-    return node;
+        return do_unlinkat(AT_FDCWD, path, AT_REMOVEDIR);
 }
 
 /*
@@ -447,43 +677,58 @@ do_rmdir(const char *path)
 int
 do_unlink(const char *path)
 {
+        return do_unlinkat(AT_FDCWD, path, 0);
+}
 
-    if(path == NULL || strlen(path) == 0)
-    {
-        return -ENOENT;
-    }
-    size_t name_len = 0;
-    vnode_t* node = NULL;
-    char name[NAME_LEN+1];
-    int ret = dir_namev(path,&name_len, &name, NULL, &node)；
-    if(ret < 0)
-    {
-        if(node)
-            vput(node);
-        return ret;
-    }
-
-    /*TODO: need to lookup? */
-    if(node == NULL)
-    {
-        return -ENOENT;
-    }
-    else if(S_ISDIR(node->vn_mode))
-    {
-        if(node)
-        {
-            vput(node);
-        }
-        return -EISDIR;
-    }
+/*
+ * unlinkat(2): do_unlink, or do_rmdir if flags has AT_REMOVEDIR, of a
+ * path relative to the directory open as dirfd (or to the current
+ * directory, for AT_FDCWD).
+ *
+ * Error cases, on top of those of do_unlink and do_rmdir:
+ *      o EBADF, ENOTDIR
+ *        dirfd is neither AT_FDCWD nor an open directory.
+ *      o EINVAL
+ *        flags has something other than AT_REMOVEDIR.
+ */
+int
+do_unlinkat(int dirfd, const char *path, int flags)
+{
+        vnode_t *base, *dir, *vn;
+        const char *name;
+        size_t namelen;
+        int ret;
 
-    
-    vnode_ops_t* ops = node->vn_ops;
-    KASSERT(ops != NULL);
+        if (flags & ~AT_REMOVEDIR)
+                return -EINVAL;
+        if (0 > (ret = get_dirfd_vnode(dirfd, &base)))
+                return ret;
+        ret = dir_namev(path, &namelen, &name, base, &dir);
+        if (NULL != base)
+                vput(base);
+        if (0 > ret)
+                return ret;
 
-    ret = ops->unlink(node, name, name_len);
-    vput(node);
-    return node;
+        if (flags & AT_REMOVEDIR) {
+                if (0 == namelen || (1 == namelen && '.' == name[0]))
+                        ret = -EINVAL;
+                else if (2 == namelen && '.' == name[0] && '.' == name[1])
+                        ret = -ENOTEMPTY;
+                else
+                        ret = dir->vn_ops->rmdir(dir, name, namelen);
+        } else if (0 == namelen) {
+                ret = -EISDIR;
+        } else if (0 == (ret = lookup(dir, name, namelen, &vn))) {
+                if (S_ISDIR(vn->vn_mode))
+                        ret = -EISDIR;
+                vput(vn);
+                if (0 == ret)
+                        ret = dir->vn_ops->unlink(dir, name, namelen);
+        }
+        if (0 == ret)
+                dcache_remove(dir, name, namelen);
+        vput(dir);
+        return ret;
 }
 
 /* To link:
@@ -566,6 +811,7 @@ do_link(const char *from, const char *to)
     vnode_ops_t* ops = from_node->vn_ops;
     KASSERT(ops != NULL);
     ret = ops->link(from_node, to_node, name, name_len);
+    dcache_remove(to_node, name, name_len);
     vput(from_node);
     vput(to_node);
     /* do not vput(tmp node) because it's not there*/
@@ -682,6 +928,49 @@ do_getdent(int fd, struct dirent *dirp)
         /*return -1;*/
 }
 
+/*
+ * Reads up to count directory entries from fd into dirp, through the
+ * readdirs op if there is one, and advances the file position past them.
+ * Returns how many were read (0 at the end of the directory), or -EBADF
+ * or -ENOTDIR as do_getdent.
+ */
+int
+do_getdents(int fd, struct dirent *dirp, int count)
+{
+        file_t *file;
+        vnode_t *dir;
+        int n = 0;
+        int ret;
+
+        KASSERT(0 < count);
+
+        if (0 > fd || NFILES <= fd || NULL == (file = fget(fd)))
+                return -EBADF;
+        dir = file->f_vnode;
+        if (!S_ISDIR(dir->vn_mode)) {
+                fput(file);
+                return -ENOTDIR;
+        }
+
+        if (NULL != dir->vn_ops->readdirs) {
+                if (0 < (n = dir->vn_ops->readdirs(dir, file->f_pos, dirp, count)))
+                        file->f_pos = dirp[n - 1].d_off;
+        } else {
+                while (n < count) {
+                        if (0 >= (ret = dir->vn_ops->readdir(dir, file->f_pos, &dirp[n]))) {
+                                if (0 == n)
+                                        n = ret;
+                                break;
+                        }
+                        file->f_pos += ret;
+                        dirp[n++].d_off = file->f_pos;
+                }
+        }
+        fput(file);
+
+        return n;
+}
+
 /*
  * Modify f_pos according to offset and whence.
  *
@@ -764,28 +1053,197 @@ do_lseek(int fd, int offset, int whence)
 int
 do_stat(const char *path, struct stat *buf)
 {
-        if(path == NULL || strlen(path) == 0)
-            return -ENOENT;
-        KASSERT(buf != NULL);
+        return do_fstatat(AT_FDCWD, path, buf, 0);
+}
+
+/*
+ * fstatat(2): do_stat of a path relative to the directory open as dirfd
+ * (or to the current directory, for AT_FDCWD). With no symbolic links
+ * there are no flags to give.
+ *
+ * Error cases, on top of those of do_stat:
+ *      o EBADF, ENOTDIR
+ *        dirfd is neither AT_FDCWD nor an open directory.
+ *      o EINVAL
+ *        flags is not 0.
+ */
+int
+do_fstatat(int dirfd, const char *path, struct stat *buf, int flags)
+{
+        vnode_t *base, *vn;
+        int ret;
+
+        if (0 != flags)
+                return -EINVAL;
+        if (0 > (ret = get_dirfd_vnode(dirfd, &base)))
+                return ret;
+        ret = open_namev(path, 0, &vn, base);
+        if (NULL != base)
+                vput(base);
+        if (0 > ret)
+                return ret;
+
+        KASSERT(vn->vn_ops->stat);
+        ret = vn->vn_ops->stat(vn, buf);
+        vput(vn);
+        return ret;
+}
+
+/*
+ * Like do_stat, for the vnode an open file refers to.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ */
+int
+do_fstat(int fd, struct stat *buf)
+{
+        file_t *file;
+        int ret;
+
+        if (fd < 0 || fd >= NFILES || NULL == (file = fget(fd)))
+                return -EBADF;
+
+        KASSERT(file->f_vnode && file->f_vnode->vn_ops->stat);
+        ret = file->f_vnode->vn_ops->stat(file->f_vnode, buf);
+        fput(file);
+        return ret;
+}
+
+/*
+ * fcntl(2), of which only the file status flags are supported: F_GETFL
+ * returns the access mode and O_APPEND, O_NONBLOCK and O_DIRECT as set,
+ * and F_SETFL sets those three from arg (ignoring the rest).
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ *      o EINVAL
+ *        cmd is not F_GETFL or F_SETFL.
+ */
+int
+do_fcntl(int fd, int cmd, int arg)
+{
+        file_t *file;
         int ret = 0;
-        vnote_t* result = NULL;
-        /* TODO: flag*/
-        if((ret = open_namev(path, O_RDWR, &result, NULL) < 0)
-        {
-            if(result)
-            {
-                vput(result);
-            }
-            return ret;
+
+        if (fd < 0 || fd >= NFILES || NULL == (file = fget(fd)))
+                return -EBADF;
+
+        switch (cmd) {
+                case F_GETFL:
+                        if (FMODE_ISREAD(file->f_mode) && FMODE_ISWRITE(file->f_mode))
+                                ret = O_RDWR;
+                        else if (FMODE_ISWRITE(file->f_mode))
+                                ret = O_WRONLY;
+                        else
+                                ret = O_RDONLY;
+                        if (FMODE_ISAPPEND(file->f_mode))
+                                ret |= O_APPEND;
+                        if (FMODE_ISNONBLOCK(file->f_mode))
+                                ret |= O_NONBLOCK;
+                        if (FMODE_ISDIRECT(file->f_mode))
+                                ret |= O_DIRECT;
+                        break;
+                case F_SETFL:
+                        file->f_mode &= ~(FMODE_APPEND | FMODE_NONBLOCK | FMODE_DIRECT);
+                        if (arg & O_APPEND)
+                                file->f_mode |= FMODE_APPEND;
+                        if (arg & O_NONBLOCK)
+                                file->f_mode |= FMODE_NONBLOCK;
+                        if (arg & O_DIRECT)
+                                file->f_mode |= FMODE_DIRECT;
+                        break;
+                default:
+                        ret = -EINVAL;
+                        break;
         }
+        fput(file);
+        return ret;
+}
 
-        KASSERT(result);
-        vnode_ops_t* ops = result->vn_ops;
-        KASSERT(ops);
-        ret = ops->stat(result, buf);
-        vput(result);
+/*
+ * fsync(2) and, if datasync is set, fdatasync(2): writes back the dirty
+ * pages of the file's vnode, then lets the file system write back what
+ * it keeps about the file, rather than everything dirty as sync(2) does.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ */
+int
+do_fsync(int fd, int datasync)
+{
+        file_t *file;
+        vnode_t *vn;
+        int ret;
+
+        if (fd < 0 || fd >= NFILES || NULL == (file = fget(fd)))
+                return -EBADF;
+        vn = file->f_vnode;
+
+        if (0 <= (ret = pframe_clean_obj(&vn->vn_mmobj)) && NULL != vn->vn_ops->fsync)
+                ret = vn->vn_ops->fsync(vn, datasync);
+        fput(file);
         return ret;
-        
+}
+
+/*
+ * posix_fadvise(2): advice on how the file will be read.
+ *
+ * POSIX_FADV_NORMAL, POSIX_FADV_RANDOM and POSIX_FADV_SEQUENTIAL hold for
+ * the whole file, for every fd sharing this open file, off and len being
+ * ignored: random reads are not read ahead (unless another file on the
+ * vnode is sequential), and sequential ones are read ahead as far as
+ * readahead goes with the pages read past being dropped behind.
+ *
+ * POSIX_FADV_WILLNEED reads the pages of [off, off + len) in now, and
+ * POSIX_FADV_DONTNEED frees the clean ones, a len of 0 meaning as far as
+ * the file goes in both cases.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ *      o EINVAL
+ *        advice is not one of the above, or off or len is negative.
+ */
+int
+do_fadvise(int fd, off_t off, off_t len, int advice)
+{
+        file_t *file;
+        vnode_t *vn;
+        uint32_t lo, hi;
+
+        if (fd < 0 || fd >= NFILES || NULL == (file = fget(fd)))
+                return -EBADF;
+        if (POSIX_FADV_NORMAL > advice || POSIX_FADV_DONTNEED < advice || 0 > off || 0 > len) {
+                fput(file);
+                return -EINVAL;
+        }
+        vn = file->f_vnode;
+
+        lo = ADDR_TO_PN(off);
+        hi = ADDR_TO_PN(PAGE_ALIGN_UP(vn->vn_len));
+        if (0 != len && off + len < vn->vn_len)
+                hi = ADDR_TO_PN(PAGE_ALIGN_UP(off + len));
+
+        switch (advice) {
+                case POSIX_FADV_WILLNEED:
+                        if (lo < hi)
+                                vnode_willneed(&vn->vn_mmobj, lo, hi - lo);
+                        break;
+                case POSIX_FADV_DONTNEED:
+                        if (lo < hi)
+                                vnode_dontneed(&vn->vn_mmobj, lo, hi - lo);
+                        break;
+                default:
+                        vnode_fadvise(vn, file->f_advice, advice);
+                        file->f_advice = advice;
+                        break;
+        }
+        fput(file);
+        return 0;
 }
 
 #ifdef __MOUNTING__
@@ -808,8 +1266,41 @@ do_stat(const char *path, struct stat *buf)
 int
 do_mount(const char *source, const char *target, const char *type)
 {
-        NOT_YET_IMPLEMENTED("MOUNTING: do_mount");
-        return -EINVAL;
+        vnode_t *mtpt;
+        fs_t *fs;
+        int ret;
+
+        if (STR_MAX <= strlen(type) || (NULL != source && STR_MAX <= strlen(source)))
+                return -ENAMETOOLONG;
+        if (0 > (ret = open_namev(target, 0, &mtpt, NULL)))
+                return ret;
+
+        if (NULL == (fs = kmalloc(sizeof(fs_t)))) {
+                vput(mtpt);
+                return -ENOMEM;
+        }
+        memset(fs, 0, sizeof(fs_t));
+        list_init(&fs->fs_vnodes);
+        strcpy(fs->fs_type, type);
+        if (NULL != source)
+                strcpy(fs->fs_dev, source);
+
+        if (0 > (ret = mountfunc(fs))) {
+                kfree(fs);
+                vput(mtpt);
+                return ret;
+        }
+
+        /* vfs_mount takes its own reference to the mount point */
+        if (0 > (ret = vfs_mount(mtpt, fs))) {
+                if (fs->fs_op->umount)
+                        fs->fs_op->umount(fs);
+                else
+                        vput(fs->fs_root);
+                kfree(fs);
+        }
+        vput(mtpt);
+        return ret;
 }
 
 /*
@@ -824,7 +1315,18 @@ do_mount(const char *source, const char *target, const char *type)
 int
 do_umount(const char *target)
 {
-        NOT_YET_IMPLEMENTED("MOUNTING: do_umount");
-        return -EINVAL;
+        vnode_t *vn;
+        fs_t *fs;
+        int ret;
+
+        /* the mount point looks up as the root of what is mounted on it */
+        if (0 > (ret = open_namev(target, 0, &vn, NULL)))
+                return ret;
+        fs = vn->vn_fs;
+        vput(vn);
+
+        if (vn != fs->fs_root || fs == vfs_root_vn->vn_fs)
+                return -EINVAL;
+        return vfs_umount(fs);
 }
 #endif
@@ -10,36 +10,75 @@
 #include "util/string.h"
 #include "util/printf.h"
 #include "errno.h"
+#include "fs/dcache.h"
+#include "fs/fcntl.h"
+#include "fs/poll.h"
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
 #include "mm/slab.h"
+#include "drivers/tty/tty.h"
 #include "proc/sched.h"
 #include "util/debug.h"
+#include "vm/anon.h"
 #include "vm/vmmap.h"
 #include "globals.h"
 
 static slab_allocator_t *vnode_allocator;
 
-static list_t vnode_inuse_list;
+/* In-core vnodes are hashed by (fs, vno) so that vget does not have to
+ * search them all; each fs also keeps a list of its own vnodes for the
+ * routines below which visit every vnode of a file system. */
+#define VNODE_NBUCKETS  (MAX_VNODES / 4)
+#define hash_vnode(fs, vno) \
+        (&vnode_hash[((((uint32_t)(fs)) >> 4) ^ ((uint32_t)(vno) * 0x9e3779b1U)) \
+                     % VNODE_NBUCKETS])
+static list_t vnode_hash[VNODE_NBUCKETS];
+
+/* Vnodes whose last reference has gone but whose files still exist are
+ * not freed right away. They stay in the hash, on this LRU list (least
+ * recently used first), until MAX_VNODES vnodes are in core or the
+ * memory is wanted (see vnode_reclaim), so that reopening a file finds
+ * its inode in core. Vnodes on the list have a refcount of zero. */
+static list_t vnode_inactive_list;
+static int vnode_ninactive;
+static int vnode_ncore;                 /* in-core vnodes, inactive included */
+
+/* The last vn_wgen stamp handed out. Vnodes get a new one when they come
+ * into core too, so that a stamp is not reused by a vnode which has been
+ * freed and another one which is allocated in its place. */
+static uint32_t vnode_wgen;
 
 /* Related to vnodes representing special files: */
 static void init_special_vnode(vnode_t *vn);
 static int special_file_read(vnode_t *file, off_t offset, void *buf, size_t count);
 static int special_file_write(vnode_t *file, off_t offset, const void *buf, size_t count);
 static int special_file_mmap(vnode_t *file, vmarea_t *vma, mmobj_t **ret);
+static int special_file_poll(vnode_t *file, int events, struct poll_table *pt);
 static int special_file_stat(vnode_t *vnode, struct stat *ss);
 static int special_file_fillpage(vnode_t *file, off_t offset, void *pagebuf);
 static int special_file_dirtypage(vnode_t *file, off_t offset);
 static int special_file_cleanpage(vnode_t *file, off_t offset, void *pagebuf);
+static void vnode_free(vnode_t *vn);
+static int vnode_reclaim(int target);
+static uint32_t vnode_reclaimable(void);
+
+static slab_shrinker_t vnode_shrinker = {
+        .ss_name = "vnode",
+        .ss_count = vnode_reclaimable,
+        .ss_scan = vnode_reclaim
+};
 /* mmobj_t entry points: */
 static void vo_vref(mmobj_t *o);
 static void vo_vput(mmobj_t *o);
 
 static int  vlookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf);
 static int  vreadpage(mmobj_t *o, pframe_t *pf);
+static int  vreadpages(mmobj_t *o, pframe_t **pfs, int npages);
 static int  vdirtypage(mmobj_t *o, pframe_t *pf);
 static int  vcleanpage(mmobj_t *o, pframe_t *pf);
+static int  vcleanpages(mmobj_t *o, pframe_t **pfs, int npages);
+static list_t *vdirtylist(mmobj_t *o);
 
 static mmobj_ops_t vnode_mmobj_ops = {
         .ref = vo_vref,
@@ -55,6 +94,7 @@ static vnode_ops_t bytedev_spec_vops = {
         .read = special_file_read,
         .write = special_file_write,
         .mmap = special_file_mmap,
+        .poll = special_file_poll,
         .create = NULL,
         .mknod = NULL,
         .lookup = NULL,
@@ -90,17 +130,67 @@ static vnode_ops_t blockdev_spec_vops = {
 /*
  * Initialization:
  */
+
+/*
+ * Constructor for the vnode allocator. The mutex, mmobj, dirty list and
+ * wait queue of a vnode are always idle (unlocked, unreferenced and empty) by the time
+ * it is freed, so they are only initialized once, when their slab is
+ * created, rather than on every vget.
+ */
+static void
+vnode_ctor(void *obj)
+{
+        vnode_t *vn = (vnode_t *)obj;
+
+        memset(vn, 0, sizeof(vnode_t));
+        krwlock_init(&vn->vn_lock);
+        mmobj_init(&vn->vn_mmobj, &vnode_mmobj_ops);
+        list_init(&vn->vn_dirtypages);
+        sched_queue_init(&vn->vn_waitq);
+}
+
 static __attribute__((unused)) void
 vnode_init(void)
 {
-        list_init(&vnode_inuse_list);
-        vnode_allocator = slab_allocator_create("vnode", sizeof(vnode_t));
+        int i;
+
+        for (i = 0; i < VNODE_NBUCKETS; i++)
+                list_init(&vnode_hash[i]);
+        list_init(&vnode_inactive_list);
+        vnode_allocator = slab_allocator_create_ctor("vnode", sizeof(vnode_t),
+                                                     vnode_ctor, NULL);
+        pframe_register_fillpages(&vnode_mmobj_ops, vreadpages);
+        pframe_register_cleanpages(&vnode_mmobj_ops, vcleanpages);
+        pframe_register_dirtylist(&vnode_mmobj_ops, vdirtylist);
+        slab_register_shrinker(&vnode_shrinker);
 }
 init_func(vnode_init);
 
 /*
  * Core vnode management routines:
  */
+vnode_t *
+vpeek(struct fs *fs, ino_t vno)
+{
+        vnode_t *vn;
+
+        list_iterate_begin(hash_vnode(fs, vno), vn, vnode_t, vn_hlink) {
+                if ((vn->vn_fs == fs) && (vn->vn_vno == vno)) {
+                        if (VN_BUSY & vn->vn_flags)
+                                return NULL;
+#ifdef __MOUNTING__
+                        /* as in vget; an inactive vnode is never a mount
+                         * point */
+                        if (0 != vn->vn_refcount)
+                                return vn->vn_mount;
+#endif
+                        return vn;
+                }
+        } list_iterate_end();
+
+        return NULL;
+}
+
 void
 vref(vnode_t *vn)
 {
@@ -120,7 +210,7 @@ vget(struct fs *fs, ino_t vno)
 
         /* look for inuse vnode */
 find:
-        list_iterate_begin(&vnode_inuse_list, vn, vnode_t, vn_link) {
+        list_iterate_begin(hash_vnode(fs, vno), vn, vnode_t, vn_hlink) {
                 if ((vn->vn_fs == fs) && (vn->vn_vno == vno)) {
                         /* found it... */
                         if (VN_BUSY & vn->vn_flags) {
@@ -135,6 +225,19 @@ find:
                                 goto find;
                         }
 
+                        if (0 == vn->vn_refcount) {
+                                /* cached since its last vput (it cannot
+                                 * be a mount point, which stays
+                                 * referenced while mounted on) */
+                                list_remove(&vn->vn_ilink);
+                                vnode_ninactive--;
+#ifdef __MOUNTING__
+                                KASSERT(vn->vn_mount == vn);
+#endif
+                                vn->vn_refcount = 1;
+                                return vn;
+                        }
+
 #ifndef __MOUNTING__
                         /* If we are implementing mountpoint support
                            then we should get the mounted vnode,
@@ -151,8 +254,19 @@ find:
         } list_iterate_end();
 
         /* if we got here, we didn't find the vnode. */
+        /*   make room for it, if need be, by evicting least recently used
+         *   inactive vnodes (this may block, and the vnode may have been
+         *   brought in meanwhile): */
+        if (MAX_VNODES <= vnode_ncore && 0 < vnode_ninactive) {
+                vnode_reclaim(vnode_ncore - MAX_VNODES + 1);
+                goto find;
+        }
         /*   alloc a new vnode: */
         vn = slab_obj_alloc(vnode_allocator);
+        if (!vn && 0 < vnode_ninactive) {
+                vnode_reclaim(1);
+                goto find;
+        }
         if (!vn) {
                 dbg(DBG_VNREF, "vget: kmem has been exhausted. "
                     "will then re-attempt to vget vnode later %d of fs %p\n", vno, fs);
@@ -160,14 +274,29 @@ find:
                 sched_switch();
                 goto find;
         }
-        memset(vn, 0, sizeof(vnode_t));
-        /*   initialize its contents: */
+        /*   initialize its contents (the lock, mmobj, dirty list and wait
+         *   queue come back from vnode_ctor already initialized): */
+        KASSERT(0 == vn->vn_refcount && 0 == vn->vn_nrespages);
+        KASSERT(list_empty(&vn->vn_dirtypages));
+        KASSERT(0 == vn->vn_nrandom && 0 == vn->vn_nsequential);
+        KASSERT(!krwlock_held(&vn->vn_lock));
+        KASSERT(sched_queue_empty(&vn->vn_waitq));
         /*     members that can be initialized here: */
+        vn->vn_ops = NULL;
         vn->vn_fs = fs;
         vn->vn_vno = vno;
-        kmutex_init(&vn->vn_mutex);
-        mmobj_init(&vn->vn_mmobj, &vnode_mmobj_ops);
-        sched_queue_init(&vn->vn_waitq);
+        vn->vn_mode = 0;
+        vn->vn_len = 0;
+        vn->vn_i = NULL;
+        vn->vn_devid = NULL_DEVID;
+        vn->vn_cdev = NULL;
+        vn->vn_bdev = NULL;
+        vn->vn_ra_next = 0;
+        vn->vn_ra_window = 0;
+        vn->vn_map_nblocks = 0;
+        vn->vn_nreserved = 0;
+        vn->vn_flags = 0;
+        vnode_modified(vn);
 
 #ifdef __MOUNTING__
         vn->vn_mount = vn;
@@ -177,14 +306,16 @@ find:
          *     vn_mode, vn_len, vn_i, and vn_devid (if
          *     appropriate)): */
 
-        /*       mark it busy and place it on vnode_inuse_list (so it can
+        /*       mark it busy and place it on the hash (so it can
          *       be found while we are possibly blocking): (also, seems
          *       appropriate not to ref it yet since no references from
          *       outside this context (vnode.c) will exist until we are
          *       done bringing the vnode in)
          */
         vn->vn_flags |= VN_BUSY;
-        list_insert_head(&vnode_inuse_list, &vn->vn_link);
+        list_insert_head(hash_vnode(fs, vno), &vn->vn_hlink);
+        list_insert_head(&fs->fs_vnodes, &vn->vn_link);
+        vnode_ncore++;
 
         KASSERT(vn->vn_fs->fs_op && vn->vn_fs->fs_op->read_vnode);
         /*       this is where we might block (depending on the underlying
@@ -206,7 +337,8 @@ find:
  * - decrement vn->vn_refcount
  * - if it is zero
  *     - (vn->vn_nrespages should also be zero)
- *     - free the vnode
+ *     - if the file still exists, put the vnode on the inactive list
+ *     - otherwise free the vnode
  *
  * - (otherwise it is > zero)
  *
@@ -247,6 +379,7 @@ vput(struct vnode *vn)
                  * actively-referenced ever again, and thus there is no
                  * point in keeping it or any cached pages of it around.
                  */
+                dcache_purge_vnode(vn);
                 list_iterate_begin(&vn->vn_mmobj.mmo_respages, vp, pframe_t,
                                    pf_olink) {
                         /*  (dbounov):
@@ -256,8 +389,7 @@ vput(struct vnode *vn)
                          * not touch non-anonymous objects). Both of them should
                          * definately free the page, if they have it busy.
                          */
-                        while (pframe_is_busy(vp))
-                                sched_sleep_on(&(vp->pf_waitq));
+                        pframe_wait_busy(vp);
                         pframe_free(vp);
                 } list_iterate_end();
 
@@ -276,10 +408,31 @@ vput(struct vnode *vn)
         KASSERT(vn->vn_mount == vn);
 #endif
 
-        /* no res pages and no more active references; free the vnode */
+        /* no res pages and no more active references */
         KASSERT(0 == vn->vn_refcount);
         KASSERT(0 == vn->vn_nrespages);
 
+        /* if the file still exists, keep the vnode around in case it is
+         * wanted again. A file system's root is only put when it is
+         * unmounted, so it is freed right away. */
+        if (vn != vn->vn_fs->fs_root && vn->vn_fs->fs_op->query_vnode(vn)) {
+                list_insert_tail(&vnode_inactive_list, &vn->vn_ilink);
+                vnode_ninactive++;
+                return;
+        }
+
+        vnode_free(vn);
+}
+
+/*
+ * Frees an unreferenced vnode, handing it back to its file system with
+ * delete_vnode first.
+ */
+static void
+vnode_free(vnode_t *vn)
+{
+        KASSERT(0 == vn->vn_refcount && 0 == vn->vn_nrespages);
+
         vn->vn_flags |= VN_BUSY;
         if (vn->vn_fs->fs_op->delete_vnode) {
                 vn->vn_fs->fs_op->delete_vnode(vn);
@@ -298,17 +451,69 @@ vput(struct vnode *vn)
          * we were taking it away: */
         sched_broadcast_on(&vn->vn_waitq);
 
-        list_remove(&vn->vn_link); /* remove from vn_inuse_list */
+        list_remove(&vn->vn_hlink);
+        list_remove(&vn->vn_link); /* remove from fs_vnodes */
+        vnode_ncore--;
         slab_obj_free(vnode_allocator, vn);
 }
 
+/*
+ * Frees up to 'target' inactive vnodes (all of them if target is
+ * negative), least recently used first, and returns how many were
+ * freed. This is the vnode shrinker, which the slab allocator calls when
+ * memory runs low, and is called by vget when MAX_VNODES are in core.
+ *
+ * This function may block.
+ */
+static int
+vnode_reclaim(int target)
+{
+        int n = 0;
+
+        while (0 < vnode_ninactive && (0 > target || n < target)) {
+                vnode_t *vn = list_head(&vnode_inactive_list, vnode_t, vn_ilink);
+
+                list_remove(&vn->vn_ilink);
+                vnode_ninactive--;
+                vnode_free(vn);
+                n++;
+        }
+        return n;
+}
+
+static uint32_t
+vnode_reclaimable(void)
+{
+        return vnode_ninactive;
+}
+
+/*
+ * Frees the inactive vnodes of the given file system, which is about to
+ * be unmounted.
+ *
+ * This function may block.
+ */
+void
+vnode_inactive_purge(struct fs *fs)
+{
+        vnode_t *vn;
+
+restart:
+        list_iterate_begin(&vnode_inactive_list, vn, vnode_t, vn_ilink) {
+                if (vn->vn_fs == fs) {
+                        list_remove(&vn->vn_ilink);
+                        vnode_ninactive--;
+                        vnode_free(vn);
+                        /* This may have blocked. */
+                        goto restart;
+                }
+        } list_iterate_end();
+}
+
 int
 vfs_is_in_use(fs_t *fs)
 {
-        /* - for each vnode vn that is
-         *     - if vn does not belong to this fs
-         *         - continue
-         *
+        /* - for each vnode vn of this fs
          *     - if vn is not the root vnode and (vn->vn_refcount -
          *       vn->vn_nrespages)
          *         - vn is in use => return -EBUSY
@@ -319,7 +524,7 @@ vfs_is_in_use(fs_t *fs)
          *             - return -EBUSY
          *
          */
-        list_t *list = &vnode_inuse_list;
+        list_t *list = &fs->fs_vnodes;
         list_link_t *link;
         int ret = 0;
         for (link = list->l_next; link != list; link = link->l_next) {
@@ -329,10 +534,7 @@ vfs_is_in_use(fs_t *fs)
                 KASSERT(vn->vn_refcount >= vn->vn_nrespages);
                 KASSERT(vn->vn_nrespages >= 0);
 
-                if (fs != vn->vn_fs)
-                        continue;
-
-                /* otherwise, vn belongs to the given fs */
+                KASSERT(fs == vn->vn_fs);
 
                 /* if it is the root vnode and it has more than one
                  * reference
@@ -365,7 +567,7 @@ vnode_flush_all(struct fs *fs)
         int err;
 
 clean:
-        list_iterate_begin(&vnode_inuse_list, v, vnode_t, vn_link) {
+        list_iterate_begin(&fs->fs_vnodes, v, vnode_t, vn_link) {
                 list_iterate_begin(&v->vn_mmobj.mmo_respages,
                                    p, pframe_t, pf_olink) {
                         if (pframe_is_dirty(p)) {
@@ -385,13 +587,16 @@ clean:
 
         /* all pages of all vnodes belonging to this fs have been cleaned.
          * Now, uncache all of them: */
-        list_iterate_begin(&vnode_inuse_list, v, vnode_t, vn_link) {
+        list_iterate_begin(&fs->fs_vnodes, v, vnode_t, vn_link) {
                 list_iterate_begin(&v->vn_mmobj.mmo_respages,
                                    p, pframe_t, pf_olink) {
                         KASSERT(!pframe_is_dirty(p));
                         pframe_free(p);
                 } list_iterate_end();
         } list_iterate_end();
+
+        /* which leaves those no longer referenced inactive; free them */
+        vnode_inactive_purge(fs);
 }
 
 
@@ -401,13 +606,11 @@ clean:
 int
 vnode_inuse(struct fs *fs)
 {
-        vnode_t *vn;
+        list_link_t *link;
         int n = 0;
 
-        list_iterate_begin(&vnode_inuse_list, vn, vnode_t, vn_link) {
-                if (vn->vn_fs == fs)
-                        n++;
-        } list_iterate_end();
+        for (link = fs->fs_vnodes.l_next; link != &fs->fs_vnodes; link = link->l_next)
+                n++;
         return n;
 }
 
@@ -425,6 +628,21 @@ init_special_vnode(vnode_t *vn)
 }
 
 
+/* Reads of /dev/zero clear the whole pages of buf with page_zero, which
+ * does not pull them into the cache, and only the ends with memset */
+static int
+special_zero_read(void *buf, size_t count)
+{
+        char *p = (char *) buf, *end = p + count;
+        char *head = MIN(end, (char *) PAGE_ALIGN_UP(p));
+
+        memset(p, 0, head - p);
+        for (p = head; p + PAGE_SIZE <= end; p += PAGE_SIZE)
+                page_zero(p);
+        memset(p, 0, end - p);
+        return count;
+}
+
 /*
  * If the file is a byte device then find the file's
  * bytedev_t, and call read on it. Return what read returns.
@@ -444,6 +662,10 @@ special_file_read(vnode_t *file, off_t offset, void *buf, size_t count)
     {
         bytedev_t* cdev = file->vn_dev;
         KASSERT(cdev);
+        if (MEM_ZERO_DEVID == file->vn_devid)
+                return special_zero_read(buf, count);
+        if (MEM_NULL_DEVID == file->vn_devid)
+                return 0;
         bytedev_ops_t* ops = cdev->cd_ops;
         KASSERT(ops);
         return ops->read(file, offset, buf, count);
@@ -469,6 +691,9 @@ special_file_write(vnode_t *file, off_t offset, const void *buf, size_t count)
     {
         bytedev_t* cdev = file->vn_dev;
         KASSERT(cdev);
+        /* what is written to /dev/null is never looked at */
+        if (MEM_NULL_DEVID == file->vn_devid)
+                return count;
         bytedev_ops_t* ops = cdev->cd_ops;
         KASSERT(ops);
         return ops->write(file, offset, buf, count);
@@ -486,10 +711,39 @@ special_file_write(vnode_t *file, off_t offset, const void *buf, size_t count)
 static int
 special_file_mmap(vnode_t *file, vmarea_t *vma, mmobj_t **ret)
 {
+        mmobj_t *o;
+
+        /* A mapping of /dev/zero is anonymous memory of its own, as with
+         * MAP_ANON, so the driver is left out. Reads of it are given the
+         * shared zero page until written. The object is made for this
+         * area alone, and the reference the caller takes is its only
+         * one. */
+        if (MEM_ZERO_DEVID == file->vn_devid) {
+                if (NULL == (o = anon_create()))
+                        return -ENOMEM;
+                o->mmo_refcount--;
+                *ret = o;
+                return 0;
+        }
+
         NOT_YET_IMPLEMENTED("VM: special_file_mmap");
         return 0;
 }
 
+/* A tty can be read once it has a line for the reader; the other byte
+ * devices never keep a reader or writer waiting for long, so are always
+ * ready. */
+static int
+special_file_poll(vnode_t *file, int events, struct poll_table *pt)
+{
+        KASSERT(S_ISCHR(file->vn_mode) && NULL != file->vn_cdev);
+
+        if (TTY_MAJOR == MAJOR(file->vn_devid))
+                return tty_poll(CONTAINER_OF(file->vn_cdev, tty_device_t, tty_cdev),
+                                events, pt);
+        return POLLIN | POLLOUT;
+}
+
 /* Stat is currently the only filesystem specific routine that we have to worry
  * about for special files.  Here we just call the stat routine for the root
  * directory of the filesystem.
@@ -573,14 +827,157 @@ vlookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
         return pframe_get(o, pagenum, pf);
 }
 
+/*
+ * Called after page 'pagenum' of 'v' had to be read in. A reader that
+ * faults on exactly the page following the last one read ahead is taken
+ * to be sequential: the next vn_ra_window pages are read in too, and the
+ * window doubles (up to READAHEAD_MAX_PAGES) each time this happens. Any
+ * other fault closes the window again.
+ *
+ * While a file on v is advised POSIX_FADV_SEQUENTIAL the window opens
+ * all the way at once; while files on it are only advised
+ * POSIX_FADV_RANDOM nothing is read ahead.
+ */
+static void
+vreadahead(vnode_t *v, uint32_t pagenum)
+{
+        uint32_t npages = ((uint32_t) v->vn_len + PAGE_SIZE - 1) / PAGE_SIZE;
+        uint32_t start = pagenum + 1;
+        uint32_t count;
+
+        if (pagenum != v->vn_ra_next
+            || (0 < v->vn_nrandom && 0 == v->vn_nsequential)) {
+                v->vn_ra_window = 0;
+                v->vn_ra_next = start;
+                return;
+        }
+
+        if (0 < v->vn_nsequential)
+                v->vn_ra_window = READAHEAD_MAX_PAGES;
+        else if (0 == v->vn_ra_window)
+                v->vn_ra_window = READAHEAD_MIN_PAGES;
+        else
+                v->vn_ra_window = MIN(v->vn_ra_window << 1, READAHEAD_MAX_PAGES);
+
+        count = (start < npages) ? MIN(v->vn_ra_window, npages - start) : 0;
+        if (0 < count) {
+                /* the pages read ahead are filled through vreadpage too */
+                v->vn_flags |= VN_READAHEAD;
+                count = pframe_prefetch(&v->vn_mmobj, start, count);
+                v->vn_flags &= ~VN_READAHEAD;
+        }
+        v->vn_ra_next = start + count;
+}
+
+void
+vnode_modified(vnode_t *vn)
+{
+        vn->vn_wgen = ++vnode_wgen;
+}
+
+vnode_t *
+vnode_of_mmobj(mmobj_t *o)
+{
+        return (&vnode_mmobj_ops == o->mmo_ops) ? mmobj_to_vnode(o) : NULL;
+}
+
+void
+vnode_willneed(mmobj_t *o, uint32_t pagenum, uint32_t npages)
+{
+        vnode_t *v;
+        uint32_t filepages, count;
+
+        if (&vnode_mmobj_ops != o->mmo_ops)
+                return;
+
+        v = mmobj_to_vnode(o);
+        filepages = ((uint32_t) v->vn_len + PAGE_SIZE - 1) / PAGE_SIZE;
+        if (pagenum >= filepages)
+                return;
+        npages = MIN(npages, filepages - pagenum);
+
+        /* like readahead, this does not start more readahead */
+        v->vn_flags |= VN_READAHEAD;
+        while (0 < npages) {
+                uint32_t want = MIN(npages, READAHEAD_MAX_PAGES);
+
+                /* it stops short when free memory runs low */
+                if (want != (count = pframe_prefetch(o, pagenum, want)))
+                        break;
+                pagenum += count;
+                npages -= count;
+        }
+        v->vn_flags &= ~VN_READAHEAD;
+}
+
+void
+vnode_dontneed(mmobj_t *o, uint32_t pagenum, uint32_t npages)
+{
+        pframe_t *pf;
+
+        for (; 0 < npages; pagenum++, npages--) {
+                if (NULL != (pf = pframe_get_resident(o, pagenum)) && !pframe_is_dirty(pf)
+                    && !pframe_is_pinned(pf) && !pframe_is_busy(pf))
+                        pframe_free(pf);
+        }
+}
+
+void
+vnode_fadvise(vnode_t *vn, int from, int to)
+{
+        if (POSIX_FADV_RANDOM == from)
+                vn->vn_nrandom--;
+        else if (POSIX_FADV_SEQUENTIAL == from)
+                vn->vn_nsequential--;
+
+        if (POSIX_FADV_RANDOM == to)
+                vn->vn_nrandom++;
+        else if (POSIX_FADV_SEQUENTIAL == to)
+                vn->vn_nsequential++;
+}
+
 static int
 vreadpage(mmobj_t *o, pframe_t *pf)
 {
+        int ret;
+
         KASSERT(NULL != pf);
         KASSERT(NULL != o);
 
         vnode_t *v = mmobj_to_vnode(o);
-        return v->vn_ops->fillpage(v, (int)PN_TO_ADDR(pf->pf_pagenum), pf->pf_addr);
+        ret = v->vn_ops->fillpage(v, (int)PN_TO_ADDR(pf->pf_pagenum), pf->pf_addr);
+        if (0 == ret && !(VN_READAHEAD & v->vn_flags))
+                vreadahead(v, pf->pf_pagenum);
+        return ret;
+}
+
+/* Only used for readahead, which is why it never starts more readahead */
+static int
+vreadpages(mmobj_t *o, pframe_t **pfs, int npages)
+{
+        void *pagebufs[READAHEAD_MAX_PAGES];
+        vnode_t *v;
+        int i, ret;
+
+        KASSERT(NULL != pfs);
+        KASSERT(NULL != o);
+        KASSERT(0 < npages && npages <= READAHEAD_MAX_PAGES);
+
+        v = mmobj_to_vnode(o);
+        if (NULL == v->vn_ops->fillpages) {
+                for (i = 0; i < npages; i++) {
+                        if ((ret = v->vn_ops->fillpage(v, (int) PN_TO_ADDR(pfs[i]->pf_pagenum),
+                                                       pfs[i]->pf_addr)) < 0)
+                                return ret;
+                }
+                return 0;
+        }
+
+        for (i = 0; i < npages; i++) {
+                KASSERT(pfs[i]->pf_pagenum == pfs[0]->pf_pagenum + (uint32_t) i);
+                pagebufs[i] = pfs[i]->pf_addr;
+        }
+        return v->vn_ops->fillpages(v, (int) PN_TO_ADDR(pfs[0]->pf_pagenum), pagebufs, npages);
 }
 
 static int
@@ -591,6 +988,7 @@ vdirtypage(mmobj_t *o, pframe_t *pf)
 
         vnode_t *v = mmobj_to_vnode(o);
         if (!pframe_is_dirty(pf)) {
+                vnode_modified(v);
                 return v->vn_ops->dirtypage(v, (int) PN_TO_ADDR(pf->pf_pagenum));
         } else {
                 return 0;
@@ -606,3 +1004,36 @@ vcleanpage(mmobj_t *o, pframe_t *pf)
         vnode_t *v = mmobj_to_vnode(o);
         return v->vn_ops->cleanpage(v, (int) PN_TO_ADDR(pf->pf_pagenum), pf->pf_addr);
 }
+
+static int
+vcleanpages(mmobj_t *o, pframe_t **pfs, int npages)
+{
+        void *pagebufs[PFRAME_CLEAN_BATCH];
+        vnode_t *v;
+        int i, ret;
+
+        KASSERT(NULL != pfs);
+        KASSERT(NULL != o);
+        KASSERT(0 < npages && npages <= PFRAME_CLEAN_BATCH);
+
+        v = mmobj_to_vnode(o);
+        if (NULL == v->vn_ops->cleanpages) {
+                for (i = 0; i < npages; i++) {
+                        if ((ret = vcleanpage(o, pfs[i])) < 0)
+                                return ret;
+                }
+                return 0;
+        }
+
+        for (i = 0; i < npages; i++) {
+                KASSERT(pfs[i]->pf_pagenum == pfs[0]->pf_pagenum + (uint32_t) i);
+                pagebufs[i] = pfs[i]->pf_addr;
+        }
+        return v->vn_ops->cleanpages(v, (int) PN_TO_ADDR(pfs[0]->pf_pagenum), pagebufs, npages);
+}
+
+static list_t *
+vdirtylist(mmobj_t *o)
+{
+        return &mmobj_to_vnode(o)->vn_dirtypages;
+}
@@ -0,0 +1,194 @@
+/*
+ * Warm boot: the file pages in the page cache at shutdown are read back
+ * in by a worker thread as soon as the next boot has mounted the root
+ * file system, while init and the shell start, so that the programs and
+ * libraries they load are mostly in memory by the time they fault on
+ * them.
+ *
+ * The list is kept by inode and page number (the VFS layer has no way to
+ * ask where a page is on the disk). Sorted that way, each file's pages
+ * come in runs which pframe_prefetch reads a run at a time, and files
+ * created together, which s5fs puts in nearby inodes and blocks, are
+ * read one after the other.
+ */
+
+#include "kernel.h"
+#include "errno.h"
+#include "globals.h"
+
+#include "fs/fcntl.h"
+#include "fs/stat.h"
+#include "fs/vfs.h"
+#include "fs/vfs_syscall.h"
+#include "fs/vnode.h"
+#include "fs/warmboot.h"
+
+#include "mm/kmalloc.h"
+#include "mm/pframe.h"
+
+#include "proc/workq.h"
+
+#include "util/debug.h"
+
+#define WARMBOOT_MAGIC          0x5742534c      /* "WBSL" */
+#define WARMBOOT_MAX_PAGES      2048            /* 16 KB of list */
+
+typedef struct warmboot_hdr {
+        uint32_t        wh_magic;
+        uint32_t        wh_npages;
+} warmboot_hdr_t;
+
+typedef struct warmboot_page {
+        uint32_t        wp_vno;
+        uint32_t        wp_pagenum;
+} warmboot_page_t;
+
+typedef struct warmboot_list {
+        fs_t            *wl_fs;
+        uint32_t         wl_npages;
+        warmboot_page_t *wl_pages;
+} warmboot_list_t;
+
+static work_t warmboot_work;
+
+/* pframe_walk's function: adds pf to the list if it is a page of a
+ * regular file on the root file system */
+static void
+warmboot_add(pframe_t *pf, void *arg)
+{
+        warmboot_list_t *wl = (warmboot_list_t *) arg;
+        vnode_t *vn;
+
+        if (WARMBOOT_MAX_PAGES == wl->wl_npages)
+                return;
+        if (NULL == (vn = vnode_of_mmobj(pf->pf_obj)) || wl->wl_fs != vn->vn_fs
+            || !S_ISREG(vn->vn_mode))
+                return;
+        wl->wl_pages[wl->wl_npages].wp_vno = vn->vn_vno;
+        wl->wl_pages[wl->wl_npages].wp_pagenum = pf->pf_pagenum;
+        wl->wl_npages++;
+}
+
+static int
+warmboot_before(const warmboot_page_t *a, const warmboot_page_t *b)
+{
+        return (a->wp_vno != b->wp_vno) ? a->wp_vno < b->wp_vno
+               : a->wp_pagenum < b->wp_pagenum;
+}
+
+/* A shell sort; the list is not long, and this runs at shutdown */
+static void
+warmboot_sort(warmboot_page_t *pages, uint32_t n)
+{
+        uint32_t gap, i, j;
+        warmboot_page_t p;
+
+        for (gap = n / 2; gap > 0; gap /= 2) {
+                for (i = gap; i < n; i++) {
+                        p = pages[i];
+                        for (j = i; j >= gap && warmboot_before(&p, &pages[j - gap]); j -= gap)
+                                pages[j] = pages[j - gap];
+                        pages[j] = p;
+                }
+        }
+}
+
+void
+warmboot_save(void)
+{
+        warmboot_list_t wl;
+        warmboot_hdr_t wh;
+        int fd, err;
+
+        KASSERT(PID_IDLE == curproc->p_pid);
+
+        wl.wl_fs = vfs_root_vn->vn_fs;
+        wl.wl_npages = 0;
+        if (NULL == (wl.wl_pages = kmalloc(WARMBOOT_MAX_PAGES * sizeof(warmboot_page_t)))) {
+                dbg(DBG_VFS, "warmboot: no memory for the page list\n");
+                return;
+        }
+        pframe_walk(warmboot_add, &wl);
+        warmboot_sort(wl.wl_pages, wl.wl_npages);
+
+        wh.wh_magic = WARMBOOT_MAGIC;
+        wh.wh_npages = wl.wl_npages;
+        if (0 > (fd = do_open(WARMBOOT_PATH, O_WRONLY | O_CREAT | O_TRUNC))) {
+                dbg(DBG_VFS, "warmboot: cannot create %s: %d\n", WARMBOOT_PATH, fd);
+                kfree(wl.wl_pages);
+                return;
+        }
+        if (sizeof(wh) != (err = do_write(fd, &wh, sizeof(wh)))
+            || (int)(wl.wl_npages * sizeof(warmboot_page_t))
+            != (err = do_write(fd, wl.wl_pages, wl.wl_npages * sizeof(warmboot_page_t)))) {
+                dbg(DBG_VFS, "warmboot: cannot write %s: %d\n", WARMBOOT_PATH, err);
+                do_close(fd);
+                do_unlink(WARMBOOT_PATH);
+        } else {
+                dbg(DBG_VFS, "warmboot: saved %u pages\n", wl.wl_npages);
+                do_close(fd);
+        }
+        kfree(wl.wl_pages);
+}
+
+/* Reads the list in, or returns NULL if there is none, or none which
+ * makes sense. Either way, the file is gone afterwards. */
+static warmboot_page_t *
+warmboot_load(uint32_t *npages)
+{
+        warmboot_page_t *pages = NULL;
+        warmboot_hdr_t wh;
+        int fd, len;
+
+        if (0 > (fd = do_open(WARMBOOT_PATH, O_RDONLY)))
+                return NULL;
+        if (sizeof(wh) == do_read(fd, &wh, sizeof(wh))
+            && WARMBOOT_MAGIC == wh.wh_magic && WARMBOOT_MAX_PAGES >= wh.wh_npages
+            && NULL != (pages = kmalloc(MAX(wh.wh_npages, 1) * sizeof(warmboot_page_t)))) {
+                len = wh.wh_npages * sizeof(warmboot_page_t);
+                if (len != do_read(fd, pages, len)) {
+                        kfree(pages);
+                        pages = NULL;
+                }
+                *npages = wh.wh_npages;
+        }
+        do_close(fd);
+        do_unlink(WARMBOOT_PATH);
+        return pages;
+}
+
+/* The work item: prefetches each run of consecutive pages of a file
+ * with one vnode_willneed */
+static void
+warmboot_run(void *arg)
+{
+        warmboot_page_t *pages;
+        uint32_t npages, i, j, nread = 0;
+        vnode_t *vn;
+
+        if (NULL == (pages = warmboot_load(&npages)))
+                return;
+
+        for (i = 0; i < npages; i = j) {
+                j = i + 1;
+                while (j < npages && pages[j].wp_vno == pages[i].wp_vno
+                       && pages[j].wp_pagenum == pages[j - 1].wp_pagenum + 1)
+                        j++;
+
+                vn = vget(vfs_root_vn->vn_fs, pages[i].wp_vno);
+                if (S_ISREG(vn->vn_mode)) {
+                        vnode_willneed(&vn->vn_mmobj, pages[i].wp_pagenum, j - i);
+                        nread += j - i;
+                }
+                vput(vn);
+        }
+        dbg(DBG_VFS, "warmboot: prefetched %u of %u pages\n", nread, npages);
+        kfree(pages);
+}
+
+void
+warmboot_start(void)
+{
+        work_init(&warmboot_work, warmboot_run, NULL);
+        work_queue(&warmboot_work);
+}
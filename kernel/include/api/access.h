@@ -9,7 +9,12 @@ struct argvec;
 int copy_from_user(void *kaddr, const void *uaddr, size_t nbytes);
 int copy_to_user(void *uaddr, const void *kaddr, size_t nbytes);
 
+/* Where a faulting user access at eip continues, or 0 if eip is not one */
+uintptr_t access_fixup(uintptr_t eip);
+
 char *user_strdup(struct argstr *ustr);
+char *user_path(struct argstr *ustr);
+void user_path_free(char *path);
 char **user_vecdup(struct argvec *uvec);
 
 int range_perm(struct proc *p, const void *vaddr, size_t len, int perm);
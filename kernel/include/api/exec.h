@@ -6,6 +6,8 @@ struct regs;
 
 int do_execve(const char *filename, char *const *argv, char *const *envp, struct regs *regs);
 
+int do_spawn(const char *filename, char *const *argv, char *const *envp);
+
 void kernel_execve(const char *filename, char *const *argv, char *const *envp);
 
 void userland_entry(const struct regs *regs);
@@ -0,0 +1,33 @@
+/* kdata.h - The kernel data page, which every process can read
+ */
+
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+#ifdef __KERNEL__
+#include "types.h"
+#else
+#include "sys/types.h"
+#endif
+
+/*
+ * The kernel maps one page of its own read-only at KDATA_ADDR, the top
+ * page of user memory, in every address space it execs, so that values
+ * which would otherwise take a system call to read can be read from
+ * userland straight off the page. The kernel writes them as they change
+ * (at each clock tick), so they are never more than a tick old. There
+ * is one page for all processes; nothing per-process is on it.
+ */
+#define KDATA_ADDR      0xbffff000
+
+typedef struct kdata {
+        volatile uint32_t       kd_jiffies;     /* clock ticks since boot */
+        uint32_t                kd_tick_msecs;  /* milliseconds per tick */
+        volatile uint32_t       kd_free_pages;  /* free physical pages */
+        uint32_t                kd_page_size;
+} kdata_t;
+
+#ifndef __KERNEL__
+#define KDATA           ((const kdata_t *) KDATA_ADDR)
+#endif
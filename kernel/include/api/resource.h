@@ -0,0 +1,29 @@
+/* resource.h - Resource usage of a process
+ */
+
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+#ifdef __KERNEL__
+#include "types.h"
+#else
+#include "sys/types.h"
+#endif
+
+/* Whose usage getrusage(2) reports */
+#define RUSAGE_SELF     0
+
+/* Page faults the process has taken since it last exec'd, and the CPU
+ * cycles spent handling each kind (including any time spent waiting for
+ * the page to be read in) */
+struct rusage {
+        uint32_t ru_minflt;          /* the page was resident */
+        uint32_t ru_majflt;          /* it had to be read in */
+        uint32_t ru_cowflt;          /* a private copy of it was made */
+        uint32_t ru_zeroflt;         /* anonymous memory never written before */
+        uint64_t ru_minflt_cycles;
+        uint64_t ru_majflt_cycles;
+        uint64_t ru_cowflt_cycles;
+        uint64_t ru_zeroflt_cycles;
+};
@@ -49,13 +49,50 @@
 #define SYS_getpid              35
 #define SYS_errno               39
 #define SYS_halt                40
-#define SYS_get_free_mem        41 /* NYI */
+#define SYS_get_free_mem        41
 #define SYS_set_errno           42
 #define SYS_dup2                43
 #define SYS_brk                 44
 #define SYS_mount               45
 #define SYS_umount              46
 #define SYS_stat                47
+#define SYS_splice              48
+#define SYS_readv               49
+#define SYS_writev              50
+#define SYS_pread               51
+#define SYS_pwrite              52
+#define SYS_preadv              53
+#define SYS_pwritev             54
+#define SYS_spawn               55
+#define SYS_mlock               56
+#define SYS_munlock             57
+#define SYS_madvise             58
+#define SYS_getrusage           59
+#define SYS_fstat               60
+#define SYS_nice                61
+#define SYS_nanosleep           62
+#define SYS_batch               63
+#define SYS_futex               64
+#define SYS_sched_setaffinity   65
+#define SYS_sched_getaffinity   66
+#define SYS_poll                67
+#define SYS_fcntl               68
+#define SYS_fsync               69
+#define SYS_fdatasync           70
+#define SYS_fadvise             71
+#define SYS_sendfile            72
+#define SYS_copy_file_range     73
+#define SYS_openat              74
+#define SYS_fstatat             75
+#define SYS_unlinkat            76
+#define SYS_aio_setup           77
+#define SYS_aio_read            78
+#define SYS_aio_write           79
+#define SYS_aio_error           80
+#define SYS_aio_return          81
+#define SYS_aio_suspend         82
+#define SYS_shm_open            83
+#define SYS_shm_unlink          84
 
 /*
  * ... what does the scouter say about his syscall?
@@ -64,9 +101,14 @@
  */
 #define SYS_debug               9001
 #define SYS_kshell              9002
+#define SYS_dbgmodes            9003
 
 struct regs;
 struct stat;
+struct iovec;
+struct rusage;
+struct timespec;
+struct pollfd;
 
 typedef struct argstr {
         const char *as_str;
@@ -98,6 +140,89 @@ typedef struct munmap_args {
         size_t  len;
 } munmap_args_t;
 
+typedef struct mlock_args {
+        const void *addr;
+        size_t      len;
+} mlock_args_t;
+
+typedef struct madvise_args {
+        void   *addr;
+        size_t  len;
+        int     advice;
+} madvise_args_t;
+
+typedef struct getrusage_args {
+        int            who;
+        struct rusage *usage;
+} getrusage_args_t;
+
+typedef struct nanosleep_args {
+        const struct timespec *req;
+        struct timespec       *rem;
+} nanosleep_args_t;
+
+/* futex(2) operations */
+#define FUTEX_WAIT      0       /* sleep if *uaddr is still val */
+#define FUTEX_WAKE      1       /* wake up to val waiters */
+
+typedef struct futex_args {
+        uint32_t              *uaddr;
+        int                    op;
+        uint32_t               val;
+        const struct timespec *timeout; /* FUTEX_WAIT only; NULL for none */
+} futex_args_t;
+
+/* Processor masks: bit i for processor i */
+typedef struct sched_setaffinity_args {
+        pid_t                  pid;     /* 0 for the caller */
+        uint32_t               mask;
+} sched_setaffinity_args_t;
+
+typedef struct sched_getaffinity_args {
+        pid_t                  pid;     /* 0 for the caller */
+        uint32_t              *mask;
+} sched_getaffinity_args_t;
+
+typedef struct poll_args {
+        struct pollfd         *fds;
+        uint32_t               nfds;
+        int                    timeout; /* milliseconds; negative for none */
+} poll_args_t;
+
+struct aiocb;
+
+typedef struct aio_suspend_args {
+        const struct aiocb *const *list;
+        int                    nent;
+        const struct timespec *timeout; /* NULL for none */
+} aio_suspend_args_t;
+
+/* One syscall of a batch; the kernel fills in se_ret and se_errno */
+typedef struct sysbatch_ent {
+        uint32_t se_sysnum;
+        uint32_t se_arg;
+        int      se_ret;
+        int      se_errno;
+} sysbatch_ent_t;
+
+/* Stop at the first syscall of a batch which fails */
+#define SYSBATCH_STOP 0x1
+
+typedef struct sysbatch_args {
+        sysbatch_ent_t *ents;
+        int             count;
+        int             flags;
+} sysbatch_args_t;
+
+/* Changes the kernel's dbg() modes by a string like "vfs,-pframe",
+ * if dma_modes.as_str is not NULL, then writes the modes now on to
+ * dma_buf, if it is not NULL */
+typedef struct dbgmodes_args {
+        argstr_t  dma_modes;
+        char     *dma_buf;
+        size_t    dma_len;
+} dbgmodes_args_t;
+
 typedef struct open_args {
         argstr_t filename;
         int      flags;
@@ -167,4 +292,89 @@ typedef struct stat_args {
         struct stat *buf;
 } stat_args_t;
 
+typedef struct fstat_args {
+        int          fd;
+        struct stat *buf;
+} fstat_args_t;
+
+/* The *at() calls; dirfd may be AT_FDCWD */
+typedef struct openat_args {
+        int          dirfd;
+        argstr_t     filename;
+        int          flags;
+        int          mode;
+} openat_args_t;
+
+typedef struct fstatat_args {
+        int          dirfd;
+        argstr_t     path;
+        struct stat *buf;
+        int          flags;
+} fstatat_args_t;
+
+typedef struct unlinkat_args {
+        int          dirfd;
+        argstr_t     path;
+        int          flags;
+} unlinkat_args_t;
+
+typedef struct fcntl_args {
+        int          fd;
+        int          cmd;
+        int          arg;
+} fcntl_args_t;
+
+typedef struct fadvise_args {
+        int          fd;
+        off_t        off;
+        off_t        len;
+        int          advice;
+} fadvise_args_t;
+
+typedef struct sendfile_args {
+        int          out_fd;
+        int          in_fd;
+        off_t       *off;       /* NULL for in_fd's file position */
+        size_t       count;
+} sendfile_args_t;
+
+/* The offsets are NULL for the files' positions; no flags are defined */
+typedef struct copy_file_range_args {
+        int          fd_in;
+        off_t       *off_in;
+        int          fd_out;
+        off_t       *off_out;
+        size_t       len;
+        unsigned int flags;
+} copy_file_range_args_t;
+
+typedef struct splice_args {
+        int    fdin;
+        int    fdout;
+        size_t len;
+} splice_args_t;
+
+/* readv, writev, preadv and pwritev; off is ignored by the first two */
+typedef struct iov_args {
+        int                 fd;
+        const struct iovec *iov;
+        int                 iovcnt;
+        off_t               off;
+} iov_args_t;
+
+typedef struct pread_args {
+        int    fd;
+        void  *buf;
+        size_t nbytes;
+        off_t  off;
+} pread_args_t;
+
 struct utsname;
+
+#ifdef __KERNEL__
+/* Per-syscall call counts and log2 latency histograms, which are only
+ * collected once enabled */
+void syscall_stats_enable(int on);
+void syscall_stats_reset(void);
+size_t syscall_stats_info(const void *data, char *buf, size_t size);
+#endif
@@ -0,0 +1,17 @@
+/* time.h - Time intervals, as for nanosleep(2)
+ */
+
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+#ifdef __KERNEL__
+#include "types.h"
+#else
+#include "sys/types.h"
+#endif
+
+struct timespec {
+        int32_t tv_sec;         /* seconds */
+        int32_t tv_nsec;        /* and nanoseconds, less than 1000000000 */
+};
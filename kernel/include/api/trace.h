@@ -0,0 +1,92 @@
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+#ifdef __KERNEL__
+#include "types.h"
+#else
+#include "sys/types.h"
+#endif
+
+/*
+ * Static tracepoints. Each event belongs to a class, and each class has
+ * its own ring of the most recent TRACE_RING_ENTS events, so that a
+ * busy class (slab, say) does not push a quiet one (faults) out. A
+ * class records nothing until it is turned on.
+ *
+ * /dev/trace holds, for each class in turn, a trace_hdr_t followed by
+ * its ring of trace_ent_t; event th_head - 1 is the newest, at index
+ * (th_head - 1) % th_size. Writing "on [class,...]", "off" or "reset"
+ * to it turns classes on (all of them if none are named), turns all of
+ * them off, or empties the rings. usr/bin/trace decodes it.
+ */
+
+#define TRACE_CLASS_PAGE        0
+#define TRACE_CLASS_SLAB        1
+#define TRACE_CLASS_PFRAME      2
+#define TRACE_CLASS_FAULT       3
+#define TRACE_CLASS_SCHED       4
+#define TRACE_CLASS_SYSCALL     5
+#define TRACE_NCLASSES          6
+
+#define TRACE_CLASS_NAMES \
+        { "page", "slab", "pframe", "fault", "sched", "syscall" }
+
+/* An event number holds its class in its top byte */
+#define TRACE_EVENT(class, n)   (((class) << 8) | (n))
+#define TRACE_CLASS(event)      ((event) >> 8)
+
+                                                        /* te_args: */
+#define TRACE_PAGE_ALLOC        TRACE_EVENT(TRACE_CLASS_PAGE, 0)    /* addr, npages */
+#define TRACE_PAGE_FREE         TRACE_EVENT(TRACE_CLASS_PAGE, 1)    /* addr, npages */
+#define TRACE_SLAB_ALLOC        TRACE_EVENT(TRACE_CLASS_SLAB, 0)    /* obj, allocator */
+#define TRACE_SLAB_FREE         TRACE_EVENT(TRACE_CLASS_SLAB, 1)    /* obj, allocator */
+#define TRACE_PFRAME_GET        TRACE_EVENT(TRACE_CLASS_PFRAME, 0)  /* mmobj, pagenum */
+#define TRACE_FAULT             TRACE_EVENT(TRACE_CLASS_FAULT, 0)   /* vaddr, cause, cycles */
+#define TRACE_SWITCH            TRACE_EVENT(TRACE_CLASS_SCHED, 0)   /* from, to, to pid */
+#define TRACE_SYSCALL_ENTER     TRACE_EVENT(TRACE_CLASS_SYSCALL, 0) /* sysnum, arg */
+#define TRACE_SYSCALL_EXIT      TRACE_EVENT(TRACE_CLASS_SYSCALL, 1) /* sysnum, ret, errno */
+
+#define TRACE_RING_ENTS         512
+#define TRACE_MAGIC             0x74726163      /* "trac" */
+
+typedef struct trace_hdr {
+        uint32_t th_magic;
+        uint32_t th_class;
+        uint32_t th_size;       /* entries in the ring */
+        uint32_t th_head;       /* events ever recorded since the reset */
+} trace_hdr_t;
+
+typedef struct trace_ent {
+        uint64_t te_time;       /* the time stamp counter */
+        uint16_t te_event;
+        int16_t  te_pid;        /* -1 before there are processes */
+        uint32_t te_args[3];
+} trace_ent_t;
+
+#ifdef __KERNEL__
+
+extern uint32_t trace_classes;
+
+/* Costs a load and a not-taken branch while the class is off; the
+ * arguments are only evaluated once it is on */
+#define TRACE(event, a0, a1, a2)                                        \
+        do {                                                            \
+                if (__builtin_expect(0 != (trace_classes                \
+                                           & (1 << TRACE_CLASS(event))), 0)) \
+                        trace_record((event), (uint32_t)(a0),           \
+                                     (uint32_t)(a1), (uint32_t)(a2));   \
+        } while (0)
+
+void trace_record(uint32_t event, uint32_t a0, uint32_t a1, uint32_t a2);
+
+/* Turns the classes in the mask on and the rest off, allocating the
+ * rings of the ones being turned on for the first time */
+int trace_enable(uint32_t classes);
+/* Parses a comma-separated list of class names into a mask */
+int trace_parse(const char *names, uint32_t *classes);
+void trace_reset(void);
+/* Copies the /dev/trace layout from offset into buf */
+int trace_read(int offset, void *buf, int count);
+
+#endif /* __KERNEL__ */
@@ -2,3 +2,6 @@
 
 #define KERNEL_PHYS_BASE 0x100000
 #define MEMORY_MAP_BASE 0x9000
+/* Where the other processors start, once the bootloader is done with
+ * the low memory (see boot/smpboot.S) */
+#define SMP_TRAMPOLINE_PADDR 0x7000
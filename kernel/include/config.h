@@ -12,6 +12,9 @@
  * kernel configuration parameters
  */
 #define DEFAULT_STACK_SIZE      (56*1024) /* size of stacks */
+#define USER_STACK_INIT         (16*1024) /* user stacks start this big */
+#define USER_STACK_MAX          (8*1024*1024) /* and grow down to at most this */
+#define USER_STACK_GAP          (64*1024) /* free space kept below them */
 #define TICK_MSECS              10        /* msecs between clock interrupts */
 
 /*
@@ -19,16 +22,24 @@
  */
 
 /*
- *     finds fraction of available page frames that will be dedicated to kmem
- *     the rest are given to the vm system
+ *     The slab allocators and the page cache take their frames from the one
+ *     page allocator, with no fixed share for either; under pressure pageoutd
+ *     takes back from each in proportion to what it could give (see
+ *     pageoutd_balance in mm/pframe.c).
  */
-#define KMEM_FRAC(x)               (((x)>>2)+((x)>>3)) /* 37.5%-ish */
 
 /*     pframe/mmobj-system-related: */
-#define PF_HASH_SIZE                  17 /* Number of buckets in pn/mmobj->pframe hash */
+#define PF_HASH_MIN_SHIFT              5 /* log2 of initial number of buckets in pn/mmobj->pframe hash */
+#define PF_HASH_LOAD                   2 /* grow the hash when chains average this long */
 /*         Pageout-related: */
-#define PAGEOUTD_FREE_TARGET_SHIFT     5 /* 3.125% */
-#define PAGEOUTD_FREE_MIN_SHIFT        4 /* 6.25% */
+#define PAGEOUTD_FREE_TARGET_SHIFT     4 /* 6.25%: pageoutd stops reclaiming here */
+#define PAGEOUTD_FREE_LOW_SHIFT        5 /* 3.125%: pageoutd starts reclaiming here */
+#define PAGEOUTD_FREE_MIN_SHIFT        6 /* 1.5625%: allocations wait below this */
+/*         Writeback-related: */
+#define PFLUSHD_INTERVAL_MSECS      5000 /* pflushd looks for old dirty pages this often */
+#define PFLUSHD_EXPIRE_MSECS       30000 /* and writes back those dirty for longer */
+#define PFLUSHD_BACKGROUND_SHIFT       4 /* 6.25%: pflushd writes back any dirty file pages above this */
+#define PFLUSHD_THROTTLE_SHIFT         3 /* 12.5%: writers help write back above this */
 
 
 /*
@@ -36,11 +47,15 @@
  */
 
 #define MAXPATHLEN              1024    /* maximum size of a pathname */
-#define MAX_FILES               1024    /* max number of files */
-#define MAX_VFS                 8       /* max # of vfses */
 #define MAX_VNODES              1024    /* max number of in-core vnodes */
 #define NAME_LEN                28      /* maximum directory entry length */
-#define NFILES                  32      /* maximum number of open files */
+#define NFILES                  32      /* maximum number of open files; fixed
+                                         * by proc_t's layout, which the
+                                         * prebuilt proc and fork code use */
+#define READAHEAD_MIN_PAGES     2       /* first readahead window of a sequential reader */
+#define READAHEAD_MAX_PAGES     16      /* largest readahead window */
+#define DCACHE_NBUCKETS         64      /* name cache hash chains */
+#define DCACHE_MAX_ENTRIES      512     /* name cache entries, positive and negative */
 
 /* Note: if rootfs is ramfs, this is completely ignored */
 #define VFS_ROOTFS_DEV  "disk0" /* device containing root filesystem */
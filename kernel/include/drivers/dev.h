@@ -19,6 +19,7 @@
  *     - char major 1:         Memory devices (mem)
  *         - minor 0:          /dev/null       The null device
  *         - minor 1:          /dev/zero       The zero device
+ *         - minor 2:          /dev/slabinfo   Slab allocator statistics
  *
  *     - char major 2:         TTY devices (tty)
  *         - minor 0:          /dev/tty0       First TTY device
@@ -29,6 +30,12 @@
  *         - minor 0:          first disk device
  *         - minor 1:          second disk device
  *         - and so on...
+ *
+ *     - block major 2:        RAM disks
+ *         - minor 0:          /dev/ram0, if RAMDISK_PAGES is set
+ *
+ *     - block major 3:        Striped disks
+ *         - minor 0:          /dev/md0, if STRIPE_DISKS is set
  */
 
 #define MINOR_BITS              8
@@ -41,9 +48,19 @@
 #define NULL_DEVID              (MKDEVID(0, 0))
 #define MEM_NULL_DEVID          (MKDEVID(1, 0))
 #define MEM_ZERO_DEVID          (MKDEVID(1, 1))
+#define MEM_SLABINFO_DEVID      (MKDEVID(1, 2))
+#define MEM_INTRINFO_DEVID      (MKDEVID(1, 3))
+#define MEM_SYSSTAT_DEVID       (MKDEVID(1, 4))
+#define MEM_TRACE_DEVID         (MKDEVID(1, 5))
 
 #define DISK_MAJOR 1
+#define RAMDISK_MAJOR 2
+#define STRIPE_MAJOR 3
+#define HMDISK_MAJOR 4
 
 #define MEM_MAJOR       1
 #define MEM_NULL_MINOR  0
 #define MEM_ZERO_MINOR  1
+#define MEM_SLABINFO_MINOR 2
+#define MEM_INTRINFO_MINOR 3
+#define MEM_SYSSTAT_MINOR 4
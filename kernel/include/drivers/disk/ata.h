@@ -1,5 +1,14 @@
 #pragma once
 
+/*
+ * The ATA driver is prebuilt (drivers/disk/libdisk.a). It carries out
+ * every read_block and write_block as one bus-master DMA command (see
+ * dma.h), with one interrupt however many blocks it covers, and has no
+ * per-sector PIO path. A caller gets fewer interrupts per byte by
+ * asking for more blocks at once, as blkqueue's scatter-gather requests
+ * do.
+ */
+
 /**
  * Initialize the ATA subsystem.
  */
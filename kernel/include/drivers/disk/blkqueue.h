@@ -0,0 +1,106 @@
+/*
+ *       FILE: blkqueue.h
+ *      DESCR: asynchronous block I/O request queues
+ */
+
+#pragma once
+
+#include "types.h"
+
+#include "drivers/blockdev.h"
+#include "proc/sched.h"
+#include "util/list.h"
+
+#define BLK_READ        0
+#define BLK_WRITE       1
+
+/* Most blocks a scatter-gather request may transfer */
+#define BLK_MAX_SEGS    16
+
+struct blk_request;
+typedef void (*blk_done_t)(struct blk_request *req);
+
+/*
+ * A request to transfer br_count blocks between a block device and
+ * either one page-aligned buffer (br_buf) or, for a scatter-gather
+ * request, br_count separate block-sized page-aligned buffers (br_segs).
+ * The submitter owns the request and must keep it (and its buffers)
+ * alive until it has completed.
+ */
+typedef struct blk_request {
+        blockdev_t         *br_bdev;
+        int                 br_dir;         /* BLK_READ or BLK_WRITE */
+        char               *br_buf;         /* NULL for scatter-gather */
+        void              **br_segs;        /* one buffer per block */
+        blocknum_t          br_block;
+        size_t              br_count;
+
+        /* Completion: br_done is set, then everyone sleeping on br_waitq
+         * is woken up, then br_callback (if any) is called from the
+         * queue's thread. The queue never touches the request again after
+         * calling br_callback, so the callback may free it. */
+        int                 br_done;
+        int                 br_err;         /* 0 or -errno */
+        blk_done_t          br_callback;
+        void               *br_data;        /* for use by br_callback */
+        ktqueue_t           br_waitq;
+
+        /* Private: */
+        list_link_t         br_link;        /* link on the queue's pending list */
+} blk_request_t;
+
+/**
+ * Initializes a request. br_callback and br_data are cleared and may be
+ * set afterwards.
+ */
+void blk_request_init(blk_request_t *req, blockdev_t *bdev, int dir,
+                      char *buf, blocknum_t block, size_t count);
+
+/**
+ * Initializes a scatter-gather request: block 'block + i' is transferred
+ * to or from segs[i], for i < count <= BLK_MAX_SEGS.
+ */
+void blk_request_init_sg(blk_request_t *req, blockdev_t *bdev, int dir,
+                         void **segs, blocknum_t block, size_t count);
+
+/**
+ * Queues a request on its device and returns without waiting for it.
+ * Requests on the same device are started in C-LOOK order (ascending
+ * block number, wrapping around to the lowest pending block). Devices
+ * without a queue carry out the request before this returns.
+ *
+ * @param req an initialized request which is not already pending
+ */
+void blk_submit(blk_request_t *req);
+
+/**
+ * Waits for a submitted request to complete.
+ *
+ * @return the request's result, 0 on success or -errno on failure
+ */
+int blk_wait(blk_request_t *req);
+
+/**
+ * Submits a request and waits for it. A drop-in replacement for calling
+ * the device's read_block or write_block directly.
+ *
+ * @return 0 on success, -errno on failure
+ */
+int blk_rw(blockdev_t *bdev, int dir, char *buf, blocknum_t block, size_t count);
+
+/**
+ * Like blk_rw, for a scatter-gather transfer.
+ */
+int blk_rw_sg(blockdev_t *bdev, int dir, void **segs, blocknum_t block, size_t count);
+
+/**
+ * Stops the queue threads once their pending requests are done. Called
+ * by idleproc at shutdown, after the last block has been written back.
+ */
+void blkqueue_shutdown(void);
+
+/**
+ * Debug info function, prints each queue's pending and completed
+ * request counts.
+ */
+size_t blkqueue_info(const void *data, char *buf, size_t size);
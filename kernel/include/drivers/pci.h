@@ -33,6 +33,30 @@
 #define PCI_CMD_IO		BIT(0)
 #define PCI_CMD_MMIO		BIT(1)
 #define PCI_CMD_BUSMASTER	BIT(2)
+#define PCI_CMD_INTXDISABLE	BIT(10)
+
+#define PCI_STATUS_CAPLIST	BIT(4)
+
+/* Capability IDs, and the registers of the MSI capability (from its
+ * offset); MME and MMC are the log2 of the messages enabled and those
+ * the device can send */
+#define PCI_CAP_MSI		0x05
+
+#define PCI_MSI_CONTROL		0x02
+#define PCI_MSI_ADDR		0x04
+#define PCI_MSI_ADDR_HI		0x08
+#define PCI_MSI_DATA_32		0x08
+#define PCI_MSI_DATA_64		0x0C
+
+#define PCI_MSI_CTL_ENABLE	BIT(0)
+#define PCI_MSI_CTL_MMC(ctl)	(((ctl) >> 1) & 0x7)
+#define PCI_MSI_CTL_MME_SHIFT	4
+#define PCI_MSI_CTL_MME_MASK	(0x7 << PCI_MSI_CTL_MME_SHIFT)
+#define PCI_MSI_CTL_64BIT	BIT(7)
+
+/* Where a message is written to reach the local APIC with the given ID */
+#define PCI_MSI_ADDR_BASE	0xFEE00000
+#define PCI_MSI_ADDR_DEST(id)	((uint32_t)(id) << 12)
 
 enum {
 	PCI_MMIO, PCI_IO, PCI_INVALIDBAR
@@ -70,3 +94,19 @@ pcidev_t* pci_lookup(uint8_t class, uint8_t subclass, uint8_t interface);
 uint32_t pci_read_config(pcidev_t* dev, uint8_t reg_off, uint8_t length);
 
 void pci_write_config(pcidev_t* dev, uint8_t reg_off, uint32_t val, uint8_t length);
+
+/* The rest are in drivers/pci_msi.c, as the code above is prebuilt. */
+
+/* Returns the offset in the device's configuration space of its
+ * capability with the given ID, or 0 if it has none. */
+uint8_t pci_find_capability(pcidev_t* dev, uint8_t id);
+
+/* Has the device raise nvecs message signalled interrupts, intr to
+ * intr + nvecs - 1, at the boot processor's local APIC instead of
+ * asserting its interrupt line. nvecs is a power of two no more than 32,
+ * and intr a multiple of it. Returns 0, -ENODEV if the device has no MSI
+ * capability, or -ERANGE if it cannot send nvecs messages. */
+int pci_msi_enable(pcidev_t* dev, uint8_t intr, int nvecs);
+
+/* Puts the device back to asserting its interrupt line. */
+void pci_msi_disable(pcidev_t* dev);
@@ -5,6 +5,9 @@ struct tty_device;
 
 typedef void (*tty_driver_callback_t)(void *, char);
 
+/* One character at a time, for the same reason as tty_ldisc_ops_t: the
+ * virtual terminal driver which fills this in is only prebuilt. The
+ * cost this leaves is the screen writes, made cheap in screen.c. */
 typedef struct tty_driver_ops {
         /**
          * Write the given character to the tty driver.
@@ -3,6 +3,13 @@
 struct tty_ldisc;
 struct tty_device;
 
+/*
+ * Output goes through here a character at a time, with no buffer-wide
+ * process_buf: the tty and n_tty code that fill in and call this table
+ * exist only as prebuilt objects (drivers/libdrivers.a, tty/libtty.a),
+ * which lay it out as these five members. Any member added would be
+ * read past the end of their table.
+ */
 typedef struct tty_ldisc_ops {
         /**
          * Attaches a line discipline to the given tty and allocates
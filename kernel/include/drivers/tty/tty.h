@@ -27,3 +27,15 @@ void tty_init(void);
  * @return a newly allocated tty or NULL on error
  */
 tty_device_t *tty_create(struct tty_driver *driver, int id);
+
+struct poll_table;
+
+/**
+ * The poll entry point of a tty's device file (see vnode_ops_t).
+ *
+ * @param tty the tty
+ * @param events the events polled for
+ * @param pt the poll table to wait with, or NULL
+ * @return the events the tty has
+ */
+int tty_poll(tty_device_t *tty, int events, struct poll_table *pt);
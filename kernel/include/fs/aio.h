@@ -0,0 +1,64 @@
+/* aio.h - Asynchronous I/O, as for aio_read(3)
+ */
+
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+#ifdef __KERNEL__
+#include "types.h"
+#else
+#include "sys/types.h"
+#endif
+
+/*
+ * A read or write which the caller does not wait for. Each request is
+ * made on a completion queue, an fd got from aio_setup(), which polls
+ * readable while requests on it have finished that have not been read
+ * from it; reading it gives the struct aiocb pointers of those
+ * requests. As with POSIX, aio_error() is EINPROGRESS until a request
+ * has finished, and aio_return() gives its result and must be called
+ * once for each request, after which the aiocb may be used again.
+ *
+ * The data read is in aio_buf once the process has seen that the
+ * request finished: when aio_error(), aio_return() or aio_suspend()
+ * says it has, or it is read from the queue. Only the process which
+ * made the queue may use it.
+ */
+struct aiocb {
+        int             aio_fildes;     /* the file to read or write */
+        off_t           aio_offset;     /* where in it */
+        volatile void  *aio_buf;
+        size_t          aio_nbytes;
+        int             aio_queue;      /* the aio_setup() fd to finish on */
+};
+
+/* The most bytes a request may move, and requests a queue may hold */
+#define AIO_MAX_NBYTES  65536
+#define AIO_MAX_REQS    64
+
+#ifndef __KERNEL__
+struct timespec;
+
+int     aio_setup(void);
+int     aio_read(struct aiocb *cb);
+int     aio_write(struct aiocb *cb);
+int     aio_error(const struct aiocb *cb);
+int     aio_return(struct aiocb *cb);
+int     aio_suspend(const struct aiocb *const list[], int nent,
+                    const struct timespec *timeout);
+#else
+/* The aio syscalls, of which ucb (and each of ucbs) is in user space.
+ * do_aio_suspend waits for at most ticks clock ticks, or for ever if
+ * it is negative. */
+int do_aio_setup(void);
+int do_aio_read(const struct aiocb *ucb);
+int do_aio_write(const struct aiocb *ucb);
+int do_aio_error(const struct aiocb *ucb);
+int do_aio_return(const struct aiocb *ucb);
+int do_aio_suspend(const struct aiocb *const *ucbs, int nent, int ticks);
+
+/* Lets the requests about to be done finish, then stops the workers.
+ * Called by the idle process when shutting down. */
+void aio_shutdown(void);
+#endif
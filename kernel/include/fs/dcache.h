@@ -0,0 +1,80 @@
+/*
+ *       FILE: dcache.h
+ *      DESCR: directory entry (name lookup) cache
+ */
+
+#pragma once
+
+#include "types.h"
+
+struct vnode;
+struct fs;
+
+/* dcache_lookup's result when the cache knows nothing about the name */
+#define DCACHE_MISS     1
+
+/**
+ * Looks up 'name' in the directory 'dir' in the name cache. "." and
+ * ".." are never cached.
+ *
+ * @param dir the directory to look in
+ * @param name the name, which need not be null-terminated
+ * @param len the length of name
+ * @param result on a positive hit, set to the entry's vnode with its
+ * refcount incremented
+ * @param genp on a miss, set to the value to pass to dcache_enter once
+ * the name has been looked up in the file system
+ * @return 0 on a positive hit, -ENOENT if the name is known not to
+ * exist, DCACHE_MISS otherwise
+ */
+int dcache_lookup(struct vnode *dir, const char *name, size_t len,
+                  struct vnode **result, uint32_t *genp);
+
+/**
+ * As dcache_lookup, but on a positive hit *result is only borrowed: no
+ * reference is taken, and it is a miss if the vnode is not in core. For
+ * walking through directories without blocking.
+ */
+int dcache_peek(struct vnode *dir, const char *name, size_t len,
+                struct vnode **result);
+
+/**
+ * Records the result of a file system lookup of 'name' in 'dir': vn is
+ * the vnode found, or NULL if the name does not exist. If the cache has
+ * been invalidated since 'gen' was handed out by dcache_lookup the
+ * lookup may have raced with a change to the directory, and nothing is
+ * recorded. Nothing is recorded for a directory with VN_NOCACHE set
+ * either.
+ */
+void dcache_enter(struct vnode *dir, const char *name, size_t len,
+                  struct vnode *vn, uint32_t gen);
+
+/**
+ * Forgets whatever is known about 'name' in 'dir'. Must be called after
+ * any operation which adds, removes or replaces a directory entry.
+ */
+void dcache_remove(struct vnode *dir, const char *name, size_t len);
+
+/**
+ * Forgets every entry in, or naming, the vnode 'vn'. Called once the
+ * vnode has been deleted, since its inode number may be reused.
+ */
+void dcache_purge_vnode(struct vnode *vn);
+
+/**
+ * Forgets every entry belonging to the file system 'fs'. Called before
+ * it is unmounted.
+ */
+void dcache_purge_fs(struct fs *fs);
+
+/**
+ * A count which changes whenever any directory entry may have been
+ * added, removed or renamed (that is, with every dcache_remove or
+ * purge), for caches of things derived from names.
+ */
+uint32_t dcache_namegen(void);
+
+/**
+ * Debug info function, prints the cache's size and hit rates.
+ */
+size_t dcache_info(const void *data, char *buf, size_t size);
@@ -15,3 +15,22 @@
 #define O_CREAT         0x100   /* Create file if non-existent. */
 #define O_TRUNC         0x200   /* Truncate to zero length. */
 #define O_APPEND        0x400   /* Append to file. */
+#define O_NONBLOCK      0x800   /* Fail with EAGAIN rather than wait. */
+#define O_DIRECT        0x1000  /* Move whole pages past the page cache. */
+#define O_EXCL          0x2000  /* With O_CREAT, fail if it exists (shm_open). */
+
+/* For the *at() calls: the dirfd meaning the current directory, and
+ * unlinkat()'s flag to remove a directory. */
+#define AT_FDCWD        -100
+#define AT_REMOVEDIR    0x200
+
+/* Commands for fcntl(). */
+#define F_GETFL         3       /* Get the access mode and status flags. */
+#define F_SETFL         4       /* Set O_APPEND, O_NONBLOCK and O_DIRECT. */
+
+/* Advice for posix_fadvise(). */
+#define POSIX_FADV_NORMAL       0       /* No particular access pattern. */
+#define POSIX_FADV_RANDOM       1       /* Read in no particular order. */
+#define POSIX_FADV_SEQUENTIAL   2       /* Read in order, once. */
+#define POSIX_FADV_WILLNEED     3       /* The range will be read soon. */
+#define POSIX_FADV_DONTNEED     4       /* The range will not be read again. */
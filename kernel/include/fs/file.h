@@ -5,10 +5,14 @@
 #define FMODE_READ    1
 #define FMODE_WRITE   2
 #define FMODE_APPEND  4
+#define FMODE_NONBLOCK 8
+#define FMODE_DIRECT  16
 
 #define FMODE_ISREAD(m)      ((m & FMODE_READ) != 0)
 #define FMODE_ISWRITE(m)      ((m & FMODE_WRITE) != 0)
 #define FMODE_ISAPPEND(m)      ((m & FMODE_APPEND) != 0)
+#define FMODE_ISNONBLOCK(m)      ((m & FMODE_NONBLOCK) != 0)
+#define FMODE_ISDIRECT(m)      ((m & FMODE_DIRECT) != 0)
 
 struct vnode;
 
@@ -22,9 +26,10 @@ typedef struct file {
 
         /*
          * The mode in which this file was opened. This is a mask of the flags
-         * FMODE_READ, FMODE_WRITE, and FMODE_APPEND. It is set when the file
-         * is first opened, and use to restrict the operations that can be
-         * performed on the underlying vnode.
+         * FMODE_READ, FMODE_WRITE, FMODE_APPEND, FMODE_NONBLOCK and
+         * FMODE_DIRECT. It is set when the file is first opened (though
+         * fcntl can change the last three), and use to restrict the operations that can be performed on
+         * the underlying vnode.
          */
         int                     f_mode;
 
@@ -34,6 +39,13 @@ typedef struct file {
          */
         int                     f_refcount;
 
+        /*
+         * POSIX_FADV_NORMAL, POSIX_FADV_RANDOM or POSIX_FADV_SEQUENTIAL, as
+         * last given to fadvise(2) (see do_fadvise). The vnode counts its
+         * files which have the last two.
+         */
+        int                     f_advice;
+
         /*
          * The vnode which corresponds to this file.
          */
@@ -9,6 +9,9 @@
 
 struct open_args;
 struct proc;
+struct vnode;
 
 int do_open(const char *filename, int flags);
+int do_openat(int dirfd, const char *filename, int flags);
 int get_empty_fd(struct proc *p);
+int get_dirfd_vnode(int dirfd, struct vnode **base);
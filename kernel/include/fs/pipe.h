@@ -7,4 +7,7 @@
 
 #pragma once
 
+#include "types.h"
+
 int do_pipe(int pipefd[2]);
+int do_splice(int fdin, int fdout, size_t len);
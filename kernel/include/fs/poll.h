@@ -0,0 +1,75 @@
+/* poll.h - Waiting for file descriptors to be ready, as for poll(2)
+ */
+
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+#ifdef __KERNEL__
+#include "types.h"
+#else
+#include "sys/types.h"
+#endif
+
+#define POLLIN          0x01    /* a read would not block */
+#define POLLPRI         0x02    /* (never set, there is no urgent data) */
+#define POLLOUT         0x04    /* a write would not block */
+#define POLLERR         0x08    /* a write would fail (revents only) */
+#define POLLHUP         0x10    /* nothing more will be written (revents only) */
+#define POLLNVAL        0x20    /* the fd is not open (revents only) */
+
+typedef unsigned int nfds_t;
+
+struct pollfd {
+        int     fd;
+        short   events;         /* what to wait for */
+        short   revents;        /* what there is */
+};
+
+#ifdef __KERNEL__
+#include "proc/sched.h"
+#include "util/list.h"
+
+/*
+ * A thread only sleeps on one queue, so a poller cannot sleep on the
+ * queues of all the files it is waiting for. Instead each of those has
+ * a pollhead, and a poller links a waiter onto it for each file, all of
+ * them pointing back to its poll_table, on whose queue it sleeps.
+ * Whatever makes a file readier calls poll_wakeup on its pollhead,
+ * which wakes every poll_table with a waiter there.
+ */
+typedef struct pollhead {
+        list_t                  ph_waiters;
+} pollhead_t;
+
+typedef struct poll_waiter {
+        list_link_t             pw_link;        /* on a pollhead */
+        struct poll_table      *pw_pt;
+} poll_waiter_t;
+
+typedef struct poll_table {
+        ktqueue_t               pt_q;
+        int                     pt_woken;       /* since it last looked */
+        poll_waiter_t          *pt_waiters;
+        int                     pt_nwaiters;
+        int                     pt_maxwaiters;
+} poll_table_t;
+
+void pollhead_init(pollhead_t *ph);
+
+/* Called from a vnode's poll entry point with the poll_table it was
+ * given (when that is not NULL), so that the poller is woken by
+ * poll_wakeup on ph. The pollhead must outlast the poll, which it does
+ * as the poller holds the file. */
+void poll_wait(poll_table_t *pt, pollhead_t *ph);
+
+/* Wakes the pollers waiting on ph. May be called from interrupt
+ * context. */
+void poll_wakeup(pollhead_t *ph);
+
+/* poll(2): fills in the revents of the nfds pollfds in fds (which are
+ * in the kernel), waiting for one to have any for at most timeout
+ * milliseconds, or forever if it is negative. Returns how many have
+ * any, 0 if the time ran out, or -errno. */
+int do_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+#endif
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "fs/vfs.h"
+
+int procfs_mount(struct fs *fs);
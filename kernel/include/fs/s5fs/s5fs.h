@@ -12,6 +12,7 @@
 #include "config.h"
 
 #include "proc/kmutex.h"
+#include "proc/workq.h"
 #include "fs/vfs.h"
 #include "mm/page.h"
 #include "drivers/blockdev.h"
@@ -32,21 +33,76 @@
 #define S5_TYPE_DIR             0x2
 #define S5_TYPE_CHR             0x4
 #define S5_TYPE_BLK             0x8
+/* Or'd into S5_TYPE_DATA for a file whose data is in its inode (see below) */
+#define S5_TYPE_INLINE          0x10
 
 #define S5_MAGIC                071177
 #define S5_CURRENT_VERSION      3
+/* Like version 3, but directories may carry a hash index (see below) */
+#define S5_INDEXED_VERSION      4
+/* Like version 4, but files may use a double-indirect block (see below) */
+#define S5_LARGEFILE_VERSION    5
+/* Like version 5, but small files may be kept in their inodes (see below) */
+#define S5_INLINE_VERSION       6
+/* Like version 6, but the disk may be split into groups (see below) */
+#define S5_GROUPED_VERSION      7
+
+#define S5_HAS_DIRINDEX(super)  (S5_INDEXED_VERSION <= (super)->s5s_version)
+#define S5_HAS_DINDIRECT(super) (S5_LARGEFILE_VERSION <= (super)->s5s_version)
+#define S5_HAS_INLINE(super)    (S5_INLINE_VERSION <= (super)->s5s_version)
+#define S5_HAS_GROUPS(super)    (S5_GROUPED_VERSION <= (super)->s5s_version \
+                                 && 0 != (super)->s5s_group_nblocks)
 
 /* Number of blocks stored in the indirect block */
 #define S5_NIDIRECT_BLOCKS      (S5_BLOCK_SIZE / sizeof(uint32_t))
 
+/*
+ * On a S5_LARGEFILE_VERSION file system the last of an inode's direct
+ * block pointers names a double-indirect block instead: a block of
+ * pointers to S5_NIDIRECT_BLOCKS more indirect blocks, which map the
+ * file's blocks after those the (single) indirect block maps. Files can
+ * then have S5_LARGE_MAX_FILE_BLOCKS blocks rather than
+ * S5_MAX_FILE_BLOCKS, though s5_size limits them to 4 GiB.
+ */
+#define S5_DINDIRECT_SLOT       (S5_NDIRECT_BLOCKS - 1)
+#define S5_LARGE_MAX_FILE_BLOCKS \
+        (S5_DINDIRECT_SLOT + S5_NIDIRECT_BLOCKS + S5_NIDIRECT_BLOCKS * S5_NIDIRECT_BLOCKS)
+
 /* Given a file offset, returns the block number that it is in */
 #define S5_DATA_BLOCK(seekptr)  ((seekptr) / S5_BLOCK_SIZE)
 
 /* Given a file offset, returns the offset into the pointer's block */
 #define S5_DATA_OFFSET(seekptr) ((seekptr) % S5_BLOCK_SIZE)
 
+/*
+ * On a S5_GROUPED_VERSION file system with s5s_group_nblocks set, the
+ * blocks after the superblock are split into groups of that many blocks
+ * (the last may be shorter), each starting with the inode blocks for its
+ * own s5s_group_ninodes inodes (a multiple of S5_INODES_PER_BLOCK) and
+ * going on with data blocks. Group g holds inodes g * s5s_group_ninodes
+ * on. There is still one free block list; the groups only decide where
+ * things go. A file's blocks are put in its inode's group, and a file's
+ * inode in its directory's group, so that an inode and the data it is
+ * read with are close together on disk; a new directory goes in a group
+ * with plenty of inodes and blocks left (see s5_alloc_inode). Disks
+ * without groups have all of the inode blocks straight after the
+ * superblock, as before.
+ */
+#define S5_NGROUPS(super)                                                 \
+        (((super)->s5s_num_inodes + (super)->s5s_group_ninodes - 1)       \
+         / (super)->s5s_group_ninodes)
+#define S5_GROUP_IBLOCKS(super) ((super)->s5s_group_ninodes / S5_INODES_PER_BLOCK)
+#define S5_GROUP_START(super, g) (1 + (g) * (super)->s5s_group_nblocks)
+#define S5_GROUP_DATA(super, g) (S5_GROUP_START(super, g) + S5_GROUP_IBLOCKS(super))
+#define S5_INODE_GROUP(super, inum) ((inum) / (super)->s5s_group_ninodes)
+#define S5_BLOCK_GROUP(super, blkno) (((blkno) - 1) / (super)->s5s_group_nblocks)
+
 /* Given an inode number, tells the block that inode is stored in. */
-#define S5_INODE_BLOCK(inum)    ((inum) / S5_INODES_PER_BLOCK + 1)
+#define S5_INODE_BLOCK(super, inum)                                       \
+        (S5_HAS_GROUPS(super)                                             \
+         ? S5_GROUP_START(super, S5_INODE_GROUP(super, inum))             \
+           + ((inum) % (super)->s5s_group_ninodes) / S5_INODES_PER_BLOCK  \
+         : (inum) / S5_INODES_PER_BLOCK + 1)
 
 /*
  * Given an inode number, tells the offset (in units of s5_inode_t) of
@@ -80,6 +136,16 @@ typedef struct s5_super {
         uint32_t s5s_root_inode;         /* root inode */
         uint32_t s5s_num_inodes;         /* number of inodes */
         uint32_t s5s_version;            /* version of this disk format */
+
+        /* Blocks set aside for the journal (see below), or 0 if there is
+         * none; disks made before journals existed have zeros here */
+        uint32_t s5s_journal_start;
+        uint32_t s5s_journal_nblocks;
+
+        /* The size of a group, in blocks and in inodes (see above), or 0 if
+         * the disk is not split into groups */
+        uint32_t s5s_group_nblocks;
+        uint32_t s5s_group_ninodes;
 } s5_super_t;
 
 /* The contents of an inode, as stored on disk. */
@@ -97,20 +163,147 @@ typedef struct s5_inode {
         uint32_t   s5_indirect_block;
 } s5_inode_t;
 
+/*
+ * On a S5_INLINE_VERSION file system a regular file of at most
+ * S5_INLINE_MAX bytes may keep its data in its inode, where the block
+ * pointers would otherwise be, rather than in a block of its own; its
+ * type is then S5_TYPE_DATA | S5_TYPE_INLINE, and S5_INODE_TYPE is its
+ * type without the flag. New files start out inline. A file which grows
+ * past S5_INLINE_MAX is moved to a block (see s5_inline_expand) and is
+ * never made inline again.
+ */
+#define S5_INLINE_MAX           ((S5_NDIRECT_BLOCKS + 1) * sizeof(uint32_t))
+#define S5_INLINE_DATA(inode)   ((char *) (inode)->s5_direct_blocks)
+#define S5_IS_INLINE(inode)     (S5_TYPE_INLINE & (inode)->s5_type)
+#define S5_INODE_TYPE(inode)    ((inode)->s5_type & ~S5_TYPE_INLINE)
+
 /* The contents of a directory entry, as stored on disk. */
 typedef struct s5_dirent {
         uint32_t   s5d_inode;
         char       s5d_name[S5_NAME_LEN];
 } s5_dirent_t;
 
+/*
+ * On a S5_INDEXED_VERSION file system a directory may have a hash index
+ * of its entries, so that names can be found without reading them all.
+ * The entries themselves are stored exactly as in version 3, so anything
+ * which only understands the linear format can still read (though not
+ * safely modify) the directory.
+ *
+ * The index lives in the block named by the directory's
+ * s5_indirect_block, which a directory this small (S5_DIRINDEX_MAX
+ * entries fit in the direct blocks) does not otherwise use. It is an
+ * open-addressed hash table probed linearly from slot
+ * (hash % S5_DIRINDEX_NSLOTS). A slot holds the top half of the name's
+ * hash and, below it, the number of the entry plus one; zero is an
+ * empty slot. A directory which outgrows S5_DIRINDEX_MAX loses its index
+ * and is searched linearly from then on.
+ */
+#define S5_DIRINDEX_MAGIC       0xd1ec7041
+#define S5_DIRINDEX_NSLOTS      ((S5_BLOCK_SIZE - 2 * sizeof(uint32_t)) / sizeof(uint32_t))
+#define S5_DIRINDEX_MAX         (S5_DIRINDEX_NSLOTS * 3 / 4)
+#define S5_DIRINDEX_HASH(slot)  ((slot) & 0xffff0000)
+#define S5_DIRINDEX_ENTRY(slot) ((slot) & 0xffff)
+
+typedef struct s5_dirindex {
+        uint32_t   s5x_magic;              /* S5_DIRINDEX_MAGIC */
+        uint32_t   s5x_nentries;           /* number of full slots */
+        uint32_t   s5x_slots[S5_DIRINDEX_NSLOTS];
+} s5_dirindex_t;
+
+/*
+ * A file system may have a metadata journal: s5s_journal_nblocks
+ * contiguous blocks, set aside by fsmaker, which are on no free list.
+ * Metadata blocks (the superblock, inode blocks, indirect blocks,
+ * directory indexes, the free list) and directory blocks are copied to
+ * the journal before they are written in place, so that a crash leaves
+ * either all or none of a transaction's blocks to be found.
+ *
+ * The first block of the journal is a header naming the sequence number
+ * of the transaction which may be found next. A transaction is one or
+ * more batches, starting in the journal's second block, each a
+ * descriptor record listing where the blocks which follow it go (in the
+ * same order), and a commit record, counting all the blocks, in the
+ * block after the last batch. If the records carry the header's
+ * sequence number, the transaction is complete and is replayed when the
+ * file system is mounted; the header's number is bumped once all of its
+ * blocks have reached their own places.
+ */
+#define S5_JOURNAL_HEADER_MAGIC 0x4a4e4c48
+#define S5_JOURNAL_DESC_MAGIC   0x4a4e4c44
+#define S5_JOURNAL_COMMIT_MAGIC 0x4a4e4c43
+#define S5_JOURNAL_MAX_RECORD   ((S5_BLOCK_SIZE - 3 * sizeof(uint32_t)) / sizeof(uint32_t))
+/* A journal holds a header, a descriptor, a commit record and a block */
+#define S5_JOURNAL_MIN_BLOCKS   4
+
+typedef struct s5_jheader {
+        uint32_t   s5jh_magic;             /* S5_JOURNAL_HEADER_MAGIC */
+        uint32_t   s5jh_seq;
+} s5_jheader_t;
+
+typedef struct s5_jrecord {
+        uint32_t   s5jr_magic;             /* S5_JOURNAL_{DESC,COMMIT}_MAGIC */
+        uint32_t   s5jr_seq;
+        uint32_t   s5jr_nblocks;
+        uint32_t   s5jr_blocks[S5_JOURNAL_MAX_RECORD];     /* descriptor only */
+} s5_jrecord_t;
+
 #ifndef __FSMAKER__
 /* Our in-memory representation of a s5fs filesytem (fs_i points to this) */
 typedef struct s5fs {
         blockdev_t              *s5f_bdev;
         s5_super_t              *s5f_super;
-        kmutex_t                s5f_mutex;
         fs_t                    *s5f_fs;
+
+        /* The file system's own locks. Neither s5f_block_mutex (the free
+         * block bitmap) nor s5f_inode_mutex (the free inode bitmap) is
+         * held while waiting for the disk; s5f_sync_mutex serializes
+         * rewriting the on-disk free lists and is held across its
+         * writes. s5f_block_mutex may be taken with s5f_inode_mutex
+         * held, to pick a group for a directory, but not the other way
+         * around. */
+        kmutex_t                s5f_block_mutex;
+        kmutex_t                s5f_inode_mutex;
+        kmutex_t                s5f_sync_mutex;
+
+        /* The two bitmaps below are built by a work item queued at mount
+         * time, so that mounting only reads the superblock (and replays
+         * the journal). Until s5f_maps_ready, anything which reads or
+         * changes them waits on s5f_maps_waitq (see s5_maps_wait);
+         * s5f_maps_err is why they could not be built, if they could
+         * not, in which case nothing can be allocated. */
+        work_t                  s5f_maps_work;
+        int                     s5f_maps_ready;
+        int                     s5f_maps_err;
+        ktqueue_t               s5f_maps_waitq;
+
+        /* In-core free block bitmap (a set bit is a free block), built from
+         * the on-disk free list at mount time. Allocation and freeing only
+         * touch the bitmap; the on-disk list is rewritten from it at sync
+         * and unmount time (see s5_freemap_sync). */
+        uint32_t                *s5f_freemap;
+        uint32_t                s5f_freemap_nblocks;    /* blocks covered */
+        uint32_t                s5f_nfree;              /* set bits */
+        uint32_t                s5f_nreserved;          /* see s5_reserve_block */
+        int                     s5f_freemap_dirty;
+
+        /* In-core free inode bitmap, built from the inodes at mount time;
+         * the on-disk inode free list is rewritten from it lazily (see
+         * s5_imap_sync). */
+        uint32_t                *s5f_imap;
+        uint32_t                s5f_imap_nbits;
+        uint32_t                s5f_nfree_inodes;
+        int                     s5f_imap_dirty;
+
+        /* The in-core inode table of dirty inode blocks, newest first
+         * (see s5_dirty_inode) */
+        list_t                  s5f_itable;
+        int                     s5f_itable_nblocks;
+
+        /* NULL unless the disk has a journal (see s5fs_journal.c) */
+        struct s5_journal       *s5f_journal;
 } s5fs_t;
 
 int s5fs_mount(struct fs *fs);
+int s5fs_format(blockdev_t *dev, uint32_t nblocks, uint32_t ninodes);
 #endif
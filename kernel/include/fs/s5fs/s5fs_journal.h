@@ -0,0 +1,54 @@
+/*
+ *   FILE: s5fs_journal.h
+ *  DESCR: S5 metadata journal
+ */
+
+#pragma once
+
+#include "types.h"
+
+struct s5fs;
+struct mmobj;
+
+/**
+ * Sets up the journal of a file system whose superblock names one (and
+ * does nothing otherwise), replaying the last transaction if it was
+ * committed but not finished. Called by s5fs_mount.
+ *
+ * @return 0 on success, -errno on failure
+ */
+int  s5_journal_mount(struct s5fs *fs);
+
+/**
+ * Commits whatever is left and frees the journal. Called by
+ * s5fs_umount once nothing can change any more.
+ */
+void s5_journal_umount(struct s5fs *fs);
+
+/**
+ * Group commit: logs every dirty metadata and directory block of the
+ * file system, then writes them in place. Does nothing if nothing was
+ * changed since the last commit.
+ *
+ * @return 0 on success, -errno on failure
+ */
+int  s5_journal_commit(struct s5fs *fs);
+
+/**
+ * Called before pages [pagenum, pagenum + npages) of the given
+ * directory-page or metadata object are written in place (they are
+ * busy, and so not dirty, by then), commits them along with everything
+ * else first if anything changed.
+ */
+int  s5_journal_prewrite(struct s5fs *fs, struct mmobj *o, uint32_t pagenum, int npages);
+
+/**
+ * Notes that a directory block has changed. Metadata blocks are noticed
+ * when they are dirtied.
+ */
+void s5_journal_touch(struct s5fs *fs);
+
+/**
+ * Debug info function, prints each journal's commit counts.
+ */
+size_t s5_journal_info(const void *data, char *buf, size_t size);
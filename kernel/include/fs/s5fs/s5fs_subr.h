@@ -11,13 +11,16 @@
 struct fs;
 struct vnode;
 
-int s5_alloc_inode(struct fs *fs, uint16_t type, devid_t devid);
+int s5_alloc_inode(struct fs *fs, uint16_t type, devid_t devid, ino_t near);
 void s5_free_inode(struct vnode *vnode);
 
 
 int s5_read_file(struct vnode *vn, off_t seek, char *dest, size_t len);
 int s5_write_file(struct vnode *vn, off_t seek, const char *bytes,
                   size_t len);
+int s5_read_direct(struct vnode *vn, off_t seek, char *dest, size_t len);
+int s5_write_direct(struct vnode *vn, off_t seek, const char *bytes,
+                    size_t len);
 
 /* TA BLANK {{{ */
 /* TODO: perhaps change the order of the arguments 'parent' and 'child' to
@@ -28,28 +31,40 @@ int s5_link(struct vnode *parent, struct vnode *child,
 int s5_find_dirent(struct vnode *vnode, const char *name, size_t namelen);
 int s5_remove_dirent(struct vnode *vnode, const char *name, size_t namelen);
 int s5_seek_to_block(struct vnode *vnode, off_t seekptr, int alloc);
+int s5_reserve_block(struct vnode *vnode);
+int s5_map_resident(struct vnode *vnode, off_t seekptr);
+int s5_inline_expand(struct vnode *vnode);
+void s5_inline_read(struct vnode *vnode, off_t offset, void *pagebuf);
+void s5_inline_write(struct vnode *vnode, off_t offset, const void *pagebuf);
+
+/* Values of s5_seek_to_block's 'alloc' */
+#define S5_MAP_LOOKUP           0       /* never allocate */
+#define S5_MAP_ALLOC            1       /* allocate whatever is missing */
+#define S5_MAP_INDIRECT         2       /* only allocate indirect blocks */
+#define S5_MAP_RESERVED         3       /* S5_MAP_ALLOC, into a reservation */
 int s5_inode_blocks(struct vnode *vnode);
 
+struct s5fs;
+int  s5_freemap_build(struct s5fs *fs);
+int  s5_freemap_sync(struct s5fs *fs);
+void s5_freemap_destroy(struct s5fs *fs);
+int  s5_imap_build(struct s5fs *fs);
+void s5_imap_sync(struct s5fs *fs);
+void s5_imap_destroy(struct s5fs *fs);
+void s5_maps_build(struct s5fs *fs);
+int  s5_maps_wait(struct s5fs *fs);
+
 #define VNODE_TO_S5FS(vn)       ( (s5fs_t *)((vn)->vn_fs->fs_i))
 #define VNODE_TO_S5INODE(vn)    ( (s5_inode_t *)(vn)->vn_i )
 #define S5FS_TO_VMOBJ(s5fs)     (&(s5fs)->s5f_bdev->bd_mmobj)
 
-/* TA BLANK {{{ */
-/* TODO: change args to be more natural for how things are arranged in this
- * experimental version of things */
-/* TA BLANK }}} */
-#define s5_dirty_inode(fs, inode)                                       \
-        do {                                                            \
-                pframe_t *p;                                            \
-                int err;                                                \
-                pframe_get(S5FS_TO_VMOBJ((fs)),                         \
-                           S5_INODE_BLOCK((inode)->s5_number), &p);     \
-                KASSERT(p);                                             \
-                err = pframe_dirty(p);                                  \
-                KASSERT(!err                                            \
-                        && "shouldn\'t fail for a page belonging "      \
-                        "to a block device");                           \
-        } while (0)
+/* Most inode blocks the in-core inode table holds (see s5fs_subr.c) */
+#define S5_ITABLE_MAX_BLOCKS    16
+
+struct s5_inode;
+void s5_dirty_inode(struct s5fs *fs, struct s5_inode *inode);
+void s5_inode_flush(struct s5fs *fs, int wait);
+void s5_inode_sync(struct s5fs *fs, struct s5_inode *inode);
 
 /*
  * A Note from the Fennster:
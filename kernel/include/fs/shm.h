@@ -0,0 +1,10 @@
+#pragma once
+
+/*
+ * The shm_open and shm_unlink syscalls, with name in the kernel. A name
+ * is a '/' followed by up to NAME_LEN characters, none of them a '/'.
+ * oflags is O_RDONLY or O_RDWR, with O_CREAT and O_EXCL; O_TRUNC is not
+ * supported, as nothing can shorten an object. See fs/shm.c.
+ */
+int do_shm_open(const char *name, int oflags);
+int do_shm_unlink(const char *name);
@@ -0,0 +1,20 @@
+/* uio.h - Scatter/gather I/O vectors
+ */
+
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+#ifdef __KERNEL__
+#include "types.h"
+#else
+#include "sys/types.h"
+#endif
+
+/* The most segments readv(2) and friends take in one call */
+#define UIO_MAXIOV      64
+
+struct iovec {
+        void   *iov_base;
+        size_t  iov_len;
+};
@@ -58,6 +58,15 @@ typedef struct fs_ops {
          * This entry point is ALLOWED TO BLOCK.
          */
         int (*umount)(struct fs *fs);
+
+        /*
+         * Write back any filesystem metadata which is only kept up to date
+         * in memory, so that the page cache can then be cleaned by sync(2).
+         * Returns 0 on success, negative number on error. May be NULL.
+         *
+         * This entry point is ALLOWED TO BLOCK.
+         */
+        int (*sync)(struct fs *fs);
 } fs_ops_t;
 
 #ifndef STR_MAX
@@ -115,6 +124,13 @@ typedef struct fs {
 
         /* Filesystem-specific data. */
         void            *fs_i;
+
+        /*
+         * The in-core vnodes of this file system, used (only) by
+         * vfs/vnode.c. Whoever allocates the fs_t must list_init() this
+         * before mounting it.
+         */
+        list_t          fs_vnodes;
 } fs_t;
 
 /* - this is the vnode on which we will mount the vfsroot fs.
@@ -141,6 +157,9 @@ extern struct vnode *vfs_root_vn;
  */
 int vfs_shutdown();
 
+/* Calls the sync entry point of every mounted filesystem */
+void vfs_sync(void);
+
 /* Pathname resolution: */
 /* (the corresponding definitions live in namev.c) */
 int lookup(struct vnode *dir, const char *name, size_t len,
@@ -8,21 +8,36 @@
 #include "fs/pipe.h"
 #include "fs/stat.h"
 
+struct file;
+
 int do_close(int fd);
 int do_read(int fd, void *buf, size_t nbytes);
 int do_write(int fd, const void *buf, size_t nbytes);
+int do_pread(int fd, void *buf, size_t nbytes, off_t off);
+int do_pwrite(int fd, const void *buf, size_t nbytes, off_t off);
+int file_pread(struct file *file, void *buf, size_t nbytes, off_t off);
+int file_pwrite(struct file *file, const void *buf, size_t nbytes, off_t off);
 int do_dup(int fd);
 int do_dup2(int ofd, int nfd);
 int do_mknod(const char *path, int mode, unsigned devid);
 int do_mkdir(const char *path);
 int do_rmdir(const char *path);
 int do_unlink(const char *path);
+int do_unlinkat(int dirfd, const char *path, int flags);
 int do_link(const char *from, const char *to);
 int do_rename(const char *oldname, const char *newname);
 int do_chdir(const char *path);
 int do_getdent(int fd, struct dirent *dirp);
+int do_getdents(int fd, struct dirent *dirp, int count);
 int do_lseek(int fd, int offset, int whence);
 int do_stat(const char *path, struct stat *uf);
+int do_fstat(int fd, struct stat *uf);
+int do_fstatat(int dirfd, const char *path, struct stat *uf, int flags);
+int do_fcntl(int fd, int cmd, int arg);
+int do_fsync(int fd, int datasync);
+int do_fadvise(int fd, off_t off, off_t len, int advice);
+int do_sendfile(int outfd, int infd, off_t *off, size_t count);
+int do_copy_file_range(int infd, off_t *inoff, int outfd, off_t *outoff, size_t len);
 
 #ifdef __MOUNTING__
 /* for mounting implementations only, not required */
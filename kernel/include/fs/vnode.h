@@ -13,6 +13,7 @@
 #include "drivers/bytedev.h"
 #include "util/list.h"
 #include "proc/kmutex.h"
+#include "proc/krwlock.h"
 #include "mm/mmobj.h"
 #include "mm/pframe.h"
 
@@ -22,6 +23,7 @@ struct stat;
 struct file;
 struct vnode;
 struct vmarea;
+struct poll_table;
 
 typedef struct vnode_ops {
         /* The following functions map directly to their corresponding
@@ -60,6 +62,43 @@ typedef struct vnode_ops {
          * the returned object if necessary), nor may it block.
          */
         int (*mmap)(struct vnode *file, struct vmarea *vma, struct mmobj **ret);
+        /*
+         * Optional. Returns which of the poll events (see fs/poll.h) the
+         * file has now: those of 'events' it is ready for, and POLLERR
+         * or POLLHUP whether asked for or not. If 'pt' is not NULL it
+         * should also poll_wait on each pollhead which is woken when
+         * the file becomes readier. Must not block. If NULL the file is
+         * always ready.
+         */
+        int (*poll)(struct vnode *file, int events, struct poll_table *pt);
+        /*
+         * Optional. read and write for files opened O_NONBLOCK, which
+         * fail with -EAGAIN rather than wait for data or room, and
+         * otherwise transfer what they can without waiting. If NULL, a
+         * nonblocking read or write fails with -EAGAIN if poll says the
+         * file is not ready, and otherwise goes through read or write.
+         */
+        int (*read_nonblock)(struct vnode *file, off_t offset, void *buf, size_t count);
+        int (*write_nonblock)(struct vnode *file, off_t offset, const void *buf, size_t count);
+        /*
+         * Optional. read and write for files opened O_DIRECT, called only
+         * for whole pages at a page boundary: pages of the file which are
+         * not in the page cache are moved straight between the disk and
+         * 'buf' without being cached, while those which are stay the copy
+         * that counts (they are read from, or written into). If NULL, or
+         * for any other transfer, read and write are used.
+         */
+        int (*read_direct)(struct vnode *file, off_t offset, void *buf, size_t count);
+        int (*write_direct)(struct vnode *file, off_t offset, const void *buf, size_t count);
+
+        /*
+         * Optional: called by fsync(2) and fdatasync(2) once the file's
+         * dirty pages have been written back, to write back what the file
+         * system keeps about the file (its inode, its block map). If
+         * 'datasync' is set, metadata which is not needed to read the data
+         * back (such as times) may be left. Returns 0 or -errno.
+         */
+        int (*fsync)(struct vnode *file, int datasync);
 
         /* Operations that can be performed on directory files: */
 
@@ -109,6 +148,14 @@ typedef struct vnode_ops {
          * read and 0 will be returned.
          */
         int (*readdir)(struct vnode *dir, off_t offset, struct dirent *d);
+        /*
+         * Optional. Reads as many directory entries starting at offset
+         * as fit in the 'count' dirents at 'd', in one pass, setting
+         * each one's d_off to the offset of the entry after it. Returns
+         * how many were read, which is 0 at the end of the directory. If
+         * NULL, readdir is called for each entry in turn.
+         */
+        int (*readdirs)(struct vnode *dir, off_t offset, struct dirent *d, int count);
 
         /* Operations that can be performed on any type of file: */
         /*
@@ -138,6 +185,14 @@ typedef struct vnode_ops {
          * 'pagebuf'.
          */
         int (*fillpage)(struct vnode *vnode, off_t offset, void *pagebuf);
+        /*
+         * Optional. Read the consecutive pages of 'vnode' starting with
+         * the page containing 'offset' into the 'npages' page-sized
+         * buffers in 'pagebufs', reading contiguous blocks with as few
+         * device requests as possible. If NULL, fillpage is called on
+         * each page in turn.
+         */
+        int (*fillpages)(struct vnode *vnode, off_t offset, void **pagebufs, int npages);
         /*
          * A hook; an attempt is being made to dirty the page
          * belonging to 'vnode' that contains 'offset'. (If the
@@ -155,10 +210,23 @@ typedef struct vnode_ops {
          * containing 'offset'.
          */
         int (*cleanpage)(struct vnode *vnode, off_t offset, void *pagebuf);
+        /*
+         * Optional. Write the 'npages' page-sized buffers in 'pagebufs'
+         * to the consecutive pages of 'vnode' starting with the page
+         * containing 'offset', coalescing contiguous blocks into as few
+         * device writes as possible. If NULL, cleanpage is called on
+         * each page in turn.
+         */
+        int (*cleanpages)(struct vnode *vnode, off_t offset, void **pagebufs, int npages);
 } vnode_ops_t;
 
 
 #define VN_BUSY        0x1
+#define VN_READAHEAD   0x2
+/* The names in this directory are not cached (see fs/dcache.c), as its
+ * file system's entries come and go without it knowing; set by
+ * read_vnode */
+#define VN_NOCACHE     0x4
 
 typedef struct vnode {
         /*
@@ -228,10 +296,12 @@ typedef struct vnode {
         off_t              vn_len;
 
         /*
-         * A mutex used to synchronize reads and writes. This is only used by
-         * the underlying filesystem implementation.
+         * A lock used to synchronize reads and writes: held shared by
+         * operations which only look at the file (read, lookup, readdir,
+         * stat) and exclusive by those which change it. This is only used
+         * by the underlying filesystem implementation.
          */
-        kmutex_t           vn_mutex;
+        krwlock_t          vn_lock;
 
         /*
          * A generic pointer which the file system can use to store any extra
@@ -260,9 +330,37 @@ typedef struct vnode {
          */
         blockdev_t        *vn_bdev;
 
+        /* Readahead state, used (only) by the vnode mmobj (vfs/vnode.c): */
+        uint32_t           vn_ra_next;     /* page a sequential reader faults on next */
+        uint32_t           vn_ra_window;   /* pages to read ahead when it does */
+        uint32_t           vn_nrandom;     /* files on it advised POSIX_FADV_RANDOM */
+        uint32_t           vn_nsequential; /* and POSIX_FADV_SEQUENTIAL */
+
+        /* Block mapping cache, used (only) by the file system, which may
+         * remember here that file blocks [vn_map_lblock, vn_map_lblock +
+         * vn_map_nblocks) are on disk blocks starting at vn_map_pblock: */
+        uint32_t           vn_map_lblock;
+        uint32_t           vn_map_pblock;
+        uint32_t           vn_map_nblocks;
+
+        /* Free blocks the file system has set aside for this vnode's
+         * dirty pages which do not have disk blocks yet: */
+        uint32_t           vn_nreserved;
+
+        /* Stamp of the last change to the file's contents (see
+         * vnode_modified), never the same for two different contents
+         * of any in-core vnodes, for caches of what was read from it: */
+        uint32_t           vn_wgen;
+
+        /* The dirty pages of vn_mmobj, so that fsync(2) does not have to
+         * look through all of them (see pframe_register_dirtylist): */
+        list_t             vn_dirtypages;
+
         /* Used (only) by the v{get,ref,put} facilities (vfs/vnode.c): */
-        list_link_t        vn_link;        /* link on system vnode list */
-        int                vn_flags;       /* VN_BUSY */
+        list_link_t        vn_link;        /* link on vn_fs->fs_vnodes */
+        list_link_t        vn_hlink;       /* link on vnode hash chain */
+        list_link_t        vn_ilink;       /* link on inactive list, if unreferenced */
+        int                vn_flags;       /* VN_BUSY, VN_READAHEAD, VN_NOCACHE */
         ktqueue_t          vn_waitq;       /* queue of threads waiting for vnode
                                               to become not busy */
 } vnode_t;
@@ -314,6 +412,16 @@ typedef struct vnode {
  */
 struct vnode *vget(struct fs *fs, ino_t vnum);
 
+/*
+ *     Returns the vnode for 'vnum' in 'fs' if it is already in core and
+ *     not busy, or NULL, without taking a reference. The vnode may go
+ *     away as soon as the caller blocks, so it can only be looked at,
+ *     or vget(), before then.
+ *
+ *     DOES NOT BLOCK.
+ */
+struct vnode *vpeek(struct fs *fs, ino_t vnum);
+
 /*
  *     Increment the reference count of the provided vnode.
  */
@@ -361,12 +469,52 @@ int vfs_is_in_use(struct fs *fs);
  */
 void vnode_flush_all(struct fs *fs);
 
+/*
+ *         Free the vnodes of the specified fs which are being kept in core
+ *         with no references (see vput). Must be done before a file
+ *         system is unmounted.
+ */
+void vnode_inactive_purge(struct fs *fs);
+
 /*
  *         Returns the number of vnodes from this filesystem that are in
  *         use.
  */
 int vnode_inuse(struct fs *fs);
 
+/*
+ *         If o is the memory object of a vnode, reads its pages
+ *         [pagenum, pagenum + npages) into the page cache ahead of their
+ *         use (for MADV_WILLNEED), as far as the file goes and as long
+ *         as memory is not short. Does nothing for any other object.
+ */
+void vnode_willneed(struct mmobj *o, uint32_t pagenum, uint32_t npages);
+
+/*
+ *         Frees the resident pages [pagenum, pagenum + npages) of o which
+ *         are clean and neither pinned nor busy, for POSIX_FADV_DONTNEED.
+ */
+void vnode_dontneed(struct mmobj *o, uint32_t pagenum, uint32_t npages);
+
+/*
+ *         Moves one of the files open on vn from the fadvise(2) advice
+ *         'from' to 'to', keeping count of how many are advised random
+ *         or sequential for readahead (see vreadahead).
+ */
+void vnode_fadvise(vnode_t *vn, int from, int to);
+
+/*
+ *         Returns the vnode whose memory object o is, or NULL if it is
+ *         some other kind of object.
+ */
+vnode_t *vnode_of_mmobj(struct mmobj *o);
+
+/*
+ *         Gives vn a new vn_wgen stamp, as its contents are changing (by
+ *         a write, or a page of it being dirtied through a mapping).
+ */
+void vnode_modified(vnode_t *vn);
+
 
 /* Diagnostic: */
 /*
@@ -0,0 +1,24 @@
+/*
+ *       FILE: warmboot.h
+ *      DESCR: saving the hot part of the page cache across a reboot
+ */
+
+#pragma once
+
+/* The file on the root file system which holds the list */
+#define WARMBOOT_PATH           "/.warmboot"
+
+/**
+ * Writes WARMBOOT_PATH: the file pages (of the root file system) which
+ * are in the page cache, sorted by inode and page. Called by the idle
+ * process at shutdown, before the file system is unmounted.
+ */
+void warmboot_save(void);
+
+/**
+ * Queues work to read the pages WARMBOOT_PATH lists back into the page
+ * cache, then removes it, so that a list is only ever used by the boot
+ * after the clean shutdown which wrote it. Called by the idle process
+ * before init is started.
+ */
+void warmboot_start(void);
@@ -2,6 +2,9 @@
 
 #include "types.h"
 
+/* The most processors which are started */
+#define APIC_MAX_CPUS 8
+
 /* Initializes the APIC using data from the ACPI tables.
  * ACPI handlers must be initialized before calling this
  * function. */
@@ -10,8 +13,22 @@ void apic_init();
 /* Maps the given IRQ to the given interrupt number. */
 void apic_setredir(uint32_t irq, uint8_t intr);
 
-/* Starts the APIC timer */
-void apic_enable_periodic_timer(uint32_t freq);
+/* Masks (or unmasks) the given IRQ at the IOAPIC. */
+void apic_setmask(uint32_t irq, int mask);
+
+/* Starts the APIC timer raising the given interrupt every msecs
+ * milliseconds, having first timed it against the PIT. */
+void apic_enable_periodic_timer(uint8_t intr, uint32_t msecs);
+
+/* Switches the (started) APIC timer to one-shot mode, to raise its
+ * interrupt once after the given number of its periods (at least one,
+ * and as many as its counter can hold). Returns the number of periods
+ * actually used. */
+uint32_t apic_timer_oneshot(uint32_t periods);
+
+/* Switches the timer back to periodic mode after apic_timer_oneshot,
+ * returning the number of whole periods which went by in between. */
+uint32_t apic_timer_periodic(void);
 
 /* Stops the APIC timer */
 void apic_disable_periodic_timer();
@@ -33,3 +50,25 @@ uint8_t apic_getipl();
  * originating from the APIC has been finished. This function
  * should only be called from the interrupt subsystem. */
 void apic_eoi();
+
+/* Returns the number of processors, going by the enabled local APICs
+ * in the ACPI tables, and the local APIC ID of each; processor 0 is the
+ * one which booted. */
+uint32_t apic_ncpus(void);
+uint8_t apic_cpu_id(uint32_t cpu);
+
+/* Returns the local APIC ID of the processor this runs on. */
+uint8_t apic_current_id(void);
+
+/* Starts the processor with the given local APIC ID running in real
+ * mode at the page aligned physical address paddr, which must be below
+ * 1mb, with INIT and STARTUP inter-processor interrupts. */
+void apic_start_ap(uint8_t apicid, uintptr_t paddr);
+
+/* Sends the interrupt intr to the processor with the given local APIC
+ * ID. */
+void apic_send_ipi(uint8_t apicid, uint8_t intr);
+
+/* Enables the local APIC of the processor this runs on, once another
+ * processor has been started. */
+void apic_ap_init(void);
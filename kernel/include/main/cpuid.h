@@ -85,9 +85,14 @@ enum cpuid_requests {
         CPUID_INTELBRANDSTRINGEND,
 };
 
+/* Model-specific registers for SYSENTER/SYSEXIT */
+#define MSR_SYSENTER_CS         0x174
+#define MSR_SYSENTER_ESP        0x175
+#define MSR_SYSENTER_EIP        0x176
+
 static inline void cpuid(int request, uint32_t *a, uint32_t *d)
 {
-        __asm__ volatile("cpuid":"=a"(*a), "=d"(*d):"0"(request));
+        __asm__ volatile("cpuid":"=a"(*a), "=d"(*d):"0"(request):"ebx", "ecx");
 }
 
 static inline void cpuid_get_msr(uint32_t msr, uint32_t* lo, uint32_t* hi)
@@ -100,6 +105,15 @@ static inline void cpuid_set_msr(uint32_t msr, uint32_t lo, uint32_t hi)
 	__asm__ volatile("wrmsr"::"a"(lo),"d"(hi),"c"(msr));
 }
 
+/* The number of cycles since the CPU was reset */
+static inline uint64_t cpuid_rdtsc(void)
+{
+        uint32_t lo, hi;
+
+        __asm__ volatile("rdtsc":"=a"(lo), "=d"(hi));
+        return ((uint64_t) hi << 32) | lo;
+}
+
 static inline void io_wait(void)
 {
 	__asm__ volatile("jmp 1f\n\t"
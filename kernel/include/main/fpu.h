@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Lazy FPU and SSE state. Only the thread which last used the FPU (its
+ * owner) has its registers in the CPU; every other thread runs with
+ * CR0.TS set, so its first FPU or SSE instruction traps (#NM), and only
+ * then is the owner's state saved and the new thread's loaded. Kernel
+ * threads and user programs which never touch the FPU never pay for it,
+ * and a thread switching back to the owner does not either.
+ */
+
+struct kthread;
+
+/* What fxsave writes, or fnsave on a CPU without it */
+typedef struct fpu_state {
+        uint8_t         fs_regs[512];
+        int             fs_valid;       /* if fs_regs has been saved into */
+} __attribute__((aligned(16))) fpu_state_t;
+
+/* Marks a thread's state as never saved, so that its first FPU
+ * instruction starts it from the initial state. */
+void fpu_state_init(fpu_state_t *fs);
+
+/* Sets CR0.TS for the thread about to run unless it owns the FPU. Called
+ * by the scheduler just before switching to it. */
+void fpu_switch(struct kthread *next);
+
+/* Forgets the owner if it is thr, which has exited, so that its state is
+ * not saved onto the stack it is about to give up. */
+void fpu_release(struct kthread *thr);
@@ -13,7 +13,13 @@
 
 void gdt_init(void);
 
+/* Loads a copy of the GDT, with a TSS of its own whose kernel stack is
+ * kstack, on processor cpu (not 0, which booted and uses the original).
+ * Segments set after this are set in the original only. */
+void gdt_init_ap(uint32_t cpu, void *kstack);
+
 void gdt_set_kernel_stack(void *addr);
+void gdt_enable_sysenter(void);
 
 void gdt_set_entry(uint32_t segment, uint32_t base, uint32_t limit,
                    uint8_t ring, int exec, int dir, int rw);
@@ -7,18 +7,26 @@
 
 #define INTR_DIVIDE_BY_ZERO 0x00
 #define INTR_INVALID_OPCODE 0x06
+#define INTR_DEVICE_NOT_AVAILABLE 0x07
 #define INTR_GPF 0x0d
 #define INTR_PAGE_FAULT 0x0e
 
+#define INTR_TLB_SHOOTDOWN 0xf8
 #define INTR_PIT 0xf1
 #define INTR_APICTIMER 0xf0
 #define INTR_KEYBOARD 0xe0
+#define INTR_SERIAL 0xe4
+#define INTR_SERIAL_TTY 0xe3
 #define INTR_DISK_PRIMARY 0xd0
 #define INTR_DISK_SECONDARY 0xd1
 
 /* NOTE: INTR_SYSCALL is not defined here, but is in syscall.h (it must be
  * in a userland-accessible header) */
 
+/* The r_err of a syscall which came in by sysenter rather than int, whose
+ * errno goes back in esi */
+#define INTR_ERR_SYSENTER 1
+
 #define IPL_LOW 0
 #define IPL_HIGH (0xff)
 
@@ -31,6 +39,10 @@ typedef struct regs {
 
 void intr_init();
 
+/* Loads the interrupt table, which intr_init has set up, on a
+ * processor which has been started since. */
+void intr_init_ap();
+
 /* The function pointer which should be implemented by functions
  * which will handle interrupts. These handlers should be registered
  * with the interrupt subsystem via the intr_register function.
@@ -46,6 +58,12 @@ typedef void (*intr_handler_t)(regs_t *regs);
 intr_handler_t intr_register(uint8_t intr, intr_handler_t handler);
 int32_t intr_map(uint16_t irq, uint8_t intr);
 
+/* Notes that the device behind intr now raises it as a message
+ * signalled interrupt (see pci_msi_enable), which goes to the local APIC
+ * without the IOAPIC but still needs an EOI. The IOAPIC line which was
+ * mapped to intr, if any, is masked, and is returned (or -1). */
+int32_t intr_map_msi(uint8_t intr);
+
 static inline void intr_enable()
 {
         __asm__ volatile("sti");
@@ -76,10 +94,13 @@ static inline void intr_wait()
  * At initialization time devices should detect their individual
  * IPLs and save them for use with this function. IPL_LOW allows
  * all hardware interrupts. IPL_HIGH blocks all hardware interrupts */
-static inline void intr_setipl(uint8_t ipl)
-{
-        apic_setipl(ipl);
-}
+void intr_setipl(uint8_t ipl);
+
+/* Writes how often each interrupt has been taken and how long its
+ * handler ran (in CPU cycles, counting any of the handler's time spent
+ * asleep, as in a system call), and how long interrupts were blocked by
+ * intr_setipl(IPL_HIGH). */
+size_t intr_stats_info(const void *data, char *buf, size_t size);
 
 /* Retreives the current interrupt priority level. */
 static inline uint8_t intr_getipl()
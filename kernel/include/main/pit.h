@@ -2,8 +2,11 @@
 
 #include "types.h"
 
-/* Starts the Programmable Interval Timer (PIT)
- * delivering periodic interrupts at 1000 Hz
- * (i.e., one every millisecond) to the given interrupt. */
-void pit_init(uint8_t intr);
-void pit_starttimer(uint8_t intr);
+/* Starts the Programmable Interval Timer (PIT) counting down the
+ * given number of microseconds (at most 54925) on channel 2, which
+ * raises no interrupt. */
+void pit_oneshot_start(uint32_t usecs);
+
+/* Returns true once the count started by pit_oneshot_start has run
+ * out. */
+int pit_oneshot_done(void);
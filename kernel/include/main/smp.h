@@ -0,0 +1,31 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Starting the other processors. Every enabled local APIC in the ACPI
+ * MADT is a processor; smp_init starts each of them (up to
+ * APIC_MAX_CPUS) with INIT and STARTUP interrupts, gives it a stack,
+ * its own GDT and TSS, the interrupt table and its local APIC, and
+ * leaves it halted with interrupts off.
+ *
+ * Threads, and so the scheduler, still only run on processor 0, which
+ * booted, as does every interrupt, since nothing in the kernel outside
+ * of this is safe to run on two processors at once.
+ */
+
+/* Starts the other processors. Called by kmain once the interrupt table
+ * and the GDT are set up, while the first 4mb are still identity
+ * mapped. */
+void smp_init(void);
+
+/* Returns the number of processors which have started, counting the
+ * one which booted. */
+uint32_t smp_ncpus(void);
+
+/* Returns the number, from 0 up to smp_ncpus, of the processor this
+ * runs on. */
+uint32_t smp_cpu(void);
+
+/* Returns the local APIC ID of a started processor. */
+uint8_t smp_cpu_apicid(uint32_t cpu);
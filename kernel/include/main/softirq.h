@@ -0,0 +1,51 @@
+#pragma once
+
+#include "util/list.h"
+
+/*
+ * Interrupt bottom halves. An interrupt handler (the top half) should do
+ * only what has to be done with the interrupt blocked, acknowledging the
+ * device and taking its data, and raise a softirq for the rest. Raised
+ * softirqs run on the way out of the interrupt, after the EOI, with
+ * interrupts enabled at IPL_LOW, so they hold up no other interrupt. If
+ * the interrupt came in while the kernel was at a higher IPL they are
+ * left to the work queue instead, rather than break into whatever the
+ * kernel was protecting.
+ *
+ * A softirq function runs in interrupt context, on whatever thread's
+ * stack, so it must not block. A softirq raised again before it has run
+ * only runs once.
+ */
+
+typedef void (*softirq_func_t)(void *arg);
+
+typedef struct softirq {
+        list_link_t     si_link;        /* on the pending list once raised */
+        softirq_func_t  si_func;
+        void           *si_arg;
+} softirq_t;
+
+/**
+ * Sets up a softirq which has not been raised.
+ *
+ * @param si the softirq
+ * @param func the function to call
+ * @param arg the argument to pass it
+ */
+void softirq_init(softirq_t *si, softirq_func_t func, void *arg);
+
+/**
+ * Marks a softirq to be run, normally from an interrupt handler.
+ *
+ * @param si the softirq
+ */
+void softirq_raise(softirq_t *si);
+
+/**
+ * Runs any raised softirqs, if ipl (the level the interrupted code was
+ * at) allows, or hands them to the work queue if not. Called by the
+ * interrupt subsystem on the way out of every interrupt.
+ *
+ * @param ipl the IPL when the interrupt came in
+ */
+void softirq_run(uint8_t ipl);
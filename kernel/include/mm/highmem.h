@@ -0,0 +1,21 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * High memory: usable physical memory which the kernel does not map.
+ * The kernel maps physical memory only from kernel_start up to the kmap
+ * slots, about 1gb, and reaches nothing past 4gb (there is no PAE), so
+ * on a larger machine the rest is kept here, a page at a time by
+ * physical address, to be reached through pt_kmap. It is handed out as
+ * the blocks of the high memory disk (drivers/disk/hmdisk.c).
+ */
+
+/* Adds the pages wholly within the physical addresses [start, end).
+ * Called while booting, by phys_add_highmem. */
+void highmem_add_range(uintptr_t start, uintptr_t end);
+
+/* The number of pages of high memory, and the physical address of the
+ * nth of them */
+uint32_t highmem_npages(void);
+uintptr_t highmem_page(uint32_t n);
@@ -2,5 +2,36 @@
 
 #include "types.h"
 
+/*
+ * kmalloc counts the blocks it hands out against the place it was called
+ * from, so that what is holding kernel memory can be found on a running
+ * kernel (see /proc/kmallocinfo and the kshell's kmallocinfo command).
+ * Every call of kmalloc has its own tag, which is given an index the
+ * first time it is used; the index is kept in the word kmalloc puts in
+ * front of each block, so that kfree knows what to count it against.
+ * Calls made from code not built with this header, and those first made
+ * once every index has been given out, are counted as "other".
+ */
+typedef struct kmalloc_tag {
+        const char     *kt_file;
+        int             kt_line;
+        uint32_t        kt_index;       /* 0 until it is first used */
+
+        uint32_t        kt_nobjs;       /* blocks held now */
+        uint32_t        kt_nbytes;      /* and the memory they take up */
+        uint32_t        kt_nallocs;     /* blocks ever got */
+} kmalloc_tag_t;
+
+#define KMALLOC_MAX_TAGS        1024
+
 void *kmalloc(size_t size);
+void *kmalloc_tagged(size_t size, kmalloc_tag_t *tag);
 void  kfree(void *addr);
+
+#define kmalloc(size)                                                   \
+        ({ static kmalloc_tag_t __kmalloc_tag = { __FILE__, __LINE__, 0, 0, 0, 0 }; \
+           kmalloc_tagged((size), &__kmalloc_tag); })
+
+/* Prints the tags which hold memory, and the total, for procfs and the
+ * kshell. The data argument is unused. */
+size_t kmalloc_tags_info(const void *data, char *buf, size_t size);
@@ -23,3 +23,13 @@
 */
 #define MAP_FIXED       4
 #define MAP_ANON        8
+#define MAP_POPULATE    16    /* fault the pages in up front */
+#define MAP_GROWSDOWN   32    /* grows down on faults below it, a stack */
+
+/* Advice for madvise().
+*/
+#define MADV_NORMAL     0     /* No particular access pattern. */
+#define MADV_RANDOM     1     /* Pages will be used in no particular order. */
+#define MADV_SEQUENTIAL 2     /* Pages will be used in order, once. */
+#define MADV_WILLNEED   3     /* Pages will be needed soon. */
+#define MADV_DONTNEED   4     /* Pages are not needed any more. */
@@ -48,7 +48,29 @@ void  page_free(void *addr);
 void *page_alloc_n(uint32_t npages);
 void  page_free_n(void *start, uint32_t npages);
 
+/* Allocates one page filled with zeros, which is freed with page_free.
+ * Pages are cleared ahead of time by the page zeroing daemon when the
+ * system is idle, so this is usually faster than clearing a page from
+ * page_alloc. page_zero_replace returns a page of zeros in place of a
+ * page from page_alloc, which it either clears or frees. */
+void *page_alloc_zeroed(void);
+void *page_zero_replace(void *addr);
+
+/* Stops the page zeroing daemon, called by the idle process at
+ * shutdown */
+void  pagezerod_shutdown(void);
+
+/* Debug info function, prints the state of the pool of cleared pages
+ * and of the cache of kernel stacks */
+size_t page_zero_info(const void *data, char *buf, size_t size);
+
 /* Returns the number of free pages remaining in the
  * system. Note that calls to page_alloc_n(npages) may
  * fail even if page_free_count() >= npages. */
 uint32_t page_free_count();
+
+/* Returns the number of free blocks of exactly 2^order
+ * pages, for 0 <= order < PAGE_NSIZES. The sum over all
+ * orders of page_free_blocks(order) << order is equal to
+ * page_free_count(). */
+uint32_t page_free_blocks(uint32_t order);
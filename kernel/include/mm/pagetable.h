@@ -6,6 +6,7 @@
 #define PD_WRITE_THROUGH  0x008
 #define PD_CACHE_DISABLED 0x010
 #define PD_ACCESSED       0x020
+#define PD_SIZE           0x080     /* maps a 4mb page, needs CR4.PSE */
 
 #define PT_PRESENT        0x001
 #define PT_WRITE          0x002
@@ -36,6 +37,16 @@ uintptr_t pt_phys_tmp_map(uintptr_t paddr);
  * will cause the kernel to panic. */
 uintptr_t pt_phys_perm_map(uintptr_t paddr, uint32_t count);
 
+/* Maps the physical page at paddr at a kernel virtual address until the
+ * matching pt_kunmap, and returns that address. Unlike
+ * pt_phys_tmp_map, mappings may nest (there is a small, fixed number of
+ * slots, running out of which is a panic), and mapping a page which is
+ * already, or was recently, mapped costs no TLB flush. Not for use in
+ * interrupt handlers, which could take a slot from under a thread
+ * choosing one. */
+uintptr_t pt_kmap(uintptr_t paddr);
+void pt_kunmap(uintptr_t vaddr);
+
 /* Looks up the given virtual address (vaddr) in the current page
  * directory, in order to find the matching physical memory address it
  * points to. vaddr MUST have a mapping in the current page directory,
@@ -58,6 +69,17 @@ void pt_unmap(pagedir_t *pd, uintptr_t vaddr);
  * the addresses must be page aligned in the user address space */
 void pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh);
 
+/* Write-protects every page mapped in [low, high) of src, and maps the
+ * same pages read-only at the same addresses in dst. The addresses must
+ * be aligned to the range covered by a page table. Returns 0, or -ENOMEM
+ * if a page table could not be allocated for dst (some entries may have
+ * been copied). Note that the TLB is not flushed by this function. */
+int pt_share_range(pagedir_t *dst, pagedir_t *src, uintptr_t vlow, uintptr_t vhigh);
+
+/* Returns the number of pages mapped in the user part of the given page
+ * directory */
+uint32_t pt_resident(pagedir_t *pd);
+
 /* Creates a new page directory which is initialized to contain
  * mappings for all kernel memory. If there is not enough memory
  * to allocate the directory NULL is returned. Note that destroying
@@ -76,3 +98,8 @@ void pt_set(pagedir_t *pd);
 
 /* Retreives the virtual address of the page directory currently in cr3. */
 pagedir_t *pt_get();
+
+/* Returns a mask of the processors other than this one which have pd in
+ * cr3, or, if pd is NULL, which have ever loaded a page directory (and so
+ * run threads, and use the kernel's mappings). */
+uint32_t pt_active_cpus(pagedir_t *pd);
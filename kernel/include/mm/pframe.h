@@ -11,6 +11,9 @@ struct mmobj;
 
 #define PF_BUSY                 0x01
 #define PF_DIRTY                0x02
+#define PF_REFERENCED           0x04    /* looked up since last aged */
+#define PF_ACTIVE               0x08    /* on the active list */
+#define PF_MERGED               0x10    /* pf_addr is shared, see vm/ksm.c */
 
 #define pframe_is_busy(pf)          ((pf)->pf_flags & PF_BUSY)
 #define pframe_set_busy(pf)         do { (pf)->pf_flags |= PF_BUSY; } while (0)
@@ -20,11 +23,29 @@ struct mmobj;
 #define pframe_set_dirty(pf)        do { (pf)->pf_flags |= PF_DIRTY; } while (0)
 #define pframe_clear_dirty(pf)      do { (pf)->pf_flags &= ~PF_DIRTY; } while (0)
 
+#define pframe_is_referenced(pf)    ((pf)->pf_flags & PF_REFERENCED)
+#define pframe_set_referenced(pf)   do { (pf)->pf_flags |= PF_REFERENCED; } while (0)
+#define pframe_clear_referenced(pf) do { (pf)->pf_flags &= ~PF_REFERENCED; } while (0)
+
+#define pframe_is_active(pf)        ((pf)->pf_flags & PF_ACTIVE)
+
+#define pframe_is_merged(pf)        ((pf)->pf_flags & PF_MERGED)
+
+/* Most dirty pages written back by one pframe_clean_batch call */
+#define PFRAME_CLEAN_BATCH          16
+
 #define pframe_is_pinned(pf)        ((pf)->pf_pincount)
 #define pframe_is_free(pf)          (!(pf)->pf_obj)
 
 /* A pframe structure represents a page frame in physical memory available to the
- * kernel. pframes are managed by mmobjs */
+ * kernel. pframes are managed by mmobjs
+ *
+ * pframes are allocated from a slab (with their wait queues constructed
+ * once) rather than kept in an array indexed by frame number: a pframe is
+ * not tied to one frame, as pf_addr changes when a page is merged (see
+ * vm/ksm.c), replaced by a zeroed page, or moved by compaction, and the
+ * layout is fixed by the prebuilt drivers, which use the private fields
+ * as well. */
 typedef struct pframe {
         /* Public read: (do not modify outside pframe.c) */
 
@@ -38,17 +59,21 @@ typedef struct pframe {
         void               *pf_addr;
 
         /* Private: */
-        uint8_t             pf_flags;    /* PF_DIRTY, PF_BUSY */
+        uint8_t             pf_flags;    /* PF_DIRTY, PF_BUSY, PF_REFERENCED, PF_ACTIVE */
         ktqueue_t           pf_waitq;    /* wait on this if page is busy */
         int                 pf_pincount;
-        list_link_t         pf_link;     /* link on {free,allocated,pinned}_list */
+        list_link_t         pf_link;     /* link on {active,inactive,pinned}_list */
         list_link_t         pf_hlink;    /* link on hash chain of resident page hash */
         list_link_t         pf_olink;    /* link on object's list of resident pages */
+        list_link_t         pf_dlink;    /* link on object's dirty list, if it keeps one */
+        list_link_t         pf_gdlink;   /* link on the dirty list, oldest first */
+        uint32_t            pf_dirtied;  /* jiffies when it last went from clean to dirty */
 } pframe_t;
 
 void pframe_init(void);
 void pframe_add_range(uint32_t startpfn, uint32_t endpfn);
 void pframe_pageoutd_init(void);
+void pframe_pflushd_shutdown(void);
 
 void pframe_shutdown(void);
 
@@ -56,15 +81,55 @@ pframe_t *pframe_get_resident(struct mmobj *o, uint32_t pagenum);
 
 int pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result);
 int pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result);
+uint32_t pframe_prefetch(struct mmobj *o, uint32_t pagenum, uint32_t npages);
 void pframe_migrate(pframe_t *pf, mmobj_t *dest);
 
+void pframe_wait_busy(pframe_t *pf);
 void pframe_pin(pframe_t *pf);
 void pframe_unpin(pframe_t *pf);
+void pframe_deactivate(pframe_t *pf);
 
 int  pframe_dirty(pframe_t *pf);
+void pframe_mark_dirty(pframe_t *pf);
 int  pframe_clean(pframe_t *pf);
+int  pframe_clean_batch(pframe_t **pfs, int npages);
 void pframe_free(pframe_t *pf);
 
 void pframe_clean_all(void);
+void pframe_throttle(void);
+int  pframe_clean_obj(struct mmobj *o);
+void pframe_walk(void (*fn)(pframe_t *pf, void *arg), void *arg);
 
 void pframe_remove_from_pts(pframe_t *pf);
+uint32_t pframe_relocate(uintptr_t start, uintptr_t end, uint32_t npages);
+
+size_t pframe_info(const void *data, char *buf, size_t size);
+
+/* Lookups, hits, fills (and the cycles they took), evictions and
+ * writebacks, for each kind of object and the files of each type of
+ * file system, for procfs and the kshell */
+size_t pframe_stat_info(const void *data, char *buf, size_t size);
+void pframe_stat_reset(void);
+
+/* The block devices' objects, which are counted as their own kind */
+void pframe_register_blockdev(struct mmobj_ops *ops);
+
+/* Read in / write back 'npages' consecutive pages of 'o' in one operation */
+typedef int (*pframe_fillpages_t)(struct mmobj *o, pframe_t **pfs, int npages);
+typedef int (*pframe_cleanpages_t)(struct mmobj *o, pframe_t **pfs, int npages);
+void pframe_register_fillpages(struct mmobj_ops *ops, pframe_fillpages_t fn);
+void pframe_register_cleanpages(struct mmobj_ops *ops, pframe_cleanpages_t fn);
+
+/* Write ordering hooks: 'dirtied' is called whenever one of the object's
+ * pages has been dirtied, 'preclean' just before a run of its pages is
+ * written back (a nonzero return fails the write, leaving them dirty) */
+typedef void (*pframe_dirtied_t)(struct mmobj *o, pframe_t *pf);
+typedef int (*pframe_preclean_t)(struct mmobj *o, pframe_t **pfs, int npages);
+void pframe_register_dirtied(struct mmobj_ops *ops, pframe_dirtied_t fn);
+void pframe_register_preclean(struct mmobj_ops *ops, pframe_preclean_t fn);
+
+/* Returns the list on which the object's dirty pages are kept, linked by
+ * pf_dlink, for pframe_clean_obj. A page stays on it until it has been
+ * written back clean, so pages being written are still on it. */
+typedef list_t *(*pframe_dirtylist_t)(struct mmobj *o);
+void pframe_register_dirtylist(struct mmobj_ops *ops, pframe_dirtylist_t fn);
@@ -7,3 +7,8 @@
  * while the first megabyte of memory is identity mapped,
  * otherwise its behavior is undefined. */
 uintptr_t phys_detect_highmem();
+
+/* Hands the usable physical memory at and above lowmax, which the kernel
+ * does not map, to highmem_add_range (see mm/highmem.h), as far as 4gb.
+ * Like phys_detect_highmem, only used while booting. */
+void phys_add_highmem(uintptr_t lowmax);
@@ -16,11 +16,49 @@
  * it to the free list *without calling the destructor*. This lets you save
  * on destruction/construction calls; the idea is that every free object in
  * the cache is in a known state.
+ *
+ * The constructor is called on every object of a slab when the slab is
+ * created, and the destructor on every object of a slab just before its
+ * pages are reclaimed; either may be NULL. Objects must be handed back to
+ * slab_obj_free in their constructed state.
  */
 typedef struct slab_allocator slab_allocator_t;
+typedef void (*slab_ctor_t)(void *obj);
+typedef void (*slab_dtor_t)(void *obj);
 
 slab_allocator_t *slab_allocator_create(const char *name, size_t size);
+slab_allocator_t *slab_allocator_create_ctor(const char *name, size_t size,
+                                             slab_ctor_t ctor, slab_dtor_t dtor);
 int slab_allocators_reclaim(int target);
 
+/* How many pages the empty slabs hold */
+uint32_t slab_allocators_reclaimable(void);
+
+/*
+ * Caches kept by other parts of the kernel whose objects come from slab
+ * allocators (or kmalloc) register a shrinker, which says how many of
+ * those objects could be freed (ss_count) and frees up to nr of them,
+ * least recently used first, returning how many it freed (ss_scan).
+ * slab_allocators_reclaim runs them before giving empty slabs back, so
+ * that what they free can be reclaimed too; it is called by pageoutd and
+ * by the page allocator before an allocation fails. ss_scan may block.
+ * Shrinkers are registered for the life of the kernel.
+ */
+typedef struct slab_shrinker {
+        const char             *ss_name;
+        uint32_t              (*ss_count)(void);
+        int                   (*ss_scan)(int nr);
+
+        uint32_t                ss_nfreed;      /* statistics, for slabinfo */
+        struct slab_shrinker   *ss_next;
+} slab_shrinker_t;
+
+void slab_register_shrinker(slab_shrinker_t *shrinker);
+
+/* How many objects the shrinkers say they could free */
+uint32_t slab_shrinkers_count(void);
+
 void *slab_obj_alloc(slab_allocator_t *allocator);
 void slab_obj_free(slab_allocator_t *allocator, void *obj);
+
+size_t slab_allocators_info(const void *data, char *buf, size_t size);
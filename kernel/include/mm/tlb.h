@@ -4,6 +4,10 @@
 #include "types.h"
 
 #include "mm/page.h"
+#include "mm/pagetable.h"
+
+/* The tlb_flush functions only invalidate this processor's TLB; see
+ * tlb_shootdown for the others'. */
 
 /* Invalidates any entries from the TLB which contain
  * mappings for the given virtual address. */
@@ -12,22 +16,95 @@ static inline void tlb_flush(uintptr_t vaddr)
         __asm__ volatile("invlpg (%0)" :: "r"(vaddr));
 }
 
+/* Invalidates the entire TLB, except for global entries (the kernel's
+ * own mappings, if the CPU supports them, see pt_init), which only
+ * tlb_flush removes. */
+static inline void tlb_flush_all()
+{
+        uintptr_t pdir;
+        __asm__ volatile("movl %%cr3, %0" : "=r"(pdir));
+        __asm__ volatile("movl %0, %%cr3" :: "r"(pdir) : "memory");
+}
+
+/* Beyond this many pages it is cheaper to reload cr3 (which
+ * invalidates every user entry at once, and makes the process refill
+ * those it still uses) than to invlpg one page at a time. */
+#define TLB_FLUSH_MAX 32
+
 /* Invalidates any entries for the count virtual addresses
- * starting at vaddr from the TLB. If this range is very
- * large it may be more efficient to call tlb_flush_all
- * to invalidate the entire TLB. */
+ * starting at vaddr from the TLB, invalidating the entire
+ * TLB instead if there are more than TLB_FLUSH_MAX. */
 static inline void tlb_flush_range(uintptr_t vaddr, uint32_t count)
 {
         uint32_t i;
+
+        if (TLB_FLUSH_MAX < count) {
+                tlb_flush_all();
+                return;
+        }
         for (i = 0; i < count; ++i, vaddr += PAGE_SIZE) {
                 tlb_flush(vaddr);
         }
 }
 
-/* Invalidates the entire TLB. */
-static inline void tlb_flush_all()
+/* Invalidates the count pages starting at vaddr in the TLBs of the
+ * other processors which have pd loaded, or, for the kernel's own
+ * mappings (pd NULL), of every other processor running threads; and
+ * waits until they have. Beyond TLB_FLUSH_MAX pages each flushes its
+ * whole TLB. Costs nothing if no other processor has pd loaded. */
+void tlb_shootdown(pagedir_t *pd, uintptr_t vaddr, uint32_t count);
+
+typedef struct tlb_batch tlb_batch_t;
+
+/* As tlb_shootdown, for the addresses in a batch */
+void tlb_shootdown_batch(pagedir_t *pd, tlb_batch_t *tb);
+
+/* Collects the (user) addresses whose mappings an operation changes, so
+ * that they are invalidated together once it is done: one page at a time
+ * if there are few, otherwise with a single tlb_flush_all. */
+struct tlb_batch {
+        uint32_t  tb_count;                     /* may exceed TLB_FLUSH_MAX */
+        uintptr_t tb_vaddr[TLB_FLUSH_MAX];
+};
+
+static inline void tlb_batch_init(tlb_batch_t *tb)
 {
-        uintptr_t pdir;
-        __asm__ volatile("movl %%cr3, %0" : "=r"(pdir));
-        __asm__ volatile("movl %0, %%cr3" :: "r"(pdir) : "memory");
+        tb->tb_count = 0;
+}
+
+static inline void tlb_batch_add(tlb_batch_t *tb, uintptr_t vaddr)
+{
+        if (TLB_FLUSH_MAX > tb->tb_count)
+                tb->tb_vaddr[tb->tb_count] = vaddr;
+        tb->tb_count++;
+}
+
+/* Adds the count pages starting at vaddr */
+static inline void tlb_batch_add_range(tlb_batch_t *tb, uintptr_t vaddr, uint32_t count)
+{
+        uint32_t i;
+
+        if (TLB_FLUSH_MAX < count) {
+                tb->tb_count += count;
+                return;
+        }
+        for (i = 0; i < count; ++i, vaddr += PAGE_SIZE)
+                tlb_batch_add(tb, vaddr);
+}
+
+/* Invalidates everything added since tlb_batch_init, here and on the
+ * other processors which have the current address space loaded, and
+ * empties the batch */
+static inline void tlb_batch_flush(tlb_batch_t *tb)
+{
+        uint32_t i;
+
+        tlb_shootdown_batch(pt_get(), tb);
+        if (TLB_FLUSH_MAX < tb->tb_count) {
+                tlb_flush_all();
+        } else {
+                for (i = 0; i < tb->tb_count; ++i)
+                        tlb_flush(tb->tb_vaddr[i]);
+        }
+        tb->tb_count = 0;
 }
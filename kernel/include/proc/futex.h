@@ -0,0 +1,37 @@
+#pragma once
+
+#include "types.h"
+
+struct vmmap;
+
+/*
+ * Futexes: user-space locks wait in the kernel only when contended.
+ * A thread waits on a word of user memory, which the kernel knows by
+ * its address space and address; nothing exists in the kernel for a
+ * futex while no thread waits on it.
+ */
+
+/**
+ * Sleeps (cancellably) until woken by futex_wake on the same word, if
+ * the word still holds val. The word is read and the thread goes to
+ * sleep without anything else running in between, so a wake made after
+ * the word has changed cannot be missed.
+ *
+ * @param map the address space of the word
+ * @param uaddr the word, which must be aligned
+ * @param val what the caller saw in the word
+ * @param ticks the longest to sleep for, or 0 for no limit
+ * @return 0 if woken, -EAGAIN if the word no longer holds val,
+ * -ETIMEDOUT, -EINTR if cancelled, -EINVAL or -EFAULT for a bad word
+ */
+int futex_wait(struct vmmap *map, uint32_t *uaddr, uint32_t val, uint32_t ticks);
+
+/**
+ * Wakes threads waiting on a word, in the order they started waiting.
+ *
+ * @param map the address space of the word
+ * @param uaddr the word
+ * @param n the most threads to wake
+ * @return the number woken
+ */
+int futex_wake(struct vmmap *map, uint32_t *uaddr, int n);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "types.h"
+
 #include "proc/sched.h"
 
 typedef struct kmutex {
@@ -40,8 +42,25 @@ void kmutex_lock(kmutex_t *mtx);
 int  kmutex_lock_cancellable(kmutex_t *mtx);
 
 /**
- * Unlocks the specified mutex.
+ * Locks the specified mutex if nobody holds it. Does not block.
+ *
+ * @param mtx the mutex to lock
+ * @return 1 if the current thread now holds the mutex, 0 if another
+ * thread held it
+ */
+int  kmutex_trylock(kmutex_t *mtx);
+
+/**
+ * Unlocks the specified mutex. If any threads are waiting for it, the
+ * first of them is woken already holding it.
  *
  * @mtx the mutex to unlock
  */
 void kmutex_unlock(kmutex_t *mtx);
+
+/**
+ * Writes how often mutexes have been locked, how often they were already
+ * held, and how long was spent waiting for them, by the place they were
+ * locked from.
+ */
+size_t kmutex_info(const void *data, char *buf, size_t size);
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "proc/sched.h"
+
+/*
+ * A reader-writer lock: any number of threads may hold it shared, or one
+ * thread may hold it exclusive. Writers are preferred; once a writer is
+ * waiting, no more readers are let in until it has had the lock, so a
+ * steady stream of readers cannot starve it. As with kmutex_t, the lock
+ * is handed straight to the next writer on unlock.
+ */
+typedef struct krwlock {
+        ktqueue_t       krw_readq;      /* waiting to hold it shared */
+        ktqueue_t       krw_writeq;     /* waiting to hold it exclusive */
+        struct kthread *krw_writer;     /* exclusive holder, if any */
+        int             krw_nreaders;   /* shared holders */
+} krwlock_t;
+
+/**
+ * Initializes the fields of the specified krwlock_t.
+ *
+ * @param rw the lock to initialize
+ */
+void krwlock_init(krwlock_t *rw);
+
+/**
+ * Locks the specified lock shared.
+ *
+ * Note: This function may block.
+ *
+ * Note: These locks are not re-entrant, in either mode.
+ *
+ * @param rw the lock to lock
+ */
+void krwlock_read_lock(krwlock_t *rw);
+
+/**
+ * Locks the specified lock shared, but puts the current thread into a
+ * cancellable sleep if the function blocks.
+ *
+ * @param rw the lock to lock
+ * @return 0 if the current thread now holds the lock shared and -EINTR
+ * if the sleep was cancelled and this thread does not hold it
+ */
+int  krwlock_read_lock_cancellable(krwlock_t *rw);
+
+/**
+ * Unlocks the specified lock, held shared by the current thread.
+ *
+ * @param rw the lock to unlock
+ */
+void krwlock_read_unlock(krwlock_t *rw);
+
+/**
+ * Locks the specified lock exclusive.
+ *
+ * Note: This function may block.
+ *
+ * @param rw the lock to lock
+ */
+void krwlock_write_lock(krwlock_t *rw);
+
+/**
+ * Locks the specified lock exclusive, but puts the current thread into
+ * a cancellable sleep if the function blocks.
+ *
+ * @param rw the lock to lock
+ * @return 0 if the current thread now holds the lock exclusive and
+ * -EINTR if the sleep was cancelled and this thread does not hold it
+ */
+int  krwlock_write_lock_cancellable(krwlock_t *rw);
+
+/**
+ * Unlocks the specified lock, held exclusive by the current thread.
+ *
+ * @param rw the lock to unlock
+ */
+void krwlock_write_unlock(krwlock_t *rw);
+
+/**
+ * @param rw the lock
+ * @return 1 if any thread holds the lock, in either mode, 0 otherwise
+ */
+#define krwlock_held(rw) \
+        (NULL != (rw)->krw_writer || 0 != (rw)->krw_nreaders)
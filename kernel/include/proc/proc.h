@@ -10,11 +10,19 @@
 
 #include "config.h"
 
+/* pids are handed out by the prebuilt proc.o (proc/libproc.a), which
+ * walks the process list for a free one; see proc_lookup */
 #define PROC_MAX_COUNT  65536
 #define PROC_NAME_LEN   256
 
 struct regs;
 
+/* The prebuilt proc.o, fork.o and kthread.o reach these fields by their
+ * offsets, so none of them can be moved, shrunk or put out of line
+ * (p_comm and p_files included) without the sources of those objects:
+ * proc_create copies the name into p_comm whole, and fork copies
+ * p_files. The slab allocator hands out proc_t's whole from a cache of
+ * their own, so their size costs pages, not slab fragmentation. */
 typedef struct proc {
         pid_t           p_pid;                 /* our pid */
         char            p_comm[PROC_NAME_LEN]; /* process name */
@@ -66,6 +74,13 @@ proc_t *proc_create(char *name);
 /**
  * Finds the process with the specified PID.
  *
+ * This walks proc_list(), as the pid allocator does. Both live in the
+ * prebuilt proc.o along with do_waitpid, proc_create and proc_cleanup,
+ * which link and unlink processes from the list and their parents'
+ * p_children themselves, so a pid hash or zombie list kept outside
+ * proc.o could not be kept in step with them, and proc_t's layout is
+ * fixed by the same objects.
+ *
  * @param pid the PID of the process to find
  * @return a pointer to the process with PID pid, or NULL if there is
  * no such process
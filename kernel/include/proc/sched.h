@@ -1,13 +1,31 @@
 #pragma once
 
+#include "types.h"
+
 #include "util/list.h"
 
+struct fpu_state;
+
 struct kthread;
 typedef struct ktqueue {
         list_t          tq_list;
         int             tq_size;
 } ktqueue_t;
 
+/* Scheduling latency: how long threads waited on a run queue for the
+ * processor, and how long they slept, in cycles; sl_hist[w][i] counts
+ * the waits of 2^i to 2^(i+1)-1 cycles. Kept for the system, and for
+ * each process in its vmmap. */
+#define SCHED_LAT_RUNQ          0
+#define SCHED_LAT_BLOCK         1
+#define SCHED_LAT_BUCKETS       32
+
+typedef struct sched_latency {
+        uint32_t        sl_count[2];
+        uint64_t        sl_cycles[2];
+        uint32_t        sl_hist[2][SCHED_LAT_BUCKETS];
+} sched_latency_t;
+
 /**
  * Switches execution between kernel threads.
  */
@@ -52,6 +70,40 @@ void sched_sleep_on(ktqueue_t *q);
  */
 int sched_cancellable_sleep_on(ktqueue_t *q);
 
+/**
+ * Like sched_sleep_on and sched_cancellable_sleep_on, but as an
+ * exclusive waiter: sched_broadcast_on wakes only the longest-waiting
+ * exclusive waiter on a queue (and every other waiter). One which is
+ * woken but leaves what it waited for as it found it, so that the next
+ * would not have to sleep again, should pass the wakeup on by calling
+ * sched_broadcast_on itself.
+ *
+ * @param q the queue to sleep on
+ */
+void sched_sleep_on_exclusive(ktqueue_t *q);
+int sched_cancellable_sleep_on_exclusive(ktqueue_t *q);
+
+/**
+ * Like sched_sleep_on, but gives up waiting after the given number of
+ * clock ticks (see util/timer.h for converting from milliseconds).
+ *
+ * @param q the queue to sleep on
+ * @param ticks the longest to sleep for
+ * @return -ETIMEDOUT if the time ran out and 0 if the thread was woken
+ */
+int sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks);
+
+/**
+ * Like sched_cancellable_sleep_on, but gives up waiting after the given
+ * number of clock ticks.
+ *
+ * @param q the queue to sleep on
+ * @param ticks the longest to sleep for
+ * @return -EINTR if the thread was cancelled, -ETIMEDOUT if the time ran
+ * out and 0 if it was woken
+ */
+int sched_cancellable_sleep_on_timeout(ktqueue_t *q, uint32_t ticks);
+
 /**
  * Wakes a single thread from sleep if there are any waiting on the
  * queue.
@@ -62,15 +114,147 @@ int sched_cancellable_sleep_on(ktqueue_t *q);
 struct kthread *sched_wakeup_on(ktqueue_t *q);
 
 /**
- * Wake up all threads running on the queue.
+ * Wake up all threads sleeping on the queue, save that only the first of
+ * those sleeping as exclusive waiters is woken.
  *
  * @param q the queue to wake up threads from
  */
 void sched_broadcast_on(ktqueue_t *q);
 
+/**
+ * Wake up all threads sleeping on the queue, exclusive waiters too, as
+ * when what they are waiting on is going away.
+ *
+ * @param q the queue to wake up threads from
+ */
+void sched_wakeup_all(ktqueue_t *q);
+
 /**
  * Cancel the given thread from the queue it sleeps on.
  *
  * @param the thread to cancel sleep from
  */
 void sched_cancel(struct kthread *kthr);
+
+/**
+ * Charges a clock tick to the current thread, moving it down a level
+ * once it has used up its time slice, and now and then moves every
+ * thread back to the top level. Called from the timer interrupt
+ * handler, with interrupts blocked.
+ *
+ * @return 1 if the current thread should be preempted, because its
+ * slice is used up or a more favoured thread is runnable, 0 otherwise
+ */
+int sched_tick(void);
+
+/**
+ * Marks the current thread as needing to give up the processor the next
+ * time sched_preempt is called. Called from the timer interrupt handler
+ * when sched_tick returns 1.
+ */
+void sched_need_resched(void);
+
+/**
+ * If the current thread has been marked by sched_need_resched, puts it
+ * back on the run queue and switches to the next thread. Called on the
+ * way out of an interrupt which came from userland, where it is safe to
+ * switch; it behaves like a yield in a system call.
+ */
+void sched_preempt(void);
+
+/*
+ * Kernel preemption, with KPREEMPT. Most of the kernel keeps its lists
+ * consistent only by not being switched away from, so a thread in the
+ * kernel is still never preempted from an interrupt. Instead long
+ * operations call sched_cond_resched between their steps, at points
+ * where they could sleep, and there it gives up the processor as
+ * sched_preempt would if the timer has said to. That bounds how long a
+ * thread in the kernel keeps others waiting by the longest stretch
+ * between such points, rather than by its whole system call.
+ *
+ * A thread is not preempted while it has preemption disabled (the two
+ * calls nest), holds a spinlock or runs above IPL_LOW. Holding a mutex
+ * does not stop it, since it could sleep holding one anyway.
+ */
+void sched_preempt_disable(void);
+void sched_preempt_enable(void);
+
+/**
+ * Switches to another thread if the current one should be preempted
+ * and may be here (see above). Does nothing without KPREEMPT.
+ *
+ * @return 1 if another thread ran, 0 otherwise
+ */
+int sched_cond_resched(void);
+
+/**
+ * Adds inc to the niceness of the given thread, keeping it between 0
+ * (the default) and 19. A nicer thread is kept on lower priority
+ * levels. Threads inherit the niceness of the thread which creates
+ * them.
+ *
+ * @param kt the thread
+ * @param inc how much nicer it gets (negative to make it less nice)
+ * @return the new niceness
+ */
+int sched_nice(struct kthread *kt, int inc);
+
+/**
+ * Returns true if a thread may be restricted to the processors in the
+ * given mask (bit i for processor i): it must allow one which has
+ * started and runs threads, which is only processor 0 for now.
+ *
+ * @param mask the processors
+ * @return 1 if the mask can be used, 0 otherwise
+ */
+int sched_affinity_valid(uint32_t mask);
+
+/**
+ * Restricts the given thread to the processors in a valid mask (see
+ * sched_affinity_valid), dropping those which have not started. Threads
+ * inherit the mask of the thread which creates them.
+ *
+ * @param kt the thread
+ * @param mask the processors
+ */
+void sched_setaffinity(struct kthread *kt, uint32_t mask);
+
+/**
+ * Returns the processors the given thread may run on.
+ *
+ * @param kt the thread
+ * @return its processor mask
+ */
+uint32_t sched_getaffinity(struct kthread *kt);
+
+/**
+ * Returns where the given thread's FPU state is saved while another
+ * thread has the FPU, which is kept with its scheduling state.
+ *
+ * @param kt the thread
+ * @return its FPU state
+ */
+struct fpu_state *sched_fpu_state(struct kthread *kt);
+
+/*
+ * Priority inheritance for proc/kmutex.c. sched_mutex_wait is called by
+ * the current thread just before it sleeps waiting for mtx, lending its
+ * level to the holder and on along the chain of holders, or with NULL
+ * once it has given up waiting without being handed it.
+ * sched_mutex_acquired is called once the current thread holds mtx, and
+ * sched_mutex_released once it has handed mtx on to its new holder (or
+ * to nobody), taking back what it was lent if it holds no more mutexes.
+ */
+struct kmutex;
+void sched_mutex_wait(struct kmutex *mtx);
+void sched_mutex_acquired(struct kmutex *mtx);
+void sched_mutex_released(struct kmutex *mtx);
+
+/*
+ * Debug info function, prints the run queue and sleep latency of the
+ * system and the time slept on each wait channel if data is NULL, or
+ * else that of the process data and the totals of each of its threads.
+ * sched_latency_reset clears the system's.
+ */
+size_t sched_latency_info(const void *data, char *buf, size_t size);
+void sched_latency_reset(void);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "types.h"
+
+#include "util/list.h"
+
+typedef struct spinlock {
+        volatile uint32_t sl_locked;
+        const char       *sl_name;
+        struct kthread   *sl_holder;
+        uint32_t          sl_nacquired;
+        uint32_t          sl_ncontended;  /* of sl_nacquired */
+        uint64_t          sl_spin_cycles; /* over all of sl_ncontended */
+        list_link_t       sl_link;        /* on the list spinlock_info walks */
+} spinlock_t;
+
+/**
+ * Initializes a spinlock, unlocked, and adds it to the ones
+ * spinlock_info reports on.
+ *
+ * @param lock the spinlock to initialize
+ * @param name what spinlock_info calls it
+ */
+void spinlock_init(spinlock_t *lock, const char *name);
+
+/**
+ * Takes a spinlock, spinning until it is free.
+ *
+ * Note: A thread must not sleep holding a spinlock. It is not touched
+ * by interrupt handlers unless it is always taken with
+ * spin_lock_irqsave.
+ *
+ * Note: These locks are not re-entrant.
+ *
+ * @param lock the spinlock to take
+ */
+void spin_lock(spinlock_t *lock);
+
+/**
+ * Releases a spinlock taken with spin_lock.
+ *
+ * @param lock the spinlock to release
+ */
+void spin_unlock(spinlock_t *lock);
+
+/**
+ * Raises the IPL to IPL_HIGH and takes a spinlock, for data which
+ * interrupt handlers touch as well.
+ *
+ * @param lock the spinlock to take
+ * @return the IPL to give back to spin_unlock_irqrestore
+ */
+uint8_t spin_lock_irqsave(spinlock_t *lock);
+
+/**
+ * Releases a spinlock taken with spin_lock_irqsave and puts the IPL
+ * back to what it was.
+ *
+ * @param lock the spinlock to release
+ * @param ipl what spin_lock_irqsave returned
+ */
+void spin_unlock_irqrestore(spinlock_t *lock, uint8_t ipl);
+
+static inline int
+spin_is_locked(spinlock_t *lock)
+{
+        return 0 != lock->sl_locked;
+}
+
+/**
+ * The number of spinlocks held on this processor, which has to be 0
+ * whenever a thread sleeps.
+ */
+int spinlock_nheld(void);
+
+/**
+ * Writes how often each spinlock has been taken, how often it was
+ * already held, and how many cycles were spent spinning for it.
+ */
+size_t spinlock_info(const void *data, char *buf, size_t size);
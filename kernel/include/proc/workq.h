@@ -0,0 +1,55 @@
+#pragma once
+
+#include "util/list.h"
+
+/*
+ * The kernel work queue: functions to be called later, in thread
+ * context, by one of a small pool of worker threads shared by the whole
+ * kernel. Unlike a timer function, a work function may block; unlike a
+ * daemon of its own, it costs no stack while it is not running.
+ *
+ * Work may be queued from anywhere, including interrupt handlers and
+ * timer functions. A work item is queued at most once at a time, so
+ * queueing one which has not run yet does nothing; it runs once, after
+ * all the reasons for queueing it.
+ */
+
+typedef void (*work_func_t)(void *arg);
+
+typedef struct work {
+        list_link_t     w_link;         /* on the queue while pending */
+        work_func_t     w_func;
+        void           *w_arg;
+} work_t;
+
+/**
+ * Sets up a work item which is not queued.
+ *
+ * @param w the work item
+ * @param func the function to call
+ * @param arg the argument to pass it
+ */
+void work_init(work_t *w, work_func_t func, void *arg);
+
+/**
+ * Queues a work item to be run by a worker thread.
+ *
+ * @param w the work item
+ * @return 1 if it was queued, 0 if it was already waiting to run
+ */
+int work_queue(work_t *w);
+
+/**
+ * Takes a work item off the queue if it has not started running. It may
+ * still be running when this returns.
+ *
+ * @param w the work item
+ * @return 1 if it was waiting to run, 0 otherwise
+ */
+int work_cancel(work_t *w);
+
+/**
+ * Runs whatever work is still queued, then stops the worker threads and
+ * waits for them. Called by the idle process when shutting down.
+ */
+void workq_shutdown(void);
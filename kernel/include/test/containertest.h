@@ -0,0 +1,5 @@
+#pragma once
+
+/* Runs the tests of the generic containers, returning how many checks
+ * failed, or -ENOMEM */
+int containertest_main(void);
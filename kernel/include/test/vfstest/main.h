@@ -0,0 +1,5 @@
+#pragma once
+
+/* Runs the VFS tests, or with "-b" and its flags their benchmark mode
+ * (see test/vfstest/vfstest.c); returns 0 if all went well */
+int vfstest_main(int argc, char **argv);
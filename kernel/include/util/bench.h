@@ -0,0 +1,29 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * In-kernel microbenchmarks, run from the kshell's bench command. A
+ * benchmark times n runs of the operation it measures, each with
+ * cpuid_rdtsc, and leaves the cycles each took in samples[0..n); it
+ * does whatever setup it needs around the timed part. It returns 0, or
+ * -errno if it could not run. The samples are reported as their
+ * minimum, median, 99th percentile and maximum.
+ */
+
+typedef int (*bench_func_t)(uint32_t *samples, int n);
+
+#define BENCH_DEFAULT_SAMPLES   1000
+#define BENCH_MAX_SAMPLES       10000
+
+/* Adds a benchmark; the name and description are not copied */
+void bench_register(const char *name, bench_func_t func, const char *desc);
+
+/* Runs the benchmark called name, or every one if name is "all", with
+ * nsamples samples, and prints a line of results per benchmark to buf.
+ * Returns -ENOENT if there is no such benchmark, -EINVAL if nsamples is
+ * out of range, or -ENOMEM */
+int bench_run(const char *name, int nsamples, char *buf, size_t size);
+
+/* Debug info function, lists the benchmarks */
+size_t bench_info(const void *data, char *buf, size_t size);
@@ -21,3 +21,171 @@ bit_check(const void *addr, uintptr_t bit)
         return (*map & (1 << (bit & 0x1f)));
 }
 
+
+static inline void
+bit_set(void *addr, uintptr_t bit)
+{
+        uint32_t *map = (uint32_t *)addr;
+        map += (bit >> 5);
+        *map |= (uint32_t)(1 << (bit & 0x1f));
+}
+
+static inline void
+bit_clear(void *addr, uintptr_t bit)
+{
+        uint32_t *map = (uint32_t *)addr;
+        map += (bit >> 5);
+        *map &= ~(uint32_t)(1 << (bit & 0x1f));
+}
+
+/* The lowest and highest set bits of a word, which must not be 0 */
+static inline int
+bit_ffs(uint32_t word)
+{
+        int bit;
+        __asm__("bsfl %1, %0" : "=r"(bit) : "rm"(word));
+        return bit;
+}
+
+static inline int
+bit_fls(uint32_t word)
+{
+        int bit;
+        __asm__("bsrl %1, %0" : "=r"(bit) : "rm"(word));
+        return bit;
+}
+
+static inline int
+bit_popcount(uint32_t word)
+{
+        word = word - ((word >> 1) & 0x55555555);
+        word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+        word = (word + (word >> 4)) & 0x0f0f0f0f;
+        return (int)((word * 0x01010101) >> 24);
+}
+
+/*
+ * Bitmaps of any number of bits, kept in 32 bit words (bit i is bit
+ * i % 32 of word i / 32), which are searched a word at a time. The bits
+ * past nbits in the last word are ignored.
+ */
+#define BITMAP_WORDS(nbits)     (((nbits) + 31) >> 5)
+
+/* The first set bit at or after start, or -1 if there is none */
+static inline int
+bitmap_find_next_set(const void *addr, uintptr_t nbits, uintptr_t start)
+{
+        const uint32_t *map = (const uint32_t *)addr;
+        uintptr_t w, nwords = BITMAP_WORDS(nbits);
+        uint32_t word;
+
+        if (start >= nbits)
+                return -1;
+        w = start >> 5;
+        word = map[w] & (~0U << (start & 0x1f));
+        while (0 == word) {
+                if (++w >= nwords)
+                        return -1;
+                word = map[w];
+        }
+        w = (w << 5) + bit_ffs(word);
+        return (w < nbits) ? (int)w : -1;
+}
+
+/* The first clear bit at or after start, or -1 if there is none */
+static inline int
+bitmap_find_next_zero(const void *addr, uintptr_t nbits, uintptr_t start)
+{
+        const uint32_t *map = (const uint32_t *)addr;
+        uintptr_t w, nwords = BITMAP_WORDS(nbits);
+        uint32_t word;
+
+        if (start >= nbits)
+                return -1;
+        w = start >> 5;
+        word = ~map[w] & (~0U << (start & 0x1f));
+        while (0 == word) {
+                if (++w >= nwords)
+                        return -1;
+                word = ~map[w];
+        }
+        w = (w << 5) + bit_ffs(word);
+        return (w < nbits) ? (int)w : -1;
+}
+
+/* The last set bit before end, or -1 if there is none */
+static inline int
+bitmap_find_prev_set(const void *addr, uintptr_t end)
+{
+        const uint32_t *map = (const uint32_t *)addr;
+        uintptr_t w;
+        uint32_t word;
+
+        if (0 == end)
+                return -1;
+        w = (end - 1) >> 5;
+        word = map[w] & (~0U >> (31 - ((end - 1) & 0x1f)));
+        while (0 == word) {
+                if (0 == w--)
+                        return -1;
+                word = map[w];
+        }
+        return (int)((w << 5) + bit_fls(word));
+}
+
+/* Sets or clears the n bits from start */
+static inline void
+bitmap_set_range(void *addr, uintptr_t start, uintptr_t n)
+{
+        uint32_t *map = (uint32_t *)addr;
+        uintptr_t end = start + n;
+
+        while (start < end) {
+                uint32_t mask = ~0U << (start & 0x1f);
+                if ((start | 0x1f) >= end)
+                        mask &= ~0U >> (31 - ((end - 1) & 0x1f));
+                map[start >> 5] |= mask;
+                start = (start | 0x1f) + 1;
+        }
+}
+
+static inline void
+bitmap_clear_range(void *addr, uintptr_t start, uintptr_t n)
+{
+        uint32_t *map = (uint32_t *)addr;
+        uintptr_t end = start + n;
+
+        while (start < end) {
+                uint32_t mask = ~0U << (start & 0x1f);
+                if ((start | 0x1f) >= end)
+                        mask &= ~0U >> (31 - ((end - 1) & 0x1f));
+                map[start >> 5] &= ~mask;
+                start = (start | 0x1f) + 1;
+        }
+}
+
+/* How many of the first nbits are set */
+static inline int
+bitmap_weight(const void *addr, uintptr_t nbits)
+{
+        const uint32_t *map = (const uint32_t *)addr;
+        uintptr_t w;
+        int n = 0;
+
+        for (w = 0; w < (nbits >> 5); w++)
+                n += bit_popcount(map[w]);
+        if (nbits & 0x1f)
+                n += bit_popcount(map[w] & ((1U << (nbits & 0x1f)) - 1));
+        return n;
+}
+
+/* How many of the n bits from start are set */
+static inline int
+bitmap_weight_range(const void *addr, uintptr_t start, uintptr_t n)
+{
+        const uint32_t *map = (const uint32_t *)addr;
+        int skip = (int)(start & 0x1f);
+
+        return bitmap_weight(map + (start >> 5), skip + n)
+               - bitmap_weight(map + (start >> 5), skip);
+}
@@ -144,6 +144,11 @@ void dbg_init(void);
 void dbg_print(char *fmt, ...) __attribute__((format(printf, 1, 2)));
 void dbg_printinfo(dbg_infofunc_t func, const void *data);
 
+/* Sends whatever is still buffered for the serial port, waiting for the
+ * port rather than its interrupt, and sends everything printed after it
+ * the same way. For just before the kernel halts. */
+void dbg_flush(void);
+
 const char *dbg_color(uint64_t d_mode);
 
 #ifndef NDEBUG
@@ -175,9 +180,13 @@ const char *dbg_color(uint64_t d_mode);
                 }                                               \
         } while(0)
 
-#define dbg_active(mode) (dbg_modes & (mode))
-void dbg_add_mode(const char *mode);
-void dbg_add_modes(const char *modes);
+/* Nothing past this test, arguments included, is evaluated for a mode
+ * that is off, and the compiler moves the printing out of the way, so
+ * leaving dbg() calls in costs a load and a branch */
+#define dbg_active(mode) __builtin_expect(0 != (dbg_modes & (mode)), 0)
+int dbg_add_mode(const char *mode);
+int dbg_add_modes(const char *modes);
+size_t dbg_modes_info(const void *data, char *buf, size_t size);
 #else
 #define dbg(mode, arg)
 #define dbg_active(mode) 0
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "types.h"
+#include "kernel.h"
+
+/*
+ * Intrusive chained hash table which grows to keep its chains short.
+ *
+ * htable_t is the table. hlink_t should be included in structures which
+ * want to be in a table. The table does not know the keys, only the
+ * hash of each item, given to htable_insert: a lookup walks the items
+ * with the hash it is given and the caller compares their keys.
+ *
+ * The table starts with one bucket, held in the htable_t itself, so
+ * an empty table costs nothing and htable_insert never fails: if no
+ * bigger bucket array can be allocated the chains get longer. The
+ * buckets are doubled when there are more than two items to a bucket;
+ * they are never shrunk, so removal does not allocate or move anything.
+ *
+ * htable_init(ht) initializes an empty table.
+ * htable_destroy(ht) frees the buckets; the table must be empty.
+ * htable_count(ht) returns how many items are in the table.
+ *
+ * htable_insert(ht, link, hash) adds link with the hash.
+ * htable_remove(ht, link) removes link, which must be in a table.
+ *
+ * To look for an item by key, which will work even if you
+ * htable_remove() the current item:
+ *    type iterator;
+ *    htable_iterate_begin(ht, hash, iterator, type, member) {
+ *        if (iterator->key == key) ...
+ *    } htable_iterate_end();
+ *
+ * And to go through all of them, in no particular order:
+ *    htable_iterate_all_begin(ht, iterator, type, member) {
+ *        ... use iterator ...
+ *    } htable_iterate_end();
+ *
+ * Nothing may be inserted while iterating, as that may move the items
+ * to new buckets.
+ *
+ * The hash functions below mix all of their bits into the low ones, by
+ * which the table picks a bucket.
+ */
+
+typedef struct hlink {
+        struct hlink   *hl_next;
+        struct hlink  **hl_pprev;       /* what points to this one */
+        uint32_t        hl_hash;
+} hlink_t;
+
+typedef struct htable {
+        hlink_t       **ht_buckets;
+        uint32_t        ht_mask;        /* the number of buckets, less one */
+        uint32_t        ht_count;
+        hlink_t        *ht_first;       /* the bucket to start with */
+} htable_t;
+
+/* The most buckets the table grows to */
+#define HTABLE_MAX_BUCKETS      (1 << 16)
+
+void htable_init(htable_t *ht);
+void htable_destroy(htable_t *ht);
+void htable_insert(htable_t *ht, hlink_t *link, uint32_t hash);
+void htable_remove(htable_t *ht, hlink_t *link);
+
+/* The item after link in the table, or the first if link is NULL; NULL
+ * at the end */
+hlink_t *htable_next(htable_t *ht, hlink_t *link);
+
+#define htable_count(ht)        ((ht)->ht_count)
+
+#define htable_iterate_begin(ht, hash, iterator, type, member)          \
+        do {                                                            \
+                uint32_t __hl_hash = (hash);                            \
+                hlink_t *__hl = (ht)->ht_buckets[__hl_hash & (ht)->ht_mask]; \
+                hlink_t *__hl_next;                                     \
+                for (; NULL != __hl; __hl = __hl_next) {                \
+                        __hl_next = __hl->hl_next;                      \
+                        if (__hl->hl_hash != __hl_hash)                 \
+                                continue;                               \
+                        iterator = CONTAINER_OF(__hl, type, member);
+
+#define htable_iterate_all_begin(ht, iterator, type, member)            \
+        do {                                                            \
+                hlink_t *__hl = htable_next((ht), NULL);                \
+                hlink_t *__hl_next;                                     \
+                for (; NULL != __hl; __hl = __hl_next) {                \
+                        __hl_next = htable_next((ht), __hl);            \
+                        iterator = CONTAINER_OF(__hl, type, member);
+
+#define htable_iterate_end()                                            \
+                }                                                       \
+        } while (0)
+
+/* The finalizer of MurmurHash3, which changes every bit of the
+ * result with any bit of the value */
+static inline uint32_t
+hash_32(uint32_t val)
+{
+        val ^= val >> 16;
+        val *= 0x85ebca6b;
+        val ^= val >> 13;
+        val *= 0xc2b2ae35;
+        val ^= val >> 16;
+        return val;
+}
+
+static inline uint32_t
+hash_ptr(const void *ptr)
+{
+        return hash_32((uint32_t) ptr);
+}
+
+/* For keys of two words, such as an object and a page number */
+static inline uint32_t
+hash_pair(uint32_t a, uint32_t b)
+{
+        return hash_32(a * 0x9e3779b1 + b);
+}
+
+/* FNV-1a, for names */
+static inline uint32_t
+hash_bytes(const void *buf, size_t len)
+{
+        const unsigned char *p = (const unsigned char *) buf;
+        uint32_t h = 0x811c9dc5;
+
+        while (len-- > 0)
+                h = (h ^ *p++) * 0x01000193;
+        return h;
+}
+
+static inline uint32_t
+hash_str(const char *s)
+{
+        uint32_t h = 0x811c9dc5;
+
+        while ('\0' != *s)
+                h = (h ^ (unsigned char) *s++) * 0x01000193;
+        return h;
+}
@@ -1,17 +1,33 @@
 #pragma once
 
+/*
+ * Each init_func leaves a record in the .init section holding the
+ * function and its name, and each init_depends after it a record
+ * holding the address of the record of the function depended on. So
+ * the linker resolves the dependencies (naming a function which is not
+ * an init_func fails the link), and init_call_all only follows
+ * pointers.
+ */
 #define init_func(func)                         \
         __asm__ (                               \
+                ".pushsection .rodata\n"        \
+                "__init_name_" #func ":\n\t"    \
+                ".string \"" #func "\"\n\t"     \
+                ".popsection\n\t"               \
                 ".pushsection .init\n\t"        \
+                ".balign 4\n\t"                 \
+                ".globl __init_entry_" #func "\n" \
+                "__init_entry_" #func ":\n\t"   \
                 ".long " #func "\n\t"           \
-                ".string \"" #func "\"\n\t"     \
+                ".long __init_name_" #func "\n\t" \
                 ".popsection\n\t"               \
         );
 #define init_depends(name)                      \
         __asm__ (                               \
                 ".pushsection .init\n\t"        \
+                ".balign 4\n\t"                 \
                 ".long 0\n\t"                   \
-                ".string \"" #name "\"\n\t"     \
+                ".long __init_entry_" #name "\n\t" \
                 ".popsection\n\t"               \
         );
 
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * A small LZ77 compressor in the style of LZ4, for data of at most 64k:
+ * quick to compress and quicker to decompress, at the cost of ratio.
+ */
+#define LZ_MAX_INPUT    0x10000
+
+/* Compresses len bytes of src into dst, which holds cap bytes. Returns
+ * the compressed length, or 0 if it does not fit. Must not be called
+ * from interrupt context (it uses a static hash table). */
+size_t lz_compress(const void *src, size_t len, void *dst, size_t cap);
+
+/* Decompresses len bytes of src into dst, which holds cap bytes.
+ * Returns the decompressed length, or -1 if src is not valid
+ * compressed data or does not fit. */
+int lz_decompress(const void *src, size_t len, void *dst, size_t cap);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "types.h"
+
+/* The mean of count samples which add up to total, or 0 if there are
+ * none, as the statistics print them. total / count is a 64-bit
+ * division, which is __udivdi3 in util/math.c; it is only for printing,
+ * so it does not matter that it is done in software. */
+uint32_t math_average(uint64_t total, uint32_t count);
+
+/* The bucket of a log2 histogram of nbuckets which a sample of cycles
+ * goes in: floor(log2(cycles)), 0 for 0, and the last bucket for
+ * anything too big for the others. */
+int math_log2_bucket(uint64_t cycles, int nbuckets);
+
+/* Prints the occupied buckets of such a histogram, on a line of their
+ * own, as iprintf does. */
+void math_log2_info(char **buf, size_t *size, const uint32_t *hist, int nbuckets);
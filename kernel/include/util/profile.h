@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types.h"
+
+struct regs;
+
+/*
+ * A sampling profiler. While it is on, each clock tick counts the
+ * kernel instruction it interrupted, in a histogram of PROFILE_BUCKET
+ * bytes of kernel text per bucket, or just that it interrupted
+ * userland. The idle loop is mostly missed, since the tick is stopped
+ * while idle (see time_idle_enter).
+ */
+
+/* Called from the clock interrupt with the registers it interrupted */
+void profile_tick(struct regs *regs);
+
+/* Starts sampling, from an empty histogram; -ENOMEM if there is no
+ * memory for it */
+int profile_start(void);
+void profile_stop(void);
+
+/* The sample counts, and the busiest buckets */
+size_t profile_info(const void *data, char *buf, size_t size);
+
+/* Writes every bucket hit to the debug log, as "profile: <pc> <count>"
+ * lines, for tools/profile/symbolize.py to match with symbols.dbg */
+void profile_dump(void);
@@ -74,5 +74,10 @@ char  *strcat(char *dest, const char *src);
 char  *strdup(const char *s);
 char  *strtok(char *s, const char *d);
 
+/* copy or clear a page-aligned page, without filling the cache if the
+ * CPU can manage it */
+void   page_copy(void *dest, const void *src);
+void   page_zero(void *dest);
+
 /* return string-representation of an errno */
 char  *strerror(int errnum);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "types.h"
+
+/* Timer interrupts since boot, one every TICK_MSECS milliseconds */
+extern volatile uint32_t jiffies;
+
+/* Called with interrupts blocked by the scheduler as it is about to halt
+ * with nothing to run. Stops the periodic tick, leaving the timer to go
+ * off once, when the next kernel timer is due (or as late as it can, if
+ * none is pending), so that an idle machine takes no interrupts it does
+ * not need. */
+void time_idle_enter(void);
+
+/* Called with interrupts blocked once the halt is over, whatever woke
+ * it. Restarts the periodic tick, if it was stopped and has not already
+ * restarted, with jiffies caught up with the time spent halted. */
+void time_idle_exit(void);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "types.h"
+#include "config.h"
+
+#include "util/list.h"
+
+/*
+ * Kernel timers: a function to be called once a number of clock ticks
+ * (see util/time.h) have gone by, and optionally every so many ticks from
+ * then on.
+ *
+ * Timer functions are called from the clock tick's softirq (see
+ * main/softirq.h), so they must not block; they are meant to wake up a thread (as sleeping with a
+ * timeout does, see sched_sleep_on_timeout) or to do a little work and
+ * return. A timer may be added or deleted from any context, including
+ * its own function.
+ */
+
+/* Clock ticks in at least ms milliseconds */
+#define MSECS_TO_TICKS(ms)      (((ms) + TICK_MSECS - 1) / TICK_MSECS)
+
+/* Returned by ktimer_next if no timer is pending */
+#define KTIMER_NONE             0xffffffff
+
+typedef void (*ktimer_func_t)(void *arg);
+
+typedef struct ktimer {
+        list_link_t     tm_link;        /* on a wheel slot while pending */
+        uint32_t        tm_expires;     /* jiffies at which it is due */
+        uint32_t        tm_period;      /* ticks between calls, 0 if once */
+        ktimer_func_t   tm_func;
+        void           *tm_arg;
+} ktimer_t;
+
+/**
+ * Sets up a timer which is not pending.
+ *
+ * @param t the timer
+ * @param func the function to call when the timer goes off
+ * @param arg the argument to pass it
+ */
+void ktimer_init(ktimer_t *t, ktimer_func_t func, void *arg);
+
+/**
+ * Makes the timer go off after ticks clock ticks (rounded up to 1),
+ * and then every period ticks if period is not 0. If the timer is
+ * already pending it is first deleted.
+ *
+ * @param t the timer
+ * @param ticks ticks from now until it first goes off
+ * @param period ticks between later calls, or 0 to call it just once
+ */
+void ktimer_add(ktimer_t *t, uint32_t ticks, uint32_t period);
+
+/**
+ * Stops the timer going off, if it has not already.
+ *
+ * @param t the timer
+ * @return 1 if the timer was pending, 0 otherwise
+ */
+int ktimer_del(ktimer_t *t);
+
+/**
+ * @param t the timer
+ * @return 1 if the timer is waiting to go off, 0 otherwise
+ */
+int ktimer_pending(ktimer_t *t);
+
+/**
+ * Returns how many clock ticks from now the next pending timer is due
+ * (0 if it is overdue), or KTIMER_NONE if there is none. Takes time in
+ * proportion to the number of wheel slots, so is meant for going idle
+ * rather than for every tick. Interrupts must be blocked.
+ */
+uint32_t ktimer_next(void);
+
+/**
+ * Runs every timer which has become due, having already advanced
+ * jiffies. Called from the clock tick's softirq, and by the scheduler
+ * when it stops being idle.
+ */
+void ktimer_tick(void);
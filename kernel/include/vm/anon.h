@@ -5,5 +5,11 @@ struct mmobj;
 void anon_init();
 struct mmobj *anon_create(void);
 
+/* Whether o is an anonymous object */
+int anon_is(struct mmobj *o);
+
 extern int anon_count;
 
+/* The page of zeros mapped for anonymous pages which have only been read */
+extern void *anon_zero_page;
+
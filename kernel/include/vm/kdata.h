@@ -0,0 +1,16 @@
+#pragma once
+
+#include "api/kdata.h"
+
+struct vmmap;
+
+/* The kernel's view of the kernel data page (see api/kdata.h) */
+extern kdata_t *kdata;
+
+/* Brings the values on the page up to date; called from the clock
+ * interrupt */
+void kdata_tick(void);
+
+/* Maps the page at KDATA_ADDR in map. Returns 0 or -errno, -EINVAL
+ * if something is already mapped there. */
+int kdata_map(struct vmmap *map);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "types.h"
+
+struct pframe;
+
+/* Gives pf, which is about to be written, a page of its own again if it
+ * shares one with other pframes. Called from the dirtypage entry points
+ * of anonymous and shadow objects. Returns 0 or -ENOMEM. */
+int ksm_unmerge(struct pframe *pf);
+
+/* Drops pf's share of the page it shares, which pf is being freed with,
+ * freeing the page if nothing else shares it */
+void ksm_release(struct pframe *pf);
+
+void ksm_shutdown(void);
+
+/* Debug info function, prints how many pages are shared and how often */
+size_t ksm_info(const void *data, char *buf, size_t size);
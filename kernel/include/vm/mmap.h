@@ -5,3 +5,5 @@ struct vmarea;
 
 int do_munmap(void *addr, size_t len);
 int do_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off, void **ret);
+int do_mlock(const void *addr, size_t len, int lock);
+int do_madvise(void *addr, size_t len, int advice);
@@ -8,4 +8,24 @@
 #define FAULT_RESERVED 0x08
 #define FAULT_EXEC     0x10
 
+/* The kinds of fault counted, see handle_pagefault */
+#define PAGEFAULT_MINOR  0      /* the page was resident */
+#define PAGEFAULT_MAJOR  1      /* it had to be read in */
+#define PAGEFAULT_COW    2      /* a private copy of it was made */
+#define PAGEFAULT_ZERO   3      /* anonymous memory never written before */
+#define PAGEFAULT_NKINDS 4
+
+typedef struct pagefault_stats {
+        uint32_t pfs_count[PAGEFAULT_NKINDS];
+        uint64_t pfs_cycles[PAGEFAULT_NKINDS];  /* spent handling them */
+} pagefault_stats_t;
+
+struct vmarea;
+
 void handle_pagefault(uintptr_t vaddr, uint32_t cause);
+int pagefault_resolve(uintptr_t vaddr, uint32_t cause);
+int pagefault_map(struct vmarea *vma, uint32_t vfn, int forwrite);
+
+/* Debug info function, prints the given fault counts (the system's if
+ * data is NULL) */
+size_t pagefault_info(const void *data, char *buf, size_t size);
@@ -5,5 +5,8 @@ struct mmobj;
 void shadow_init();
 struct mmobj *shadow_create(void);
 
+/* Whether o is a shadow object */
+int shadow_is(struct mmobj *o);
+
 extern int shadow_count;
 
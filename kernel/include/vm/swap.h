@@ -0,0 +1,62 @@
+#pragma once
+
+#include "types.h"
+
+#include "mm/mmobj.h"
+
+struct pframe;
+
+/*
+ * Where the pages of one anonymous or shadow object are in swap: the
+ * swap slot of each page which has one, 0 being none. Pages are found
+ * through a directory of leaves, each a page of slots, and neither is
+ * allocated until a page in its range is written out.
+ */
+typedef struct swap_map {
+        uint32_t **sm_dir;
+        uint32_t   sm_nslots;   /* slots held */
+} swap_map_t;
+
+/* Anonymous and shadow objects are allocated as these, the map of
+ * their pages in swap following the object */
+typedef struct swap_mmobj {
+        mmobj_t    sw_obj;
+        swap_map_t sw_map;
+} swap_mmobj_t;
+
+void swap_init(void);
+
+/* Whether there is anywhere to swap to, a swap device or zram; until
+ * there is, anonymous and shadow pages are pinned as soon as they are
+ * filled */
+int swap_enabled(void);
+/* Whether o's pages are cleaned by writing them to swap: whether it is
+ * an anonymous or shadow object */
+int swap_backed(struct mmobj *o);
+
+void swap_map_init(swap_map_t *map);
+/* Frees every slot in map, and the map itself */
+void swap_map_destroy(swap_map_t *map);
+
+/* Writes pf, a page of an anonymous or shadow object, to swap, in the
+ * slot it already has if it has one. Returns 0 or -errno. */
+int swap_out(struct mmobj *o, struct pframe *pf);
+/* Reads pf back from swap if o has a slot for it. Returns 1 if it was
+ * read, 0 if o has no copy of it in swap, or -errno. A page read from
+ * zram loses its slot, and is left dirty. */
+int swap_in(struct mmobj *o, struct pframe *pf);
+
+/* Whether o has a copy of the page in swap (never, unless o is an
+ * anonymous or shadow object) */
+int swap_holds(struct mmobj *o, uint32_t pagenum);
+/* Frees o's slot for the page, if it has one */
+void swap_discard(struct mmobj *o, uint32_t pagenum);
+/* Moves the slots of the shadow object o, which is about to be collapsed
+ * into child, to child, freeing those of pages child has its own copies
+ * of. The pages o has resident lose their slots, and are dirtied so that
+ * they are written out again once they have moved up. Returns 0, or
+ * -ENOMEM having moved nothing. */
+int swap_collapse(struct mmobj *o, struct mmobj *child);
+
+/* Debug info function, prints how much of swap is in use */
+size_t swap_info(const void *data, char *buf, size_t size);
@@ -4,6 +4,11 @@
 
 #include "util/list.h"
 
+#include "proc/krwlock.h"
+#include "proc/sched.h"
+
+#include "vm/pagefault.h"
+
 #define VMMAP_DIR_LOHI 1
 #define VMMAP_DIR_HILO 2
 
@@ -11,9 +16,33 @@ struct mmobj;
 struct proc;
 struct vnode;
 
+struct vmarea;
+
+/*
+ * The areas of an address space are kept both on vmm_list, in address
+ * order, and in an AVL tree keyed by vma_start, so that finding the area
+ * containing a page, or a gap of a given size, takes logarithmic time.
+ *
+ * With more than one thread in a process, vmm_lock is held shared while
+ * a fault looks up and maps its page, and exclusive by anything changing
+ * the areas (mmap, munmap, brk, mlock, madvise), so that faults in
+ * different threads go on at the same time but never see an area change
+ * under them.
+ */
 typedef struct vmmap {
-        list_t       vmm_list;
-        struct proc *vmm_proc;
+        list_t         vmm_list;
+        struct proc   *vmm_proc;     /* must stay here, fork sets it */
+        struct vmarea *vmm_root;     /* root of the tree of areas */
+        struct vmarea *vmm_hint;     /* the area vmmap_lookup last found */
+        struct vmmap  *vmm_clone;    /* the map being forked from this one,
+                                      * see pt_unmap_range */
+        pagefault_stats_t vmm_faults; /* faults taken in this address
+                                       * space, see handle_pagefault */
+        uint32_t       vmm_ticks;    /* clock ticks taken while its process
+                                      * was running, see util/time.c */
+        sched_latency_t vmm_sched;   /* waits of its threads, see
+                                      * proc/sched.c */
+        krwlock_t      vmm_lock;
 } vmmap_t;
 
 /* make sure you understand why mapping boundaries are in terms of frame
@@ -24,7 +53,8 @@ typedef struct vmarea {
         uint32_t       vma_off;      /* offset from beginning of vma_obj in pages */
 
         int            vma_prot;     /* permissions on mapping */
-        int            vma_flags;    /* either MAP_SHARED or MAP_PRIVATE */
+        int            vma_flags;    /* either MAP_SHARED or MAP_PRIVATE,
+                                      * and maybe MAP_GROWSDOWN */
 
         struct vmmap  *vma_vmmap;    /* address space that this area belongs to */
         struct mmobj  *vma_obj;      /* the vm object to read pages from */
@@ -32,6 +62,19 @@ typedef struct vmarea {
         list_link_t    vma_olink;    /* link on the list of all vm_areas
                                       * having the same vm_object at the
                                       * bottom of their chain */
+
+        /* Maintained by vmmap.c, see vmmap_t */
+        struct vmarea *vma_left;
+        struct vmarea *vma_right;
+        struct vmarea *vma_parent;
+        int            vma_height;
+        uint32_t       vma_gap;      /* free pages between the previous
+                                      * area (or USER_MEM_LOW) and this one */
+        uint32_t       vma_maxgap;   /* largest vma_gap in this subtree */
+
+        int            vma_locked;   /* its pages are pinned, see vmmap_lock */
+        int            vma_advice;   /* MADV_NORMAL, MADV_RANDOM or
+                                      * MADV_SEQUENTIAL, see vmmap_advise */
 } vmarea_t;
 
 void vmmap_init(void);
@@ -41,13 +84,24 @@ void vmmap_destroy(vmmap_t *map);
 
 vmarea_t *vmmap_lookup(vmmap_t *map, uint32_t vfn);
 int vmmap_map(vmmap_t *map, struct vnode *file, uint32_t lopage, uint32_t npages, int prot, int flags, off_t off, int dir, vmarea_t **new);
+int vmmap_map_obj(vmmap_t *map, struct mmobj *obj, uint32_t lopage, uint32_t npages,
+                  int prot, int flags);
 int vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages);
 int vmmap_is_range_empty(vmmap_t *map, uint32_t startvfn, uint32_t npages);
 int vmmap_find_range(vmmap_t *map, uint32_t npages, int dir);
+int vmmap_populate(vmmap_t *map, uint32_t lopage, uint32_t npages);
+int vmmap_lock(vmmap_t *map, uint32_t lopage, uint32_t npages, int lock);
+int vmmap_advise(vmmap_t *map, uint32_t lopage, uint32_t npages, int advice);
+int vmmap_grow_down(vmmap_t *map, uint32_t vfn);
+int vmmap_brk(vmmap_t *map, uint32_t oldend, uint32_t newend);
 
 int vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count);
 int vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count);
 
 vmmap_t *vmmap_clone(vmmap_t *map);
+void vmmap_fork_unshadow(vmmap_t *map);
 
 size_t vmmap_mapping_info(const void *map, char *buf, size_t size);
+
+/* Debug info function, prints how often vmmap_lookup's hint was right */
+size_t vmmap_lookup_info(const void *data, char *buf, size_t size);
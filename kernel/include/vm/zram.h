@@ -0,0 +1,24 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * The compressed tier of swap, see vm/zram.c. Entries are numbered from
+ * 1, as swap slots are.
+ */
+
+void zram_init(void);
+
+/* Whether pages can be compressed into memory */
+int zram_enabled(void);
+
+/* Compresses the page at addr into the pool. Returns its entry, or
+ * -ENOSPC if it does not compress well enough or the pool is full, or
+ * -ENOMEM. */
+int zram_store(const void *addr);
+/* Decompresses the entry into the page at addr. Returns 0 or -errno. */
+int zram_load(uint32_t entry, void *addr);
+void zram_free(uint32_t entry);
+
+/* Debug info function, prints how full and how compressed the pool is */
+size_t zram_info(const void *data, char *buf, size_t size);
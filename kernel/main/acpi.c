@@ -84,14 +84,15 @@ static struct rsd_table *rsd_table;
  * that memory, returning the new virtual address for that table */
 static void *_acpi_load_table(uintptr_t paddr)
 {
-        struct acpi_header *tmp =
-                (struct acpi_header *)(pt_phys_tmp_map((uintptr_t)PAGE_ALIGN_DOWN(paddr)) + (PAGE_OFFSET(paddr)));
+        uintptr_t page = pt_kmap((uintptr_t)PAGE_ALIGN_DOWN(paddr));
+        struct acpi_header *tmp = (struct acpi_header *)(page + PAGE_OFFSET(paddr));
 
         /* this function is not designed to handle tables which
          * cross page boundaries */
         KASSERT(PAGE_OFFSET(paddr) + tmp->ah_size < PAGE_SIZE);
         struct acpi_header *table = kmalloc(tmp->ah_size);
         memcpy(table, tmp, tmp->ah_size);
+        pt_kunmap(page);
         return (void *)table;
 }
 
@@ -2,7 +2,9 @@
 
 #include "main/io.h"
 #include "main/acpi.h"
+#include "main/apic.h"
 #include "main/cpuid.h"
+#include "main/pit.h"
 
 #include "mm/page.h"
 #include "mm/pagetable.h"
@@ -90,6 +92,15 @@
 #define LAPICTPR (*(volatile uint32_t*)(apic->at_addr + LOCAL_APIC_TASKPRIOR))
 #define LAPICSPUR (*(volatile uint32_t*)(apic->at_addr + LOCAL_APIC_SPURIOUS))
 #define LAPICEOI (*(volatile uint32_t*)(apic->at_addr + LOCAL_APIC_EOI))
+#define LAPICICRL (*(volatile uint32_t*)(apic->at_addr + LOCAL_APIC_ICRL))
+#define LAPICICRH (*(volatile uint32_t*)(apic->at_addr + LOCAL_APIC_ICRH))
+
+/* Inter-processor interrupts, written to the low half of the ICR */
+#define ICR_INIT 0x00000500
+#define ICR_STARTUP 0x00000600
+#define ICR_PENDING 0x00001000
+#define ICR_ASSERT 0x00004000
+#define ICR_LEVEL 0x00008000
 
 /* IO APIC */
 #define IOAPIC_IOWIN 0x10
@@ -130,13 +141,19 @@ struct ioapic_table {
 };
 
 static struct apic_table *apic = NULL;
-static struct lapic_table *lapic = NULL;
+static struct lapic_table *lapic = NULL;        /* the boot processor's */
 static struct ioapic_table *ioapic = NULL;
 
+/* The IDs of the enabled local APICs, the boot processor's first */
+static uint8_t lapic_ids[APIC_MAX_CPUS];
+static uint32_t lapic_count = 0;
+
+/* The spurious interrupt vector, for the other processors' APICs */
+static uint8_t apic_spur_intr;
 
 static uint32_t __lapic_getid(void)
 {
-	return (LAPICID >> 24) & 0x0f;
+	return (LAPICID >> 24) & 0xff;
 }
 
 static uint32_t __lapic_getver(void)
@@ -249,40 +266,67 @@ void apic_disable_periodic_timer() {
 	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TASKPRIOR) = 0;
 }
 
-void apic_enable_periodic_timer(uint32_t freq) {
-	uint32_t tmp;
-	uint32_t cpubusfreq;
+/* How long the APIC timer is timed against the PIT for */
+#define APIC_CALIBRATE_USECS 10000
+
+/* The timer's interrupt, the count for one period, and the count the
+ * timer was last started from in one-shot mode */
+static uint8_t apic_timer_intr;
+static uint32_t apic_timer_count;
+static uint32_t apic_timer_oneshot_count;
+
+void apic_enable_periodic_timer(uint8_t intr, uint32_t msecs) {
+	uint32_t ticks, count;
 
 	dbgq(DBG_CORE, "--- Enabling APIC Timer ---\n");
 
+	/* Count down from -1 (divided by 16, as below) while the PIT
+	 * counts down APIC_CALIBRATE_USECS */
+	*(uint32_t*)(apic->at_addr + LOCAL_APIC_LVT_TMR) = LOCAL_APIC_DISABLE;
 	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRDIV) = 0x03;
-	/* Initialize PIT Ch 2 in one-shot mode */
-	/* Some crazy magic numbers here */
-	outb(0x61, (inb(0x61) & 0xfd) | 1);
-	outb(0x43, 0xb2);
-	outb(0x42, 0x9b);
-	inb(0x60);
-	outb(0x42, 0x2e);
-	
-	/* reset PIT one-shot counter (start counting) */
-	tmp = (uint32_t)(inb(0x61) & 0xfe);
-	outb(0x61, (uint8_t)tmp);
-	outb(0x61, (uint8_t)tmp | 1);
-	/* reset APIC timer (set counter to -1) */
+	pit_oneshot_start(APIC_CALIBRATE_USECS);
 	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRINITCNT) = 0xffffffff;
-	/* wait until the PIT reaches zero */
-	while(!(inb(0x61) & 0x20));
-	/* Stop the APIC timer */
-	*(uint32_t*)(apic->at_addr + LOCAL_APIC_LVT_TMR) = LOCAL_APIC_DISABLE;
-	/* some math */
-	cpubusfreq = ((0xffffffff - *(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRINITCNT)) + 1) * 16 * 100;
-	tmp = (cpubusfreq / freq / 16) * 10000;
-	dbgq(DBG_CORE, "CPU Bus Freq: %u\n", cpubusfreq);
-	dbgq(DBG_CORE, "APIC Timer initial count %u\n", tmp);
+	while (!pit_oneshot_done());
+	ticks = 0xffffffff - *(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRCURRCNT);
+	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRINITCNT) = 0;
+
+	/* and so the count for one interrupt every msecs */
+	count = ticks / (APIC_CALIBRATE_USECS / 1000) * msecs;
+	dbgq(DBG_CORE, "APIC timer: %u ticks in %u us (bus clock %u kHz)\n",
+	     ticks, APIC_CALIBRATE_USECS, ticks * 16 / (APIC_CALIBRATE_USECS / 1000));
+	dbgq(DBG_CORE, "APIC timer initial count %u for %u ms\n", count, msecs);
+
 	/* Set up the APIC timer for periodic mode */
-	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRINITCNT) = (tmp < 16 ? 16 : tmp);
-	*(uint32_t*)(apic->at_addr + LOCAL_APIC_LVT_TMR) = 32 | LOCAL_APIC_TMR_PERIODIC;
+	apic_timer_intr = intr;
+	apic_timer_count = (count < 16 ? 16 : count);
+	*(uint32_t*)(apic->at_addr + LOCAL_APIC_LVT_TMR) = intr | LOCAL_APIC_TMR_PERIODIC;
 	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRDIV) = 0x03;
+	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRINITCNT) = apic_timer_count;
+}
+
+uint32_t apic_timer_oneshot(uint32_t periods) {
+	KASSERT(0 != apic_timer_count);
+	if (periods > 0xffffffff / apic_timer_count)
+		periods = 0xffffffff / apic_timer_count;
+	if (0 == periods)
+		periods = 1;
+	apic_timer_oneshot_count = periods * apic_timer_count;
+
+	/* writing the initial count restarts the timer in its new mode */
+	*(uint32_t*)(apic->at_addr + LOCAL_APIC_LVT_TMR) = apic_timer_intr;
+	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRINITCNT) = apic_timer_oneshot_count;
+	return periods;
+}
+
+uint32_t apic_timer_periodic(void) {
+	uint32_t elapsed;
+
+	KASSERT(0 != apic_timer_count);
+	elapsed = apic_timer_oneshot_count
+	          - *(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRCURRCNT);
+	*(uint32_t*)(apic->at_addr + LOCAL_APIC_LVT_TMR) = apic_timer_intr | LOCAL_APIC_TMR_PERIODIC;
+	*(uint32_t*)(apic->at_addr + LOCAL_APIC_TMRINITCNT) = apic_timer_count;
+	return elapsed / apic_timer_count;
 }
 
 static void apic_disable_8259() {
@@ -325,24 +369,36 @@ void apic_init()
         KASSERT(PAGE_ALIGNED(apic->at_addr));
         apic->at_addr = pt_phys_perm_map(apic->at_addr, 1);
 
-        /* Get the tables for the local APIC and IO APICS,
-         * Weenix currently only supports one of each, in order
-         * to enforce this a KASSERT will fail this if more than one
-         * of each type is found */
+        /* Get the tables for the local APICs and IO APICS. There is a
+         * local APIC for every processor, of which the one we are
+         * running on gets the interrupts; Weenix currently only
+         * supports one IO APIC, in order to enforce this a KASSERT
+         * will fail this if more than one is found */
+        lapic_ids[0] = __lapic_getid();
+        lapic_count = 1;
         uint8_t off = sizeof(*apic);
         while (off < apic->at_header.ah_size) {
                 uint8_t type = *(ptr + off);
                 uint8_t size = *(ptr + off + 1);
                 if (TYPE_LAPIC == type) {
+                        struct lapic_table *l = (struct lapic_table *)(ptr + off);
                         KASSERT(apic_exists() && "Local APIC does not exist");
                         KASSERT(sizeof(struct lapic_table) == size);
-                        KASSERT(NULL == lapic && "Weenix only supports a single local APIC");
-                        lapic = (struct lapic_table *)(ptr + off);
                         dbgq(DBG_CORE, "LAPIC:\n");
-                        dbgq(DBG_CORE, "   id:         0x%.2x\n", (uint32_t)lapic->at_apicid);
-                        dbgq(DBG_CORE, "   processor:  0x%.3x\n", (uint32_t)lapic->at_procid);
-                        dbgq(DBG_CORE, "   enabled:    %i\n", lapic->at_flags & 0x1);
-                        KASSERT(lapic->at_flags & 0x1 && "The local APIC is disabled");
+                        dbgq(DBG_CORE, "   id:         0x%.2x\n", (uint32_t)l->at_apicid);
+                        dbgq(DBG_CORE, "   processor:  0x%.3x\n", (uint32_t)l->at_procid);
+                        dbgq(DBG_CORE, "   enabled:    %i\n", l->at_flags & 0x1);
+                        if (l->at_apicid == lapic_ids[0]) {
+                                KASSERT(l->at_flags & 0x1 && "The local APIC is disabled");
+                                lapic = l;
+                        } else if (!(l->at_flags & 0x1)) {
+                                /* a processor which is not there */
+                        } else if (lapic_count < APIC_MAX_CPUS) {
+                                lapic_ids[lapic_count++] = l->at_apicid;
+                        } else {
+                                dbgq(DBG_CORE, "   (ignored, more than %d processors)\n",
+                                     APIC_MAX_CPUS);
+                        }
                 } else if (TYPE_IOAPIC == type) {
                         KASSERT(apic_exists() && "IO APIC does not exist");
                         KASSERT(sizeof(struct ioapic_table) == size);
@@ -359,7 +415,8 @@ void apic_init()
                 }
                 off += size;
         }
-        KASSERT(NULL != lapic && "Could not find a local APIC device");
+        KASSERT(NULL != lapic && "Could not find this processor's local APIC");
+        dbgq(DBG_CORE, "Processors:          %u\n", lapic_count);
         KASSERT(NULL != ioapic && "Could not find an IO APIC");
 
 	dbgq(DBG_CORE, "--- Enabling APIC ---\n");
@@ -388,9 +445,70 @@ void apic_setipl(uint8_t ipl)
 void apic_setspur(uint8_t intr)
 {
         dbg(DBG_CORE, "mapping spurious interrupts to %hhu\n", intr);
+        apic_spur_intr = intr;
         __lapic_setspur(intr);
 }
 
+uint32_t apic_ncpus(void)
+{
+        return lapic_count;
+}
+
+uint8_t apic_cpu_id(uint32_t cpu)
+{
+        KASSERT(cpu < lapic_count);
+        return lapic_ids[cpu];
+}
+
+uint8_t apic_current_id(void)
+{
+        return __lapic_getid();
+}
+
+void apic_ap_init(void)
+{
+        apic_enable();
+        __lapic_setspur(apic_spur_intr);
+}
+
+/* Busy waits for at least the given number of microseconds */
+static void __apic_udelay(uint32_t usecs)
+{
+        pit_oneshot_start(usecs);
+        while (!pit_oneshot_done());
+}
+
+/* Sends an inter-processor interrupt to the given local APIC
+ * and waits for it to be accepted */
+static void __apic_send_ipi(uint8_t apicid, uint32_t icr)
+{
+        LAPICICRH = ((uint32_t)apicid) << 24;
+        LAPICICRL = icr;
+        while (LAPICICRL & ICR_PENDING);
+}
+
+void apic_start_ap(uint8_t apicid, uintptr_t paddr)
+{
+        KASSERT(PAGE_ALIGNED(paddr) && paddr < 0x100000);
+
+        /* The universal startup algorithm from the MultiProcessor
+         * Specification: INIT (asserted, then deasserted for the
+         * processors which need it), then two STARTUPs, which start the
+         * processor in real mode at paddr */
+        __apic_send_ipi(apicid, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+        __apic_send_ipi(apicid, ICR_INIT | ICR_LEVEL);
+        __apic_udelay(10000);
+        __apic_send_ipi(apicid, ICR_STARTUP | ICR_ASSERT | (paddr >> PAGE_SHIFT));
+        __apic_udelay(200);
+        __apic_send_ipi(apicid, ICR_STARTUP | ICR_ASSERT | (paddr >> PAGE_SHIFT));
+        __apic_udelay(200);
+}
+
+void apic_send_ipi(uint8_t apicid, uint8_t intr)
+{
+        __apic_send_ipi(apicid, ICR_ASSERT | intr);
+}
+
 void apic_eoi()
 {
         LAPICEOI = 0x0;
@@ -402,3 +520,8 @@ void apic_setredir(uint32_t irq, uint8_t intr)
         __ioapic_setredir(irq, intr);
         __ioapic_setmask(irq, 0);
 }
+
+void apic_setmask(uint32_t irq, int mask)
+{
+        __ioapic_setmask(irq, mask);
+}
@@ -0,0 +1,132 @@
+#include "types.h"
+#include "globals.h"
+#include "kernel.h"
+
+#include "main/cpuid.h"
+#include "main/fpu.h"
+#include "main/interrupt.h"
+
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+
+#define CR0_MP          0x00000002      /* monitor coprocessor: wait traps on TS */
+#define CR0_EM          0x00000004      /* emulate: every FPU instruction traps */
+#define CR0_TS          0x00000008      /* task switched */
+#define CR4_OSFXSR      0x00000200      /* fxsave/fxrstor, and SSE */
+#define CR4_OSXMMEXCPT  0x00000400      /* SSE exceptions as #XM */
+
+/* The initial MXCSR: every SSE exception masked */
+#define MXCSR_INIT      0x1f80
+
+static int fpu_present;
+static int fpu_fxsr;
+static kthread_t *fpu_owner;            /* whose registers are in the CPU */
+static int fpu_ts;                      /* whether CR0.TS is set */
+
+static void
+fpu_set_ts(int ts)
+{
+        uint32_t cr0;
+
+        if (ts == fpu_ts)
+                return;
+        if (ts) {
+                __asm__ volatile("movl %%cr0, %0" : "=r"(cr0));
+                __asm__ volatile("movl %0, %%cr0" :: "r"(cr0 | CR0_TS));
+        } else {
+                __asm__ volatile("clts");
+        }
+        fpu_ts = ts;
+}
+
+void
+fpu_state_init(fpu_state_t *fs)
+{
+        fs->fs_valid = 0;
+}
+
+void
+fpu_switch(kthread_t *next)
+{
+        if (fpu_present)
+                fpu_set_ts(next != fpu_owner);
+}
+
+void
+fpu_release(kthread_t *thr)
+{
+        if (thr == fpu_owner)
+                fpu_owner = NULL;
+}
+
+/* #NM: the current thread has used the FPU with TS set, so it is not the
+ * owner. Hands it the FPU, saving the old owner's registers first. */
+static void
+fpu_trap(regs_t *regs)
+{
+        uint8_t oldipl = intr_getipl();
+        fpu_state_t *fs;
+        uint32_t mxcsr = MXCSR_INIT;
+
+        intr_setipl(IPL_HIGH);
+        fpu_set_ts(0);
+        KASSERT(fpu_owner != curthr);
+
+        if (NULL != fpu_owner) {
+                fs = sched_fpu_state(fpu_owner);
+                if (fpu_fxsr)
+                        __asm__ volatile("fxsave %0" : "=m"(fs->fs_regs));
+                else
+                        __asm__ volatile("fnsave %0" : "=m"(fs->fs_regs));
+                fs->fs_valid = 1;
+        }
+
+        fs = sched_fpu_state(curthr);
+        if (fs->fs_valid) {
+                if (fpu_fxsr)
+                        __asm__ volatile("fxrstor %0" :: "m"(fs->fs_regs));
+                else
+                        __asm__ volatile("frstor %0" :: "m"(fs->fs_regs));
+        } else {
+                __asm__ volatile("fninit");
+                if (fpu_fxsr)
+                        __asm__ volatile("ldmxcsr %0" :: "m"(mxcsr));
+        }
+        fpu_owner = curthr;
+        intr_setipl(oldipl);
+}
+
+static __attribute__((unused)) void
+fpu_init(void)
+{
+        uint32_t eax, edx, cr0, cr4;
+
+        cpuid(CPUID_GETFEATURES, &eax, &edx);
+        if (!(CPUID_FEAT_EDX_FPU & edx)) {
+                dbg(DBG_INIT, "No FPU\n");
+                return;
+        }
+        fpu_present = 1;
+        fpu_fxsr = !!(CPUID_FEAT_EDX_FXSR & edx);
+
+        __asm__ volatile("movl %%cr0, %0" : "=r"(cr0));
+        cr0 = (cr0 | CR0_MP) & ~CR0_EM;
+        __asm__ volatile("movl %0, %%cr0" :: "r"(cr0));
+        if (fpu_fxsr) {
+                __asm__ volatile("movl %%cr4, %0" : "=r"(cr4));
+                cr4 |= CR4_OSFXSR;
+                if (CPUID_FEAT_EDX_SSE & edx)
+                        cr4 |= CR4_OSXMMEXCPT;
+                __asm__ volatile("movl %0, %%cr4" :: "r"(cr4));
+        }
+        __asm__ volatile("fninit");
+
+        intr_register(INTR_DEVICE_NOT_AVAILABLE, fpu_trap);
+        /* nobody owns the FPU yet */
+        fpu_ts = 0;
+        fpu_set_ts(1);
+}
+init_func(fpu_init);
@@ -1,4 +1,8 @@
+#include "kernel.h"
+
+#include "main/apic.h"
 #include "main/gdt.h"
+#include "main/cpuid.h"
 
 #include "util/printf.h"
 #include "util/debug.h"
@@ -54,6 +58,27 @@ static struct gdt_location gdtl = {
         .gl_offset = (uint32_t) &gdt
 };
 
+/* The other processors' copies, see gdt_init_ap. Those of processor 0,
+ * which booted, are the ones above. */
+static struct gdt_entry gdt_ap[APIC_MAX_CPUS][GDT_COUNT];
+static struct tss_entry tss_ap[APIC_MAX_CPUS];
+
+static void __gdt_set_entry(struct gdt_entry *table, uint32_t segment, uint32_t base,
+                            uint32_t limit, uint8_t ring, int exec, int dir, int rw);
+
+/* Points the TSS descriptor of a GDT at t, and sets t up */
+static void __gdt_set_tss(struct gdt_entry *table, struct tss_entry *t)
+{
+        __gdt_set_entry(table, GDT_TSS, (uint32_t)t, sizeof(*t), 0, 1, 0, 0);
+        table[GDT_TSS / 8].ge_access &= ~(0b10000);
+        table[GDT_TSS / 8].ge_access |= 0b1;
+        table[GDT_TSS / 8].ge_flags &= ~(0b10000000);
+
+        memset(t, 0, sizeof(*t));
+        t->ts_ss0 = GDT_KERNEL_DATA;
+        t->ts_iopb = sizeof(*t);
+}
+
 void gdt_init(void)
 {
         struct gdt_location *data = &gdtl;
@@ -67,47 +92,78 @@ void gdt_init(void)
 
         __asm__ volatile("lgdt (%0)" :: "p"(data));
 
-        gdt_set_entry(GDT_TSS, (uint32_t)&tss, sizeof(tss), 0, 1, 0, 0);
-        gdt[GDT_TSS / 8].ge_access &= ~(0b10000);
-        gdt[GDT_TSS / 8].ge_access |= 0b1;
-        gdt[GDT_TSS / 8].ge_flags &= ~(0b10000000);
+        __gdt_set_tss(gdt, &tss);
+
+        int segment = GDT_TSS;
+        __asm__ volatile("ltr %0" :: "m"(segment));
+}
+
+void gdt_init_ap(uint32_t cpu, void *kstack)
+{
+        struct gdt_location data;
+
+        KASSERT(0 < cpu && cpu < APIC_MAX_CPUS);
 
-        memset(&tss, 0, sizeof(tss));
-        tss.ts_ss0 = GDT_KERNEL_DATA;
-        tss.ts_iopb = sizeof(tss);
+        /* the same segments, but a TSS of its own, which a processor
+         * marks busy when it loads it */
+        memcpy(gdt_ap[cpu], gdt, sizeof(gdt));
+        __gdt_set_tss(gdt_ap[cpu], &tss_ap[cpu]);
+        tss_ap[cpu].ts_esp0 = (uint32_t)kstack;
+
+        data.gl_size = GDT_COUNT * 8;
+        data.gl_offset = (uint32_t)gdt_ap[cpu];
+        __asm__ volatile("lgdt (%0)" :: "p"(&data));
 
         int segment = GDT_TSS;
         __asm__ volatile("ltr %0" :: "m"(segment));
 }
 
+/* Whether SYSENTER is in use, in which case its stack has to follow
+ * the TSS's */
+static int gdt_sysenter = 0;
+
 void gdt_set_kernel_stack(void *addr)
 {
         tss.ts_esp0 = (uint32_t)addr;
+        if (gdt_sysenter)
+                cpuid_set_msr(MSR_SYSENTER_ESP, (uint32_t)addr, 0);
 }
 
-void gdt_set_entry(uint32_t segment, uint32_t base, uint32_t limit,
-                   uint8_t ring, int exec, int dir, int rw)
+void gdt_enable_sysenter(void)
+{
+        gdt_sysenter = 1;
+        cpuid_set_msr(MSR_SYSENTER_ESP, tss.ts_esp0, 0);
+}
+
+static void __gdt_set_entry(struct gdt_entry *table, uint32_t segment, uint32_t base,
+                            uint32_t limit, uint8_t ring, int exec, int dir, int rw)
 {
         KASSERT(segment < GDT_COUNT * 8 && 0 == segment % 8);
         KASSERT(ring <= 3);
         KASSERT(limit <= 0xFFFFF);
 
         int index = segment / 8;
-        gdt[index].ge_limitlo = (uint16_t)limit;
-        gdt[index].ge_baselo = (uint16_t)base;
-        gdt[index].ge_basemid = (uint8_t)(base >> 16);
-        gdt[index].ge_basehi = (uint8_t)(base >> 24);
-        gdt[index].ge_flags = 0b11000000 | (uint8_t)(limit >> 16);
-
-        gdt[index].ge_access = 0b10000000;
-        gdt[index].ge_access |= (ring << 5);
-        gdt[index].ge_access |= 0b10000;
+        table[index].ge_limitlo = (uint16_t)limit;
+        table[index].ge_baselo = (uint16_t)base;
+        table[index].ge_basemid = (uint8_t)(base >> 16);
+        table[index].ge_basehi = (uint8_t)(base >> 24);
+        table[index].ge_flags = 0b11000000 | (uint8_t)(limit >> 16);
+
+        table[index].ge_access = 0b10000000;
+        table[index].ge_access |= (ring << 5);
+        table[index].ge_access |= 0b10000;
         if (exec)
-                gdt[index].ge_access |= 0b1000;
+                table[index].ge_access |= 0b1000;
         if (dir)
-                gdt[index].ge_access |= 0b100;
+                table[index].ge_access |= 0b100;
         if (rw)
-                gdt[index].ge_access |= 0b10;
+                table[index].ge_access |= 0b10;
+}
+
+void gdt_set_entry(uint32_t segment, uint32_t base, uint32_t limit,
+                   uint8_t ring, int exec, int dir, int rw)
+{
+        __gdt_set_entry(gdt, segment, base, limit, ring, exec, dir, rw);
 }
 
 void gdt_clear(uint32_t segment)
@@ -1,12 +1,17 @@
 #include "types.h"
 
 #include "util/debug.h"
+#include "util/math.h"
 #include "util/string.h"
+#include "util/printf.h"
 
 #include "main/io.h"
 #include "main/apic.h"
 #include "main/interrupt.h"
 #include "main/gdt.h"
+#include "main/cpuid.h"
+#include "main/softirq.h"
+#include "proc/sched.h"
 
 #define MAX_INTERRUPTS          256
 
@@ -322,6 +327,50 @@ INTR_NOERRCODE(253)
 INTR_NOERRCODE(254)
 INTR_NOERRCODE(255)
 
+/*
+ * The sysenter entry point. The processor has only switched to the
+ * kernel stack (MSR_SYSENTER_ESP, kept equal to the TSS's esp0), so this
+ * builds the same frame as int $INTR_SYSCALL would and goes through
+ * __intr_handler; fork and the like still see a full regs_t. Userland
+ * passes the syscall number in eax, the argument in esi, its stack in ecx
+ * and where to return to in edx, and gets the errno back in esi.
+ */
+extern intr_handler_t __intr_sysenter;
+__asm__ (
+        ".global __intr_sysenter\n"
+        "__intr_sysenter:\n\t"
+        "push $0x23\n\t"                       /* r_ss, GDT_USER_DATA | 3 */
+        "push %ecx\n\t"                        /* r_useresp */
+        "pushf\n\t"                            /* r_eflags ... */
+        "orl $0x200, (%esp)\n\t"               /* ... which had IF set */
+        "push $0x1b\n\t"                       /* r_cs, GDT_USER_TEXT | 3 */
+        "push %edx\n\t"                        /* r_eip */
+        "push $1\n\t"                          /* INTR_ERR_SYSENTER */
+        "push $0x2e\n\t"                       /* INTR_SYSCALL */
+        "movl %esi, %edx\n\t"                  /* the argument goes in edx */
+        "xorl %esi, %esi\n\t"                  /* and a forked child's errno is 0 */
+        "pusha\n\t"
+        "push %ds\n\t"
+        "push %es\n\t"
+        "movl %ss, %edx\n\t"
+        "movl %edx, %ds\n\t"
+        "movl %edx, %es\n\t"
+        "sti\n\t"                              /* as through the trap gate */
+        "call __intr_handler\n\t"
+        "cli\n\t"
+        "pop %es\n\t"
+        "pop %ds\n\t"
+        "popa\n\t"
+        "add $8, %esp\n\t"
+        "pushl 8(%esp)\n\t"                    /* the eflags, less IF until */
+        "andl $0xfffffdff, (%esp)\n\t"         /* the sti just before sysexit */
+        "popf\n\t"
+        "movl (%esp), %edx\n\t"
+        "movl 12(%esp), %ecx\n\t"
+        "sti\n\t"
+        "sysexit\n"
+);
+
 typedef struct intr_desc {
         uint16_t baselo;
         uint16_t selector;
@@ -338,6 +387,24 @@ typedef struct intr_info {
 static intr_desc_t intr_table[MAX_INTERRUPTS];
 static intr_handler_t intr_handlers[MAX_INTERRUPTS];
 static int32_t intr_mappings[MAX_INTERRUPTS];
+static uint8_t intr_msi[MAX_INTERRUPTS];
+
+/* How often each interrupt is taken and how long its handler takes, in
+ * cycles */
+typedef struct intr_stats {
+        uint32_t is_count;
+        uint32_t is_min;
+        uint32_t is_max;
+        uint64_t is_total;
+} intr_stats_t;
+
+static intr_stats_t intr_stats[MAX_INTERRUPTS];
+
+/* How often, and for how long, interrupts are blocked with IPL_HIGH */
+static uint64_t intr_high_start;        /* 0 if not at IPL_HIGH */
+static uint32_t intr_high_count;
+static uint32_t intr_high_max;
+static uint64_t intr_high_total;
 
 intr_info_t intr_data = {
         .size = sizeof(intr_info_t),
@@ -369,21 +436,100 @@ int32_t intr_map(uint16_t irq, uint8_t intr)
         return oldirq;
 }
 
+int32_t intr_map_msi(uint8_t intr)
+{
+        int32_t irq = intr_mappings[intr];
+
+        KASSERT(INTR_SPURIOUS != intr);
+        if (0 <= irq)
+                apic_setmask(irq, 1);
+        intr_msi[intr] = 1;
+        return irq;
+}
+
+void intr_setipl(uint8_t ipl)
+{
+        uint8_t old = apic_getipl();
+        uint32_t cycles;
+
+        if (IPL_HIGH == ipl && IPL_HIGH != old) {
+                intr_high_start = cpuid_rdtsc();
+        } else if (IPL_HIGH != ipl && IPL_HIGH == old && 0 != intr_high_start) {
+                cycles = (uint32_t) (cpuid_rdtsc() - intr_high_start);
+                intr_high_start = 0;
+                intr_high_count++;
+                intr_high_total += cycles;
+                if (cycles > intr_high_max)
+                        intr_high_max = cycles;
+        }
+        apic_setipl(ipl);
+}
+
 static __attribute__((used)) void __intr_handler(regs_t regs)
 {
         intr_handler_t handler = intr_handlers[regs.r_intr];
+        intr_stats_t *stats = &intr_stats[regs.r_intr];
+        uint8_t ipl = intr_getipl();
+        uint64_t start;
+        uint32_t cycles;
+
         _intr_regs = &regs;
         if (NULL != handler) {
+                start = cpuid_rdtsc();
                 handler(&regs);
+                cycles = (uint32_t) (cpuid_rdtsc() - start);
+                if (0 == stats->is_count++ || cycles < stats->is_min)
+                        stats->is_min = cycles;
+                if (cycles > stats->is_max)
+                        stats->is_max = cycles;
+                stats->is_total += cycles;
         } else {
                 panic("Unhandled interrupt 0x%x\n", regs.r_intr);
         }
 
-        if (0 <= intr_mappings[regs.r_intr]) {
+        /* the local APIC timer, inter-processor interrupts and MSIs are
+         * not routed through the IOAPIC, but still need an EOI */
+        if (0 <= intr_mappings[regs.r_intr] || intr_msi[regs.r_intr]
+            || INTR_APICTIMER == regs.r_intr
+            || INTR_TLB_SHOOTDOWN == regs.r_intr) {
                 apic_eoi();
         }
 
         _intr_regs = NULL;
+
+        /* the bottom halves of this and any other interrupts */
+        softirq_run(ipl);
+
+#ifdef __UPREEMPT__
+        /* on the way back to userland, give up the processor if the
+         * timer said to; the kernel itself is never preempted */
+        if (3 == (regs.r_cs & 3)) {
+                sched_preempt();
+        }
+#endif
+}
+
+size_t intr_stats_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        intr_stats_t *stats;
+        int i;
+
+        iprintf(&buf, &size, "%-6s %10s %10s %10s %10s\n",
+                "vector", "count", "min", "avg", "max");
+        for (i = 0; i < MAX_INTERRUPTS; i++) {
+                stats = &intr_stats[i];
+                if (0 == stats->is_count)
+                        continue;
+                iprintf(&buf, &size, "0x%02x   %10u %10u %10u %10u\n", i,
+                        stats->is_count, stats->is_min,
+                        math_average(stats->is_total, stats->is_count),
+                        stats->is_max);
+        }
+        iprintf(&buf, &size, "IPL_HIGH %8u times, %10u cycles avg, %10u max\n",
+                intr_high_count, math_average(intr_high_total, intr_high_count),
+                intr_high_max);
+        return size;
 }
 
 static void __intr_divide_by_zero_handler(regs_t *regs)
@@ -423,6 +569,7 @@ static void __intr_set_entry(uint8_t isr, uint32_t addr, int seg, int flags)
 void intr_init()
 {
         int i;
+        uint32_t eax, edx;
         intr_info_t *data = &intr_data;
 
         /* initialize intr_data */
@@ -430,6 +577,7 @@ void intr_init()
         intr_data.base = (uint32_t) intr_table;
 
         memset(intr_handlers, 0, sizeof(intr_handlers));
+        memset(intr_msi, 0, sizeof(intr_msi));
         for (i = 0; i < MAX_INTERRUPTS; ++i) {
                 intr_mappings[i] = -1;
         }
@@ -696,6 +844,17 @@ void intr_init()
         __intr_set_entry(255, (uint32_t)&INTR(255), GDT_KERNEL_TEXT, IDT_DESC_PRESENT | IDT_DESC_BIT32 | IDT_DESC_RING0);
         __asm__("lidt (%0)" :: "p"(data));
 
+        /* The SYSENTER MSRs, if there are any. The first Pentium Pros
+         * claimed SEP even though they could not do it */
+        cpuid(CPUID_GETFEATURES, &eax, &edx);
+        if ((edx & CPUID_FEAT_EDX_SEP)
+            && !(0x600 == (eax & 0xf00) && (eax & 0xff) < 0x33)) {
+                cpuid_set_msr(MSR_SYSENTER_CS, GDT_KERNEL_TEXT, 0);
+                cpuid_set_msr(MSR_SYSENTER_EIP, (uint32_t)&__intr_sysenter, 0);
+                gdt_enable_sysenter();
+                dbg(DBG_INTR, "using sysenter for syscalls\n");
+        }
+
         apic_setspur(INTR_SPURIOUS);
 
         intr_register(INTR_SPURIOUS, __intr_spurious);
@@ -703,3 +862,10 @@ void intr_init()
         intr_register(INTR_GPF, __intr_gpf_handler);
         intr_register(INTR_INVALID_OPCODE, __intr_inval_opcode_handler);
 }
+
+void intr_init_ap()
+{
+        intr_info_t *data = &intr_data;
+
+        __asm__("lidt (%0)" :: "p"(data));
+}
@@ -17,31 +17,42 @@
 #include "vm/shadowd.h"
 #include "vm/shadow.h"
 #include "vm/anon.h"
+#include "vm/ksm.h"
+#include "vm/swap.h"
 
 #include "main/acpi.h"
 #include "main/apic.h"
 #include "main/interrupt.h"
 #include "main/gdt.h"
+#include "main/smp.h"
 
 #include "proc/sched.h"
 #include "proc/proc.h"
 #include "proc/kthread.h"
+#include "proc/workq.h"
 
 #include "drivers/dev.h"
 #include "drivers/blockdev.h"
 #include "drivers/disk/ata.h"
+#include "drivers/disk/blkqueue.h"
+#include "drivers/bytedev.h"
+#include "drivers/tty/tty.h"
 #include "drivers/tty/virtterm.h"
 #include "drivers/pci.h"
 
 #include "api/exec.h"
 #include "api/syscall.h"
 
+#include "fs/aio.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
 #include "fs/vfs_syscall.h"
 #include "fs/fcntl.h"
 #include "fs/stat.h"
+#include "fs/warmboot.h"
+#include "fs/s5fs/s5fs.h"
 #include "test/kshell/kshell.h"
+#include "test/vfstest/main.h"
 
 GDB_DEFINE_HOOK(boot)
 GDB_DEFINE_HOOK(initialized)
@@ -83,6 +94,7 @@ kmain()
         intr_init();
 
         gdt_init();
+        smp_init();
 
         /* initialize slab allocators */
 #ifdef __VM__
@@ -167,6 +179,11 @@ idleproc_run(int arg1, void *arg2)
         init_call_all();
         GDB_CALL_HOOK(initialized);
 
+#ifdef __VM__
+        /* once the disks are there, before anything is paged out */
+        swap_init();
+#endif
+
         /* Create other kernel threads (in order) */
         /* PROCS BLANK {{{ */
 #ifdef __SHADOWD__
@@ -194,6 +211,10 @@ idleproc_run(int arg1, void *arg2)
         /* PROCS BLANK {{{ */
         int fd, ii;
         char path[32];
+#ifdef __S5FS__
+        blockdev_t *bd;
+        s5_super_t *super;
+#endif
 
         struct stat statbuf;
         if (do_stat("/dev", &statbuf) < 0) {
@@ -209,6 +230,26 @@ idleproc_run(int arg1, void *arg2)
         } else {
                 do_close(fd);
         }
+        if ((fd = do_open("/dev/slabinfo", O_RDONLY)) < 0) {
+                KASSERT(!(status = do_mknod("/dev/slabinfo", S_IFCHR, MEM_SLABINFO_DEVID)));
+        } else {
+                do_close(fd);
+        }
+        if ((fd = do_open("/dev/interrupts", O_RDONLY)) < 0) {
+                KASSERT(!(status = do_mknod("/dev/interrupts", S_IFCHR, MEM_INTRINFO_DEVID)));
+        } else {
+                do_close(fd);
+        }
+        if ((fd = do_open("/dev/sysstat", O_RDONLY)) < 0) {
+                KASSERT(!(status = do_mknod("/dev/sysstat", S_IFCHR, MEM_SYSSTAT_DEVID)));
+        } else {
+                do_close(fd);
+        }
+        if ((fd = do_open("/dev/trace", O_RDONLY)) < 0) {
+                KASSERT(!(status = do_mknod("/dev/trace", S_IFCHR, MEM_TRACE_DEVID)));
+        } else {
+                do_close(fd);
+        }
 
         memset(path, '\0', 32);
         for (ii = 0; ii < __NTERMS__; ii++) {
@@ -220,6 +261,15 @@ idleproc_run(int arg1, void *arg2)
                         do_close(fd);
                 }
         }
+        /* the serial tty follows the virtual terminals, if there is a UART */
+        if (NULL != bytedev_lookup(MKDEVID(TTY_MAJOR, vt_num_terminals()))) {
+                if ((fd = do_open("/dev/ttyS0", O_RDONLY)) < 0) {
+                        KASSERT(!do_mknod("/dev/ttyS0", S_IFCHR,
+                                          MKDEVID(TTY_MAJOR, vt_num_terminals())));
+                } else {
+                        do_close(fd);
+                }
+        }
 
         for (ii = 0; ii < __NDISKS__; ii++) {
                 sprintf(path, "/dev/hda%d", ii);
@@ -230,7 +280,41 @@ idleproc_run(int arg1, void *arg2)
                         do_close(fd);
                 }
         }
+#ifdef __S5FS__
+        /* the ram disk starts out blank, so it is given a file system to
+         * be mounted as "ram0" */
+        if (NULL != (bd = blockdev_lookup(MKDEVID(RAMDISK_MAJOR, 0)))) {
+                if ((fd = do_open("/dev/ram0", O_RDONLY)) < 0) {
+                        KASSERT(!do_mknod("/dev/ram0", S_IFBLK, MKDEVID(RAMDISK_MAJOR, 0)));
+                } else {
+                        do_close(fd);
+                }
+                if (0 > s5fs_format(bd, __RAMDISK_PAGES__, MAX(1, __RAMDISK_PAGES__ / 8)))
+                        dbg(DBG_INIT, "Could not make a file system on the ram disk\n");
+        }
+        /* and so may the striped disk the first time, mounted as "md0" */
+        if (NULL != (bd = blockdev_lookup(MKDEVID(STRIPE_MAJOR, 0)))) {
+                if ((fd = do_open("/dev/md0", O_RDONLY)) < 0) {
+                        KASSERT(!do_mknod("/dev/md0", S_IFBLK, MKDEVID(STRIPE_MAJOR, 0)));
+                } else {
+                        do_close(fd);
+                }
+                super = page_alloc();
+                KASSERT(NULL != super);
+                if (0 > blk_rw(bd, BLK_READ, (char *) super, S5_SUPER_BLOCK, 1)
+                    || (S5_MAGIC != super->s5s_magic
+                        && 0 > s5fs_format(bd, __STRIPE_DISKS__ * __STRIPE_MEMBER_BLOCKS__,
+                                           __STRIPE_DISKS__ * __STRIPE_MEMBER_BLOCKS__ / 8)))
+                        dbg(DBG_INIT, "Could not make a file system on the striped disk\n");
+                page_free(super);
+        }
+#endif
         /* PROCS BLANK }}} */
+
+#ifdef __S5FS__
+        /* read back what was in the page cache at the last shutdown */
+        warmboot_start();
+#endif
 #endif
 
         /* Finally, enable interrupts (we want to make sure interrupts
@@ -249,11 +333,29 @@ idleproc_run(int arg1, void *arg2)
 
 
 #ifdef __SHADOWD__
-        /* wait for shadowd to shutdown */
+        /* stop shadowd being run */
         shadowd_shutdown();
 #endif
+#ifdef __KSM__
+        ksm_shutdown();
+#endif
+
+        /* finish the aio being done, with the files it holds, and stop
+         * the workers */
+        aio_shutdown();
+
+        /* run whatever work is left and stop the workers */
+        workq_shutdown();
+
+        pagezerod_shutdown();
+        pframe_pflushd_shutdown();
 
 #ifdef __VFS__
+#ifdef __S5FS__
+        /* for the next boot to read back in: */
+        warmboot_save();
+#endif
+
         /* Shutdown the vfs: */
         dbg_print("weenix: vfs shutdown...\n");
         vput(curproc->p_cwd);
@@ -267,6 +369,9 @@ idleproc_run(int arg1, void *arg2)
         pframe_shutdown();
 #endif
 
+        /* Everything has been written back, stop the disk queues */
+        blkqueue_shutdown();
+
         dbg_print("\nweenix: halted cleanly!\n");
         GDB_CALL_HOOK(shutdown);
         hard_shutdown();
@@ -367,5 +472,7 @@ hard_shutdown()
 #ifdef __DRIVERS__
         vt_print_shutdown();
 #endif
+        /* the serial interrupt will not come again to send the rest */
+        dbg_flush();
         __asm__ volatile("cli; hlt");
 }
@@ -1,33 +1,51 @@
 #include "globals.h"
 
 #include "main/io.h"
-#include "main/interrupt.h"
-#include "util/delay.h"
-#include "main/apic.h"
+#include "main/pit.h"
 
-#include "proc/sched.h"
-#include "proc/kthread.h"
+#include "util/debug.h"
 
-#define APIC_TIMER_IRQ 32 /* Map interrupt 32 */
-
-/* IRQ */
-/*#define PIT_IRQ 0*/
+/*
+ * The PIT is only used as a reference clock, to find out how fast the
+ * local APIC timer (which delivers the clock interrupts) counts. Its
+ * channel 2 can count down once with its output readable through the
+ * keyboard controller's port B, so it can be timed without interrupts.
+ */
 
 /* I/O ports */
-/*#define PIT_DATA0 0x40
-#define PIT_DATA1 0x41
-#define PIT_DATA2 0x42
-#define PIT_CMD   0x43
+#define PIT_DATA2       0x42
+#define PIT_CMD         0x43
+#define PIT_PORTB       0x61            /* channel 2 gate and output */
+
+#define PIT_PORTB_GATE2 0x01
+#define PIT_PORTB_SPKR  0x02
+#define PIT_PORTB_OUT2  0x20
+
+/* channel 2, low then high byte, mode 1 (hardware one-shot), binary */
+#define PIT_CMD_ONESHOT2 0xb2
+
+#define CLOCK_TICK_RATE 1193182         /* Hz */
+
+void pit_oneshot_start(uint32_t usecs)
+{
+        /* usecs * CLOCK_TICK_RATE / 1000000, in 32 bits */
+        uint32_t count = usecs * (CLOCK_TICK_RATE / 1000) / 1000;
+        uint8_t portb;
 
-#define CLOCK_TICK_RATE 1193182
-#undef HZ
-#define HZ 1000
+        KASSERT(0 < count && count <= 0xffff);
 
-#define LATCH (CLOCK_TICK_RATE / HZ)*/
-static unsigned int ms = 0;
+        /* gate off, speaker off, while the count is loaded */
+        portb = inb(PIT_PORTB) & ~(PIT_PORTB_GATE2 | PIT_PORTB_SPKR);
+        outb(PIT_PORTB, portb);
+        outb(PIT_CMD, PIT_CMD_ONESHOT2);
+        outb(PIT_DATA2, count & 0xff);
+        outb(PIT_DATA2, (count >> 8) & 0xff);
 
-void pit_handler(regs_t* regs) {
+        /* a rising edge on the gate starts the count */
+        outb(PIT_PORTB, portb | PIT_PORTB_GATE2);
 }
 
-void pit_init(uint8_t intr) {
+int pit_oneshot_done(void)
+{
+        return 0 != (inb(PIT_PORTB) & PIT_PORTB_OUT2);
 }
@@ -0,0 +1,150 @@
+#include "types.h"
+#include "kernel.h"
+
+#include "boot/config.h"
+
+#include "main/apic.h"
+#include "main/gdt.h"
+#include "main/interrupt.h"
+#include "main/pit.h"
+#include "main/smp.h"
+
+#include "mm/page.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+
+/* How long to wait for a processor to start, in waits short enough for
+ * the PIT to count */
+#define SMP_START_WAIT_USECS    10000
+#define SMP_START_WAITS         20
+
+/* Filled in for each processor before it is started; the layout is
+ * known to boot/smpboot.S */
+struct smp_trampoline_args {
+        uint32_t sa_cr0;
+        uint32_t sa_cr3;
+        uint32_t sa_cr4;
+        uint32_t sa_esp;
+        uint32_t sa_entry;
+};
+
+extern char smp_trampoline[];
+extern char smp_trampoline_args[];
+extern char smp_trampoline_end[];
+
+typedef struct smp_cpu {
+        uint8_t          sc_apicid;
+        void            *sc_stack;      /* the page it runs on */
+        volatile int     sc_online;     /* set by the processor itself */
+} smp_cpu_t;
+
+static smp_cpu_t smp_cpus[APIC_MAX_CPUS];
+static uint32_t smp_nstarted = 1;
+/* The processor being started, which smp_ap_main looks itself up by */
+static volatile uint32_t smp_starting;
+
+/*
+ * Where a started processor goes from the trampoline, on its own stack
+ * with paging on. It parks itself halted with interrupts off; no
+ * interrupt is routed to it, so it stays there.
+ */
+static void
+smp_ap_main(void)
+{
+        smp_cpu_t *sc = &smp_cpus[smp_starting];
+
+        gdt_init_ap(smp_starting, (char *)sc->sc_stack + PAGE_SIZE);
+        intr_init_ap();
+        apic_ap_init();
+        apic_setipl(IPL_HIGH);
+        KASSERT(apic_current_id() == sc->sc_apicid);
+
+        sc->sc_online = 1;
+        while (1)
+                __asm__ volatile("cli\n\thlt");
+}
+
+void
+smp_init(void)
+{
+        struct smp_trampoline_args *args;
+        uint32_t cpu, i;
+
+        smp_cpus[0].sc_apicid = apic_current_id();
+        smp_cpus[0].sc_online = 1;
+        if (1 == apic_ncpus())
+                return;
+
+        KASSERT(smp_trampoline_end - smp_trampoline <= (int)PAGE_SIZE);
+        memcpy((void *)SMP_TRAMPOLINE_PADDR, smp_trampoline,
+               smp_trampoline_end - smp_trampoline);
+        args = (struct smp_trampoline_args *)(SMP_TRAMPOLINE_PADDR
+                                               + (smp_trampoline_args - smp_trampoline));
+
+        /* every processor gets the paging this one has now, the kernel's
+         * page directory with the first 4mb still identity mapped */
+        __asm__ volatile("movl %%cr0, %0" : "=r"(args->sa_cr0));
+        __asm__ volatile("movl %%cr3, %0" : "=r"(args->sa_cr3));
+        __asm__ volatile("movl %%cr4, %0" : "=r"(args->sa_cr4));
+        args->sa_entry = (uint32_t)smp_ap_main;
+
+        for (cpu = 1; cpu < apic_ncpus(); cpu++) {
+                smp_cpu_t *sc = &smp_cpus[cpu];
+
+                sc->sc_apicid = apic_cpu_id(cpu);
+                if (NULL == (sc->sc_stack = page_alloc()))
+                        panic("Not enough memory to start processor %u\n", cpu);
+                args->sa_esp = (uint32_t)sc->sc_stack + PAGE_SIZE;
+                smp_starting = cpu;
+
+                apic_start_ap(sc->sc_apicid, SMP_TRAMPOLINE_PADDR);
+                for (i = 0; i < SMP_START_WAITS && !sc->sc_online; i++) {
+                        pit_oneshot_start(SMP_START_WAIT_USECS);
+                        while (!pit_oneshot_done() && !sc->sc_online);
+                }
+                if (!sc->sc_online) {
+                        /* it may yet start, on this stack, so the stack
+                         * is not given back; and no other processor can
+                         * be started while it might */
+                        dbg(DBG_CORE, "processor %u (local APIC 0x%.2x) did not start\n",
+                            cpu, sc->sc_apicid);
+                        break;
+                }
+                smp_nstarted++;
+                dbg(DBG_CORE, "started processor %u (local APIC 0x%.2x)\n",
+                    cpu, sc->sc_apicid);
+        }
+        dbgq(DBG_CORE, "%u of %u processors running\n", smp_nstarted, apic_ncpus());
+}
+
+uint32_t
+smp_ncpus(void)
+{
+        return smp_nstarted;
+}
+
+uint32_t
+smp_cpu(void)
+{
+        uint8_t apicid;
+        uint32_t cpu;
+
+        /* before any other processor starts (and before the local APIC
+         * is even mapped) it can only be the one which booted */
+        if (1 == smp_nstarted)
+                return 0;
+        apicid = apic_current_id();
+        for (cpu = 0; cpu < smp_nstarted; cpu++)
+                if (apicid == smp_cpus[cpu].sc_apicid)
+                        return cpu;
+        panic("local APIC 0x%.2x is not a started processor\n", apicid);
+        return 0;
+}
+
+uint8_t
+smp_cpu_apicid(uint32_t cpu)
+{
+        KASSERT(cpu < smp_nstarted);
+        return smp_cpus[cpu].sc_apicid;
+}
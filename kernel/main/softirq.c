@@ -0,0 +1,81 @@
+#include "types.h"
+
+#include "main/interrupt.h"
+#include "main/softirq.h"
+
+#include "proc/workq.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+
+static void softirq_work_run(void *arg);
+
+static list_t softirq_pending = { &softirq_pending, &softirq_pending };
+static int softirq_running;     /* so that nested interrupts leave them */
+
+/* for softirqs put off to the work queue */
+static work_t softirq_work = { { NULL, NULL }, softirq_work_run, NULL };
+
+void
+softirq_init(softirq_t *si, softirq_func_t func, void *arg)
+{
+        list_link_init(&si->si_link);
+        si->si_func = func;
+        si->si_arg = arg;
+}
+
+void
+softirq_raise(softirq_t *si)
+{
+        uint8_t oldipl = intr_getipl();
+
+        KASSERT(NULL != si->si_func);
+        intr_setipl(IPL_HIGH);
+        if (!list_link_is_linked(&si->si_link))
+                list_insert_tail(&softirq_pending, &si->si_link);
+        intr_setipl(oldipl);
+}
+
+/* Runs raised softirqs until there are none, at IPL_LOW, with interrupts
+ * enabled. They may be raised again meanwhile */
+static void
+softirq_run_all(void)
+{
+        softirq_t *si;
+
+        softirq_running = 1;
+        intr_setipl(IPL_HIGH);
+        intr_enable();
+        while (!list_empty(&softirq_pending)) {
+                si = list_head(&softirq_pending, softirq_t, si_link);
+                list_remove(&si->si_link);
+                intr_setipl(IPL_LOW);
+                si->si_func(si->si_arg);
+                intr_setipl(IPL_HIGH);
+        }
+        softirq_running = 0;
+}
+
+static void
+softirq_work_run(void *arg)
+{
+        uint8_t oldipl = intr_getipl();
+
+        if (!softirq_running)
+                softirq_run_all();
+        intr_setipl(oldipl);
+}
+
+void
+softirq_run(uint8_t ipl)
+{
+        if (softirq_running || list_empty(&softirq_pending))
+                return;
+        if (IPL_LOW == ipl) {
+                softirq_run_all();
+                intr_disable();
+                intr_setipl(ipl);
+        } else {
+                work_queue(&softirq_work);
+        }
+}
@@ -0,0 +1,54 @@
+#include "types.h"
+#include "kernel.h"
+
+#include "mm/highmem.h"
+#include "mm/page.h"
+
+#include "util/debug.h"
+
+/* The memory map has few entries, so neither does this */
+#define HIGHMEM_MAX_RANGES      8
+
+typedef struct highmem_range {
+        uintptr_t       hr_base;        /* physical, page aligned */
+        uint32_t        hr_npages;
+} highmem_range_t;
+
+static highmem_range_t highmem_ranges[HIGHMEM_MAX_RANGES];
+static int highmem_nranges = 0;
+static uint32_t highmem_total = 0;
+
+void
+highmem_add_range(uintptr_t start, uintptr_t end)
+{
+        start = (uintptr_t) PAGE_ALIGN_UP(start);
+        end = (uintptr_t) PAGE_ALIGN_DOWN(end);
+        if (start >= end)
+                return;
+        if (HIGHMEM_MAX_RANGES == highmem_nranges) {
+                dbgq(DBG_MM, "Ignoring high memory 0x%08x-0x%08x\n", start, end);
+                return;
+        }
+        highmem_ranges[highmem_nranges].hr_base = start;
+        highmem_ranges[highmem_nranges].hr_npages = (end - start) >> PAGE_SHIFT;
+        highmem_nranges++;
+        highmem_total += (end - start) >> PAGE_SHIFT;
+        dbgq(DBG_MM, "High memory: 0x%08x-0x%08x\n", start, end);
+}
+
+uint32_t
+highmem_npages(void)
+{
+        return highmem_total;
+}
+
+uintptr_t
+highmem_page(uint32_t n)
+{
+        int i;
+
+        KASSERT(n < highmem_total);
+        for (i = 0; n >= highmem_ranges[i].hr_npages; i++)
+                n -= highmem_ranges[i].hr_npages;
+        return highmem_ranges[i].hr_base + (n << PAGE_SHIFT);
+}
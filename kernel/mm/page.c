@@ -1,38 +1,163 @@
 #include "types.h"
 #include "kernel.h"
+#include "globals.h"
+
+#include "main/apic.h"
+#include "main/smp.h"
 
 #include "mm/mm.h"
 #include "mm/page.h"
+#include "mm/pframe.h"
 #include "mm/slab.h"
 
+#include "api/trace.h"
+
 #include "util/gdb.h"
 #include "util/bits.h"
 #include "util/list.h"
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/printf.h"
 
 #include "vm/shadowd.h"
 
 #include "proc/sched.h"
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/spinlock.h"
+
+#include "util/init.h"
 
 GDB_DEFINE_HOOK(page_alloc, void *addr, int npages)
 GDB_DEFINE_HOOK(page_free, void *addr, int npages)
 
+/* page_lock covers the buddy freelists and bitmaps, and the counts of
+ * what is on them; pagegroup_table and the groups' bounds do not change
+ * once the memory is added */
+static spinlock_t page_lock;
 static list_t pagegroup_list;
 static uintptr_t page_freecount;
 
+/* page_nfree[order] is the number of free blocks of 2^order pages, and
+ * pagegroup_avail[order] lists the groups which have at least one of
+ * them, so finding a block of a given order never has to look at groups
+ * which cannot satisfy it */
+static uint32_t page_nfree[PAGE_NSIZES];
+static list_t pagegroup_avail[PAGE_NSIZES];
+
 struct pagegroup {
         list_t       pg_freelist[PAGE_NSIZES];
         void        *pg_map[PAGE_NSIZES];
         uintptr_t    pg_baseaddr;
         uintptr_t    pg_endaddr;
         list_link_t  pg_link;
+        list_link_t  pg_alink[PAGE_NSIZES]; /* link on pagegroup_avail */
 };
 
+/* Maps each PAGEGROUP_CHUNK_SHIFT-sized chunk of the address space to the
+ * pagegroup which manages it. A chunk which is split between more than
+ * one group is marked PAGEGROUP_SHARED, and addresses in it fall back to
+ * searching pagegroup_list. */
+#define PAGEGROUP_CHUNK_SHIFT 22
+#define PAGEGROUP_NCHUNKS     (1 << (32 - PAGEGROUP_CHUNK_SHIFT))
+#define PAGEGROUP_SHARED      ((struct pagegroup *) 1)
+static struct pagegroup *pagegroup_table[PAGEGROUP_NCHUNKS];
+
 struct freepage {
         list_link_t fp_link;
 };
 
+/* Pages which pagezerod has already cleared, linked through their first
+ * bytes (which page_alloc_zeroed clears again). They count as allocated */
+#define PAGE_ZERO_TARGET      32      /* pagezerod fills the pool to this */
+#define PAGE_ZERO_LOW         8       /* and is woken below this */
+#define PAGE_ZERO_MIN_FREE    256     /* unless fewer pages than this are free */
+
+static spinlock_t page_zero_lock;
+static list_t page_zero_pool;
+static uint32_t page_nzero;
+static uint32_t page_nzero_hits;
+static uint32_t page_nzero_misses;
+
+/* Kernel stacks which threads have given back, kept whole so that the
+ * next kthread_create does not have to split and poison a block of 16
+ * pages (kthread allocates its stacks DEFAULT_STACK_SIZE plus a page at
+ * a time). They count as allocated, and go back to the allocator when
+ * memory is short */
+#define PAGE_STACK_NPAGES     (DEFAULT_STACK_SIZE / PAGE_SIZE + 1)
+#define PAGE_STACK_CACHE      8
+
+static spinlock_t page_stack_lock;
+static list_t page_stack_cache;
+static uint32_t page_nstack;
+
+/* Each processor's cache of free single pages, so that most page_allocs
+ * and page_frees do not take page_lock: a cache which runs dry takes
+ * PAGE_PCPU_BATCH pages from the buddy lists at once, and one which grows
+ * past PAGE_PCPU_HIGH gives the coldest PAGE_PCPU_BATCH of them back.
+ * They count as free. Only its own processor touches a cache, and
+ * page_alloc and page_free never block and are not called by interrupt
+ * handlers, so a cache needs no lock */
+#define PAGE_PCPU_BATCH       16
+#define PAGE_PCPU_HIGH        64
+
+struct page_pcpu {
+        list_t       pp_pages;       /* most recently freed first */
+        uint32_t     pp_count;
+        uint32_t     pp_nrefills;
+        uint32_t     pp_ndrains;
+};
+
+static struct page_pcpu page_pcpu[APIC_MAX_CPUS];
+
+static proc_t *pagezerod;
+static kthread_t *pagezerod_thr;
+static ktqueue_t pagezerod_waitq;
+
+/* Compaction makes a free block of a high order, when there are enough
+ * free pages but not together, by moving the page cache's pages out of a
+ * block which is partly free (see _page_compact). While that is done the
+ * block's free pages, and those freed in it, are held in
+ * page_compact_held instead of going back on the buddy lists, so that
+ * nothing is allocated from the block before all of it is free. The
+ * range is empty (start == end) when nothing is being compacted. Covered
+ * by page_lock. */
+#define PAGE_COMPACT_TRIES    8       /* blocks tried for one allocation */
+#define PAGE_COMPACT_NPAGES   (1 << (PAGE_NSIZES - 1))
+
+static uintptr_t page_compact_start;
+static uintptr_t page_compact_end;
+static uint32_t page_compact_held[BITMAP_WORDS(PAGE_COMPACT_NPAGES)];
+static uint32_t page_compact_nheld;
+static uint32_t page_ncompacted;
+static uint32_t page_ncompact_failed;
+
+#define _page_compacting(addr) \
+        ((uintptr_t)(addr) - page_compact_start < page_compact_end - page_compact_start)
+
+static void page_zero_drain(void);
+static void page_stack_drain(void);
+static void _page_pcpu_drain(struct page_pcpu *pp, uint32_t npages);
+static int _page_compact(uint32_t order);
+
+static void
+_freelist_insert(struct pagegroup *group, uint32_t order, uintptr_t addr)
+{
+        if (list_empty(&group->pg_freelist[order]))
+                list_insert_tail(&pagegroup_avail[order], &group->pg_alink[order]);
+        list_insert_head(&group->pg_freelist[order], &((struct freepage *)addr)->fp_link);
+        page_nfree[order]++;
+}
+
+static void
+_freelist_remove(struct pagegroup *group, uint32_t order, uintptr_t addr)
+{
+        list_remove(&((struct freepage *)addr)->fp_link);
+        page_nfree[order]--;
+        if (list_empty(&group->pg_freelist[order]))
+                list_remove(&group->pg_alink[order]);
+}
+
 static struct pagegroup *
 _pagegroup_create(uintptr_t start, uintptr_t end)
 {
@@ -65,25 +190,30 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
         /* discard the remainder of the page being used for
          * mappings and read just npages */
         end = (uintptr_t)PAGE_ALIGN_DOWN(end);
+        if (end < start)
+                end = start;
         npages = (end - start) >> PAGE_SHIFT;
         group->pg_endaddr = end;
 
+        for (order = 0; order < PAGE_NSIZES; ++order) {
+                list_init(&group->pg_freelist[order]);
+                list_link_init(&group->pg_alink[order]);
+        }
+
         /* put pages which do not fit nicely into the largest
          * order and add them to smaller buckets */
         for (order = 0; order < PAGE_NSIZES - 1; ++order) {
-                list_init(&group->pg_freelist[order]);
                 if (npages & (1 << order)) {
                         end -= (1 << order) << PAGE_SHIFT;
-                        list_insert_head(&group->pg_freelist[order], &((struct freepage *)end)->fp_link);
+                        _freelist_insert(group, order, end);
                 }
         }
 
         /* put the remaining pages into the largest bucket */
         KASSERT(0 == (end - start) % (1 << order));
-        list_init(&group->pg_freelist[order]);
         uintptr_t current = start;
         while (current < end) {
-                list_insert_head(&group->pg_freelist[order], &((struct freepage *)current)->fp_link);
+                _freelist_insert(group, order, current);
                 current += (1 << order) << PAGE_SHIFT;
         }
 
@@ -93,7 +223,14 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
 static struct pagegroup *
 _pagegroup_from_address(uintptr_t addr)
 {
-        struct pagegroup *group;
+        struct pagegroup *group = pagegroup_table[addr >> PAGEGROUP_CHUNK_SHIFT];
+
+        if (likely(PAGEGROUP_SHARED != group)) {
+                if (NULL != group && addr >= group->pg_baseaddr && addr < group->pg_endaddr)
+                        return group;
+                return NULL;
+        }
+
         list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
                 if (addr >= group->pg_baseaddr && addr < group->pg_endaddr)
                         return group;
@@ -101,11 +238,47 @@ _pagegroup_from_address(uintptr_t addr)
         return NULL;
 }
 
+static void
+_pagegroup_table_add(struct pagegroup *group)
+{
+        uintptr_t chunk = group->pg_baseaddr >> PAGEGROUP_CHUNK_SHIFT;
+        uintptr_t last = (group->pg_endaddr - 1) >> PAGEGROUP_CHUNK_SHIFT;
+
+        for (; chunk <= last; ++chunk) {
+                if (NULL == pagegroup_table[chunk])
+                        pagegroup_table[chunk] = group;
+                else
+                        pagegroup_table[chunk] = PAGEGROUP_SHARED;
+        }
+}
+
 void
 page_init()
 {
+        int order;
+
+        spinlock_init(&page_lock, "page");
+        spinlock_init(&page_zero_lock, "page zero pool");
+        spinlock_init(&page_stack_lock, "page stacks");
+
         list_init(&pagegroup_list);
         page_freecount = 0;
+        for (order = 0; order < PAGE_NSIZES; ++order) {
+                list_init(&pagegroup_avail[order]);
+                page_nfree[order] = 0;
+        }
+        memset(pagegroup_table, 0, sizeof(pagegroup_table));
+
+        list_init(&page_zero_pool);
+        page_nzero = 0;
+        list_init(&page_stack_cache);
+        page_nstack = 0;
+        for (order = 0; order < APIC_MAX_CPUS; ++order) {
+                list_init(&page_pcpu[order].pp_pages);
+                page_pcpu[order].pp_count = 0;
+                page_pcpu[order].pp_nrefills = 0;
+                page_pcpu[order].pp_ndrains = 0;
+        }
 }
 
 void
@@ -119,8 +292,11 @@ page_add_range(uintptr_t start, uintptr_t end)
 
         struct pagegroup *group = _pagegroup_create(start, end);
         if (group->pg_baseaddr < group->pg_endaddr) {
+                spin_lock(&page_lock);
                 list_insert_tail(&pagegroup_list, &group->pg_link);
+                _pagegroup_table_add(group);
                 page_freecount += ADDR_TO_PN(group->pg_endaddr - group->pg_baseaddr);
+                spin_unlock(&page_lock);
         }
 }
 
@@ -158,7 +334,7 @@ __page_split(struct pagegroup *group, uint32_t order)
         KASSERT(PAGE_SIZE >= sizeof(uintptr_t));
 
         uintptr_t target = (uintptr_t)list_head(&group->pg_freelist[order], struct freepage, fp_link);
-        list_remove_head(&group->pg_freelist[order]);
+        _freelist_remove(group, order, target);
 
         /* splitting the page requires marking it as allocated */
         if (likely(order < PAGE_NSIZES - 1)) {
@@ -169,8 +345,8 @@ __page_split(struct pagegroup *group, uint32_t order)
         KASSERT(!bit_check(group->pg_map[order], _pagegroup_calculate_index(group, order, target)));
 
         uintptr_t buddy = (target + ((1 << (order - 1)) << PAGE_SHIFT));
-        list_insert_head(&group->pg_freelist[order - 1], &((struct freepage *)target)->fp_link);
-        list_insert_head(&group->pg_freelist[order - 1], &((struct freepage *)buddy)->fp_link);
+        _freelist_insert(group, order - 1, target);
+        _freelist_insert(group, order - 1, buddy);
         dbg(DBG_PAGEALLOC, "split 0x%.8x (%u) into 0x%.8x and 0x%.8x\n", target, order, target, buddy);
 }
 
@@ -181,35 +357,63 @@ __page_split(struct pagegroup *group, uint32_t order)
  * 16k block.
  *
  * @param order the order of the block to split into.
+ * @param reclaim whether to try to free memory if there is none to split
  * @return the group where the split took place on success, NULL otherwise
+ *
+ * Called, and returns, with page_lock held, but drops it to reclaim
+ * memory when there is none to split.
  */
+/* Splits the first free block of at least the given order down to it,
+ * returning its group, or NULL if there is none */
+static struct pagegroup *
+__page_split_first(int order)
+{
+        struct pagegroup *group;
+        int norder;
+
+        for (norder = order; norder < PAGE_NSIZES; norder++) {
+                if (0 == page_nfree[norder])
+                        continue;
+                group = list_head(&pagegroup_avail[norder], struct pagegroup, pg_alink[norder]);
+                while (norder > order) {
+                        __page_split(group, norder);
+                        --norder;
+                }
+                KASSERT(!list_empty(&group->pg_freelist[order]));
+                return group;
+        }
+        return NULL;
+}
+
 static struct pagegroup *
-_page_split(int order)
+_page_split(int order, int reclaim)
 {
 #ifdef __SHADOWD__
         uint32_t num_retrys = 2;
 #else
         uint32_t num_retrys = 0;
 #endif
-        int norder;
+        struct pagegroup *group;
 
         do {
-                /* Find the first free block of greater size than requested. */
-                for (norder = order + 1; norder < PAGE_NSIZES; norder++) {
-                        struct pagegroup *group;
-                        list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
-                                if (!list_empty(&group->pg_freelist[norder])) {
-                                        while (norder > order) {
-                                                __page_split(group, norder);
-                                                --norder;
-                                        }
-                                        KASSERT(!list_empty(&group->pg_freelist[order]));
-                                        return group;
-                                }
-                        } list_iterate_end();
-                }
+                /* Find the first free block of greater size than
+                 * requested, or of the size itself once memory has
+                 * been reclaimed. */
+                if (NULL != (group = __page_split_first(order)))
+                        return group;
 
+                if (!reclaim)
+                        return NULL;
                 dbg(DBG_PAGEALLOC, "WARNING, cannot allocate order=%u\n", order);
+
+                /* If the pages are free but scattered, gathering them
+                 * costs less than reclaiming more */
+                if (0 < order && (uintptr_t)(1 << order) <= page_freecount
+                    && _page_compact(order)
+                    && NULL != (group = __page_split_first(order)))
+                        return group;
+
+                spin_unlock(&page_lock);
                 /* We have run out of kernel memory. Lets try and collapse some
                    shadow trees, and then retry */
 #ifdef __SHADOWD__
@@ -217,8 +421,12 @@ _page_split(int order)
                 shadowd_wakeup();
                 shadowd_alloc_sleep();
 #endif
+                page_zero_drain();
+                page_stack_drain();
+                _page_pcpu_drain(&page_pcpu[smp_cpu()], PAGE_PCPU_HIGH + 1);
                 int num_freed = slab_allocators_reclaim(0);
                 dbg(DBG_MM, "reclaimed %d pages from slab allocator.\n", num_freed);
+                spin_lock(&page_lock);
         } while (num_retrys-- > 0);
 
         /* We are out of memory, and not even the shadow deamon could free some */
@@ -226,34 +434,83 @@ _page_split(int order)
 }
 
 /**
- * Allocate a block of at least 2^order pages. Fills the block with the
- * MM_POISON_ALLOC pattern.
+ * Takes a block of 2^order pages off the buddy lists, with page_lock
+ * held (which _page_split may drop to reclaim, if reclaim is set).
  *
  * @param order the order of the block size desired
- * @return the address of the free memory or null if no memory could be allocated
+ * @param reclaim whether to try to free memory if there is none
+ * @return the address of the block or 0 if there is none
  */
-static void *
-_page_alloc_order(uint32_t order)
+static uintptr_t
+__page_alloc_locked(uint32_t order, int reclaim)
 {
         uintptr_t addr;
         struct pagegroup *group;
 
-        list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
-                if (!list_empty(&group->pg_freelist[order]))
-                        goto found;
-        } list_iterate_end();
-
-        if (NULL != (group = _page_split(order))) {
+        if (0 != page_nfree[order]) {
+                group = list_head(&pagegroup_avail[order], struct pagegroup, pg_alink[order]);
+        } else if (NULL != (group = _page_split(order, reclaim))) {
                 KASSERT(!list_empty(&group->pg_freelist[order]));
-                goto found;
+        } else {
+                return 0;
         }
-        return NULL;
 
-found:
         addr = (uintptr_t)list_head(&group->pg_freelist[order], struct freepage, fp_link);
-        list_remove_head(&group->pg_freelist[order]);
+        _freelist_remove(group, order, addr);
         if (PAGE_NSIZES - 1 > order)
                 bit_flip(group->pg_map[order + 1], _pagegroup_calculate_index(group, order + 1, addr));
+        page_freecount -= (1 << order);
+        return addr;
+}
+
+/* Fills a processor's page cache from the buddy lists, returning how
+ * many pages it took */
+static uint32_t
+_page_pcpu_refill(struct page_pcpu *pp)
+{
+        uintptr_t addr;
+        uint32_t n;
+
+        spin_lock(&page_lock);
+        /* only worth reclaiming for if there are no pages at all */
+        for (n = 0; n < PAGE_PCPU_BATCH; n++) {
+                if (0 == (addr = __page_alloc_locked(0, 0 == n)))
+                        break;
+                list_insert_tail(&pp->pp_pages, &((struct freepage *)addr)->fp_link);
+                pp->pp_count++;
+        }
+        spin_unlock(&page_lock);
+        pp->pp_nrefills++;
+        return n;
+}
+
+/**
+ * Allocate a block of at least 2^order pages, single pages from this
+ * processor's cache. Fills the block with the MM_POISON_ALLOC pattern.
+ *
+ * @param order the order of the block size desired
+ * @return the address of the free memory or null if no memory could be allocated
+ */
+static void *
+_page_alloc_order(uint32_t order)
+{
+        uintptr_t addr;
+
+        if (0 == order) {
+                struct page_pcpu *pp = &page_pcpu[smp_cpu()];
+
+                if (0 == pp->pp_count && 0 == _page_pcpu_refill(pp))
+                        return NULL;
+                addr = (uintptr_t)list_head(&pp->pp_pages, struct freepage, fp_link);
+                list_remove(&((struct freepage *)addr)->fp_link);
+                pp->pp_count--;
+        } else {
+                spin_lock(&page_lock);
+                addr = __page_alloc_locked(order, 1);
+                spin_unlock(&page_lock);
+                if (0 == addr)
+                        return NULL;
+        }
 
         dbg(DBG_MM, "allocating %d pages (addr 0x%x)\n", (1 << order), addr);
 
@@ -265,7 +522,6 @@ found:
         memset((void *)addr, MM_POISON_ALLOC, (1 << order) << PAGE_SHIFT);
 #endif /* MM_POISON */
 
-        page_freecount -= (1 << order);
         return (void *) addr;
 }
 
@@ -282,20 +538,197 @@ __page_join(struct pagegroup *group, int order, uintptr_t addr)
 
                 dbg(DBG_PAGEALLOC, "joining 0x%.8x and 0x%.8x (%u) into 0x%.8x\n", addr, buddy, order, MIN(offset, buddy));
 
-                list_remove(&((struct freepage *)addr)->fp_link);
-                list_remove(&((struct freepage *)buddy)->fp_link);
+                _freelist_remove(group, order, addr);
+                _freelist_remove(group, order, buddy);
                 addr = MIN(addr, buddy);
                 ++order;
-                list_insert_head(&group->pg_freelist[order], &((struct freepage *)addr)->fp_link);
+                _freelist_insert(group, order, addr);
 
                 if (PAGE_NSIZES - 1 > order)
                         bit_flip(group->pg_map[order + 1], _pagegroup_calculate_index(group, order + 1, (uintptr_t)addr));
         }
 }
 
+/* Puts a block of 2^order pages back on the buddy lists, joining it
+ * with its buddies, with page_lock held */
+static void
+__page_free_locked(void *addr, int order)
+{
+        struct pagegroup *group = _pagegroup_from_address((uintptr_t)addr);
+        if (NULL == group)
+                return;
+
+        if (unlikely(_page_compacting(addr))
+            && (uintptr_t)addr + ((1 << order) << PAGE_SHIFT) <= page_compact_end) {
+                bitmap_set_range(page_compact_held, ADDR_TO_PN((uintptr_t)addr - page_compact_start),
+                                 1 << order);
+                page_compact_nheld += 1 << order;
+                return;
+        }
+
+        _freelist_insert(group, order, (uintptr_t)addr);
+        page_freecount += (1 << order);
+
+        if (PAGE_NSIZES - 1 > order) {
+                uintptr_t index = _pagegroup_calculate_index(group, order + 1, (uintptr_t)addr);
+                bit_flip(group->pg_map[order + 1], index);
+                __page_join(group, order, (uintptr_t)addr);
+        }
+}
+
+/* Gives up to npages of the coldest pages in a processor's page cache
+ * back to the buddy lists */
+static void
+_page_pcpu_drain(struct page_pcpu *pp, uint32_t npages)
+{
+        struct freepage *fp;
+
+        if (0 == pp->pp_count)
+                return;
+        spin_lock(&page_lock);
+        for (; 0 < npages && 0 < pp->pp_count; npages--) {
+                fp = list_tail(&pp->pp_pages, struct freepage, fp_link);
+                list_remove(&fp->fp_link);
+                pp->pp_count--;
+                __page_free_locked(fp, 0);
+        }
+        spin_unlock(&page_lock);
+        pp->pp_ndrains++;
+}
+
+/* Picks the block of 2^order pages to compact: the first one not already
+ * tried which holds a free block of the next order down, or failing that
+ * of the order below that, and so on, so as to move as few pages as
+ * possible. Returns its address, and sets *groupp, or returns 0. */
+static uintptr_t
+_page_compact_pick(uint32_t order, const uintptr_t *tried, uint32_t ntried,
+                   struct pagegroup **groupp)
+{
+        uintptr_t size = (1 << order) << PAGE_SHIFT;
+        struct pagegroup *group;
+        struct freepage *fp;
+        uintptr_t start;
+        uint32_t i;
+        int k;
+
+        for (k = order - 1; 0 <= k; k--) {
+                list_iterate_begin(&pagegroup_avail[k], group, struct pagegroup, pg_alink[k]) {
+                        list_iterate_begin(&group->pg_freelist[k], fp, struct freepage, fp_link) {
+                                start = group->pg_baseaddr
+                                        + (((uintptr_t)fp - group->pg_baseaddr) & ~(size - 1));
+                                if (start + size > group->pg_endaddr)
+                                        continue;
+                                for (i = 0; i < ntried && tried[i] != start; i++)
+                                        ;
+                                if (i == ntried) {
+                                        *groupp = group;
+                                        return start;
+                                }
+                        } list_iterate_end();
+                } list_iterate_end();
+        }
+        return 0;
+}
+
+/* Takes the free blocks in [start, start + 2^order pages) off the buddy
+ * lists, as though they had been allocated, into page_compact_held */
+static void
+_page_compact_isolate(struct pagegroup *group, uintptr_t start, uint32_t order)
+{
+        uintptr_t size = (1 << order) << PAGE_SHIFT;
+        struct freepage *fp;
+        uint32_t k;
+
+        memset(page_compact_held, 0, sizeof(page_compact_held));
+        page_compact_nheld = 0;
+        page_compact_start = start;
+        page_compact_end = start + size;
+
+        for (k = 0; k < order; k++) {
+                list_iterate_begin(&group->pg_freelist[k], fp, struct freepage, fp_link) {
+                        if (!_page_compacting(fp))
+                                continue;
+                        _freelist_remove(group, k, (uintptr_t)fp);
+                        bit_flip(group->pg_map[k + 1],
+                                 _pagegroup_calculate_index(group, k + 1, (uintptr_t)fp));
+                        page_freecount -= 1 << k;
+                        bitmap_set_range(page_compact_held, ADDR_TO_PN((uintptr_t)fp - start), 1 << k);
+                        page_compact_nheld += 1 << k;
+                } list_iterate_end();
+        }
+}
+
+/* Ends the compaction of the block, freeing it whole if all of it is now
+ * held and otherwise giving back the pages which are. Returns whether
+ * the block was freed. */
+static int
+_page_compact_finish(uint32_t order)
+{
+        uintptr_t start = page_compact_start;
+        int i = 0;
+
+        page_compact_start = page_compact_end = 0;
+        if ((uint32_t)(1 << order) == page_compact_nheld) {
+                __page_free_locked((void *)start, order);
+                return 1;
+        }
+        while (0 <= (i = bitmap_find_next_set(page_compact_held, 1 << order, i)))
+                __page_free_locked((void *)(start + (i++ << PAGE_SHIFT)), 0);
+        return 0;
+}
+
+/*
+ * Tries to make a free block of 2^order pages out of one which is partly
+ * free, by moving the page cache's pages out of the rest of it (see
+ * pframe_relocate). If any other page is in the way, such as a slab or
+ * a page table, the next best block is tried instead.
+ *
+ * Called, and returns, with page_lock held, which it drops while the
+ * pages are moved.
+ *
+ * @param order the order of the block wanted
+ * @return whether there is now a free block of the order
+ */
+static int
+_page_compact(uint32_t order)
+{
+        uintptr_t tried[PAGE_COMPACT_TRIES];
+        uint32_t ntried, npages = 1 << order;
+        struct pagegroup *group;
+        uintptr_t start;
+
+        KASSERT(0 < order && PAGE_NSIZES > order);
+
+        /* only one block is compacted at a time */
+        if (page_compact_start != page_compact_end)
+                return 0;
+
+        for (ntried = 0; ntried < PAGE_COMPACT_TRIES; ntried++) {
+                if (0 == (start = _page_compact_pick(order, tried, ntried, &group)))
+                        break;
+                tried[ntried] = start;
+                _page_compact_isolate(group, start, order);
+                spin_unlock(&page_lock);
+
+                /* what it may allocate comes from outside the block */
+                _page_pcpu_drain(&page_pcpu[smp_cpu()], PAGE_PCPU_HIGH + 1);
+                pframe_relocate(start, start + (npages << PAGE_SHIFT),
+                                npages - page_compact_nheld);
+
+                spin_lock(&page_lock);
+                if (_page_compact_finish(order)) {
+                        dbg(DBG_PAGEALLOC, "compacted 0x%.8x (%u)\n", start, order);
+                        page_ncompacted++;
+                        return 1;
+                }
+        }
+        page_ncompact_failed++;
+        return 0;
+}
+
 /**
- * Free a block of 2^order pages. Fills the memory with a special
- * MM_POISON_FREE pattern.
+ * Free a block of 2^order pages, single pages to this processor's
+ * cache. Fills the memory with a special MM_POISON_FREE pattern.
  *
  * @param addr the start of the block being freed
  * @param order the order of the block size being freed
@@ -311,21 +744,21 @@ _page_free_order(void *addr, int order)
         memset(addr, MM_POISON_FREE, (1 << order) << PAGE_SHIFT);
 #endif /* MM_POISON */
 
-        struct pagegroup *group = _pagegroup_from_address((uintptr_t)addr);
-        if (NULL == group)
-                return;
-
-        list_insert_head(&group->pg_freelist[order], &((struct freepage *)addr)->fp_link);
-        page_freecount += (1 << order);
+        /* pages of a block being compacted go straight back to it */
+        if (0 == order && likely(!_page_compacting(addr))) {
+                struct page_pcpu *pp = &page_pcpu[smp_cpu()];
 
-        if (PAGE_NSIZES - 1 > order) {
-                uintptr_t index = _pagegroup_calculate_index(group, order + 1, (uintptr_t)addr);
-                bit_flip(group->pg_map[order + 1], index);
-                __page_join(group, order, (uintptr_t)addr);
+                list_insert_head(&pp->pp_pages, &((struct freepage *)addr)->fp_link);
+                if (PAGE_PCPU_HIGH < ++pp->pp_count)
+                        _page_pcpu_drain(pp, PAGE_PCPU_BATCH);
+        } else {
+                spin_lock(&page_lock);
+                __page_free_locked(addr, order);
+                spin_unlock(&page_lock);
         }
 
         dbg(DBG_MM, "page_free: freed %d pages (addr 0x%p); %u pages currently free\n",
-            (1 << order), addr, page_freecount);
+            (1 << order), addr, page_free_count());
 }
 
 /*
@@ -337,6 +770,7 @@ page_alloc(void)
 {
         void *addr =  _page_alloc_order(0);
         GDB_CALL_HOOK(page_alloc, addr, 1);
+        TRACE(TRACE_PAGE_ALLOC, addr, 1, 0);
         return addr;
 }
 
@@ -348,16 +782,13 @@ void
 page_free(void *addr)
 {
         GDB_CALL_HOOK(page_free, addr, 1);
+        TRACE(TRACE_PAGE_FREE, addr, 1, 0);
         _page_free_order(addr, 0);
 }
 
-/*
- * Allocates a block of at least npages pages.
- * @param npages the number of pages to allocate
- * @return the address of the block
- */
-void *
-page_alloc_n(uint32_t npages)
+/* The order of the block which holds npages pages */
+static int
+_page_order(uint32_t npages)
 {
         int order;
 
@@ -366,9 +797,34 @@ page_alloc_n(uint32_t npages)
                         break;
         if (order == PAGE_NSIZES)
                 panic("Implementation does not permit allocating %u pages!\n", npages);
+        return order;
+}
+
+/*
+ * Allocates a block of at least npages pages.
+ * @param npages the number of pages to allocate
+ * @return the address of the block
+ */
+void *
+page_alloc_n(uint32_t npages)
+{
+        int order = _page_order(npages);
 
-        void *addr = _page_alloc_order(order);
+        void *addr = NULL;
+        if (PAGE_STACK_NPAGES == npages) {
+                spin_lock(&page_stack_lock);
+                if (!list_empty(&page_stack_cache)) {
+                        struct freepage *fp = list_head(&page_stack_cache, struct freepage, fp_link);
+                        list_remove(&fp->fp_link);
+                        page_nstack--;
+                        addr = fp;
+                }
+                spin_unlock(&page_stack_lock);
+        }
+        if (NULL == addr)
+                addr = _page_alloc_order(order);
         GDB_CALL_HOOK(page_alloc, addr, npages);
+        TRACE(TRACE_PAGE_ALLOC, addr, npages, 0);
         return addr;
 }
 
@@ -379,23 +835,241 @@ page_alloc_n(uint32_t npages)
 void
 page_free_n(void *start, uint32_t npages)
 {
-        int order;
-
-        for (order = 0; order < PAGE_NSIZES; order++)
-                if ((1 << order) >= (int)npages)
-                        break;
-        if (order == PAGE_NSIZES)
-                panic("Implementation does not permit allocating %u pages!\n", npages);
+        int order = _page_order(npages);
 
         GDB_CALL_HOOK(page_free, start, npages);
+        TRACE(TRACE_PAGE_FREE, start, npages, 0);
+        if (PAGE_STACK_NPAGES == npages) {
+                spin_lock(&page_stack_lock);
+                if (PAGE_STACK_CACHE > page_nstack) {
+                        /* the most recently used stack is the warmest, so
+                         * it goes out first */
+                        list_insert_head(&page_stack_cache, &((struct freepage *)start)->fp_link);
+                        page_nstack++;
+                        spin_unlock(&page_stack_lock);
+                        return;
+                }
+                spin_unlock(&page_stack_lock);
+        }
         _page_free_order(start, order);
 }
 
+/* Gives the cached kernel stacks back to the allocator */
+static void
+page_stack_drain(void)
+{
+        struct freepage *fp;
+
+        spin_lock(&page_stack_lock);
+        while (!list_empty(&page_stack_cache)) {
+                fp = list_head(&page_stack_cache, struct freepage, fp_link);
+                list_remove(&fp->fp_link);
+                page_nstack--;
+                spin_unlock(&page_stack_lock);
+                _page_free_order(fp, _page_order(PAGE_STACK_NPAGES));
+                spin_lock(&page_stack_lock);
+        }
+        KASSERT(0 == page_nstack);
+        spin_unlock(&page_stack_lock);
+}
+
 /*
  * @return the number of free pages in the kmem system
  */
 uint32_t
 page_free_count()
 {
-        return page_freecount;
+        uint32_t cpu, count = page_freecount;
+
+        for (cpu = 0; cpu < smp_ncpus(); cpu++)
+                count += page_pcpu[cpu].pp_count;
+        return count;
+}
+
+/*
+ * @param order the order of the block size of interest
+ * @return the number of free blocks of exactly 2^order pages, not
+ * counting the pages in the processors' page caches
+ */
+uint32_t
+page_free_blocks(uint32_t order)
+{
+        KASSERT(PAGE_NSIZES > order);
+        return page_nfree[order];
+}
+
+/*
+ * Takes a page from the pool, clearing the link it was on there, or
+ * returns NULL if the pool is empty. Either way, wakes pagezerod if the
+ * pool is running low.
+ */
+static void *
+_page_zero_take(void)
+{
+        struct freepage *fp = NULL;
+        uint32_t nzero;
+
+        spin_lock(&page_zero_lock);
+        if (!list_empty(&page_zero_pool)) {
+                fp = list_head(&page_zero_pool, struct freepage, fp_link);
+                list_remove(&fp->fp_link);
+                page_nzero--;
+                page_nzero_hits++;
+        } else {
+                page_nzero_misses++;
+        }
+        nzero = page_nzero;
+        spin_unlock(&page_zero_lock);
+
+        if (PAGE_ZERO_LOW > nzero && NULL != pagezerod_thr)
+                sched_wakeup_on(&pagezerod_waitq);
+        if (NULL != fp)
+                memset(fp, 0, sizeof(*fp));
+        return fp;
+}
+
+/*
+ * Allocates one page and returns it filled with zeros. The page comes
+ * from the pool which pagezerod clears ahead of time if it has one, and
+ * is cleared here otherwise. Free it with page_free.
+ * @return the address of the page, or NULL if no memory could be allocated
+ */
+void *
+page_alloc_zeroed(void)
+{
+        void *addr;
+
+        if (NULL != (addr = _page_zero_take()))
+                return addr;
+        if (NULL == (addr = page_alloc()))
+                return NULL;
+        page_zero(addr);
+        return addr;
+}
+
+/*
+ * Returns a page of zeros in place of the page at addr (which was
+ * allocated with page_alloc): one from pagezerod's pool, in which case
+ * addr is freed, or else addr itself, cleared.
+ */
+void *
+page_zero_replace(void *addr)
+{
+        void *zero;
+
+        if (NULL == (zero = _page_zero_take())) {
+                page_zero(addr);
+                return addr;
+        }
+        page_free(addr);
+        return zero;
+}
+
+/* Gives the pool back to the allocator, when memory is short */
+static void
+page_zero_drain(void)
+{
+        struct freepage *fp;
+
+        spin_lock(&page_zero_lock);
+        while (!list_empty(&page_zero_pool)) {
+                fp = list_head(&page_zero_pool, struct freepage, fp_link);
+                list_remove(&fp->fp_link);
+                page_nzero--;
+                spin_unlock(&page_zero_lock);
+                page_free(fp);
+                spin_lock(&page_zero_lock);
+        }
+        KASSERT(0 == page_nzero);
+        spin_unlock(&page_zero_lock);
+}
+
+/*
+ * The page zeroing daemon: whenever the pool of cleared pages runs low,
+ * clears pages until it is full again, as long as memory is not short.
+ * It yields after every page, so that it mostly runs when nothing else
+ * is runnable, taking the clearing out of the page fault path.
+ */
+static void *
+pagezerod_run(int arg1, void *arg2)
+{
+        while (1) {
+                while (PAGE_ZERO_TARGET > page_nzero
+                       && PAGE_ZERO_MIN_FREE < page_free_count()) {
+                        struct freepage *fp;
+
+                        if (NULL == (fp = page_alloc()))
+                                break;
+                        page_zero(fp);
+                        spin_lock(&page_zero_lock);
+                        list_insert_tail(&page_zero_pool, &fp->fp_link);
+                        page_nzero++;
+                        spin_unlock(&page_zero_lock);
+
+                        sched_make_runnable(curthr);
+                        sched_switch();
+                        if (curthr->kt_cancelled)
+                                kthread_exit((void *) 0);
+                }
+
+                if (sched_cancellable_sleep_on(&pagezerod_waitq))
+                        kthread_exit((void *) 0);
+        }
+        return NULL;
+}
+
+static __attribute__((unused)) void
+pagezerod_init(void)
+{
+        sched_queue_init(&pagezerod_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        pagezerod = proc_create("pagezerod");
+        KASSERT(NULL != pagezerod);
+        pagezerod_thr = kthread_create(pagezerod, pagezerod_run, 0, NULL);
+        KASSERT(NULL != pagezerod_thr);
+
+        sched_make_runnable(pagezerod_thr);
+}
+init_func(pagezerod_init);
+init_depends(sched_init);
+
+/*
+ * Stops pagezerod and waits for it, then gives the pool back. Called by
+ * the idle process when shutting down.
+ */
+void
+pagezerod_shutdown(void)
+{
+        KASSERT(PID_IDLE == curproc->p_pid);
+        KASSERT(NULL != pagezerod_thr);
+
+        kthread_cancel(pagezerod_thr, (void *) 0);
+        pagezerod_thr = NULL;
+        do_waitpid(pagezerod->p_pid, 0, NULL);
+        page_zero_drain();
+}
+
+/*
+ * Debug info function, prints how many cleared pages are waiting and how
+ * often one was there when needed, how many kernel stacks are cached,
+ * and how full each processor's page cache is.
+ */
+size_t
+page_zero_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        uint32_t cpu;
+
+        iprintf(&buf, &size, "%u/%u pages cleared ahead, %u hits, %u misses\n",
+                page_nzero, PAGE_ZERO_TARGET, page_nzero_hits, page_nzero_misses);
+        iprintf(&buf, &size, "%u/%u kernel stacks cached\n", page_nstack, PAGE_STACK_CACHE);
+        iprintf(&buf, &size, "%u blocks compacted, %u compactions failed\n",
+                page_ncompacted, page_ncompact_failed);
+        for (cpu = 0; cpu < smp_ncpus(); cpu++)
+                iprintf(&buf, &size, "cpu %u: %u/%u free pages cached, %u refills, %u drains\n",
+                        cpu, page_pcpu[cpu].pp_count, PAGE_PCPU_HIGH,
+                        page_pcpu[cpu].pp_nrefills, page_pcpu[cpu].pp_ndrains);
+        return size;
 }
@@ -5,7 +5,10 @@
 #include "limits.h"
 #include "globals.h"
 
+#include "main/apic.h"
 #include "main/interrupt.h"
+#include "main/cpuid.h"
+#include "main/smp.h"
 
 #include "mm/mm.h"
 #include "mm/page.h"
@@ -19,9 +22,18 @@
 #include "util/printf.h"
 
 #include "vm/pagefault.h"
+#include "vm/vmmap.h"
+
+#include "proc/proc.h"
+
+#include "api/access.h"
 
 #include "boot/config.h"
 
+#define CR0_WP            0x00010000  /* supervisor write protect */
+#define CR4_PSE           0x00000010  /* page size extensions */
+#define CR4_PGE           0x00000080  /* page global enable */
+
 #define PT_ENTRY_COUNT    (PAGE_SIZE / sizeof (uint32_t))
 #define PT_VADDR_SIZE     (PAGE_SIZE * PT_ENTRY_COUNT)
 
@@ -41,13 +53,39 @@ struct pagedir {
 #define vaddr_to_offset(vaddr) \
         (((uint32_t)(vaddr)) & (~PAGE_MASK))
 
+/* The page tables of the user part of an address space are freed as soon
+ * as nothing is mapped through them. Each one's count of present entries
+ * is kept in the low bits of its pd_virtual entry (the tables are page
+ * aligned, and a count of up to PT_ENTRY_COUNT fits below PAGE_SHIFT), so
+ * the page directory does not grow. The kernel's tables have a count of
+ * 0 and are never looked at by the code which maintains it. */
+#define pd_table(pd, index) \
+        ((pte_t *)((uintptr_t)(pd)->pd_virtual[index] & PAGE_MASK))
+#define pd_count(pd, index) \
+        ((uint32_t)((uintptr_t)(pd)->pd_virtual[index] & ~PAGE_MASK))
+
 /* the virtual address of the page directory in cr3 */
 static pagedir_t *current_pagedir = NULL;
+/* What each processor last put in cr3, for the TLB shootdowns */
+static pagedir_t *pt_cpu_pagedir[APIC_MAX_CPUS];
 static pagedir_t *template_pagedir = NULL;
 
+/* PT_GLOBAL if the kernel's own mappings are global, 0 otherwise */
+static pte_t pt_kernel_global = 0;
+
 static uint32_t phys_map_count = 1;
 static pte_t *final_page;
 
+/* The kmap slots are the first KMAP_NSLOTS entries of final_page (the
+ * single pt_phys_tmp_map entry is the last one, and pt_phys_perm_map
+ * hands out those below it). A slot keeps mapping its page after it is
+ * released, so that mapping the same page again needs no invlpg. */
+#define KMAP_NSLOTS       8
+#define KMAP_BASE         (UPTR_MAX - PT_VADDR_SIZE + 1)
+
+static int kmap_refs[KMAP_NSLOTS];
+static uint32_t kmap_next;      /* where to look for a free slot first */
+
 uintptr_t
 pt_phys_tmp_map(uintptr_t paddr)
 {
@@ -65,7 +103,7 @@ pt_phys_perm_map(uintptr_t paddr, uint32_t count)
         KASSERT(PAGE_ALIGNED(paddr));
 
         phys_map_count += count;
-        KASSERT(phys_map_count < PT_ENTRY_COUNT);
+        KASSERT(phys_map_count < PT_ENTRY_COUNT - KMAP_NSLOTS);
 
         uint32_t i;
         for (i = 0; i < count; ++i) {
@@ -78,6 +116,53 @@ pt_phys_perm_map(uintptr_t paddr, uint32_t count)
         return vaddr;
 }
 
+uintptr_t
+pt_kmap(uintptr_t paddr)
+{
+        uint32_t i, slot = KMAP_NSLOTS;
+
+        KASSERT(PAGE_ALIGNED(paddr));
+
+        for (i = 0; i < KMAP_NSLOTS; ++i) {
+                if ((PT_PRESENT & final_page[i]) && paddr == (final_page[i] & PAGE_MASK)) {
+                        slot = i;
+                        goto found;
+                }
+        }
+        for (i = 0; i < KMAP_NSLOTS; ++i) {
+                uint32_t s = (kmap_next + i) % KMAP_NSLOTS;
+
+                if (0 == kmap_refs[s]) {
+                        slot = s;
+                        break;
+                }
+        }
+        if (KMAP_NSLOTS == slot)
+                panic("out of kmap slots\n");
+
+        kmap_next = (slot + 1) % KMAP_NSLOTS;
+        if (PT_PRESENT & final_page[slot]) {
+                final_page[slot] = paddr | PT_PRESENT | PT_WRITE;
+                tlb_flush(KMAP_BASE + slot * PAGE_SIZE);
+        } else {
+                final_page[slot] = paddr | PT_PRESENT | PT_WRITE;
+        }
+
+found:
+        kmap_refs[slot]++;
+        return KMAP_BASE + slot * PAGE_SIZE;
+}
+
+void
+pt_kunmap(uintptr_t vaddr)
+{
+        uint32_t slot = (vaddr - KMAP_BASE) >> PAGE_SHIFT;
+
+        KASSERT(KMAP_BASE <= vaddr && KMAP_NSLOTS > slot);
+        KASSERT(0 < kmap_refs[slot]);
+        kmap_refs[slot]--;
+}
+
 uintptr_t
 pt_virt_to_phys(uintptr_t vaddr)
 {
@@ -85,16 +170,28 @@ pt_virt_to_phys(uintptr_t vaddr)
         uint32_t entry = vaddr_to_ptindex(vaddr);
         uint32_t offset = vaddr_to_offset(vaddr);
 
-        pte_t *pagetable = (pte_t *)pt_phys_tmp_map(current_pagedir->pd_physical[table] & PAGE_MASK);
+        if (PD_SIZE & current_pagedir->pd_physical[table])
+                return (current_pagedir->pd_physical[table] & ~(PT_VADDR_SIZE - 1))
+                       + (vaddr & (PT_VADDR_SIZE - 1));
+
+        pte_t *pagetable = (pte_t *)pt_kmap(current_pagedir->pd_physical[table] & PAGE_MASK);
         uintptr_t page = pagetable[entry] & PAGE_MASK;
+        pt_kunmap((uintptr_t)pagetable);
         return page + offset;
 }
 
+/* Switching between threads of one process (or to the same thread) keeps
+ * the page directory, and reloading CR3 would only throw away the TLB */
 void
 pt_set(pagedir_t *pd)
 {
-        uintptr_t pdir = pt_virt_to_phys((uintptr_t)pd->pd_physical);
+        uintptr_t pdir;
+
+        if (pd == current_pagedir)
+                return;
+        pdir = pt_virt_to_phys((uintptr_t)pd->pd_physical);
         current_pagedir = pd;
+        pt_cpu_pagedir[smp_cpu()] = pd;
         __asm__ volatile("movl %0, %%cr3" :: "r"(pdir) : "memory");
 }
 
@@ -104,34 +201,73 @@ pt_get(void)
         return current_pagedir;
 }
 
+uint32_t
+pt_active_cpus(pagedir_t *pd)
+{
+        uint32_t cpu, self = smp_cpu(), mask = 0;
+
+        for (cpu = 0; cpu < smp_ncpus(); cpu++) {
+                if (cpu != self && NULL != pt_cpu_pagedir[cpu]
+                    && (NULL == pd || pd == pt_cpu_pagedir[cpu]))
+                        mask |= 1U << cpu;
+        }
+        return mask;
+}
+
+/* Adds delta to the number of present entries in the given user page
+ * table, freeing the table once there are none left */
+static void
+pt_table_count(pagedir_t *pd, uint32_t index, int delta)
+{
+        uint32_t count = pd_count(pd, index) + delta;
+
+        KASSERT(PT_PRESENT & pd->pd_physical[index]);
+        KASSERT(count <= PT_ENTRY_COUNT);
+
+        if (0 == count) {
+                page_free(pd_table(pd, index));
+                pd->pd_virtual[index] = NULL;
+                pd->pd_physical[index] = 0;
+        } else {
+                pd->pd_virtual[index] = (uintptr_t *)((uintptr_t)pd_table(pd, index) | count);
+        }
+}
+
 int
 pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32_t ptflags)
 {
         KASSERT(PAGE_ALIGNED(vaddr) && PAGE_ALIGNED(paddr));
         KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr);
 
-        int index = vaddr_to_pdindex(vaddr);
+        int pdindex = vaddr_to_pdindex(vaddr);
+        int index = pdindex;
 
         pte_t *pt;
         if (!(PT_PRESENT & pd->pd_physical[index])) {
-                if (NULL == (pt = page_alloc())) {
+                if (NULL == (pt = page_alloc_zeroed())) {
                         return -ENOMEM;
                 } else {
                         KASSERT((pdflags & ~PAGE_MASK) == pdflags);
-                        memset(pt, 0, PAGE_SIZE);
                         pd->pd_physical[index] = pt_virt_to_phys((uintptr_t)pt) | pdflags;
                         pd->pd_virtual[index] = pt;
                 }
         } else {
                 /* Be sure to add additional pagedir flags if necessary */
                 pd->pd_physical[index] = pd->pd_physical[index] | pdflags;
-                pt = (pte_t *)pd->pd_virtual[index];
+                pt = pd_table(pd, index);
         }
 
         index = vaddr_to_ptindex(vaddr);
 
         KASSERT((ptflags & ~PAGE_MASK) == ptflags);
-        pt[index] = paddr | ptflags;
+        if (!(PT_PRESENT & pt[index]) && (PT_PRESENT & ptflags))
+                pt_table_count(pd, pdindex, 1);
+        else if ((PT_PRESENT & pt[index]) && !(PT_PRESENT & ptflags))
+                pt_table_count(pd, pdindex, -1);
+        /* the table may just have been freed, if nothing else is mapped
+         * through it and a non-present entry was written */
+        if (PT_PRESENT & pd->pd_physical[pdindex])
+                pt[index] = paddr | ptflags;
 
         return 0;
 }
@@ -145,42 +281,143 @@ pt_unmap(pagedir_t *pd, uintptr_t vaddr)
         int index = vaddr_to_pdindex(vaddr);
 
         if (PT_PRESENT & pd->pd_physical[index]) {
-                pte_t *pt = (pte_t *)pd->pd_virtual[index];
+                pte_t *pt = pd_table(pd, index);
+                uint32_t ptindex = vaddr_to_ptindex(vaddr);
+
+                if (PT_PRESENT & pt[ptindex]) {
+                        pt[ptindex] = 0;
+                        pt_table_count(pd, index, -1);
+                }
+        }
+}
+
+int
+pt_share_range(pagedir_t *dst, pagedir_t *src, uintptr_t vlow, uintptr_t vhigh)
+{
+        uint32_t i, j;
 
-                index = vaddr_to_ptindex(vaddr);
-                pt[index] = 0;
+        KASSERT(vlow < vhigh);
+        KASSERT(0 == vlow % PT_VADDR_SIZE && 0 == vhigh % PT_VADDR_SIZE);
+        KASSERT(USER_MEM_LOW <= vlow && USER_MEM_HIGH >= vhigh);
+
+        for (i = vaddr_to_pdindex(vlow); i < vaddr_to_pdindex(vhigh); ++i) {
+                pte_t *spt, *dpt;
+
+                if (!(PT_PRESENT & src->pd_physical[i]))
+                        continue;
+                spt = pd_table(src, i);
+
+                if (!(PT_PRESENT & dst->pd_physical[i])) {
+                        if (NULL == (dpt = page_alloc_zeroed()))
+                                return -ENOMEM;
+                        dst->pd_physical[i] = pt_virt_to_phys((uintptr_t)dpt)
+                                              | (src->pd_physical[i] & ~PAGE_MASK);
+                        dst->pd_virtual[i] = dpt;
+                } else {
+                        dpt = pd_table(dst, i);
+                }
+
+                for (j = 0; j < PT_ENTRY_COUNT; ++j) {
+                        if (PT_PRESENT & spt[j]) {
+                                spt[j] &= ~PT_WRITE;
+                                if (!(PT_PRESENT & dpt[j]))
+                                        pt_table_count(dst, i, 1);
+                                dpt[j] = spt[j];
+                        }
+                }
+        }
+        return 0;
+}
+
+uint32_t
+pt_resident(pagedir_t *pd)
+{
+        uint32_t i, n = 0;
+
+        /* each table keeps its own count */
+        for (i = vaddr_to_pdindex(USER_MEM_LOW); i < vaddr_to_pdindex(USER_MEM_HIGH); ++i) {
+                if (PT_PRESENT & pd->pd_physical[i])
+                        n += pd_count(pd, i);
         }
+        return n;
+}
+
+/* Clears entries [low, high) of the given user page table, if there is
+ * one, freeing it if that leaves it empty */
+static void
+pt_unmap_entries(pagedir_t *pd, uint32_t index, uint32_t low, uint32_t high)
+{
+        pte_t *pt;
+        int cleared = 0;
+
+        if (!(PT_PRESENT & pd->pd_physical[index]))
+                return;
+
+        pt = pd_table(pd, index);
+        for (; low < high; ++low) {
+                if (PT_PRESENT & pt[low]) {
+                        ++cleared;
+                }
+                pt[low] = 0;
+        }
+        if (0 != cleared)
+                pt_table_count(pd, index, -cleared);
 }
 
 void
 pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
 {
         uint32_t index;
+        vmmap_t *clone;
 
         KASSERT(vlow < vhigh);
         KASSERT(PAGE_ALIGNED(vlow) && PAGE_ALIGNED(vhigh));
         KASSERT(USER_MEM_LOW <= vlow && USER_MEM_HIGH >= vhigh);
 
+        /* fork unmaps all of the parent's memory just after cloning its
+         * address space, so that writes fault and the shadow objects it
+         * has just put in place are used. Write-protecting the resident
+         * pages, and giving the child the same read-only mappings, does
+         * that too without making either side fault reads back in. If the
+         * child's page tables cannot be allocated, the parent's mappings
+         * are simply removed (those the child did get are still valid).
+         * The shadows put above areas which can never be written are
+         * taken away again first (see vmmap_fork_unshadow). */
+        if (NULL != curproc && pd == curproc->p_pagedir
+            && USER_MEM_LOW == vlow && USER_MEM_HIGH == vhigh
+            && NULL != curproc->p_vmmap
+            && NULL != (clone = curproc->p_vmmap->vmm_clone)) {
+                curproc->p_vmmap->vmm_clone = NULL;
+                vmmap_fork_unshadow(curproc->p_vmmap);
+                vmmap_fork_unshadow(clone);
+                if (NULL != clone->vmm_proc
+                    && 0 == pt_share_range(clone->vmm_proc->p_pagedir, pd, vlow, vhigh))
+                        return;
+        }
+
+        /* the range may start and end within a single table */
+        if (vaddr_to_pdindex(vlow) == vaddr_to_pdindex(vhigh)) {
+                pt_unmap_entries(pd, vaddr_to_pdindex(vlow), vaddr_to_ptindex(vlow),
+                                 vaddr_to_ptindex(vhigh));
+                return;
+        }
+
         index = vaddr_to_ptindex(vlow);
-        if (PT_PRESENT & pd->pd_physical[vaddr_to_pdindex(vlow)] && index != 0) {
-                pte_t *pt = (pte_t *)pd->pd_virtual[vaddr_to_pdindex(vlow)];
-                size_t size = (PT_ENTRY_COUNT - index) * sizeof(*pt);
-                memset(&pt[index], 0, size);
+        if (index != 0) {
+                pt_unmap_entries(pd, vaddr_to_pdindex(vlow), index, PT_ENTRY_COUNT);
         }
         vlow += PAGE_SIZE * ((PT_ENTRY_COUNT - index) % PT_ENTRY_COUNT);
 
         index = vaddr_to_ptindex(vhigh);
-        if (PT_PRESENT & pd->pd_physical[vaddr_to_pdindex(vhigh)] && index != 0) {
-                pte_t *pt = (pte_t *)pd->pd_virtual[vaddr_to_pdindex(vhigh)];
-                size_t size = index * sizeof(*pt);
-                memset(&pt[0], 0, size);
+        if (index != 0) {
+                pt_unmap_entries(pd, vaddr_to_pdindex(vhigh), 0, index);
         }
         vhigh -= PAGE_SIZE * index;
 
         uint32_t i;
         for (i = vaddr_to_pdindex(vlow); i < vaddr_to_pdindex(vhigh); ++i) {
                 if (PT_PRESENT & pd->pd_physical[i]) {
-                        page_free(pd->pd_virtual[i]);
+                        page_free(pd_table(pd, i));
                         pd->pd_virtual[i] = NULL;
                         pd->pd_physical[i] = 0;
                 }
@@ -214,7 +451,7 @@ pt_destroy_pagedir(pagedir_t *pdir)
         uint32_t i;
         for (i = begin; i <= end; ++i) {
                 if (PT_PRESENT & pdir->pd_physical[i]) {
-                        page_free(pdir->pd_virtual[i]);
+                        page_free(pd_table(pdir, i));
                 }
         }
         page_free_n(pdir, 2);
@@ -228,9 +465,19 @@ _pt_fault_handler(regs_t *regs)
         __asm__ volatile("movl %%cr2, %0" : "=r"(vaddr));
         uint32_t cause = regs->r_err;
 
+        uintptr_t fixup;
+
         /* Check if pagefault was in user space (otherwise, BAD!) */
         if (cause & FAULT_USER) {
                 handle_pagefault(vaddr, cause);
+        } else if (USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr
+                   && 0 != (fixup = access_fixup(regs->r_eip))) {
+                /* copy_to/from_user touched a user page: fault it in as
+                 * the process itself would, but if the process could not
+                 * have touched it either, or it cannot be had, the copy
+                 * fails rather than the process */
+                if (0 > pagefault_resolve(vaddr, cause))
+                        regs->r_eip = fixup;
         } else {
                 panic("\nPage faulted while accessing 0x%08x\n", vaddr);
         }
@@ -263,6 +510,74 @@ _pt_fill_page(pagedir_t *pd, pte_t *pt, pde_t pdflags, pte_t ptflags,
         pd->pd_virtual[base] = pt;
 }
 
+/*
+ * Maps the physical memory in [paddr, physmax) which follows the first 4mb
+ * of the kernel, starting at vaddr, using 4mb pages wherever possible, and
+ * adds it to the page allocator. pagetable is the last page table used so
+ * far; the ones needed here are taken from just after it.
+ *
+ * Since the kernel is loaded at KERNEL_PHYS_BASE, which is not 4mb
+ * aligned, the virtual and physical addresses of the memory following it
+ * are not 4mb aligned together. So the memory up to the next 4mb
+ * physical boundary is mapped with one page table, the virtual addresses
+ * then skip ahead to the next 4mb boundary, after which virtual and
+ * physical addresses line up and 4mb pages are used up to the last
+ * (partial) 4mb of memory, which gets a page table again. The page
+ * allocator is given the two contiguous ranges.
+ */
+/* Turns on CR4.PGE once the kernel's mappings are in place, if they were
+ * made global */
+static void
+_pt_enable_global(void)
+{
+        uint32_t cr4;
+
+        if (!pt_kernel_global)
+                return;
+        __asm__ volatile("movl %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_PGE;
+        __asm__ volatile("movl %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+static void
+_pt_init_large(pagedir_t *pd, pte_t *pagetable, uintptr_t vaddr,
+               uintptr_t paddr, uintptr_t physmax)
+{
+        uint32_t cr4;
+        __asm__ volatile("movl %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_PSE;
+        __asm__ volatile("movl %0, %%cr4" :: "r"(cr4) : "memory");
+
+        /* the rest of the 4mb block of physical memory the kernel ends in */
+        uintptr_t pnext = MIN((paddr + PT_VADDR_SIZE - 1) & ~(PT_VADDR_SIZE - 1), physmax);
+        uintptr_t vhead = vaddr + (pnext - paddr);
+        pagetable += PT_ENTRY_COUNT;
+        _pt_fill_page(pd, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE | pt_kernel_global, vaddr, paddr);
+        memset(&pagetable[(pnext - paddr) >> PAGE_SHIFT], 0,
+               PAGE_SIZE - ((pnext - paddr) >> PAGE_SHIFT) * sizeof(pte_t));
+
+        /* whole 4mb pages, then a page table for whatever is left */
+        uintptr_t vlarge = vaddr + PT_VADDR_SIZE;
+        uintptr_t v = vlarge;
+        for (paddr = pnext; paddr + PT_VADDR_SIZE <= physmax; paddr += PT_VADDR_SIZE) {
+                pd->pd_physical[vaddr_to_pdindex(v)] = paddr | PD_PRESENT | PD_WRITE | PD_SIZE | pt_kernel_global;
+                pd->pd_virtual[vaddr_to_pdindex(v)] = NULL;
+                v += PT_VADDR_SIZE;
+        }
+        if (paddr < physmax) {
+                pagetable += PT_ENTRY_COUNT;
+                _pt_fill_page(pd, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE | pt_kernel_global, v, paddr);
+        }
+        tlb_flush_all();
+
+        dbgq(DBG_MM, "Mapped %u 4mb pages of physical memory\n", (v - vlarge) / PT_VADDR_SIZE);
+
+        if ((uintptr_t) pagetable + PT_ENTRY_COUNT < vhead)
+                page_add_range((uintptr_t) pagetable + PT_ENTRY_COUNT, vhead);
+        if (pnext < physmax)
+                page_add_range(vlarge, vlarge + (physmax - pnext));
+}
+
 void
 pt_init(void)
 {
@@ -275,6 +590,14 @@ pt_init(void)
         pde_t *temppdir;
         __asm__ volatile("movl %%cr3, %0" : "=r"(temppdir));
 
+        /* the kernel's mappings are the same in every page directory, so
+         * if the CPU can keep them in the TLB when cr3 is reloaded (see
+         * pt_set), they are made global */
+        uint32_t eax, edx;
+        cpuid(CPUID_GETFEATURES, &eax, &edx);
+        if (CPUID_FEAT_EDX_PGE & edx)
+                pt_kernel_global = PT_GLOBAL;
+
         pagedir_t *pagedir = (pagedir_t *)&kernel_end;
         /* The kernel ending address should be page aligned by the linker script */
         KASSERT(PAGE_ALIGNED(pagedir));
@@ -297,28 +620,59 @@ pt_init(void)
          * this will make our new page table identical to the temporary
          * page table the boot loader created. */
         pagetable += PT_ENTRY_COUNT;
-        _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE,
+        _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE | pt_kernel_global,
                       (uintptr_t)&kernel_start, KERNEL_PHYS_BASE);
 
         current_pagedir = pagedir;
+        pt_cpu_pagedir[0] = pagedir;
         /* swap the temporary page table with our identical, but more
-         * permanant page table */
-        pt_set(pagedir);
+         * permanant page table (by hand, as pt_set would see it is
+         * already current) */
+        __asm__ volatile("movl %0, %%cr3"
+                         :: "r"(pt_virt_to_phys((uintptr_t)pagedir->pd_physical)) : "memory");
+
+        /* make the kernel respect read-only user mappings too, so that
+         * copy_to_user faults on a copy-on-write page the way the process
+         * itself would, instead of writing to the page shared with others */
+        uint32_t cr0;
+        __asm__ volatile("movl %%cr0, %0" : "=r"(cr0));
+        cr0 |= CR0_WP;
+        __asm__ volatile("movl %0, %%cr0" :: "r"(cr0) : "memory");
 
         uintptr_t physmax = phys_detect_highmem();
         dbgq(DBG_MM, "Highest usable physical memory: 0x%08x\n", physmax);
+
+        /* physical memory is mapped from kernel_start up to the kmap
+         * slots, less the most _pt_init_large skips to line up its 4mb
+         * pages; whatever is past that is left as high memory */
+        uintptr_t lowmax = KERNEL_PHYS_BASE + (KMAP_BASE - (uintptr_t)&kernel_start) - PT_VADDR_SIZE;
+        if (physmax > lowmax) {
+                dbgq(DBG_MM, "Mapping physical memory only up to 0x%08x\n", lowmax);
+                physmax = lowmax;
+        }
+        phys_add_highmem(physmax);
         dbgq(DBG_MM, "Available memory: 0x%08x\n", physmax - KERNEL_PHYS_BASE);
 
         uintptr_t vaddr = ((uintptr_t)&kernel_start);
         uintptr_t paddr = KERNEL_PHYS_BASE;
+
+        if (CPUID_FEAT_EDX_PSE & edx) {
+                _pt_init_large(pagedir, pagetable, vaddr + PT_VADDR_SIZE,
+                               paddr + PT_VADDR_SIZE, physmax);
+                _pt_enable_global();
+                return;
+        }
+
         do {
                 pagetable += PT_ENTRY_COUNT;
                 vaddr += PT_VADDR_SIZE;
                 paddr += PT_VADDR_SIZE;
-                _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE, vaddr, paddr);
+                _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE | pt_kernel_global,
+                              vaddr, paddr);
         } while (paddr < physmax);
 
         page_add_range((uintptr_t) pagetable + PT_ENTRY_COUNT, physmax + ((uintptr_t)&kernel_start) - KERNEL_PHYS_BASE);
+        _pt_enable_global();
 }
 
 void
@@ -357,9 +711,14 @@ pt_mapping_info(const void *pt, char *buf, size_t osize)
 
         while (PT_ENTRY_COUNT > pdi) {
                 pte_t *entry = NULL;
-                if (PD_PRESENT & pagedir->pd_physical[pdi]) {
-                        if (PT_PRESENT & pagedir->pd_virtual[pdi][pti]) {
-                                entry = &pagedir->pd_virtual[pdi][pti];
+                pte_t large;
+                if (PD_SIZE & pagedir->pd_physical[pdi]) {
+                        /* a 4mb page, looked at 4kb at a time */
+                        large = (pagedir->pd_physical[pdi] & ~(PT_VADDR_SIZE - 1)) + pti * PAGE_SIZE;
+                        entry = &large;
+                } else if (PD_PRESENT & pagedir->pd_physical[pdi]) {
+                        if (PT_PRESENT & pd_table(pagedir, pdi)[pti]) {
+                                entry = &pd_table(pagedir, pdi)[pti];
                         }
                 } else {
                         ++pdi;
@@ -1,11 +1,24 @@
 #include "globals.h"
 #include "config.h"
 #include "errno.h"
+#include "kernel.h"
+
+#include "api/trace.h"
+
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+
+#include "main/cpuid.h"
 
 #include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
 
 #include "util/debug.h"
+#include "util/math.h"
 #include "util/string.h"
+#include "util/printf.h"
+#include "util/time.h"
 
 #include "mm/mmobj.h"
 #include "mm/page.h"
@@ -16,6 +29,11 @@
 #include "mm/pagetable.h"
 
 #include "vm/vmmap.h"
+#include "vm/anon.h"
+#include "vm/ksm.h"
+#include "vm/shadow.h"
+#include "vm/swap.h"
+#include "util/timer.h"
 
 /*
  * In this file, physical pages (as represented by pframes) will be
@@ -50,17 +68,23 @@
  *
  *
  * When a page is allocated or pinned:
- *     - pf_link links the page into allocated_list or pinned_list,
- *       respectively
+ *     - pf_link links the page into active_list or inactive_list (if it
+ *       is allocated) or pinned_list, respectively
  *     - pf_hlink links the page into the appropriate hash chain of the
  *       resident page hashtable
  *     - pf_olink links the page into the appropriate mmobj's list of
  *       resident pages
+ *     - pf_dlink links the page into its mmobj's dirty list, if the mmobj
+ *       has one and the page is dirty or being cleaned
+ *     - pf_gdlink links the page into dirty_list, if it is dirty or being
+ *       cleaned
  *
  * When a page is free:
  *     - pf_link links the page into free_list
  *     - pf_hlink does not link the page into any list
  *     - pf_olink does not link the page into any list
+ *     - pf_dlink does not link the page into any list
+ *     - pf_gdlink does not link the page into any list
  */
 
 /* Page management structures:
@@ -74,28 +98,158 @@
 static int npinned;
 static list_t pinned_list;
 
-/*     The ALLOCATED list: */
-/*       Pages on this list contain useful/actual/real data. This list is
- *       maintained in least-recently-requested (via pframe_get or
- *       pframe_get_resident) (and thus, *roughly/approximately* LRU) order.
+/*     The ALLOCATED lists: */
+/*       Pages on these lists contain useful/actual/real data. They are
+ *       split into an ACTIVE and an INACTIVE list, both kept in roughly
+ *       the order pages were put on them. New pages start out inactive.
+ *       A lookup (via pframe_get or pframe_get_resident) only sets
+ *       PF_REFERENCED, unless the page is inactive and already referenced,
+ *       in which case it is promoted to the active list. pageoutd only
+ *       reclaims from the head of the inactive list, giving referenced
+ *       pages a second chance, and refills the inactive list by aging
+ *       the head of the active list. A page touched only once (e.g. by a
+ *       single sequential scan of a large file) therefore never displaces
+ *       pages which are in repeated use, like filesystem metadata.
+ */
+static int nallocated;          /* nactive + pages on inactive_list */
+static int nactive;
+static list_t active_list;
+static list_t inactive_list;
+
+/* Number of active pages pageoutd looks at each time it ages the active
+ * list, and the active:inactive ratio above which it does so */
+#define PFRAME_AGE_BATCH        32
+#define PFRAME_INACTIVE_RATIO   2
+
+/*     The DIRTY lists: */
+/*       Every dirty page, pinned or not, in the order the pages went from
+ *       clean to dirty (pf_dirtied). A page stays on it while it is being
+ *       written back, and leaves it once it has been written back clean,
+ *       so sync(2) only looks at dirty pages and writes the oldest first.
+ *       Objects which register a dirty list (pframe_register_dirtylist)
+ *       keep their pages on that too, in the same order. The pages of
+ *       objects which swap (anonymous and shadow objects) are kept apart,
+ *       on dirty_swap_list, since pflushd and the writer throttling only
+ *       write back file pages: writing anonymous memory to swap is left
+ *       to pageoutd, for when the memory is wanted.
  */
-static int nallocated;
-static list_t alloc_list;
+static uint32_t ndirty;         /* pages on dirty_list */
+static list_t dirty_list;
+static uint32_t nswapdirty;     /* pages on dirty_swap_list */
+static list_t dirty_swap_list;
 
 static slab_allocator_t *pframe_allocator;
 
 /* Used to quickly look up pframes. ALL pages "owned by" some
  * mmobj should be in this hash
- * (object, pagenum) --> list of pframes */
-#define hash_page(obj, pagenum)  ((((uint32_t)(obj)) + (pagenum)) \
-                                  % PF_HASH_SIZE)
-static list_t pframe_hash[PF_HASH_SIZE];
-
-/* Related to the Pageout daemon: */
+ * (object, pagenum) --> list of pframes
+ *
+ * The table starts with 2^PF_HASH_MIN_SHIFT buckets and is doubled
+ * whenever the number of resident pages exceeds PF_HASH_LOAD per bucket,
+ * so chains stay short however much memory is being used for caching.
+ *
+ * pframe_hash_lock covers the table, its size and pframe_nresident. The
+ * allocated and pinned lists are not under it: pageoutd and the cleaning
+ * code walk those while waiting on I/O, so they stay with the threads
+ * which can block. */
+#define hash_page(obj, pagenum)  \
+        ((((((uint32_t)(obj)) >> 4) ^ (pagenum)) * 0x9e3779b1U) \
+         >> (32 - pframe_hash_shift))
+static list_t *pframe_hash;
+static uint32_t pframe_hash_shift;
+static uint32_t pframe_nresident;
+static spinlock_t pframe_hash_lock;
+
+/* Related to the Pageout daemon:
+ *
+ * pageoutd is woken once the number of free pages drops to
+ * nfreepages_low and reclaims in the background until nfreepages_target
+ * pages are free again. Only when the free count falls to nfreepages_min
+ * does pframe_alloc stop and wait for pageoutd (a "stall"). All three
+ * marks are fractions of the memory available when pframe_init runs. */
 
 static uint32_t nfreepages_min = 0;
+static uint32_t nfreepages_low = 0;
 static uint32_t nfreepages_target = 0;
 
+/* Related to the flusher daemon:
+ *
+ * pflushd wakes up every PFLUSHD_INTERVAL_MSECS to write back the file
+ * pages which have been dirty for longer than PFLUSHD_EXPIRE_MSECS, and
+ * is woken early to write back the oldest ones, however new, once there
+ * are more than ndirty_background. A writer which finds more than
+ * ndirty_throttle dirty file pages writes the oldest back itself (see
+ * pframe_throttle). Both marks are fractions of the memory available
+ * when pframe_init runs. */
+static uint32_t ndirty_background = 0;
+static uint32_t ndirty_throttle = 0;
+
+static proc_t *pflushd = NULL;
+static kthread_t *pflushd_thr = NULL;
+static ktqueue_t pflushd_waitq;
+#define pflushd_wakeup()        (sched_broadcast_on(&pflushd_waitq))
+
+/* Writeback statistics, see pframe_info */
+static uint32_t pframe_nflushed;        /* pages written back by pflushd */
+static uint32_t pframe_nthrottled;      /* writes which had to help */
+
+/* Reclaim statistics, see pframe_info */
+static uint32_t pframe_nwakeups;        /* times pageoutd was woken up */
+static uint32_t pframe_nreclaimed;      /* pages freed by pageoutd */
+static uint32_t pframe_nstalls;         /* allocations that had to wait */
+static uint32_t pframe_nstalled;        /* allocations waiting right now */
+
+/* Page cache statistics, see pframe_stat_info. They are kept for each
+ * kind of object, and for the pages of the files of each type of file
+ * system, which is known by its fs_ops. A lookup is a pframe_get, and
+ * a miss one which had to fill the page; a probe is a
+ * pframe_get_resident, which never fills the page. */
+#define PFRAME_STAT_VNODE       0
+#define PFRAME_STAT_BLOCKDEV    1
+#define PFRAME_STAT_ANON        2
+#define PFRAME_STAT_SHADOW      3
+#define PFRAME_STAT_OTHER       4
+#define PFRAME_STAT_NKINDS      5
+
+#define PFRAME_STAT_MAXFS       8
+
+typedef struct pframe_stat {
+        uint32_t        ps_lookups;
+        uint32_t        ps_misses;
+        uint32_t        ps_probes;
+        uint32_t        ps_probe_hits;
+        uint32_t        ps_readahead;   /* pages filled by pframe_prefetch */
+        uint32_t        ps_fill_errors;
+        uint64_t        ps_fill_cycles; /* over the misses and readahead */
+        uint32_t        ps_evictions;   /* clean pages reclaimed by pageoutd */
+        uint32_t        ps_writebacks;  /* pages written back */
+} pframe_stat_t;
+
+static const char *pframe_stat_names[PFRAME_STAT_NKINDS] = {
+        "vnode", "blockdev", "anon", "shadow", "other"
+};
+static pframe_stat_t pframe_stats[PFRAME_STAT_NKINDS];
+
+static struct {
+        fs_ops_t               *pfs_ops;
+        char                    pfs_type[16];
+        pframe_stat_t           pfs_stat;
+} pframe_fsstats[PFRAME_STAT_MAXFS];
+
+/* Block devices all have the same mmobj_ops, which are prebuilt */
+static mmobj_ops_t *pframe_blockdev_ops = NULL;
+
+static pframe_stat_t *pframe_stat_of(mmobj_t *o, pframe_stat_t **fsstat);
+
+/* Adds n to the counter of both the kind of o and its file system */
+#define pframe_stat_add(o, field, n)                                    \
+        do {                                                            \
+                pframe_stat_t *__fs, *__ks = pframe_stat_of((o), &__fs); \
+                __ks->field += (n);                                     \
+                if (NULL != __fs)                                       \
+                        __fs->field += (n);                             \
+        } while (0)
+
 /*   pageoutd sleeps on this queue */
 static proc_t *pageoutd = NULL;
 static kthread_t *pageoutd_thr = NULL;
@@ -109,15 +263,33 @@ static void *pageoutd_run(int arg1, void *arg2);
 static void pageoutd_exit(void);
 #define pageoutd_wakeup()        (sched_broadcast_on(&pageoutd_waitq))
 #define pageoutd_needed()        \
-	((page_free_count() <= nfreepages_min) && (!list_empty(&alloc_list)))
+	((page_free_count() <= nfreepages_low) && (0 < nallocated))
+#define pframe_must_stall()      \
+	((page_free_count() <= nfreepages_min) && (0 < nallocated) \
+	 && (NULL != pageoutd_thr) && (curthr != pageoutd_thr))
 #define pageoutd_target_met()    (page_free_count() >= nfreepages_target)
 
 
+/*
+ * Constructor for the pframe allocator. A pframe's wait queue is always
+ * empty by the time it is freed, so it is initialized only once.
+ */
+static void
+pframe_ctor(void *obj)
+{
+        pframe_t *pf = (pframe_t *)obj;
+
+        pf->pf_obj = NULL;
+        sched_queue_init(&pf->pf_waitq);
+        list_link_init(&pf->pf_dlink);
+        list_link_init(&pf->pf_gdlink);
+}
+
 /*
  * Initialize the pinned and allocated counts and lists. Then, make a pframe
  * slab allocator. You should also list_init all the lists that make
  * up the pframe_hash. Finally, you need to set things up for pageoutd to
- * run by setting nfreepages_min and nfreepages_target.
+ * run by setting nfreepages_min, nfreepages_low and nfreepages_target.
  */
 void
 pframe_init(void)
@@ -126,19 +298,39 @@ pframe_init(void)
         npinned = 0;
         list_init(&pinned_list);
         nallocated = 0;
-        list_init(&alloc_list);
-
-        pframe_allocator = slab_allocator_create("pframe", sizeof(pframe_t));
+        nactive = 0;
+        list_init(&active_list);
+        list_init(&inactive_list);
+        ndirty = 0;
+        list_init(&dirty_list);
+        nswapdirty = 0;
+        list_init(&dirty_swap_list);
+
+        pframe_allocator = slab_allocator_create_ctor("pframe", sizeof(pframe_t),
+                                                      pframe_ctor, NULL);
         KASSERT(NULL != pframe_allocator);
 
         /* initialize pframe_hash: */
-        int i;
-        for (i = 0; i < PF_HASH_SIZE; ++i)
+        uint32_t i;
+        spinlock_init(&pframe_hash_lock, "pframe hash");
+        pframe_hash_shift = PF_HASH_MIN_SHIFT;
+        pframe_hash = kmalloc(sizeof(list_t) << pframe_hash_shift);
+        KASSERT(NULL != pframe_hash);
+        for (i = 0; i < (1U << pframe_hash_shift); ++i)
                 list_init(&pframe_hash[i]);
+        pframe_nresident = 0;
 
         /* initialize pageout parameters: */
-        nfreepages_target = page_free_count() >> 1;
-        nfreepages_min = 0;
+        uint32_t npages = page_free_count();
+        nfreepages_min = MAX(npages >> PAGEOUTD_FREE_MIN_SHIFT, 1);
+        nfreepages_low = MAX(npages >> PAGEOUTD_FREE_LOW_SHIFT, nfreepages_min + 1);
+        nfreepages_target = MAX(npages >> PAGEOUTD_FREE_TARGET_SHIFT,
+                                nfreepages_low + PFRAME_CLEAN_BATCH);
+
+        /* and writeback ones: */
+        ndirty_background = MAX(npages >> PFLUSHD_BACKGROUND_SHIFT, PFRAME_CLEAN_BATCH);
+        ndirty_throttle = MAX(npages >> PFLUSHD_THROTTLE_SHIFT,
+                              ndirty_background + PFRAME_CLEAN_BATCH);
 
 		/* initialize alloc_waitq */
 		sched_queue_init(&alloc_waitq);
@@ -163,12 +355,212 @@ pframe_shutdown()
 
         /* Free all pages */
         pframe_t *pf;
-        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
+        list_iterate_begin(&active_list, pf, pframe_t, pf_link) {
                 KASSERT(!pframe_is_dirty(pf));
                 KASSERT(!pframe_is_busy(pf));
                 KASSERT(!pframe_is_pinned(pf));
                 pframe_free(pf);
         } list_iterate_end();
+        list_iterate_begin(&inactive_list, pf, pframe_t, pf_link) {
+                KASSERT(!pframe_is_dirty(pf));
+                KASSERT(!pframe_is_busy(pf));
+                KASSERT(!pframe_is_pinned(pf));
+                pframe_free(pf);
+        } list_iterate_end();
+}
+
+/*
+ * Puts an allocated (unpinned) page at the tail of the active or inactive
+ * list and updates the counts.
+ */
+static void
+pframe_lru_insert(pframe_t *pf, int active)
+{
+        if (active) {
+                pf->pf_flags |= PF_ACTIVE;
+                list_insert_tail(&active_list, &pf->pf_link);
+                nactive++;
+        } else {
+                pf->pf_flags &= ~PF_ACTIVE;
+                list_insert_tail(&inactive_list, &pf->pf_link);
+        }
+        nallocated++;
+}
+
+/*
+ * Takes an allocated page off whichever of the active and inactive lists
+ * it is on. pframe_pin should use this (and pframe_unpin
+ * pframe_lru_insert) rather than touching the lists itself.
+ */
+static void
+pframe_lru_remove(pframe_t *pf)
+{
+        list_remove(&pf->pf_link);
+        if (pframe_is_active(pf))
+                nactive--;
+        pf->pf_flags &= ~PF_ACTIVE;
+        nallocated--;
+}
+
+/*
+ * Records a lookup of an allocated page. See the comment on the
+ * allocated lists above.
+ */
+static void
+pframe_referenced(pframe_t *pf)
+{
+        if (!pframe_is_active(pf) && pframe_is_referenced(pf)) {
+                pframe_lru_remove(pf);
+                pframe_clear_referenced(pf);
+                pframe_lru_insert(pf, 1);
+        } else {
+                pframe_set_referenced(pf);
+        }
+}
+
+/*
+ * Moves up to PFRAME_AGE_BATCH pages from the head of the active list to
+ * the inactive list, rotating referenced pages to the tail of the active
+ * list (and clearing their referenced bit) instead.
+ */
+static void
+pframe_age_active(void)
+{
+        int n;
+        pframe_t *pf;
+
+        for (n = 0; n < PFRAME_AGE_BATCH && !list_empty(&active_list); ++n) {
+                pf = list_head(&active_list, pframe_t, pf_link);
+                pframe_lru_remove(pf);
+                if (pframe_is_referenced(pf)) {
+                        pframe_clear_referenced(pf);
+                        pframe_lru_insert(pf, 1);
+                } else {
+                        pframe_lru_insert(pf, 0);
+                }
+        }
+}
+
+/*
+ * Doubles the number of buckets in pframe_hash and rehashes every resident
+ * page into the new table. If there isn't enough memory for a bigger
+ * table we just carry on with the current one; lookups get a little
+ * slower but nothing breaks.
+ *
+ * The new table is allocated without pframe_hash_lock, which is only
+ * held for the rehash; if the table grew meanwhile the new one is given
+ * back.
+ */
+static void
+pframe_hash_grow(void)
+{
+        uint32_t shift = pframe_hash_shift;
+        list_t *old;
+        uint32_t oldsize;
+        uint32_t i;
+        list_t *table;
+        pframe_t *pf;
+
+        /* the largest table the kmalloc large path can hand out */
+        if ((sizeof(list_t) << (shift + 1)) > (PAGE_SIZE << (PAGE_NSIZES - 1)) - sizeof(void *))
+                return;
+        if (NULL == (table = kmalloc(sizeof(list_t) << (shift + 1)))) {
+                dbg(DBG_PFRAME, "WARNING: not enough kernel memory to grow pframe hash\n");
+                return;
+        }
+
+        spin_lock(&pframe_hash_lock);
+        if (shift != pframe_hash_shift) {
+                spin_unlock(&pframe_hash_lock);
+                kfree(table);
+                return;
+        }
+        old = pframe_hash;
+        oldsize = 1U << pframe_hash_shift;
+        pframe_hash = table;
+        pframe_hash_shift++;
+        for (i = 0; i < (1U << pframe_hash_shift); ++i)
+                list_init(&pframe_hash[i]);
+
+        for (i = 0; i < oldsize; ++i) {
+                list_iterate_begin(&old[i], pf, pframe_t, pf_hlink) {
+                        list_remove(&pf->pf_hlink);
+                        list_insert_head(&pframe_hash[hash_page(pf->pf_obj, pf->pf_pagenum)],
+                                         &pf->pf_hlink);
+                } list_iterate_end();
+        }
+        spin_unlock(&pframe_hash_lock);
+        kfree(old);
+
+        dbg(DBG_PFRAME, "pframe hash grown to %u buckets for %u resident pages\n",
+            1U << pframe_hash_shift, pframe_nresident);
+}
+
+/* The statistics of the file system type fs, if there is room for it */
+static pframe_stat_t *
+pframe_stat_fs(fs_t *fs)
+{
+        int i;
+
+        for (i = 0; i < PFRAME_STAT_MAXFS; i++) {
+                if (fs->fs_op == pframe_fsstats[i].pfs_ops)
+                        return &pframe_fsstats[i].pfs_stat;
+                if (NULL == pframe_fsstats[i].pfs_ops) {
+                        pframe_fsstats[i].pfs_ops = fs->fs_op;
+                        strncpy(pframe_fsstats[i].pfs_type, fs->fs_type,
+                                sizeof(pframe_fsstats[i].pfs_type) - 1);
+                        return &pframe_fsstats[i].pfs_stat;
+                }
+        }
+        return NULL;
+}
+
+/* The statistics of the kind of o, and in *fsstat those of the file
+ * system it is a file of, if it is one */
+static pframe_stat_t *
+pframe_stat_of(mmobj_t *o, pframe_stat_t **fsstat)
+{
+        vnode_t *vn;
+
+        *fsstat = NULL;
+        if (NULL != (vn = vnode_of_mmobj(o))) {
+                *fsstat = pframe_stat_fs(vn->vn_fs);
+                return &pframe_stats[PFRAME_STAT_VNODE];
+        }
+        if (o->mmo_ops == pframe_blockdev_ops)
+                return &pframe_stats[PFRAME_STAT_BLOCKDEV];
+        if (anon_is(o))
+                return &pframe_stats[PFRAME_STAT_ANON];
+        if (shadow_is(o))
+                return &pframe_stats[PFRAME_STAT_SHADOW];
+        return &pframe_stats[PFRAME_STAT_OTHER];
+}
+
+void
+pframe_register_blockdev(mmobj_ops_t *ops)
+{
+        KASSERT(NULL == pframe_blockdev_ops || ops == pframe_blockdev_ops);
+        pframe_blockdev_ops = ops;
+}
+
+/* Look a page up in the resident page hash without counting it as used */
+static pframe_t *
+pframe_hash_find(mmobj_t *o, uint32_t pagenum)
+{
+        list_t *hashchain;
+        pframe_t *pf;
+
+        spin_lock(&pframe_hash_lock);
+        hashchain = &pframe_hash[hash_page(o, pagenum)];
+        list_iterate_begin(hashchain, pf, pframe_t, pf_hlink) {
+                if ((o == pf->pf_obj) && (pagenum == pf->pf_pagenum)) {
+                        spin_unlock(&pframe_hash_lock);
+                        return pf;
+                }
+        } list_iterate_end();
+        spin_unlock(&pframe_hash_lock);
+
+        return NULL;
 }
 
 /*
@@ -189,25 +581,16 @@ pframe_shutdown()
 pframe_t *
 pframe_get_resident(struct mmobj *o, uint32_t pagenum)
 {
-        list_t *hashchain;
         pframe_t *pf;
 
-        hashchain = &pframe_hash[hash_page(o, pagenum)];
-        list_iterate_begin(hashchain, pf, pframe_t, pf_hlink) {
-                if ((o == pf->pf_obj) && (pagenum == pf->pf_pagenum)) {
-                        /* found a page with the specified identity. It is
-                         * up to the caller to recognize/care if the page
-                         * is busy. */
-                        if (!pframe_is_pinned(pf)) {
-                                /* send to back of alloc_list */
-                                list_remove(&pf->pf_link);
-                                list_insert_tail(&alloc_list, &pf->pf_link);
-                        }
-                        return pf;
-                }
-        } list_iterate_end();
-
-        return NULL;
+        /* It is up to the caller to recognize/care if the page is busy. */
+        pframe_stat_add(o, ps_probes, 1);
+        if (NULL != (pf = pframe_hash_find(o, pagenum))) {
+                pframe_stat_add(o, ps_probe_hits, 1);
+                if (!pframe_is_pinned(pf))
+                        pframe_referenced(pf);
+        }
+        return pf;
 }
 
 /*
@@ -218,6 +601,11 @@ pframe_get_resident(struct mmobj *o, uint32_t pagenum)
  * page's object, pagenum, and flags, pin count, and links. We also update the
  * object's nrespages.
  *
+ * If free memory is at or below nfreepages_min, we wait for pageoutd to
+ * reclaim some first (pageoutd itself never waits). Once free memory is
+ * at or below nfreepages_low, we wake pageoutd up so it can reclaim in
+ * the background.
+ *
  * @param o the mmobj identifying this page
  * @param pagenum the page number of this page in the object
  *
@@ -227,6 +615,21 @@ static pframe_t *
 pframe_alloc(mmobj_t *o, uint32_t pagenum)
 {
         pframe_t *pf;
+        int grow;
+
+        if (pframe_must_stall()) {
+                pframe_nstalls++;
+                pframe_nstalled++;
+                do {
+                        pageoutd_wakeup();
+                        sched_sleep_on_exclusive(&alloc_waitq);
+                } while (pframe_must_stall());
+                pframe_nstalled--;
+                /* pageoutd only woke the first stalled allocator, so
+                 * let the next try now that there is memory again */
+                sched_broadcast_on(&alloc_waitq);
+        }
+
         if (NULL == (pf = slab_obj_alloc(pframe_allocator))) {
                 dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
                 return NULL;
@@ -237,21 +640,28 @@ pframe_alloc(mmobj_t *o, uint32_t pagenum)
                 return NULL;
         }
 
-        nallocated++;
-        list_insert_tail(&alloc_list, &pf->pf_link);
+        pf->pf_flags = 0;
+        pframe_lru_insert(pf, 0);
 
         pf->pf_obj = o;
         pf->pf_pagenum = pagenum;
-        pf->pf_flags = 0;
-        sched_queue_init(&pf->pf_waitq);
+        KASSERT(sched_queue_empty(&pf->pf_waitq));
         pf->pf_pincount = 0;
 
+        spin_lock(&pframe_hash_lock);
         list_insert_head(&pframe_hash[hash_page(o, pagenum)], &pf->pf_hlink);
+        grow = (++pframe_nresident > ((uint32_t) PF_HASH_LOAD << pframe_hash_shift));
+        spin_unlock(&pframe_hash_lock);
+        if (grow)
+                pframe_hash_grow();
 
         o->mmo_ops->ref(o);
         o->mmo_nrespages++;
         list_insert_head(&o->mmo_respages, &pf->pf_olink);
 
+        if (NULL != pageoutd_thr && pageoutd_needed())
+                pageoutd_wakeup();
+
         return pf;
 }
 
@@ -263,10 +673,16 @@ pframe_alloc(mmobj_t *o, uint32_t pagenum)
 static int
 pframe_fill(pframe_t *pf)
 {
+        uint64_t start;
         int ret;
 
         pframe_set_busy(pf);
+        start = cpuid_rdtsc();
         ret = pf->pf_obj->mmo_ops->fillpage(pf->pf_obj, pf);
+        pframe_stat_add(pf->pf_obj, ps_fill_cycles, cpuid_rdtsc() - start);
+        pframe_stat_add(pf->pf_obj, ps_misses, 1);
+        if (0 > ret)
+                pframe_stat_add(pf->pf_obj, ps_fill_errors, 1);
         pframe_clear_busy(pf);
 
         sched_broadcast_on(&pf->pf_waitq);
@@ -274,12 +690,238 @@ pframe_fill(pframe_t *pf)
         return ret;
 }
 
+/*
+ * Objects whose pages can be read in or written back several at a time
+ * register fillpages and cleanpages routines for their mmobj_ops here
+ * (mmobj_ops_t itself is shared with prebuilt code and cannot grow new
+ * entry points), as do the users of the write ordering hooks.
+ */
+#define PFRAME_BATCHOPS_MAX     4
+
+static struct {
+        mmobj_ops_t            *pb_ops;
+        pframe_fillpages_t      pb_fill;
+        pframe_cleanpages_t     pb_clean;
+        pframe_dirtied_t        pb_dirtied;
+        pframe_preclean_t       pb_preclean;
+        pframe_dirtylist_t      pb_dirtylist;
+} pframe_batchops[PFRAME_BATCHOPS_MAX];
+
+static int
+pframe_batchops_slot(mmobj_ops_t *ops)
+{
+        int i;
+
+        for (i = 0; i < PFRAME_BATCHOPS_MAX; i++) {
+                if (NULL == pframe_batchops[i].pb_ops
+                    || ops == pframe_batchops[i].pb_ops) {
+                        pframe_batchops[i].pb_ops = ops;
+                        return i;
+                }
+        }
+        panic("too many multi-page mmobj routines registered\n");
+        return -1;
+}
+
+void
+pframe_register_fillpages(mmobj_ops_t *ops, pframe_fillpages_t fn)
+{
+        pframe_batchops[pframe_batchops_slot(ops)].pb_fill = fn;
+}
+
+void
+pframe_register_cleanpages(mmobj_ops_t *ops, pframe_cleanpages_t fn)
+{
+        pframe_batchops[pframe_batchops_slot(ops)].pb_clean = fn;
+}
+
+void
+pframe_register_dirtied(mmobj_ops_t *ops, pframe_dirtied_t fn)
+{
+        pframe_batchops[pframe_batchops_slot(ops)].pb_dirtied = fn;
+}
+
+void
+pframe_register_preclean(mmobj_ops_t *ops, pframe_preclean_t fn)
+{
+        pframe_batchops[pframe_batchops_slot(ops)].pb_preclean = fn;
+}
+
+void
+pframe_register_dirtylist(mmobj_ops_t *ops, pframe_dirtylist_t fn)
+{
+        pframe_batchops[pframe_batchops_slot(ops)].pb_dirtylist = fn;
+}
+
+static int
+pframe_batchops_lookup(mmobj_ops_t *ops)
+{
+        int i;
+
+        for (i = 0; i < PFRAME_BATCHOPS_MAX && NULL != pframe_batchops[i].pb_ops; i++) {
+                if (ops == pframe_batchops[i].pb_ops)
+                        return i;
+        }
+        return -1;
+}
+
+static pframe_fillpages_t
+pframe_fillpages_lookup(mmobj_ops_t *ops)
+{
+        int i = pframe_batchops_lookup(ops);
+        return (0 > i) ? NULL : pframe_batchops[i].pb_fill;
+}
+
+static pframe_cleanpages_t
+pframe_cleanpages_lookup(mmobj_ops_t *ops)
+{
+        int i = pframe_batchops_lookup(ops);
+        return (0 > i) ? NULL : pframe_batchops[i].pb_clean;
+}
+
+static pframe_dirtied_t
+pframe_dirtied_lookup(mmobj_ops_t *ops)
+{
+        int i = pframe_batchops_lookup(ops);
+        return (0 > i) ? NULL : pframe_batchops[i].pb_dirtied;
+}
+
+static pframe_preclean_t
+pframe_preclean_lookup(mmobj_ops_t *ops)
+{
+        int i = pframe_batchops_lookup(ops);
+        return (0 > i) ? NULL : pframe_batchops[i].pb_preclean;
+}
+
+static pframe_dirtylist_t
+pframe_dirtylist_lookup(mmobj_ops_t *ops)
+{
+        int i = pframe_batchops_lookup(ops);
+        return (0 > i) ? NULL : pframe_batchops[i].pb_dirtylist;
+}
+
+/* Puts a page which has just been dirtied on the dirty lists, unless it
+ * is still there from before */
+static void
+pframe_dirtylists_add(pframe_t *pf)
+{
+        pframe_dirtylist_t dl;
+
+        if (!list_link_is_linked(&pf->pf_gdlink)) {
+                pf->pf_dirtied = jiffies;
+                if (swap_backed(pf->pf_obj)) {
+                        list_insert_tail(&dirty_swap_list, &pf->pf_gdlink);
+                        nswapdirty++;
+                } else {
+                        list_insert_tail(&dirty_list, &pf->pf_gdlink);
+                        if (++ndirty == ndirty_background + 1 && NULL != pflushd_thr)
+                                pflushd_wakeup();
+                }
+        }
+        if (!list_link_is_linked(&pf->pf_dlink)
+            && NULL != (dl = pframe_dirtylist_lookup(pf->pf_obj->mmo_ops)))
+                list_insert_tail(dl(pf->pf_obj), &pf->pf_dlink);
+}
+
+/* Takes a page which has been written back clean, or is being freed
+ * (and so still has its object), off the dirty lists */
+static void
+pframe_dirtylists_remove(pframe_t *pf)
+{
+        if (list_link_is_linked(&pf->pf_gdlink)) {
+                list_remove(&pf->pf_gdlink);
+                if (swap_backed(pf->pf_obj))
+                        nswapdirty--;
+                else
+                        ndirty--;
+        }
+        if (list_link_is_linked(&pf->pf_dlink))
+                list_remove(&pf->pf_dlink);
+}
+
+/*
+ * Read pages [pagenum, pagenum + npages) of 'o' into the cache ahead of
+ * their use. Resident pages are skipped. All missing pages are allocated
+ * and marked busy before any of them is filled, so that a thread looking
+ * one of them up meanwhile waits for it rather than reading it in a
+ * second time. Runs of consecutive missing pages are read with the
+ * object's registered fillpages routine, if it has one, so the device
+ * sees one request per run. Pages that fail to fill are freed again.
+ * Readahead stops early rather than push free memory below the low
+ * watermark.
+ *
+ * This routine can block at the mmobj operation level.
+ * @param o the object whose pages are read
+ * @param pagenum the first page to read
+ * @param npages the number of pages to read, at most READAHEAD_MAX_PAGES
+ * @return the number of pages, starting at pagenum, that were dealt with
+ */
+uint32_t
+pframe_prefetch(mmobj_t *o, uint32_t pagenum, uint32_t npages)
+{
+        pframe_t *pfs[READAHEAD_MAX_PAGES];
+        pframe_fillpages_t fn;
+        uint32_t i, j, k, n = 0;
+
+        KASSERT(npages <= READAHEAD_MAX_PAGES);
+
+        /* nothing below blocks until every page is busy, and staying
+         * above the low mark means pframe_alloc never stalls */
+        for (i = 0; i < npages; i++) {
+                if (NULL != pframe_hash_find(o, pagenum + i))
+                        continue;
+                if (page_free_count() <= nfreepages_low)
+                        break;
+                if (NULL == (pfs[n] = pframe_alloc(o, pagenum + i)))
+                        break;
+                pframe_set_busy(pfs[n]);
+                n++;
+        }
+        npages = i;
+
+        fn = pframe_fillpages_lookup(o->mmo_ops);
+        for (i = 0; i < n; i = j) {
+                uint64_t start;
+                int ret;
+
+                /* read each run of consecutive pages in one go if we can */
+                j = i + 1;
+                if (NULL != fn) {
+                        while (j < n && pfs[j]->pf_pagenum == pfs[j - 1]->pf_pagenum + 1)
+                                j++;
+                }
+                start = cpuid_rdtsc();
+                if (1 < j - i)
+                        ret = fn(o, &pfs[i], j - i);
+                else
+                        ret = o->mmo_ops->fillpage(o, pfs[i]);
+                pframe_stat_add(o, ps_fill_cycles, cpuid_rdtsc() - start);
+                pframe_stat_add(o, ps_readahead, j - i);
+                if (0 > ret)
+                        pframe_stat_add(o, ps_fill_errors, j - i);
+
+                for (k = i; k < j; k++) {
+                        pframe_t *pf = pfs[k];
+
+                        pframe_clear_busy(pf);
+                        sched_broadcast_on(&pf->pf_waitq);
+                        if (0 > ret) {
+                                dbg(DBG_PFRAME, "readahead of page %d of obj %p failed\n",
+                                    pf->pf_pagenum, pf->pf_obj);
+                                pframe_free(pf);
+                        }
+                }
+        }
+
+        return npages;
+}
+
 /*
  * Find and return the pframe representing the page identified by the object
  * and page number. If the page is already resident in memory, then we return
  * the existing page. Otherwise, we allocate a new page and fill it (in which
- * case this routine may block). After allocating the new pframe, we check to
- * see if we need to call pageoutd and wake it up if necessary.
+ * case this routine may block). pframe_alloc checks whether pageoutd needs
+ * to run (or whether we must wait for it) when allocating the new pframe.
  *
  * If the page is found (resident) but busy, then we will wait for it to become
  * unbusy and then try again (since it may have been freed after that). Thus,
@@ -297,6 +939,8 @@ pframe_fill(pframe_t *pf)
 int
 pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result)
 {
+        TRACE(TRACE_PFRAME_GET, o, pagenum, 0);
+        pframe_stat_add(o, ps_lookups, 1);
         NOT_YET_IMPLEMENTED("S5FS: pframe_get");
         return 0;
 }
@@ -313,7 +957,8 @@ pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result
 /*
  * Migrate a page frame up the tree. The destination must be on the same
  * branch as the pframe's current object. pf must not be busy. If dest
- * already has a page with the same number as pf clean pf.
+ * already has a page with the same number as pf, resident or in swap,
+ * pf is freed instead.
  *
  * @param pf page to be migrated
  * @param dest destination vm object
@@ -322,33 +967,64 @@ void
 pframe_migrate(pframe_t *pf, mmobj_t *dest)
 {
         KASSERT(!pframe_is_busy(pf));
-        if (NULL != pframe_get_resident(dest, pf->pf_pagenum)) {
-                /* dest already has a newer version of the page, clean this page */
-                pframe_unpin(pf);
-                pframe_clean(pf);
+        if (NULL != pframe_get_resident(dest, pf->pf_pagenum)
+            || swap_holds(dest, pf->pf_pagenum)) {
+                /* dest already has a newer version of the page, so this
+                 * one is thrown away rather than written out */
+                if (pframe_is_pinned(pf))
+                        pframe_unpin(pf);
                 pframe_free(pf);
         } else {
                 mmobj_t *src = pf->pf_obj;
-                pf->pf_obj = dest;
+                spin_lock(&pframe_hash_lock);
                 list_remove(&pf->pf_hlink);
+                pf->pf_obj = dest;
+                list_insert_head(&pframe_hash[hash_page(dest, pf->pf_pagenum)], &pf->pf_hlink);
+                spin_unlock(&pframe_hash_lock);
                 list_remove(&pf->pf_olink);
                 src->mmo_nrespages--;
                 src->mmo_ops->put(src);
-                list_insert_head(&pframe_hash[hash_page(dest, pf->pf_pagenum)], &pf->pf_hlink);
                 list_insert_head(&dest->mmo_respages, &pf->pf_olink);
                 dest->mmo_nrespages++;
                 dest->mmo_ops->ref(dest);
+                /* it keeps its place on dirty_swap_list, as both objects
+                 * are in a shadow chain and swap */
+                KASSERT(swap_backed(src) && swap_backed(dest));
+                if (list_link_is_linked(&pf->pf_dlink))
+                        list_remove(&pf->pf_dlink);
+                if (list_link_is_linked(&pf->pf_gdlink))
+                        pframe_dirtylists_add(pf);
         }
 }
 
+/*
+ * Waits until the page is not busy. The waiters sleep exclusively, so
+ * that when it stops being busy only the first is woken instead of all
+ * of them, most of which would usually find it busy again and go straight
+ * back to sleep. Each in turn passes the wakeup on to the next once it
+ * has found the page not busy, and will be running before that one is.
+ *
+ * @param pf the page to wait for
+ */
+void
+pframe_wait_busy(pframe_t *pf)
+{
+        if (!pframe_is_busy(pf))
+                return;
+        do {
+                sched_sleep_on_exclusive(&pf->pf_waitq);
+        } while (pframe_is_busy(pf));
+        sched_broadcast_on(&pf->pf_waitq);
+}
+
 /*
  * Increases the pin count on this page. Pages with a pin count > 0 will not be
  * paged out by pageoutd, so this ensures that the page will remain resident
  * until the pin count is decreased.
  *
  * If the pframe has not yet been pinned, remove this pframe's list link from
- * the allocated list and add it to the pinned list.  Be sure to decrement
- * nallocated and increment npinned.
+ * the active or inactive list with pframe_lru_remove (which decrements
+ * nallocated) and add it to the pinned list.  Be sure to increment npinned.
  *
  * In either case, increment the pf_pincount.
  *
@@ -365,8 +1041,9 @@ pframe_pin(pframe_t *pf)
  * page could be paged out any time after the calling context blocks.
  *
  * If the pin count reaches zero, move the pframe's list link from the pinned
- * list to the allocated list.  Be sure to correctly update npinned and
- * nallocated
+ * list to the tail of the active list (the page was just in use) with
+ * pframe_lru_insert, which updates nallocated. Be sure to correctly update
+ * npinned.
  *
  * @param pf a pinned page (a page with a positive pin count)
  */
@@ -376,6 +1053,26 @@ pframe_unpin(pframe_t *pf)
         NOT_YET_IMPLEMENTED("S5FS: pframe_unpin");
 }
 
+/*
+ * Makes a page the first one pageoutd reclaims, as though it had not been
+ * used for longer than any other: it goes to the head of the inactive
+ * list without its referenced bit. Used for pages which are not going to
+ * be needed again soon. Pinned, free and busy pages are left alone.
+ *
+ * @param pf the page to deactivate
+ */
+void
+pframe_deactivate(pframe_t *pf)
+{
+        if (pframe_is_pinned(pf) || pframe_is_free(pf) || pframe_is_busy(pf))
+                return;
+
+        pframe_lru_remove(pf);
+        pframe_clear_referenced(pf);
+        list_insert_head(&inactive_list, &pf->pf_link);
+        nallocated++;
+}
+
 /*
  * Indicates that a page is about to be modified. This should be called on a
  * page before any attempt to modify its contents. This marks the page dirty
@@ -398,7 +1095,12 @@ pframe_dirty(pframe_t *pf)
         pframe_set_busy(pf);
 
         if (!(ret = pf->pf_obj->mmo_ops->dirtypage(pf->pf_obj, pf))) {
+                pframe_dirtied_t dirtied = pframe_dirtied_lookup(pf->pf_obj->mmo_ops);
+
                 pframe_set_dirty(pf);
+                pframe_dirtylists_add(pf);
+                if (NULL != dirtied)
+                        dirtied(pf->pf_obj, pf);
         }
         pframe_clear_busy(pf);
         sched_broadcast_on(&pf->pf_waitq);
@@ -406,10 +1108,24 @@ pframe_dirty(pframe_t *pf)
         return ret;
 }
 
+/*
+ * Marks a page dirty whose contents have to be written back even though
+ * it was not written to, without calling the dirtypage mmobj entry point
+ * (swap does this to a page it has dropped the only other copy of).
+ *
+ * @param pf the page to mark dirty
+ */
+void
+pframe_mark_dirty(pframe_t *pf)
+{
+        pframe_set_dirty(pf);
+        pframe_dirtylists_add(pf);
+}
+
 /*
  * Clean a dirty page by writing it back to disk. Removes the dirty
  * bit of the page and updates the MMU entry.
- * The page must be dirty but unpinned.
+ * The page must be dirty.
  *
  * This routine can block at the mmobj operation level.
  * @param pf the page to clean
@@ -418,33 +1134,124 @@ pframe_dirty(pframe_t *pf)
 int
 pframe_clean(pframe_t *pf)
 {
-        int ret;
+        return pframe_clean_batch(&pf, 1);
+}
+
+/* Orders pages by object and then by page number within the object */
+static int
+pframe_clean_before(pframe_t *a, pframe_t *b)
+{
+        if (a->pf_obj != b->pf_obj)
+                return (uintptr_t) a->pf_obj < (uintptr_t) b->pf_obj;
+        return a->pf_pagenum < b->pf_pagenum;
+}
+
+/*
+ * Clean up to PFRAME_CLEAN_BATCH dirty, non-busy pages. The
+ * pages are sorted by object and page number, and each run of
+ * consecutive pages of one object is handed to that object's registered
+ * cleanpages routine in a single call, so the underlying device sees a
+ * few long ascending writes instead of many scattered page-sized ones.
+ * Objects without one are cleaned a page at a time. The pages of a run
+ * are only marked busy (and clean) while the run is being written, since
+ * writing one run may dirty the pages of another: a file system which
+ * picks disk blocks at writeback time updates its metadata then. The
+ * rest of the batch is kept pinned meanwhile. An object's registered
+ * preclean hook runs with the run marked busy, just before it is written.
+ * Pages pinned by their users may be cleaned too (pageoutd leaves them
+ * alone, but fsync(2) has to write them), since cleaning them does not
+ * take them away.
+ *
+ * This routine can block at the mmobj operation level.
+ * @param pfs the pages to clean; the array is reordered
+ * @param npages the number of pages in pfs
+ * @return 0 on success, or the first -errno encountered
+ */
+int
+pframe_clean_batch(pframe_t **pfs, int npages)
+{
+        int i, j, k, ret, err = 0;
 
-        KASSERT(pframe_is_dirty(pf) && "Cleaning page that isn't dirty!");
-        KASSERT(pf->pf_pincount == 0 && "Cleaning a pinned page!");
+        KASSERT(0 < npages && npages <= PFRAME_CLEAN_BATCH);
 
-        dbg(DBG_PFRAME, "cleaning page %d of obj %p\n", pf->pf_pagenum, pf->pf_obj);
+        for (i = 1; i < npages; i++) {
+                pframe_t *pf = pfs[i];
+                for (j = i; j > 0 && pframe_clean_before(pf, pfs[j - 1]); j--)
+                        pfs[j] = pfs[j - 1];
+                pfs[j] = pf;
+        }
 
-        /*
-         * Clear the dirty bit *before* we potentially (depending on this
-         * particular object type's 'dirtypage' implementation) block so
-         * that if the page is dirtied again while we're writing it out,
-         * we won't (incorrectly) think the page has been fully cleaned.
-         */
-        pframe_clear_dirty(pf);
+        for (i = 0; i < npages; i++) {
+                pframe_t *pf = pfs[i];
 
-        /* Make sure a future write to the page will fault (and hence dirty it) */
-        tlb_flush((uintptr_t) pf->pf_addr);
-        pframe_remove_from_pts(pf);
+                KASSERT(pframe_is_dirty(pf) && "Cleaning page that isn't dirty!");
+                KASSERT(!pframe_is_busy(pf));
 
-        pframe_set_busy(pf);
-        if ((ret = pf->pf_obj->mmo_ops->cleanpage(pf->pf_obj, pf)) < 0) {
-                pframe_set_dirty(pf);
+                pframe_pin(pf);
         }
-        pframe_clear_busy(pf);
-        sched_broadcast_on(&pf->pf_waitq);
 
-        return ret;
+        for (i = 0; i < npages; i = j) {
+                mmobj_t *o = pfs[i]->pf_obj;
+                pframe_cleanpages_t fn = pframe_cleanpages_lookup(o->mmo_ops);
+                pframe_preclean_t pre = pframe_preclean_lookup(o->mmo_ops);
+
+                j = i + 1;
+                if (NULL != fn) {
+                        while (j < npages && pfs[j]->pf_obj == o
+                               && pfs[j]->pf_pagenum == pfs[j - 1]->pf_pagenum + 1)
+                                j++;
+                }
+
+                for (k = i; k < j; k++) {
+                        pframe_t *pf = pfs[k];
+
+                        /* an earlier run may have been waiting on it */
+                        pframe_wait_busy(pf);
+                        KASSERT(pframe_is_dirty(pf));
+
+                        dbg(DBG_PFRAME, "cleaning page %d of obj %p\n", pf->pf_pagenum, pf->pf_obj);
+
+                        /*
+                         * Clear the dirty bit *before* we potentially (depending on this
+                         * particular object type's 'dirtypage' implementation) block so
+                         * that if the page is dirtied again while we're writing it out,
+                         * we won't (incorrectly) think the page has been fully cleaned.
+                         */
+                        pframe_clear_dirty(pf);
+
+                        /* Make sure a future write to the page will fault (and hence dirty it) */
+                        tlb_flush((uintptr_t) pf->pf_addr);
+                        pframe_remove_from_pts(pf);
+
+                        pframe_set_busy(pf);
+                }
+
+                if (NULL != pre && 0 > (ret = pre(o, &pfs[i], j - i))) {
+                        /* not written */
+                } else if (1 < j - i) {
+                        ret = fn(o, &pfs[i], j - i);
+                } else {
+                        ret = o->mmo_ops->cleanpage(o, pfs[i]);
+                }
+
+                if (0 <= ret)
+                        pframe_stat_add(o, ps_writebacks, j - i);
+                for (k = i; k < j; k++) {
+                        if (ret < 0)
+                                pframe_set_dirty(pfs[k]);
+                        else if (!pframe_is_dirty(pfs[k]))
+                                pframe_dirtylists_remove(pfs[k]);
+                        pframe_clear_busy(pfs[k]);
+                        sched_broadcast_on(&pfs[k]->pf_waitq);
+                }
+                if (ret < 0 && !err)
+                        err = ret;
+        }
+
+        for (i = 0; i < npages; i++)
+                pframe_unpin(pfs[i]);
+
+        return err;
 }
 
 /*
@@ -472,13 +1279,22 @@ pframe_free(pframe_t *pf)
         /* Remove from all pagetables that map it */
         pframe_remove_from_pts(pf);
 
+        spin_lock(&pframe_hash_lock);
         list_remove(&pf->pf_hlink);
+        pframe_nresident--;
+        spin_unlock(&pframe_hash_lock);
 
+        pframe_dirtylists_remove(pf);
         pf->pf_obj = NULL;
-        nallocated--;
-        list_remove(&pf->pf_link);
-
-        page_free(pf->pf_addr);
+        pframe_lru_remove(pf);
+        /* exclusive waiters which have not had their turn would never
+         * otherwise be woken */
+        sched_wakeup_all(&pf->pf_waitq);
+
+        if (pframe_is_merged(pf))
+                ksm_release(pf);
+        else
+                page_free(pf->pf_addr);
         slab_obj_free(pframe_allocator, pf);
 
         o->mmo_nrespages--;
@@ -490,6 +1306,65 @@ pframe_free(pframe_t *pf)
         o->mmo_ops->put(o);
 }
 
+/*
+ * Append the dirty, non-busy pages of 'list' to 'pfs' (which already holds
+ * 'npages' pages), stopping when it holds PFRAME_CLEAN_BATCH. If 'skipref'
+ * is set, pages that have been referenced since they were last looked at
+ * are left alone. The first busy page seen is stored in *busy if *busy is
+ * NULL. Returns the new number of pages in 'pfs'.
+ */
+static int
+pframe_gather_dirty(list_t *list, pframe_t **pfs, int npages, int skipref,
+                    pframe_t **busy)
+{
+        list_link_t *link;
+
+        for (link = list->l_next;
+             link != list && npages < PFRAME_CLEAN_BATCH; link = link->l_next) {
+                pframe_t *pf = list_item(link, pframe_t, pf_link);
+
+                KASSERT(!pframe_is_pinned(pf));
+                KASSERT(!pframe_is_free(pf));
+                if (pframe_is_busy(pf)) {
+                        if (NULL == *busy)
+                                *busy = pf;
+                } else if (pframe_is_dirty(pf)
+                           && !(skipref && pframe_is_referenced(pf))) {
+                        pfs[npages++] = pf;
+                }
+        }
+
+        return npages;
+}
+
+/*
+ * Like pframe_gather_dirty, for a list of pages linked by the list link
+ * at 'linkoff' in pframe_t, leaving out pinned pages if 'skippinned' is
+ * set.
+ */
+static int
+pframe_gather_dirtylist(list_t *list, size_t linkoff, int skippinned,
+                        pframe_t **pfs, int npages, pframe_t **busy)
+{
+        list_link_t *link;
+
+        for (link = list->l_next;
+             link != list && npages < PFRAME_CLEAN_BATCH; link = link->l_next) {
+                pframe_t *pf = (pframe_t *) ((char *) link - linkoff);
+
+                if (skippinned && pframe_is_pinned(pf))
+                        continue;
+                if (pframe_is_busy(pf)) {
+                        if (NULL == *busy)
+                                *busy = pf;
+                } else if (pframe_is_dirty(pf)) {
+                        pfs[npages++] = pf;
+                }
+        }
+
+        return npages;
+}
+
 /*
  * Clean all allocated pages (that is, all pages that are not pinned and
  * not free). This is called by sync(2).
@@ -497,29 +1372,39 @@ pframe_free(pframe_t *pf)
 void
 pframe_clean_all()
 {
-        pframe_t *pf;
-        dbg(DBG_PFRAME, "pframe_clean_all: starting (this may take a while)\n");
+        pframe_t *pfs[PFRAME_CLEAN_BATCH];
+        pframe_t *busy;
+        int npages;
+
+        dbg(DBG_PFRAME, "pframe_clean_all: starting (%u dirty pages)\n", ndirty + nswapdirty);
 
         /*
-         * Iterate from head of alloc_list to tail; This is a rough attempt to
-         * sync from least active to most active. Note that every time we block we
-         * need to start the loop over as the "current element" pf may have been
-         * moved or removed in the meantime (our list has no multithreaded
-         * integrity)
+         * Gather dirty pages from the head of the dirty lists, file pages
+         * first, so the pages dirtied longest ago (the ones a crash would
+         * lose first) are written first, and write each batch back sorted
+         * and coalesced.
+         * Clean pages are never looked at. Note that every time we block
+         * we need to start the gathering over as the pages may have been
+         * moved or removed in the meantime (our lists have no
+         * multithreaded integrity)
          */
-list_start:
-        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
-                KASSERT(!pframe_is_pinned(pf));
-                KASSERT(!pframe_is_free(pf));
-                if (pframe_is_busy(pf)) {
-                        sched_sleep_on(&pf->pf_waitq);
-                        goto list_start;
-                }
-                if (pframe_is_dirty(pf)) {
-                        pframe_clean(pf);
-                        goto list_start;
+        while (1) {
+                busy = NULL;
+                npages = pframe_gather_dirtylist(&dirty_list, offsetof(pframe_t, pf_gdlink),
+                                                 1, pfs, 0, &busy);
+                npages = pframe_gather_dirtylist(&dirty_swap_list, offsetof(pframe_t, pf_gdlink),
+                                                 1, pfs, npages, &busy);
+
+                if (0 < npages) {
+                        pframe_clean_batch(pfs, npages);
+                } else if (NULL != busy) {
+                        pframe_wait_busy(busy);
+                } else {
+                        break;
                 }
-        } list_iterate_end();
+                /* the gathering starts over anyway */
+                sched_cond_resched();
+        }
 
         /* In theory, this function might never terminate (if new pages are
          * constantly being added at the same time). That's why the user shouldn't
@@ -527,6 +1412,210 @@ list_start:
         dbg(DBG_PFRAME, "pframe_clean_all: completed!\n");
 }
 
+/*
+ * Clean every dirty page of 'o', waiting for those already being written
+ * back, as fsync(2) does for a file. If the object keeps a dirty list only
+ * that is looked at, otherwise all of its resident pages are. As in
+ * pframe_clean_all, the list is gathered from again whenever we block.
+ *
+ * @return 0 on success, or the first -errno encountered
+ */
+int
+pframe_clean_obj(mmobj_t *o)
+{
+        pframe_dirtylist_t dl = pframe_dirtylist_lookup(o->mmo_ops);
+        pframe_t *pfs[PFRAME_CLEAN_BATCH];
+        pframe_t *busy;
+        int npages, ret;
+
+        while (1) {
+                busy = NULL;
+                if (NULL != dl)
+                        npages = pframe_gather_dirtylist(dl(o), offsetof(pframe_t, pf_dlink),
+                                                         0, pfs, 0, &busy);
+                else
+                        npages = pframe_gather_dirtylist(&o->mmo_respages,
+                                                         offsetof(pframe_t, pf_olink),
+                                                         0, pfs, 0, &busy);
+
+                if (0 < npages) {
+                        /* the pages which failed are still dirty, and
+                         * would only fail again */
+                        if (0 > (ret = pframe_clean_batch(pfs, npages)))
+                                return ret;
+                } else if (NULL != busy) {
+                        pframe_wait_busy(busy);
+                } else {
+                        return 0;
+                }
+        }
+}
+
+/*
+ * Write back the oldest dirty file pages until no more than 'limit' are
+ * left and, if 'expire' is set, none has been dirty for longer than
+ * PFLUSHD_EXPIRE_MSECS. Pinned pages, and pages someone else is writing
+ * back, are left alone. Stops at the first error, the pages which failed
+ * keeping their place on the list for next time.
+ *
+ * This routine can block at the mmobj operation level.
+ * @return the number of pages written back
+ */
+static uint32_t
+pframe_writeback(uint32_t limit, int expire)
+{
+        pframe_t *pfs[PFRAME_CLEAN_BATCH];
+        list_link_t *link;
+        uint32_t nwritten = 0;
+        int npages;
+
+        while (1) {
+                npages = 0;
+                for (link = dirty_list.l_next;
+                     link != &dirty_list && npages < PFRAME_CLEAN_BATCH; link = link->l_next) {
+                        pframe_t *pf = list_item(link, pframe_t, pf_gdlink);
+
+                        /* the list is in pf_dirtied order */
+                        if (ndirty - npages <= limit
+                            && (!expire || jiffies - pf->pf_dirtied
+                                < MSECS_TO_TICKS(PFLUSHD_EXPIRE_MSECS)))
+                                break;
+                        if (!pframe_is_pinned(pf) && !pframe_is_busy(pf) && pframe_is_dirty(pf))
+                                pfs[npages++] = pf;
+                }
+
+                if (0 == npages || 0 > pframe_clean_batch(pfs, npages))
+                        return nwritten;
+                nwritten += npages;
+        }
+}
+
+/*
+ * Called by writers once they have dirtied file pages, when they hold
+ * nothing that writing those pages back could need. If there are more
+ * than ndirty_throttle dirty file pages, the writer writes back the
+ * oldest itself, down to ndirty_throttle, and so cannot dirty memory
+ * faster than it can be written back; pflushd is woken to bring the
+ * count down further.
+ */
+void
+pframe_throttle(void)
+{
+        if (ndirty <= ndirty_throttle)
+                return;
+
+        pframe_nthrottled++;
+        if (NULL != pflushd_thr)
+                pflushd_wakeup();
+        pframe_writeback(ndirty_throttle, 0);
+}
+
+/*
+ * Calls fn on every resident page which is not pinned, the active list
+ * (the pages used most recently) first. fn must not block, or free or
+ * pin the page.
+ */
+void
+pframe_walk(void (*fn)(pframe_t *pf, void *arg), void *arg)
+{
+        pframe_t *pf;
+
+        list_iterate_begin(&active_list, pf, pframe_t, pf_link) {
+                fn(pf, arg);
+        } list_iterate_end();
+        list_iterate_begin(&inactive_list, pf, pframe_t, pf_link) {
+                fn(pf, arg);
+        } list_iterate_end();
+}
+
+/*
+ * Debug info function, prints the page cache's list sizes, the pageout
+ * watermarks and the reclaim statistics.
+ */
+size_t
+pframe_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        iprintf(&buf, &size, "free pages:     %u (min %u, low %u, target %u)\n",
+                page_free_count(), nfreepages_min, nfreepages_low, nfreepages_target);
+        iprintf(&buf, &size, "resident pages: %u (active %d, inactive %d, pinned %d)\n",
+                pframe_nresident, nactive, nallocated - nactive, npinned);
+        iprintf(&buf, &size, "dirty pages:    %u file (background %u, throttle %u), %u swap",
+                ndirty, ndirty_background, ndirty_throttle, nswapdirty);
+        if (0 < ndirty) {
+                pframe_t *oldest = list_head(&dirty_list, pframe_t, pf_gdlink);
+                iprintf(&buf, &size, " (oldest file page dirtied %u ticks ago)",
+                        jiffies - oldest->pf_dirtied);
+        }
+        iprintf(&buf, &size, "\n");
+        iprintf(&buf, &size, "writeback:      %u pages by pflushd, %u writes throttled\n",
+                pframe_nflushed, pframe_nthrottled);
+        iprintf(&buf, &size, "pageoutd:       %u wakeups, %u pages reclaimed\n",
+                pframe_nwakeups, pframe_nreclaimed);
+        iprintf(&buf, &size, "stalls:         %u allocations waited, %u waiting now\n",
+                pframe_nstalls, pframe_nstalled);
+
+        return size;
+}
+
+/* What part of whole part is, in percent, without overflowing */
+static uint32_t
+pframe_stat_percent(uint32_t part, uint32_t whole)
+{
+        if (0 == whole)
+                return 0;
+        if (whole > 0xffffffffU / 100)
+                return part / (whole / 100);
+        return part * 100 / whole;
+}
+
+static void
+pframe_stat_line(char **buf, size_t *size, const char *name,
+                 const char *type, const pframe_stat_t *ps)
+{
+        iprintf(buf, size, "%-6s %-10s %8u %3u%% %8u %3u%% %8u %6u %8u %8u %8u\n",
+                name, type, ps->ps_lookups,
+                pframe_stat_percent(ps->ps_lookups - ps->ps_misses, ps->ps_lookups),
+                ps->ps_probes, pframe_stat_percent(ps->ps_probe_hits, ps->ps_probes),
+                ps->ps_readahead, ps->ps_fill_errors,
+                math_average(ps->ps_fill_cycles, ps->ps_misses + ps->ps_readahead),
+                ps->ps_evictions, ps->ps_writebacks);
+}
+
+/*
+ * Debug info function, prints the page cache statistics of each kind of
+ * object, and of the files of each type of file system.
+ */
+size_t
+pframe_stat_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        int i;
+
+        iprintf(&buf, &size, "%-17s %8s %4s %8s %4s %8s %6s %8s %8s %8s\n",
+                "", "lookups", "hit", "probes", "hit", "readahd", "errors",
+                "cyc/fill", "evicted", "written");
+        for (i = 0; i < PFRAME_STAT_NKINDS; i++)
+                pframe_stat_line(&buf, &size, "kind", pframe_stat_names[i],
+                                 &pframe_stats[i]);
+        for (i = 0; i < PFRAME_STAT_MAXFS && NULL != pframe_fsstats[i].pfs_ops; i++)
+                pframe_stat_line(&buf, &size, "fs", pframe_fsstats[i].pfs_type,
+                                 &pframe_fsstats[i].pfs_stat);
+
+        return size;
+}
+
+void
+pframe_stat_reset(void)
+{
+        int i;
+
+        memset(pframe_stats, 0, sizeof(pframe_stats));
+        for (i = 0; i < PFRAME_STAT_MAXFS; i++)
+                memset(&pframe_fsstats[i].pfs_stat, 0, sizeof(pframe_stat_t));
+}
+
 /* Remove a page frame from the page tables of all processes that map it
  * To do that, traverse all processes that map the given page frame into
  * their address space, and zero the corresponding address entry.
@@ -534,7 +1623,10 @@ list_start:
 void
 pframe_remove_from_pts(pframe_t *pf)
 {
+        tlb_batch_t tb;
         vmarea_t *vma;
+
+        tlb_batch_init(&tb);
         list_iterate_begin(mmobj_bottom_vmas(pf->pf_obj), vma, vmarea_t, vma_olink) {
                 /* Get the virtual address in the area corresponding to this pf */
                 if ((pf->pf_pagenum >= vma->vma_off)
@@ -543,10 +1635,113 @@ pframe_remove_from_pts(pframe_t *pf)
                         /* And unmap it from that area's proc */
                         if (NULL != vma->vma_vmmap->vmm_proc) {
                                 pt_unmap(vma->vma_vmmap->vmm_proc->p_pagedir, vaddr);
+                                /* other processes' entries go when
+                                 * they are next switched to, unless
+                                 * they are running elsewhere */
+                                if (curproc == vma->vma_vmmap->vmm_proc)
+                                        tlb_batch_add(&tb, vaddr);
+                                else
+                                        tlb_shootdown(vma->vma_vmmap->vmm_proc->p_pagedir,
+                                                      vaddr, 1);
                         }
                 }
 
         } list_iterate_end();
+        tlb_batch_flush(&tb);
+}
+
+struct pframe_relocation {
+        uintptr_t       pr_start;
+        uintptr_t       pr_end;
+        void          **pr_pages;       /* new frames to move pages into */
+        uint32_t        pr_npages;      /* how many are left */
+        uint32_t        pr_nmovable;
+};
+
+/* Whether the page's frame is in the range and could be moved: the
+ * page is on the LRU lists, so it is not pinned, and one which is busy
+ * may be being read or written by a device */
+static inline int
+pframe_relocatable(pframe_t *pf, struct pframe_relocation *pr)
+{
+        return (uintptr_t) pf->pf_addr >= pr->pr_start
+               && (uintptr_t) pf->pf_addr < pr->pr_end
+               && !pframe_is_busy(pf) && !pframe_is_merged(pf);
+}
+
+static void
+pframe_relocate_count(pframe_t *pf, void *arg)
+{
+        struct pframe_relocation *pr = arg;
+
+        if (pframe_relocatable(pf, pr))
+                pr->pr_nmovable++;
+}
+
+/* Unmaps the page first, so that nothing writes the old frame after
+ * it has been copied; the mappings come back from the fault handler */
+static void
+pframe_relocate_one(pframe_t *pf, void *arg)
+{
+        struct pframe_relocation *pr = arg;
+        void *old = pf->pf_addr;
+
+        if (0 == pr->pr_npages || !pframe_relocatable(pf, pr))
+                return;
+        pframe_remove_from_pts(pf);
+        pf->pf_addr = pr->pr_pages[--pr->pr_npages];
+        memcpy(pf->pf_addr, old, PAGE_SIZE);
+        page_free(old);
+}
+
+/*
+ * Moves the resident pages whose frames are in [start, end) into frames
+ * elsewhere, for the page allocator's compaction, which holds on to the
+ * ones freed in the range. Nothing is moved unless at least npages of
+ * them can be, which is how many there must be for the whole range to
+ * become free.
+ *
+ * @return the number of pages moved
+ */
+uint32_t
+pframe_relocate(uintptr_t start, uintptr_t end, uint32_t npages)
+{
+        void *pages[1 << (PAGE_NSIZES - 1)];
+        struct pframe_relocation pr;
+        uint32_t n, nmoved = 0;
+
+        KASSERT(npages <= ADDR_TO_PN(end - start));
+        KASSERT(npages <= sizeof(pages) / sizeof(pages[0]));
+
+        pr.pr_start = start;
+        pr.pr_end = end;
+        pr.pr_pages = pages;
+        pr.pr_npages = 0;
+        pr.pr_nmovable = 0;
+        pframe_walk(pframe_relocate_count, &pr);
+        if (pr.pr_nmovable < npages)
+                return 0;
+
+        /* page_alloc may block, which the walk may not, so the new
+         * frames are allocated first; then the pages are counted again,
+         * as some may have gone meanwhile */
+        for (n = 0; n < npages; n++) {
+                if (NULL == (pages[n] = page_alloc()))
+                        break;
+        }
+        if (n == npages) {
+                pr.pr_nmovable = 0;
+                pframe_walk(pframe_relocate_count, &pr);
+                if (pr.pr_nmovable >= npages) {
+                        pr.pr_npages = n;
+                        pframe_walk(pframe_relocate_one, &pr);
+                        nmoved = n - pr.pr_npages;
+                        n = pr.pr_npages;
+                }
+        }
+        while (0 < n)
+                page_free(pages[--n]);
+        return nmoved;
 }
 
 /* ------------------------------------------------------------------ */
@@ -589,11 +1784,38 @@ pageoutd_exit()
 }
 
 /*
- * The pageout daemon, when run, gets the least-recently-requested page from the
- * list of pages which are available to be paged out. Make sure to check if the
- * page is busy before yanking it. If the page you select is dirty, make sure
- * to clean it before yanking it. Finally, go back to sleep after having paged
- * out the appropriate page.
+ * The slabs and the page cache draw on the same free pages, so neither
+ * has memory set aside that the other could be short of. When pageoutd
+ * is woken, the empty slabs are asked first for their share of the
+ * shortfall, that share being their part of what the two could give
+ * back between them (every unpinned page of the page cache, and every
+ * page of an empty slab). The page cache is left to make up the rest.
+ */
+static void
+pageoutd_balance(void)
+{
+        uint32_t nfree = page_free_count(), nslab, want;
+
+        if (nfree >= nfreepages_target
+            || 0 == (nslab = slab_allocators_reclaimable()))
+                return;
+        want = nfreepages_target - nfree;
+        want = (want * nslab + nslab + nallocated - 1) / (nslab + nallocated);
+        slab_allocators_reclaim((int) want);
+}
+
+/*
+ * The pageout daemon, when run, gets the page at the head of the inactive
+ * list, first refilling the inactive list from the active list if it has
+ * become too short. Make sure to check if the page is busy before yanking
+ * it. A page which has been referenced since it was last looked at gets a
+ * second chance at the tail of the inactive list. If the page you select is
+ * dirty, make sure to clean it before yanking it; it is written back in one
+ * sorted batch together with the other unreferenced dirty pages near the
+ * head of the inactive list. If the page cache runs out of pages to
+ * reclaim first, the slab allocators' reclaimers get a turn. Finally, go
+ * back to sleep
+ * after having paged out the appropriate page.
  * Both arguments unused.
  */
 static void *
@@ -601,38 +1823,128 @@ pageoutd_run(int arg1, void *arg2)
 {
         while (1) {
                 KASSERT(nallocated >= 0);
-                while ((!pageoutd_target_met()) && (!list_empty(&alloc_list))) {
+                pageoutd_balance();
+                while ((!pageoutd_target_met()) && (0 < nallocated)) {
                         pframe_t *pf;
 
-                        /* obtain least-recently-requested page: */
-                        pf = list_head(&alloc_list, pframe_t, pf_link);
+                        if (list_empty(&inactive_list)
+                            || (nallocated - nactive) * PFRAME_INACTIVE_RATIO < nactive)
+                                pframe_age_active();
+                        if (list_empty(&inactive_list))
+                                continue;
+
+                        /* obtain least-recently-requested inactive page: */
+                        pf = list_head(&inactive_list, pframe_t, pf_link);
 
                         if (pframe_is_busy(pf)) {
-                                sched_sleep_on(&pf->pf_waitq);
+                                pframe_wait_busy(pf);
+                        } else if (pframe_is_referenced(pf)) {
+                                /* second chance */
+                                pframe_clear_referenced(pf);
+                                pframe_lru_remove(pf);
+                                pframe_lru_insert(pf, 0);
                         } else if (pframe_is_dirty(pf)) {
-                                pframe_clean(pf);
+                                /* write back as many other cold dirty pages
+                                 * as fit in one batch along with it: */
+                                pframe_t *pfs[PFRAME_CLEAN_BATCH];
+                                pframe_t *busy = NULL;
+                                int npages;
+
+                                npages = pframe_gather_dirty(&inactive_list, pfs, 0, 1, &busy);
+                                KASSERT(0 < npages && pfs[0] == pf);
+                                pframe_clean_batch(pfs, npages);
                         } else {
                                 /* it's not busy, it's clean, and it's
                                  * least-recently-requested; reclaim it: */
+                                pframe_stat_add(pf->pf_obj, ps_evictions, 1);
                                 pframe_free(pf);
+                                pframe_nreclaimed++;
                         }
                 }
 
-                /*   release the thundering herd... */
+                /* the page cache alone could not meet the target, so
+                 * shrink the kernel's other caches (evicting inactive
+                 * vnodes unpins their inode pages for the next pass): */
+                if (!pageoutd_target_met())
+                        slab_allocators_reclaim(nfreepages_target - page_free_count());
+
+                /* wake the first stalled allocator, which passes it on
+                 * to the next if there is still memory to spare: */
                 sched_broadcast_on(&alloc_waitq);
 
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: Falling asleep\n");
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: "
                     "nfreepages_target=|%d| "
+					"nfreepages_low=|%d| "
 					"nfreepages_min=|%d| "
-					"page_free_count=|%d|\n", nfreepages_target, nfreepages_min, page_free_count());
+					"page_free_count=|%d|\n", nfreepages_target, nfreepages_low, nfreepages_min, page_free_count());
                 if (sched_cancellable_sleep_on(&pageoutd_waitq))
                         kthread_exit((void *)0);
+                pframe_nwakeups++;
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: Waking up\n");
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: "
                     "nfreepages_target=|%d| "
+					"nfreepages_low=|%d| "
 					"nfreepages_min=|%d| "
-					"page_free_count=|%d|\n", nfreepages_target, nfreepages_min, page_free_count());
+					"page_free_count=|%d|\n", nfreepages_target, nfreepages_low, nfreepages_min, page_free_count());
         }
         return NULL;
 }
+
+/* ------------------------------------------------------------------ */
+/* ------------------------- FLUSHER DAEMON ------------------------- */
+/* ------------------------------------------------------------------ */
+
+/*
+ * The flusher daemon writes back the file pages which have been dirty
+ * for longer than PFLUSHD_EXPIRE_MSECS every PFLUSHD_INTERVAL_MSECS, so
+ * a crash loses at most about that much, and writes are spread out
+ * rather than all left for sync(2). When woken early because there are
+ * more than ndirty_background dirty file pages, it writes back the
+ * oldest until there are not.
+ * Both arguments unused.
+ */
+static void *
+pflushd_run(int arg1, void *arg2)
+{
+        while (1) {
+                pframe_nflushed += pframe_writeback(ndirty_background, 1);
+                if (-EINTR == sched_cancellable_sleep_on_timeout(&pflushd_waitq,
+                                MSECS_TO_TICKS(PFLUSHD_INTERVAL_MSECS)))
+                        kthread_exit((void *) 0);
+        }
+        return NULL;
+}
+
+static __attribute__((unused)) void
+pflushd_init(void)
+{
+        sched_queue_init(&pflushd_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        pflushd = proc_create("pflushd");
+        KASSERT(NULL != pflushd);
+        pflushd_thr = kthread_create(pflushd, pflushd_run, 0, NULL);
+        KASSERT(NULL != pflushd_thr);
+
+        sched_make_runnable(pflushd_thr);
+}
+init_func(pflushd_init);
+init_depends(sched_init);
+
+/*
+ * Stops pflushd and waits for it. Called by the idle process when
+ * shutting down, before the file systems are unmounted (which writes
+ * back what is left).
+ */
+void
+pframe_pflushd_shutdown(void)
+{
+        KASSERT(PID_IDLE == curproc->p_pid);
+        KASSERT(NULL != pflushd_thr);
+
+        kthread_cancel(pflushd_thr, (void *) 0);
+        pflushd_thr = NULL;
+        do_waitpid(pflushd->p_pid, 0, NULL);
+}
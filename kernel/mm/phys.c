@@ -1,6 +1,7 @@
 #include "types.h"
 #include "kernel.h"
 
+#include "mm/highmem.h"
 #include "mm/phys.h"
 
 #include "boot/config.h"
@@ -51,3 +52,33 @@ phys_detect_highmem(void)
         return 0;
 }
 
+void
+phys_add_highmem(uintptr_t lowmax)
+{
+        uint32_t i;
+        uint64_t unreachable = 0;
+        struct mmap_def *mmap = (struct mmap_def *)MEMORY_MAP_BASE;
+
+        for (i = 0; i < mmap->md_count; ++i) {
+                struct mmap_entry *me = &mmap->md_ents[i];
+                uint64_t base = ((uint64_t) me->me_basehi << 32) | me->me_baselo;
+                uint64_t end = base + (((uint64_t) me->me_lenhi << 32) | me->me_lenlo);
+
+                if (1 /* Usable */ != me->me_type || end <= lowmax)
+                        continue;
+                if (base < lowmax)
+                        base = lowmax;
+                /* what is past 4gb needs 64-bit page table entries */
+                if (end > 0x100000000ULL) {
+                        unreachable += end - MAX(base, 0x100000000ULL);
+                        if (base >= 0x100000000ULL)
+                                continue;
+                        end = 0x100000000ULL;
+                }
+                /* (a range ending at 4gb just loses its last page) */
+                highmem_add_range((uintptr_t) base, (uintptr_t) MIN(end, 0xfffff000ULL));
+        }
+        if (0 != unreachable)
+                dbgq(DBG_MM, "Ignoring %llu mb of memory past 4gb\n", unreachable >> 20);
+}
+
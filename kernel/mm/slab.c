@@ -6,20 +6,53 @@
  * (used in Solaris and Linux) from UNIX Internals: The New Frontiers,
  * by Uresh Vahalia.
  *
- * Note that there is no need for locking in allocation and deallocation because
- * it never blocks nor is used by an interrupt handler. Hurray for non preemptible
- * kernels!
+ * Objects are cached in front of the slabs in magazines, as described in
+ * "Magazines and Vmem" by Bonwick and Adams: each allocator keeps a loaded
+ * and a previous magazine (small LIFO stacks of free objects) and a depot
+ * of spare full and empty magazines, so most allocations and frees never
+ * touch a slab at all. Behind the magazines, slabs are kept on full,
+ * partial and empty lists so that refilling never has to look at a full
+ * slab.
+ *
+ * Nothing is stored alongside an object, so the objects of a slab are
+ * packed at exactly sa_objsize apart. Each slab keeps the indices of its
+ * free objects on a stack in its trailer (after the objects, with the
+ * struct slab), and which slab a page belongs to is looked up in
+ * slab_map, so that freeing an object never has to touch anything next
+ * to it.
+ *
+ * The space a slab has left over after its objects and trailer is used
+ * to color it, as Bonwick describes: each new slab of an allocator
+ * starts its objects a cache line further into its first page than the
+ * last one did, wrapping back to the start, so that the same objects of
+ * different slabs do not all fall in the same cache sets.
+ *
+ * Each allocator's magazines, slabs and counts are covered by its
+ * sa_lock, a spinlock, as allocation and deallocation never block and
+ * are not used by interrupt handlers. The lock is dropped to grow the
+ * allocator, as the page allocator may reclaim from every allocator when
+ * it runs short; so a magazine is got for an allocator's depot with only
+ * the magazine allocator's lock held. Allocator locks are taken before
+ * the magazine allocator's, never the other way.
  */
 
 #include "types.h"
+#include "kernel.h"
 
 #include "mm/mm.h"
+#include "mm/kmalloc.h"
 #include "mm/slab.h"
 #include "mm/page.h"
 
+#include "api/trace.h"
+
+#include "proc/spinlock.h"
+
 #include "util/gdb.h"
+#include "util/list.h"
 #include "util/string.h"
 #include "util/debug.h"
+#include "util/printf.h"
 
 #ifdef SLAB_REDZONE
 #define front_rz(obj)           (*(uintptr_t*)(obj))
@@ -37,51 +70,106 @@
         } while (0);
 #endif
 
+/* Number of objects held by a full magazine */
+#define SLAB_MAGAZINE_SIZE      15
+
 struct slab {
-        struct slab             *s_next;       /* link on list of slabs */
+        list_link_t              s_link;       /* link on one of the allocator's slab lists */
         int                      s_inuse;      /* number of allocated objs */
-        void                    *s_free;       /* head of obj free list */
-        void                    *s_addr;       /* start address */
+        void                    *s_addr;       /* address of the first obj, which
+                                                * is the page block's address plus
+                                                * the color (less than a page) */
+        uint16_t                *s_stack;      /* indices of the free objs, the
+                                                * (nobjs - inuse) at the bottom */
+#ifdef SLAB_CHECK_FREE
+        uint8_t                 *s_freemap;    /* bit set if an obj is free */
+#endif
 };
 
+/* The stack holds 16-bit indices */
+#define SLAB_MAX_NOBJS          0xffff
+
+#ifdef SLAB_CHECK_FREE
+#define SLAB_FREEMAP_SIZE(nobjs) (((nobjs) + 7) / 8)
+#else
+#define SLAB_FREEMAP_SIZE(nobjs) 0
+#endif
+
+struct slab_magazine {
+        struct slab_magazine    *sm_next;      /* link on depot list */
+        int                      sm_rounds;    /* number of objs in sm_objs */
+        void                    *sm_objs[SLAB_MAGAZINE_SIZE];
+};
+
+/* Allocator flags */
+#define SA_NOMAGAZINE           0x01           /* never cache objs in magazines */
+
 struct slab_allocator {
         struct slab_allocator   *sa_next;       /* link on list of slab allocators */
         const char              *sa_name;       /* user-provided name */
+        spinlock_t               sa_lock;       /* covers everything below */
         size_t                   sa_objsize;    /* object size */
-        struct slab             *sa_slabs;      /* head of slab list */
+        list_t                   sa_full;       /* slabs with no free objs */
+        list_t                   sa_partial;    /* slabs with some free objs */
+        list_t                   sa_empty;      /* slabs with no allocated objs */
         int                      sa_order;      /* npages = (1 << order) */
         int                      sa_slab_nobjs; /* number of objs per slab */
+        int                      sa_flags;      /* SA_* */
+        int                      sa_color;      /* color of the next slab */
+        int                      sa_color_max;  /* no slab has a greater color */
+        slab_ctor_t              sa_ctor;       /* constructs objs when a slab is created */
+        slab_dtor_t              sa_dtor;       /* destroys objs before a slab is freed */
+
+        /* Magazine layer, see the top of this file */
+        struct slab_magazine    *sa_loaded;     /* magazine allocs and frees use */
+        struct slab_magazine    *sa_previous;   /* always either full or empty */
+        struct slab_magazine    *sa_depot_full; /* stack of full magazines */
+        struct slab_magazine    *sa_depot_empty;/* stack of empty magazines */
+
+        /* Statistics, see slab_allocators_info */
+        uint32_t                 sa_nslabs;     /* slabs currently held */
+        uint32_t                 sa_nallocs;    /* successful slab_obj_allocs */
+        uint32_t                 sa_nfrees;     /* slab_obj_frees */
+        uint32_t                 sa_nfailed;    /* slab_obj_allocs that failed */
+        uint32_t                 sa_nreclaimed; /* slabs given back to the page allocator */
 };
 
-struct slab_bufctl {
-        union {
-                void                *sb_next;   /* next free object */
-                struct slab         *sb_slab;   /* containing slab */
-        } u;
-#ifdef SLAB_CHECK_FREE
-        uint8_t                  sb_free;       /* true if is object is free */
-#endif
-};
-#define sb_next                 u.sb_next
-#define sb_slab                 u.sb_slab
-
-#define obj_bufctl(allocator, obj) \
-        ( (struct slab_bufctl*)(((uintptr_t)(obj)) + (allocator)->sa_objsize) )
-#define bufctl_obj(allocator, buf) \
-        ( (void*)(((uintptr_t)(buf)) - (allocator)->sa_objsize) )
 #define next_obj(allocator, obj) \
-        ( (void*) (((uintptr_t)(obj)) + (allocator)->sa_objsize \
-                   + sizeof(struct slab_bufctl)) )
+        ( (void*) (((uintptr_t)(obj)) + (allocator)->sa_objsize) )
+
+/*
+ * Maps each page given to a slab to the slab, indexed by page number in
+ * two levels as the page tables are: each leaf is a page of slab pointers
+ * covering SLAB_MAP_LEAF pages, allocated the first time a slab is put in
+ * its range, and never freed.
+ */
+#define SLAB_MAP_LEAF           (PAGE_SIZE / sizeof(struct slab *))
+#define SLAB_MAP_NLEAVES        ((1 << (32 - PAGE_SHIFT)) / SLAB_MAP_LEAF)
+static struct slab **slab_map[SLAB_MAP_NLEAVES];
+static spinlock_t slab_map_lock;        /* for putting in leaves */
 
 GDB_DEFINE_HOOK(slab_obj_alloc, void *addr, struct slab_allocator *allocator)
 GDB_DEFINE_HOOK(slab_obj_free, void *addr, struct slab_allocator *allocator)
 
 /* Head of global list of slab allocators. */
 static struct slab_allocator *slab_allocators = NULL;
+static spinlock_t slab_allocators_lock;  /* for adding to it */
+
+/* Number of calls to slab_allocators_reclaim. */
+static uint32_t slab_nreclaims = 0;
+
+/* See slab_register_shrinker. A shrinker which itself runs out of memory
+ * must not be called again from within itself. */
+static slab_shrinker_t *slab_shrinkers = NULL;
+static int slab_shrinking = 0;
 
 /* Special case - allocator for allocation of slab_allocator objects. */
 static struct slab_allocator slab_allocator_allocator;
 
+/* Special case - allocator for the magazines themselves. Neither of these
+ * special allocators puts its own objects in magazines. */
+static struct slab_allocator slab_magazine_allocator;
+
 /*
  * This constant defines how many orders of magnitude (in page block
  * sizes) we'll search for an optimal slab size (past the smallest
@@ -89,18 +177,26 @@ static struct slab_allocator slab_allocator_allocator;
  */
 #define SLAB_MAX_ORDER                  5
 
+/* The colors of slabs are multiples of this, the size of a cache line */
+#define SLAB_COLOR_ALIGN                64
+
 static size_t
 _slab_size(size_t objsize, size_t nobjs)
 {
-        return (nobjs * (objsize + sizeof(struct slab_bufctl))
-                + sizeof(struct slab));
+        return (nobjs * (objsize + sizeof(uint16_t))
+                + sizeof(struct slab) + SLAB_FREEMAP_SIZE(nobjs));
 }
 
 static int
 _slab_nobjs(size_t objsize, size_t order)
 {
-        return (((PAGE_SIZE << order) - sizeof(struct slab))
-                / (objsize + sizeof(struct slab_bufctl)));
+        size_t nobjs;
+
+        nobjs = (((PAGE_SIZE << order) - sizeof(struct slab))
+                 / (objsize + sizeof(uint16_t)));
+        while (nobjs > 0 && _slab_size(objsize, nobjs) > (PAGE_SIZE << order))
+                nobjs--;
+        return MIN(nobjs, SLAB_MAX_NOBJS);
 }
 
 static int
@@ -155,10 +251,16 @@ _calc_slab_size(struct slab_allocator *allocator)
         */
         allocator->sa_order = best_order;
         allocator->sa_slab_nobjs = _slab_nobjs(allocator->sa_objsize, best_order);
+
+        /* The waste is what there is to color with; the color is kept
+         * below a page so that the page block is found from s_addr */
+        allocator->sa_color = 0;
+        allocator->sa_color_max = MIN(best_waste, (int)PAGE_SIZE - 1) & ~(SLAB_COLOR_ALIGN - 1);
 }
 
 static void
-_allocator_init(struct slab_allocator *allocator, const char *name, size_t size)
+_allocator_init(struct slab_allocator *allocator, const char *name, size_t size,
+                slab_ctor_t ctor, slab_dtor_t dtor)
 {
 #ifdef SLAB_REDZONE
         /*
@@ -166,18 +268,38 @@ _allocator_init(struct slab_allocator *allocator, const char *name, size_t size)
          */
         size += 2 * sizeof(SLAB_REDZONE);
 #endif
+        /* so that the objects, and the trailer after them, are aligned */
+        size = (size + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
 
         if (!name)
                 name = "<unnamed>";
 
         allocator->sa_name = name;
+        spinlock_init(&allocator->sa_lock, name);
         allocator->sa_objsize = size;
-        allocator->sa_slabs = NULL;
+        list_init(&allocator->sa_full);
+        list_init(&allocator->sa_partial);
+        list_init(&allocator->sa_empty);
+        allocator->sa_flags = 0;
+        allocator->sa_ctor = ctor;
+        allocator->sa_dtor = dtor;
+        allocator->sa_loaded = NULL;
+        allocator->sa_previous = NULL;
+        allocator->sa_depot_full = NULL;
+        allocator->sa_depot_empty = NULL;
+        allocator->sa_nslabs = 0;
+        allocator->sa_nallocs = 0;
+        allocator->sa_nfrees = 0;
+        allocator->sa_nfailed = 0;
+        allocator->sa_nreclaimed = 0;
         _calc_slab_size(allocator);
 
-        /* Add cache to global cache list. */
+        /* Add cache to global cache list. It is walked without the lock,
+         * so the allocator goes on whole. */
+        spin_lock(&slab_allocators_lock);
         allocator->sa_next = slab_allocators;
         slab_allocators = allocator;
+        spin_unlock(&slab_allocators_lock);
 
         dbg(DBG_MM, "Initialized new slab allocator:\n");
         dbgq(DBG_MM, "  Name:          \"%s\" (0x%p)\n", allocator->sa_name, allocator);
@@ -187,59 +309,142 @@ _allocator_init(struct slab_allocator *allocator, const char *name, size_t size)
 }
 
 struct slab_allocator *
-slab_allocator_create(const char *name, size_t size) {
+slab_allocator_create_ctor(const char *name, size_t size,
+                           slab_ctor_t ctor, slab_dtor_t dtor) {
         struct slab_allocator *allocator;
 
         allocator = (struct slab_allocator *) slab_obj_alloc(&slab_allocator_allocator);
         if (!allocator)
                 return NULL;
 
-        _allocator_init(allocator, name, size);
+        _allocator_init(allocator, name, size, ctor, dtor);
         return allocator;
 }
 
+struct slab_allocator *
+slab_allocator_create(const char *name, size_t size) {
+        return slab_allocator_create_ctor(name, size, NULL, NULL);
+}
+
+/*
+ * Applies fn to every object of a slab, as seen by the users of the
+ * allocator (i.e. past the front red-zone).
+ */
+static void
+_slab_apply(struct slab_allocator *allocator, void *addr, slab_ctor_t fn)
+{
+        void *obj;
+        int ii;
+
+        obj = addr;
+        for (ii = 0; ii < allocator->sa_slab_nobjs; ii++) {
+#ifdef SLAB_REDZONE
+                fn((void *)((uintptr_t)obj + sizeof(SLAB_REDZONE)));
+#else
+                fn(obj);
+#endif
+                obj = next_obj(allocator, obj);
+        }
+}
+
+
+/*
+ * Points the slab_map entries of npages pages at slab (which may be NULL
+ * when a slab goes away). Returns 0 if a leaf of the map was needed and
+ * could not be allocated.
+ */
+static int
+_slab_map_set(void *addr, int npages, struct slab *slab)
+{
+        uint32_t pn = ADDR_TO_PN(addr);
+        struct slab **leaf;
+
+        for (; npages > 0; npages--, pn++) {
+                if (NULL == (leaf = slab_map[pn / SLAB_MAP_LEAF])) {
+                        if (NULL == slab)
+                                continue;
+                        /* allocated without the lock, as the page
+                         * allocator may come back here to reclaim */
+                        if (NULL == (leaf = page_alloc()))
+                                return 0;
+                        memset(leaf, 0, PAGE_SIZE);
+                        spin_lock(&slab_map_lock);
+                        if (NULL == slab_map[pn / SLAB_MAP_LEAF]) {
+                                slab_map[pn / SLAB_MAP_LEAF] = leaf;
+                                leaf = NULL;
+                        }
+                        spin_unlock(&slab_map_lock);
+                        if (NULL != leaf)
+                                page_free(leaf);
+                        leaf = slab_map[pn / SLAB_MAP_LEAF];
+                }
+                /* the pages are the slab's, so nothing else writes here */
+                leaf[pn % SLAB_MAP_LEAF] = slab;
+        }
+        return 1;
+}
+
+/* Returns the slab an object (without its red-zone adjustment) is in */
+static inline struct slab *
+_slab_from_obj(void *obj)
+{
+        uint32_t pn = ADDR_TO_PN(obj);
+        struct slab **leaf = slab_map[pn / SLAB_MAP_LEAF];
 
+        KASSERT(NULL != leaf && NULL != leaf[pn % SLAB_MAP_LEAF] && "not a slab object");
+        return leaf[pn % SLAB_MAP_LEAF];
+}
+
+static inline int
+_slab_obj_index(struct slab_allocator *allocator, struct slab *slab, void *obj)
+{
+        return ((uintptr_t)obj - (uintptr_t)slab->s_addr) / allocator->sa_objsize;
+}
+
+/* Adds a slab to an allocator, which must not be locked by the caller */
 static int
 _slab_allocator_grow(struct slab_allocator *allocator)
 {
         void *addr;
         void *obj;
-        int ii, npages;
+        int ii, npages, nobjs, color;
         struct slab *slab;
 
         npages = 1 << allocator->sa_order;
+        nobjs = allocator->sa_slab_nobjs;
         addr = page_alloc_n(npages);
         if (!addr)
                 return 0;
 
-        /* Initialize each bufctl to be free and point to the next object. */
-        obj = addr;
-        for (ii = 0; ii < (allocator->sa_slab_nobjs - 1); ii++) {
-#ifdef SLAB_CHECK_FREE
-                obj_bufctl(allocator, obj)->sb_free = 1;
-#endif
-                obj = obj_bufctl(allocator, obj)->sb_next = next_obj(allocator, obj);
-        }
+        spin_lock(&allocator->sa_lock);
+        color = allocator->sa_color;
+        allocator->sa_color = (color + SLAB_COLOR_ALIGN > allocator->sa_color_max)
+                              ? 0 : color + SLAB_COLOR_ALIGN;
+        spin_unlock(&allocator->sa_lock);
 
-        /* The last bufctl is the tail of the list. */
+        /* After the last object comes the slab structure itself, followed
+         * by the stack and the free map. */
+        slab = (struct slab *)((uintptr_t)addr + color + nobjs * allocator->sa_objsize);
+        slab->s_addr = (void *)((uintptr_t)addr + color);
+        slab->s_inuse = 0;
+        slab->s_stack = (uint16_t *)(slab + 1);
 #ifdef SLAB_CHECK_FREE
-        obj_bufctl(allocator, obj)->sb_free = 1;
+        slab->s_freemap = (uint8_t *)(slab->s_stack + nobjs);
+        memset(slab->s_freemap, 0xff, SLAB_FREEMAP_SIZE(nobjs));
 #endif
-        obj_bufctl(allocator, obj)->sb_next = NULL;
 
-        /* After the last object comes the slab structure itself. */
-        slab = (struct slab *) next_obj(allocator, obj);
+        /* Every object is free, the first one on top of the stack. */
+        for (ii = 0; ii < nobjs; ii++)
+                slab->s_stack[ii] = nobjs - 1 - ii;
 
-        /*
-         * The first object in the slab will be the head of the free
-         * list and the start address of the slab.
-         */
-        slab->s_free = addr;
-        slab->s_addr = addr;
-        slab->s_inuse = 0;
+        if (!_slab_map_set(addr, npages, slab)) {
+                _slab_map_set(addr, npages, NULL);
+                page_free_n(addr, npages);
+                return 0;
+        }
 
         /* Initialize objects. */
-        obj = addr;
+        obj = slab->s_addr;
         for (ii = 0; ii < allocator->sa_slab_nobjs; ii++) {
 #ifdef SLAB_REDZONE
                 front_rz(obj) = SLAB_REDZONE;
@@ -247,52 +452,297 @@ _slab_allocator_grow(struct slab_allocator *allocator)
 #endif
                 obj = next_obj(allocator, obj);
         }
+        if (NULL != allocator->sa_ctor)
+                _slab_apply(allocator, slab->s_addr, allocator->sa_ctor);
 
         dbg(DBG_MM, "Growing cache \"%s\" (0x%p), new slab 0x%p "
             "(%d pages)\n", allocator->sa_name, allocator, slab,
             1 << allocator->sa_order);
 
         /* Place this slab into the cache. */
-        slab->s_next = allocator->sa_slabs;
-        allocator->sa_slabs = slab;
+        spin_lock(&allocator->sa_lock);
+        list_insert_head(&allocator->sa_empty, &slab->s_link);
+        allocator->sa_nslabs++;
+        spin_unlock(&allocator->sa_lock);
 
         return 1;
 }
 
-void *
-slab_obj_alloc(struct slab_allocator *allocator)
+/*
+ * Returns the list a slab with the given number of allocated objects
+ * belongs on.
+ */
+static list_t *
+_slab_list(struct slab_allocator *allocator, int inuse)
+{
+        if (0 == inuse)
+                return &allocator->sa_empty;
+        else if (allocator->sa_slab_nobjs == inuse)
+                return &allocator->sa_full;
+        else
+                return &allocator->sa_partial;
+}
+
+/*
+ * Takes a free object out of one of the allocator's slabs, growing the
+ * allocator (if grow is set) if every slab is full. Returns the object
+ * without its red-zone adjustment, or NULL if no memory is available.
+ * Called with the allocator locked, which it drops while growing.
+ */
+static void *
+_slab_obj_get(struct slab_allocator *allocator, int grow)
 {
         struct slab *slab;
+        list_t *from;
         void *obj;
-
-        /* Find a slab with a free object. */
-        for (;;) {
-                slab = allocator->sa_slabs;
-                while (slab && (slab->s_inuse == allocator->sa_slab_nobjs))
-                        slab = slab->s_next;
-                if (slab && (slab->s_inuse < allocator->sa_slab_nobjs))
+        int grown;
+
+        /* Find a slab with a free object, preferring partial slabs so
+         * that empty ones can be reclaimed. Once the lock has been
+         * dropped to grow, the new slab may already have been used up. */
+        while (1) {
+                if (!list_empty(&allocator->sa_partial)) {
+                        from = &allocator->sa_partial;
                         break;
-                if (!_slab_allocator_grow(allocator))
+                }
+                if (!list_empty(&allocator->sa_empty)) {
+                        from = &allocator->sa_empty;
+                        break;
+                }
+                if (!grow)
+                        return NULL;
+                spin_unlock(&allocator->sa_lock);
+                grown = _slab_allocator_grow(allocator);
+                spin_lock(&allocator->sa_lock);
+                if (!grown)
                         return NULL;
         }
+        slab = list_head(from, struct slab, s_link);
 
-        /*
-         * Remove an object from the slab's free list.  We'll use the
-         * free list pointer to store a pointer back to the containing
-         * slab.
-         */
-        obj = slab->s_free;
-        slab->s_free = obj_bufctl(allocator, obj)->sb_next;
-        obj_bufctl(allocator, obj)->sb_slab = slab;
-#ifdef SLAB_CHECK_FREE
-        obj_bufctl(allocator, obj)->sb_free = 0;
-#endif
+        /* Pop an object off the slab's free stack. */
+        obj = (void *)((uintptr_t)slab->s_addr + allocator->sa_objsize
+                       * slab->s_stack[allocator->sa_slab_nobjs - slab->s_inuse - 1]);
 
         slab->s_inuse++;
+        if (from != _slab_list(allocator, slab->s_inuse)) {
+                list_remove(&slab->s_link);
+                list_insert_head(_slab_list(allocator, slab->s_inuse), &slab->s_link);
+        }
 
         dbg(DBG_MM, "Allocated object 0x%p from \"%s\" (0x%p), "
             "slab 0x%p, inuse %d\n", obj, allocator->sa_name,
-            allocator, allocator, slab->s_inuse);
+            allocator, slab, slab->s_inuse);
+        return obj;
+}
+
+/*
+ * Puts an object (without its red-zone adjustment) back on the free
+ * stack of the slab that contains it.
+ */
+static void
+_slab_obj_put(struct slab_allocator *allocator, void *obj)
+{
+        struct slab *slab;
+        list_t *from;
+
+        slab = _slab_from_obj(obj);
+        from = _slab_list(allocator, slab->s_inuse);
+
+        /* Push this object back on the slab's free stack. */
+        slab->s_stack[allocator->sa_slab_nobjs - slab->s_inuse]
+                = _slab_obj_index(allocator, slab, obj);
+
+        slab->s_inuse--;
+        if (from != _slab_list(allocator, slab->s_inuse)) {
+                list_remove(&slab->s_link);
+                list_insert_head(_slab_list(allocator, slab->s_inuse), &slab->s_link);
+        }
+
+        dbg(DBG_MM, "Freed object 0x%p from \"%s\" (0x%p), slab 0x%p, inuse %d\n",
+            obj, allocator->sa_name, allocator, slab, slab->s_inuse);
+}
+
+/*
+ * Pops an object off the loaded magazine, first exchanging the loaded
+ * magazine for the previous one or a full one from the depot if it is
+ * empty. Returns NULL if there are no cached objects.
+ */
+static void *
+_magazine_pop(struct slab_allocator *allocator)
+{
+        struct slab_magazine *mag;
+
+        if (NULL == allocator->sa_loaded || 0 == allocator->sa_loaded->sm_rounds) {
+                if (NULL != allocator->sa_previous && 0 != allocator->sa_previous->sm_rounds) {
+                        mag = allocator->sa_previous;
+                        allocator->sa_previous = allocator->sa_loaded;
+                        allocator->sa_loaded = mag;
+                } else if (NULL != (mag = allocator->sa_depot_full)) {
+                        allocator->sa_depot_full = mag->sm_next;
+                        if (NULL != allocator->sa_previous) {
+                                allocator->sa_previous->sm_next = allocator->sa_depot_empty;
+                                allocator->sa_depot_empty = allocator->sa_previous;
+                        }
+                        allocator->sa_previous = allocator->sa_loaded;
+                        allocator->sa_loaded = mag;
+                } else {
+                        return NULL;
+                }
+        }
+
+        return allocator->sa_loaded->sm_objs[--allocator->sa_loaded->sm_rounds];
+}
+
+/* Allocates an empty magazine, with no allocator locked */
+static struct slab_magazine *
+_magazine_alloc(void)
+{
+        struct slab_magazine *mag;
+
+        spin_lock(&slab_magazine_allocator.sa_lock);
+        if (NULL != (mag = _slab_obj_get(&slab_magazine_allocator, 1))) {
+                slab_magazine_allocator.sa_nallocs++;
+                mag->sm_rounds = 0;
+        }
+        spin_unlock(&slab_magazine_allocator.sa_lock);
+        return mag;
+}
+
+/*
+ * Pushes an object onto the loaded magazine, first exchanging the loaded
+ * magazine for the previous one or an empty one if it is full. Returns
+ * 0 if no empty magazine could be found, in which case the caller must
+ * give the object back to its slab.
+ *
+ * Called with the allocator locked. If the depot has no empty magazine
+ * the lock is dropped to allocate one, and the magazines looked at
+ * again, as the allocator may have been drained meanwhile.
+ */
+static int
+_magazine_push(struct slab_allocator *allocator, void *obj)
+{
+        struct slab_magazine *mag, *spare = NULL;
+
+        if (allocator->sa_flags & SA_NOMAGAZINE)
+                return 0;
+
+        while (NULL == allocator->sa_loaded || SLAB_MAGAZINE_SIZE == allocator->sa_loaded->sm_rounds) {
+                if (NULL != allocator->sa_previous && 0 == allocator->sa_previous->sm_rounds) {
+                        mag = allocator->sa_previous;
+                        allocator->sa_previous = allocator->sa_loaded;
+                        allocator->sa_loaded = mag;
+                        continue;
+                }
+                if (NULL != spare) {
+                        mag = spare;
+                        spare = NULL;
+                } else if (NULL != (mag = allocator->sa_depot_empty)) {
+                        allocator->sa_depot_empty = mag->sm_next;
+                } else {
+                        spin_unlock(&allocator->sa_lock);
+                        spare = _magazine_alloc();
+                        spin_lock(&allocator->sa_lock);
+                        if (NULL == spare)
+                                return 0;
+                        continue;
+                }
+                if (NULL != allocator->sa_previous) {
+                        allocator->sa_previous->sm_next = allocator->sa_depot_full;
+                        allocator->sa_depot_full = allocator->sa_previous;
+                }
+                allocator->sa_previous = allocator->sa_loaded;
+                allocator->sa_loaded = mag;
+        }
+        if (NULL != spare) {
+                spare->sm_next = allocator->sa_depot_empty;
+                allocator->sa_depot_empty = spare;
+        }
+
+        allocator->sa_loaded->sm_objs[allocator->sa_loaded->sm_rounds++] = obj;
+        return 1;
+}
+
+/*
+ * Returns every object cached in a magazine to its slab, and frees the
+ * magazines. Called with the allocator locked.
+ */
+static void
+_magazine_drain(struct slab_allocator *allocator, struct slab_magazine *mag)
+{
+        struct slab_magazine *next;
+
+        while (NULL != mag) {
+                next = mag->sm_next;
+                while (mag->sm_rounds > 0)
+                        _slab_obj_put(allocator, mag->sm_objs[--mag->sm_rounds]);
+                spin_lock(&slab_magazine_allocator.sa_lock);
+                _slab_obj_put(&slab_magazine_allocator, mag);
+                slab_magazine_allocator.sa_nfrees++;
+                spin_unlock(&slab_magazine_allocator.sa_lock);
+                mag = next;
+        }
+}
+
+static void
+_allocator_drain(struct slab_allocator *allocator)
+{
+        if (NULL != allocator->sa_loaded) {
+                allocator->sa_loaded->sm_next = NULL;
+                _magazine_drain(allocator, allocator->sa_loaded);
+        }
+        if (NULL != allocator->sa_previous) {
+                allocator->sa_previous->sm_next = NULL;
+                _magazine_drain(allocator, allocator->sa_previous);
+        }
+        _magazine_drain(allocator, allocator->sa_depot_full);
+        _magazine_drain(allocator, allocator->sa_depot_empty);
+        allocator->sa_loaded = NULL;
+        allocator->sa_previous = NULL;
+        allocator->sa_depot_full = NULL;
+        allocator->sa_depot_empty = NULL;
+}
+
+#ifdef SLAB_CHECK_FREE
+/*
+ * Marks an object (without its red-zone adjustment) free or allocated in
+ * its slab's free map, which counts objects in magazines as free, and
+ * asserts that it was not already.
+ */
+static void
+_slab_check_free(struct slab_allocator *allocator, void *obj, int free)
+{
+        struct slab *slab = _slab_from_obj(obj);
+        int idx = _slab_obj_index(allocator, slab, obj);
+        uint8_t bit = 1 << (idx % 8);
+
+        if (free) {
+                KASSERT(!(slab->s_freemap[idx / 8] & bit) && "INVALID FREE!");
+                slab->s_freemap[idx / 8] |= bit;
+        } else {
+                KASSERT((slab->s_freemap[idx / 8] & bit) && "allocated object on a free list");
+                slab->s_freemap[idx / 8] &= ~bit;
+        }
+}
+#endif
+
+void *
+slab_obj_alloc(struct slab_allocator *allocator)
+{
+        void *obj;
+
+        spin_lock(&allocator->sa_lock);
+        if (NULL == (obj = _magazine_pop(allocator))
+            && NULL == (obj = _slab_obj_get(allocator, 1))) {
+                allocator->sa_nfailed++;
+                spin_unlock(&allocator->sa_lock);
+                return NULL;
+        }
+        allocator->sa_nallocs++;
+
+#ifdef SLAB_CHECK_FREE
+        _slab_check_free(allocator, obj, 0);
+#endif
+        spin_unlock(&allocator->sa_lock);
 
 #ifdef SLAB_REDZONE
         VERIFY_REDZONES(allocator, obj);
@@ -304,14 +754,15 @@ slab_obj_alloc(struct slab_allocator *allocator)
 #endif
 
         GDB_CALL_HOOK(slab_obj_alloc, obj, allocator);
+        TRACE(TRACE_SLAB_ALLOC, obj, allocator, 0);
         return obj;
 }
 
 void
 slab_obj_free(struct slab_allocator *allocator, void *obj)
 {
-        struct slab *slab;
         GDB_CALL_HOOK(slab_obj_free, obj, allocator);
+        TRACE(TRACE_SLAB_FREE, obj, allocator, 0);
 
 #ifdef SLAB_REDZONE
         /* Move pointer back.  See the end of kmem_cache_alloc. */
@@ -320,26 +771,44 @@ slab_obj_free(struct slab_allocator *allocator, void *obj)
         VERIFY_REDZONES(allocator, obj);
 #endif
 
+        spin_lock(&allocator->sa_lock);
 #ifdef SLAB_CHECK_FREE
-        KASSERT(!obj_bufctl(allocator, obj)->sb_free && "INVALID FREE!");
-        obj_bufctl(allocator, obj)->sb_free = 1;
+        _slab_check_free(allocator, obj, 1);
 #endif
 
-        slab = obj_bufctl(allocator, obj)->sb_slab;
-
-        /* Place this object back on the slab's free list. */
-        obj_bufctl(allocator, obj)->sb_next = slab->s_free;
-        slab->s_free = obj;
-
-        slab->s_inuse--;
+        allocator->sa_nfrees++;
+        if (!_magazine_push(allocator, obj))
+                _slab_obj_put(allocator, obj);
+        spin_unlock(&allocator->sa_lock);
+}
 
-        dbg(DBG_MM, "Freed object 0x%p from \"%s\" (0x%p), slab 0x%p, inuse %d\n",
-            obj, allocator->sa_name, allocator, slab, slab->s_inuse);
+/*
+ * Asks every shrinker with something to give to free up to nr objects
+ * (all it can if nr is negative).
+ */
+static void
+_slab_shrink(int nr)
+{
+        slab_shrinker_t *s;
+        uint32_t count;
+
+        if (slab_shrinking)
+                return;
+        slab_shrinking = 1;
+        for (s = slab_shrinkers; NULL != s; s = s->ss_next) {
+                if (0 == (count = s->ss_count()))
+                        continue;
+                if (0 <= nr && count > (uint32_t) nr)
+                        count = nr;
+                s->ss_nfreed += s->ss_scan((int) count);
+        }
+        slab_shrinking = 0;
 }
 
 /*
  * Reclaims as much memory (up to a target) from
- * unused slabs as possible
+ * unused slabs as possible, after asking the shrinkers to free up
+ * to as many objects as the target is pages
  * @param target - target number of pages to reclaim. If negative,
  * try to reclaim as many pages as possible
  * @return number of pages freed
@@ -350,89 +819,272 @@ slab_allocators_reclaim(int target)
         int npages_freed = 0, npages;
 
         struct slab_allocator *a;
-        struct slab *s, **prev;
+        struct slab *s;
+
+        slab_nreclaims++;
+
+        _slab_shrink((0 < target) ? target : -1);
 
-        /* Go through all caches */
+        /* Give every cached object back to its slab first, so that the
+         * magazines don't keep otherwise empty slabs alive. Draining
+         * frees magazines, so the magazine allocator goes last. */
         for (a = slab_allocators; NULL != a; a = a->sa_next) {
-                prev = &(a->sa_slabs);
-                s = a->sa_slabs;
-                while (NULL != s) {
-                        struct slab *next = s->s_next;
-                        if (0 == s->s_inuse) {
-                                /* Free Slab */
-                                (*prev) = next;
-                                npages = 1 << a->sa_order;
-
-                                page_free_n(s->s_addr, npages);
-                                npages_freed += npages;
-                        } else {
-                                prev = &(s->s_next);
-                        }
+                spin_lock(&a->sa_lock);
+                _allocator_drain(a);
+                spin_unlock(&a->sa_lock);
+        }
+
+        /* Go through all caches, taking each empty slab off with the
+         * lock held and freeing it without */
+        for (a = slab_allocators; NULL != a; a = a->sa_next) {
+                spin_lock(&a->sa_lock);
+                while (!list_empty(&a->sa_empty)) {
+                        s = list_head(&a->sa_empty, struct slab, s_link);
+                        list_remove(&s->s_link);
+                        a->sa_nslabs--;
+                        a->sa_nreclaimed++;
+                        spin_unlock(&a->sa_lock);
+
+                        /* Free Slab */
+                        npages = 1 << a->sa_order;
+                        if (NULL != a->sa_dtor)
+                                _slab_apply(a, s->s_addr, a->sa_dtor);
+
+                        _slab_map_set(PAGE_ALIGN_DOWN(s->s_addr), npages, NULL);
+                        page_free_n(PAGE_ALIGN_DOWN(s->s_addr), npages);
+                        npages_freed += npages;
+
                         /* Check if target was met */
                         if ((target > 0) && (npages_freed >= target)) {
                                 return npages_freed;
                         }
-                        s = next;
+                        spin_lock(&a->sa_lock);
                 }
+                spin_unlock(&a->sa_lock);
         }
         return npages_freed;
 }
 
-#define KMALLOC_SIZE_MIN_ORDER  (6)
-#define KMALLOC_SIZE_MAX_ORDER  (18)
+/*
+ * @return the number of pages in empty slabs, which
+ * slab_allocators_reclaim could give back without asking the
+ * shrinkers for anything
+ */
+uint32_t
+slab_allocators_reclaimable(void)
+{
+        struct slab_allocator *a;
+        list_link_t *link;
+        uint32_t npages = 0;
 
-static struct slab_allocator *kmalloc_allocators[KMALLOC_SIZE_MAX_ORDER - KMALLOC_SIZE_MIN_ORDER + 1];
+        for (a = slab_allocators; NULL != a; a = a->sa_next) {
+                spin_lock(&a->sa_lock);
+                for (link = a->sa_empty.l_next; link != &a->sa_empty; link = link->l_next)
+                        npages += 1 << a->sa_order;
+                spin_unlock(&a->sa_lock);
+        }
+        return npages;
+}
 
-/* Note that kmem_cache_names should be modified to remain consistent
- * with KMALLOC_SIZE_MIN_ORDER ... KMALLOC_SIZE_MAX_ORDER.
+void
+slab_register_shrinker(slab_shrinker_t *shrinker)
+{
+        KASSERT(NULL != shrinker->ss_count && NULL != shrinker->ss_scan);
+
+        shrinker->ss_nfreed = 0;
+        shrinker->ss_next = slab_shrinkers;
+        slab_shrinkers = shrinker;
+}
+
+uint32_t
+slab_shrinkers_count(void)
+{
+        slab_shrinker_t *s;
+        uint32_t count = 0;
+
+        for (s = slab_shrinkers; NULL != s; s = s->ss_next)
+                count += s->ss_count();
+        return count;
+}
+
+/*
+ * Prints a line of statistics for every slab allocator. "inuse" counts
+ * objects held by callers, so objects cached in magazines count as free.
+ * This is what /dev/slabinfo and the kshell slabinfo command display.
+ * The data argument is unused.
+ */
+size_t
+slab_allocators_info(const void *data, char *buf, size_t osize)
+{
+        struct slab_allocator *a;
+        slab_shrinker_t *s;
+        size_t size = osize;
+
+        KASSERT(NULL == data);
+        KASSERT(0 < osize);
+
+        iprintf(&buf, &size, "reclaim passes: %u\n", slab_nreclaims);
+        iprintf(&buf, &size, "%-16s %7s %5s %7s %6s %10s %10s %6s %9s\n",
+                "name", "objsize", "order", "inuse", "slabs",
+                "allocs", "frees", "failed", "reclaimed");
+        for (a = slab_allocators; NULL != a; a = a->sa_next) {
+                iprintf(&buf, &size, "%-16s %7u %5d %7u %6u %10u %10u %6u %9u\n",
+                        a->sa_name, a->sa_objsize, a->sa_order,
+                        a->sa_nallocs - a->sa_nfrees, a->sa_nslabs,
+                        a->sa_nallocs, a->sa_nfrees, a->sa_nfailed,
+                        a->sa_nreclaimed);
+        }
+
+        iprintf(&buf, &size, "\n%-16s %10s %10s\n", "shrinker", "count", "freed");
+        for (s = slab_shrinkers; NULL != s; s = s->ss_next) {
+                iprintf(&buf, &size, "%-16s %10u %10u\n", s->ss_name,
+                        s->ss_count(), s->ss_nfreed);
+        }
+
+        return size;
+}
+
+/*
+ * kmalloc size classes. Between powers of two there is a class halfway in
+ * between, which bounds internal fragmentation to about a third rather
+ * than a half. Requests (plus the header) that fit in no class are made
+ * directly from the page allocator.
+ */
+#define KMALLOC_CLASS_SHIFT     4
+#define KMALLOC_CLASS_MAX       8192
+
+static const size_t kmalloc_class_sizes[] = {
+        16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+        1536, 2048, 3072, 4096, 6144, 8192
+};
+
+/* Note that kmalloc_allocator_names should be modified to remain
+ * consistent with kmalloc_class_sizes.
  */
 static const char *kmalloc_allocator_names[] = {
+        "size-16",
+        "size-32",
+        "size-48",
         "size-64",
+        "size-96",
         "size-128",
+        "size-192",
         "size-256",
+        "size-384",
         "size-512",
+        "size-768",
         "size-1024",
+        "size-1536",
         "size-2048",
+        "size-3072",
         "size-4096",
-        "size-8192",
-        "size-16384",
-        "size-32768",
-        "size-65536",
-        "size-131072",
-        "size-262144"
+        "size-6144",
+        "size-8192"
 };
 
+#define KMALLOC_NCLASSES \
+        (sizeof(kmalloc_class_sizes) / sizeof(kmalloc_class_sizes[0]))
+
+static struct slab_allocator *kmalloc_allocators[KMALLOC_NCLASSES];
+
+/* kmalloc_class_index[(size + 15) >> 4] is the smallest class that can
+ * hold size bytes, filled in by slab_init */
+static uint8_t kmalloc_class_index[(KMALLOC_CLASS_MAX >> KMALLOC_CLASS_SHIFT) + 1];
+
+/*
+ * Every kmalloc'd block is preceded by a header word, which holds the
+ * index of the tag it is counted against (see mm/kmalloc.h) above its
+ * size: for blocks from a size class the class, and for large blocks
+ * the number of pages allocated, with the low bit set.
+ */
+#define KMALLOC_HDR_TAG_SHIFT           10
+#define KMALLOC_HDR(tag, cls)           (((uintptr_t)(tag) << KMALLOC_HDR_TAG_SHIFT) \
+                                         | ((uintptr_t)(cls) << 1))
+#define KMALLOC_LARGE_HDR(tag, npages)  (((uintptr_t)(tag) << KMALLOC_HDR_TAG_SHIFT) \
+                                         | ((uintptr_t)(npages) << 1) | 1)
+#define KMALLOC_HDR_IS_LARGE(hdr)       ((hdr) & 1)
+#define KMALLOC_HDR_CLASS(hdr)          (((hdr) & ((1 << KMALLOC_HDR_TAG_SHIFT) - 1)) >> 1)
+#define KMALLOC_HDR_NPAGES(hdr)         KMALLOC_HDR_CLASS(hdr)
+#define KMALLOC_HDR_TAG(hdr)            ((hdr) >> KMALLOC_HDR_TAG_SHIFT)
+
+/* kmalloc_tags[i] is the tag given index i; 0 is kmalloc_other */
+static kmalloc_tag_t kmalloc_other = { "other", 0, 0, 0, 0, 0 };
+static kmalloc_tag_t *kmalloc_tags[KMALLOC_MAX_TAGS] = { &kmalloc_other };
+static uint32_t kmalloc_ntags = 1;
+static spinlock_t kmalloc_tags_lock;    /* for giving out indices */
+
+/* Gives the tag an index if it has none yet and there is one left */
+static uint32_t
+_kmalloc_tag_index(kmalloc_tag_t *tag)
+{
+        spin_lock(&kmalloc_tags_lock);
+        if (0 == tag->kt_index && kmalloc_ntags < KMALLOC_MAX_TAGS) {
+                kmalloc_tags[kmalloc_ntags] = tag;
+                tag->kt_index = kmalloc_ntags++;
+        }
+        spin_unlock(&kmalloc_tags_lock);
+        return tag->kt_index;
+}
+
+/* The counts are kept without a lock, so they are changed atomically */
+static inline void
+_kmalloc_tag_count(kmalloc_tag_t *tag, int nobjs, int nbytes)
+{
+        __sync_fetch_and_add(&tag->kt_nobjs, nobjs);
+        __sync_fetch_and_add(&tag->kt_nbytes, nbytes);
+}
+
 void *
-kmalloc(size_t size)
+kmalloc_tagged(size_t size, kmalloc_tag_t *tag)
 {
-        int order;
-        struct slab_allocator **cs;
+        struct slab_allocator *cs;
+        uint32_t npages, cls, idx;
         void *addr;
 
-        size += sizeof(struct slab_allocator *);
+        if (unlikely(0 == (idx = tag->kt_index)) && kmalloc_ntags < KMALLOC_MAX_TAGS)
+                idx = _kmalloc_tag_index(tag);
+        tag = kmalloc_tags[idx];
 
-        /*
-         * Find the first power of two bucket bigger than the
-         * requested size, and allocate from it.
-         */
-        cs = kmalloc_allocators;
-        for (order = KMALLOC_SIZE_MIN_ORDER; order <= KMALLOC_SIZE_MAX_ORDER; order++, cs++) {
-                if ((size_t)(1 << order) >= size) {
-                        addr = slab_obj_alloc(*cs);
-                        if (!addr) {
-                                dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
-                                return NULL;
-                        }
-#ifdef MM_POISON
-                        memset(addr, MM_POISON_ALLOC, size);
-#endif /* MM_POISON */
-                        *((struct slab_allocator **)addr) = *cs;
-                        return (void *)(((struct slab_allocator **)addr) + 1);
+        size += sizeof(uintptr_t);
+
+        if (likely(size <= KMALLOC_CLASS_MAX)) {
+                cls = kmalloc_class_index[(size + (1 << KMALLOC_CLASS_SHIFT) - 1)
+                                          >> KMALLOC_CLASS_SHIFT];
+                cs = kmalloc_allocators[cls];
+                addr = slab_obj_alloc(cs);
+                if (!addr) {
+                        dbg(DBG_MM, "WARNING: kmalloc out of memory (%s:%d)\n",
+                            tag->kt_file, tag->kt_line);
+                        return NULL;
+                }
+                *((uintptr_t *)addr) = KMALLOC_HDR(idx, cls);
+                _kmalloc_tag_count(tag, 1, kmalloc_class_sizes[cls]);
+        } else {
+                npages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+                if (npages > (1U << (PAGE_NSIZES - 1)))
+                        panic("size bigger than maxorder %ld\n", (unsigned long) size);
+                addr = page_alloc_n(npages);
+                if (!addr) {
+                        dbg(DBG_MM, "WARNING: kmalloc out of memory (%s:%d)\n",
+                            tag->kt_file, tag->kt_line);
+                        return NULL;
                 }
+                *((uintptr_t *)addr) = KMALLOC_LARGE_HDR(idx, npages);
+                _kmalloc_tag_count(tag, 1, npages << PAGE_SHIFT);
         }
+        __sync_fetch_and_add(&tag->kt_nallocs, 1);
 
-        panic("size bigger than maxorder %ld\n", (unsigned long) size);
-        return NULL;
+#ifdef MM_POISON
+        memset(((uintptr_t *)addr) + 1, MM_POISON_ALLOC, size - sizeof(uintptr_t));
+#endif /* MM_POISON */
+        return (void *)(((uintptr_t *)addr) + 1);
+}
+
+/* For callers built without mm/kmalloc.h, which are counted as "other" */
+void *
+(kmalloc)(size_t size)
+{
+        return kmalloc_tagged(size, &kmalloc_other);
 }
 
 __attribute__((used)) static void *
@@ -447,8 +1099,23 @@ malloc(size_t size)
 void
 kfree(void *addr)
 {
-        addr = (void *)(((struct slab_allocator **)addr) - 1);
-        struct slab_allocator *sa = *(struct slab_allocator **)addr;
+        addr = (void *)(((uintptr_t *)addr) - 1);
+        uintptr_t hdr = *(uintptr_t *)addr;
+        kmalloc_tag_t *tag = kmalloc_tags[KMALLOC_HDR_TAG(hdr)];
+        struct slab_allocator *sa;
+
+        if (KMALLOC_HDR_IS_LARGE(hdr)) {
+                _kmalloc_tag_count(tag, -1, -(int)(KMALLOC_HDR_NPAGES(hdr) << PAGE_SHIFT));
+#ifdef MM_POISON
+                memset(addr, MM_POISON_FREE, KMALLOC_HDR_NPAGES(hdr) << PAGE_SHIFT);
+#endif /* MM_POISON */
+                page_free_n(addr, KMALLOC_HDR_NPAGES(hdr));
+                return;
+        }
+
+        KASSERT(KMALLOC_HDR_CLASS(hdr) < KMALLOC_NCLASSES);
+        sa = kmalloc_allocators[KMALLOC_HDR_CLASS(hdr)];
+        _kmalloc_tag_count(tag, -1, -(int)kmalloc_class_sizes[KMALLOC_HDR_CLASS(hdr)]);
 
 #ifdef MM_POISON
         /* If poisoning is enabled, wipe the memory given in
@@ -465,6 +1132,41 @@ kfree(void *addr)
         slab_obj_free(sa, addr);
 }
 
+/*
+ * Prints a line for every kmalloc tag which holds memory, giving the
+ * blocks it holds, the memory they take up (headers and the rounding up
+ * to a size class included) and how many blocks it has got in all. The
+ * data argument is unused.
+ */
+size_t
+kmalloc_tags_info(const void *data, char *buf, size_t osize)
+{
+        uint32_t i, nobjs = 0, nbytes = 0;
+        kmalloc_tag_t *tag;
+        size_t size = osize;
+
+        KASSERT(NULL == data);
+        KASSERT(0 < osize);
+
+        iprintf(&buf, &size, "%-40s %7s %10s %10s\n", "site", "objs", "bytes", "allocs");
+        for (i = 0; i < kmalloc_ntags; i++) {
+                tag = kmalloc_tags[i];
+                nobjs += tag->kt_nobjs;
+                nbytes += tag->kt_nbytes;
+                if (0 == tag->kt_nobjs)
+                        continue;
+                if (0 == tag->kt_line)
+                        iprintf(&buf, &size, "%-40s", tag->kt_file);
+                else
+                        iprintf(&buf, &size, "%32s:%-7d", tag->kt_file, tag->kt_line);
+                iprintf(&buf, &size, " %7u %10u %10u\n",
+                        tag->kt_nobjs, tag->kt_nbytes, tag->kt_nallocs);
+        }
+        iprintf(&buf, &size, "%u blocks, %u bytes, %u/%u tags\n",
+                nobjs, nbytes, kmalloc_ntags, KMALLOC_MAX_TAGS);
+        return size;
+}
+
 __attribute__((used)) static void
 free(void *addr)
 {
@@ -476,20 +1178,34 @@ free(void *addr)
 void
 slab_init()
 {
-        int order;
-        struct slab_allocator **cs;
+        uint32_t cls, idx;
+
+        spinlock_init(&slab_map_lock, "slab map");
+        spinlock_init(&kmalloc_tags_lock, "kmalloc tags");
+        spinlock_init(&slab_allocators_lock, "slab allocators");
 
         /* Special case initialization of the kmem_cache_t cache. */
-        _allocator_init(&slab_allocator_allocator, "slab_allocators", sizeof(struct slab_allocator));
+        _allocator_init(&slab_allocator_allocator, "slab_allocators", sizeof(struct slab_allocator),
+                        NULL, NULL);
+        slab_allocator_allocator.sa_flags |= SA_NOMAGAZINE;
+        _allocator_init(&slab_magazine_allocator, "slab_magazines", sizeof(struct slab_magazine),
+                        NULL, NULL);
+        slab_magazine_allocator.sa_flags |= SA_NOMAGAZINE;
 
         /*
-         * Allocate the power of two buckets for generic
-         * kmalloc/kfree.
+         * Allocate the size class buckets for generic
+         * kmalloc/kfree, and build the size to class table.
          */
-        cs = kmalloc_allocators;
-        for (order = KMALLOC_SIZE_MIN_ORDER; order <= KMALLOC_SIZE_MAX_ORDER; order++, cs++) {
-                if (NULL == (*cs = slab_allocator_create(kmalloc_allocator_names[order - KMALLOC_SIZE_MIN_ORDER], (1 << order)))) {
+        KASSERT(KMALLOC_CLASS_MAX == kmalloc_class_sizes[KMALLOC_NCLASSES - 1]);
+        for (cls = 0; cls < KMALLOC_NCLASSES; cls++) {
+                if (NULL == (kmalloc_allocators[cls] = slab_allocator_create(kmalloc_allocator_names[cls],
+                                                                             kmalloc_class_sizes[cls]))) {
                         panic("Couldn't create kmalloc allocators!\n");
                 }
         }
+        for (cls = 0, idx = 0; idx <= (KMALLOC_CLASS_MAX >> KMALLOC_CLASS_SHIFT); idx++) {
+                while (kmalloc_class_sizes[cls] < (idx << KMALLOC_CLASS_SHIFT))
+                        cls++;
+                kmalloc_class_index[idx] = cls;
+        }
 }
@@ -0,0 +1,137 @@
+#include "types.h"
+#include "kernel.h"
+
+#include "main/apic.h"
+#include "main/interrupt.h"
+#include "main/smp.h"
+
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
+
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+
+/*
+ * TLB shootdowns. A processor which changes the mappings of an address
+ * space that other processors have in cr3 (which pt_active_cpus keeps
+ * track of) posts the pages to flush and interrupts just those
+ * processors; each flushes them and clears its bit in the request, and
+ * the sender waits for every bit to clear before going on, as the old
+ * mappings may be used until then. A processor which puts something
+ * else in cr3 loses the address space's entries anyway, so it is not
+ * interrupted for it afterwards.
+ *
+ * One request is posted at a time, under tlb_shootdown_lock. The
+ * lock is taken without raising the IPL, so that a processor waiting
+ * for it still answers the holder's interrupt; so shootdowns must not
+ * be sent with the IPL raised, nor from interrupt handlers.
+ *
+ * Threads only run on the boot processor, the others being parked with
+ * interrupts off and no page directory loaded, so today no request is
+ * ever sent and each call only works out that the mask is empty.
+ */
+
+typedef struct tlb_request {
+        pagedir_t        *tr_pagedir;           /* NULL for kernel mappings */
+        uint32_t          tr_count;             /* may exceed TLB_FLUSH_MAX */
+        uintptr_t         tr_vaddr[TLB_FLUSH_MAX];
+        volatile uint32_t tr_pending;           /* processors yet to flush */
+} tlb_request_t;
+
+static spinlock_t tlb_shootdown_lock;
+static tlb_request_t tlb_request;
+
+/* Invalidates every entry, global ones too, by turning CR4.PGE off and
+ * back on */
+static void
+tlb_flush_global(void)
+{
+        uint32_t cr4;
+
+        __asm__ volatile("movl %%cr4, %0" : "=r"(cr4));
+        __asm__ volatile("movl %0, %%cr4" :: "r"(cr4 & ~0x80) : "memory");
+        __asm__ volatile("movl %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+static void
+tlb_shootdown_intr(regs_t *regs)
+{
+        tlb_request_t *tr = &tlb_request;
+        uint32_t i;
+
+        if (TLB_FLUSH_MAX >= tr->tr_count) {
+                for (i = 0; i < tr->tr_count; i++)
+                        tlb_flush(tr->tr_vaddr[i]);
+        } else if (NULL == tr->tr_pagedir) {
+                tlb_flush_global();
+        } else {
+                tlb_flush_all();
+        }
+        __asm__ volatile("lock andl %1, %0"
+                         : "+m"(tr->tr_pending) : "r"(~(1U << smp_cpu())) : "memory");
+}
+
+/* Sends the request filled in under the lock to the processors in mask
+ * and waits for all of them, then releases the lock */
+static void
+tlb_shootdown_send(uint32_t mask)
+{
+        uint32_t cpu;
+
+        tlb_request.tr_pending = mask;
+        for (cpu = 0; cpu < smp_ncpus(); cpu++) {
+                if (mask & (1U << cpu))
+                        apic_send_ipi(smp_cpu_apicid(cpu), INTR_TLB_SHOOTDOWN);
+        }
+        while (0 != tlb_request.tr_pending)
+                __asm__ volatile("pause");
+        spin_unlock(&tlb_shootdown_lock);
+}
+
+void
+tlb_shootdown(pagedir_t *pd, uintptr_t vaddr, uint32_t count)
+{
+        uint32_t i, mask;
+
+        if (0 == (mask = pt_active_cpus(pd)))
+                return;
+        KASSERT(IPL_LOW == intr_getipl() && "TLB shootdown with interrupts blocked");
+
+        spin_lock(&tlb_shootdown_lock);
+        tlb_request.tr_pagedir = pd;
+        tlb_request.tr_count = count;
+        if (TLB_FLUSH_MAX >= count) {
+                for (i = 0; i < count; i++, vaddr += PAGE_SIZE)
+                        tlb_request.tr_vaddr[i] = vaddr;
+        }
+        tlb_shootdown_send(mask);
+}
+
+void
+tlb_shootdown_batch(pagedir_t *pd, tlb_batch_t *tb)
+{
+        uint32_t i, mask;
+
+        if (0 == tb->tb_count || 0 == (mask = pt_active_cpus(pd)))
+                return;
+        KASSERT(IPL_LOW == intr_getipl() && "TLB shootdown with interrupts blocked");
+
+        spin_lock(&tlb_shootdown_lock);
+        tlb_request.tr_pagedir = pd;
+        tlb_request.tr_count = tb->tb_count;
+        if (TLB_FLUSH_MAX >= tb->tb_count) {
+                for (i = 0; i < tb->tb_count; i++)
+                        tlb_request.tr_vaddr[i] = tb->tb_vaddr[i];
+        }
+        tlb_shootdown_send(mask);
+}
+
+static __attribute__((unused)) void
+tlb_init(void)
+{
+        spinlock_init(&tlb_shootdown_lock, "tlb shootdown");
+        intr_register(INTR_TLB_SHOOTDOWN, tlb_shootdown_intr);
+}
+init_func(tlb_init);
@@ -0,0 +1,94 @@
+#include "globals.h"
+#include "errno.h"
+#include "kernel.h"
+
+#include "proc/futex.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
+#include "api/access.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+
+/*
+ * Each waiting thread has a waiter on its own stack, linked onto the
+ * bucket its word hashes to, and sleeps on the waiter's own queue, so a
+ * wake takes exactly the threads it means to. Buckets are only touched
+ * by threads (never interrupt handlers), which the kernel does not
+ * preempt, so they need no lock.
+ */
+
+#define FUTEX_NBUCKETS  64
+
+#define futex_hash(map, uaddr) \
+        ((((uintptr_t)(map) >> 4) ^ ((uintptr_t)(uaddr) >> 2)) % FUTEX_NBUCKETS)
+
+typedef struct futex_waiter {
+        list_link_t     fw_link;        /* on its bucket, until woken */
+        struct vmmap   *fw_map;
+        uint32_t       *fw_uaddr;
+        ktqueue_t       fw_q;
+} futex_waiter_t;
+
+static list_t futex_buckets[FUTEX_NBUCKETS];
+
+static __attribute__((unused)) void
+futex_init(void)
+{
+        int i;
+
+        for (i = 0; i < FUTEX_NBUCKETS; i++)
+                list_init(&futex_buckets[i]);
+}
+init_func(futex_init);
+
+int
+futex_wait(struct vmmap *map, uint32_t *uaddr, uint32_t val, uint32_t ticks)
+{
+        futex_waiter_t fw;
+        uint32_t cur;
+        int err;
+
+        if (0 != ((uintptr_t)uaddr & 3))
+                return -EINVAL;
+        /* may fault the page in, and so sleep; nothing between this and
+         * going to sleep does */
+        if (0 > (err = copy_from_user(&cur, uaddr, sizeof(cur))))
+                return err;
+        if (cur != val)
+                return -EAGAIN;
+
+        fw.fw_map = map;
+        fw.fw_uaddr = uaddr;
+        sched_queue_init(&fw.fw_q);
+        list_insert_tail(&futex_buckets[futex_hash(map, uaddr)], &fw.fw_link);
+
+        if (0 == ticks)
+                err = sched_cancellable_sleep_on(&fw.fw_q);
+        else
+                err = sched_cancellable_sleep_on_timeout(&fw.fw_q, ticks);
+
+        /* a waker takes the waiter off its bucket */
+        if (list_link_is_linked(&fw.fw_link))
+                list_remove(&fw.fw_link);
+        return err;
+}
+
+int
+futex_wake(struct vmmap *map, uint32_t *uaddr, int n)
+{
+        list_t *bucket = &futex_buckets[futex_hash(map, uaddr)];
+        futex_waiter_t *fw;
+        int woken = 0;
+
+        list_iterate_begin(bucket, fw, futex_waiter_t, fw_link) {
+                if (woken < n && fw->fw_map == map && fw->fw_uaddr == uaddr) {
+                        list_remove(&fw->fw_link);
+                        sched_wakeup_on(&fw->fw_q);
+                        woken++;
+                }
+        } list_iterate_end();
+        return woken;
+}
@@ -0,0 +1,166 @@
+#include "globals.h"
+#include "errno.h"
+
+#include "proc/kthread.h"
+#include "proc/kmutex.h"
+#include "proc/sched.h"
+
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/time.h"
+
+/*
+ * Kernel mutexes. This file replaces the kmutex.o of the prebuilt
+ * process library, as sched.c does sched.o.
+ *
+ * An unlock with threads waiting hands the mutex straight to the first
+ * of them, rather than just waking it to try again: nothing else can
+ * take the mutex between the wakeup and the waiter running, and the
+ * waiter does not have to look at it again when it does run.
+ *
+ * Every lock is counted in a table of lock classes, where a class is a
+ * place kmutex_lock is called from, along with how often the mutex was
+ * already held there and for how long (in clock ticks) the caller waited
+ * for it. kmutex_t is embedded in structures of the prebuilt drivers, so
+ * it cannot grow to say which class it is in; but a mutex is locked from
+ * few enough places that the caller says much the same.
+ *
+ * A thread waiting for a mutex lends its scheduling level to the holder
+ * (see sched_mutex_wait in sched.c).
+ */
+
+#define KMUTEX_NCLASSES         128     /* power of 2 */
+
+typedef struct kmutex_class {
+        uintptr_t       kc_site;        /* return address of kmutex_lock */
+        uint32_t        kc_nacquired;
+        uint32_t        kc_ncontended;  /* of kc_nacquired */
+        uint32_t        kc_wait_ticks;  /* over all of kc_ncontended */
+} kmutex_class_t;
+
+static kmutex_class_t kmutex_classes[KMUTEX_NCLASSES];
+static kmutex_class_t kmutex_class_other; /* once the table is full */
+
+static kmutex_class_t *
+kmutex_class(uintptr_t site)
+{
+        uint32_t i, h = (site >> 2) * 0x9e3779b1;
+        kmutex_class_t *kc;
+
+        for (i = 0; i < KMUTEX_NCLASSES; i++) {
+                kc = &kmutex_classes[(h + i) & (KMUTEX_NCLASSES - 1)];
+                if (site == kc->kc_site)
+                        return kc;
+                if (0 == kc->kc_site) {
+                        kc->kc_site = site;
+                        return kc;
+                }
+        }
+        return &kmutex_class_other;
+}
+
+/* Waits for mtx to be handed over by kmutex_unlock, returning -EINTR if
+ * the (cancellable) wait was cancelled first */
+static int
+kmutex_wait(kmutex_t *mtx, kmutex_class_t *kc, int cancellable)
+{
+        uint32_t start = jiffies;
+        int ret = 0;
+
+        kc->kc_ncontended++;
+        sched_mutex_wait(mtx);
+        if (cancellable)
+                ret = sched_cancellable_sleep_on(&mtx->km_waitq);
+        else
+                sched_sleep_on(&mtx->km_waitq);
+        kc->kc_wait_ticks += jiffies - start;
+
+        /* cancelled, but only after being handed the mutex */
+        if (curthr == mtx->km_holder)
+                return 0;
+        KASSERT(-EINTR == ret);
+        sched_mutex_wait(NULL);
+        return ret;
+}
+
+void
+kmutex_init(kmutex_t *mtx)
+{
+        sched_queue_init(&mtx->km_waitq);
+        mtx->km_holder = NULL;
+}
+
+void
+kmutex_lock(kmutex_t *mtx)
+{
+        kmutex_class_t *kc = kmutex_class((uintptr_t) __builtin_return_address(0));
+
+        KASSERT(NULL != curthr && curthr != mtx->km_holder);
+        kc->kc_nacquired++;
+        if (NULL == mtx->km_holder)
+                mtx->km_holder = curthr;
+        else
+                kmutex_wait(mtx, kc, 0);
+        sched_mutex_acquired(mtx);
+}
+
+int
+kmutex_lock_cancellable(kmutex_t *mtx)
+{
+        kmutex_class_t *kc = kmutex_class((uintptr_t) __builtin_return_address(0));
+
+        KASSERT(NULL != curthr && curthr != mtx->km_holder);
+        if (curthr->kt_cancelled)
+                return -EINTR;
+        kc->kc_nacquired++;
+        if (NULL == mtx->km_holder)
+                mtx->km_holder = curthr;
+        else if (0 > kmutex_wait(mtx, kc, 1))
+                return -EINTR;
+        sched_mutex_acquired(mtx);
+        return 0;
+}
+
+int
+kmutex_trylock(kmutex_t *mtx)
+{
+        KASSERT(NULL != curthr && curthr != mtx->km_holder);
+        if (NULL != mtx->km_holder)
+                return 0;
+        kmutex_class((uintptr_t) __builtin_return_address(0))->kc_nacquired++;
+        mtx->km_holder = curthr;
+        sched_mutex_acquired(mtx);
+        return 1;
+}
+
+void
+kmutex_unlock(kmutex_t *mtx)
+{
+        KASSERT(NULL != curthr && curthr == mtx->km_holder);
+        /* NULL if nobody is waiting */
+        mtx->km_holder = sched_wakeup_on(&mtx->km_waitq);
+        sched_mutex_released(mtx);
+}
+
+size_t
+kmutex_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        kmutex_class_t *kc;
+        int i;
+
+        iprintf(&buf, &size, "%-10s %10s %10s %10s\n",
+                "caller", "acquired", "contended", "wait ticks");
+        for (i = 0; i <= KMUTEX_NCLASSES; i++) {
+                kc = (KMUTEX_NCLASSES == i) ? &kmutex_class_other : &kmutex_classes[i];
+                if (0 == kc->kc_nacquired)
+                        continue;
+                if (KMUTEX_NCLASSES == i)
+                        iprintf(&buf, &size, "%-10s", "other");
+                else
+                        iprintf(&buf, &size, "0x%08x", kc->kc_site);
+                iprintf(&buf, &size, " %10u %10u %10u\n", kc->kc_nacquired,
+                        kc->kc_ncontended, kc->kc_wait_ticks);
+        }
+        return size;
+}
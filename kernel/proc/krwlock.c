@@ -0,0 +1,99 @@
+#include "globals.h"
+#include "errno.h"
+
+#include "proc/kthread.h"
+#include "proc/krwlock.h"
+#include "proc/sched.h"
+
+#include "util/debug.h"
+
+/*
+ * Readers wait on krw_readq while a writer holds the lock or is waiting
+ * for it, and when woken look again, since another writer may have come
+ * along in the meantime. Writers are handed the lock by whoever unlocks
+ * it last, so a woken writer already holds it.
+ */
+
+void
+krwlock_init(krwlock_t *rw)
+{
+        sched_queue_init(&rw->krw_readq);
+        sched_queue_init(&rw->krw_writeq);
+        rw->krw_writer = NULL;
+        rw->krw_nreaders = 0;
+}
+
+/* Whether a reader has to wait: writers go first */
+#define krwlock_read_blocked(rw) \
+        (NULL != (rw)->krw_writer || !sched_queue_empty(&(rw)->krw_writeq))
+
+void
+krwlock_read_lock(krwlock_t *rw)
+{
+        KASSERT(NULL != curthr && curthr != rw->krw_writer);
+        while (krwlock_read_blocked(rw))
+                sched_sleep_on(&rw->krw_readq);
+        rw->krw_nreaders++;
+}
+
+int
+krwlock_read_lock_cancellable(krwlock_t *rw)
+{
+        KASSERT(NULL != curthr && curthr != rw->krw_writer);
+        while (krwlock_read_blocked(rw)) {
+                if (0 > sched_cancellable_sleep_on(&rw->krw_readq))
+                        return -EINTR;
+        }
+        rw->krw_nreaders++;
+        return 0;
+}
+
+void
+krwlock_read_unlock(krwlock_t *rw)
+{
+        KASSERT(NULL == rw->krw_writer && 0 < rw->krw_nreaders);
+        if (0 == --rw->krw_nreaders)
+                rw->krw_writer = sched_wakeup_on(&rw->krw_writeq);
+}
+
+void
+krwlock_write_lock(krwlock_t *rw)
+{
+        KASSERT(NULL != curthr && curthr != rw->krw_writer);
+        if (!krwlock_held(rw)) {
+                rw->krw_writer = curthr;
+                return;
+        }
+        sched_sleep_on(&rw->krw_writeq);
+        KASSERT(curthr == rw->krw_writer);
+}
+
+int
+krwlock_write_lock_cancellable(krwlock_t *rw)
+{
+        KASSERT(NULL != curthr && curthr != rw->krw_writer);
+        if (curthr->kt_cancelled)
+                return -EINTR;
+        if (!krwlock_held(rw)) {
+                rw->krw_writer = curthr;
+                return 0;
+        }
+        sched_cancellable_sleep_on(&rw->krw_writeq);
+
+        /* cancelled, but only after being handed the lock */
+        if (curthr == rw->krw_writer)
+                return 0;
+
+        /* readers held back for this writer alone can go now */
+        if (!krwlock_read_blocked(rw))
+                sched_broadcast_on(&rw->krw_readq);
+        return -EINTR;
+}
+
+void
+krwlock_write_unlock(krwlock_t *rw)
+{
+        KASSERT(NULL != curthr && curthr == rw->krw_writer);
+        if (NULL == (rw->krw_writer = sched_wakeup_on(&rw->krw_writeq)))
+                sched_broadcast_on(&rw->krw_readq);
+}
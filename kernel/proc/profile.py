@@ -0,0 +1,144 @@
+import gdb
+import os
+import subprocess
+
+import weenix
+import weenix.proc
+import weenix.stack
+
+_thread_states = {
+    1 : "run",
+    2 : "sleep",
+    3 : "sleep",
+    4 : "exited"
+}
+
+class ProfileCommand(weenix.Command):
+    """usage: profile [-n <samples>] [-i <msecs>] [-c] [-p <pid>]... [-o <file>]
+    -n <samples> how many times to stop the kernel (default 100)
+    -i <msecs>   how long to let it run in between (default 10)
+    -c           sample only the thread which is running, rather than every
+                 kernel thread
+    -p <pid>     sample only the threads of the process (may be repeated)
+    -o <file>    write the result to <file> rather than the terminal
+    Lets the kernel run and interrupts it, over and over, and each time
+    records the stack of every thread (or, with -c, just curthr). The
+    result is in the folded format of flamegraph.pl, a line for each
+    distinct stack,
+
+        <proc>[<pid>];<state>;<outermost function>;...;<innermost> <count>
+
+    <state> being run or sleep, so that with every thread sampled the
+    graph shows where the time goes whether or not the threads are on the
+    processor (wall-clock and off-CPU time). A thread which is not running
+    is read from the context it last switched out with; the running one
+    from the registers, and if it was stopped in an interrupt, from what
+    it was interrupted in as well."""
+
+    def __init__(self):
+        weenix.Command.__init__(self, "profile", gdb.COMMAND_DATA)
+
+    def _parse(self, arg):
+        args = gdb.string_to_argv(arg)
+        opts = { "samples" : 100, "msecs" : 10, "current" : False,
+                 "pids" : set(), "file" : None }
+        i = 0
+        try:
+            while (i < len(args)):
+                if (args[i] == "-c"):
+                    opts["current"] = True
+                    i += 1
+                    continue
+                if (i + 1 == len(args)):
+                    raise ValueError(args[i])
+                if (args[i] == "-n"):
+                    opts["samples"] = int(args[i + 1])
+                elif (args[i] == "-i"):
+                    opts["msecs"] = int(args[i + 1])
+                elif (args[i] == "-p"):
+                    opts["pids"].add(int(args[i + 1]))
+                elif (args[i] == "-o"):
+                    opts["file"] = args[i + 1]
+                else:
+                    raise ValueError(args[i])
+                i += 2
+        except ValueError:
+            gdb.write("{0}\n".format(self.__doc__))
+            raise gdb.GdbError("invalid arguments")
+        if (opts["samples"] <= 0 or opts["msecs"] <= 0):
+            raise gdb.GdbError("samples and msecs must be positive")
+        return opts
+
+    def _run_for(self, msecs):
+        # gdb stops the kernel when it gets a SIGINT while it runs, just
+        # as for a ^C at the terminal, so a process of its own sends one
+        # once the time is up
+        timer = subprocess.Popen(["sh", "-c", "sleep {0}; kill -INT {1}"
+                                  .format(msecs / 1000.0, os.getpid())])
+        try:
+            gdb.execute("continue", to_string=True)
+        finally:
+            # (if the kernel stopped of its own accord, the signal is
+            # still to come, and has to be waited out here)
+            while (True):
+                try:
+                    timer.wait()
+                    break
+                except KeyboardInterrupt:
+                    pass
+
+    def _stack(self, thr, current):
+        if (not current):
+            ctx = thr["kt_ctx"]
+            return weenix.stack.names(int(ctx["c_eip"]), int(ctx["c_ebp"]))
+        if (int(gdb.parse_and_eval("$cs")) & 0x3):
+            return ["[user]"]
+        res = weenix.stack.names(int(gdb.parse_and_eval("$pc")),
+                                 int(gdb.parse_and_eval("$ebp")))
+        regs = gdb.parse_and_eval("_intr_regs")
+        if (int(regs) != 0):
+            if (int(regs["r_cs"]) & 0x3):
+                res.append("[user]")
+            else:
+                res += weenix.stack.names(int(regs["r_eip"]), int(regs["r_ebp"]))
+        return res
+
+    def _sample(self, opts, counts):
+        curthr = gdb.parse_and_eval("curthr")
+        for proc in weenix.proc.iter():
+            if (len(opts["pids"]) != 0 and not proc.pid() in opts["pids"]):
+                continue
+            for thr in proc.threads():
+                current = (thr.address == curthr)
+                if (opts["current"] and not current):
+                    continue
+                state = _thread_states.get(int(thr["kt_state"]), "?")
+                if (state == "exited"):
+                    continue
+                stack = self._stack(thr, current)
+                stack.reverse()
+                key = ";".join(["{0}[{1}]".format(proc.name(), proc.pid()), state] + stack)
+                counts[key] = counts.get(key, 0) + 1
+
+    def invoke(self, arg, tty):
+        opts = self._parse(arg)
+        counts = dict()
+        try:
+            for i in range(opts["samples"]):
+                self._run_for(opts["msecs"])
+                self._sample(opts, counts)
+        except KeyboardInterrupt:
+            gdb.write("profile: stopped early\n")
+
+        lines = ["{0} {1}\n".format(key, counts[key]) for key in sorted(counts.keys())]
+        if (opts["file"] == None):
+            for line in lines:
+                gdb.write(line)
+        else:
+            out = open(opts["file"], "w")
+            out.writelines(lines)
+            out.close()
+            gdb.write("profile: {0} stacks written to {1}\n"
+                      .format(len(lines), opts["file"]))
+
+ProfileCommand()
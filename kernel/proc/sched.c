@@ -0,0 +1,923 @@
+#include "globals.h"
+#include "errno.h"
+
+#include "api/trace.h"
+
+#include "main/cpuid.h"
+#include "main/fpu.h"
+#include "main/interrupt.h"
+#include "main/smp.h"
+
+#include "proc/sched.h"
+#include "proc/kmutex.h"
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/spinlock.h"
+
+#include "util/bits.h"
+#include "util/init.h"
+#include "util/math.h"
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+#include "util/time.h"
+#include "util/timer.h"
+
+#include "vm/vmmap.h"
+
+/*
+ * A multi-level feedback queue scheduler. This file replaces the sched.o
+ * of the prebuilt process library (which is no longer linked in, as
+ * everything it defines is defined here) and keeps its sleep and wakeup
+ * semantics exactly; only the run queue is different.
+ *
+ * There are SCHED_NLEVELS run queues, 0 the most favoured: the next
+ * thread to run is the first on the highest non-empty level, found from
+ * a bitmap of the non-empty levels. A thread starts on the top level it
+ * may use (its floor, which is 0 unless it has been niced), and moves
+ * one level down each time it uses up a time slice (see sched_tick),
+ * where slices are longer. A thread which goes to sleep before using up
+ * its slice is not CPU bound, so when it wakes it goes back to its
+ * floor: threads waiting on terminal input (or any other I/O) run ahead
+ * of ones which compute. So that the bottom levels do not starve, every
+ * SCHED_BOOST_TICKS ticks every thread goes back to its floor.
+ *
+ * kthread_t comes from the prebuilt process library and cannot grow, so
+ * each thread's scheduling state, and its FPU state (see main/fpu.c),
+ * lives at the base of its kernel stack
+ * (the end which the stack grows towards, and never reaches unless it
+ * is about to overflow anyway). A magic number and the thread pointer
+ * tell a stack whose state is set up from a new (or reused) one.
+ *
+ * A sleep may be given a timeout, in which case a timer (util/timer.c)
+ * takes the thread off its queue if nothing wakes it first. As timers go
+ * off in the timer interrupt handler, sleep queues are only touched with
+ * interrupts blocked.
+ *
+ * Each thread has a mask of the processors it may run on (see
+ * sched_setaffinity). All threads run on processor 0, as main/smp.c
+ * leaves the others halted, so there is one set of run queues and no
+ * placement to do; a mask only has to allow processor 0.
+ *
+ * A thread waiting for a mutex lends its level to the holder, and on
+ * along the chain of holders should that one be waiting for another, so
+ * that a thread on a low level holding a mutex across I/O cannot keep a
+ * more favoured one waiting behind everything between them. A thread
+ * runs on the better of its own level and the one lent to it, and keeps
+ * what it has been lent until it holds no more mutexes: as kmutex_t
+ * cannot grow there is no list of the mutexes a thread holds from which
+ * to work out what is still owed it sooner.
+ *
+ * The time from a thread being made runnable to it being switched to,
+ * and from it going to sleep to it being made runnable, is measured with
+ * the cycle counter, and added to the thread's totals, to the latency
+ * histograms of the system and of its process, and, for a sleep, to its
+ * wait channel in a table of the queues slept on (which, like the lock
+ * classes of kmutex.c, puts what does not fit under "other").
+ */
+
+#define SCHED_NLEVELS           16
+#define SCHED_NICE_MAX          19
+
+/* Time slice, in ticks, of a thread on the given level: one tick on the
+ * top levels, doubling every four levels */
+#define SCHED_QUANTUM(level)    (1 << ((level) / 4))
+
+/* How often everything goes back to the top */
+#define SCHED_BOOST_TICKS       100
+
+#define SCHED_MAGIC             0x5c4ed001
+
+/* The processors which run threads */
+#define SCHED_CPUS              0x1
+
+/* How far along a chain of mutex holders a level is lent */
+#define SCHED_LEND_DEPTH        8
+
+#define SCHED_NCHANNELS         128     /* power of 2 */
+
+typedef struct sched_info {
+        uint32_t        si_magic;
+        kthread_t      *si_thr;         /* whose stack this is */
+        int             si_level;       /* run queue, when runnable */
+        int             si_ticks;       /* of its slice used so far */
+        int             si_nice;        /* 0 to SCHED_NICE_MAX */
+        uint32_t        si_epoch;       /* sched_epoch when last boosted */
+        uint32_t        si_affinity;    /* processors it may run on */
+        int             si_exclusive;   /* 1 while in an exclusive sleep */
+        int             si_lent;        /* level lent by mutex waiters */
+        int             si_nmutexes;    /* mutexes held */
+        int             si_preempt;     /* sched_preempt_disable depth */
+        kmutex_t       *si_blocked;     /* the mutex it is waiting for */
+        uint64_t        si_stamp;       /* when it last went to sleep or
+                                         * was made runnable */
+        ktqueue_t      *si_wchan;       /* what it last slept on */
+        uint64_t        si_cycles[2];   /* waiting for the processor, and
+                                         * asleep, see sched_account */
+        fpu_state_t     si_fpu;         /* aligned, as the stack base is */
+} sched_info_t;
+
+typedef struct sched_channel {
+        ktqueue_t      *sc_wchan;
+        uint32_t        sc_nsleeps;
+        uint64_t        sc_cycles;      /* over all of sc_nsleeps */
+} sched_channel_t;
+
+static sched_latency_t sched_latency;
+static sched_channel_t sched_channels[SCHED_NCHANNELS];
+static sched_channel_t sched_channel_other; /* once the table is full */
+
+static ktqueue_t kt_runq[SCHED_NLEVELS];
+static uint32_t kt_runq_bitmap;         /* bit i set if kt_runq[i] is not empty */
+
+static uint32_t sched_ticks;
+static uint32_t sched_epoch;            /* count of periodic boosts */
+static int sched_resched;               /* set when curthr should be preempted */
+static uint32_t sched_nkpreempts;       /* by sched_cond_resched */
+
+static int
+sched_floor(int nice)
+{
+        return nice * (SCHED_NLEVELS - 1) / SCHED_NICE_MAX;
+}
+
+/* The processors which have started */
+static uint32_t
+sched_online(void)
+{
+        return (1U << smp_ncpus()) - 1;
+}
+
+/* Returns the scheduling state of thr, first setting it up if thr has
+ * not been seen before. A new thread inherits the niceness and affinity
+ * of the one creating it (the current thread), if there is one. */
+static sched_info_t *
+sched_info(kthread_t *thr)
+{
+        sched_info_t *si = (sched_info_t *) thr->kt_kstack;
+
+        KASSERT(NULL != si);
+        if (SCHED_MAGIC != si->si_magic || thr != si->si_thr) {
+                si->si_magic = SCHED_MAGIC;
+                si->si_thr = thr;
+                si->si_nice = (NULL != curthr && thr != curthr)
+                              ? sched_info(curthr)->si_nice : 0;
+                si->si_affinity = (NULL != curthr && thr != curthr)
+                                  ? sched_info(curthr)->si_affinity : sched_online();
+                si->si_level = sched_floor(si->si_nice);
+                si->si_ticks = 0;
+                si->si_epoch = sched_epoch;
+                si->si_exclusive = 0;
+                si->si_lent = SCHED_NLEVELS;
+                si->si_nmutexes = 0;
+                si->si_preempt = 0;
+                si->si_blocked = NULL;
+                si->si_stamp = cpuid_rdtsc();
+                si->si_wchan = NULL;
+                si->si_cycles[SCHED_LAT_RUNQ] = 0;
+                si->si_cycles[SCHED_LAT_BLOCK] = 0;
+                fpu_state_init(&si->si_fpu);
+        }
+        return si;
+}
+
+fpu_state_t *
+sched_fpu_state(kthread_t *thr)
+{
+        return &sched_info(thr)->si_fpu;
+}
+
+/* Sends thr back to its floor with a fresh slice */
+static void
+sched_boost(sched_info_t *si)
+{
+        si->si_level = sched_floor(si->si_nice);
+        si->si_ticks = 0;
+        si->si_epoch = sched_epoch;
+}
+
+/* The level thr runs on, what it has been lent if that is better */
+static int
+sched_prio(sched_info_t *si)
+{
+        return MIN(si->si_level, si->si_lent);
+}
+
+static int
+sched_runq_level(ktqueue_t *q)
+{
+        return (q >= &kt_runq[0] && q < &kt_runq[SCHED_NLEVELS]) ? q - kt_runq : -1;
+}
+
+static sched_channel_t *
+sched_channel(ktqueue_t *q)
+{
+        uint32_t i, h = ((uintptr_t) q >> 2) * 0x9e3779b1;
+        sched_channel_t *sc;
+
+        for (i = 0; i < SCHED_NCHANNELS; i++) {
+                sc = &sched_channels[(h + i) & (SCHED_NCHANNELS - 1)];
+                if (q == sc->sc_wchan)
+                        return sc;
+                if (NULL == sc->sc_wchan) {
+                        sc->sc_wchan = q;
+                        return sc;
+                }
+        }
+        return &sched_channel_other;
+}
+
+static void
+sched_latency_add(sched_latency_t *sl, int which, uint64_t cycles)
+{
+        sl->sl_count[which]++;
+        sl->sl_cycles[which] += cycles;
+        sl->sl_hist[which][math_log2_bucket(cycles, SCHED_LAT_BUCKETS)]++;
+}
+
+/* Charges thr with having waited since it was last stamped, on a run
+ * queue (SCHED_LAT_RUNQ) or asleep (SCHED_LAT_BLOCK), and stamps it
+ * again. Interrupts must be blocked */
+static void
+sched_account(kthread_t *thr, sched_info_t *si, int which)
+{
+        uint64_t now = cpuid_rdtsc();
+        uint64_t cycles = now - si->si_stamp;
+
+        si->si_stamp = now;
+        si->si_cycles[which] += cycles;
+        sched_latency_add(&sched_latency, which, cycles);
+        if (NULL != thr->kt_proc && NULL != thr->kt_proc->p_vmmap)
+                sched_latency_add(&thr->kt_proc->p_vmmap->vmm_sched, which, cycles);
+        if (SCHED_LAT_BLOCK == which) {
+                sched_channel_t *sc = sched_channel(si->si_wchan);
+
+                sc->sc_nsleeps++;
+                sc->sc_cycles += cycles;
+        }
+}
+
+static __attribute__((unused)) void
+sched_init(void)
+{
+        int i;
+
+        for (i = 0; i < SCHED_NLEVELS; i++)
+                sched_queue_init(&kt_runq[i]);
+        kt_runq_bitmap = 0;
+}
+init_func(sched_init);
+
+/*** PRIVATE KTQUEUE MANIPULATION FUNCTIONS ***/
+/**
+ * Enqueues a thread onto a queue.
+ *
+ * @param q the queue to enqueue the thread onto
+ * @param thr the thread to enqueue onto the queue
+ */
+static void
+ktqueue_enqueue(ktqueue_t *q, kthread_t *thr)
+{
+        KASSERT(!thr->kt_wchan);
+        list_insert_head(&q->tq_list, &thr->kt_qlink);
+        thr->kt_wchan = q;
+        q->tq_size++;
+}
+
+/**
+ * Dequeues a thread from the queue.
+ *
+ * @param q the queue to dequeue a thread from
+ * @return the thread dequeued from the queue
+ */
+static kthread_t *
+ktqueue_dequeue(ktqueue_t *q)
+{
+        kthread_t *thr;
+        list_link_t *link;
+
+        if (list_empty(&q->tq_list))
+                return NULL;
+
+        link = q->tq_list.l_prev;
+        thr = list_item(link, kthread_t, kt_qlink);
+        list_remove(link);
+        thr->kt_wchan = NULL;
+
+        q->tq_size--;
+
+        return thr;
+}
+
+/**
+ * Removes a given thread from a queue.
+ *
+ * @param q the queue to remove the thread from
+ * @param thr the thread to remove from the queue
+ */
+static void
+ktqueue_remove(ktqueue_t *q, kthread_t *thr)
+{
+        KASSERT(thr->kt_qlink.l_next && thr->kt_qlink.l_prev);
+        list_remove(&thr->kt_qlink);
+        thr->kt_wchan = NULL;
+        q->tq_size--;
+}
+
+/* Puts thr on the run queue for its level. Interrupts must be blocked */
+static void
+runq_enqueue(kthread_t *thr)
+{
+        sched_info_t *si = sched_info(thr);
+
+        KASSERT(si->si_affinity & SCHED_CPUS);
+        if (si->si_epoch != sched_epoch)
+                sched_boost(si);
+        ktqueue_enqueue(&kt_runq[sched_prio(si)], thr);
+        kt_runq_bitmap |= 1U << sched_prio(si);
+}
+
+/* Takes the first thread off the highest non-empty run queue, or returns
+ * NULL if all are empty. Interrupts must be blocked */
+static kthread_t *
+runq_dequeue(void)
+{
+        kthread_t *thr;
+        int level;
+
+        if (0 == kt_runq_bitmap)
+                return NULL;
+        level = bit_ffs(kt_runq_bitmap);
+        thr = ktqueue_dequeue(&kt_runq[level]);
+        KASSERT(NULL != thr);
+        if (sched_queue_empty(&kt_runq[level]))
+                kt_runq_bitmap &= ~(1U << level);
+        return thr;
+}
+
+/*** PUBLIC KTQUEUE MANIPULATION FUNCTIONS ***/
+void
+sched_queue_init(ktqueue_t *q)
+{
+        list_init(&q->tq_list);
+        q->tq_size = 0;
+}
+
+int
+sched_queue_empty(ktqueue_t *q)
+{
+        return list_empty(&q->tq_list);
+}
+
+void
+sched_sleep_on(ktqueue_t *q)
+{
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        curthr->kt_state = KT_SLEEP;
+        ktqueue_enqueue(q, curthr);
+        sched_switch();
+        intr_setipl(oldipl);
+}
+
+int
+sched_cancellable_sleep_on(ktqueue_t *q)
+{
+        uint8_t oldipl = intr_getipl();
+
+        if (curthr->kt_cancelled)
+                return -EINTR;
+        intr_setipl(IPL_HIGH);
+        curthr->kt_state = KT_SLEEP_CANCELLABLE;
+        ktqueue_enqueue(q, curthr);
+        sched_switch();
+        intr_setipl(oldipl);
+        return curthr->kt_cancelled ? -EINTR : 0;
+}
+
+void
+sched_sleep_on_exclusive(ktqueue_t *q)
+{
+        sched_info_t *si = sched_info(curthr);
+
+        si->si_exclusive = 1;
+        sched_sleep_on(q);
+        si->si_exclusive = 0;
+}
+
+int
+sched_cancellable_sleep_on_exclusive(ktqueue_t *q)
+{
+        sched_info_t *si = sched_info(curthr);
+        int ret;
+
+        si->si_exclusive = 1;
+        ret = sched_cancellable_sleep_on(q);
+        si->si_exclusive = 0;
+        return ret;
+}
+
+/* A sleep with a timeout, on the sleeping thread's stack */
+typedef struct sched_timeout {
+        ktimer_t        st_timer;
+        kthread_t      *st_thr;
+        int             st_expired;     /* 1 if the timer woke it */
+} sched_timeout_t;
+
+static void
+sched_timeout_expire(void *arg)
+{
+        sched_timeout_t *st = (sched_timeout_t *) arg;
+        kthread_t *thr = st->st_thr;
+
+        /* unless something else has woken it already */
+        if ((KT_SLEEP == thr->kt_state || KT_SLEEP_CANCELLABLE == thr->kt_state)
+            && NULL != thr->kt_wchan) {
+                st->st_expired = 1;
+                ktqueue_remove(thr->kt_wchan, thr);
+                sched_boost(sched_info(thr));
+                sched_make_runnable(thr);
+        }
+}
+
+/* Sleeps on q in the given state for at most ticks, returning 1 if the
+ * time ran out and 0 if the thread was woken (or cancelled) first */
+static int
+sched_sleep_timeout(ktqueue_t *q, int state, uint32_t ticks)
+{
+        sched_timeout_t st;
+        uint8_t oldipl = intr_getipl();
+
+        st.st_thr = curthr;
+        st.st_expired = 0;
+        ktimer_init(&st.st_timer, sched_timeout_expire, &st);
+
+        intr_setipl(IPL_HIGH);
+        curthr->kt_state = state;
+        ktqueue_enqueue(q, curthr);
+        ktimer_add(&st.st_timer, ticks, 0);
+        sched_switch();
+        ktimer_del(&st.st_timer);
+        intr_setipl(oldipl);
+
+        return st.st_expired;
+}
+
+int
+sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks)
+{
+        return sched_sleep_timeout(q, KT_SLEEP, ticks) ? -ETIMEDOUT : 0;
+}
+
+int
+sched_cancellable_sleep_on_timeout(ktqueue_t *q, uint32_t ticks)
+{
+        int expired;
+
+        if (curthr->kt_cancelled)
+                return -EINTR;
+        expired = sched_sleep_timeout(q, KT_SLEEP_CANCELLABLE, ticks);
+        if (curthr->kt_cancelled)
+                return -EINTR;
+        return expired ? -ETIMEDOUT : 0;
+}
+
+kthread_t *
+sched_wakeup_on(ktqueue_t *q)
+{
+        uint8_t oldipl = intr_getipl();
+        kthread_t *ret;
+
+        intr_setipl(IPL_HIGH);
+        if (sched_queue_empty(q)) {
+                intr_setipl(oldipl);
+                return NULL;
+        }
+
+        ret = ktqueue_dequeue(q);
+        KASSERT((ret->kt_state == KT_SLEEP) || (ret->kt_state == KT_SLEEP_CANCELLABLE));
+        sched_boost(sched_info(ret));
+        sched_make_runnable(ret);
+        intr_setipl(oldipl);
+        return ret;
+}
+
+void
+sched_broadcast_on(ktqueue_t *q)
+{
+        uint8_t oldipl = intr_getipl();
+        kthread_t *thr;
+        int exclusive = 0;
+
+        intr_setipl(IPL_HIGH);
+        /* oldest first, as sched_wakeup_on takes them, so that exclusive
+         * waiters get their turns in order */
+        list_iterate_reverse(&q->tq_list, thr, kthread_t, kt_qlink) {
+                sched_info_t *si = sched_info(thr);
+
+                if (si->si_exclusive) {
+                        if (exclusive)
+                                continue;
+                        exclusive = 1;
+                }
+                KASSERT((thr->kt_state == KT_SLEEP) || (thr->kt_state == KT_SLEEP_CANCELLABLE));
+                ktqueue_remove(q, thr);
+                sched_boost(si);
+                sched_make_runnable(thr);
+        } list_iterate_end();
+        intr_setipl(oldipl);
+}
+
+void
+sched_wakeup_all(ktqueue_t *q)
+{
+        while (NULL != sched_wakeup_on(q))
+                ;
+}
+
+void
+sched_cancel(struct kthread *kthr)
+{
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        kthr->kt_cancelled = 1;
+        if (KT_SLEEP_CANCELLABLE == kthr->kt_state) {
+                KASSERT(kthr->kt_wchan);
+                ktqueue_remove(kthr->kt_wchan, kthr);
+                sched_boost(sched_info(kthr));
+                sched_make_runnable(kthr);
+        }
+        intr_setipl(oldipl);
+}
+
+/*
+ * Switches to the next runnable thread, waiting (with interrupts
+ * enabled, halted, and without the periodic tick) for one if there is
+ * none. The current thread must already be
+ * on the run queue, on a sleep queue, or exited; an exited thread's
+ * scheduling state is cleared, so that its stack is not mistaken for it
+ * should both be reused.
+ */
+void
+sched_switch(void)
+{
+        uint8_t oldipl = intr_getipl();
+        kthread_t *next, *prev;
+
+        KASSERT(0 == spinlock_nheld() && "sleeping with a spinlock held");
+        intr_setipl(IPL_HIGH);
+
+        if (KT_EXITED == curthr->kt_state) {
+                ((sched_info_t *) curthr->kt_kstack)->si_magic = 0;
+                fpu_release(curthr);
+        } else if (KT_SLEEP == curthr->kt_state
+                   || KT_SLEEP_CANCELLABLE == curthr->kt_state) {
+                sched_info_t *si = sched_info(curthr);
+
+                si->si_stamp = cpuid_rdtsc();
+                si->si_wchan = curthr->kt_wchan;
+        }
+
+        while (NULL == (next = runq_dequeue())) {
+                intr_disable();
+                time_idle_enter();
+                intr_setipl(IPL_LOW);
+                intr_wait();
+                intr_setipl(IPL_HIGH);
+                time_idle_exit();
+        }
+
+        sched_account(next, sched_info(next), SCHED_LAT_RUNQ);
+
+        prev = curthr;
+        TRACE(TRACE_SWITCH, prev, next, next->kt_proc->p_pid);
+        curthr = next;
+        curproc = next->kt_proc;
+        fpu_switch(next);
+        context_switch(&prev->kt_ctx, &next->kt_ctx);
+
+        intr_setipl(oldipl);
+}
+
+void
+sched_make_runnable(kthread_t *thr)
+{
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        KASSERT(-1 == sched_runq_level(thr->kt_wchan));
+        if (KT_SLEEP == thr->kt_state || KT_SLEEP_CANCELLABLE == thr->kt_state)
+                sched_account(thr, sched_info(thr), SCHED_LAT_BLOCK);
+        else
+                sched_info(thr)->si_stamp = cpuid_rdtsc();
+        thr->kt_state = KT_RUN;
+        runq_enqueue(thr);
+        intr_setipl(oldipl);
+}
+
+int
+sched_tick(void)
+{
+        sched_info_t *si;
+        kthread_t *thr;
+        ktqueue_t all;
+        int expired = 0;
+
+        if (0 == ++sched_ticks % SCHED_BOOST_TICKS) {
+                /* everything back to the top: the runnable threads now
+                 * (in the order they would have run), the others when
+                 * they are next made runnable */
+                sched_epoch++;
+                sched_queue_init(&all);
+                while (NULL != (thr = runq_dequeue()))
+                        ktqueue_enqueue(&all, thr);
+                while (NULL != (thr = ktqueue_dequeue(&all)))
+                        runq_enqueue(thr);
+        }
+
+        if (NULL == curthr || KT_RUN != curthr->kt_state || NULL != curthr->kt_wchan)
+                return 0;
+        si = sched_info(curthr);
+        if (si->si_epoch != sched_epoch)
+                sched_boost(si);
+        if (++si->si_ticks >= SCHED_QUANTUM(si->si_level)) {
+                if (si->si_level < SCHED_NLEVELS - 1)
+                        si->si_level++;
+                si->si_ticks = 0;
+                expired = 1;
+        }
+
+        /* someone more favoured is waiting */
+        if (0 != kt_runq_bitmap
+            && (kt_runq_bitmap & ((1U << sched_prio(si)) - 1)))
+                expired = 1;
+        return expired;
+}
+
+void
+sched_need_resched(void)
+{
+        sched_resched = 1;
+}
+
+void
+sched_preempt(void)
+{
+        if (!sched_resched)
+                return;
+        sched_resched = 0;
+        if (KT_RUN != curthr->kt_state || NULL != curthr->kt_wchan)
+                return;
+
+        /* as in a system call, the switch happens with interrupts on,
+         * and the interrupt returns when this thread is next run */
+        intr_enable();
+        sched_make_runnable(curthr);
+        sched_switch();
+}
+
+void
+sched_preempt_disable(void)
+{
+        sched_info(curthr)->si_preempt++;
+}
+
+void
+sched_preempt_enable(void)
+{
+        sched_info_t *si = sched_info(curthr);
+
+        KASSERT(0 < si->si_preempt);
+        si->si_preempt--;
+}
+
+int
+sched_cond_resched(void)
+{
+#ifdef __KPREEMPT__
+        if (!sched_resched || NULL == curthr)
+                return 0;
+        /* the thread has to be able to sleep here */
+        if (0 != sched_info(curthr)->si_preempt || 0 != spinlock_nheld()
+            || IPL_LOW != intr_getipl())
+                return 0;
+        if (KT_RUN != curthr->kt_state || NULL != curthr->kt_wchan)
+                return 0;
+
+        sched_resched = 0;
+        sched_nkpreempts++;
+        sched_make_runnable(curthr);
+        sched_switch();
+        return 1;
+#else
+        return 0;
+#endif
+}
+
+int
+sched_nice(kthread_t *thr, int inc)
+{
+        sched_info_t *si = sched_info(thr);
+        uint8_t oldipl = intr_getipl();
+        int nice, level;
+
+        nice = si->si_nice + inc;
+        if (nice < 0)
+                nice = 0;
+        else if (nice > SCHED_NICE_MAX)
+                nice = SCHED_NICE_MAX;
+
+        intr_setipl(IPL_HIGH);
+        si->si_nice = nice;
+        if (si->si_level < sched_floor(nice)) {
+                /* a runnable thread moves to its new level's queue */
+                if (-1 != (level = sched_runq_level(thr->kt_wchan))) {
+                        ktqueue_remove(&kt_runq[level], thr);
+                        if (sched_queue_empty(&kt_runq[level]))
+                                kt_runq_bitmap &= ~(1U << level);
+                }
+                si->si_level = sched_floor(nice);
+                si->si_ticks = 0;
+                if (-1 != level)
+                        runq_enqueue(thr);
+        }
+        intr_setipl(oldipl);
+
+        return nice;
+}
+
+int
+sched_affinity_valid(uint32_t mask)
+{
+        return 0 != (mask & sched_online() & SCHED_CPUS);
+}
+
+void
+sched_setaffinity(kthread_t *thr, uint32_t mask)
+{
+        KASSERT(sched_affinity_valid(mask));
+        sched_info(thr)->si_affinity = mask & sched_online();
+}
+
+uint32_t
+sched_getaffinity(kthread_t *thr)
+{
+        return sched_info(thr)->si_affinity;
+}
+
+/* Sets the level lent to thr, moving it to the run queue it now belongs
+ * on if it is runnable. Interrupts must be blocked */
+static void
+sched_set_lent(kthread_t *thr, sched_info_t *si, int lent)
+{
+        int level = sched_runq_level(thr->kt_wchan);
+
+        if (-1 != level) {
+                ktqueue_remove(&kt_runq[level], thr);
+                if (sched_queue_empty(&kt_runq[level]))
+                        kt_runq_bitmap &= ~(1U << level);
+        }
+        si->si_lent = lent;
+        if (-1 != level)
+                runq_enqueue(thr);
+}
+
+void
+sched_mutex_wait(kmutex_t *mtx)
+{
+        sched_info_t *si = sched_info(curthr);
+        uint8_t oldipl = intr_getipl();
+        int prio = sched_prio(si);
+        int depth;
+
+        intr_setipl(IPL_HIGH);
+        si->si_blocked = mtx;
+        for (depth = 0; depth < SCHED_LEND_DEPTH && NULL != mtx
+             && NULL != mtx->km_holder; depth++) {
+                kthread_t *thr = mtx->km_holder;
+                sched_info_t *hi = sched_info(thr);
+
+                if (sched_prio(hi) <= prio)
+                        break;
+                sched_set_lent(thr, hi, prio);
+                mtx = hi->si_blocked;
+        }
+        intr_setipl(oldipl);
+}
+
+void
+sched_mutex_acquired(kmutex_t *mtx)
+{
+        sched_info_t *si = sched_info(curthr);
+
+        KASSERT(curthr == mtx->km_holder);
+        si->si_blocked = NULL;
+        si->si_nmutexes++;
+}
+
+void
+sched_mutex_released(kmutex_t *mtx)
+{
+        sched_info_t *si = sched_info(curthr);
+        uint8_t oldipl = intr_getipl();
+        kthread_t *thr;
+
+        KASSERT(0 < si->si_nmutexes);
+        intr_setipl(IPL_HIGH);
+        if (0 == --si->si_nmutexes)
+                si->si_lent = SCHED_NLEVELS;
+
+        /* the new holder is owed the levels of those still waiting */
+        if (NULL != (thr = mtx->km_holder)) {
+                sched_info_t *hi = sched_info(thr);
+                kthread_t *w;
+                int prio = sched_prio(hi);
+
+                list_iterate_begin(&mtx->km_waitq.tq_list, w, kthread_t, kt_qlink) {
+                        prio = MIN(prio, sched_prio(sched_info(w)));
+                } list_iterate_end();
+                hi->si_blocked = NULL;
+                if (prio < sched_prio(hi))
+                        sched_set_lent(thr, hi, prio);
+        }
+        intr_setipl(oldipl);
+}
+
+static size_t
+sched_latency_hist_info(const sched_latency_t *sl, char *buf, size_t osize)
+{
+        static const char *names[2] = { "runq", "block" };
+        size_t size = osize;
+        int w;
+
+        iprintf(&buf, &size, "%-10s %10s %12s\n", "wait", "count", "mean cycles");
+        for (w = SCHED_LAT_RUNQ; w <= SCHED_LAT_BLOCK; w++) {
+                iprintf(&buf, &size, "%-10s %10u %12u\n", names[w], sl->sl_count[w],
+                        math_average(sl->sl_cycles[w], sl->sl_count[w]));
+                math_log2_info(&buf, &size, sl->sl_hist[w], SCHED_LAT_BUCKETS);
+        }
+        return size;
+}
+
+size_t
+sched_latency_info(const void *data, char *buf, size_t osize)
+{
+        const proc_t *p = data;
+        size_t size = osize;
+        sched_channel_t *sc;
+        kthread_t *thr;
+        int i;
+
+        if (NULL != p) {
+                if (NULL == p->p_vmmap)
+                        return size;
+                size = sched_latency_hist_info(&p->p_vmmap->vmm_sched, buf, size);
+                buf += osize - size;
+                iprintf(&buf, &size, "%-10s %20s %20s\n", "thread",
+                        "runq cycles", "block cycles");
+                list_iterate_begin(&p->p_threads, thr, kthread_t, kt_plink) {
+                        sched_info_t *si;
+
+                        if (KT_EXITED == thr->kt_state)
+                                continue;
+                        si = sched_info(thr);
+                        iprintf(&buf, &size, "0x%08x %20llu %20llu\n", (uintptr_t) thr,
+                                si->si_cycles[SCHED_LAT_RUNQ],
+                                si->si_cycles[SCHED_LAT_BLOCK]);
+                } list_iterate_end();
+                return size;
+        }
+
+        size = sched_latency_hist_info(&sched_latency, buf, size);
+        buf += osize - size;
+#ifdef __KPREEMPT__
+        iprintf(&buf, &size, "kernel preemptions: %u\n", sched_nkpreempts);
+#endif
+        iprintf(&buf, &size, "%-10s %10s %12s\n", "wchan", "sleeps", "mean cycles");
+        for (i = 0; i <= SCHED_NCHANNELS; i++) {
+                sc = (SCHED_NCHANNELS == i) ? &sched_channel_other : &sched_channels[i];
+                if (0 == sc->sc_nsleeps)
+                        continue;
+                if (SCHED_NCHANNELS == i)
+                        iprintf(&buf, &size, "%-10s", "other");
+                else
+                        iprintf(&buf, &size, "0x%08x", (uintptr_t) sc->sc_wchan);
+                iprintf(&buf, &size, " %10u %12u\n", sc->sc_nsleeps,
+                        math_average(sc->sc_cycles, sc->sc_nsleeps));
+        }
+        return size;
+}
+
+void
+sched_latency_reset(void)
+{
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        memset(&sched_latency, 0, sizeof(sched_latency));
+        memset(sched_channels, 0, sizeof(sched_channels));
+        memset(&sched_channel_other, 0, sizeof(sched_channel_other));
+        intr_setipl(oldipl);
+}
@@ -0,0 +1,130 @@
+#include "globals.h"
+#include "kernel.h"
+
+#include "main/cpuid.h"
+#include "main/interrupt.h"
+
+#include "proc/kthread.h"
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/printf.h"
+
+/*
+ * Spinlocks, for the allocators and caches which are used too often,
+ * and for too short a time, to sleep on a kmutex. A lock is taken with
+ * an xchg, spinning on a plain read (with pause) while it is held, so
+ * the spin does not keep pulling the lock's line from its holder.
+ *
+ * Threads only run on the boot processor, without preemption, so the
+ * only way a lock can be found held is by its own holder, or by an
+ * interrupt handler over it: a deadlock either way. Rather than hang,
+ * spin_lock asserts against the first and panics after spinning for
+ * far too long. Each lock still counts how contended it was, which
+ * says where the kernel would have to be split further once threads
+ * run on the other processors.
+ */
+
+/* spins before spin_lock gives up on a lock ever being released */
+#define SPINLOCK_DEADLOCK_SPINS (1U << 28)
+
+static list_t spinlock_list = { &spinlock_list, &spinlock_list };
+static int spinlock_held;       /* by this processor */
+
+static inline uint32_t
+spinlock_xchg(volatile uint32_t *p, uint32_t val)
+{
+        __asm__ volatile("xchgl %0, %1" : "+r"(val), "+m"(*p) : : "memory");
+        return val;
+}
+
+void
+spinlock_init(spinlock_t *lock, const char *name)
+{
+        lock->sl_locked = 0;
+        lock->sl_name = name;
+        lock->sl_holder = NULL;
+        lock->sl_nacquired = 0;
+        lock->sl_ncontended = 0;
+        lock->sl_spin_cycles = 0;
+        list_insert_tail(&spinlock_list, &lock->sl_link);
+}
+
+void
+spin_lock(spinlock_t *lock)
+{
+        uint64_t start;
+        uint32_t spins = 0;
+
+        KASSERT(NULL == curthr || curthr != lock->sl_holder);
+
+        if (0 != spinlock_xchg(&lock->sl_locked, 1)) {
+                start = cpuid_rdtsc();
+                do {
+                        while (lock->sl_locked) {
+                                __asm__ volatile("pause");
+                                if (++spins == SPINLOCK_DEADLOCK_SPINS)
+                                        panic("spinlock %s held too long by thread %p\n",
+                                              lock->sl_name, lock->sl_holder);
+                        }
+                } while (0 != spinlock_xchg(&lock->sl_locked, 1));
+                lock->sl_ncontended++;
+                lock->sl_spin_cycles += cpuid_rdtsc() - start;
+        }
+        lock->sl_nacquired++;
+        lock->sl_holder = curthr;
+        spinlock_held++;
+}
+
+void
+spin_unlock(spinlock_t *lock)
+{
+        KASSERT(lock->sl_locked && 0 < spinlock_held);
+
+        lock->sl_holder = NULL;
+        spinlock_held--;
+        /* everything done under the lock is seen before it is free (x86
+         * does not reorder stores, so the compiler is all to stop) */
+        __asm__ volatile("" : : : "memory");
+        lock->sl_locked = 0;
+}
+
+uint8_t
+spin_lock_irqsave(spinlock_t *lock)
+{
+        uint8_t ipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        spin_lock(lock);
+        return ipl;
+}
+
+void
+spin_unlock_irqrestore(spinlock_t *lock, uint8_t ipl)
+{
+        spin_unlock(lock);
+        intr_setipl(ipl);
+}
+
+int
+spinlock_nheld(void)
+{
+        return spinlock_held;
+}
+
+size_t
+spinlock_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        spinlock_t *lock;
+
+        iprintf(&buf, &size, "%-16s %10s %10s %12s\n",
+                "spinlock", "acquired", "contended", "spin kcycles");
+        list_iterate_begin(&spinlock_list, lock, spinlock_t, sl_link) {
+                iprintf(&buf, &size, "%-16s %10u %10u %12u\n", lock->sl_name,
+                        lock->sl_nacquired, lock->sl_ncontended,
+                        (uint32_t)(lock->sl_spin_cycles >> 10));
+        } list_iterate_end();
+        return size;
+}
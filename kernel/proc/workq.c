@@ -0,0 +1,141 @@
+#include "globals.h"
+#include "errno.h"
+
+#include "main/interrupt.h"
+
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/workq.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+
+/*
+ * Work is kept on a single FIFO list, which the workers take from in
+ * turn. With more than one worker, one work function blocking does not
+ * hold up the rest. Without MTP a process has only one thread, so each
+ * worker is a process of its own.
+ *
+ * As work is queued from interrupt handlers, the list is only touched
+ * with interrupts blocked.
+ */
+
+#define WORKQ_NWORKERS          2
+
+/* set up statically, so that work can be queued before the workers
+ * are started */
+static list_t workq_list = { &workq_list, &workq_list };
+static ktqueue_t workq_waitq = {        /* idle workers sleep on this */
+        { &workq_waitq.tq_list, &workq_waitq.tq_list }, 0
+};
+
+static proc_t *workq_procs[WORKQ_NWORKERS];
+static kthread_t *workq_thrs[WORKQ_NWORKERS];
+
+void
+work_init(work_t *w, work_func_t func, void *arg)
+{
+        list_link_init(&w->w_link);
+        w->w_func = func;
+        w->w_arg = arg;
+}
+
+int
+work_queue(work_t *w)
+{
+        uint8_t oldipl = intr_getipl();
+        int queued = 0;
+
+        KASSERT(NULL != w->w_func);
+        intr_setipl(IPL_HIGH);
+        if (!list_link_is_linked(&w->w_link)) {
+                list_insert_tail(&workq_list, &w->w_link);
+                sched_wakeup_on(&workq_waitq);
+                queued = 1;
+        }
+        intr_setipl(oldipl);
+        return queued;
+}
+
+int
+work_cancel(work_t *w)
+{
+        uint8_t oldipl = intr_getipl();
+        int pending;
+
+        intr_setipl(IPL_HIGH);
+        if ((pending = list_link_is_linked(&w->w_link)))
+                list_remove(&w->w_link);
+        intr_setipl(oldipl);
+        return pending;
+}
+
+/* Takes the next work item off the queue, waiting for one if there is
+ * none, or returns NULL once the worker has been cancelled and the queue
+ * is empty */
+static work_t *
+workq_next(void)
+{
+        uint8_t oldipl = intr_getipl();
+        work_t *w = NULL;
+
+        intr_setipl(IPL_HIGH);
+        while (list_empty(&workq_list)) {
+                if (0 > sched_cancellable_sleep_on(&workq_waitq))
+                        break;
+        }
+        if (!list_empty(&workq_list)) {
+                w = list_head(&workq_list, work_t, w_link);
+                list_remove(&w->w_link);
+        }
+        intr_setipl(oldipl);
+        return w;
+}
+
+static void *
+workq_run(int arg1, void *arg2)
+{
+        work_t *w;
+
+        while (NULL != (w = workq_next())) {
+                /* w may be queued again, or freed, by its function */
+                w->w_func(w->w_arg);
+        }
+        return NULL;
+}
+
+static __attribute__((unused)) void
+workq_init(void)
+{
+        int i;
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        for (i = 0; i < WORKQ_NWORKERS; i++) {
+                workq_procs[i] = proc_create("workqd");
+                KASSERT(NULL != workq_procs[i]);
+                workq_thrs[i] = kthread_create(workq_procs[i], workq_run, i, NULL);
+                KASSERT(NULL != workq_thrs[i]);
+                sched_make_runnable(workq_thrs[i]);
+        }
+}
+init_func(workq_init);
+init_depends(sched_init);
+
+void
+workq_shutdown(void)
+{
+        int i;
+
+        KASSERT(PID_IDLE == curproc->p_pid);
+        for (i = 0; i < WORKQ_NWORKERS; i++) {
+                KASSERT(NULL != workq_thrs[i]);
+                kthread_cancel(workq_thrs[i], (void *) 0);
+                workq_thrs[i] = NULL;
+        }
+        for (i = 0; i < WORKQ_NWORKERS; i++)
+                do_waitpid(workq_procs[i]->p_pid, 0, NULL);
+        KASSERT(list_empty(&workq_list));
+}
@@ -0,0 +1,307 @@
+/*
+ * The microbenchmarks for the kshell's bench command (see util/bench.h),
+ * of the operations most of the kernel's time goes to.
+ */
+
+#include "kernel.h"
+#include "errno.h"
+#include "globals.h"
+
+#include "main/cpuid.h"
+
+#include "mm/mmobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+
+#ifdef __VFS__
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#endif
+
+#ifdef __VM__
+#include "vm/anon.h"
+#endif
+
+#include "util/bench.h"
+#include "util/debug.h"
+#include "util/init.h"
+
+#define BENCH_CYCLES(t0)        ((uint32_t)(cpuid_rdtsc() - (t0)))
+
+static int
+bench_page_alloc(uint32_t *samples, int n)
+{
+        uint64_t t0;
+        void *p;
+        int i;
+
+        for (i = 0; i < n; i++) {
+                t0 = cpuid_rdtsc();
+                p = page_alloc();
+                samples[i] = BENCH_CYCLES(t0);
+                if (NULL == p)
+                        return -ENOMEM;
+                page_free(p);
+        }
+        return 0;
+}
+
+static int
+bench_page_free(uint32_t *samples, int n)
+{
+        uint64_t t0;
+        void *p;
+        int i;
+
+        for (i = 0; i < n; i++) {
+                if (NULL == (p = page_alloc()))
+                        return -ENOMEM;
+                t0 = cpuid_rdtsc();
+                page_free(p);
+                samples[i] = BENCH_CYCLES(t0);
+        }
+        return 0;
+}
+
+/* A cache of its own, so that what other allocators hold does not count */
+static slab_allocator_t *bench_allocator;
+
+static int
+bench_slab_alloc(uint32_t *samples, int n)
+{
+        uint64_t t0;
+        void *obj;
+        int i;
+
+        for (i = 0; i < n; i++) {
+                t0 = cpuid_rdtsc();
+                obj = slab_obj_alloc(bench_allocator);
+                samples[i] = BENCH_CYCLES(t0);
+                if (NULL == obj)
+                        return -ENOMEM;
+                slab_obj_free(bench_allocator, obj);
+        }
+        return 0;
+}
+
+#ifdef __VM__
+/* On an anonymous object: its first page, resident, n times */
+static int
+bench_pframe_hit(uint32_t *samples, int n)
+{
+        mmobj_t *o;
+        pframe_t *pf;
+        uint64_t t0;
+        int i, err = 0;
+
+        if (NULL == (o = anon_create()))
+                return -ENOMEM;
+        if (0 > (err = pframe_get(o, 0, &pf)))
+                goto out;
+        for (i = 0; i < n; i++) {
+                t0 = cpuid_rdtsc();
+                err = pframe_get(o, 0, &pf);
+                samples[i] = BENCH_CYCLES(t0);
+                if (0 > err)
+                        goto out;
+        }
+out:
+        o->mmo_ops->put(o);
+        return err;
+}
+
+/* Anonymous pages stay pinned until their object goes, so the miss
+ * benchmark starts a new object after this many */
+#define BENCH_PFRAME_MISS_BATCH 64
+
+/* On anonymous objects: pages which are not resident, so each is
+ * allocated and zeroed */
+static int
+bench_pframe_miss(uint32_t *samples, int n)
+{
+        mmobj_t *o = NULL;
+        pframe_t *pf;
+        uint64_t t0;
+        int i, err = 0;
+
+        for (i = 0; i < n; i++) {
+                if (0 == i % BENCH_PFRAME_MISS_BATCH) {
+                        if (NULL != o)
+                                o->mmo_ops->put(o);
+                        if (NULL == (o = anon_create()))
+                                return -ENOMEM;
+                }
+                t0 = cpuid_rdtsc();
+                err = pframe_get(o, i % BENCH_PFRAME_MISS_BATCH, &pf);
+                samples[i] = BENCH_CYCLES(t0);
+                if (0 > err)
+                        break;
+        }
+        o->mmo_ops->put(o);
+        return err;
+}
+#endif
+
+#ifdef __VFS__
+/* Of the root directory, which is always in core */
+static int
+bench_vget(uint32_t *samples, int n)
+{
+        vnode_t *vn;
+        uint64_t t0;
+        int i;
+
+        for (i = 0; i < n; i++) {
+                t0 = cpuid_rdtsc();
+                vn = vget(vfs_root_vn->vn_fs, vfs_root_vn->vn_vno);
+                samples[i] = BENCH_CYCLES(t0);
+                vput(vn);
+        }
+        return 0;
+}
+
+/* Of /dev, which the name cache usually has */
+static int
+bench_lookup(uint32_t *samples, int n)
+{
+        vnode_t *vn;
+        uint64_t t0;
+        int i, err;
+
+        for (i = 0; i < n; i++) {
+                t0 = cpuid_rdtsc();
+                err = lookup(vfs_root_vn, "dev", 3, &vn);
+                samples[i] = BENCH_CYCLES(t0);
+                if (0 > err)
+                        return err;
+                vput(vn);
+        }
+        return 0;
+}
+#endif
+
+/*
+ * The scheduling benchmarks run against a thread in a process of its
+ * own, which either yields whenever it runs (switch), or sleeps on
+ * bench_waitq and times how long after bench_stamp it woke (wakeup).
+ */
+#define BENCH_PARTNER_SWITCH    0
+#define BENCH_PARTNER_WAKEUP    1
+
+static ktqueue_t bench_waitq;
+static uint64_t bench_stamp;
+static int bench_partner_done;
+
+static void *
+bench_partner_run(int mode, void *arg)
+{
+        uint32_t *samples = (uint32_t *) arg;
+        int i = 0;
+
+        while (!bench_partner_done) {
+                if (BENCH_PARTNER_SWITCH == mode) {
+                        sched_make_runnable(curthr);
+                        sched_switch();
+                } else {
+                        sched_sleep_on(&bench_waitq);
+                        if (!bench_partner_done)
+                                samples[i++] = BENCH_CYCLES(bench_stamp);
+                }
+        }
+        return NULL;
+}
+
+static int
+bench_partner_start(int mode, uint32_t *samples)
+{
+        proc_t *p;
+        kthread_t *thr;
+
+        bench_partner_done = 0;
+        if (NULL == (p = proc_create("bench")))
+                return -ENOMEM;
+        thr = kthread_create(p, bench_partner_run, mode, samples);
+        KASSERT(NULL != thr);
+        sched_make_runnable(thr);
+        sched_make_runnable(curthr);
+        sched_switch();
+        return p->p_pid;
+}
+
+static void
+bench_partner_stop(pid_t pid)
+{
+        bench_partner_done = 1;
+        sched_broadcast_on(&bench_waitq);
+        do_waitpid(pid, 0, NULL);
+}
+
+/* Half the time to yield to the partner and be yielded back to */
+static int
+bench_switch(uint32_t *samples, int n)
+{
+        uint64_t t0;
+        int i, pid;
+
+        if (0 > (pid = bench_partner_start(BENCH_PARTNER_SWITCH, NULL)))
+                return pid;
+        for (i = 0; i < n; i++) {
+                t0 = cpuid_rdtsc();
+                sched_make_runnable(curthr);
+                sched_switch();
+                samples[i] = BENCH_CYCLES(t0) / 2;
+        }
+        bench_partner_stop(pid);
+        return 0;
+}
+
+/* From sched_wakeup_on to the woken thread running, with nothing else
+ * runnable but the waker */
+static int
+bench_wakeup(uint32_t *samples, int n)
+{
+        int i, pid;
+
+        if (0 > (pid = bench_partner_start(BENCH_PARTNER_WAKEUP, samples)))
+                return pid;
+        for (i = 0; i < n; i++) {
+                KASSERT(!sched_queue_empty(&bench_waitq));
+                bench_stamp = cpuid_rdtsc();
+                sched_wakeup_on(&bench_waitq);
+                sched_make_runnable(curthr);
+                sched_switch();
+        }
+        bench_partner_stop(pid);
+        return 0;
+}
+
+static __attribute__((unused)) void
+bench_init(void)
+{
+        bench_allocator = slab_allocator_create("bench", 64);
+        KASSERT(NULL != bench_allocator);
+        sched_queue_init(&bench_waitq);
+
+        bench_register("page_alloc", bench_page_alloc, "page_alloc of one page");
+        bench_register("page_free", bench_page_free, "page_free of one page");
+        bench_register("slab_alloc", bench_slab_alloc, "slab_obj_alloc of 64 bytes");
+#ifdef __VM__
+        bench_register("pframe_hit", bench_pframe_hit, "pframe_get of a resident page");
+        bench_register("pframe_miss", bench_pframe_miss,
+                       "pframe_get of an anonymous page which is not resident");
+#endif
+#ifdef __VFS__
+        bench_register("vget", bench_vget, "vget of a vnode in core");
+        bench_register("lookup", bench_lookup, "lookup of /dev");
+#endif
+        bench_register("switch", bench_switch, "a context switch between kernel threads");
+        bench_register("wakeup", bench_wakeup,
+                       "sched_wakeup_on until the woken thread runs");
+}
+init_func(bench_init);
+init_depends(sched_init);
@@ -0,0 +1,120 @@
+/*
+ * Tests of the generic containers (util/hash.h), run from the kshell's
+ * ctest command. The failures are reported with the rest of the tests,
+ * as DBG_TEST.
+ */
+
+#include "kernel.h"
+#include "errno.h"
+
+#include "mm/kmalloc.h"
+
+#include "test/containertest.h"
+#include "test/usertest.h"
+
+#include "util/debug.h"
+#include "util/hash.h"
+
+#define CT_NITEMS       1000
+
+typedef struct ct_item {
+        uint32_t        ci_key;
+        hlink_t         ci_hlink;
+        int             ci_in;          /* in the container under test */
+} ct_item_t;
+
+static int ct_failures;
+
+#define ct_assert(expr)                                                 \
+        do {                                                            \
+                if (!test_assert((expr), NULL))                         \
+                        ct_failures++;                                  \
+        } while (0)
+
+/* The order the items go in and come out in; 7 is prime to CT_NITEMS,
+ * so this is every index once, in an order far from sorted */
+#define CT_SHUFFLE(i)   (((i) * 7 + 3) % CT_NITEMS)
+
+static ct_item_t *
+ct_hash_find(htable_t *ht, uint32_t key)
+{
+        ct_item_t *item;
+
+        htable_iterate_begin(ht, hash_32(key), item, ct_item_t, ci_hlink) {
+                if (item->ci_key == key)
+                        return item;
+        } htable_iterate_end();
+        return NULL;
+}
+
+static void
+ct_hash(ct_item_t *items)
+{
+        htable_t ht;
+        ct_item_t *item;
+        int i, n;
+
+        htable_init(&ht);
+        ct_assert(NULL == ct_hash_find(&ht, 0));
+        for (i = 0; i < CT_NITEMS; i++) {
+                item = &items[CT_SHUFFLE(i)];
+                htable_insert(&ht, &item->ci_hlink, hash_32(item->ci_key));
+                item->ci_in = 1;
+        }
+        ct_assert(CT_NITEMS == htable_count(&ht));
+        /* it grew, unless it was out of memory */
+        ct_assert(CT_NITEMS <= 2 * (ht.ht_mask + 1));
+
+        for (i = 0; i < CT_NITEMS; i++) {
+                ct_assert(&items[i] == ct_hash_find(&ht, items[i].ci_key));
+                ct_assert(NULL == ct_hash_find(&ht, items[i].ci_key + 1));
+        }
+
+        n = 0;
+        htable_iterate_all_begin(&ht, item, ct_item_t, ci_hlink) {
+                ct_assert(item->ci_in);
+                if (0 == item->ci_key % 4) {
+                        htable_remove(&ht, &item->ci_hlink);
+                        item->ci_in = 0;
+                }
+                n++;
+        } htable_iterate_end();
+        ct_assert(CT_NITEMS == n);
+        ct_assert(CT_NITEMS / 2 == htable_count(&ht));
+        for (i = 0; i < CT_NITEMS; i++) {
+                ct_assert((items[i].ci_in ? &items[i] : NULL)
+                          == ct_hash_find(&ht, items[i].ci_key));
+        }
+
+        for (i = 0; i < CT_NITEMS; i++) {
+                if (items[i].ci_in) {
+                        htable_remove(&ht, &items[i].ci_hlink);
+                        items[i].ci_in = 0;
+                }
+        }
+        ct_assert(0 == htable_count(&ht));
+        ct_assert(NULL == htable_next(&ht, NULL));
+        htable_destroy(&ht);
+}
+
+int
+containertest_main(void)
+{
+        ct_item_t *items;
+        int i;
+
+        if (NULL == (items = kmalloc(CT_NITEMS * sizeof(*items))))
+                return -ENOMEM;
+        for (i = 0; i < CT_NITEMS; i++) {
+                items[i].ci_key = 2 * i;
+                items[i].ci_in = 0;
+        }
+
+        ct_failures = 0;
+        test_init();
+        ct_hash(items);
+        test_fini();
+
+        kfree(items);
+        return ct_failures;
+}
@@ -2,20 +2,46 @@
 
 #include "command.h"
 #include "errno.h"
+#include "api/syscall.h"
 #include "priv.h"
 
 #ifdef __VFS__
+#include "fs/dcache.h"
 #include "fs/fcntl.h"
 #include "fs/file.h"
 #include "fs/vfs_syscall.h"
 #include "fs/vnode.h"
 #endif
 
+#include "main/interrupt.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+
+#include "proc/kmutex.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+#include "test/containertest.h"
 #include "test/kshell/io.h"
+#ifdef __VFS__
+#include "test/vfstest/main.h"
+#endif
 
 #include "util/debug.h"
+#include "util/bench.h"
+#include "util/printf.h"
+#include "util/profile.h"
 #include "util/string.h"
 
+#include "vm/vmmap.h"
+#include "vm/pagefault.h"
+#include "vm/ksm.h"
+#include "vm/swap.h"
+
 int kshell_help(kshell_t *ksh, int argc, char **argv)
 {
         /* Print a list of available commands */
@@ -60,7 +86,299 @@ int kshell_echo(kshell_t *ksh, int argc, char **argv)
         return 0;
 }
 
+int kshell_slabinfo(kshell_t *ksh, int argc, char **argv)
+{
+        char *buf;
+
+        if (NULL == (buf = page_alloc_n(2))) {
+                kprintf(ksh, "slabinfo: not enough memory\n");
+                return 1;
+        }
+
+        slab_allocators_info(NULL, buf, 2 * PAGE_SIZE);
+        kshell_write(ksh, buf, strnlen(buf, 2 * PAGE_SIZE));
+
+        page_free_n(buf, 2);
+        return 0;
+}
+
+int kshell_kmallocinfo(kshell_t *ksh, int argc, char **argv)
+{
+        char *buf;
+
+        if (NULL == (buf = page_alloc_n(4))) {
+                kprintf(ksh, "kmallocinfo: not enough memory\n");
+                return 1;
+        }
+
+        kmalloc_tags_info(NULL, buf, 4 * PAGE_SIZE);
+        kshell_write(ksh, buf, strnlen(buf, 4 * PAGE_SIZE));
+
+        page_free_n(buf, 4);
+        return 0;
+}
+
+int kshell_pfinfo(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[512];
+
+        pframe_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+        return 0;
+}
+
+int kshell_cachestat(kshell_t *ksh, int argc, char **argv)
+{
+        char *buf;
+
+        if (2 == argc && !strcmp(argv[1], "reset")) {
+                pframe_stat_reset();
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "Usage: cachestat [reset]\n");
+                return 0;
+        }
+
+        if (NULL == (buf = page_alloc())) {
+                kprintf(ksh, "cachestat: not enough memory\n");
+                return 1;
+        }
+
+        pframe_stat_info(NULL, buf, PAGE_SIZE);
+        kshell_write(ksh, buf, strnlen(buf, PAGE_SIZE));
+
+        page_free(buf);
+        return 0;
+}
+
+int kshell_vminfo(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[128];
+
+        vmmap_lookup_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+        page_zero_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+        swap_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+        ksm_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+        return 0;
+}
+
+int kshell_faults(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[256];
+        proc_t *p;
+
+        kprintf(ksh, "all processes:\n");
+        pagefault_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+
+        list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                if (NULL == p->p_vmmap)
+                        continue;
+                kprintf(ksh, "%d (%s):\n", p->p_pid, p->p_comm);
+                pagefault_info(&p->p_vmmap->vmm_faults, buf, sizeof(buf));
+                kprintf(ksh, "%s", buf);
+        } list_iterate_end();
+        return 0;
+}
+
+int kshell_schedlat(kshell_t *ksh, int argc, char **argv)
+{
+        char *buf;
+        proc_t *p;
+
+        if (2 == argc && !strcmp(argv[1], "reset")) {
+                sched_latency_reset();
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "Usage: schedlat [reset]\n");
+                return 0;
+        }
+
+        /* a line for each of up to 128 wait channels */
+        if (NULL == (buf = page_alloc_n(2))) {
+                kprintf(ksh, "schedlat: out of memory\n");
+                return 0;
+        }
+        kprintf(ksh, "all processes:\n");
+        sched_latency_info(NULL, buf, 2 * PAGE_SIZE);
+        kshell_write_all(ksh, buf, strlen(buf));
+        list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                if (NULL == p->p_vmmap)
+                        continue;
+                kprintf(ksh, "%d (%s):\n", p->p_pid, p->p_comm);
+                sched_latency_info(p, buf, 2 * PAGE_SIZE);
+                kshell_write_all(ksh, buf, strlen(buf));
+        } list_iterate_end();
+        page_free_n(buf, 2);
+        return 0;
+}
+
+int kshell_lockstat(kshell_t *ksh, int argc, char **argv)
+{
+        char *buf;
+
+        /* a line for each of up to 128 callers */
+        if (NULL == (buf = page_alloc_n(2))) {
+                kprintf(ksh, "lockstat: out of memory\n");
+                return 0;
+        }
+        kmutex_info(NULL, buf, 2 * PAGE_SIZE);
+        /* more than kprintf can take */
+        kshell_write_all(ksh, buf, strlen(buf));
+        spinlock_info(NULL, buf, 2 * PAGE_SIZE);
+        kshell_write_all(ksh, buf, strlen(buf));
+        page_free_n(buf, 2);
+        return 0;
+}
+
+int kshell_interrupts(kshell_t *ksh, int argc, char **argv)
+{
+        char *buf;
+
+        /* a line for each vector taken */
+        if (NULL == (buf = page_alloc_n(2))) {
+                kprintf(ksh, "interrupts: out of memory\n");
+                return 0;
+        }
+        intr_stats_info(NULL, buf, 2 * PAGE_SIZE);
+        kshell_write_all(ksh, buf, strlen(buf));
+        page_free_n(buf, 2);
+        return 0;
+}
+
+int kshell_sysstat(kshell_t *ksh, int argc, char **argv)
+{
+        char *buf;
+
+        if (2 == argc) {
+                if (!strcmp(argv[1], "on")) {
+                        syscall_stats_enable(1);
+                } else if (!strcmp(argv[1], "off")) {
+                        syscall_stats_enable(0);
+                } else if (!strcmp(argv[1], "reset")) {
+                        syscall_stats_reset();
+                } else {
+                        kprintf(ksh, "Usage: sysstat [on|off|reset]\n");
+                }
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "Usage: sysstat [on|off|reset]\n");
+                return 0;
+        }
+
+        /* two lines for each syscall made */
+        if (NULL == (buf = page_alloc_n(4))) {
+                kprintf(ksh, "sysstat: out of memory\n");
+                return 0;
+        }
+        syscall_stats_info(NULL, buf, 4 * PAGE_SIZE);
+        kshell_write_all(ksh, buf, strlen(buf));
+        page_free_n(buf, 4);
+        return 0;
+}
+
+int kshell_dbg(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[512];
+
+        if (2 == argc) {
+                if (dbg_add_modes(argv[1]) < 0)
+                        kprintf(ksh, "dbg: unknown modes in \"%s\"\n", argv[1]);
+        } else if (1 != argc) {
+                kprintf(ksh, "Usage: dbg [mode,-mode,...]\n");
+                return 0;
+        }
+
+        dbg_modes_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s\n", buf);
+        return 0;
+}
+
+int kshell_profile(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[1024];
+
+        if (2 == argc) {
+                if (!strcmp(argv[1], "start")) {
+                        if (profile_start() < 0)
+                                kprintf(ksh, "profile: out of memory\n");
+                } else if (!strcmp(argv[1], "stop")) {
+                        profile_stop();
+                } else if (!strcmp(argv[1], "dump")) {
+                        profile_dump();
+                } else {
+                        kprintf(ksh, "Usage: profile [start|stop|dump]\n");
+                }
+                return 0;
+        } else if (1 != argc) {
+                kprintf(ksh, "Usage: profile [start|stop|dump]\n");
+                return 0;
+        }
+
+        profile_info(NULL, buf, sizeof(buf));
+        kshell_write_all(ksh, buf, strlen(buf));
+        return 0;
+}
+
+int kshell_bench(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[1024];
+        int nsamples = BENCH_DEFAULT_SAMPLES, err;
+
+        if (1 == argc) {
+                bench_info(NULL, buf, sizeof(buf));
+                kshell_write_all(ksh, buf, strlen(buf));
+                return 0;
+        }
+        if (3 < argc || (3 == argc && (1 != sscanf(argv[2], "%d", &nsamples)
+                                       || 0 >= nsamples))) {
+                kprintf(ksh, "Usage: bench [name|all [samples]]\n");
+                return 0;
+        }
+
+        if (0 > (err = bench_run(argv[1], nsamples, buf, sizeof(buf)))) {
+                kprintf(ksh, "bench: %s: %s\n", argv[1],
+                        (-ENOENT == err) ? "no such benchmark"
+                        : (-EINVAL == err) ? "too many samples" : "out of memory");
+                return 0;
+        }
+        kshell_write_all(ksh, buf, strlen(buf));
+        return 0;
+}
+
+int kshell_ctest(kshell_t *ksh, int argc, char **argv)
+{
+        int failed = containertest_main();
+
+        if (0 > failed)
+                kprintf(ksh, "ctest: out of memory\n");
+        else
+                kprintf(ksh, "ctest: %d checks failed\n", failed);
+        return 0;
+}
+
 #ifdef __VFS__
+/* The results go to the DBG_TEST debug output, as the tests' do */
+int kshell_vfstest(kshell_t *ksh, int argc, char **argv)
+{
+        if (0 != vfstest_main(argc, argv))
+                kprintf(ksh, "vfstest: failed\n");
+        return 0;
+}
+
+int kshell_dcinfo(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[128];
+
+        dcache_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+        return 0;
+}
+
 int kshell_cat(kshell_t *ksh, int argc, char **argv)
 {
         if (argc < 2) {
@@ -321,3 +639,43 @@ int kshell_stat(kshell_t *ksh, int argc, char **argv)
         return exit_val;
 }
 #endif
+
+#ifdef __MOUNTING__
+int kshell_mount(kshell_t *ksh, int argc, char **argv)
+{
+        int ret;
+
+        KASSERT(NULL != ksh);
+        KASSERT(NULL != argv);
+
+        if (3 != argc && 4 != argc) {
+                kprintf(ksh, "Usage: mount TYPE DIRECTORY [DEVICE]\n");
+                return 1;
+        }
+        if ((ret = do_mount((4 == argc) ? argv[3] : NULL, argv[2], argv[1])) < 0) {
+                kprintf(ksh, "mount: cannot mount %s on `%s': %s\n",
+                        argv[1], argv[2], strerror(-ret));
+                return 1;
+        }
+        return 0;
+}
+
+int kshell_umount(kshell_t *ksh, int argc, char **argv)
+{
+        int ret;
+
+        KASSERT(NULL != ksh);
+        KASSERT(NULL != argv);
+
+        if (2 != argc) {
+                kprintf(ksh, "Usage: umount DIRECTORY\n");
+                return 1;
+        }
+        if ((ret = do_umount(argv[1])) < 0) {
+                kprintf(ksh, "umount: cannot unmount `%s': %s\n",
+                        argv[1], strerror(-ret));
+                return 1;
+        }
+        return 0;
+}
+#endif
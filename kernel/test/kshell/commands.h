@@ -8,13 +8,33 @@
 KSHELL_CMD(help);
 KSHELL_CMD(exit);
 KSHELL_CMD(echo);
+KSHELL_CMD(slabinfo);
+KSHELL_CMD(kmallocinfo);
+KSHELL_CMD(pfinfo);
+KSHELL_CMD(cachestat);
+KSHELL_CMD(vminfo);
+KSHELL_CMD(faults);
+KSHELL_CMD(schedlat);
+KSHELL_CMD(lockstat);
+KSHELL_CMD(interrupts);
+KSHELL_CMD(sysstat);
+KSHELL_CMD(dbg);
+KSHELL_CMD(profile);
+KSHELL_CMD(bench);
+KSHELL_CMD(ctest);
 #ifdef __VFS__
 KSHELL_CMD(cat);
 KSHELL_CMD(ls);
+KSHELL_CMD(dcinfo);
 KSHELL_CMD(cd);
 KSHELL_CMD(rm);
 KSHELL_CMD(link);
 KSHELL_CMD(rmdir);
 KSHELL_CMD(mkdir);
 KSHELL_CMD(stat);
+KSHELL_CMD(vfstest);
+#endif
+#ifdef __MOUNTING__
+KSHELL_CMD(mount);
+KSHELL_CMD(umount);
 #endif
@@ -34,10 +34,40 @@ static __attribute__((unused)) void kshell_init()
         kshell_add_command("help", kshell_help,
                            "prints a list of available commands");
         kshell_add_command("echo", kshell_echo, "display a line of text");
+        kshell_add_command("slabinfo", kshell_slabinfo,
+                           "display slab allocator statistics");
+        kshell_add_command("kmallocinfo", kshell_kmallocinfo,
+                           "display the kernel memory held by each kmalloc caller");
+        kshell_add_command("pfinfo", kshell_pfinfo,
+                           "display page cache and pageout statistics");
+        kshell_add_command("cachestat", kshell_cachestat,
+                           "display page cache hits and misses by object and file system [reset]");
+        kshell_add_command("vminfo", kshell_vminfo,
+                           "display address space lookup and page zeroing statistics");
+        kshell_add_command("faults", kshell_faults,
+                           "display page fault counts and costs by process");
+        kshell_add_command("schedlat", kshell_schedlat,
+                           "display run queue and sleep latency by process [reset]");
+        kshell_add_command("lockstat", kshell_lockstat,
+                           "display mutex contention by caller");
+        kshell_add_command("interrupts", kshell_interrupts,
+                           "display interrupt counts and handler times");
+        kshell_add_command("sysstat", kshell_sysstat,
+                           "display syscall counts and latencies [on|off|reset]");
+        kshell_add_command("dbg", kshell_dbg,
+                           "display or change debug modes [mode,-mode,...]");
+        kshell_add_command("profile", kshell_profile,
+                           "sample where the kernel runs [start|stop|dump]");
+        kshell_add_command("bench", kshell_bench,
+                           "run microbenchmarks [name|all [samples]]");
+        kshell_add_command("ctest", kshell_ctest,
+                           "run the tests of the hash table");
 #ifdef __VFS__
         kshell_add_command("cat", kshell_cat,
                            "concatenate files and print on the standard output");
         kshell_add_command("ls", kshell_ls, "list directory contents");
+        kshell_add_command("dcinfo", kshell_dcinfo,
+                           "display name cache statistics");
         kshell_add_command("cd", kshell_cd, "change the working directory");
         kshell_add_command("rm", kshell_rm, "remove files");
         kshell_add_command("link", kshell_link,
@@ -46,6 +76,13 @@ static __attribute__((unused)) void kshell_init()
                            "remove empty directories");
         kshell_add_command("mkdir", kshell_mkdir, "make directories");
         kshell_add_command("stat", kshell_stat, "display file status");
+        kshell_add_command("vfstest", kshell_vfstest,
+                           "run the VFS tests, or benchmark [-b [-p procs] [-f files] [-d depth] [-s size] [-i rounds]]");
+#endif
+#ifdef __MOUNTING__
+        kshell_add_command("mount", kshell_mount,
+                           "mount a file system (ramfs, procfs or s5fs)");
+        kshell_add_command("umount", kshell_umount, "unmount a file system");
 #endif
 
         kshell_add_command("exit", kshell_exit, "exits the shell");
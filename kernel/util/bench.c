@@ -0,0 +1,104 @@
+#include "kernel.h"
+#include "errno.h"
+
+#include "mm/kmalloc.h"
+
+#include "util/bench.h"
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+typedef struct bench {
+        const char   *b_name;
+        const char   *b_desc;
+        bench_func_t  b_func;
+        list_link_t   b_link;
+} bench_t;
+
+/* set up statically, so that benchmarks can be registered from any
+ * init function */
+static list_t bench_list = { &bench_list, &bench_list };
+
+void
+bench_register(const char *name, bench_func_t func, const char *desc)
+{
+        bench_t *b;
+
+        if (NULL == (b = kmalloc(sizeof(*b))))
+                panic("no memory to register benchmark %s\n", name);
+        b->b_name = name;
+        b->b_desc = desc;
+        b->b_func = func;
+        list_link_init(&b->b_link);
+        list_insert_tail(&bench_list, &b->b_link);
+}
+
+/* A shell sort, so that the percentiles can be read off */
+static void
+bench_sort(uint32_t *samples, int n)
+{
+        int gap, i, j;
+        uint32_t s;
+
+        for (gap = n / 2; gap > 0; gap /= 2) {
+                for (i = gap; i < n; i++) {
+                        s = samples[i];
+                        for (j = i; j >= gap && samples[j - gap] > s; j -= gap)
+                                samples[j] = samples[j - gap];
+                        samples[j] = s;
+                }
+        }
+}
+
+static void
+bench_run_one(bench_t *b, uint32_t *samples, int n, char **buf, size_t *size)
+{
+        int err;
+
+        memset(samples, 0, n * sizeof(*samples));
+        if (0 > (err = b->b_func(samples, n))) {
+                iprintf(buf, size, "%-12s failed: %d\n", b->b_name, err);
+                return;
+        }
+        bench_sort(samples, n);
+        iprintf(buf, size, "%-12s %9u %9u %9u %9u\n", b->b_name, samples[0],
+                samples[n / 2], samples[n - 1 - n / 100], samples[n - 1]);
+}
+
+int
+bench_run(const char *name, int nsamples, char *buf, size_t size)
+{
+        int all = !strcmp(name, "all"), found = 0;
+        uint32_t *samples;
+        bench_t *b;
+
+        if (1 > nsamples || BENCH_MAX_SAMPLES < nsamples)
+                return -EINVAL;
+        if (NULL == (samples = kmalloc(nsamples * sizeof(*samples))))
+                return -ENOMEM;
+
+        iprintf(&buf, &size, "%d samples, cycles:\n%-12s %9s %9s %9s %9s\n", nsamples,
+                "benchmark", "min", "median", "p99", "max");
+        list_iterate_begin(&bench_list, b, bench_t, b_link) {
+                if (all || !strcmp(name, b->b_name)) {
+                        found = 1;
+                        bench_run_one(b, samples, nsamples, &buf, &size);
+                }
+        } list_iterate_end();
+
+        kfree(samples);
+        return found ? 0 : -ENOENT;
+}
+
+size_t
+bench_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        bench_t *b;
+
+        list_iterate_begin(&bench_list, b, bench_t, b_link) {
+                iprintf(&buf, &size, "%-12s %s\n", b->b_name, b->b_desc);
+        } list_iterate_end();
+        return size;
+}
@@ -2,19 +2,26 @@
 #include "util/string.h"
 #include "util/printf.h"
 
+#include "util/init.h"
+
 #include "main/io.h"
 #include "main/interrupt.h"
 
 #include "kernel.h"
+#include "errno.h"
 
-/* Below is a truly terrible poll-driven serial driver that we use for debugging
+/* Below is a truly terrible serial driver that we use for debugging
  * purposes - it outputs to COM1, but
- * this can be easily changed. It does not use interrupts, and cannot read input
+ * this can be easily changed. It cannot read input. Output goes into a
+ * ring, which is sent by polling the port until interrupts are set up
+ * and by the transmitter-empty interrupt from then on
  * */
 /* This port is COM1 */
 #define PORT 0x3f8
-/* Corresponding interrupt vector */
-#define PORT_INTR 0x0d
+/* Its IRQ line */
+#define PORT_IRQ 4
+/* How many bytes the transmitter FIFO takes once empty */
+#define PORT_FIFO 16
 
 /* Special port available on Bochs emulator only. Any characters
  * written to this port are printed to the Bochs log. We use this
@@ -31,6 +38,27 @@ typedef struct dbg_mode {
 
 static int dbg_supports_bochs_e9_hack;
 
+/* The output ring. The indices only ever increase; a byte lives at its
+ * index modulo DBG_RING_SIZE. Only touched with interrupts off, which is
+ * all the locking a uniprocessor needs. */
+#define DBG_RING_SIZE 16384
+static char dbg_ring[DBG_RING_SIZE];
+static uint32_t dbg_ring_head;          /* where the next byte goes */
+static uint32_t dbg_ring_tail;          /* the next byte to send */
+static int dbg_serial_async;            /* if the interrupt drains the ring */
+
+static inline uint32_t dbg_intr_save(void)
+{
+        uint32_t flags;
+        __asm__ volatile("pushfl; popl %0; cli" : "=r"(flags) :: "memory");
+        return flags;
+}
+
+static inline void dbg_intr_restore(uint32_t flags)
+{
+        __asm__ volatile("pushl %0; popfl" :: "r"(flags) : "memory", "cc");
+}
+
 void dbg_init()
 {
 
@@ -65,19 +93,75 @@ const char *dbg_color(uint64_t d_mode)
         return NULL;
 }
 
+/* Sends the ring to the port a FIFO at a time, as far as it will take
+ * without waiting or, if 'wait', all of it. Called with interrupts off. */
+static void dbg_ring_send(int wait)
+{
+        int i;
+
+        while (dbg_ring_tail != dbg_ring_head) {
+                /* Wait until the port is free */
+                if (!(inb(PORT + 5) & 0x20)) {
+                        if (!wait)
+                                return;
+                        continue;
+                }
+                for (i = 0; i < PORT_FIFO && dbg_ring_tail != dbg_ring_head; ++i)
+                        outb(PORT, dbg_ring[dbg_ring_tail++ % DBG_RING_SIZE]);
+        }
+}
+
+static void dbg_serial_intr(regs_t *regs)
+{
+        inb(PORT + 2);          /* acknowledges it */
+        dbg_ring_send(0);
+}
+
+static __attribute__((unused)) void dbg_serial_init(void)
+{
+        if (dbg_supports_bochs_e9_hack)
+                return;
+
+        intr_register(INTR_SERIAL, dbg_serial_intr);
+        intr_map(PORT_IRQ, INTR_SERIAL);
+        dbg_serial_async = 1;
+        outb(PORT + 1, 0x02);   /* Interrupt when the transmitter empties */
+        outb(PORT + 4, 0x08);   /* OUT2, which connects the interrupt line */
+}
+init_func(dbg_serial_init);
+
 static void dbg_puts(char *c)
 {
+        uint32_t flags;
+
         if (dbg_supports_bochs_e9_hack) {
                 while (*c != '\0') {
                         outb(PORT_BOCHS, *c++);
                 }
-        } else {
-                while (*c != '\0') {
-                        /* Wait until the port is free */
-                        while (!(inb(PORT + 5) & 0x20));
-                        outb(PORT, *c++);
-                }
+                return;
         }
+
+        flags = dbg_intr_save();
+        while (*c != '\0') {
+                /* only a full ring makes us wait for the port */
+                if (DBG_RING_SIZE == dbg_ring_head - dbg_ring_tail)
+                        dbg_ring_send(1);
+                dbg_ring[dbg_ring_head++ % DBG_RING_SIZE] = *c++;
+        }
+        /* start the transmitter if it is idle; its interrupt sends the
+         * rest */
+        dbg_ring_send(!dbg_serial_async);
+        dbg_intr_restore(flags);
+}
+
+void dbg_flush(void)
+{
+        uint32_t flags;
+
+        flags = dbg_intr_save();
+        dbg_serial_async = 0;
+        dbg_ring_send(1);
+        dbg_intr_restore(flags);
 }
 
 #define BUFFER_SIZE 1024
@@ -109,9 +193,10 @@ void dbg_printinfo(dbg_infofunc_t func, const void *data)
  * searches for <code>name</code> in the list of known
  * debugging modes specified above and, if it
  * finds <code>name</code>, adds the corresponding
- * debugging mode to a list
+ * debugging mode to a list, or removes it if <code>name</code>
+ * starts with '-'. Returns -EINVAL for an unknown mode
  */
-void dbg_add_mode(const char *name)
+int dbg_add_mode(const char *name)
 {
         int cancel;
         dbg_mode_t *mode;
@@ -128,7 +213,7 @@ void dbg_add_mode(const char *name)
                         break;
         if (mode->d_name == NULL) {
                 dbg_print("Warning: Unknown debug option: \"%s\"\n", name);
-                return;
+                return -EINVAL;
         }
 
         if (cancel) {
@@ -136,22 +221,28 @@ void dbg_add_mode(const char *name)
         } else {
                 dbg_modes |= mode->d_mode;
         }
-
+        return 0;
 }
 
 /**
  * Cycles through each comma-delimited debugging option and
- * adds it to the debugging modes by calling dbg_add_mode
+ * adds it to the debugging modes by calling dbg_add_mode.
+ * The known options are all applied even if some are not;
+ * returns -EINVAL if any were unknown
  */
-void dbg_add_modes(const char *modes)
+int dbg_add_modes(const char *modes)
 {
         char env[256];
         char *name;
+        int ret = 0;
 
         strncpy(env, modes, sizeof(env));
+        env[sizeof(env) - 1] = '\0';
         /* Maybe it would be good if we did this without strtok, but I'm too lazy */
         for (name = strtok(env, ","); name; name = strtok(NULL, ","))
-                dbg_add_mode(name);
+                if (dbg_add_mode(name) < 0)
+                        ret = -EINVAL;
+        return ret;
 }
 
 size_t dbg_modes_info(const void *data, char *buf, size_t size)
@@ -198,6 +289,9 @@ void dbg_panic(const char *file, int line, const char *func, const char *fmt, ..
         va_list args;
         va_start(args, fmt);
 
+        /* the interrupt will never come; send everything before halting */
+        dbg_serial_async = 0;
+
         dbg_print("panic in %s:%u %s(): ", file, line, func);
         vsnprintf(buf, PANIC_BUFSIZE, fmt, args);
         dbg_print("%s", buf);
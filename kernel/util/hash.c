@@ -0,0 +1,103 @@
+#include "kernel.h"
+
+#include "mm/kmalloc.h"
+
+#include "util/debug.h"
+#include "util/hash.h"
+
+/* How many items to a bucket there may be before the table grows */
+#define HTABLE_LOAD     2
+
+void
+htable_init(htable_t *ht)
+{
+        ht->ht_first = NULL;
+        ht->ht_buckets = &ht->ht_first;
+        ht->ht_mask = 0;
+        ht->ht_count = 0;
+}
+
+void
+htable_destroy(htable_t *ht)
+{
+        KASSERT(0 == ht->ht_count);
+        if (&ht->ht_first != ht->ht_buckets)
+                kfree(ht->ht_buckets);
+        htable_init(ht);
+}
+
+static inline void
+htable_link(hlink_t **bucket, hlink_t *link)
+{
+        if (NULL != (link->hl_next = *bucket))
+                link->hl_next->hl_pprev = &link->hl_next;
+        link->hl_pprev = bucket;
+        *bucket = link;
+}
+
+/* Doubles the buckets if it can, moving every item to its new bucket */
+static void
+htable_grow(htable_t *ht)
+{
+        uint32_t nbuckets = 2 * (ht->ht_mask + 1);
+        hlink_t **buckets;
+        uint32_t i;
+
+        if (nbuckets > HTABLE_MAX_BUCKETS
+            || NULL == (buckets = kmalloc(nbuckets * sizeof(*buckets))))
+                return;
+        for (i = 0; i < nbuckets; i++)
+                buckets[i] = NULL;
+
+        for (i = 0; i <= ht->ht_mask; i++) {
+                hlink_t *link, *next;
+
+                for (link = ht->ht_buckets[i]; NULL != link; link = next) {
+                        next = link->hl_next;
+                        htable_link(&buckets[link->hl_hash & (nbuckets - 1)], link);
+                }
+        }
+        if (&ht->ht_first != ht->ht_buckets)
+                kfree(ht->ht_buckets);
+        ht->ht_buckets = buckets;
+        ht->ht_mask = nbuckets - 1;
+}
+
+void
+htable_insert(htable_t *ht, hlink_t *link, uint32_t hash)
+{
+        if (++ht->ht_count > HTABLE_LOAD * (ht->ht_mask + 1))
+                htable_grow(ht);
+        link->hl_hash = hash;
+        htable_link(&ht->ht_buckets[hash & ht->ht_mask], link);
+}
+
+void
+htable_remove(htable_t *ht, hlink_t *link)
+{
+        KASSERT(NULL != link->hl_pprev);
+        KASSERT(0 < ht->ht_count);
+
+        if (NULL != (*link->hl_pprev = link->hl_next))
+                link->hl_next->hl_pprev = link->hl_pprev;
+        link->hl_next = NULL;
+        link->hl_pprev = NULL;
+        ht->ht_count--;
+}
+
+hlink_t *
+htable_next(htable_t *ht, hlink_t *link)
+{
+        uint32_t i = 0;
+
+        if (NULL != link) {
+                if (NULL != link->hl_next)
+                        return link->hl_next;
+                i = (link->hl_hash & ht->ht_mask) + 1;
+        }
+        for (; i <= ht->ht_mask; i++) {
+                if (NULL != ht->ht_buckets[i])
+                        return ht->ht_buckets[i];
+        }
+        return NULL;
+}
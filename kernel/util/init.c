@@ -1,130 +1,81 @@
 #include "kernel.h"
 
-#include "mm/kmalloc.h"
-
-#include "util/list.h"
-#include "util/string.h"
 #include "util/debug.h"
 #include "util/init.h"
 
-static int _init_search_count = 0;
-
-struct init_function {
-        init_func_t  if_func;
-        const char  *if_name;
-        list_link_t  if_link;
-
-        int          if_search;
-        int          if_called;
-        list_t       if_deps;
+/* A record in the .init section, as left by the macros in util/init.h:
+ * a function's, or one of its dependencies' if ie_func is NULL */
+struct init_entry {
+        init_func_t  ie_func;
+        const void  *ie_arg;    /* the name, or the record depended on */
 };
 
-struct init_depends {
-        const char  *id_name;
-        list_link_t  id_link;
-};
+/* More than are in the kernel, so that the state can be static (the
+ * slab allocator is not up yet when this runs) */
+#define INIT_MAX_ENTRIES 256
 
-static void _init_call(list_t *funcs, struct init_function *func)
-{
-        struct init_depends *dep;
-        list_iterate_begin(&func->if_deps, dep, struct init_depends, id_link) {
-                int found = 0;
-                struct init_function *f;
-                list_iterate_begin(funcs, f, struct init_function, if_link) {
-                        if (0 == strcmp(dep->id_name, f->if_name)) {
-                                found = 1;
-                                goto done;
-                        }
-                } list_iterate_end();
-done:
+#define INIT_UNCALLED    0
+#define INIT_CALLING     1      /* its dependencies are being called */
+#define INIT_CALLED      2
 
-                if (!found) {
-                        panic("'%s' dependency for '%s' does not exist",
-                              dep->id_name, func->if_name);
-                }
+static uint8_t _init_state[INIT_MAX_ENTRIES];
 
-                if (func->if_search == f->if_search) {
-                        panic("circular dependency between '%s' and '%s'",
-                              func->if_name, f->if_name);
-                }
+#define _init_name(ent) ((const char *)(ent)->ie_arg)
 
-                dbg(DBG_INIT, "'%s' depends on '%s': ", func->if_name, f->if_name);
-                if (!f->if_called) {
-                        dbgq(DBG_INIT, "calling\n");
-                        f->if_search = func->if_search;
-                        _init_call(funcs, f);
-                } else {
-                        dbgq(DBG_INIT, "already called\n");
+static void _init_call(struct init_entry *start, struct init_entry *end,
+                       struct init_entry *func)
+{
+        struct init_entry *dep;
+
+        _init_state[func - start] = INIT_CALLING;
+        for (dep = func + 1; dep < end && NULL == dep->ie_func; dep++) {
+                struct init_entry *f = (struct init_entry *) dep->ie_arg;
+
+                KASSERT(start <= f && f < end && NULL != f->ie_func);
+                dbg(DBG_INIT, "'%s' depends on '%s': ", _init_name(func), _init_name(f));
+                switch (_init_state[f - start]) {
+                        case INIT_UNCALLED:
+                                dbgq(DBG_INIT, "calling\n");
+                                _init_call(start, end, f);
+                                break;
+                        case INIT_CALLING:
+                                panic("circular dependency between '%s' and '%s'",
+                                      _init_name(func), _init_name(f));
+                                break;
+                        default:
+                                dbgq(DBG_INIT, "already called\n");
+                                break;
                 }
-        } list_iterate_end();
-
-        KASSERT(!func->if_called);
+        }
 
-        dbg(DBG_INIT, "Calling %s (0x%p)\n", func->if_name, func->if_func);
-        func->if_func();
-        func->if_called = 1;
+        dbg(DBG_INIT, "Calling %s (0x%p)\n", _init_name(func), func->ie_func);
+        func->ie_func();
+        _init_state[func - start] = INIT_CALLED;
 }
 
 void init_call_all()
 {
-        list_t funcs;
-        char *buf, *end;
-
-        list_init(&funcs);
-        buf = (char *) &kernel_start_init;
-        end = (char *) &kernel_end_init;
-
-        while (buf < end) {
-                struct init_function *curr = kmalloc(sizeof(*curr));
-                KASSERT(NULL != curr);
+        struct init_entry *start = (struct init_entry *) &kernel_start_init;
+        struct init_entry *end = (struct init_entry *) &kernel_end_init;
+        struct init_entry *ent;
 
-                list_insert_tail(&funcs, &curr->if_link);
-                list_init(&curr->if_deps);
+        KASSERT(end - start <= INIT_MAX_ENTRIES);
+        KASSERT(start == end || NULL != start->ie_func);
 
-                KASSERT(NULL != *(uintptr_t *)buf);
-                curr->if_func = (init_func_t) * (uintptr_t *)buf;
-                curr->if_name = buf + sizeof(curr->if_func);
-                curr->if_search = 0;
-                curr->if_called = 0;
-
-                buf += sizeof(curr->if_func) + strlen(curr->if_name) + 1;
-
-                while ((NULL == *(uintptr_t *)buf) && (buf < end)) {
-                        struct init_depends *dep = kmalloc(sizeof(*dep));
-                        KASSERT(NULL != dep);
-
-                        list_insert_tail(&curr->if_deps, &dep->id_link);
-
-                        dep->id_name = buf + sizeof(curr->if_func);
-                        buf += sizeof(curr->if_func) + strlen(dep->id_name) + 1;
-                }
-        }
-
-        KASSERT(buf == end);
-
-        struct init_function *func;
         dbg(DBG_INIT, "Initialization functions and dependencies:\n");
-        list_iterate_begin(&funcs, func, struct init_function, if_link) {
-                dbgq(DBG_INIT, "%s (0x%p): ", func->if_name, func->if_func);
-                struct init_depends *dep;
-                list_iterate_begin(&func->if_deps, dep, struct init_depends, id_link) {
-                        dbgq(DBG_INIT, "%s ", dep->id_name);
-                } list_iterate_end();
-                dbgq(DBG_INIT, "\n");
-        } list_iterate_end();
-
-        list_iterate_begin(&funcs, func, struct init_function, if_link) {
-                if (!func->if_called) {
-                        func->if_search = ++_init_search_count;
-                        _init_call(&funcs, func);
+        for (ent = start; ent < end; ent++) {
+                if (NULL != ent->ie_func) {
+                        if (ent != start)
+                                dbgq(DBG_INIT, "\n");
+                        dbgq(DBG_INIT, "%s (0x%p): ", _init_name(ent), ent->ie_func);
+                } else {
+                        dbgq(DBG_INIT, "%s ", _init_name((struct init_entry *) ent->ie_arg));
                 }
-        } list_iterate_end();
+        }
+        dbgq(DBG_INIT, "\n");
 
-        list_iterate_begin(&funcs, func, struct init_function, if_link) {
-                struct init_depends *dep;
-                list_iterate_begin(&func->if_deps, dep, struct init_depends, id_link) {
-                        kfree(dep);
-                } list_iterate_end();
-                kfree(func);
-        } list_iterate_end();
+        for (ent = start; ent < end; ent++) {
+                if (NULL != ent->ie_func && INIT_UNCALLED == _init_state[ent - start])
+                        _init_call(start, end, ent);
+        }
 }
@@ -0,0 +1,175 @@
+#include "types.h"
+#include "kernel.h"
+
+#include "util/debug.h"
+#include "util/lz.h"
+#include "util/string.h"
+
+/*
+ * The compressed data is a run of sequences, each a token byte, the
+ * literals, and then a match: a two-byte little-endian offset back into
+ * what has been decompressed so far. The token's high nibble is the
+ * number of literals and its low nibble the length of the match less
+ * LZ_MIN_MATCH, either being followed (after the token for the literals,
+ * after the offset for the match) by bytes to add to it if it is 15, up
+ * to and including the first which is not 255. The last sequence has
+ * no match, which is how the end is found.
+ *
+ * Matches are found through a table of where each hash of four bytes
+ * was last seen, so only the most recent candidate is ever tried.
+ */
+
+#define LZ_MIN_MATCH    4
+#define LZ_HASH_BITS    12
+#define LZ_MAX_OFFSET   0xffff
+
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+static inline uint32_t
+lz_read32(const uint8_t *p)
+{
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint32_t
+lz_hash(uint32_t seq)
+{
+        return (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the bytes past 15 of a length, returning the new end of the
+ * output, or NULL if they do not fit before oend */
+static uint8_t *
+lz_put_length(uint8_t *op, uint8_t *oend, size_t n)
+{
+        for (n -= 15; n >= 255; n -= 255) {
+                if (op == oend)
+                        return NULL;
+                *op++ = 255;
+        }
+        if (op == oend)
+                return NULL;
+        *op++ = n;
+        return op;
+}
+
+/* Writes a sequence of nlit literals and, unless mlen is 0, a match.
+ * Returns the new end of the output, or NULL if it does not fit. */
+static uint8_t *
+lz_put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t nlit,
+                uint32_t off, size_t mlen)
+{
+        uint8_t *token;
+        size_t m = (0 == mlen) ? 0 : mlen - LZ_MIN_MATCH;
+
+        if (op == oend)
+                return NULL;
+        token = op++;
+        *token = (MIN(nlit, 15) << 4) | MIN(m, 15);
+        if (15 <= nlit && NULL == (op = lz_put_length(op, oend, nlit)))
+                return NULL;
+        if ((size_t)(oend - op) < nlit)
+                return NULL;
+        memcpy(op, lit, nlit);
+        op += nlit;
+
+        if (0 == mlen)
+                return op;
+        if (oend - op < 2)
+                return NULL;
+        *op++ = off & 0xff;
+        *op++ = off >> 8;
+        if (15 <= m && NULL == (op = lz_put_length(op, oend, m)))
+                return NULL;
+        return op;
+}
+
+size_t
+lz_compress(const void *src, size_t len, void *dst, size_t cap)
+{
+        const uint8_t *in = src, *end = in + len, *ip = in, *anchor = in;
+        uint8_t *op = dst, *oend = op + cap;
+
+        KASSERT(len <= LZ_MAX_INPUT);
+
+        memset(lz_table, 0, sizeof(lz_table));
+        while (ip + LZ_MIN_MATCH <= end) {
+                uint32_t seq = lz_read32(ip);
+                uint32_t h = lz_hash(seq);
+                const uint8_t *ref = in + lz_table[h];
+                size_t mlen;
+
+                lz_table[h] = ip - in;
+                if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != seq) {
+                        ip++;
+                        continue;
+                }
+
+                for (mlen = LZ_MIN_MATCH; ip + mlen < end && ref[mlen] == ip[mlen]; mlen++)
+                        ;
+                if (NULL == (op = lz_put_sequence(op, oend, anchor, ip - anchor,
+                                                  ip - ref, mlen)))
+                        return 0;
+                ip += mlen;
+                anchor = ip;
+        }
+
+        if (NULL == (op = lz_put_sequence(op, oend, anchor, end - anchor, 0, 0)))
+                return 0;
+        return op - (uint8_t *) dst;
+}
+
+/* Reads the bytes past 15 of a length into *n. Returns the new position
+ * in the input, or NULL if it runs off the end. */
+static const uint8_t *
+lz_get_length(const uint8_t *ip, const uint8_t *iend, size_t *n)
+{
+        uint8_t b;
+
+        do {
+                if (ip == iend)
+                        return NULL;
+                b = *ip++;
+                *n += b;
+        } while (255 == b);
+        return ip;
+}
+
+int
+lz_decompress(const void *src, size_t len, void *dst, size_t cap)
+{
+        const uint8_t *ip = src, *iend = ip + len;
+        uint8_t *out = dst, *op = out, *oend = out + cap;
+
+        while (ip < iend) {
+                uint8_t token = *ip++;
+                size_t nlit = token >> 4, mlen = token & 15;
+                uint32_t off;
+
+                if (15 == nlit && NULL == (ip = lz_get_length(ip, iend, &nlit)))
+                        return -1;
+                if ((size_t)(iend - ip) < nlit || (size_t)(oend - op) < nlit)
+                        return -1;
+                memcpy(op, ip, nlit);
+                ip += nlit;
+                op += nlit;
+
+                /* the last sequence */
+                if (ip == iend)
+                        break;
+
+                if (iend - ip < 2)
+                        return -1;
+                off = ip[0] | (ip[1] << 8);
+                ip += 2;
+                if (15 == mlen && NULL == (ip = lz_get_length(ip, iend, &mlen)))
+                        return -1;
+                mlen += LZ_MIN_MATCH;
+                if (0 == off || off > (uint32_t)(op - out) || (size_t)(oend - op) < mlen)
+                        return -1;
+                /* byte by byte, as the match may overlap what it makes */
+                for (; 0 < mlen; mlen--, op++)
+                        *op = *(op - off);
+        }
+        return op - out;
+}
@@ -58,6 +58,9 @@
 #include "types.h"
 #include "kernel.h"
 
+#include "util/math.h"
+#include "util/printf.h"
+
 /*
  * Depending on the desired operation, we view a `long long' (aka quad_t) in
  * one or more of the following formats.
@@ -405,3 +408,36 @@ int log2(int x)
 
         return result;
 }
+
+uint32_t
+math_average(uint64_t total, uint32_t count)
+{
+        if (0 == count)
+                return 0;
+        return (uint32_t)(total / count);
+}
+
+int
+math_log2_bucket(uint64_t cycles, int nbuckets)
+{
+        int bucket = 0;
+
+        if (0 != (cycles >> 32))
+                bucket = nbuckets - 1;
+        else if (0 != cycles)
+                bucket = 31 - __builtin_clz((uint32_t) cycles);
+        return MIN(bucket, nbuckets - 1);
+}
+
+void
+math_log2_info(char **buf, size_t *size, const uint32_t *hist, int nbuckets)
+{
+        int b;
+
+        iprintf(buf, size, "    log2:");
+        for (b = 0; b < nbuckets; b++) {
+                if (0 != hist[b])
+                        iprintf(buf, size, " %d:%u", b, hist[b]);
+        }
+        iprintf(buf, size, "\n");
+}
@@ -0,0 +1,133 @@
+#include "kernel.h"
+#include "errno.h"
+
+#include "main/interrupt.h"
+
+#include "mm/page.h"
+
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/profile.h"
+#include "util/string.h"
+
+/* The histogram is at most this big; the buckets grow to fit */
+#define PROFILE_MAX_NPAGES      (1 << (PAGE_NSIZES - 1))
+#define PROFILE_MIN_SHIFT       4
+
+/* How many of the busiest buckets profile_info lists */
+#define PROFILE_TOP             10
+
+static int profile_on;
+static uint32_t *profile_hist;          /* allocated on the first start */
+static uint32_t profile_npages;
+static uint32_t profile_nbuckets;
+static int profile_shift;               /* log2 of the bytes per bucket */
+static uint32_t profile_kernel;         /* samples in kernel text */
+static uint32_t profile_user;           /* samples in userland */
+static uint32_t profile_other;          /* kernel samples outside the text */
+
+void
+profile_tick(regs_t *regs)
+{
+        uintptr_t text = (uintptr_t) &kernel_start_text;
+
+        if (!profile_on)
+                return;
+        if (regs->r_cs & 0x3) {
+                profile_user++;
+        } else if (regs->r_eip >= text && regs->r_eip < (uintptr_t) &kernel_end_text) {
+                profile_hist[(regs->r_eip - text) >> profile_shift]++;
+                profile_kernel++;
+        } else {
+                profile_other++;
+        }
+}
+
+int
+profile_start(void)
+{
+        uint32_t size = (uintptr_t) &kernel_end_text - (uintptr_t) &kernel_start_text;
+        uint8_t oldipl;
+
+        if (NULL == profile_hist) {
+                profile_shift = PROFILE_MIN_SHIFT;
+                while ((size >> profile_shift) * sizeof(uint32_t)
+                       > PROFILE_MAX_NPAGES * PAGE_SIZE)
+                        profile_shift++;
+                profile_nbuckets = ((size - 1) >> profile_shift) + 1;
+                profile_npages = (profile_nbuckets * sizeof(uint32_t) + PAGE_SIZE - 1)
+                                 / PAGE_SIZE;
+                if (NULL == (profile_hist = page_alloc_n(profile_npages)))
+                        return -ENOMEM;
+        }
+
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        memset(profile_hist, 0, profile_npages * PAGE_SIZE);
+        profile_kernel = profile_user = profile_other = 0;
+        profile_on = 1;
+        intr_setipl(oldipl);
+        return 0;
+}
+
+void
+profile_stop(void)
+{
+        profile_on = 0;
+}
+
+static uintptr_t
+profile_pc(uint32_t bucket)
+{
+        return (uintptr_t) &kernel_start_text + (bucket << profile_shift);
+}
+
+size_t
+profile_info(const void *data, char *buf, size_t size)
+{
+        uint32_t top[PROFILE_TOP];
+        int ntop = 0;
+        uint32_t i;
+        int j;
+
+        KASSERT(NULL == data);
+
+        iprintf(&buf, &size, "profile %s: %u samples, %u kernel, %u user, %u other\n",
+                profile_on ? "on" : "off",
+                profile_kernel + profile_user + profile_other,
+                profile_kernel, profile_user, profile_other);
+        if (NULL == profile_hist)
+                return size;
+
+        /* insert each bucket into the top list, busiest first */
+        for (i = 0; i < profile_nbuckets; i++) {
+                if (0 == profile_hist[i])
+                        continue;
+                for (j = ntop; j > 0 && profile_hist[top[j - 1]] < profile_hist[i]; j--)
+                        if (j < PROFILE_TOP)
+                                top[j] = top[j - 1];
+                if (j < PROFILE_TOP) {
+                        top[j] = i;
+                        if (ntop < PROFILE_TOP)
+                                ntop++;
+                }
+        }
+        for (j = 0; j < ntop; j++)
+                iprintf(&buf, &size, "  0x%08x-0x%08x %8u\n", profile_pc(top[j]),
+                        profile_pc(top[j] + 1) - 1, profile_hist[top[j]]);
+        return size;
+}
+
+void
+profile_dump(void)
+{
+        uint32_t i;
+
+        dbg_print("profile: user %u\n", profile_user);
+        dbg_print("profile: other %u\n", profile_other);
+        if (NULL == profile_hist)
+                return;
+        for (i = 0; i < profile_nbuckets; i++)
+                if (0 != profile_hist[i])
+                        dbg_print("profile: 0x%08x %u\n", profile_pc(i), profile_hist[i]);
+}
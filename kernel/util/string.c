@@ -1,54 +1,219 @@
 #include "ctype.h"
 #include "errno.h"
 
+#include "main/cpuid.h"
+#include "mm/page.h"
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+
+/*
+ * The rep-prefixed string instructions move a byte per iteration with
+ * movsb/stosb, but four with movsl/stosl, so anything big enough to be
+ * worth it has its unaligned head done a byte at a time and the rest a
+ * word at a time. Short operations, and copies whose source and
+ * destination can never be aligned at once, just use the byte forms.
+ */
+#define STRING_WORD_MIN 16
+
+/* Whether the CPU has SSE2, whose movnti is used by page_copy and
+ * page_zero. Set at boot by string_init. */
+static int string_sse2;
+
+static __attribute__((unused)) void
+string_init(void)
+{
+        uint32_t eax, edx;
+
+        cpuid(CPUID_GETFEATURES, &eax, &edx);
+        string_sse2 = !!(CPUID_FEAT_EDX_SSE2 & edx);
+}
+init_func(string_init);
+
 int memcmp(const void *cs, const void *ct, size_t count)
 {
-        int ret;
-        /* Compare bytes at %esi and %edi up to %ecx bytes OR until
-         * the bytes are not equal */
-        /* If not equal, set zf = 0 and stop */
-        /* Find out zf and sf and use them to return 0,1, or -1 */
-        __asm__ volatile(
-                "xor %%eax, %%eax\n\t"  /* Zero output */
-                "cld\n\t"               /* Make sure direction is forwards */
-                "repe\n\t"
-                "cmpsb\n\t"
-                "setnz %%al\n\t"        /* If it is not zero, put 1 in low part */
-                "sets %%ah"             /* If sign set (means 2nd arg larger),
-                                         * put 1 in high part */
-                : "=a"(ret)
-                : "S"(cs), "D"(ct), "c"(count)
-                : "cc"                  /* Overwrite flags */
-        );
-        return ((ret & 1) ? ((ret >> 8) ? -1 : 1) : 0);
+        const unsigned char *s1 = cs, *s2 = ct;
+
+        /* skip over equal words, the differing one (if any) is then
+         * compared byte by byte */
+        if (count >= STRING_WORD_MIN && 0 == (((uintptr_t) s1 | (uintptr_t) s2) & 3)) {
+                while (count >= 4 && *(const uint32_t *) s1 == *(const uint32_t *) s2) {
+                        s1 += 4;
+                        s2 += 4;
+                        count -= 4;
+                }
+        }
+        for (; count; count--, s1++, s2++) {
+                if (*s1 != *s2)
+                        return (*s1 < *s2) ? -1 : 1;
+        }
+        return 0;
 }
 
 void *memcpy(void *dest, const void *src, size_t count)
 {
-        /* Move %ecx bytes from %esi to %edi */
-        __asm__ volatile(
-                "cld\n\t" /* Make sure direction is forwards */
-                "rep\n\t"
-                "movsb"
-                : /* No output */
-                : "S"(src), "D"(dest), "c"(count)
-                : "cc" /* We overwrite condition codes - i.e., flags */
-        );
+        size_t n;
+        int d0, d1, d2;
+
+        if (count >= STRING_WORD_MIN && 0 == (((uintptr_t) dest ^ (uintptr_t) src) & 3)) {
+                /* Move bytes up to a word boundary, then %ecx / 4 words,
+                 * then what is left */
+                n = -(uintptr_t) dest & 3;
+                __asm__ volatile(
+                        "cld\n\t"
+                        "rep\n\t"
+                        "movsb\n\t"
+                        "movl %4, %%ecx\n\t"
+                        "shrl $2, %%ecx\n\t"
+                        "rep\n\t"
+                        "movsl\n\t"
+                        "movl %4, %%ecx\n\t"
+                        "andl $3, %%ecx\n\t"
+                        "rep\n\t"
+                        "movsb"
+                        : "=&c"(d0), "=&S"(d1), "=&D"(d2)
+                        : "0"(n), "g"(count - n), "1"(src), "2"(dest)
+                        : "memory", "cc"
+                );
+        } else {
+                /* Move %ecx bytes from %esi to %edi */
+                __asm__ volatile(
+                        "cld\n\t" /* Make sure direction is forwards */
+                        "rep\n\t"
+                        "movsb"
+                        : "=&c"(d0), "=&S"(d1), "=&D"(d2)
+                        : "0"(count), "1"(src), "2"(dest)
+                        : "memory", "cc" /* We overwrite condition codes - i.e., flags */
+                );
+        }
         return dest;
 }
 
 void *memset(void *s, int c, size_t count)
 {
-        /* Fill %ecx bytes at %edi with %eax (actually %al) */
+        uint32_t word = (unsigned char) c;
+        size_t n;
+        int d0, d1;
+
+        if (count >= STRING_WORD_MIN) {
+                /* Fill bytes up to a word boundary, then %ecx / 4 words
+                 * of %eax (the byte four times), then what is left */
+                word |= word << 8;
+                word |= word << 16;
+                n = -(uintptr_t) s & 3;
+                __asm__ volatile(
+                        "cld\n\t"
+                        "rep\n\t"
+                        "stosb\n\t"
+                        "movl %3, %%ecx\n\t"
+                        "shrl $2, %%ecx\n\t"
+                        "rep\n\t"
+                        "stosl\n\t"
+                        "movl %3, %%ecx\n\t"
+                        "andl $3, %%ecx\n\t"
+                        "rep\n\t"
+                        "stosb"
+                        : "=&c"(d0), "=&D"(d1)
+                        : "0"(n), "g"(count - n), "a"(word), "1"(s)
+                        : "memory", "cc"
+                );
+        } else {
+                /* Fill %ecx bytes at %edi with %eax (actually %al) */
+                __asm__ volatile(
+                        "cld\n\t" /* Make sure direction is forwards */
+                        "rep\n\t"
+                        "stosb"
+                        : "=&c"(d0), "=&D"(d1)
+                        : "0"(count), "a"(word), "1"(s)
+                        : "memory", "cc" /* Overwrite flags */
+                );
+        }
+        return s;
+}
+
+/*
+ * Copies and clears whole pages. With SSE2 the stores are movnti, which
+ * bypass the cache: a page copied for copy-on-write or cleared for an
+ * anonymous fault is a whole page's worth of lines which would
+ * otherwise push out everything else, for only the few bytes the
+ * faulting instruction is about to touch. movnti stores from a general
+ * purpose register, so there is no FPU or XMM state to save. The sfence
+ * orders the stores with whatever follows (e.g. mapping the page).
+ */
+void
+page_copy(void *dest, const void *src)
+{
+        int d0, d1, d2;
+
+        KASSERT(PAGE_ALIGNED(dest) && PAGE_ALIGNED(src));
+
+        if (!string_sse2) {
+                __asm__ volatile(
+                        "cld\n\t"
+                        "rep\n\t"
+                        "movsl"
+                        : "=&c"(d0), "=&S"(d1), "=&D"(d2)
+                        : "0"(PAGE_SIZE / 4), "1"(src), "2"(dest)
+                        : "memory", "cc"
+                );
+                return;
+        }
+
         __asm__ volatile(
-                "cld\n\t" /* Make sure direction is forwards */
-                "rep\n\t"
-                "stosb"
-                : /* No output */
-                : "a"(c), "D"(s), "c"(count)
-                : "cc" /* Overwrite flags */
+                "1:\n\t"
+                "movl (%1), %%eax\n\t"
+                "movl 4(%1), %%edx\n\t"
+                "movnti %%eax, (%2)\n\t"
+                "movnti %%edx, 4(%2)\n\t"
+                "movl 8(%1), %%eax\n\t"
+                "movl 12(%1), %%edx\n\t"
+                "movnti %%eax, 8(%2)\n\t"
+                "movnti %%edx, 12(%2)\n\t"
+                "addl $16, %1\n\t"
+                "addl $16, %2\n\t"
+                "decl %0\n\t"
+                "jnz 1b\n\t"
+                "sfence"
+                : "=&r"(d0), "=&r"(d1), "=&r"(d2)
+                : "0"(PAGE_SIZE / 16), "1"(src), "2"(dest)
+                : "eax", "edx", "memory", "cc"
+        );
+}
+
+void
+page_zero(void *dest)
+{
+        int d0, d1;
+
+        KASSERT(PAGE_ALIGNED(dest));
+
+        if (!string_sse2) {
+                __asm__ volatile(
+                        "cld\n\t"
+                        "rep\n\t"
+                        "stosl"
+                        : "=&c"(d0), "=&D"(d1)
+                        : "0"(PAGE_SIZE / 4), "a"(0), "1"(dest)
+                        : "memory", "cc"
+                );
+                return;
+        }
+
+        __asm__ volatile(
+                "xorl %%eax, %%eax\n\t"
+                "1:\n\t"
+                "movnti %%eax, (%1)\n\t"
+                "movnti %%eax, 4(%1)\n\t"
+                "movnti %%eax, 8(%1)\n\t"
+                "movnti %%eax, 12(%1)\n\t"
+                "addl $16, %1\n\t"
+                "decl %0\n\t"
+                "jnz 1b\n\t"
+                "sfence"
+                : "=&r"(d0), "=&r"(d1)
+                : "0"(PAGE_SIZE / 16), "1"(dest)
+                : "eax", "memory", "cc"
         );
-        return s;
 }
 
 int strncmp(const char *cs, const char *ct, size_t count)
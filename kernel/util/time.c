@@ -2,35 +2,88 @@
 
 #include "main/interrupt.h"
 #include "main/apic.h"
-#include "main/pit.h"
+#include "main/softirq.h"
 
 #include "util/debug.h"
 #include "util/init.h"
+#include "util/profile.h"
+#include "util/time.h"
+#include "util/timer.h"
 
 #include "proc/sched.h"
 #include "proc/kthread.h"
 
-#define APIC_TIMER_IRQ 32 /* Map interrupt 32 */
+#include "vm/kdata.h"
+#include "vm/vmmap.h"
 
-#ifdef __UPREEMPT__
-static unsigned int ms = 0;
+volatile uint32_t jiffies = 0;
 
-static void pit_handler(regs_t *regs)
+static int time_started;        /* 1 once the timer is running */
+static int time_tickless;       /* 1 while it is in one-shot mode */
+static softirq_t time_softirq;  /* runs the timers */
+
+static void time_softirq_run(void *arg)
+{
+        ktimer_tick();
+}
+
+/* Puts the timer back in periodic mode, catching jiffies up with the
+ * ticks skipped while idle */
+static void time_resume(void)
 {
-  dbg(DBG_CORE, "PIT HANDLER FIRED\n");
+        jiffies += apic_timer_periodic();
+        time_tickless = 0;
+        kdata_tick();
 }
 
-/* Uncomment this to enable the apic timer to 
- * call the pit_handler for userland preemption
- */
+/* Runs every TICK_MSECS on the local APIC timer: leaves any timers which
+ * are due to its softirq, takes a profiler sample, charges the tick to
+ * the current process, and if the scheduler says the current thread's
+ * slice is up, has it preempted on the way out of the interrupt (see
+ * __intr_handler), if that is back to userland and UPREEMPT is on. */
+static void timer_handler(regs_t *regs)
+{
+        softirq_raise(&time_softirq);
+        if (time_tickless) {
+                /* the one-shot set by time_idle_enter */
+                time_resume();
+                return;
+        }
+        jiffies++;
+        kdata_tick();
+        profile_tick(regs);
+        if (NULL != curproc && NULL != curproc->p_vmmap)
+                curproc->p_vmmap->vmm_ticks++;
+        if (sched_tick())
+                sched_need_resched();
+}
 
 static __attribute__((unused)) void time_init(void)
 {
-  intr_map(APIC_TIMER_IRQ, APIC_TIMER_IRQ);
-  intr_register(APIC_TIMER_IRQ, pit_handler);
-  /* TODO: figure out how this argument converts to hertz */
-  apic_enable_periodic_timer(8);
+        softirq_init(&time_softirq, time_softirq_run, NULL);
+        intr_register(INTR_APICTIMER, timer_handler);
+        apic_enable_periodic_timer(INTR_APICTIMER, TICK_MSECS);
+        time_started = 1;
 }
 init_func(time_init);
+init_depends(ktimer_wheel_init);
+init_depends(sched_init);
 
-#endif
+void time_idle_enter(void)
+{
+        uint32_t next;
+
+        /* no point for a tick or two */
+        if (!time_started || time_tickless || (next = ktimer_next()) <= 1)
+                return;
+        apic_timer_oneshot(next);
+        time_tickless = 1;
+}
+
+void time_idle_exit(void)
+{
+        if (time_tickless) {
+                time_resume();
+                ktimer_tick();
+        }
+}
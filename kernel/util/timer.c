@@ -0,0 +1,224 @@
+#include "globals.h"
+
+#include "main/interrupt.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/time.h"
+#include "util/timer.h"
+
+/*
+ * A hierarchical timing wheel, as in Varghese and Lauck (and the Linux
+ * kernel). The first wheel has a slot for each of the next TVR_SIZE
+ * ticks; a timer due within that many ticks goes straight into the
+ * slot for the tick it is due at, and is run when the wheel gets there.
+ * Each of the TVN_LEVELS further wheels has TVN_SIZE slots, each slot
+ * covering as many ticks as the whole of the wheel below it. Whenever
+ * a wheel comes round to its first slot again, the next slot of the
+ * wheel above is emptied into it ("cascaded"), by which time every
+ * timer in that slot is due within the range of the wheel below.
+ *
+ * So adding and deleting a timer take constant time, and so does a tick
+ * apart from running the timers due at it and the occasional cascade,
+ * however many timers are pending.
+ */
+
+#define TVR_BITS        8
+#define TVN_BITS        6
+#define TVR_SIZE        (1 << TVR_BITS)
+#define TVN_SIZE        (1 << TVN_BITS)
+#define TVR_MASK        (TVR_SIZE - 1)
+#define TVN_MASK        (TVN_SIZE - 1)
+#define TVN_LEVELS      4       /* TVR_BITS + TVN_LEVELS * TVN_BITS == 32 */
+
+/* The index into wheel n (1 the first of the upper ones) of a time */
+#define TVN_INDEX(time, n)      (((time) >> (TVR_BITS + ((n) - 1) * TVN_BITS)) & TVN_MASK)
+
+static list_t ktimer_tv1[TVR_SIZE];
+static list_t ktimer_tvn[TVN_LEVELS][TVN_SIZE];
+
+/* The next tick whose timers have not been run */
+static uint32_t ktimer_clock;
+
+static __attribute__((unused)) void
+ktimer_wheel_init(void)
+{
+        int i, j;
+
+        for (i = 0; i < TVR_SIZE; i++)
+                list_init(&ktimer_tv1[i]);
+        for (i = 0; i < TVN_LEVELS; i++)
+                for (j = 0; j < TVN_SIZE; j++)
+                        list_init(&ktimer_tvn[i][j]);
+        ktimer_clock = jiffies;
+}
+init_func(ktimer_wheel_init);
+
+/* Puts t in the slot for its expiry time. Interrupts must be blocked */
+static void
+ktimer_insert(ktimer_t *t)
+{
+        uint32_t expires = t->tm_expires;
+        uint32_t idx = expires - ktimer_clock;
+        list_t *slot;
+
+        if ((int32_t) idx < 0) {
+                /* already due: run it at the next tick */
+                slot = &ktimer_tv1[ktimer_clock & TVR_MASK];
+        } else if (idx < TVR_SIZE) {
+                slot = &ktimer_tv1[expires & TVR_MASK];
+        } else if (idx < 1U << (TVR_BITS + TVN_BITS)) {
+                slot = &ktimer_tvn[0][TVN_INDEX(expires, 1)];
+        } else if (idx < 1U << (TVR_BITS + 2 * TVN_BITS)) {
+                slot = &ktimer_tvn[1][TVN_INDEX(expires, 2)];
+        } else if (idx < 1U << (TVR_BITS + 3 * TVN_BITS)) {
+                slot = &ktimer_tvn[2][TVN_INDEX(expires, 3)];
+        } else {
+                slot = &ktimer_tvn[3][TVN_INDEX(expires, 4)];
+        }
+        list_insert_tail(slot, &t->tm_link);
+}
+
+/* Empties the current slot of upper wheel n into the wheels below it,
+ * returning the slot's index (0 when wheel n has come round too) */
+static int
+ktimer_cascade(int n)
+{
+        int idx = TVN_INDEX(ktimer_clock, n);
+        list_t *slot = &ktimer_tvn[n - 1][idx];
+        ktimer_t *t;
+
+        while (!list_empty(slot)) {
+                t = list_head(slot, ktimer_t, tm_link);
+                list_remove(&t->tm_link);
+                ktimer_insert(t);
+        }
+        return idx;
+}
+
+void
+ktimer_init(ktimer_t *t, ktimer_func_t func, void *arg)
+{
+        list_link_init(&t->tm_link);
+        t->tm_expires = 0;
+        t->tm_period = 0;
+        t->tm_func = func;
+        t->tm_arg = arg;
+}
+
+void
+ktimer_add(ktimer_t *t, uint32_t ticks, uint32_t period)
+{
+        uint8_t oldipl = intr_getipl();
+
+        KASSERT(NULL != t->tm_func);
+        intr_setipl(IPL_HIGH);
+        if (list_link_is_linked(&t->tm_link))
+                list_remove(&t->tm_link);
+        t->tm_expires = jiffies + (0 == ticks ? 1 : ticks);
+        t->tm_period = period;
+        ktimer_insert(t);
+        intr_setipl(oldipl);
+}
+
+int
+ktimer_del(ktimer_t *t)
+{
+        uint8_t oldipl = intr_getipl();
+        int pending;
+
+        intr_setipl(IPL_HIGH);
+        if ((pending = list_link_is_linked(&t->tm_link)))
+                list_remove(&t->tm_link);
+        intr_setipl(oldipl);
+        return pending;
+}
+
+uint32_t
+ktimer_next(void)
+{
+        uint32_t next = KTIMER_NONE, left;
+        ktimer_t *t;
+        list_t *slot;
+        int i, n;
+
+        /* the first wheel is in order, so the first non-empty slot from
+         * here has its next timer */
+        for (i = 0; i < TVR_SIZE; i++) {
+                if (!list_empty(&ktimer_tv1[(ktimer_clock + i) & TVR_MASK])) {
+                        next = ktimer_clock + i - jiffies;
+                        if ((int32_t) next < 0)
+                                next = 0;
+                        break;
+                }
+        }
+
+        /* but a timer added to an upper wheel a while ago may be due
+         * sooner, so also look at the first non-empty slot of each */
+        for (n = 1; n <= TVN_LEVELS; n++) {
+                for (i = 0; i < TVN_SIZE; i++) {
+                        slot = &ktimer_tvn[n - 1][(TVN_INDEX(ktimer_clock, n) + i) & TVN_MASK];
+                        if (list_empty(slot))
+                                continue;
+                        list_iterate_begin(slot, t, ktimer_t, tm_link) {
+                                left = t->tm_expires - jiffies;
+                                if ((int32_t) left < 0)
+                                        left = 0;
+                                if (left < next)
+                                        next = left;
+                        } list_iterate_end();
+                        break;
+                }
+        }
+        return next;
+}
+
+int
+ktimer_pending(ktimer_t *t)
+{
+        return list_link_is_linked(&t->tm_link);
+}
+
+void
+ktimer_tick(void)
+{
+        uint8_t oldipl = intr_getipl();
+        list_t due;
+        ktimer_t *t;
+        int idx;
+
+        intr_setipl(IPL_HIGH);
+        /* normally once, but more if ticks were missed */
+        while ((int32_t) (jiffies - ktimer_clock) >= 0) {
+                idx = ktimer_clock & TVR_MASK;
+                if (0 == idx
+                    && 0 == ktimer_cascade(1)
+                    && 0 == ktimer_cascade(2)
+                    && 0 == ktimer_cascade(3))
+                        ktimer_cascade(4);
+                ktimer_clock++;
+
+                /* a timer function may add or delete any timer, so take
+                 * them off the slot one at a time */
+                list_init(&due);
+                if (!list_empty(&ktimer_tv1[idx])) {
+                        due = ktimer_tv1[idx];
+                        due.l_next->l_prev = &due;
+                        due.l_prev->l_next = &due;
+                        list_init(&ktimer_tv1[idx]);
+                }
+                while (!list_empty(&due)) {
+                        t = list_head(&due, ktimer_t, tm_link);
+                        list_remove(&t->tm_link);
+                        if (0 != t->tm_period) {
+                                t->tm_expires += t->tm_period;
+                                ktimer_insert(t);
+                        }
+                        intr_setipl(oldipl);
+                        t->tm_func(t->tm_arg);
+                        intr_setipl(IPL_HIGH);
+                }
+        }
+        intr_setipl(oldipl);
+}
@@ -0,0 +1,147 @@
+#include "kernel.h"
+#include "errno.h"
+#include "globals.h"
+
+#include "api/trace.h"
+
+#include "main/interrupt.h"
+#include "main/cpuid.h"
+
+#include "mm/page.h"
+
+#include "proc/proc.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+
+/* Each ring, rounded up to pages */
+#define TRACE_RING_NPAGES \
+        ((TRACE_RING_ENTS * sizeof(trace_ent_t) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+/* The bytes of /dev/trace per class */
+#define TRACE_SEG_SIZE \
+        (sizeof(trace_hdr_t) + TRACE_RING_ENTS * sizeof(trace_ent_t))
+
+typedef struct trace_ring {
+        trace_ent_t *tr_ents;   /* NULL until the class is first on */
+        uint32_t     tr_head;   /* events ever recorded since the reset */
+} trace_ring_t;
+
+uint32_t trace_classes;
+static trace_ring_t trace_rings[TRACE_NCLASSES];
+
+void
+trace_record(uint32_t event, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+        trace_ring_t *tr = &trace_rings[TRACE_CLASS(event)];
+        uint8_t oldipl = intr_getipl();
+        trace_ent_t *te;
+
+        /* tracepoints are hit from interrupt handlers too */
+        intr_setipl(IPL_HIGH);
+        if (NULL != tr->tr_ents) {
+                te = &tr->tr_ents[tr->tr_head++ % TRACE_RING_ENTS];
+                te->te_time = cpuid_rdtsc();
+                te->te_event = event;
+                te->te_pid = (NULL == curproc) ? -1 : curproc->p_pid;
+                te->te_args[0] = a0;
+                te->te_args[1] = a1;
+                te->te_args[2] = a2;
+        }
+        intr_setipl(oldipl);
+}
+
+int
+trace_enable(uint32_t classes)
+{
+        int i;
+
+        for (i = 0; i < TRACE_NCLASSES; i++) {
+                if (!(classes & (1 << i)) || NULL != trace_rings[i].tr_ents)
+                        continue;
+                /* kept from then on, so that turning a class off and on
+                 * again does not lose what it recorded */
+                if (NULL == (trace_rings[i].tr_ents = page_alloc_n(TRACE_RING_NPAGES)))
+                        return -ENOMEM;
+                memset(trace_rings[i].tr_ents, 0, TRACE_RING_NPAGES * PAGE_SIZE);
+        }
+        trace_classes = classes;
+        return 0;
+}
+
+int
+trace_parse(const char *names, uint32_t *classes)
+{
+        static const char *class_names[TRACE_NCLASSES] = TRACE_CLASS_NAMES;
+        char buf[128];
+        char *name;
+        int i;
+
+        strncpy(buf, names, sizeof(buf));
+        buf[sizeof(buf) - 1] = '\0';
+        *classes = 0;
+        for (name = strtok(buf, ","); name; name = strtok(NULL, ",")) {
+                for (i = 0; i < TRACE_NCLASSES; i++)
+                        if (!strcmp(name, class_names[i]))
+                                break;
+                if (TRACE_NCLASSES == i)
+                        return -EINVAL;
+                *classes |= 1 << i;
+        }
+        return 0;
+}
+
+void
+trace_reset(void)
+{
+        uint8_t oldipl = intr_getipl();
+        int i;
+
+        intr_setipl(IPL_HIGH);
+        for (i = 0; i < TRACE_NCLASSES; i++)
+                trace_rings[i].tr_head = 0;
+        intr_setipl(oldipl);
+}
+
+/*
+ * Copies count bytes of the /dev/trace layout, starting at offset, to
+ * buf. A class which was never on reads as an empty ring. The rings are
+ * not frozen while they are copied, so turn tracing off first for a
+ * consistent picture.
+ */
+int
+trace_read(int offset, void *buf, int count)
+{
+        char *dst = buf;
+        int done = 0;
+
+        KASSERT(0 <= offset && 0 <= count);
+
+        while (done < count && offset < (int)(TRACE_NCLASSES * TRACE_SEG_SIZE)) {
+                int class = offset / TRACE_SEG_SIZE;
+                int off = offset % TRACE_SEG_SIZE;
+                trace_ring_t *tr = &trace_rings[class];
+                int n;
+
+                if (off < (int)sizeof(trace_hdr_t)) {
+                        trace_hdr_t th;
+                        th.th_magic = TRACE_MAGIC;
+                        th.th_class = class;
+                        th.th_size = TRACE_RING_ENTS;
+                        th.th_head = tr->tr_head;
+                        n = MIN(count - done, (int)sizeof(trace_hdr_t) - off);
+                        memcpy(dst, (char *)&th + off, n);
+                } else {
+                        off -= sizeof(trace_hdr_t);
+                        n = MIN(count - done, (int)TRACE_SEG_SIZE - (int)sizeof(trace_hdr_t) - off);
+                        if (NULL == tr->tr_ents)
+                                memset(dst, 0, n);
+                        else
+                                memcpy(dst, (char *)tr->tr_ents + off, n);
+                }
+                dst += n;
+                done += n;
+                offset += n;
+        }
+        return done;
+}
@@ -11,8 +11,18 @@
 #include "mm/slab.h"
 #include "mm/tlb.h"
 
+#include "proc/sched.h"
+
+#include "vm/anon.h"
+#include "vm/ksm.h"
+#include "vm/swap.h"
+
 int anon_count = 0; /* for debugging/verification purposes */
 
+/* Mapped read-only wherever anonymous memory which has never been written
+ * is read, see handle_pagefault. It is never written itself. */
+void *anon_zero_page = NULL;
+
 static slab_allocator_t *anon_allocator;
 
 static void anon_ref(mmobj_t *o);
@@ -39,7 +49,12 @@ static mmobj_ops_t anon_mmobj_ops = {
 void
 anon_init()
 {
-        NOT_YET_IMPLEMENTED("VM: anon_init");
+        anon_allocator = slab_allocator_create("anon", sizeof(swap_mmobj_t));
+        KASSERT(NULL != anon_allocator && "failed to create anon allocator!");
+
+        anon_zero_page = page_alloc();
+        KASSERT(NULL != anon_zero_page && "failed to allocate the zero page!");
+        page_zero(anon_zero_page);
 }
 
 /*
@@ -51,8 +66,21 @@ anon_init()
 mmobj_t *
 anon_create()
 {
-        NOT_YET_IMPLEMENTED("VM: anon_create");
-        return NULL;
+        mmobj_t *o;
+
+        if (NULL == (o = slab_obj_alloc(anon_allocator)))
+                return NULL;
+        mmobj_init(o, &anon_mmobj_ops);
+        swap_map_init(&((swap_mmobj_t *) o)->sw_map);
+        o->mmo_refcount = 1;
+        anon_count++;
+        return o;
+}
+
+int
+anon_is(mmobj_t *o)
+{
+        return &anon_mmobj_ops == o->mmo_ops;
 }
 
 /* Implementation of mmobj entry points: */
@@ -63,7 +91,8 @@ anon_create()
 static void
 anon_ref(mmobj_t *o)
 {
-        NOT_YET_IMPLEMENTED("VM: anon_ref");
+        KASSERT(NULL != o && 0 < o->mmo_refcount && &anon_mmobj_ops == o->mmo_ops);
+        o->mmo_refcount++;
 }
 
 /*
@@ -77,7 +106,30 @@ anon_ref(mmobj_t *o)
 static void
 anon_put(mmobj_t *o)
 {
-        NOT_YET_IMPLEMENTED("VM: anon_put");
+        KASSERT(NULL != o && 0 < o->mmo_refcount && &anon_mmobj_ops == o->mmo_ops);
+        KASSERT(o->mmo_refcount >= o->mmo_nrespages);
+
+        if (o->mmo_refcount - 1 == o->mmo_nrespages) {
+                pframe_t *pf;
+
+                /* each pframe_free puts o again, but takes away a page
+                 * first, so those puts do not come back here */
+                list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                        pframe_wait_busy(pf);
+                        if (pframe_is_pinned(pf))
+                                pframe_unpin(pf);
+                        pframe_free(pf);
+                } list_iterate_end();
+        }
+
+        KASSERT(o->mmo_refcount > o->mmo_nrespages);
+        if (0 < --o->mmo_refcount)
+                return;
+
+        KASSERT(0 == o->mmo_nrespages);
+        swap_map_destroy(&((swap_mmobj_t *) o)->sw_map);
+        anon_count--;
+        slab_obj_free(anon_allocator, o);
 }
 
 /* Get the corresponding page from the mmobj. No special handling is
@@ -85,29 +137,49 @@ anon_put(mmobj_t *o)
 static int
 anon_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 {
-        NOT_YET_IMPLEMENTED("VM: anon_lookuppage");
-        return -1;
+        return pframe_get(o, pagenum, pf);
 }
 
 /* The following three functions should not be difficult. */
 
+/* The page is read back if it was paged out. Otherwise it has never
+ * been written, and until now any process sharing o which read it was
+ * given the zero page, which has to go from its page table now that the
+ * page is about to be written. */
 static int
 anon_fillpage(mmobj_t *o, pframe_t *pf)
 {
-        NOT_YET_IMPLEMENTED("VM: anon_fillpage");
+        int ret;
+
+        KASSERT(pf->pf_obj == o);
+
+        if (0 > (ret = swap_in(o, pf)))
+                return ret;
+        if (0 == ret) {
+                pf->pf_addr = page_zero_replace(pf->pf_addr);
+                pframe_remove_from_pts(pf);
+        }
+        /* without swap there is nowhere to page anonymous pages out to */
+        if (!swap_enabled())
+                pframe_pin(pf);
         return 0;
 }
 
+/* A page shared with others by same-page merging gets its own copy back */
 static int
 anon_dirtypage(mmobj_t *o, pframe_t *pf)
 {
-        NOT_YET_IMPLEMENTED("VM: anon_dirtypage");
-        return -1;
+        return ksm_unmerge(pf);
 }
 
+/* If the page cannot be written out it is kept in memory for good, as it
+ * would be without swap, rather than have pageoutd come back to it */
 static int
 anon_cleanpage(mmobj_t *o, pframe_t *pf)
 {
-        NOT_YET_IMPLEMENTED("VM: anon_cleanpage");
-        return -1;
+        int ret;
+
+        if (0 > (ret = swap_out(o, pf)))
+                pframe_pin(pf);
+        return ret;
 }
@@ -51,11 +51,39 @@
  * of brk and mmap in the same process.
  *
  * Note that this function "returns" the new break through the "ret" argument.
- * Return 0 on success, -errno on failure.
+ * Return 0 on success, -errno on failure. Hold vmm_lock exclusive while
+ * changing the map.
+ *
+ * The map only changes when the break crosses a page boundary, and then
+ * the heap's area is resized in place (see vmmap_brk), so that moving the
+ * break costs no more than the system call.
  */
 int
 do_brk(void *addr, void **ret)
 {
-        NOT_YET_IMPLEMENTED("VM: do_brk");
+        vmmap_t *map = curproc->p_vmmap;
+        uint32_t oldend, newend;
+        int err = 0;
+
+        if (NULL == addr) {
+                *ret = curproc->p_brk;
+                return 0;
+        }
+        if ((uintptr_t) addr < (uintptr_t) curproc->p_start_brk
+            || (uintptr_t) addr > USER_MEM_HIGH)
+                return -ENOMEM;
+
+        oldend = ADDR_TO_PN(PAGE_ALIGN_UP(curproc->p_brk));
+        newend = ADDR_TO_PN(PAGE_ALIGN_UP(addr));
+        if (oldend != newend) {
+                krwlock_write_lock(&map->vmm_lock);
+                err = vmmap_brk(map, oldend, newend);
+                krwlock_write_unlock(&map->vmm_lock);
+                if (0 > err)
+                        return err;
+        }
+
+        curproc->p_brk = addr;
+        *ret = addr;
         return 0;
 }
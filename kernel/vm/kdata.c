@@ -0,0 +1,117 @@
+#include "globals.h"
+#include "errno.h"
+#include "config.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/mmobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+#include "util/time.h"
+
+#include "vm/kdata.h"
+#include "vm/vmmap.h"
+
+/*
+ * The kernel data page is the one page of an object which lives as long
+ * as the kernel, and which every address space maps shared and
+ * read-only. The page is filled and pinned when the object is made, so
+ * it is never paged out, and the kernel writes to it where it is in the
+ * kernel's own address space.
+ */
+
+kdata_t *kdata = NULL;
+
+static mmobj_t kdata_obj;
+
+static void
+kdata_ref(mmobj_t *o)
+{
+        KASSERT(&kdata_obj == o && 0 < o->mmo_refcount);
+        o->mmo_refcount++;
+}
+
+/* The kernel's own reference keeps it from ever being freed */
+static void
+kdata_put(mmobj_t *o)
+{
+        KASSERT(&kdata_obj == o && 1 < o->mmo_refcount);
+        o->mmo_refcount--;
+}
+
+static int
+kdata_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
+{
+        if (0 != pagenum || forwrite)
+                return -EFAULT;
+        return pframe_get(o, pagenum, pf);
+}
+
+static int
+kdata_fillpage(mmobj_t *o, pframe_t *pf)
+{
+        kdata_t *kd = (kdata_t *) pf->pf_addr;
+
+        memset(pf->pf_addr, 0, PAGE_SIZE);
+        kd->kd_jiffies = jiffies;
+        kd->kd_tick_msecs = TICK_MSECS;
+        kd->kd_free_pages = page_free_count();
+        kd->kd_page_size = PAGE_SIZE;
+        pframe_pin(pf);
+        return 0;
+}
+
+/* Only the kernel writes the page, and not through the page cache */
+static int
+kdata_dirtypage(mmobj_t *o, pframe_t *pf)
+{
+        return -EFAULT;
+}
+
+static int
+kdata_cleanpage(mmobj_t *o, pframe_t *pf)
+{
+        return 0;
+}
+
+static mmobj_ops_t kdata_mmobj_ops = {
+        .ref = kdata_ref,
+        .put = kdata_put,
+        .lookuppage = kdata_lookuppage,
+        .fillpage  = kdata_fillpage,
+        .dirtypage = kdata_dirtypage,
+        .cleanpage = kdata_cleanpage
+};
+
+static __attribute__((unused)) void
+kdata_init(void)
+{
+        pframe_t *pf;
+
+        mmobj_init(&kdata_obj, &kdata_mmobj_ops);
+        kdata_obj.mmo_refcount = 1;
+        if (0 > pframe_get(&kdata_obj, 0, &pf))
+                panic("could not allocate the kernel data page\n");
+        kdata = (kdata_t *) pf->pf_addr;
+}
+init_func(kdata_init);
+
+void
+kdata_tick(void)
+{
+        if (NULL == kdata)
+                return;
+        kdata->kd_jiffies = jiffies;
+        kdata->kd_free_pages = page_free_count();
+}
+
+int
+kdata_map(vmmap_t *map)
+{
+        return vmmap_map_obj(map, &kdata_obj, ADDR_TO_PN(KDATA_ADDR), 1,
+                             PROT_READ, MAP_SHARED);
+}
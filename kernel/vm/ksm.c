@@ -0,0 +1,355 @@
+#include "types.h"
+#include "globals.h"
+#include "kernel.h"
+#include "errno.h"
+
+#include "mm/mmobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+
+#include "proc/proc.h"
+#include "proc/workq.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/printf.h"
+#include "util/string.h"
+#include "util/timer.h"
+
+#include "vm/anon.h"
+#include "vm/ksm.h"
+#include "vm/shadow.h"
+#include "vm/vmmap.h"
+
+/*
+ * Same-page merging. Every KSM_INTERVAL_MSECS, the pages of the objects
+ * at the top of the chains of the areas of user processes (the ones each
+ * process has written) are looked at, the areas' worth of at least
+ * KSM_PAGES_PER_RUN pages at a time, and a page found to be the same as
+ * another is made to share the other's physical page, read-only, its own
+ * being freed.
+ *
+ * A shared page is a ksm_page_t, found both by the hash of what is in it
+ * and by its address. The pframes sharing it have PF_MERGED set and its
+ * address as their pf_addr. They are never mapped writable: the area
+ * would have to write-fault first, and pframe_dirty then gives the
+ * pframe a copy of its own again (see ksm_unmerge). So what is in a
+ * shared page never changes.
+ *
+ * A page which matches no shared page is remembered in ksm_unstable,
+ * one page for each hash, by object and page number rather than by
+ * pframe so that nothing need be done if it goes away. A later page
+ * with the same hash and the same contents is merged with it then.
+ * ksm_unstable is cleared at the end of each pass over the processes.
+ *
+ * Nothing here blocks, so the processes' areas and pages cannot change
+ * while they are looked at.
+ */
+
+#define KSM_INTERVAL_MSECS      500
+#define KSM_PAGES_PER_RUN       256
+#define KSM_NBUCKETS            256
+#define KSM_UNSTABLE            1024
+
+typedef struct ksm_page {
+        void       *kp_addr;
+        uint32_t    kp_hash;
+        int         kp_refcount;        /* pframes sharing it */
+        list_link_t kp_hlink;           /* on ksm_stable[kp_hash] */
+        list_link_t kp_alink;           /* on ksm_byaddr[its address] */
+} ksm_page_t;
+
+typedef struct ksm_candidate {
+        mmobj_t    *kc_obj;
+        uint32_t    kc_pagenum;
+        uint32_t    kc_hash;
+} ksm_candidate_t;
+
+static slab_allocator_t *ksm_allocator = NULL;
+static list_t ksm_stable[KSM_NBUCKETS];
+static list_t ksm_byaddr[KSM_NBUCKETS];
+static ksm_candidate_t ksm_unstable[KSM_UNSTABLE];
+
+/* Where the next run starts */
+static pid_t ksm_cursor_pid = -1;
+static uint32_t ksm_cursor_vfn = 0;
+
+static uint32_t ksm_nshared = 0;        /* shared pages */
+static uint32_t ksm_nsharing = 0;       /* pframes sharing them */
+static uint32_t ksm_npasses = 0;
+static uint32_t ksm_nunmerged = 0;
+
+#define ksm_addr_bucket(addr)   ((((uintptr_t)(addr)) >> PAGE_SHIFT) % KSM_NBUCKETS)
+
+/* FNV-1a, a word at a time */
+static uint32_t
+ksm_hash(const void *addr)
+{
+        const uint32_t *w = addr;
+        uint32_t h = 2166136261U;
+        uint32_t i;
+
+        for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++)
+                h = (h ^ w[i]) * 16777619U;
+        return h;
+}
+
+static ksm_page_t *
+ksm_lookup_addr(void *addr)
+{
+        ksm_page_t *kp;
+
+        list_iterate_begin(&ksm_byaddr[ksm_addr_bucket(addr)], kp, ksm_page_t, kp_alink) {
+                if (kp->kp_addr == addr)
+                        return kp;
+        } list_iterate_end();
+        panic("merged page %p is not shared\n", addr);
+        return NULL;
+}
+
+/* Takes kp's page off the books once nothing shares it, leaving the
+ * page itself to the caller */
+static void
+ksm_page_forget(ksm_page_t *kp)
+{
+        KASSERT(0 == kp->kp_refcount);
+
+        list_remove(&kp->kp_hlink);
+        list_remove(&kp->kp_alink);
+        slab_obj_free(ksm_allocator, kp);
+        ksm_nshared--;
+}
+
+int
+ksm_unmerge(pframe_t *pf)
+{
+        ksm_page_t *kp;
+        void *page;
+
+        if (!pframe_is_merged(pf))
+                return 0;
+        kp = ksm_lookup_addr(pf->pf_addr);
+
+        if (1 == kp->kp_refcount) {
+                /* the last one sharing it has it to itself */
+                kp->kp_refcount--;
+                ksm_page_forget(kp);
+        } else {
+                if (NULL == (page = page_alloc()))
+                        return -ENOMEM;
+                page_copy(page, pf->pf_addr);
+                /* the areas' read-only mappings are of the shared page */
+                pframe_remove_from_pts(pf);
+                pf->pf_addr = page;
+                kp->kp_refcount--;
+        }
+        pf->pf_flags &= ~PF_MERGED;
+        ksm_nsharing--;
+        ksm_nunmerged++;
+        return 0;
+}
+
+void
+ksm_release(pframe_t *pf)
+{
+        ksm_page_t *kp = ksm_lookup_addr(pf->pf_addr);
+
+        KASSERT(pframe_is_merged(pf));
+
+        pf->pf_flags &= ~PF_MERGED;
+        ksm_nsharing--;
+        if (0 == --kp->kp_refcount) {
+                ksm_page_forget(kp);
+                page_free(pf->pf_addr);
+        }
+}
+
+#ifdef __KSM__
+static work_t ksm_work;
+static ktimer_t ksm_timer;
+
+/* Makes pf, whose mappings may be writable, share kp's page */
+static void
+ksm_share(pframe_t *pf, ksm_page_t *kp)
+{
+        KASSERT(!pframe_is_merged(pf) && !pframe_is_busy(pf));
+
+        pframe_remove_from_pts(pf);
+        if (pf->pf_addr != kp->kp_addr) {
+                page_free(pf->pf_addr);
+                pf->pf_addr = kp->kp_addr;
+        }
+        pf->pf_flags |= PF_MERGED;
+        kp->kp_refcount++;
+        ksm_nsharing++;
+}
+
+/* Makes the page of pf, which is the same as that of pframe c, shared
+ * between them */
+static void
+ksm_share_new(pframe_t *c, pframe_t *pf, uint32_t hash)
+{
+        ksm_page_t *kp;
+
+        if (NULL == (kp = slab_obj_alloc(ksm_allocator)))
+                return;
+        kp->kp_addr = c->pf_addr;
+        kp->kp_hash = hash;
+        kp->kp_refcount = 0;
+        list_insert_head(&ksm_stable[hash % KSM_NBUCKETS], &kp->kp_hlink);
+        list_insert_head(&ksm_byaddr[ksm_addr_bucket(kp->kp_addr)], &kp->kp_alink);
+        ksm_nshared++;
+
+        ksm_share(c, kp);
+        ksm_share(pf, kp);
+}
+
+/* Merges pf with a shared page or a remembered page which is the same,
+ * or remembers it */
+static void
+ksm_scan_page(pframe_t *pf)
+{
+        uint32_t hash = ksm_hash(pf->pf_addr);
+        ksm_candidate_t *kc = &ksm_unstable[hash % KSM_UNSTABLE];
+        ksm_page_t *kp;
+        pframe_t *c;
+
+        list_iterate_begin(&ksm_stable[hash % KSM_NBUCKETS], kp, ksm_page_t, kp_hlink) {
+                if (kp->kp_hash == hash && 0 == memcmp(kp->kp_addr, pf->pf_addr, PAGE_SIZE)) {
+                        ksm_share(pf, kp);
+                        return;
+                }
+        } list_iterate_end();
+
+        /* the object may be gone, but then no page is found for it */
+        if (NULL != kc->kc_obj && kc->kc_hash == hash
+            && NULL != (c = pframe_get_resident(kc->kc_obj, kc->kc_pagenum))
+            && c != pf && !pframe_is_busy(c) && !pframe_is_merged(c)
+            && 0 == memcmp(c->pf_addr, pf->pf_addr, PAGE_SIZE)) {
+                kc->kc_obj = NULL;
+                ksm_share_new(c, pf, hash);
+                return;
+        }
+
+        kc->kc_obj = pf->pf_obj;
+        kc->kc_pagenum = pf->pf_pagenum;
+        kc->kc_hash = hash;
+}
+
+/* Scans the resident pages of the top objects of p's areas from the one
+ * at ksm_cursor_vfn on, a whole area at a time, until *budget of them
+ * have been looked at. Returns 0 if it ran out of budget (ksm_cursor_vfn
+ * then being where to go on from), 1 if it got through them all. The
+ * pages are gone through by object rather than looked up, which would
+ * count as a use of each of them. */
+static int
+ksm_scan_proc(proc_t *p, int *budget)
+{
+        vmarea_t *vma;
+
+        list_iterate_begin(&p->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                mmobj_t *o = vma->vma_obj;
+                pframe_t *pf;
+
+                if (0 >= *budget) {
+                        ksm_cursor_vfn = vma->vma_start;
+                        return 0;
+                }
+                if (vma->vma_start < ksm_cursor_vfn || (!anon_is(o) && !shadow_is(o)))
+                        continue;
+                list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                        (*budget)--;
+                        if (!pframe_is_busy(pf) && !pframe_is_merged(pf))
+                                ksm_scan_page(pf);
+                } list_iterate_end();
+        } list_iterate_end();
+        return 1;
+}
+
+/* Picks up where the last run stopped, in the process ksm_cursor_pid,
+ * and goes on through those after it on the process list. If that
+ * process has gone the pass starts again. */
+static void
+ksm_scan(void *arg)
+{
+        int budget = KSM_PAGES_PER_RUN;
+        int started = (-1 == ksm_cursor_pid);
+        proc_t *p;
+
+        list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                if (!started && p->p_pid != ksm_cursor_pid)
+                        continue;
+                if (!started)
+                        started = 1;
+                else
+                        ksm_cursor_vfn = 0;
+                if (PROC_RUNNING != p->p_state || NULL == p->p_vmmap)
+                        continue;
+                ksm_cursor_pid = p->p_pid;
+                if (!ksm_scan_proc(p, &budget))
+                        return;
+        } list_iterate_end();
+
+        if (started) {
+                memset(ksm_unstable, 0, sizeof(ksm_unstable));
+                ksm_npasses++;
+        }
+        ksm_cursor_pid = -1;
+        ksm_cursor_vfn = 0;
+}
+
+/* The timer function, which cannot block, so leaves the work to a
+ * worker thread */
+static void
+ksm_tick(void *arg)
+{
+        work_queue(&ksm_work);
+}
+#endif
+
+static __attribute__((unused)) void
+ksm_init(void)
+{
+        int i;
+
+        for (i = 0; i < KSM_NBUCKETS; i++) {
+                list_init(&ksm_stable[i]);
+                list_init(&ksm_byaddr[i]);
+        }
+        ksm_allocator = slab_allocator_create("ksm", sizeof(ksm_page_t));
+        KASSERT(NULL != ksm_allocator);
+
+#ifdef __KSM__
+        work_init(&ksm_work, ksm_scan, NULL);
+        ktimer_init(&ksm_timer, ksm_tick, NULL);
+        ktimer_add(&ksm_timer, MSECS_TO_TICKS(KSM_INTERVAL_MSECS),
+                   MSECS_TO_TICKS(KSM_INTERVAL_MSECS));
+#endif
+}
+init_func(ksm_init);
+init_depends(ktimer_wheel_init);
+
+/*
+ * Stop scanning. A run already queued still happens before the work
+ * queue shuts down. Pages already shared stay that way.
+ */
+void
+ksm_shutdown(void)
+{
+#ifdef __KSM__
+        KASSERT(PID_IDLE == curproc->p_pid);
+        ktimer_del(&ksm_timer);
+#endif
+}
+
+size_t
+ksm_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        iprintf(&buf, &size, "ksm: %u pages shared by %u, %u unshared again, %u passes\n",
+                ksm_nshared, ksm_nsharing, ksm_nunmerged, ksm_npasses);
+        return size;
+}
@@ -21,14 +21,20 @@
 
 /*
  * This function implements the mmap(2) syscall, but only
- * supports the MAP_SHARED, MAP_PRIVATE, MAP_FIXED, and
- * MAP_ANON flags.
+ * supports the MAP_SHARED, MAP_PRIVATE, MAP_FIXED, MAP_ANON and
+ * MAP_POPULATE flags.
  *
  * Add a mapping to the current process's address space.
  * You need to do some error checking; see the ERRORS section
  * of the manpage for the problems you should anticipate.
  * After error checking most of the work of this function is
  * done by vmmap_map(), but remember to clear the TLB.
+ *
+ * With MAP_POPULATE, the new area's pages are faulted in before
+ * returning with vmmap_populate(). The mapping is not undone if that
+ * fails; the pages will simply be faulted in when they are touched.
+ *
+ * Hold the map's vmm_lock exclusive while changing it (see vmmap.h).
  */
 int
 do_mmap(void *addr, size_t len, int prot, int flags,
@@ -44,7 +50,7 @@ do_mmap(void *addr, size_t len, int prot, int flags,
  *
  * As with do_mmap() it should perform the required error checking,
  * before calling upon vmmap_remove() to do most of the work.
- * Remember to clear the TLB.
+ * Remember to clear the TLB, and to hold vmm_lock exclusive.
  */
 int
 do_munmap(void *addr, size_t len)
@@ -53,3 +59,51 @@ do_munmap(void *addr, size_t len)
         return -1;
 }
 
+
+/*
+ * This function implements mlock(2) (if lock is set) and munlock(2).
+ * The range is widened to whole pages, all of which must be mapped;
+ * vmmap_lock() does the work.
+ */
+int
+do_mlock(const void *addr, size_t len, int lock)
+{
+        uintptr_t lo = (uintptr_t) PAGE_ALIGN_DOWN(addr);
+        uintptr_t hi = (uintptr_t) PAGE_ALIGN_UP((uintptr_t) addr + len);
+        int ret;
+
+        if (0 == len)
+                return 0;
+        if (USER_MEM_LOW > lo || USER_MEM_HIGH < hi || hi <= lo)
+                return -ENOMEM;
+
+        krwlock_write_lock(&curproc->p_vmmap->vmm_lock);
+        ret = vmmap_lock(curproc->p_vmmap, ADDR_TO_PN(lo), ADDR_TO_PN(hi - lo), lock);
+        krwlock_write_unlock(&curproc->p_vmmap->vmm_lock);
+        return ret;
+}
+
+/*
+ * This function implements madvise(2). addr must be page aligned; the
+ * length is rounded up to whole pages, all of which must be mapped.
+ * vmmap_advise() does the work.
+ */
+int
+do_madvise(void *addr, size_t len, int advice)
+{
+        uintptr_t lo = (uintptr_t) addr;
+        uintptr_t hi = (uintptr_t) PAGE_ALIGN_UP(lo + len);
+        int ret;
+
+        if (!PAGE_ALIGNED(addr))
+                return -EINVAL;
+        if (0 == len)
+                return 0;
+        if (USER_MEM_LOW > lo || USER_MEM_HIGH < hi || hi <= lo)
+                return -ENOMEM;
+
+        krwlock_write_lock(&curproc->p_vmmap->vmm_lock);
+        ret = vmmap_advise(curproc->p_vmmap, ADDR_TO_PN(lo), ADDR_TO_PN(hi - lo), advice);
+        krwlock_write_unlock(&curproc->p_vmmap->vmm_lock);
+        return ret;
+}
@@ -3,7 +3,13 @@
 #include "kernel.h"
 #include "errno.h"
 
+#include "api/trace.h"
+
 #include "util/debug.h"
+#include "util/math.h"
+#include "util/printf.h"
+
+#include "main/cpuid.h"
 
 #include "proc/proc.h"
 
@@ -13,9 +19,258 @@
 #include "mm/mmobj.h"
 #include "mm/pframe.h"
 #include "mm/pagetable.h"
+#include "mm/tlb.h"
 
 #include "vm/pagefault.h"
 #include "vm/vmmap.h"
+#include "vm/anon.h"
+#include "vm/swap.h"
+
+/* Pages around (and including) a faulting page which a read fault maps in
+ * if they are resident: the aligned block of this many containing it */
+#define FAULT_AROUND_PAGES 8
+
+/* Faults taken by all processes, see handle_pagefault; each process's
+ * own are kept in its address space */
+static pagefault_stats_t pagefault_stats;
+
+/*
+ * Finds the page of vma at vfn if it can be had without blocking: the
+ * first resident copy of it down the shadow chain, as long as it is not
+ * busy. *top is set if it is in vma's own object. A copy which is out
+ * in swap has to be read back, so it is not to be had either.
+ */
+static pframe_t *
+pagefault_resident(vmarea_t *vma, uint32_t vfn, int *top)
+{
+        uint32_t pagenum = vfn - vma->vma_start + vma->vma_off;
+        mmobj_t *o;
+
+        for (o = vma->vma_obj; NULL != o; o = o->mmo_shadowed) {
+                pframe_t *pf = pframe_get_resident(o, pagenum);
+
+                if (NULL != pf) {
+                        *top = (o == vma->vma_obj);
+                        return pframe_is_busy(pf) ? NULL : pf;
+                }
+                if (swap_holds(o, pagenum))
+                        return NULL;
+        }
+        return NULL;
+}
+
+/*
+ * Whether the page of vma at vfn has never been written: it is neither
+ * resident nor in swap anywhere down the shadow chain, and the chain ends
+ * in an anonymous object.
+ */
+static int
+pagefault_zero(vmarea_t *vma, uint32_t vfn)
+{
+        uint32_t pagenum = vfn - vma->vma_start + vma->vma_off;
+        mmobj_t *o;
+
+        for (o = vma->vma_obj; NULL != o->mmo_shadowed; o = o->mmo_shadowed) {
+                if (NULL != pframe_get_resident(o, pagenum) || swap_holds(o, pagenum))
+                        return 0;
+        }
+        return anon_is(o) && NULL == pframe_get_resident(o, pagenum)
+               && !swap_holds(o, pagenum);
+}
+
+/*
+ * Fault-around: after a read fault on vfn, maps those other pages of the
+ * surrounding FAULT_AROUND_PAGES block of vma which are already resident
+ * and not busy, so that touching them does not fault too (running a
+ * binary whose text is in the page cache takes one fault per block
+ * rather than one per page). Nothing is read in and nothing blocks.
+ *
+ * The pages are mapped read-only, so that writes still fault for
+ * copy-on-write and dirtying, except for pages which the area has
+ * already written: a private area's own copies and a shared area's dirty
+ * pages, unless same-page merging has since shared them.
+ */
+static void
+pagefault_around(vmarea_t *vma, uint32_t vfn)
+{
+        uint32_t lo = MAX(vfn & ~(FAULT_AROUND_PAGES - 1), vma->vma_start);
+        uint32_t hi = MIN((vfn | (FAULT_AROUND_PAGES - 1)) + 1, vma->vma_end);
+        tlb_batch_t tb;
+        uint32_t v;
+
+        tlb_batch_init(&tb);
+        for (v = lo; v < hi; v++) {
+                uint32_t ptflags = PT_PRESENT | PT_USER;
+                pframe_t *pf;
+                int top;
+
+                if (v == vfn || NULL == (pf = pagefault_resident(vma, v, &top)))
+                        continue;
+                if ((vma->vma_prot & PROT_WRITE) && top && !pframe_is_merged(pf)
+                    && ((vma->vma_flags & MAP_PRIVATE) || pframe_is_dirty(pf)))
+                        ptflags |= PT_WRITE;
+
+                pt_map(curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(v),
+                       pt_virt_to_phys((uintptr_t) pf->pf_addr),
+                       PD_PRESENT | PD_WRITE | PD_USER, ptflags);
+                tlb_batch_add(&tb, (uintptr_t) PN_TO_ADDR(v));
+        }
+        tlb_batch_flush(&tb);
+}
+
+/*
+ * Which kind of fault (PAGEFAULT_*) handling a fault on page vfn of vma
+ * is going to be, judged by where the page is before it is handled.
+ */
+static int
+pagefault_kind(vmarea_t *vma, uint32_t vfn, int forwrite)
+{
+        int top;
+
+        if (pagefault_zero(vma, vfn))
+                return PAGEFAULT_ZERO;
+        if (NULL == pagefault_resident(vma, vfn, &top))
+                return PAGEFAULT_MAJOR;
+        if (forwrite && (vma->vma_flags & MAP_PRIVATE) && !top)
+                return PAGEFAULT_COW;
+        return PAGEFAULT_MINOR;
+}
+
+/*
+ * Drop-behind for areas advised MADV_SEQUENTIAL: a reader which has moved
+ * on to vfn will not be back for the page of the file before it, so that
+ * page is made the first one pageoutd reclaims.
+ */
+static void
+pagefault_behind(vmarea_t *vma, uint32_t vfn)
+{
+        mmobj_t *o = mmobj_bottom_obj(vma->vma_obj);
+        pframe_t *pf;
+
+        if (vfn <= vma->vma_start || anon_is(o))
+                return;
+        if (NULL != (pf = pframe_get_resident(o, vfn - 1 - vma->vma_start + vma->vma_off)))
+                pframe_deactivate(pf);
+}
+
+/*
+ * Maps page vfn of vma into the current process's page table the way a
+ * fault of the given kind on it would (see handle_pagefault), returning
+ * -errno rather than killing the process if the page cannot be had. The
+ * caller has checked that the area permits the access.
+ *
+ * A read maps whichever page the area's object chain yields, read-only.
+ * In a private file mapping that is the vnode's own pframe until the
+ * area writes the page (the shadow object only gets a copy then), so
+ * every process running a shared library's text shares one copy of it.
+ */
+int
+pagefault_map(vmarea_t *vma, uint32_t vfn, int forwrite)
+{
+        uintptr_t vaddr = (uintptr_t) PN_TO_ADDR(vfn);
+        uint32_t ptflags = PT_PRESENT | PT_USER;
+        pframe_t *pf;
+        int ret;
+
+        KASSERT(vma->vma_vmmap == curproc->p_vmmap);
+        KASSERT(vma->vma_start <= vfn && vma->vma_end > vfn);
+
+        if (!forwrite && pagefault_zero(vma, vfn)) {
+                pt_map(curproc->p_pagedir, vaddr,
+                       pt_virt_to_phys((uintptr_t) anon_zero_page),
+                       PD_PRESENT | PD_WRITE | PD_USER, ptflags);
+                tlb_flush(vaddr);
+                return 0;
+        }
+
+        if (0 > (ret = pframe_lookup(vma->vma_obj, vfn - vma->vma_start + vma->vma_off,
+                                     forwrite, &pf)))
+                return ret;
+        if (forwrite) {
+                if (0 > (ret = pframe_dirty(pf)))
+                        return ret;
+                ptflags |= PT_WRITE;
+        }
+
+        if (0 > (ret = pt_map(curproc->p_pagedir, vaddr,
+                              pt_virt_to_phys((uintptr_t) pf->pf_addr),
+                              PD_PRESENT | PD_WRITE | PD_USER, ptflags)))
+                return ret;
+        tlb_flush(vaddr);
+
+        if (MADV_SEQUENTIAL == vma->vma_advice)
+                pagefault_behind(vma, vfn);
+        return 0;
+}
+
+/*
+ * A fault on an unmapped page may be just below the stack, which then
+ * grows to take it in (see vmmap_grow_down). Changing the area needs the
+ * map's lock exclusive, so the shared lock the fault holds is given up
+ * while it does; the area is looked up again after, as the map may have
+ * changed in between. Returns whether the stack grew.
+ */
+static int
+pagefault_grow_stack(uint32_t vfn)
+{
+        vmmap_t *map = curproc->p_vmmap;
+        int ret;
+
+        krwlock_read_unlock(&map->vmm_lock);
+        krwlock_write_lock(&map->vmm_lock);
+        ret = vmmap_grow_down(map, vfn);
+        krwlock_write_unlock(&map->vmm_lock);
+        krwlock_read_lock(&map->vmm_lock);
+        return 0 == ret;
+}
+
+/*
+ * Does the work of handle_pagefault (see below), but returns -EFAULT
+ * rather than killing the process if the access is bad or the page
+ * cannot be had. _pt_fault_handler calls it directly for a fault in
+ * copy_from_user or copy_to_user, which then fails instead.
+ */
+int
+pagefault_resolve(uintptr_t vaddr, uint32_t cause)
+{
+        uint64_t start = cpuid_rdtsc();
+        uint32_t vfn = ADDR_TO_PN(vaddr);
+        int forwrite = (cause & FAULT_WRITE) ? 1 : 0;
+        vmarea_t *vma;
+        uint64_t cycles;
+        int kind;
+
+        krwlock_read_lock(&curproc->p_vmmap->vmm_lock);
+        vma = vmmap_lookup(curproc->p_vmmap, vfn);
+        if (NULL == vma && pagefault_grow_stack(vfn))
+                vma = vmmap_lookup(curproc->p_vmmap, vfn);
+        if (NULL == vma
+            || (forwrite && !(vma->vma_prot & PROT_WRITE))
+            || ((cause & FAULT_EXEC) && !(vma->vma_prot & PROT_EXEC))
+            || (!forwrite && !(vma->vma_prot & (PROT_READ | PROT_EXEC)))) {
+                krwlock_read_unlock(&curproc->p_vmmap->vmm_lock);
+                dbg(DBG_VM, "pid %d: bad access to 0x%08x\n", curproc->p_pid, vaddr);
+                return -EFAULT;
+        }
+
+        kind = pagefault_kind(vma, vfn, forwrite);
+        if (0 > pagefault_map(vma, vfn, forwrite)) {
+                krwlock_read_unlock(&curproc->p_vmmap->vmm_lock);
+                return -EFAULT;
+        }
+
+        if (!forwrite)
+                pagefault_around(vma, vfn);
+        krwlock_read_unlock(&curproc->p_vmmap->vmm_lock);
+
+        cycles = cpuid_rdtsc() - start;
+        pagefault_stats.pfs_count[kind]++;
+        pagefault_stats.pfs_cycles[kind] += cycles;
+        curproc->p_vmmap->vmm_faults.pfs_count[kind]++;
+        curproc->p_vmmap->vmm_faults.pfs_cycles[kind] += cycles;
+        TRACE(TRACE_FAULT, vaddr, cause, cycles);
+        return 0;
+}
 
 /*
  * This gets called by _pt_fault_handler in mm/pagetable.c The
@@ -47,9 +302,36 @@
  * @param cause this is the type of operation on the memory
  *              address which caused the fault, possible values
  *              can be found in pagefault.h
+ *
+ * A read fault also maps in the resident neighbours of the page (see
+ * pagefault_around). A read of anonymous memory which has never been
+ * written maps the shared zero page read-only instead of filling in a
+ * page of zeros, which is only done once the page is written.
+ *
+ * Each fault handled is counted, by kind (see pagefault_kind) along with
+ * the cycles spent on it, both for the system and for the process.
  */
 void
 handle_pagefault(uintptr_t vaddr, uint32_t cause)
 {
-        NOT_YET_IMPLEMENTED("VM: handle_pagefault");
+        if (0 > pagefault_resolve(vaddr, cause))
+                do_exit(EFAULT);
+}
+
+size_t
+pagefault_info(const void *data, char *buf, size_t osize)
+{
+        static const char *names[PAGEFAULT_NKINDS] = {
+                "minor", "major", "cow", "zero"
+        };
+        const pagefault_stats_t *stats = (NULL == data) ? &pagefault_stats : data;
+        size_t size = osize;
+        int i;
+
+        for (i = 0; i < PAGEFAULT_NKINDS; i++) {
+                iprintf(&buf, &size, "%-6s %8u faults, %8u cycles each\n", names[i],
+                        stats->pfs_count[i],
+                        math_average(stats->pfs_cycles[i], stats->pfs_count[i]));
+        }
+        return size;
 }
@@ -11,9 +11,14 @@
 #include "mm/slab.h"
 #include "mm/tlb.h"
 
+#include "proc/sched.h"
+
 #include "vm/vmmap.h"
 #include "vm/shadow.h"
 #include "vm/shadowd.h"
+#include "vm/anon.h"
+#include "vm/ksm.h"
+#include "vm/swap.h"
 
 #define SHADOW_SINGLETON_THRESHOLD 5
 
@@ -28,12 +33,17 @@ static int shadow_singleton_count = 0;
 
 static slab_allocator_t *shadow_allocator;
 
+/* The object whose pages are being freed or migrated away, whose puts
+ * (one per page) must not start a collapse of it */
+static mmobj_t *shadow_emptying = NULL;
+
 static void shadow_ref(mmobj_t *o);
 static void shadow_put(mmobj_t *o);
 static int  shadow_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf);
 static int  shadow_fillpage(mmobj_t *o, pframe_t *pf);
 static int  shadow_dirtypage(mmobj_t *o, pframe_t *pf);
 static int  shadow_cleanpage(mmobj_t *o, pframe_t *pf);
+static void shadow_collapse(mmobj_t *o);
 
 static mmobj_ops_t shadow_mmobj_ops = {
         .ref = shadow_ref,
@@ -52,7 +62,8 @@ static mmobj_ops_t shadow_mmobj_ops = {
 void
 shadow_init()
 {
-        NOT_YET_IMPLEMENTED("VM: shadow_init");
+        shadow_allocator = slab_allocator_create("shadow", sizeof(swap_mmobj_t));
+        KASSERT(NULL != shadow_allocator && "failed to create shadow allocator!");
 }
 
 /*
@@ -64,8 +75,21 @@ shadow_init()
 mmobj_t *
 shadow_create()
 {
-        NOT_YET_IMPLEMENTED("VM: shadow_create");
-        return NULL;
+        mmobj_t *o;
+
+        if (NULL == (o = slab_obj_alloc(shadow_allocator)))
+                return NULL;
+        mmobj_init(o, &shadow_mmobj_ops);
+        swap_map_init(&((swap_mmobj_t *) o)->sw_map);
+        o->mmo_refcount = 1;
+        shadow_count++;
+        return o;
+}
+
+int
+shadow_is(mmobj_t *o)
+{
+        return &shadow_mmobj_ops == o->mmo_ops;
 }
 
 /* Implementation of mmobj entry points: */
@@ -76,7 +100,8 @@ shadow_create()
 static void
 shadow_ref(mmobj_t *o)
 {
-        NOT_YET_IMPLEMENTED("VM: shadow_ref");
+        KASSERT(NULL != o && 0 < o->mmo_refcount && &shadow_mmobj_ops == o->mmo_ops);
+        o->mmo_refcount++;
 }
 
 /*
@@ -86,11 +111,107 @@ shadow_ref(mmobj_t *o)
  * longer in use and, since it is a shadow object, it will never
  * be used again. You should unpin and uncache all of the object's
  * pages and then free the object itself.
+ *
+ * If instead the object is left with a single reference besides its
+ * pages, and it is not the top of a chain, that reference is from the
+ * one shadow object above it, and the two are merged at once (see
+ * shadow_collapse).
  */
 static void
 shadow_put(mmobj_t *o)
 {
-        NOT_YET_IMPLEMENTED("VM: shadow_put");
+        KASSERT(NULL != o && 0 < o->mmo_refcount && &shadow_mmobj_ops == o->mmo_ops);
+        KASSERT(o->mmo_refcount >= o->mmo_nrespages);
+
+        if (o->mmo_refcount - 1 == o->mmo_nrespages) {
+                mmobj_t *emptying = shadow_emptying;
+                pframe_t *pf;
+
+                /* each pframe_free puts o again, but takes away a page
+                 * first, so those puts do not come back here */
+                shadow_emptying = o;
+                list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                        pframe_wait_busy(pf);
+                        if (pframe_is_pinned(pf))
+                                pframe_unpin(pf);
+                        pframe_free(pf);
+                } list_iterate_end();
+                shadow_emptying = emptying;
+        }
+
+        KASSERT(o->mmo_refcount > o->mmo_nrespages);
+        if (0 < --o->mmo_refcount) {
+                if (1 == o->mmo_refcount - o->mmo_nrespages && o != shadow_emptying)
+                        shadow_collapse(o);
+                return;
+        }
+
+        KASSERT(0 == o->mmo_nrespages);
+        swap_map_destroy(&((swap_mmobj_t *) o)->sw_map);
+        o->mmo_shadowed->mmo_ops->put(o->mmo_shadowed);
+        slab_obj_free(shadow_allocator, o);
+        shadow_count--;
+}
+
+/*
+ * Removes the shadow object o, whose only reference (besides its pages)
+ * is from the shadow object above it, from its chain: its pages move up
+ * into that object (unless it has its own copies already) and the object
+ * above then shadows what o shadowed. Fork after fork would otherwise
+ * leave every surviving address space at the top of a chain as long as
+ * the number of generations, each lookup walking all of it; this way a
+ * chain is never longer than the number of address spaces still sharing
+ * its pages.
+ *
+ * The object above is found through the areas at the bottom of the
+ * chain. Nothing happens if o turns out to be the top of its chain (the
+ * reference is an area's), if any of its pages is busy, or if there is
+ * no memory to move its slots in swap up with, in which case a later
+ * put will try again.
+ */
+static void
+shadow_collapse(mmobj_t *o)
+{
+        mmobj_t *child = NULL, *below = o->mmo_shadowed, *emptying;
+        vmarea_t *vma;
+        pframe_t *pf;
+
+        KASSERT(NULL != below);
+
+        list_iterate_begin(mmobj_bottom_vmas(o), vma, vmarea_t, vma_olink) {
+                mmobj_t *c;
+
+                for (c = vma->vma_obj; NULL != c && c != o; c = c->mmo_shadowed) {
+                        if (c->mmo_shadowed == o) {
+                                child = c;
+                                goto found;
+                        }
+                }
+        } list_iterate_end();
+        return;
+
+found:
+        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                if (pframe_is_busy(pf))
+                        return;
+        } list_iterate_end();
+        if (0 > swap_collapse(o, child))
+                return;
+
+        /* migrating a page puts o, and freeing one a newer copy of which
+         * is in child may block, before o is taken out of the chain */
+        emptying = shadow_emptying;
+        shadow_emptying = o;
+        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                pframe_migrate(pf, child);
+        } list_iterate_end();
+        shadow_emptying = emptying;
+
+        KASSERT(1 == o->mmo_refcount && 0 == o->mmo_nrespages);
+        below->mmo_ops->ref(below);
+        child->mmo_shadowed = below;
+        /* now frees o, putting the reference to below it held */
+        shadow_put(o);
 }
 
 /* This function looks up the given page in this shadow object. The
@@ -105,8 +226,16 @@ shadow_put(mmobj_t *o)
 static int
 shadow_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 {
-        NOT_YET_IMPLEMENTED("VM: shadow_lookuppage");
-        return 0;
+        mmobj_t *s;
+
+        if (forwrite)
+                return pframe_get(o, pagenum, pf);
+
+        for (s = o; NULL != s->mmo_shadowed; s = s->mmo_shadowed) {
+                if (NULL != pframe_get_resident(s, pagenum) || swap_holds(s, pagenum))
+                        return pframe_get(s, pagenum, pf);
+        }
+        return pframe_lookup(s, pagenum, 0, pf);
 }
 
 /* As per the specification in mmobj.h, fill the page frame starting
@@ -123,22 +252,64 @@ shadow_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 static int
 shadow_fillpage(mmobj_t *o, pframe_t *pf)
 {
-        NOT_YET_IMPLEMENTED("VM: shadow_fillpage");
+        pframe_t *src = NULL;
+        mmobj_t *s;
+        int ret;
+
+        KASSERT(pf->pf_obj == o);
+
+        /* o's own copy, paged out */
+        if (0 > (ret = swap_in(o, pf)))
+                return ret;
+        if (0 < ret)
+                goto filled;
+
+        for (s = o->mmo_shadowed; NULL != s->mmo_shadowed; s = s->mmo_shadowed) {
+                if (NULL != pframe_get_resident(s, pf->pf_pagenum)
+                    || swap_holds(s, pf->pf_pagenum))
+                        break;
+        }
+        if (NULL != s->mmo_shadowed) {
+                ret = pframe_get(s, pf->pf_pagenum, &src);
+        } else if (anon_is(s) && NULL == pframe_get_resident(s, pf->pf_pagenum)
+                   && !swap_holds(s, pf->pf_pagenum)) {
+                /* the page has never been written, so there is nothing to
+                 * copy, and no reason to give the bottom object a page of
+                 * zeros too */
+                pf->pf_addr = page_zero_replace(pf->pf_addr);
+                goto filled;
+        } else {
+                ret = pframe_lookup(s, pf->pf_pagenum, 0, &src);
+        }
+        if (0 > ret)
+                return ret;
+
+        page_copy(pf->pf_addr, src->pf_addr);
+filled:
+        /* without swap there is nowhere to page shadow pages out to */
+        if (!swap_enabled())
+                pframe_pin(pf);
         return 0;
 }
 
 /* These next two functions are not difficult. */
 
+/* As for anonymous pages, a page shared by same-page merging is copied
+ * back; the slot in swap, if any, is written over when it is cleaned */
 static int
 shadow_dirtypage(mmobj_t *o, pframe_t *pf)
 {
-        NOT_YET_IMPLEMENTED("VM: shadow_dirtypage");
-        return -1;
+        return ksm_unmerge(pf);
 }
 
+/* As for anonymous pages, a page which cannot be written out is kept in
+ * memory for good */
 static int
 shadow_cleanpage(mmobj_t *o, pframe_t *pf)
 {
-        NOT_YET_IMPLEMENTED("VM: shadow_cleanpage");
-        return -1;
+        int ret;
+
+        if (0 > (ret = swap_out(o, pf)))
+                pframe_pin(pf);
+        return ret;
 }
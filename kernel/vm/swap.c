@@ -0,0 +1,372 @@
+#include "types.h"
+#include "kernel.h"
+#include "errno.h"
+
+#include "drivers/blockdev.h"
+#include "drivers/dev.h"
+
+#include "mm/mmobj.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+
+#include "util/bits.h"
+#include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+#include "vm/anon.h"
+#include "vm/shadow.h"
+#include "vm/swap.h"
+#include "vm/zram.h"
+
+/*
+ * Swap, where pageoutd writes the dirty pages of anonymous and shadow
+ * objects so that it can reclaim them like file pages. It is the second
+ * disk, whose first __SWAP_BLOCKS__ blocks are taken as slots of a page
+ * each (slot 0, which would be the same as none, is not used). A bitmap
+ * says which slots are in use, and each object has a swap_map_t of the
+ * slots of its pages.
+ *
+ * In front of the disk is zram (see vm/zram.c), which keeps pages
+ * compressed in memory. A page goes there if it can, and to the disk
+ * if it does not compress or zram is full; either tier can be had
+ * without the other. A slot with SWAP_ZRAM set is a zram entry. As the
+ * point of zram is to take less memory than the page, a page read back
+ * from it gives up its entry there and then, and is dirtied so that it
+ * is compressed again if it is reclaimed.
+ *
+ * A page read back in keeps its slot, so that if it is reclaimed again
+ * before it is written it need not go out a second time; a slot is only
+ * freed along with its page's object, or when the page is thrown away
+ * or moved to another object. A page written to a full swap is pinned
+ * instead, as it would have been without swap, so that pageoutd does
+ * not keep coming back to it.
+ */
+
+#define SWAP_SWAPDEV            MKDEVID(DISK_MAJOR, 1)
+
+#define SWAP_ZRAM               0x80000000
+#define SWAP_IS_ZRAM(slot)      ((slot) & SWAP_ZRAM)
+#define SWAP_ZRAM_ENTRY(slot)   ((slot) & ~SWAP_ZRAM)
+
+/* Slots per leaf of a swap map, and the pages a map can hold */
+#define SWAP_LEAF_SLOTS         (PAGE_SIZE / sizeof(uint32_t))
+#define SWAP_DIR_LEAVES         (PAGE_SIZE / sizeof(uint32_t *))
+#define SWAP_MAP_PAGES          (SWAP_LEAF_SLOTS * SWAP_DIR_LEAVES)
+
+static blockdev_t *swap_dev = NULL;
+
+static uint32_t swap_bitmap[(__SWAP_BLOCKS__ + 31) / 32];
+static uint32_t swap_next = 1;          /* where the search for a slot starts */
+static uint32_t swap_nused = 0;
+
+static uint32_t swap_nouts = 0;         /* pages written */
+static uint32_t swap_nins = 0;          /* pages read */
+static uint32_t swap_nfull = 0;         /* pages pinned for want of a slot */
+
+void
+swap_init(void)
+{
+        zram_init();
+#if defined(__SWAP__) && __NDISKS__ > 1
+        if (NULL == (swap_dev = blockdev_lookup(SWAP_SWAPDEV))) {
+                dbg(DBG_INIT, "No swap device\n");
+                return;
+        }
+        dbg(DBG_INIT, "Swapping to disk 1, %u slots\n", __SWAP_BLOCKS__ - 1);
+#elif defined(__SWAP__)
+        dbg(DBG_INIT, "No swap: it goes on the second disk, and NDISKS is 1\n");
+#endif
+}
+
+int
+swap_enabled(void)
+{
+        return NULL != swap_dev || zram_enabled();
+}
+
+/* Takes a free slot on the disk, the next one after the last taken if
+ * it can, so that pages written out together are near each other.
+ * Returns 0 if there is none. */
+static uint32_t
+swap_slot_alloc(void)
+{
+        int slot;
+
+        /* slot 0 is never taken, so is never found from 1 */
+        if (0 > (slot = bitmap_find_next_zero(swap_bitmap, __SWAP_BLOCKS__, swap_next))
+            && 0 > (slot = bitmap_find_next_zero(swap_bitmap, __SWAP_BLOCKS__, 1)))
+                return 0;
+        bit_set(swap_bitmap, slot);
+        swap_next = slot + 1;
+        swap_nused++;
+        return slot;
+}
+
+static void
+swap_slot_free(uint32_t slot)
+{
+        if (SWAP_IS_ZRAM(slot)) {
+                zram_free(SWAP_ZRAM_ENTRY(slot));
+                return;
+        }
+
+        KASSERT(0 < slot && slot < __SWAP_BLOCKS__);
+        KASSERT(bit_check(swap_bitmap, slot));
+
+        bit_clear(swap_bitmap, slot);
+        swap_nused--;
+}
+
+void
+swap_map_init(swap_map_t *map)
+{
+        map->sm_dir = NULL;
+        map->sm_nslots = 0;
+}
+
+void
+swap_map_destroy(swap_map_t *map)
+{
+        uint32_t i, j;
+
+        if (NULL == map->sm_dir)
+                return;
+        for (i = 0; i < SWAP_DIR_LEAVES; i++) {
+                uint32_t *leaf = map->sm_dir[i];
+
+                if (NULL == leaf)
+                        continue;
+                for (j = 0; j < SWAP_LEAF_SLOTS && 0 < map->sm_nslots; j++) {
+                        if (0 != leaf[j]) {
+                                swap_slot_free(leaf[j]);
+                                map->sm_nslots--;
+                        }
+                }
+                page_free(leaf);
+        }
+        KASSERT(0 == map->sm_nslots);
+        page_free(map->sm_dir);
+        map->sm_dir = NULL;
+}
+
+/* The slot for the page in map, 0 if it has none */
+static uint32_t
+swap_map_get(swap_map_t *map, uint32_t pagenum)
+{
+        uint32_t *leaf;
+
+        if (NULL == map->sm_dir || SWAP_MAP_PAGES <= pagenum)
+                return 0;
+        if (NULL == (leaf = map->sm_dir[pagenum / SWAP_LEAF_SLOTS]))
+                return 0;
+        return leaf[pagenum % SWAP_LEAF_SLOTS];
+}
+
+/* Records that the page, which has no slot in map, is in slot, allocating
+ * the directory and the leaf if need be. Returns 0 or -errno. */
+static int
+swap_map_set(swap_map_t *map, uint32_t pagenum, uint32_t slot)
+{
+        uint32_t **leafp;
+
+        KASSERT(0 == swap_map_get(map, pagenum));
+
+        if (SWAP_MAP_PAGES <= pagenum)
+                return -ENOSPC;
+        if (NULL == map->sm_dir
+            && NULL == (map->sm_dir = page_alloc_zeroed()))
+                return -ENOMEM;
+        leafp = &map->sm_dir[pagenum / SWAP_LEAF_SLOTS];
+        if (NULL == *leafp && NULL == (*leafp = page_alloc_zeroed()))
+                return -ENOMEM;
+        (*leafp)[pagenum % SWAP_LEAF_SLOTS] = slot;
+        map->sm_nslots++;
+        return 0;
+}
+
+/* Forgets the page's slot, returning it (0 if there was none) */
+static uint32_t
+swap_map_clear(swap_map_t *map, uint32_t pagenum)
+{
+        uint32_t slot = swap_map_get(map, pagenum);
+
+        if (0 != slot) {
+                map->sm_dir[pagenum / SWAP_LEAF_SLOTS][pagenum % SWAP_LEAF_SLOTS] = 0;
+                map->sm_nslots--;
+        }
+        return slot;
+}
+
+int
+swap_backed(mmobj_t *o)
+{
+        return anon_is(o) || shadow_is(o);
+}
+
+/* o's swap map, or NULL if it is not an object which swaps */
+static swap_map_t *
+swap_obj_map(mmobj_t *o)
+{
+        if (!swap_backed(o))
+                return NULL;
+        return &((swap_mmobj_t *) o)->sw_map;
+}
+
+int
+swap_out(mmobj_t *o, pframe_t *pf)
+{
+        swap_map_t *map = swap_obj_map(o);
+        uint32_t slot;
+        int ret;
+
+        KASSERT(NULL != map && swap_enabled());
+
+        /* the page goes to zram, and anything it had before is dropped,
+         * if it can; a failure is only final if there is no disk */
+        if (zram_enabled()) {
+                if (0 < (ret = zram_store(pf->pf_addr))) {
+                        slot = SWAP_ZRAM | ret;
+                        swap_discard(o, pf->pf_pagenum);
+                        if (0 > (ret = swap_map_set(map, pf->pf_pagenum, slot))) {
+                                zram_free(SWAP_ZRAM_ENTRY(slot));
+                                return ret;
+                        }
+                        swap_nouts++;
+                        return 0;
+                }
+                if (NULL == swap_dev) {
+                        swap_nfull++;
+                        return ret;
+                }
+        }
+
+        /* a copy in zram (there from before zram filled up) is replaced */
+        if (SWAP_IS_ZRAM(swap_map_get(map, pf->pf_pagenum)))
+                swap_discard(o, pf->pf_pagenum);
+        if (0 == (slot = swap_map_get(map, pf->pf_pagenum))) {
+                if (0 == (slot = swap_slot_alloc())) {
+                        swap_nfull++;
+                        return -ENOSPC;
+                }
+                if (0 > (ret = swap_map_set(map, pf->pf_pagenum, slot))) {
+                        swap_slot_free(slot);
+                        return ret;
+                }
+        }
+        /* if this fails the slot is kept, the page staying dirty */
+        if (0 > (ret = swap_dev->bd_ops->write_block(swap_dev, pf->pf_addr, slot, 1)))
+                return ret;
+        swap_nouts++;
+        return 0;
+}
+
+int
+swap_in(mmobj_t *o, pframe_t *pf)
+{
+        swap_map_t *map = swap_obj_map(o);
+        uint32_t slot;
+        int ret;
+
+        KASSERT(NULL != map);
+
+        if (0 == (slot = swap_map_get(map, pf->pf_pagenum)))
+                return 0;
+        if (SWAP_IS_ZRAM(slot)) {
+                if (0 > (ret = zram_load(SWAP_ZRAM_ENTRY(slot), pf->pf_addr)))
+                        return ret;
+                swap_discard(o, pf->pf_pagenum);
+                pframe_mark_dirty(pf);
+        } else if (0 > (ret = swap_dev->bd_ops->read_block(swap_dev, pf->pf_addr, slot, 1))) {
+                return ret;
+        }
+        swap_nins++;
+        return 1;
+}
+
+int
+swap_holds(mmobj_t *o, uint32_t pagenum)
+{
+        swap_map_t *map = swap_obj_map(o);
+
+        return NULL != map && 0 != swap_map_get(map, pagenum);
+}
+
+void
+swap_discard(mmobj_t *o, uint32_t pagenum)
+{
+        swap_map_t *map = swap_obj_map(o);
+        uint32_t slot;
+
+        if (NULL != map && 0 != (slot = swap_map_clear(map, pagenum)))
+                swap_slot_free(slot);
+}
+
+int
+swap_collapse(mmobj_t *o, mmobj_t *child)
+{
+        swap_map_t *map = swap_obj_map(o);
+        swap_map_t *cmap = swap_obj_map(child);
+        uint32_t i, j;
+
+        KASSERT(shadow_is(o) && shadow_is(child));
+
+        if (NULL == map->sm_dir)
+                return 0;
+
+        /* first every leaf a slot may move into, so that nothing is
+         * moved unless everything can be */
+        if (NULL == cmap->sm_dir && NULL == (cmap->sm_dir = page_alloc_zeroed()))
+                return -ENOMEM;
+        for (i = 0; i < SWAP_DIR_LEAVES; i++) {
+                if (NULL != map->sm_dir[i] && NULL == cmap->sm_dir[i]
+                    && NULL == (cmap->sm_dir[i] = page_alloc_zeroed()))
+                        return -ENOMEM;
+        }
+
+        for (i = 0; i < SWAP_DIR_LEAVES && 0 < map->sm_nslots; i++) {
+                if (NULL == map->sm_dir[i])
+                        continue;
+                for (j = 0; j < SWAP_LEAF_SLOTS; j++) {
+                        uint32_t pagenum = i * SWAP_LEAF_SLOTS + j;
+                        pframe_t *pf;
+                        uint32_t slot;
+
+                        if (0 == (slot = swap_map_clear(map, pagenum)))
+                                continue;
+                        if (NULL != pframe_get_resident(child, pagenum)
+                            || 0 != swap_map_get(cmap, pagenum)) {
+                                /* child's own copy is newer */
+                                swap_slot_free(slot);
+                        } else if (NULL != (pf = pframe_get_resident(o, pagenum))) {
+                                /* the page moves up by itself, and must
+                                 * be written out again from there */
+                                swap_slot_free(slot);
+                                pframe_mark_dirty(pf);
+                        } else {
+                                cmap->sm_dir[i][j] = slot;
+                                cmap->sm_nslots++;
+                        }
+                }
+        }
+        swap_map_destroy(map);
+        return 0;
+}
+
+size_t
+swap_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        if (!swap_enabled()) {
+                iprintf(&buf, &size, "swap: none\n");
+                return size;
+        }
+        iprintf(&buf, &size, "swap: %u pages out, %u in, %u pinned when full\n",
+                swap_nouts, swap_nins, swap_nfull);
+        if (NULL != swap_dev)
+                iprintf(&buf, &size, "swap: %u of %u disk slots used\n",
+                        swap_nused, __SWAP_BLOCKS__ - 1);
+        size = zram_info(NULL, buf, size);
+        return size;
+}
@@ -1,10 +1,13 @@
 #include "kernel.h"
 #include "errno.h"
 #include "globals.h"
+#include "config.h"
 
 #include "vm/vmmap.h"
 #include "vm/shadow.h"
 #include "vm/anon.h"
+#include "vm/pagefault.h"
+#include "vm/swap.h"
 
 #include "proc/proc.h"
 
@@ -23,10 +26,17 @@
 #include "mm/mm.h"
 #include "mm/mman.h"
 #include "mm/mmobj.h"
+#include "mm/tlb.h"
+#include "mm/pagetable.h"
+#include "mm/pframe.h"
 
 static slab_allocator_t *vmmap_allocator;
 static slab_allocator_t *vmarea_allocator;
 
+/* Statistics, see vmmap_lookup_info */
+static uint32_t vmmap_nhinthits;
+static uint32_t vmmap_nhintmisses;
+
 void
 vmmap_init(void)
 {
@@ -42,6 +52,8 @@ vmarea_alloc(void)
         vmarea_t *newvma = (vmarea_t *) slab_obj_alloc(vmarea_allocator);
         if (newvma) {
                 newvma->vma_vmmap = NULL;
+                newvma->vma_locked = 0;
+                newvma->vma_advice = MADV_NORMAL;
         }
         return newvma;
 }
@@ -53,13 +65,357 @@ vmarea_free(vmarea_t *vma)
         slab_obj_free(vmarea_allocator, vma);
 }
 
+/*
+ * The tree of areas.
+ *
+ * Every area is on both vmm_list (in address order) and an AVL tree
+ * keyed by vma_start. Each node also records the gap of free pages in
+ * front of it and the largest such gap in its subtree, so that a free
+ * range can be found by descending the tree too; the gap behind the
+ * last area is not in the tree and is checked separately.
+ */
+#define VMMAP_LOW_VFN  ADDR_TO_PN(USER_MEM_LOW)
+#define VMMAP_HIGH_VFN ADDR_TO_PN(USER_MEM_HIGH)
+
+static int
+vma_height(vmarea_t *vma)
+{
+        return (NULL == vma) ? 0 : vma->vma_height;
+}
+
+static uint32_t
+vma_maxgap(vmarea_t *vma)
+{
+        return (NULL == vma) ? 0 : vma->vma_maxgap;
+}
+
+/* Recomputes a node's height and maxgap from its children */
+static void
+vma_update(vmarea_t *vma)
+{
+        vma->vma_height = 1 + MAX(vma_height(vma->vma_left),
+                                  vma_height(vma->vma_right));
+        vma->vma_maxgap = MAX(vma->vma_gap, MAX(vma_maxgap(vma->vma_left),
+                                                vma_maxgap(vma->vma_right)));
+}
+
+static vmarea_t *
+vma_prev(vmmap_t *map, vmarea_t *vma)
+{
+        if (vma->vma_plink.l_prev == &map->vmm_list)
+                return NULL;
+        return list_item(vma->vma_plink.l_prev, vmarea_t, vma_plink);
+}
+
+static vmarea_t *
+vma_next(vmmap_t *map, vmarea_t *vma)
+{
+        if (vma->vma_plink.l_next == &map->vmm_list)
+                return NULL;
+        return list_item(vma->vma_plink.l_next, vmarea_t, vma_plink);
+}
+
+/* Recomputes the gap in front of an area (after the area before it has
+ * moved, or it has) and the maxgaps above it */
+static void
+vmmap_fix_gap(vmmap_t *map, vmarea_t *vma)
+{
+        vmarea_t *prev = vma_prev(map, vma);
+
+        vma->vma_gap = vma->vma_start - ((NULL == prev) ? VMMAP_LOW_VFN : prev->vma_end);
+        for (; NULL != vma; vma = vma->vma_parent)
+                vma_update(vma);
+}
+
+/* Puts new where old is in the tree (new may be NULL) */
+static void
+vmmap_tree_replace(vmmap_t *map, vmarea_t *old, vmarea_t *new)
+{
+        vmarea_t *parent = old->vma_parent;
+
+        if (NULL == parent)
+                map->vmm_root = new;
+        else if (parent->vma_left == old)
+                parent->vma_left = new;
+        else
+                parent->vma_right = new;
+        if (NULL != new)
+                new->vma_parent = parent;
+}
+
+/* Rotates the subtree rooted at vma left (its right child becomes the
+ * root) or right, returning the new root */
+static vmarea_t *
+vmmap_tree_rotate(vmmap_t *map, vmarea_t *vma, int left)
+{
+        vmarea_t *top = left ? vma->vma_right : vma->vma_left;
+        vmarea_t *mid = left ? top->vma_left : top->vma_right;
+
+        vmmap_tree_replace(map, vma, top);
+        if (left) {
+                vma->vma_right = mid;
+                top->vma_left = vma;
+        } else {
+                vma->vma_left = mid;
+                top->vma_right = vma;
+        }
+        if (NULL != mid)
+                mid->vma_parent = vma;
+        vma->vma_parent = top;
+
+        vma_update(vma);
+        vma_update(top);
+        return top;
+}
+
+/* Restores the balance (and heights and maxgaps) on the path from vma to
+ * the root after vma's subtree has changed */
+static void
+vmmap_tree_rebalance(vmmap_t *map, vmarea_t *vma)
+{
+        while (NULL != vma) {
+                int balance;
+
+                vma_update(vma);
+                balance = vma_height(vma->vma_left) - vma_height(vma->vma_right);
+                if (1 < balance) {
+                        vmarea_t *l = vma->vma_left;
+                        if (vma_height(l->vma_left) < vma_height(l->vma_right))
+                                vmmap_tree_rotate(map, l, 1);
+                        vma = vmmap_tree_rotate(map, vma, 0);
+                } else if (-1 > balance) {
+                        vmarea_t *r = vma->vma_right;
+                        if (vma_height(r->vma_right) < vma_height(r->vma_left))
+                                vmmap_tree_rotate(map, r, 0);
+                        vma = vmmap_tree_rotate(map, vma, 1);
+                }
+                vma = vma->vma_parent;
+        }
+}
+
+/* Adds an area to the list and the tree */
+static void
+vmmap_link(vmmap_t *map, vmarea_t *newvma)
+{
+        vmarea_t *parent = NULL, *before = NULL, *next;
+        vmarea_t **where = &map->vmm_root;
+
+        while (NULL != *where) {
+                parent = *where;
+                if (newvma->vma_start < parent->vma_start) {
+                        where = &parent->vma_left;
+                } else {
+                        before = parent;
+                        where = &parent->vma_right;
+                }
+        }
+
+        newvma->vma_left = newvma->vma_right = NULL;
+        newvma->vma_parent = parent;
+        *where = newvma;
+
+        if (NULL == before)
+                list_insert_head(&map->vmm_list, &newvma->vma_plink);
+        else
+                list_insert_before(before->vma_plink.l_next, &newvma->vma_plink);
+
+        newvma->vma_gap = newvma->vma_start
+                          - ((NULL == before) ? VMMAP_LOW_VFN : before->vma_end);
+        vmmap_tree_rebalance(map, newvma);
+        if (NULL != (next = vma_next(map, newvma)))
+                vmmap_fix_gap(map, next);
+}
+
+/* Removes an area from the list and the tree */
+static void
+vmmap_unlink(vmmap_t *map, vmarea_t *vma)
+{
+        vmarea_t *next = vma_next(map, vma);
+        vmarea_t *start;
+
+        if (NULL == vma->vma_left || NULL == vma->vma_right) {
+                start = vma->vma_parent;
+                vmmap_tree_replace(map, vma,
+                                   (NULL != vma->vma_left) ? vma->vma_left : vma->vma_right);
+        } else {
+                /* the successor, which has no left child, takes vma's
+                 * place */
+                vmarea_t *s = vma->vma_right;
+                while (NULL != s->vma_left)
+                        s = s->vma_left;
+
+                if (s->vma_parent == vma) {
+                        start = s;
+                } else {
+                        start = s->vma_parent;
+                        vmmap_tree_replace(map, s, s->vma_right);
+                        s->vma_right = vma->vma_right;
+                        s->vma_right->vma_parent = s;
+                }
+                vmmap_tree_replace(map, vma, s);
+                s->vma_left = vma->vma_left;
+                s->vma_left->vma_parent = s;
+        }
+        vmmap_tree_rebalance(map, start);
+
+        list_remove(&vma->vma_plink);
+        if (NULL != next)
+                vmmap_fix_gap(map, next);
+        if (map->vmm_hint == vma)
+                map->vmm_hint = NULL;
+}
+
+/* The first area which ends after vfn, or NULL if there is none */
+static vmarea_t *
+vmmap_lower_bound(vmmap_t *map, uint32_t vfn)
+{
+        vmarea_t *vma = map->vmm_root, *found = NULL;
+
+        while (NULL != vma) {
+                if (vma->vma_end > vfn) {
+                        found = vma;
+                        if (vma->vma_start <= vfn)
+                                break;
+                        vma = vma->vma_left;
+                } else {
+                        vma = vma->vma_right;
+                }
+        }
+        return found;
+}
+
+/* The free pages behind the last area */
+static uint32_t
+vmmap_tail_gap(vmmap_t *map)
+{
+        vmarea_t *last;
+
+        if (list_empty(&map->vmm_list))
+                return VMMAP_HIGH_VFN - VMMAP_LOW_VFN;
+        last = list_tail(&map->vmm_list, vmarea_t, vma_plink);
+        return VMMAP_HIGH_VFN - last->vma_end;
+}
+
+/* Splits vma at vfn, which must lie inside it: vma keeps the pages below
+ * vfn and a new area, which is returned, gets the rest. Returns NULL if
+ * the new area cannot be allocated. */
+static vmarea_t *
+vmmap_split(vmmap_t *map, vmarea_t *vma, uint32_t vfn)
+{
+        vmarea_t *newvma;
+
+        KASSERT(vma->vma_start < vfn && vma->vma_end > vfn);
+
+        if (NULL == (newvma = vmarea_alloc()))
+                return NULL;
+        newvma->vma_start = vfn;
+        newvma->vma_end = vma->vma_end;
+        newvma->vma_off = vma->vma_off + (vfn - vma->vma_start);
+        newvma->vma_prot = vma->vma_prot;
+        /* only the bottom of a stack grows */
+        newvma->vma_flags = vma->vma_flags & ~MAP_GROWSDOWN;
+        newvma->vma_locked = vma->vma_locked;
+        newvma->vma_advice = vma->vma_advice;
+        newvma->vma_obj = vma->vma_obj;
+        if (NULL != newvma->vma_obj)
+                newvma->vma_obj->mmo_ops->ref(newvma->vma_obj);
+        list_link_init(&newvma->vma_olink);
+        if (list_link_is_linked(&vma->vma_olink))
+                list_insert_before(vma->vma_olink.l_next, &newvma->vma_olink);
+
+        vma->vma_end = vfn;
+        newvma->vma_vmmap = map;
+        vmmap_link(map, newvma);
+        return newvma;
+}
+
+/* Splits vma where lo and hi lie inside it, returning the part of it
+ * within [lo, hi), or NULL if a new area cannot be allocated */
+static vmarea_t *
+vmmap_clip(vmmap_t *map, vmarea_t *vma, uint32_t lo, uint32_t hi)
+{
+        if (vma->vma_start < lo && NULL == (vma = vmmap_split(map, vma, lo)))
+                return NULL;
+        if (vma->vma_end > hi && NULL == vmmap_split(map, vma, hi))
+                return NULL;
+        return vma;
+}
+
+/* Whether every page of [lopage, hipage) is mapped */
+static int
+vmmap_is_range_full(vmmap_t *map, uint32_t lopage, uint32_t hipage)
+{
+        vmarea_t *vma = vmmap_lower_bound(map, lopage);
+        uint32_t vfn = lopage;
+
+        while (vfn < hipage) {
+                if (NULL == vma || vma->vma_start > vfn)
+                        return 0;
+                vfn = vma->vma_end;
+                vma = vma_next(map, vma);
+        }
+        return 1;
+}
+
+/*
+ * Pins (or unpins) the pages [lo, hi) of a locked area. Only the pages
+ * of a file are pinned: those of anonymous memory move between the
+ * objects of the chain as they are copied, so there is no one page to
+ * pin, and with swap a locked area's anonymous pages may still page
+ * out. The file's pages are pinned in the object at the bottom of the
+ * area's chain, which (unlike the one at the top) stays the same for as
+ * long as the area exists, so that unlocking finds the same pages.
+ *
+ * Returns 0 on success, or -errno if a page could not be read in, in
+ * which case none of the pages are left pinned.
+ */
+static int
+vmmap_pin_range(vmarea_t *vma, uint32_t lo, uint32_t hi, int pin)
+{
+        mmobj_t *o = mmobj_bottom_obj(vma->vma_obj);
+        uint32_t vfn;
+        pframe_t *pf;
+        int ret;
+
+        if (anon_is(o))
+                return 0;
+
+        for (vfn = lo; vfn < hi; vfn++) {
+                uint32_t pagenum = vfn - vma->vma_start + vma->vma_off;
+
+                if (!pin) {
+                        pf = pframe_get_resident(o, pagenum);
+                        KASSERT(NULL != pf && pframe_is_pinned(pf));
+                        pframe_unpin(pf);
+                } else if (0 > (ret = pframe_get(o, pagenum, &pf))) {
+                        vmmap_pin_range(vma, lo, vfn, 0);
+                        return ret;
+                } else {
+                        pframe_pin(pf);
+                }
+        }
+        return 0;
+}
+
 /* Create a new vmmap, which has no vmareas and does
  * not refer to a process. */
 vmmap_t *
 vmmap_create(void)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_create");
-        return NULL;
+        vmmap_t *map;
+
+        if (NULL == (map = slab_obj_alloc(vmmap_allocator)))
+                return NULL;
+        list_init(&map->vmm_list);
+        map->vmm_root = NULL;
+        map->vmm_hint = NULL;
+        map->vmm_clone = NULL;
+        map->vmm_proc = NULL;
+        memset(&map->vmm_faults, 0, sizeof(map->vmm_faults));
+        map->vmm_ticks = 0;
+        memset(&map->vmm_sched, 0, sizeof(map->vmm_sched));
+        krwlock_init(&map->vmm_lock);
+        return map;
 }
 
 /* Removes all vmareas from the address space and frees the
@@ -67,7 +423,28 @@ vmmap_create(void)
 void
 vmmap_destroy(vmmap_t *map)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_destroy");
+        vmarea_t *vma;
+
+        KASSERT(NULL != map);
+
+        /* a fork which failed after cloning the address space */
+        if (NULL != curproc && NULL != curproc->p_vmmap
+            && map == curproc->p_vmmap->vmm_clone)
+                curproc->p_vmmap->vmm_clone = NULL;
+
+        /* the tree goes with its nodes */
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                list_remove(&vma->vma_plink);
+                if (list_link_is_linked(&vma->vma_olink))
+                        list_remove(&vma->vma_olink);
+                if (vma->vma_locked)
+                        vmmap_pin_range(vma, vma->vma_start, vma->vma_end, 0);
+                if (NULL != vma->vma_obj)
+                        vma->vma_obj->mmo_ops->put(vma->vma_obj);
+                vmarea_free(vma);
+        } list_iterate_end();
+
+        slab_obj_free(vmmap_allocator, map);
 }
 
 /* Add a vmarea to an address space. Assumes (i.e. asserts to some extent)
@@ -77,7 +454,15 @@ vmmap_destroy(vmmap_t *map)
 void
 vmmap_insert(vmmap_t *map, vmarea_t *newvma)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_insert");
+        KASSERT(NULL != map && NULL != newvma);
+        KASSERT(NULL == newvma->vma_vmmap);
+        KASSERT(newvma->vma_start < newvma->vma_end);
+        KASSERT(VMMAP_LOW_VFN <= newvma->vma_start && VMMAP_HIGH_VFN >= newvma->vma_end);
+        KASSERT(vmmap_is_range_empty(map, newvma->vma_start,
+                                     newvma->vma_end - newvma->vma_start));
+
+        newvma->vma_vmmap = map;
+        vmmap_link(map, newvma);
 }
 
 /* Find a contiguous range of free virtual pages of length npages in
@@ -86,21 +471,71 @@ vmmap_insert(vmmap_t *map, vmarea_t *newvma)
  *
  * Your algorithm should be first fit. If dir is VMMAP_DIR_HILO, you
  * should find a gap as high in the address space as possible; if dir
- * is VMMAP_DIR_LOHI, the gap should be as low as possible. */
+ * is VMMAP_DIR_LOHI, the gap should be as low as possible.
+ *
+ * The gap in front of each area is cached in the tree, along with the
+ * largest one under each node, so this descends straight to the lowest
+ * (or highest) area with a large enough gap in front of it. */
 int
 vmmap_find_range(vmmap_t *map, uint32_t npages, int dir)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_find_range");
+        vmarea_t *vma = map->vmm_root;
+
+        KASSERT(VMMAP_DIR_LOHI == dir || VMMAP_DIR_HILO == dir);
+        if (0 == npages)
+                return -1;
+
+        if (VMMAP_DIR_HILO == dir) {
+                if (vmmap_tail_gap(map) >= npages)
+                        return (int)(VMMAP_HIGH_VFN - npages);
+                while (NULL != vma && vma->vma_maxgap >= npages) {
+                        if (vma_maxgap(vma->vma_right) >= npages)
+                                vma = vma->vma_right;
+                        else if (vma->vma_gap >= npages)
+                                return (int)(vma->vma_start - npages);
+                        else
+                                vma = vma->vma_left;
+                }
+        } else {
+                while (NULL != vma && vma->vma_maxgap >= npages) {
+                        if (vma_maxgap(vma->vma_left) >= npages)
+                                vma = vma->vma_left;
+                        else if (vma->vma_gap >= npages)
+                                return (int)(vma->vma_start - vma->vma_gap);
+                        else
+                                vma = vma->vma_right;
+                }
+                if (vmmap_tail_gap(map) >= npages)
+                        return (int)(VMMAP_HIGH_VFN - vmmap_tail_gap(map));
+        }
         return -1;
 }
 
-/* Find the vm_area that vfn lies in. Simply scan the address space
- * looking for a vma whose range covers vfn. If the page is unmapped,
- * return NULL. */
+/* Find the vm_area that vfn lies in, by descending the tree. If the
+ * page is unmapped, return NULL.
+ *
+ * Consecutive faults usually fall in the same area (a growing stack, a
+ * heap being touched in order), so the area found last is tried first. */
 vmarea_t *
 vmmap_lookup(vmmap_t *map, uint32_t vfn)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_lookup");
+        vmarea_t *vma = map->vmm_hint;
+
+        if (NULL != vma && vma->vma_start <= vfn && vma->vma_end > vfn) {
+                vmmap_nhinthits++;
+                return vma;
+        }
+        vmmap_nhintmisses++;
+
+        vma = map->vmm_root;
+        while (NULL != vma) {
+                if (vfn < vma->vma_start)
+                        vma = vma->vma_left;
+                else if (vfn >= vma->vma_end)
+                        vma = vma->vma_right;
+                else
+                        return (map->vmm_hint = vma);
+        }
         return NULL;
 }
 
@@ -111,8 +546,60 @@ vmmap_lookup(vmmap_t *map, uint32_t vfn)
 vmmap_t *
 vmmap_clone(vmmap_t *map)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_clone");
-        return NULL;
+        vmmap_t *newmap;
+        vmarea_t *vma;
+
+        if (NULL == (newmap = vmmap_create()))
+                return NULL;
+
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                vmarea_t *newvma;
+
+                if (NULL == (newvma = vmarea_alloc())) {
+                        vmmap_destroy(newmap);
+                        return NULL;
+                }
+                newvma->vma_start = vma->vma_start;
+                newvma->vma_end = vma->vma_end;
+                newvma->vma_off = vma->vma_off;
+                newvma->vma_prot = vma->vma_prot;
+                newvma->vma_flags = vma->vma_flags;
+                newvma->vma_advice = vma->vma_advice;
+                /* locks are not inherited */
+                newvma->vma_obj = NULL;
+                list_link_init(&newvma->vma_olink);
+                vmmap_insert(newmap, newvma);
+        } list_iterate_end();
+
+        map->vmm_clone = newmap;
+        return newmap;
+}
+
+/*
+ * Fork puts a new shadow object above every private area of both the
+ * parent and the child. Those above areas which cannot be written, such
+ * as program text, would never get a page, but every fault on the area
+ * would look through them; so where the area mapped the bottom object of
+ * its chain before the fork, it is made to map it again and the shadow
+ * is freed. Called for both address spaces, from pt_unmap_range, when
+ * fork unmaps the parent's memory after setting up the child's objects.
+ */
+void
+vmmap_fork_unshadow(vmmap_t *map)
+{
+        vmarea_t *vma;
+
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                mmobj_t *o = vma->vma_obj;
+
+                if ((vma->vma_flags & MAP_PRIVATE) && !(vma->vma_prot & PROT_WRITE)
+                    && NULL != o && shadow_is(o) && 1 == o->mmo_refcount
+                    && 0 == o->mmo_nrespages && NULL == o->mmo_shadowed->mmo_shadowed) {
+                        vma->vma_obj = o->mmo_shadowed;
+                        vma->vma_obj->mmo_ops->ref(vma->vma_obj);
+                        o->mmo_ops->put(o);
+                }
+        } list_iterate_end();
 }
 
 /* Insert a mapping into the map starting at lopage for npages pages.
@@ -128,7 +615,10 @@ vmmap_clone(vmmap_t *map)
  * of the area's fields except for vma_obj have been set before
  * calling mmap.
  *
- * If MAP_PRIVATE is specified set up a shadow object for the mmobj.
+ * If MAP_PRIVATE is specified set up a shadow object for the mmobj,
+ * unless the mapping is not PROT_WRITE: nothing is ever copied into such
+ * a mapping, so it maps the mmobj itself, and its faults do not have to
+ * look through an empty shadow object first.
  *
  * All of the input to this function should be valid (KASSERT!).
  * See mmap(2) for for description of legal input.
@@ -139,6 +629,13 @@ vmmap_clone(vmmap_t *map)
  * is no chance of failure.
  *
  * If 'new' is non-NULL a pointer to the new vmarea_t should be stored in it.
+ *
+ * Every mapping is of 4kb pages. A 4mb page directory entry for one
+ * would need an aligned order-10 block, past the buddy allocator's
+ * largest (PAGE_NSIZES), and would have to be split back into pframes
+ * whenever copy-on-write after the prebuilt fork, swap, compaction or
+ * KSM touched one of its pages; fault-around and MAP_POPULATE are what
+ * cut the faults instead.
  */
 int
 vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
@@ -148,6 +645,36 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
         return -1;
 }
 
+/* Maps npages of an object the kernel made itself (rather than a file
+ * or anonymous memory) at lopage, from page 0 of the object. The area
+ * takes a reference to obj. Returns -EINVAL if anything is already
+ * mapped in the range. */
+int
+vmmap_map_obj(vmmap_t *map, mmobj_t *obj, uint32_t lopage, uint32_t npages,
+              int prot, int flags)
+{
+        vmarea_t *vma;
+
+        KASSERT(NULL != map && NULL != obj);
+
+        if (!vmmap_is_range_empty(map, lopage, npages))
+                return -EINVAL;
+
+        if (NULL == (vma = vmarea_alloc()))
+                return -ENOMEM;
+        vma->vma_start = lopage;
+        vma->vma_end = lopage + npages;
+        vma->vma_off = 0;
+        vma->vma_prot = prot;
+        vma->vma_flags = flags;
+        obj->mmo_ops->ref(obj);
+        vma->vma_obj = obj;
+        list_link_init(&vma->vma_olink);
+        list_insert_tail(mmobj_bottom_vmas(obj), &vma->vma_olink);
+        vmmap_insert(map, vma);
+        return 0;
+}
+
 /*
  * We have no guarantee that the region of the address space being
  * unmapped will play nicely with our list of vmareas.
@@ -176,12 +703,355 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
  * Case 4: *[*************]**
  * The region completely contains the vmarea. Remove the vmarea from the
  * list.
+ *
+ * The first area affected is found in the tree; the rest follow it on
+ * the list.
  */
 int
 vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_remove");
-        return -1;
+        uint32_t hipage = lopage + npages;
+        vmarea_t *vma, *next;
+
+        for (vma = vmmap_lower_bound(map, lopage);
+             NULL != vma && vma->vma_start < hipage; vma = next) {
+                if (vma->vma_start < lopage && vma->vma_end > hipage) {
+                        /* case 1: split off the part above the region,
+                         * which leaves case 2 */
+                        if (NULL == vmmap_split(map, vma, hipage))
+                                return -ENOMEM;
+                }
+                next = vma_next(map, vma);
+
+                if (vma->vma_locked)
+                        vmmap_pin_range(vma, MAX(vma->vma_start, lopage),
+                                        MIN(vma->vma_end, hipage), 0);
+
+                if (vma->vma_start < lopage) {
+                        /* case 2: the gap behind it grows */
+                        vma->vma_end = lopage;
+                        if (NULL != next)
+                                vmmap_fix_gap(map, next);
+                } else if (vma->vma_end > hipage) {
+                        /* case 3: the gap in front of it grows */
+                        vma->vma_off += hipage - vma->vma_start;
+                        vma->vma_start = hipage;
+                        vmmap_fix_gap(map, vma);
+                } else {
+                        /* case 4 */
+                        vmmap_unlink(map, vma);
+                        if (list_link_is_linked(&vma->vma_olink))
+                                list_remove(&vma->vma_olink);
+                        if (NULL != vma->vma_obj)
+                                vma->vma_obj->mmo_ops->put(vma->vma_obj);
+                        vmarea_free(vma);
+                }
+                /* the areas done are consistent, and nothing else of
+                 * the process can touch them until the pages go below */
+                sched_cond_resched();
+        }
+
+        if (NULL != map->vmm_proc) {
+                pt_unmap_range(map->vmm_proc->p_pagedir,
+                               (uintptr_t) PN_TO_ADDR(lopage),
+                               (uintptr_t) PN_TO_ADDR(hipage));
+                if (curproc == map->vmm_proc)
+                        tlb_flush_range((uintptr_t) PN_TO_ADDR(lopage), npages);
+                tlb_shootdown(map->vmm_proc->p_pagedir,
+                              (uintptr_t) PN_TO_ADDR(lopage), npages);
+        }
+        return 0;
+}
+
+/*
+ * Faults in the pages [lopage, lopage + npages) of the current process's
+ * address space ahead of time, so that touching them later does not
+ * fault. Pages of writable private areas are faulted in for writing, so
+ * that their copies are made now too; everything else is mapped as a
+ * read would map it. Unmapped pages, and areas which cannot be accessed
+ * at all, are skipped.
+ *
+ * Returns 0 on success, or -errno if a page could not be had.
+ */
+int
+vmmap_populate(vmmap_t *map, uint32_t lopage, uint32_t npages)
+{
+        uint32_t hipage = lopage + npages;
+        vmarea_t *vma;
+        int ret;
+
+        KASSERT(map == curproc->p_vmmap);
+
+        for (vma = vmmap_lower_bound(map, lopage);
+             NULL != vma && vma->vma_start < hipage; vma = vma_next(map, vma)) {
+                int forwrite = (vma->vma_prot & PROT_WRITE) && (vma->vma_flags & MAP_PRIVATE);
+                uint32_t vfn;
+
+                if (!(vma->vma_prot & (PROT_READ | PROT_WRITE | PROT_EXEC)))
+                        continue;
+                for (vfn = MAX(vma->vma_start, lopage); vfn < MIN(vma->vma_end, hipage); vfn++) {
+                        if (0 > (ret = pagefault_map(vma, vfn, forwrite)))
+                                return ret;
+                }
+        }
+        return 0;
+}
+
+/*
+ * Locks (mlock) or unlocks (munlock) the pages [lopage, lopage + npages)
+ * of the address space, all of which must be mapped. The pages of a
+ * locked area are pinned, so that pageoutd leaves them alone, and those
+ * of the current process are faulted in straight away (see
+ * vmmap_populate). Areas are split where only part of one changes.
+ * Locks do not nest, and are not inherited by fork.
+ *
+ * Returns 0 on success, -ENOMEM if part of the range is unmapped (or an
+ * area cannot be split), or -errno if a page could not be read in, in
+ * which case the areas before it stay locked.
+ */
+int
+vmmap_lock(vmmap_t *map, uint32_t lopage, uint32_t npages, int lock)
+{
+        uint32_t hipage = lopage + npages;
+        vmarea_t *vma;
+        int ret;
+
+        lock = lock ? 1 : 0;
+
+        if (!vmmap_is_range_full(map, lopage, hipage))
+                return -ENOMEM;
+
+        for (vma = vmmap_lower_bound(map, lopage);
+             NULL != vma && vma->vma_start < hipage; vma = vma_next(map, vma)) {
+                if (vma->vma_locked == lock)
+                        continue;
+                if (NULL == (vma = vmmap_clip(map, vma, lopage, hipage)))
+                        return -ENOMEM;
+
+                if (0 > (ret = vmmap_pin_range(vma, vma->vma_start, vma->vma_end, lock)))
+                        return ret;
+                vma->vma_locked = lock;
+
+                if (lock && map == curproc->p_vmmap
+                    && 0 > (ret = vmmap_populate(map, vma->vma_start,
+                                                 vma->vma_end - vma->vma_start)))
+                        return ret;
+        }
+        return 0;
+}
+
+/*
+ * MADV_DONTNEED for the pages [lo, hi) of a private area: the area's own
+ * copies of them are thrown away, so that they read as the underlying
+ * file (or as zeros) again. A copy further down the chain, which the
+ * area still shares with a process it was forked from or to, cannot be
+ * thrown away; it is hidden behind a fresh copy of the file's page (or
+ * of zeros) instead.
+ *
+ * Returns 0 on success, or -errno if such a fresh copy cannot be made.
+ */
+static int
+vmmap_dontneed(vmarea_t *vma, uint32_t lo, uint32_t hi)
+{
+        mmobj_t *top = vma->vma_obj;
+        mmobj_t *bottom = mmobj_bottom_obj(top);
+        uint32_t vfn;
+        int ret;
+
+        KASSERT(top != bottom);
+
+        for (vfn = lo; vfn < hi; vfn++) {
+                uint32_t pagenum = vfn - vma->vma_start + vma->vma_off;
+                pframe_t *pf, *src;
+                mmobj_t *o;
+
+                for (o = top->mmo_shadowed; NULL != o->mmo_shadowed; o = o->mmo_shadowed) {
+                        if (NULL != pframe_get_resident(o, pagenum) || swap_holds(o, pagenum))
+                                break;
+                }
+
+                if (NULL == o->mmo_shadowed) {
+                        while (NULL != (pf = pframe_get_resident(top, pagenum))
+                               && pframe_is_busy(pf))
+                                pframe_wait_busy(pf);
+                        if (NULL != pf) {
+                                if (pframe_is_pinned(pf))
+                                        pframe_unpin(pf);
+                                pframe_free(pf);
+                        }
+                        swap_discard(top, pagenum);
+                        continue;
+                }
+
+                if (0 > (ret = pframe_get(top, pagenum, &pf)))
+                        return ret;
+                /* kept while the file's page is read, and dirtied so that
+                 * it is not read back from what it hides if paged out */
+                pframe_pin(pf);
+                if (0 > (ret = pframe_dirty(pf))) {
+                        pframe_unpin(pf);
+                        return ret;
+                }
+                if (!anon_is(bottom) && 0 <= pframe_lookup(bottom, pagenum, 0, &src))
+                        page_copy(pf->pf_addr, src->pf_addr);
+                else
+                        page_zero(pf->pf_addr);
+                pframe_unpin(pf);
+        }
+        return 0;
+}
+
+/*
+ * Implements madvise(2) for the pages [lopage, lopage + npages) of the
+ * address space, all of which must be mapped:
+ *
+ * MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL are recorded in the areas
+ * (which are split where only part of one changes). A fault in a
+ * sequential area makes the page of the file behind it the first one
+ * pageoutd reclaims (see pagefault_map).
+ *
+ * MADV_WILLNEED reads the file pages of the range in ahead of time.
+ *
+ * MADV_DONTNEED unmaps the range. Private areas also lose their copies of
+ * its pages, see vmmap_dontneed; the pages of shared areas stay where
+ * they are. Locked pages cannot be given up.
+ *
+ * Returns 0 on success, -EINVAL for unknown advice or DONTNEED on locked
+ * pages, -ENOMEM if part of the range is unmapped (or an area cannot be
+ * split), or another -errno if DONTNEED fails to replace a page.
+ */
+int
+vmmap_advise(vmmap_t *map, uint32_t lopage, uint32_t npages, int advice)
+{
+        uint32_t hipage = lopage + npages;
+        vmarea_t *vma;
+        int ret = 0;
+
+        if (MADV_NORMAL > advice || MADV_DONTNEED < advice)
+                return -EINVAL;
+        if (!vmmap_is_range_full(map, lopage, hipage))
+                return -ENOMEM;
+
+        for (vma = vmmap_lower_bound(map, lopage);
+             NULL != vma && vma->vma_start < hipage; vma = vma_next(map, vma)) {
+                uint32_t lo = MAX(vma->vma_start, lopage);
+                uint32_t hi = MIN(vma->vma_end, hipage);
+                mmobj_t *bottom = mmobj_bottom_obj(vma->vma_obj);
+
+                switch (advice) {
+                        case MADV_WILLNEED:
+                                vnode_willneed(bottom, lo - vma->vma_start + vma->vma_off,
+                                               hi - lo);
+                                break;
+                        case MADV_DONTNEED:
+                                if (vma->vma_locked)
+                                        return -EINVAL;
+                                if ((vma->vma_flags & MAP_PRIVATE) && vma->vma_obj != bottom
+                                    && 0 > (ret = vmmap_dontneed(vma, lo, hi)))
+                                        return ret;
+                                break;
+                        default:
+                                if (vma->vma_advice == advice)
+                                        break;
+                                if (NULL == (vma = vmmap_clip(map, vma, lopage, hipage)))
+                                        return -ENOMEM;
+                                vma->vma_advice = advice;
+                                break;
+                }
+        }
+
+        if (MADV_DONTNEED == advice && NULL != map->vmm_proc) {
+                pt_unmap_range(map->vmm_proc->p_pagedir,
+                               (uintptr_t) PN_TO_ADDR(lopage),
+                               (uintptr_t) PN_TO_ADDR(hipage));
+                if (curproc == map->vmm_proc)
+                        tlb_flush_range((uintptr_t) PN_TO_ADDR(lopage), npages);
+                tlb_shootdown(map->vmm_proc->p_pagedir,
+                              (uintptr_t) PN_TO_ADDR(lopage), npages);
+        }
+        return 0;
+}
+
+/*
+ * Grows the MAP_GROWSDOWN area above vfn down to take it in, for a fault
+ * on a stack. The area's vma_off is how far it may still grow, as it
+ * cannot go below page 0 of its object; the space below it must also
+ * stay USER_STACK_GAP clear of the area under it, so that a stack which
+ * runs away faults rather than running into another mapping.
+ *
+ * Returns 0 if vfn is in an area afterwards (another thread may have
+ * grown it first), -EFAULT if there is no stack above it to grow, or
+ * -ENOMEM if growing it would go past its limit or into the gap.
+ */
+int
+vmmap_grow_down(vmmap_t *map, uint32_t vfn)
+{
+        vmarea_t *vma = vmmap_lower_bound(map, vfn), *prev;
+        uint32_t npages, floor;
+
+        if (NULL == vma)
+                return -EFAULT;
+        if (vma->vma_start <= vfn)
+                return 0;
+        if (!(vma->vma_flags & MAP_GROWSDOWN))
+                return -EFAULT;
+
+        npages = vma->vma_start - vfn;
+        prev = vma_prev(map, vma);
+        floor = ((NULL == prev) ? VMMAP_LOW_VFN : prev->vma_end)
+                + USER_STACK_GAP / PAGE_SIZE;
+        if (npages > vma->vma_off || vfn < floor)
+                return -ENOMEM;
+
+        dbg(DBG_VM, "growing stack at 0x%p down by %u pages\n",
+            PN_TO_ADDR(vma->vma_start), npages);
+        vma->vma_start = vfn;
+        vma->vma_off -= npages;
+        vmmap_fix_gap(map, vma);
+        return 0;
+}
+
+/*
+ * Moves the end of the heap from page oldend to newend, for brk(2). The
+ * heap grows in place: if the area ending at oldend is private anonymous
+ * memory (the heap itself, or the bss below it) its end is moved up, so
+ * that neither a new area nor a new shadow object is made, and only if
+ * there is none is a new area mapped. Shrinking throws away the area's
+ * copies of the pages given up (see vmmap_dontneed), which would
+ * otherwise be seen again, rather than zeros, when it grows back.
+ *
+ * Returns 0 on success, -ENOMEM if the pages it would grow into are not
+ * free, or -errno if a new area cannot be mapped.
+ */
+int
+vmmap_brk(vmmap_t *map, uint32_t oldend, uint32_t newend)
+{
+        vmarea_t *vma = (VMMAP_LOW_VFN < oldend) ? vmmap_lookup(map, oldend - 1) : NULL;
+        vmarea_t *next;
+        int ret;
+
+        if (NULL != vma
+            && (vma->vma_end != oldend || !(vma->vma_flags & MAP_PRIVATE)
+                || !anon_is(mmobj_bottom_obj(vma->vma_obj))))
+                vma = NULL;
+
+        if (newend > oldend) {
+                if (!vmmap_is_range_empty(map, oldend, newend - oldend))
+                        return -ENOMEM;
+                if (NULL == vma)
+                        return vmmap_map(map, NULL, oldend, newend - oldend,
+                                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                                         0, 0, NULL);
+                vma->vma_end = newend;
+                if (NULL != (next = vma_next(map, vma)))
+                        vmmap_fix_gap(map, next);
+                return 0;
+        }
+
+        if (NULL != vma && vma->vma_obj != mmobj_bottom_obj(vma->vma_obj)
+            && 0 > (ret = vmmap_dontneed(vma, MAX(vma->vma_start, newend), oldend)))
+                return ret;
+        return vmmap_remove(map, newend, oldend - newend);
 }
 
 /*
@@ -191,8 +1061,9 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
 int
 vmmap_is_range_empty(vmmap_t *map, uint32_t startvfn, uint32_t npages)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_is_range_empty");
-        return 0;
+        vmarea_t *vma = vmmap_lower_bound(map, startvfn);
+
+        return NULL == vma || vma->vma_start >= startvfn + npages;
 }
 
 /* Read into 'buf' from the virtual address space of 'map' starting at
@@ -274,3 +1145,13 @@ end:
         */
         return osize - size;
 }
+
+size_t
+vmmap_lookup_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        iprintf(&buf, &size, "vmmap_lookup: %u hint hits, %u misses\n",
+                vmmap_nhinthits, vmmap_nhintmisses);
+        return size;
+}
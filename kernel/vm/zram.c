@@ -0,0 +1,214 @@
+#include "types.h"
+#include "kernel.h"
+#include "errno.h"
+
+#include "mm/page.h"
+#include "mm/slab.h"
+
+#include "util/debug.h"
+#include "util/lz.h"
+#include "util/printf.h"
+#include "util/string.h"
+
+#include "vm/zram.h"
+
+/*
+ * Compressed swap in memory, tried before the swap disk (see vm/swap.c):
+ * a page written out is compressed with lz_compress, and the result
+ * kept in an object from one of a few slab allocators, one for each
+ * multiple of ZRAM_CLASS_SIZE up to ZRAM_MAX_LEN. A page which does not
+ * compress to that goes on to the disk. A page of one repeated word,
+ * which a lot of anonymous memory is (zeros, mostly), is kept as just
+ * the word.
+ *
+ * The pool holds at most __ZRAM_PAGES__ pages' worth of objects, and
+ * there are four times as many entries, enough for pages compressing
+ * to a quarter of their size.
+ *
+ * Nothing in here blocks, so the compressor's static state and
+ * zram_buf are never used by two threads at once.
+ */
+
+#define ZRAM_CLASS_SIZE         256
+#define ZRAM_NCLASSES           12
+#define ZRAM_MAX_LEN            (ZRAM_CLASS_SIZE * ZRAM_NCLASSES)
+#define ZRAM_NENTRIES           (__ZRAM_PAGES__ * 4)
+#define ZRAM_POOL_BYTES         (__ZRAM_PAGES__ * PAGE_SIZE)
+
+/* ze_len of an entry holding a page of one repeated word */
+#define ZRAM_SAME               0xffff
+
+typedef struct zram_entry {
+        void     *ze_data;      /* the compressed page */
+        uint32_t  ze_word;      /* the word repeated, or the next free entry */
+        uint16_t  ze_len;       /* 0 if the entry is free */
+} zram_entry_t;
+
+static zram_entry_t *zram_table = NULL;
+static uint32_t zram_free_head = 0;     /* the first free entry, 0 if none */
+
+static slab_allocator_t *zram_classes[ZRAM_NCLASSES];
+static const char *zram_class_names[ZRAM_NCLASSES] = {
+        "zram-256", "zram-512", "zram-768", "zram-1024", "zram-1280", "zram-1536",
+        "zram-1792", "zram-2048", "zram-2304", "zram-2560", "zram-2816", "zram-3072"
+};
+
+static char zram_buf[ZRAM_MAX_LEN];
+
+static uint32_t zram_nused = 0;         /* entries in use */
+static uint32_t zram_nsame = 0;         /* of which those of one word */
+static uint32_t zram_pool_bytes = 0;    /* in objects */
+static uint32_t zram_data_bytes = 0;    /* compressed data in them */
+static uint32_t zram_nrejected = 0;     /* pages which did not compress */
+
+void
+zram_init(void)
+{
+#ifdef __ZRAM__
+        uint32_t npages = (ZRAM_NENTRIES * sizeof(zram_entry_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+        uint32_t i;
+
+        if (NULL == (zram_table = page_alloc_n(npages)))
+                panic("Not enough memory for the zram table\n");
+        memset(zram_table, 0, npages * PAGE_SIZE);
+
+        /* entry 0 is never used */
+        for (i = ZRAM_NENTRIES - 1; 0 < i; i--) {
+                zram_table[i].ze_word = zram_free_head;
+                zram_free_head = i;
+        }
+
+        for (i = 0; i < ZRAM_NCLASSES; i++) {
+                zram_classes[i] = slab_allocator_create(zram_class_names[i],
+                                                        (i + 1) * ZRAM_CLASS_SIZE);
+                KASSERT(NULL != zram_classes[i]);
+        }
+        dbg(DBG_INIT, "Compressing swap into up to %u pages\n", __ZRAM_PAGES__);
+#endif
+}
+
+int
+zram_enabled(void)
+{
+        return NULL != zram_table;
+}
+
+/* Whether the page is one word repeated, which is put in *word */
+static int
+zram_same(const void *addr, uint32_t *word)
+{
+        const uint32_t *w = addr;
+        uint32_t i;
+
+        for (i = 1; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+                if (w[i] != w[0])
+                        return 0;
+        }
+        *word = w[0];
+        return 1;
+}
+
+int
+zram_store(const void *addr)
+{
+        uint32_t entry = zram_free_head;
+        zram_entry_t *ze = &zram_table[entry];
+        size_t len, cls;
+        uint32_t word;
+
+        KASSERT(zram_enabled());
+
+        if (0 == entry)
+                return -ENOSPC;
+
+        if (zram_same(addr, &word)) {
+                zram_free_head = ze->ze_word;
+                ze->ze_data = NULL;
+                ze->ze_word = word;
+                ze->ze_len = ZRAM_SAME;
+                zram_nsame++;
+                zram_nused++;
+                return entry;
+        }
+
+        if (0 == (len = lz_compress(addr, PAGE_SIZE, zram_buf, ZRAM_MAX_LEN))) {
+                zram_nrejected++;
+                return -ENOSPC;
+        }
+        cls = (len - 1) / ZRAM_CLASS_SIZE;
+        if (zram_pool_bytes + (cls + 1) * ZRAM_CLASS_SIZE > ZRAM_POOL_BYTES)
+                return -ENOSPC;
+        if (NULL == (ze->ze_data = slab_obj_alloc(zram_classes[cls])))
+                return -ENOMEM;
+        memcpy(ze->ze_data, zram_buf, len);
+
+        zram_free_head = ze->ze_word;
+        ze->ze_len = len;
+        zram_pool_bytes += (cls + 1) * ZRAM_CLASS_SIZE;
+        zram_data_bytes += len;
+        zram_nused++;
+        return entry;
+}
+
+int
+zram_load(uint32_t entry, void *addr)
+{
+        zram_entry_t *ze = &zram_table[entry];
+
+        KASSERT(0 < entry && entry < ZRAM_NENTRIES && 0 != ze->ze_len);
+
+        if (ZRAM_SAME == ze->ze_len) {
+                uint32_t *w = addr;
+                uint32_t i;
+
+                for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++)
+                        w[i] = ze->ze_word;
+                return 0;
+        }
+        if (PAGE_SIZE != lz_decompress(ze->ze_data, ze->ze_len, addr, PAGE_SIZE)) {
+                dbg(DBG_MM, "zram entry %u does not decompress\n", entry);
+                return -EIO;
+        }
+        return 0;
+}
+
+void
+zram_free(uint32_t entry)
+{
+        zram_entry_t *ze = &zram_table[entry];
+
+        KASSERT(0 < entry && entry < ZRAM_NENTRIES && 0 != ze->ze_len);
+
+        if (ZRAM_SAME == ze->ze_len) {
+                zram_nsame--;
+        } else {
+                size_t cls = (ze->ze_len - 1) / ZRAM_CLASS_SIZE;
+
+                slab_obj_free(zram_classes[cls], ze->ze_data);
+                zram_pool_bytes -= (cls + 1) * ZRAM_CLASS_SIZE;
+                zram_data_bytes -= ze->ze_len;
+        }
+        ze->ze_data = NULL;
+        ze->ze_len = 0;
+        ze->ze_word = zram_free_head;
+        zram_free_head = entry;
+        zram_nused--;
+}
+
+size_t
+zram_info(const void *data, char *buf, size_t osize)
+{
+        size_t size = osize;
+        uint32_t ncompressed = zram_nused - zram_nsame;
+
+        if (!zram_enabled()) {
+                iprintf(&buf, &size, "zram: none\n");
+                return size;
+        }
+        iprintf(&buf, &size, "zram: %u of %u entries used (%u of one word), "
+                "%u of %u pool bytes\n", zram_nused, ZRAM_NENTRIES - 1, zram_nsame,
+                zram_pool_bytes, ZRAM_POOL_BYTES);
+        iprintf(&buf, &size, "zram: %u bytes a page compressed, %u pages rejected\n",
+                (0 == ncompressed) ? 0 : zram_data_bytes / ncompressed, zram_nrejected);
+        return size;
+}
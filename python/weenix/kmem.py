@@ -9,7 +9,6 @@ _uint32_type = gdb.lookup_type("uint32_t")
 _uintptr_type = gdb.lookup_type("uintptr_t")
 _slab_type = gdb.lookup_type("struct slab")
 _allocator_type = gdb.lookup_type("struct slab_allocator")
-_bufctl_type = gdb.lookup_type("struct slab_bufctl")
 _void_type = gdb.lookup_type("void")
 
 class Slab:
@@ -22,11 +21,15 @@ class Slab:
 			self._value = val.cast(_slab_type)
 
 	def objs(self, typ=None):
+		nobjs = int(self._alloc["sa_slab_nobjs"])
+		# the bottom (nobjs - inuse) entries of the stack are the free objects
+		stack = self._value["s_stack"]
+		free = set()
+		for i in xrange(nobjs - int(self._value["s_inuse"])):
+			free.add(int(stack[i]))
 		next = self._value["s_addr"]
-		for i in xrange(self._alloc["sa_slab_nobjs"]):
-			bufctl = (next.cast(_uintptr_type)
-					  + self._alloc["sa_objsize"]).cast(_bufctl_type.pointer())
-			if (bufctl.dereference()["u"]["sb_slab"] == self._value.address):
+		for i in xrange(nobjs):
+			if (i not in free):
 				# if redzones are in effect we need to skip them
 				if (int(next.cast(_uint32_type.pointer()).dereference()) == 0xdeadbeef):
 					value = (next.cast(_uint32_type.pointer()) + 1).cast(_void_type.pointer())
@@ -39,8 +42,7 @@ class Slab:
 					yield value
 					
 			next = (next.cast(_uintptr_type)
-					+ self._alloc["sa_objsize"]
-					+ _bufctl_type.sizeof).cast(_void_type.pointer())
+					+ self._alloc["sa_objsize"]).cast(_void_type.pointer())
 
 class SlabAllocator:
 
@@ -57,10 +59,9 @@ class SlabAllocator:
 		return int(self._value["sa_objsize"])
 
 	def slabs(self):
-		next = self._value["sa_slabs"]
-		while (next != 0):
-			yield Slab(self._value, next.dereference())
-			next = next.dereference()["s_next"]
+		for name in ["sa_full", "sa_partial", "sa_empty"]:
+			for slab in weenix.list.load(self._value[name], "struct slab", "s_link"):
+				yield Slab(self._value, slab.item())
 
 	def objs(self, typ=None):
 		for slab in self.slabs():
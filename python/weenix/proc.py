@@ -35,6 +35,10 @@ class Proc:
 		for child in weenix.list.load(self._val["p_children"], "struct proc", "p_child_link"):
 			yield Proc(child.item())
 
+	def threads(self):
+		for thr in weenix.list.load(self._val["p_threads"], "struct kthread", "kt_plink"):
+			yield thr.item()
+
 	def str_short(self):
 		res = "{0:>5} ({1}) {2}".format(self.pid(), self.name(), self.state())
 		if (self.state() == "EXITED"):
@@ -1,4 +1,5 @@
 import gdb
+import struct
 import weenix
 
 class Stack:
@@ -54,3 +55,39 @@ class Frame:
                 res = res[:-2]
             res += ") in {0}:{1}".format(self._symtab.symtab.filename, self._symtab.line)
         return res
+
+def func_name(pc):
+    try:
+        block = gdb.block_for_pc(pc)
+    except RuntimeError:
+        block = None
+    while (block != None and block.function == None):
+        block = block.superblock
+    return None if block == None else block.function.name
+
+def names(pc, fp, limit=64):
+    """Returns the names of the functions on the stack whose innermost
+    frame is at pc, with frame pointer fp, innermost first. Rather than
+    gdb's unwinder it follows the saved frame pointers (the kernel is
+    built without -fomit-frame-pointer), so that the stack of a thread
+    which is not running can be read without setting the registers, and
+    quickly. It stops at the first address it has no function for, as the
+    frame pointers past it (through assembly, or in userland) cannot be
+    trusted."""
+    res = list()
+    inferior = gdb.selected_inferior()
+    while (len(res) < limit):
+        name = func_name(pc)
+        if (name == None):
+            break
+        res.append(name)
+        if (fp == 0):
+            break
+        try:
+            fp, pc = struct.unpack("<II", bytes(inferior.read_memory(fp, 8)))
+        except gdb.MemoryError:
+            break
+        # the return address is just past the call, which may have been
+        # the last instruction of the function
+        pc -= 1
+    return res
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Runs the user-space benchmarks (/usr/bin/bench) on a fresh copy of the
+# disk, using the launcher's batch mode, and prints their results: the
+# "bench: <name> <value> <unit>" lines, without the prefix. Any
+# arguments are passed on to bench, to run just some of them.
+#
+# The kernel and disk have to have been built with VM=1. Only qemu can
+# be run in batch mode, so that is the machine used.
+#
+# usage: tools/bench/run.sh [benchmark...]
+
+TIMEOUT=600
+
+cd $(dirname $0)/../..
+
+CMDS=$(mktemp)
+OUT=$(mktemp)
+trap 'rm -f "$CMDS" "$OUT"' EXIT
+
+echo "/usr/bin/bench $*" > "$CMDS"
+echo "/sbin/halt" >> "$CMDS"
+
+./weenix -n -b "$CMDS" > "$OUT" 2>&1 &
+pid=$!
+
+# qemu keeps running after the kernel halts, so stop it once bench is done
+for ((i = 0; i < TIMEOUT; i++)); do
+	if grep -q "^bench: end" "$OUT" || ! kill -0 $pid 2> /dev/null; then
+		break
+	fi
+	sleep 1
+done
+kill $pid 2> /dev/null
+wait $pid 2> /dev/null
+
+if ! grep -q "^bench: end" "$OUT"; then
+	echo "$0: bench did not finish; its output was:" >&2
+	cat "$OUT" >&2
+	exit 1
+fi
+grep "^bench: " "$OUT" | grep -v "^bench: begin\|^bench: end" | tr -d '\r' | sed "s/^bench: //"
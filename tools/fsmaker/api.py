@@ -4,6 +4,19 @@ import struct
 
 S5_MAGIC = 0x727f
 S5_CURRENT_VERSION = 3
+# version 3 plus directory hash indexes, see kernel/include/fs/s5fs/s5fs.h
+S5_INDEXED_VERSION = 4
+# version 4 plus double-indirect blocks, see kernel/include/fs/s5fs/s5fs.h
+S5_LARGEFILE_VERSION = 5
+# version 5 plus small files kept in their inodes, see kernel/include/fs/s5fs/s5fs.h
+S5_INLINE_VERSION = 6
+# version 6 plus groups of inode and data blocks, see kernel/include/fs/s5fs/s5fs.h
+S5_GROUPED_VERSION = 7
+S5_VERSIONS = set([ S5_CURRENT_VERSION, S5_INDEXED_VERSION, S5_LARGEFILE_VERSION, S5_INLINE_VERSION, S5_GROUPED_VERSION ])
+S5_DIRINDEX_MAGIC = 0xd1ec7041
+# the metadata journal, see kernel/include/fs/s5fs/s5fs.h
+S5_JOURNAL_HEADER_MAGIC = 0x4a4e4c48
+S5_JOURNAL_MIN_BLOCKS = 4
 S5_BLOCK_SIZE = 4096
 
 S5_NBLKS_PER_FNODE = 30
@@ -11,6 +24,13 @@ S5_NDIRECT_BLOCKS = 28
 S5_MAX_FILE_BLOCKS = S5_NDIRECT_BLOCKS + math.floor(S5_BLOCK_SIZE / 4)
 S5_MAX_FILE_SIZE = S5_MAX_FILE_BLOCKS * S5_BLOCK_SIZE
 
+S5_NIDIRECT_BLOCKS = S5_BLOCK_SIZE // 4
+# on a version 5 disk the last direct block pointer names a double-indirect block
+S5_DINDIRECT_SLOT = S5_NDIRECT_BLOCKS - 1
+S5_LARGE_MAX_FILE_BLOCKS = S5_DINDIRECT_SLOT + S5_NIDIRECT_BLOCKS + S5_NIDIRECT_BLOCKS ** 2
+# (limited by the 32-bit size field)
+S5_LARGE_MAX_FILE_SIZE = min(S5_LARGE_MAX_FILE_BLOCKS * S5_BLOCK_SIZE, 0xffffffff)
+
 S5_NAME_LEN = 28
 S5_DIRENT_SIZE = S5_NAME_LEN + 4
 
@@ -23,6 +43,9 @@ S5_TYPE_DIR = 0x2
 S5_TYPE_CHR = 0x4
 S5_TYPE_BLK = 0x8
 S5_TYPES = set([ S5_TYPE_FREE, S5_TYPE_DATA, S5_TYPE_DIR, S5_TYPE_CHR, S5_TYPE_BLK ])
+# or'd into S5_TYPE_DATA for a file whose data is where its block pointers would be
+S5_TYPE_INLINE = 0x10
+S5_INLINE_MAX = (S5_NDIRECT_BLOCKS + 1) * 4
 
 class S5fsException(Exception):
 
@@ -87,6 +110,7 @@ class Dirent:
         self._offset = offset
 
     def remove(self):
+        self._parent.drop_index()
         self._parent.write(self._offset + 4, '\0')
 
 class Inode:
@@ -119,14 +143,23 @@ class Inode:
         self._simfile.seek(int(self._offset + 4))
         self._simfile.write(struct.pack("I", val))
 
-    def get_type(self):
+    def _get_raw_type(self):
         self._simfile.seek(int(self._offset + 8))
         return struct.unpack("H", self._simfile.read(2))[0]
 
+    def get_type(self):
+        return self._get_raw_type() & ~S5_TYPE_INLINE
+
     def set_type(self, val):
         self._simfile.seek(int(self._offset + 8))
         self._simfile.write(struct.pack("H", val))
 
+    def is_inline(self):
+        return (self._get_raw_type() & S5_TYPE_INLINE) != 0
+
+    def set_inline(self, inline):
+        self.set_type(self.get_type() | (S5_TYPE_INLINE if inline else 0))
+
     def get_link_count(self):
         self._simfile.seek(int(self._offset + 10))
         return struct.unpack("h", self._simfile.read(2))[0]
@@ -180,46 +213,158 @@ class Inode:
             res += "links: {0}\n".format(self.get_link_count())
         if (self.get_type() in set([ S5_TYPE_DATA, S5_TYPE_DIR ])):
             res += "size:  {0} bytes".format(self.get_size())
-            if (self.get_size() > S5_MAX_FILE_SIZE):
-                res += " (INVALID, max file size is {0})".format(S5_MAX_FILE_SIZE)
+            if (self.get_size() > self._max_file_size()):
+                res += " (INVALID, max file size is {0})".format(self._max_file_size())
             elif (self.get_type() == S5_TYPE_DIR and self.get_size() % S5_DIRENT_SIZE != 0):
                 res += " (INVALID, directory size must be multiple of dirent size ({0}))".format(S5_DIRENT_SIZE)
             elif (self.get_type() == S5_TYPE_DIR):
                 res += " ({0} dirents)".format(self.get_size() / S5_DIRENT_SIZE)
             res += "\n"
-            res += "direct blocks ({0}):\n".format(S5_NDIRECT_BLOCKS)
-            for i in xrange(S5_NDIRECT_BLOCKS):
+            if (self.is_inline()):
+                res += "inline data{0}\n".format("" if self.get_size() <= S5_INLINE_MAX else " (INVALID, size is more than {0})".format(S5_INLINE_MAX))
+                return res[:-1]
+            res += "direct blocks ({0}):\n".format(self._ndirect())
+            for i in xrange(self._ndirect()):
                 res += " {0:5}".format(self.get_direct_blockno(i))
                 if ((i + 1) % 4 == 0):
                     res += "\n"
             if (res[-1] != "\n"):
                 res += "\n"
             res += "indirect block: {0}\n".format(self.get_indirect_blockno())
+            if (self._ndirect() != S5_NDIRECT_BLOCKS):
+                res += "double-indirect block: {0}\n".format(self.get_direct_blockno(S5_DINDIRECT_SLOT))
         elif (self.get_type() == S5_TYPE_FREE):
             res += "next free: {0}\n".format(self.get_next_free())
         res = res[:-1]
         return res
 
+    def _ndirect(self):
+        if (self._simdisk.get_version() >= S5_LARGEFILE_VERSION):
+            return S5_DINDIRECT_SLOT
+        return S5_NDIRECT_BLOCKS
+
+    def _max_file_size(self):
+        if (self._simdisk.get_version() >= S5_LARGEFILE_VERSION):
+            return S5_LARGE_MAX_FILE_SIZE
+        return S5_MAX_FILE_SIZE
+
+    def _expand_inline(self):
+        # moves an inline file's data to a block, so that it can grow
+        data = self.read()
+        self._simfile.seek(int(self._offset + 12))
+        self._simfile.write('\0' * S5_INLINE_MAX)
+        self.set_inline(False)
+        self.set_size(0)
+        self.write(0, data)
+
+    def _take_blocks(self):
+        # Returns the contents of each block the file has, as (blockloc,
+        # data) pairs, and forgets the blocks without freeing them, for
+        # Simdisk.defrag; a directory's index is dropped (the kernel builds
+        # a new one). Device files and inline files have no blocks.
+        if (self.get_type() not in set([ S5_TYPE_DATA, S5_TYPE_DIR ]) or self.is_inline()):
+            return []
+        self.drop_index()
+        res = []
+        nblocks = int(math.ceil(float(min(self.get_size(), self._max_file_size())) / S5_BLOCK_SIZE))
+        for blockloc in xrange(nblocks):
+            blockno = self._get_blockno(blockloc)
+            if (blockno != 0):
+                res.append((blockloc, self._simdisk.get_block(blockno).read()))
+        for i in xrange(S5_NDIRECT_BLOCKS):
+            self.set_direct_blockno(i, 0)
+        self.set_indirect_blockno(0)
+        return res
+
+    def _alloc_zeroed_block(self):
+        block = self._simdisk.alloc_block()
+        block.zero()
+        return block.get_blockno()
+
+    def _slot(self, blockloc, alloc=False):
+        # Returns (block, index) locating the pointer to block 'blockloc'
+        # of the file, where block is None for the inode's own direct
+        # pointers. Returns None if an indirect block on the way is
+        # missing, unless alloc is set, in which case it is allocated.
+        blockloc = int(blockloc)
+        ndirect = self._ndirect()
+        if (blockloc < ndirect):
+            return (None, blockloc)
+        blockloc -= ndirect
+        if (blockloc < S5_NIDIRECT_BLOCKS):
+            if (self.get_indirect_blockno() == 0):
+                if (not alloc):
+                    return None
+                self.set_indirect_blockno(self._alloc_zeroed_block())
+            return (self._simdisk.get_block(self.get_indirect_blockno()), blockloc)
+        blockloc -= S5_NIDIRECT_BLOCKS
+        if (ndirect == S5_NDIRECT_BLOCKS or blockloc >= S5_NIDIRECT_BLOCKS ** 2):
+            raise S5fsException("file block {0} is past the maximum file size".format(blockloc))
+        if (self.get_direct_blockno(S5_DINDIRECT_SLOT) == 0):
+            if (not alloc):
+                return None
+            self.set_direct_blockno(S5_DINDIRECT_SLOT, self._alloc_zeroed_block())
+        dindirect = self._simdisk.get_block(self.get_direct_blockno(S5_DINDIRECT_SLOT))
+        index = blockloc // S5_NIDIRECT_BLOCKS
+        indirect = struct.unpack("I", dindirect.read(index * 4, 4))[0]
+        if (indirect == 0):
+            if (not alloc):
+                return None
+            indirect = self._alloc_zeroed_block()
+            dindirect.write(index * 4, struct.pack("I", indirect))
+        return (self._simdisk.get_block(indirect), blockloc % S5_NIDIRECT_BLOCKS)
+
+    def _get_blockno(self, blockloc):
+        slot = self._slot(blockloc)
+        if (slot == None):
+            return 0
+        (block, index) = slot
+        if (block == None):
+            return self.get_direct_blockno(index)
+        return struct.unpack("I", block.read(index * 4, 4))[0]
+
+    def _set_blockno(self, blockloc, blockno):
+        slot = self._slot(blockloc, alloc=True)
+        (block, index) = slot
+        if (block == None):
+            self.set_direct_blockno(index, blockno)
+        else:
+            block.write(index * 4, struct.pack("I", blockno))
+
+    def _free_indirect_blocks(self, nblocks):
+        # frees the indirect blocks which only map blocks at or past
+        # 'nblocks', all of which must already be free
+        ndirect = self._ndirect()
+        if (ndirect != S5_NDIRECT_BLOCKS and self.get_direct_blockno(S5_DINDIRECT_SLOT) != 0):
+            first = ndirect + S5_NIDIRECT_BLOCKS
+            dindirect = self._simdisk.get_block(self.get_direct_blockno(S5_DINDIRECT_SLOT))
+            for i in xrange(S5_NIDIRECT_BLOCKS):
+                indirect = struct.unpack("I", dindirect.read(i * 4, 4))[0]
+                if (indirect != 0 and nblocks <= first + i * S5_NIDIRECT_BLOCKS):
+                    self._simdisk.get_block(indirect).free()
+                    dindirect.write(i * 4, struct.pack("I", 0))
+            if (nblocks <= first):
+                dindirect.free()
+                self.set_direct_blockno(S5_DINDIRECT_SLOT, 0)
+        if (self.get_indirect_blockno() != 0 and nblocks <= ndirect):
+            self._simdisk.get_block(self.get_indirect_blockno()).free()
+            self.set_indirect_blockno(0)
+
     def read(self, offset=0, size=None):
         if (size == None):
             size = self.get_size()
         if (self.get_type() not in set([ S5_TYPE_DATA, S5_TYPE_DIR ])):
             raise S5fsException("cannot read from inode of type " + self.get_type_str())
-        size = min(size, min(S5_MAX_FILE_SIZE, self.get_size()) - offset)
+        size = min(size, min(self._max_file_size(), self.get_size()) - offset)
+        if (self.is_inline()):
+            size = max(0, min(size, S5_INLINE_MAX - offset))
+            self._simfile.seek(int(self._offset + 12 + offset))
+            return self._simfile.read(size)
         res = ""
         while (size > 0):
-            blockno = math.floor(offset / S5_BLOCK_SIZE)
             blockoff = offset % S5_BLOCK_SIZE
             ammount = min(S5_BLOCK_SIZE - blockoff, size)
-            if (blockno < S5_NDIRECT_BLOCKS):
-                blockno = self.get_direct_blockno(blockno)
-            else:
-                if (self.get_indirect_blockno() == 0):
-                    blockno = 0
-                else:
-                    indirect = self._simdisk.get_block(self.get_indirect_blockno())
-                    blockno -= S5_NDIRECT_BLOCKS
-                    blockno = struct.unpack("I", indirect.read(blockno * 4, 4))[0]
+            blockno = self._get_blockno(math.floor(offset / S5_BLOCK_SIZE))
             if (blockno == 0):
                 for i in xrange(ammount):
                     res += '\0'
@@ -232,34 +377,26 @@ class Inode:
     def write(self, offset, data):
         if (self.get_type() not in set([ S5_TYPE_DATA, S5_TYPE_DIR ])):
             raise S5fsException("cannot write to inode of type " + self.get_type_str())
-        if (offset + len(data) > S5_MAX_FILE_SIZE):
-            raise S5fsException("cannot write up to byte {0}, max file size is {1}".format(offset + len(data), S5_MAX_FILE_SIZE))
+        if (offset + len(data) > self._max_file_size()):
+            raise S5fsException("cannot write up to byte {0}, max file size is {1}".format(offset + len(data), self._max_file_size()))
+        if (self.is_inline() and offset + len(data) <= S5_INLINE_MAX):
+            self._simfile.seek(int(self._offset + 12 + offset))
+            self._simfile.write(data)
+            if (offset + len(data) > self.get_size()):
+                self.set_size(offset + len(data))
+            return
+        if (self.is_inline()):
+            self._expand_inline()
         remaining = len(data)
         while (remaining > 0):
             blockloc = math.floor(offset / S5_BLOCK_SIZE)
             blockoff = offset % S5_BLOCK_SIZE
             ammount = min(S5_BLOCK_SIZE - blockoff, remaining)
-            if (blockloc < S5_NDIRECT_BLOCKS):
-                blockno = self.get_direct_blockno(blockloc)
-            else:
-                if (self.get_indirect_blockno() == 0):
-                    indirect = self._simdisk.alloc_block()
-                    indirect.zero()
-                    self.set_indirect_blockno(indirect.get_blockno())
-                    blockno = 0
-                else:
-                    indirect = self._simdisk.get_block(self.get_indirect_blockno())
-                    blockno = struct.unpack("I", indirect.read((blockloc - S5_NDIRECT_BLOCKS) * 4, 4))[0]
+            blockno = self._get_blockno(blockloc)
             if (blockno == 0):
-                block = self._simdisk.alloc_block()
-                block.zero()
-                if (blockloc < S5_NDIRECT_BLOCKS):
-                    self.set_direct_blockno(blockloc, block.get_blockno())
-                else:
-                    indirect = self._simdisk.get_block(self.get_indirect_blockno())
-                    indirect.write((blockloc - S5_NDIRECT_BLOCKS) * 4, struct.pack("I", block.get_blockno()))
-            else:
-                block = self._simdisk.get_block(blockno)
+                blockno = self._alloc_zeroed_block()
+                self._set_blockno(blockloc, blockno)
+            block = self._simdisk.get_block(blockno)
             if (remaining == ammount):
                 block.write(blockoff, data[-remaining:])
             else:
@@ -270,38 +407,42 @@ class Inode:
             self.set_size(offset)
 
     def truncate(self, size=0):
-        target = math.floor((size - 1) / S5_BLOCK_SIZE)
-        curr = math.floor(self.get_size() / S5_BLOCK_SIZE)
-        while (curr > target):
-            if (curr < S5_NDIRECT_BLOCKS):
-                blockno = self.get_direct_blockno(curr)
-            else:
-                if (self.get_indirect_blockno() == 0):
-                    blockno = 0
-                else:
-                    indirect = self._simdisk.get_block(self.get_indirect_blockno())
-                    blockno = struct.unpack("I", indirect.read((curr - S5_NDIRECT_BLOCKS) * 4, 4))[0]
+        # blocks [keep, end) are freed; growing a file just makes it sparse
+        if (self.is_inline() and size <= S5_INLINE_MAX):
+            oldsize = self.get_size()
+            if (size < oldsize):
+                self._simfile.seek(int(self._offset + 12 + size))
+                self._simfile.write('\0' * (oldsize - size))
+            self.set_size(size)
+            return
+        if (self.is_inline()):
+            self._expand_inline()
+        keep = int(math.ceil(float(size) / S5_BLOCK_SIZE))
+        end = int(math.ceil(float(self.get_size()) / S5_BLOCK_SIZE))
+        for blockloc in xrange(keep, end):
+            blockno = self._get_blockno(blockloc)
             if (blockno > 0):
-                block = self._simdisk.get_block(blockno)
-                block.free()
-                if (curr < S5_NDIRECT_BLOCKS):
-                    self.set_direct_blockno(curr, 0)
-                else:
-                    indirect = self._simdisk.get_block(self.get_indirect_blockno())
-                    indirect.write((curr - S5_NDIRECT_BLOCKS) * 4, struct.pack("I", 0))
-                    if (curr == S5_NDIRECT_BLOCKS):
-                        indirect.free()
-                        self.set_indirect_blockno(0)
-            curr -= 1
-        while (curr < target):
-            if (curr < S5_NDIRECT_BLOCKS):
-                self.set_direct_blockno(0)
-            else:
-                if (self.get_indirect_blockno() != 0):
-                    indirect = self._simdisk.get_block(self.get_indirect_blockno())
-                    indirect.write((curr - S5_NDIRECT_BLOCKS) * 4, struct.pack("I", 0))
+                self._simdisk.get_block(blockno).free()
+                self._set_blockno(blockloc, 0)
+        self._free_indirect_blocks(keep)
         self.set_size(size)
 
+    def drop_index(self):
+        # The kernel keeps a directory's hash index (in the block its
+        # indirect block pointer names) up to date, but we do not; instead we
+        # free the index before changing the directory's entries and the
+        # kernel builds a new one when it next adds an entry.
+        if (self._simdisk.get_version() < S5_INDEXED_VERSION or self.get_type() != S5_TYPE_DIR):
+            return
+        if (self.get_indirect_blockno() == 0):
+            return
+        index = self._simdisk.get_block(self.get_indirect_blockno())
+        if (struct.unpack("I", index.read(0, 4))[0] != S5_DIRINDEX_MAGIC):
+            return
+        index.write(0, struct.pack("I", 0))
+        index.free()
+        self.set_indirect_blockno(0)
+
     def _find_dirent(self, name, types=S5_TYPES):
         if (self.get_type() != S5_TYPE_DIR):
             raise S5fsException("cannot remove directory entry in non-directory inode of type " + self.get_type_str())
@@ -359,6 +500,7 @@ class Inode:
             raise S5fsException("cannot create directory entry, inode has size {0} not a multiple of dirent size {1}".format(self.get_size(), S5_DIRENT_SIZE))
         if (len(name) >= S5_NAME_LEN):
             raise S5fsException("directroy entry name '{0}' too long, limit is {1} characters".format(name, S5_NAME_LEN - 1))
+        self.drop_index()
         empty = -1
         for i in xrange(0, self.get_size(), S5_DIRENT_SIZE):
             direntname = self.read(i + 4, S5_NAME_LEN).split('\0', 1)[0]
@@ -382,6 +524,8 @@ class Inode:
             for i in xrange(S5_NDIRECT_BLOCKS):
                 inode.set_direct_blockno(i, 0)
             inode.set_indirect_blockno(0)
+            # new files start out in their inodes, as the kernel's do
+            inode.set_inline(self._simdisk.get_version() >= S5_INLINE_VERSION)
             self._make_dirent(inode.get_number(), name)
             return inode
         except S5fsException as e:
@@ -459,6 +603,7 @@ class Inode:
         return last
 
     def free(self):
+        self.drop_index()
         if (self.get_size() != 0):
             self.truncate()
         self.set_type(S5_TYPE_FREE)
@@ -469,6 +614,11 @@ class Simdisk:
 
     def __init__(self, simfile):
         self._simfile = simfile
+        # while defrag lays out files, the free blocks of each group (in
+        # reverse, so that pop() hands them out in order), and the group
+        # to take from first
+        self._seq_blocks = None
+        self._seq_group = 0
 
     def get_magic(self):
         self._simfile.seek(0)
@@ -536,13 +686,54 @@ class Simdisk:
         self._simfile.seek(20 + 4 * S5_NBLKS_PER_FNODE)
         self._simfile.write(struct.pack("I", val))
 
+    def get_journal_start(self):
+        self._simfile.seek(24 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_journal_start(self, val):
+        self._simfile.seek(24 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_journal_nblocks(self):
+        self._simfile.seek(28 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_journal_nblocks(self, val):
+        self._simfile.seek(28 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_group_nblocks(self):
+        self._simfile.seek(32 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_group_nblocks(self, val):
+        self._simfile.seek(32 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_group_ninodes(self):
+        self._simfile.seek(36 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_group_ninodes(self, val):
+        self._simfile.seek(36 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def has_groups(self):
+        return self.get_version() >= S5_GROUPED_VERSION and self.get_group_nblocks() != 0
+
     def get_super_block_summary(self):
         res = ""
         res += "magic:      0x{0:04x} ({1})\n".format(self.get_magic(), "VALID" if self.get_magic() == S5_MAGIC else "INVALID")
-        res += "version:    0x{0:04x}{1}\n".format(self.get_version(), "" if self.get_version() == S5_CURRENT_VERSION else " (INVALID)")
+        res += "version:    0x{0:04x}{1}\n".format(self.get_version(), "" if self.get_version() in S5_VERSIONS else " (INVALID)")
         res += "num inodes: {0}\n".format(self.get_num_inodes())
         res += "free inode: {0}{1}\n".format(self.get_free_inode(), "" if self.get_free_inode() < self.get_num_inodes() else " (INVALID)")
         res += "root inode: {0}{1}\n".format(self.get_root_inode(), "" if self.get_root_inode() < self.get_num_inodes() else " (INVALID)")
+        if (self.get_journal_nblocks() == 0):
+            res += "journal:    none\n"
+        else:
+            res += "journal:    blocks {0} to {1}{2}\n".format(self.get_journal_start(), self.get_journal_start() + self.get_journal_nblocks() - 1, "" if self.get_journal_nblocks() >= S5_JOURNAL_MIN_BLOCKS else " (INVALID, too small)")
+        if (self.has_groups()):
+            res += "groups:     {0} blocks, {1} inodes each{2}\n".format(self.get_group_nblocks(), self.get_group_ninodes(), "" if self.get_group_ninodes() > 0 and self.get_group_ninodes() % S5_INODES_PER_BLOCK == 0 and self.get_group_ninodes() / S5_INODES_PER_BLOCK < self.get_group_nblocks() else " (INVALID)")
         res += "free blocks ({0}{1}):\n".format(self.get_nfree(), "" if self.get_nfree() <= S5_NBLKS_PER_FNODE else (", too large shouldn't exceed " + str(S5_NBLKS_PER_FNODE)))
         for i in xrange(min(self.get_nfree(), S5_NBLKS_PER_FNODE - 1)):
             res += "  {0}".format(self.get_free_block(i))
@@ -553,22 +744,53 @@ class Simdisk:
         res += "  last free block: {0}\n".format(self.get_last_free_block())
         return res
 
-    def format(self, inodes, size):
+    def _group_layout(self, inodes, blocks, group):
+        # splits the blocks after the superblock into groups of 'group'
+        # blocks, each with an equal share of the inodes (whole blocks of
+        # them); a last group too short for its inodes is left out
+        ngroups = int(math.ceil(float(blocks - 1) / group))
+        while (True):
+            ninodes = int(math.ceil(float(inodes) / ngroups))
+            ninodes = int(math.ceil(float(ninodes) / S5_INODES_PER_BLOCK)) * S5_INODES_PER_BLOCK
+            iblocks = ninodes / S5_INODES_PER_BLOCK
+            if (ngroups == 1 or 1 + (ngroups - 1) * group + iblocks < blocks):
+                break
+            ngroups -= 1
+        if (iblocks >= group or 1 + iblocks >= blocks):
+            raise S5fsException("cannot fit {0} inodes in groups of {1} blocks, each group's share takes {2} blocks".format(inodes, group, iblocks))
+        return (ngroups, ninodes, iblocks)
+
+    def format(self, inodes, size, version=S5_CURRENT_VERSION, journal=0, group=0):
         if (inodes < 1):
             raise S5fsException("cannot format disk with {0} inodes, must have at least one".format(inodes))
         if (size % S5_BLOCK_SIZE != 0):
             raise S5fsException("cannot format disk to size {0} which is not a multiple of the block size {1}".format(size, S5_BLOCK_SIZE))
         blocks = int(size / S5_BLOCK_SIZE)
-        iblocks = int(math.floor((inodes - 1) / S5_INODES_PER_BLOCK) + 1)
-        if (iblocks + 1 >= blocks):
-            raise S5fsException("cannot format disk of size {0} with {1} inodes, the inodes require at least {2} bytes of space".format(size, inodes, (1 + iblocks) * S5_BLOCK_SIZE))
-        self._simfile.truncate()
-        self._simfile.seek(size)
-        self._simfile.write("")
+        if (journal != 0 and journal < S5_JOURNAL_MIN_BLOCKS):
+            raise S5fsException("cannot make a journal of {0} blocks, must have at least {1}".format(journal, S5_JOURNAL_MIN_BLOCKS))
+        if (group != 0):
+            # the journal goes at the start of the first group's data
+            version = max(version, S5_GROUPED_VERSION)
+            (ngroups, group_ninodes, iblocks) = self._group_layout(inodes, blocks, group)
+            inodes = ngroups * group_ninodes
+            jstart = 1 + iblocks
+            if (iblocks + journal >= min(group, blocks - 1)):
+                raise S5fsException("cannot make a journal of {0} blocks in the first group, which has {1} blocks for data".format(journal, min(group, blocks - 1) - iblocks))
+        else:
+            iblocks = int(math.floor((inodes - 1) / S5_INODES_PER_BLOCK) + 1)
+            if (iblocks + 1 >= blocks):
+                raise S5fsException("cannot format disk of size {0} with {1} inodes, the inodes require at least {2} bytes of space".format(size, inodes, (1 + iblocks) * S5_BLOCK_SIZE))
+            if (iblocks + 1 + journal >= blocks):
+                raise S5fsException("cannot format disk of size {0} with {1} inodes and a journal of {2} blocks, they require at least {3} bytes of space".format(size, inodes, journal, (1 + iblocks + journal) * S5_BLOCK_SIZE))
+            jstart = iblocks + 1
+        self._simfile.truncate(size)
 
         self.set_magic(S5_MAGIC)
-        self.set_version(S5_CURRENT_VERSION)
+        self.set_version(version)
         self.set_num_inodes(inodes)
+        if (group != 0):
+            self.set_group_nblocks(group)
+            self.set_group_ninodes(group_ninodes)
         for i in xrange(inodes):
             inode = self.get_inode(i)
             inode.set_number(i)
@@ -577,9 +799,36 @@ class Simdisk:
         inode.set_next_free(0xffffffff)
         self.set_free_inode(0)
 
+        # the journal follows the (first group's) inodes and is never on
+        # the free list
+        self.set_journal_start(jstart if journal else 0)
+        self.set_journal_nblocks(journal)
+        if (journal):
+            header = self.get_block(jstart)
+            header.zero()
+            header.write(0, struct.pack("II", S5_JOURNAL_HEADER_MAGIC, 1))
+
+        self.set_nfree(0)
+        self.set_last_free_block(0xffffffff)
+        self._write_free_list([ b for g in self._group_data_blocks() for b in g ])
+
+        root = self.alloc_inode()
+        for i in xrange(S5_NDIRECT_BLOCKS):
+            root.set_direct_blockno(i, 0)
+        root.set_indirect_blockno(0)
+        root.set_type(S5_TYPE_DIR)
+        root.set_size(0)
+        root.set_link_count(1)
+        root._make_dirent(root.get_number(), ".")
+        root._make_dirent(root.get_number(), "..")
+        root.set_link_count(1)
+
+    def _write_free_list(self, free):
+        # makes 'free' the free list; the last of the blocks are handed
+        # out first
         self.set_last_free_block(0xffffffff)
         i = 0
-        for num in xrange(iblocks+1, blocks):
+        for num in free:
             if (i == S5_NBLKS_PER_FNODE - 1):
                 block = self.get_block(num)
                 for j in xrange(S5_NBLKS_PER_FNODE - 1):
@@ -592,16 +841,94 @@ class Simdisk:
                 i += 1
         self.set_nfree(i)
 
-        root = self.alloc_inode()
-        for i in xrange(S5_NDIRECT_BLOCKS):
-            root.set_direct_blockno(i, 0)
-        root.set_indirect_blockno(0)
-        root.set_type(S5_TYPE_DIR)
-        root.set_size(0)
-        root.set_link_count(1)
-        root._make_dirent(root.get_number(), ".")
-        root._make_dirent(root.get_number(), "..")
-        root.set_link_count(1)
+    def _group_data_blocks(self):
+        # the blocks which may hold data (all but the superblock, the inode
+        # blocks and the journal), as a list for each group; disks made
+        # before format made the file its full size may be shorter, but
+        # their last block is free
+        self._simfile.seek(0, os.SEEK_END)
+        blocks = int(self._simfile.tell() / S5_BLOCK_SIZE)
+        for b in self.free_blocks():
+            blocks = max(blocks, b + 1)
+        jstart = self.get_journal_start()
+        jend = jstart + self.get_journal_nblocks()
+        if (self.has_groups()):
+            group = self.get_group_nblocks()
+            iblocks = self.get_group_ninodes() / S5_INODES_PER_BLOCK
+            ngroups = int(math.ceil(float(self.get_num_inodes()) / self.get_group_ninodes()))
+            ranges = [ (1 + g * group + iblocks, min(1 + (g + 1) * group, blocks)) for g in xrange(ngroups) ]
+        else:
+            ranges = [ (int(math.floor((self.get_num_inodes() - 1) / S5_INODES_PER_BLOCK) + 2), blocks) ]
+        return [ [ b for b in xrange(start, end) if b < jstart or b >= jend ] for (start, end) in ranges ]
+
+    def _inode_group(self, index):
+        if (self.has_groups()):
+            return index / self.get_group_ninodes()
+        return 0
+
+    def defrag(self, order=[]):
+        # Lays out every file again: contiguously, its indirect blocks
+        # among its data where the file needs them first, a directory's
+        # files straight after it, and each file in its inode's group.
+        # The files (paths or inode numbers) in 'order' go first, in that
+        # order, then the rest of the tree breadth first, then any inode
+        # not in the tree. Every file's contents are held in memory while
+        # its blocks are handed out again in order.
+        seen = set()
+        inodes = []
+        def add(inode):
+            if (inode != None and inode.get_number() not in seen):
+                seen.add(inode.get_number())
+                inodes.append(inode)
+        for item in order:
+            try:
+                add(self.get_inode(item) if isinstance(item, (int, long)) else self.open(item))
+            except S5fsException:
+                pass
+        queue = [ self.get_inode(self.get_root_inode()) ]
+        queued = set([ queue[0].get_number() ])
+        while (len(queue) > 0):
+            curr = queue.pop(0)
+            add(curr)
+            for dirent in curr.getdents():
+                if (dirent.name == "." or dirent.name == ".."):
+                    continue
+                inode = self.get_inode(dirent.inode)
+                if (inode.get_type() != S5_TYPE_DIR):
+                    add(inode)
+                elif (inode.get_number() not in queued):
+                    queued.add(inode.get_number())
+                    queue.append(inode)
+        for index in xrange(self.get_num_inodes()):
+            inode = self.get_inode(index)
+            if (inode.get_type() != S5_TYPE_FREE):
+                add(inode)
+
+        contents = [ (inode, inode.get_size(), inode._take_blocks()) for inode in inodes ]
+        self._seq_blocks = [ list(reversed(g)) for g in self._group_data_blocks() ]
+        try:
+            for (inode, size, blocks) in contents:
+                self._seq_group = self._inode_group(inode.get_number())
+                for (blockloc, data) in blocks:
+                    inode.write(blockloc * S5_BLOCK_SIZE, data)
+                inode.set_size(size)
+            # highest first, so that the free list hands out the rest in order
+            free = [ b for g in reversed(self._seq_blocks) for b in g ]
+        finally:
+            self._seq_blocks = None
+        self._write_free_list(free)
+
+    def free_blocks(self):
+        # every block on the free list, including those holding the list
+        for i in xrange(min(self.get_nfree(), S5_NBLKS_PER_FNODE - 1)):
+            yield self.get_free_block(i)
+        bnext = self.get_last_free_block()
+        while (bnext != 0xffffffff):
+            yield bnext
+            block = self.get_block(bnext)
+            for i in xrange(S5_NBLKS_PER_FNODE - 1):
+                yield struct.unpack("I", block.read(i * 4, 4))[0]
+            bnext = struct.unpack("I", block.read((S5_NBLKS_PER_FNODE - 1) * 4, 4))[0]
 
     def free_inodes(self):
         inext = self.get_free_inode()
@@ -614,7 +941,12 @@ class Simdisk:
                 raise S5fsException("error encountered while iterating free inodes: {0}".format(str(e)))
 
     def get_inode(self, index):
-        offset = S5_BLOCK_SIZE * (1 + math.floor(index / S5_INODES_PER_BLOCK)) + S5_INODE_SIZE * (index % S5_INODES_PER_BLOCK)
+        if (self.has_groups()):
+            ninodes = self.get_group_ninodes()
+            blockno = 1 + (index / ninodes) * self.get_group_nblocks() + (index % ninodes) / S5_INODES_PER_BLOCK
+        else:
+            blockno = 1 + index / S5_INODES_PER_BLOCK
+        offset = S5_BLOCK_SIZE * blockno + S5_INODE_SIZE * (index % S5_INODES_PER_BLOCK)
         if (index >= self.get_num_inodes()):
             raise S5fsException("cannot get inode {0}, there are only {1} inodes on disk".format(index, self.get_num_inodes()))
         return Inode(self, index, offset)
@@ -631,6 +963,12 @@ class Simdisk:
         return Block(self, offset, index)
 
     def alloc_block(self):
+        if (self._seq_blocks != None):
+            ngroups = len(self._seq_blocks)
+            for g in range(self._seq_group, ngroups) + range(0, self._seq_group):
+                if (len(self._seq_blocks[g]) > 0):
+                    return self.get_block(self._seq_blocks[g].pop())
+            raise S5fsDiskSpaceException()
         if (self.get_nfree() > S5_NBLKS_PER_FNODE - 1):
             raise S5fsException("nfree {0} is invalid, maximum value is {1}".format(self.get_nfree(), S5_NBLKS_PER_FNODE - 1))
         if (self.get_nfree() == 0):
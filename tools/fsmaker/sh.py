@@ -15,6 +15,10 @@ import tempfile
 
 import curses.ascii
 
+# the kernel's warm boot list, see kernel/include/fs/warmboot.h
+WARMBOOT_PATH = "/.warmboot"
+WARMBOOT_MAGIC = 0x5742534c
+
 class OptionParser(optparse.OptionParser):
 
     def __init__(self, **args):
@@ -61,7 +65,7 @@ class FsmakerShell(cmd.Cmd):
         self._parse_getfile = OptionParser(usage="usage: %prog <source> <dest>", prog="getfile", description="gets a file from the real disk and puts it on the simdisk")
         self._parse_putfile = OptionParser(usage="usage: %prog <source> <dest>", prog="putfile", description="puts a file from the simdisk onto the real disk")
 
-        self._parse_format = OptionParser(usage="usage: %prog -i <inode count> [-s <size>|-b <blocks>]", prog="format", description="formats the simdisk to an empty file system")
+        self._parse_format = OptionParser(usage="usage: %prog -i <inode count> [-s <size>|-b <blocks>] [-x|-L|-I] [-J <blocks>] [-G <blocks>] [-D] [-t <trace>]", prog="format", description="formats the simdisk to an empty file system")
         self._parse_format.add_option("-s", "--size", action="store", type="int", default=None,
                                       help="size for the new file system in bytes, must specify either this option or -b but not both")
         self._parse_format.add_option("-b", "--blocks", action="store", type="int", default=None,
@@ -70,6 +74,32 @@ class FsmakerShell(cmd.Cmd):
                                       help="number of inodes to put on the disk, this must be specified and be compatible with the size of the disk (there must be enough space for the inodes)")
         self._parse_format.add_option("-d", "--directory", action="store", type="str", default=None,
                                       help="initializes the disk with the contents of the specified directory")
+        self._parse_format.add_option("-x", "--indexed", action="store_const", dest="version",
+                                      const=api.S5_INDEXED_VERSION, default=api.S5_CURRENT_VERSION,
+                                      help="formats the disk as version {0}, which allows the kernel to index large directories".format(api.S5_INDEXED_VERSION))
+        self._parse_format.add_option("-L", "--large-files", action="store_const", dest="version",
+                                      const=api.S5_LARGEFILE_VERSION,
+                                      help="formats the disk as version {0}, which also allows files of up to {1} bytes using double-indirect blocks".format(api.S5_LARGEFILE_VERSION, api.S5_LARGE_MAX_FILE_SIZE))
+        self._parse_format.add_option("-I", "--inline", action="store_const", dest="version",
+                                      const=api.S5_INLINE_VERSION,
+                                      help="formats the disk as version {0}, which also keeps files of up to {1} bytes in their inodes".format(api.S5_INLINE_VERSION, api.S5_INLINE_MAX))
+        self._parse_format.add_option("-J", "--journal", action="store", type="int", default=0,
+                                      help="sets aside this many blocks (at least {0}) after the inodes for the kernel's metadata journal".format(api.S5_JOURNAL_MIN_BLOCKS))
+        self._parse_format.add_option("-G", "--groups", action="store", type="int", default=0,
+                                      help="formats the disk as version {0}, split into groups of this many blocks which each hold some of the inodes, so that the kernel keeps files near their inodes".format(api.S5_GROUPED_VERSION))
+        self._parse_format.add_option("-D", "--defrag", action="store_true", default=False,
+                                      help="once the contents of -d are copied, lays out the disk as the defrag command does")
+        self._parse_format.add_option("-t", "--trace", action="store", type="str", default=None,
+                                      help="the same as -D, putting the files the given trace names first (see defrag)")
+
+        self._parse_defrag = OptionParser(usage="usage: %prog [-t <trace>|-w]", prog="defrag",
+                                          description="lays out every file contiguously, each directory's files just after it, so that the disk reads quickly from cold; "
+                                          "files named by a trace go first, in its order")
+        self._parse_defrag.add_option("-t", "--trace", action="store", type="str", default=None,
+                                      help="a file on the real disk naming the files to put first: either a warm boot list "
+                                      "(the kernel's {0}) or paths, one to a line".format(WARMBOOT_PATH))
+        self._parse_defrag.add_option("-w", "--warmboot", action="store_true", default=False,
+                                      help="uses the warm boot list left on the simdisk at {0} as the trace".format(WARMBOOT_PATH))
 
     def open(self, path, create=False):
         if (path.startswith("/")):
@@ -630,6 +660,52 @@ class FsmakerShell(cmd.Cmd):
         else:
             return []
 
+    def read_trace(self, data):
+        # A warm boot list (see kernel/fs/warmboot.c) is a header and
+        # (inode, page) pairs; the inodes are taken in the order their
+        # first pages appear. Anything else is a path on each line.
+        if (len(data) >= 8 and struct.unpack("II", data[:8])[0] == WARMBOOT_MAGIC):
+            npages = struct.unpack("II", data[:8])[1]
+            order = []
+            for i in xrange(min(npages, (len(data) - 8) / 8)):
+                ino = struct.unpack("II", data[8 + i * 8:16 + i * 8])[0]
+                if (len(order) == 0 or order[-1] != ino):
+                    order.append(ino)
+            return order
+        return [ line.strip() for line in data.splitlines() if len(line.strip()) > 0 and not line.startswith("#") ]
+
+    def defrag(self, trace=None, warmboot=False):
+        order = []
+        if (trace != None):
+            with open(trace, 'rb') as f:
+                order = self.read_trace(f.read())
+        elif (warmboot):
+            wb = self._simdisk.open(WARMBOOT_PATH)
+            if (wb == None):
+                raise api.S5fsException("no warm boot list at {0}".format(WARMBOOT_PATH))
+            order = self.read_trace(wb.read())
+        self._simdisk.defrag(order)
+
+    def do_defrag(self, args):
+        try:
+            (options, args) = self._parse_defrag.parse_args(shlex.split(args))
+        except ValueError as e:
+            self._parse_defrag.error(str(e))
+            return
+
+        if (len(args) != 0):
+            self._parse_defrag.error("command takes no arguments")
+        else:
+            try:
+                self.defrag(trace=options.trace, warmboot=options.warmboot)
+            except api.S5fsException as e:
+                self._parse_defrag.error(str(e))
+            except IOError as e:
+                self._parse_defrag.error(str(e))
+
+    def help_defrag(self):
+        self._parse_defrag.print_help()
+
     def do_format(self, args):
         try:
             (options, args) = self._parse_format.parse_args(shlex.split(args))
@@ -648,7 +724,7 @@ class FsmakerShell(cmd.Cmd):
                 size = options.size
             else:
                 size = options.blocks * api.S5_BLOCK_SIZE
-            self._simdisk.format(options.inodes, size)
+            self._simdisk.format(options.inodes, size, version=options.version, journal=options.journal, group=options.groups)
 
         if (options.directory):
             q = Queue.Queue()
@@ -668,6 +744,14 @@ class FsmakerShell(cmd.Cmd):
                     dest = self.open(os.path.join("/", curr), create=True)
                     self.getfile(source, dest)
 
+        if (options.defrag or options.trace):
+            try:
+                self.defrag(trace=options.trace)
+            except api.S5fsException as e:
+                self._parse_format.error(str(e))
+            except IOError as e:
+                self._parse_format.error(str(e))
+
     def default(self, line):
         if (line.strip() == "EOF"):
             print("\n")
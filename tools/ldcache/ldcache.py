@@ -0,0 +1,127 @@
+"""
+Library cache for ld-weenix.
+
+ld-weenix looks for a library named without a '/' in each directory of
+LD_LIBRARY_PATH, the module's DT_RPATH and its default path in turn,
+opening each candidate. This writes <output>, a table of the names such
+a library may be asked for by (its file name, and its DT_SONAME if that
+has no '/' in it) and the absolute path of the library on the disk
+image, which ld-weenix (see user/lib/ld-weenix/ldcache.c) maps and
+looks names up in before falling back to its default path.
+
+The file is a header, the entries sorted by name (as strcmp orders
+them) and then the strings they point into, all little-endian 32 bit
+words.
+
+usage: ldcache.py <output> <library...>
+
+where each library is given by its path relative to the root of the
+disk image.
+"""
+
+import os
+import struct
+import sys
+
+LDCACHE_MAGIC = 0x43444c57      # "WLDC"
+LDCACHE_VERSION = 1
+
+PT_DYNAMIC = 2
+
+DT_NULL = 0
+DT_STRTAB = 5
+DT_SONAME = 14
+
+
+class LdcacheError(Exception):
+        pass
+
+
+def soname(path):
+        """The DT_SONAME of the shared library at path, or None"""
+        f = open(path, "rb")
+        data = f.read()
+        f.close()
+
+        if data[:4] != b"\x7fELF":
+                raise LdcacheError("%s: not an ELF file" % path)
+        (phoff,) = struct.unpack_from("<I", data, 0x1c)
+        (phentsize, phnum) = struct.unpack_from("<HH", data, 0x2a)
+
+        loads = []
+        dynamic = None
+        for i in range(phnum):
+                (ptype, offset, vaddr, paddr, filesz) = \
+                        struct.unpack_from("<5I", data, phoff + i * phentsize)
+                loads.append((vaddr, offset, filesz))
+                if PT_DYNAMIC == ptype:
+                        dynamic = (offset, filesz)
+        if dynamic is None:
+                raise LdcacheError("%s: not a shared library" % path)
+
+        def file_offset(vaddr):
+                for (start, offset, size) in loads:
+                        if start <= vaddr < start + size:
+                                return offset + vaddr - start
+                raise LdcacheError("%s: address 0x%x is not in the file" % (path, vaddr))
+
+        strtab = None
+        name = None
+        for i in range(0, dynamic[1], 8):
+                (tag, val) = struct.unpack_from("<iI", data, dynamic[0] + i)
+                if DT_NULL == tag:
+                        break
+                elif DT_STRTAB == tag:
+                        strtab = val
+                elif DT_SONAME == tag:
+                        name = val
+        if name is None:
+                return None
+        if strtab is None:
+                raise LdcacheError("%s: no string table" % path)
+        start = file_offset(strtab) + name
+        return data[start:data.index(b"\0", start)].decode()
+
+
+def main(argv):
+        if len(argv) < 2:
+                sys.stderr.write(__doc__)
+                return 1
+
+        entries = {}
+        for path in argv[2:]:
+                target = "/" + path.lstrip("/")
+                names = [os.path.basename(path)]
+                try:
+                        so = soname(path)
+                except LdcacheError as e:
+                        sys.stderr.write("  ldcache: skipping %s\n" % e)
+                        continue
+                if so is not None and "/" not in so:
+                        names.append(so)
+                for name in names:
+                        if entries.get(name, target) != target:
+                                sys.stderr.write("  ldcache: %s is both %s and %s, keeping the first\n"
+                                                 % (name, entries[name], target))
+                                continue
+                        entries[name] = target
+
+        strings = b""
+        table = []
+        for name in sorted(entries, key=lambda n: n.encode()):
+                table.append((len(strings), len(strings) + len(name) + 1))
+                strings += name.encode() + b"\0" + entries[name].encode() + b"\0"
+
+        out = struct.pack("<4I", LDCACHE_MAGIC, LDCACHE_VERSION, len(table), len(strings))
+        for e in table:
+                out += struct.pack("<2I", *e)
+        out += strings
+
+        f = open(argv[1], "wb")
+        f.write(out)
+        f.close()
+        return 0
+
+
+if __name__ == "__main__":
+        sys.exit(main(sys.argv))
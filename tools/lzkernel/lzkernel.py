@@ -0,0 +1,154 @@
+"""
+Compresses the kernel for the boot image.
+
+The kernel proper (everything after stage1 and stage2) is compressed in
+the format of kernel/util/lz.c, and stage2 (kernel/boot/stage2.S) expands
+it where the kernel runs instead of copying it there, so that the
+bootloader reads far fewer sectors. Unlike lz_compress, which works on
+at most 64k, this compresses the whole kernel as one stream; a match
+still reaches at most 64k back.
+
+Appends the compressed kernel to <image>, which must hold just stage1
+and a stage2 built with COMPRESS_KERNEL=1, and writes its length and the
+number of sectors it takes into the words at the end of stage2.
+
+usage: lzkernel.py <image> <kernel binary>
+"""
+
+import struct
+import sys
+
+LZ_MIN_MATCH = 4
+LZ_HASH_BITS = 16
+LZ_MAX_OFFSET = 0xffff
+
+STAGE1_SIZE = 512
+STAGE2_SIZE = 1024
+SECTOR_SIZE = 512
+
+# where stage2 keeps kernel_lz_size and kernel_sectors
+TRAILER_OFFSET = STAGE1_SIZE + STAGE2_SIZE - 6
+
+
+class LzError(Exception):
+        pass
+
+
+def put_length(out, n):
+        n -= 15
+        while n >= 255:
+                out.append(255)
+                n -= 255
+        out.append(n)
+
+
+def put_sequence(out, data, anchor, nlit, off, mlen):
+        m = mlen - LZ_MIN_MATCH if mlen else 0
+        out.append((min(nlit, 15) << 4) | min(m, 15))
+        if nlit >= 15:
+                put_length(out, nlit)
+        out += data[anchor:anchor + nlit]
+        if mlen:
+                out.append(off & 0xff)
+                out.append(off >> 8)
+                if m >= 15:
+                        put_length(out, m)
+
+
+def compress(data):
+        """As lz_compress: each match is the last place its first four
+        bytes were seen, if that is near enough"""
+        table = {}
+        out = bytearray()
+        end = len(data)
+        ip = anchor = 0
+        while ip + LZ_MIN_MATCH <= end:
+                seq = data[ip:ip + LZ_MIN_MATCH]
+                ref = table.get(seq)
+                table[seq] = ip
+                if ref is None or ip - ref > LZ_MAX_OFFSET:
+                        ip += 1
+                        continue
+                mlen = LZ_MIN_MATCH
+                while ip + mlen < end and data[ref + mlen] == data[ip + mlen]:
+                        mlen += 1
+                put_sequence(out, data, anchor, ip - anchor, ip - ref, mlen)
+                ip += mlen
+                anchor = ip
+        put_sequence(out, data, anchor, end - anchor, 0, 0)
+        return bytes(out)
+
+
+def get_length(src, ip, n):
+        while True:
+                b = src[ip]
+                ip += 1
+                n += b
+                if b != 255:
+                        return (ip, n)
+
+
+def decompress(src):
+        """As lz_decompress, and as stage2 does it"""
+        out = bytearray()
+        ip = 0
+        while ip < len(src):
+                token = src[ip]
+                ip += 1
+                (nlit, mlen) = (token >> 4, token & 15)
+                if nlit == 15:
+                        (ip, nlit) = get_length(src, ip, nlit)
+                out += src[ip:ip + nlit]
+                ip += nlit
+                if ip == len(src):
+                        break
+                off = src[ip] | (src[ip + 1] << 8)
+                ip += 2
+                if mlen == 15:
+                        (ip, mlen) = get_length(src, ip, mlen)
+                mlen += LZ_MIN_MATCH
+                if off == 0 or off > len(out):
+                        raise LzError("bad match at %d" % ip)
+                for i in range(mlen):
+                        out.append(out[-off])
+        return bytes(out)
+
+
+def main(argv):
+        if len(argv) != 3:
+                sys.stderr.write(__doc__)
+                return 1
+
+        f = open(argv[2], "rb")
+        kernel = f.read()
+        f.close()
+        f = open(argv[1], "rb")
+        image = bytearray(f.read())
+        f.close()
+
+        if len(image) != STAGE1_SIZE + STAGE2_SIZE:
+                sys.stderr.write("lzkernel: %s is not just stage1 and stage2\n" % argv[1])
+                return 1
+        (lzsize,) = struct.unpack_from("<I", image, TRAILER_OFFSET)
+        if lzsize != 0:
+                sys.stderr.write("lzkernel: %s already holds a compressed kernel\n" % argv[1])
+                return 1
+
+        data = compress(kernel)
+        if decompress(data) != kernel:
+                sys.stderr.write("lzkernel: the kernel does not decompress as it was\n")
+                return 1
+
+        sectors = (len(data) + SECTOR_SIZE - 1) // SECTOR_SIZE
+        struct.pack_into("<IH", image, TRAILER_OFFSET, len(data), sectors)
+        f = open(argv[1], "wb")
+        f.write(image)
+        f.write(data)
+        f.close()
+        sys.stdout.write("  Kernel compressed from %d to %d bytes (%d sectors)\n"
+                         % (len(kernel), len(data), sectors))
+        return 0
+
+
+if __name__ == "__main__":
+        sys.exit(main(sys.argv))
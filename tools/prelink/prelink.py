@@ -0,0 +1,263 @@
+"""
+Prelinker for weenix dynamic executables.
+
+The shared libraries are linked at fixed, distinct addresses (see
+PRELINK_BASE_* in user/Makefile), so once ld-weenix maps each one where
+it was linked, every relocation in a program and its libraries has a
+value which can be worked out ahead of time. For each executable this
+writes those values to <outdir>/<checksum>, where <checksum> identifies
+the executable, along with the address and checksum of each library
+they were computed against. ld-weenix (see user/lib/ld-weenix/ldprelink.c) looks
+for that file, and if every library still matches just stores the
+values instead of resolving any symbols.
+
+Symbols are resolved exactly as ld-weenix's _ldresolve does, over the
+same chain of modules in the same order.
+
+usage: prelink.py <outdir> <libdir> <executable...>
+"""
+
+import os
+import struct
+import sys
+
+PRELINK_MAGIC = 0x4b4c5057      # "WPLK"
+PRELINK_VERSION = 1
+
+PT_LOAD = 1
+PT_DYNAMIC = 2
+
+DT_NULL = 0
+DT_NEEDED = 1
+DT_PLTRELSZ = 2
+DT_HASH = 4
+DT_STRTAB = 5
+DT_SYMTAB = 6
+DT_RELA = 7
+DT_REL = 17
+DT_RELSZ = 18
+DT_JMPREL = 23
+DT_TEXTREL = 22
+
+STB_LOCAL = 0
+STB_GLOBAL = 1
+STB_WEAK = 2
+SHN_UNDEF = 0
+
+R_386_32 = 1
+R_386_PC32 = 2
+R_386_COPY = 5
+R_386_GLOB_DAT = 6
+R_386_JMP_SLOT = 7
+R_386_RELATIVE = 8
+
+
+class PrelinkError(Exception):
+        pass
+
+
+def checksum(data, h=0x811c9dc5):
+        """FNV-1a, as _ldchecksum in ld-weenix"""
+        for b in bytearray(data):
+                h = ((h ^ b) * 0x01000193) & 0xffffffff
+        return h
+
+
+class Module(object):
+        """An executable or shared library, as ld-weenix sees it"""
+
+        def __init__(self, path, name):
+                self.path = path
+                self.name = name
+                f = open(path, "rb")
+                self.data = f.read()
+                f.close()
+
+                if self.data[:4] != b"\x7fELF":
+                        raise PrelinkError("%s: not an ELF file" % path)
+                (phoff,) = struct.unpack_from("<I", self.data, 0x1c)
+                (phentsize, phnum) = struct.unpack_from("<HH", self.data, 0x2a)
+
+                self.loads = []
+                dynamic = None
+                for i in range(phnum):
+                        (ptype, off, vaddr, paddr, filesz, memsz, flags, align) = \
+                                struct.unpack_from("<8I", self.data, phoff + i * phentsize)
+                        if PT_LOAD == ptype:
+                                self.loads.append((vaddr, off, filesz, memsz))
+                        elif PT_DYNAMIC == ptype:
+                                dynamic = vaddr
+                if dynamic is None:
+                        raise PrelinkError("%s: not dynamically linked" % path)
+                # where ld-weenix maps the module if it is prelinked,
+                # which makes its load bias 0
+                self.bottom = min([l[0] for l in self.loads]) & ~0xfff
+                self.top = max([l[0] + l[3] for l in self.loads])
+
+                self.dyn = []
+                off = self.offset(dynamic)
+                while True:
+                        (tag, val) = struct.unpack_from("<iI", self.data, off)
+                        if DT_NULL == tag:
+                                break
+                        self.dyn.append((tag, val))
+                        off += 8
+                tags = dict(self.dyn)
+                if DT_TEXTREL in tags or DT_RELA in tags:
+                        raise PrelinkError("%s: text or RELA relocations" % path)
+
+                self.needed = [self.string(tags[DT_STRTAB], v) for (t, v) in self.dyn if DT_NEEDED == t]
+                self.strtab = tags[DT_STRTAB]
+                (nbucket, nchain) = struct.unpack_from("<II", self.data, self.offset(tags[DT_HASH]))
+                self.symtab = self.bytes(tags[DT_SYMTAB], nchain * 16)
+                self.rel = self.bytes(tags[DT_REL], tags.get(DT_RELSZ, 0)) if DT_REL in tags else b""
+                self.jmprel = self.bytes(tags[DT_JMPREL], tags.get(DT_PLTRELSZ, 0)) if DT_JMPREL in tags else b""
+                self.checksum = checksum(self.jmprel, checksum(self.rel, checksum(self.symtab)))
+
+                self.syms = []
+                self.byname = {}
+                for i in range(nchain):
+                        (st_name, value, size, info, other, shndx) = struct.unpack_from("<IIIBBH", self.symtab, i * 16)
+                        name = self.string(self.strtab, st_name)
+                        self.syms.append((name, value, size, info >> 4, shndx))
+                        if i and name not in self.byname:
+                                self.byname[name] = i
+
+        def offset(self, vaddr):
+                for (v, off, filesz, memsz) in self.loads:
+                        if v <= vaddr < v + filesz:
+                                return vaddr - v + off
+                raise PrelinkError("%s: address 0x%x is not in the file" % (self.path, vaddr))
+
+        def bytes(self, vaddr, n):
+                off = self.offset(vaddr)
+                return self.data[off:off + n]
+
+        def string(self, strtab, i):
+                off = self.offset(strtab) + i
+                end = self.data.index(b"\0", off)
+                return self.data[off:end].decode("ascii")
+
+        def word(self, vaddr):
+                return struct.unpack_from("<I", self.data, self.offset(vaddr))[0]
+
+        def symbol(self, name, binding):
+                """_ldsymbol: the address and size of name, if it is
+                defined here with the given binding"""
+                i = self.byname.get(name)
+                if i is None:
+                        return None
+                (n, value, size, bind, shndx) = self.syms[i]
+                if bind != binding or SHN_UNDEF == shndx:
+                        return None
+                return (value, size)
+
+
+def load_chain(exe, libdir):
+        """The modules in the order ld-weenix links them (_ldlinkobj)"""
+        chain = [exe]
+        names = set()
+        i = 0
+        while i < len(chain):
+                for name in chain[i].needed:
+                        # ld-weenix stops at the first name it has seen
+                        if name in names:
+                                break
+                        names.add(name)
+                        chain.append(Module(os.path.join(libdir, os.path.basename(name)), name))
+                i += 1
+        return chain
+
+
+def resolve(chain, module, name, exclude):
+        """_ldresolve"""
+        for m in chain:
+                if not exclude or m is not module:
+                        s = m.symbol(name, STB_GLOBAL)
+                        if s:
+                                return s
+        for m in chain:
+                s = m.symbol(name, STB_WEAK)
+                if s:
+                        return s
+        s = module.symbol(name, STB_LOCAL)
+        if s is None:
+                raise PrelinkError("%s: unresolved symbol %s" % (module.path, name))
+        return s
+
+
+def prelink(exe, libdir):
+        chain = load_chain(exe, libdir)
+        fixups = []
+        copies = []
+
+        for (i, m) in enumerate(chain):
+                if m.name and 0 == m.bottom:
+                        raise PrelinkError("%s: not linked at a fixed address" % m.path)
+                for n in chain[:i]:
+                        if m.bottom < n.top and n.bottom < m.top:
+                                raise PrelinkError("%s: overlaps %s" % (m.path, n.path))
+
+        # every module is at its link address, so relocations need no
+        # load bias, and R_386_RELATIVE ones nothing at all
+        for m in chain:
+                for table in (m.rel, m.jmprel):
+                        for i in range(0, len(table), 8):
+                                (offset, info) = struct.unpack_from("<II", table, i)
+                                sym = info >> 8
+                                rtype = info & 0xff
+                                addr = offset
+                                name = m.syms[sym][0]
+                                if R_386_RELATIVE == rtype:
+                                        continue
+                                elif R_386_COPY == rtype:
+                                        (value, size) = resolve(chain, m, name, True)
+                                        copies.append((addr, value, size))
+                                elif rtype in (R_386_GLOB_DAT, R_386_JMP_SLOT):
+                                        fixups.append((addr, resolve(chain, m, name, False)[0]))
+                                elif R_386_32 == rtype:
+                                        value = resolve(chain, m, name, False)[0]
+                                        fixups.append((addr, (m.word(addr) + value) & 0xffffffff))
+                                elif R_386_PC32 == rtype:
+                                        value = resolve(chain, m, name, False)[0]
+                                        fixups.append((addr, (m.word(addr) + value - addr) & 0xffffffff))
+                                else:
+                                        raise PrelinkError("%s: relocation type %d" % (m.path, rtype))
+
+        out = struct.pack("<5I", PRELINK_MAGIC, PRELINK_VERSION, len(chain), len(fixups), len(copies))
+        for m in chain:
+                out += struct.pack("<2I", m.bottom if m.name else 0, m.checksum)
+        for f in fixups:
+                out += struct.pack("<2I", *f)
+        for c in copies:
+                out += struct.pack("<3I", *c)
+        return out
+
+
+def main(argv):
+        if len(argv) < 3:
+                sys.stderr.write(__doc__)
+                return 1
+        outdir = argv[1]
+        libdir = argv[2]
+        if not os.path.isdir(outdir):
+                os.makedirs(outdir)
+        for f in os.listdir(outdir):
+                os.remove(os.path.join(outdir, f))
+
+        for path in argv[3:]:
+                try:
+                        exe = Module(path, None)
+                        data = prelink(exe, libdir)
+                except PrelinkError as e:
+                        # ld-weenix just relocates these at run time as usual
+                        sys.stderr.write("  prelink: skipping %s\n" % e)
+                        continue
+                f = open(os.path.join(outdir, "%08x" % exe.checksum), "wb")
+                f.write(data)
+                f.close()
+        return 0
+
+
+if __name__ == "__main__":
+        sys.exit(main(sys.argv))
@@ -0,0 +1,75 @@
+"""
+Symbolizes a kernel profile.
+
+'profile dump' in the kshell writes each histogram bucket the profiler
+hit to the debug log as "profile: <pc> <count>" lines, <pc> being the
+start of the bucket, along with "profile: user <n>" and
+"profile: other <n>" for the samples outside kernel text. This matches
+the buckets with the functions in kernel/symbols.dbg (which the kernel
+Makefile generates) and prints the samples per function, busiest first.
+
+A bucket which spans two functions is charged to the one it starts in.
+Every dump in the log is added up, so give it a log of just one (the
+counts are cleared by 'profile start').
+
+usage: symbolize.py <symbols.dbg> <log>
+"""
+
+import bisect
+import re
+import sys
+
+LINE = re.compile(r"profile: (0x[0-9a-fA-F]+|user|other) (\d+)")
+
+
+def read_symbols(path):
+        syms = {}
+        f = open(path)
+        for line in f:
+                fields = line.split()
+                if len(fields) != 2:
+                        continue
+                addr = int(fields[0], 16)
+                # several names for one address (a function and its
+                # local labels); keep the first, which readelf lists
+                # in symbol table order
+                if addr and addr not in syms:
+                        syms[addr] = fields[1]
+        f.close()
+        addrs = sorted(syms)
+        return (addrs, [syms[a] for a in addrs])
+
+
+def main(argv):
+        if len(argv) != 3:
+                sys.stderr.write(__doc__)
+                return 1
+        (addrs, names) = read_symbols(argv[1])
+
+        counts = {}
+        total = 0
+        f = open(argv[2])
+        for line in f:
+                m = LINE.search(line)
+                if m is None:
+                        continue
+                (what, n) = (m.group(1), int(m.group(2)))
+                total += n
+                if what in ("user", "other"):
+                        name = "[%s]" % what
+                else:
+                        i = bisect.bisect_right(addrs, int(what, 16)) - 1
+                        name = names[i] if i >= 0 else "[unknown]"
+                counts[name] = counts.get(name, 0) + n
+        f.close()
+
+        if 0 == total:
+                sys.stderr.write("no profile samples in %s\n" % argv[2])
+                return 1
+        for (name, n) in sorted(counts.items(), key=lambda c: -c[1]):
+                print("%8d %5.1f%% %s" % (n, 100.0 * n / total, name))
+        return 0
+
+
+if __name__ == "__main__":
+        sys.exit(main(sys.argv))
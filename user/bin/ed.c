@@ -124,6 +124,7 @@
 #define SIGQUIT 3
 #define FNSIZE  64
 #define LBSIZE  512
+#define IOBSIZE 8192    /* file reads and writes */
 #define ESIZE   128
 #define GBSIZE  256
 #define NBRA    5
@@ -159,6 +160,7 @@ int     *fendcore;
 int     *addr1;
 int     *addr2;
 char    genbuf[LBSIZE];
+char    iobuf[IOBSIZE];
 int     count[2];
 char    *nextip;
 char    *linebp;
@@ -719,9 +721,9 @@ getfile()
         fp = nextip;
         do {
                 if (--ninbuf < 0) {
-                        if ((ninbuf = read(io, genbuf, LBSIZE) - 1) < 0)
+                        if ((ninbuf = read(io, iobuf, IOBSIZE) - 1) < 0)
                                 return(EOF);
-                        fp = genbuf;
+                        fp = iobuf;
                 }
                 if (lp >= &linebuf[LBSIZE])
                         error;
@@ -744,16 +746,16 @@ putfile()
         register char *fp, *lp;
         register int nib;
 
-        nib = 512;
-        fp = genbuf;
+        nib = IOBSIZE;
+        fp = iobuf;
         a1 = addr1;
         do {
                 lp = getline(*a1++);
                 for (;;) {
                         if (--nib < 0) {
-                                write(io, genbuf, fp - genbuf);
-                                nib = 511;
-                                fp = genbuf;
+                                write(io, iobuf, fp - iobuf);
+                                nib = IOBSIZE - 1;
+                                fp = iobuf;
                         }
                         if (++count[1] == 0)
                                 ++count[0];
@@ -763,38 +765,44 @@ putfile()
                         }
                 }
         } while (a1 <= addr2);
-        write(io, genbuf, fp - genbuf);
+        write(io, iobuf, fp - iobuf);
 }
 
+/*
+ * The new lines are put after the last line as they come, and once they
+ * are all in are rotated into place after a, rather than everything after
+ * a being moved up one for each. The line table grows by doubling.
+ */
 int
 append(f, a)
 int (*f)();
 int *a;
 {
-        register int *a1, *a2, *rdot;
-        int nline, tl;
-        int *corep = (int *)endcore;
-        struct core {
-                int integer;
-        };
+        register int *olddol;
+        int nline, grow;
 
         nline = 0;
-        dot = a;
+        olddol = dol;
         while ((*f)() == 0) {
                 if (dol >= endcore) {
-                        if (sbrk(1024) == (char *) - 1)
+                        grow = (char *)endcore - (char *)fendcore;
+                        if (grow < 1024)
+                                grow = 1024;
+                        if (sbrk(grow) == (char *) - 1) {
                                 error;
-                        *corep += 1024;
+                                break;
+                        }
+                        endcore = (int *)((char *)endcore + grow);
                 }
-                tl = putline();
+                *++dol = putline();
                 nline++;
-                a1 = ++dol;
-                a2 = a1 + 1;
-                rdot = ++dot;
-                while (a1 > rdot)
-                        *--a2 = *--a1;
-                *rdot = tl;
         }
+        if (a < olddol && nline > 0) {
+                reverse(a + 1, olddol + 1);
+                reverse(olddol + 1, dol + 1);
+                reverse(a + 1, dol + 1);
+        }
+        dot = a + nline;
         return(nline);
 }
 
@@ -892,9 +900,9 @@ getblock(int atl, int iof)
 {
         register int bno, off;
 
-        bno = (atl >> 8) & 0377;
+        bno = (atl >> 8) & 0xffffff;
         off = (atl << 1) & 0774;
-        if (bno >= 255) {
+        if (atl < 0) {
                 puts(TMPERR);
                 error;
         }
@@ -924,7 +932,7 @@ blkio(int b, char *buf, void *iofcn)
 {
         int (*iof)(int f, char * b, int len) =
                 (int( *)(int f, char * b, int len)) iofcn;
-        lseek(tfile, b, SEEK_SET);
+        lseek(tfile, (off_t) b * 512, SEEK_SET);
         if ((*iof)(tfile, buf, 512) != 512) {
                 puts(TMPERR);
                 error;
@@ -961,6 +969,7 @@ global(int k)
         register int c;
         register int *a1;
         char globuf[GBSIZE];
+        int wrapped;
 
         if (globp)
                 error;
@@ -989,14 +998,31 @@ global(int k)
                 if (a1 >= addr1 && a1 <= addr2 && execute(0, a1) == k)
                         *a1 |= 01;
         }
-        for (a1 = zero; a1 <= dol; a1++) {
+        /*
+         * The marks move with the lines, so after each command the scan
+         * carries on from where it was, the next line having taken the
+         * place of one which was deleted; it goes round from the top again
+         * (once) in case the command moved marked lines above it, rather
+         * than starting over every time.
+         */
+        wrapped = 1;
+        for (a1 = zero; ;) {
+                if (a1 > dol) {
+                        if (wrapped)
+                                break;
+                        wrapped = 1;
+                        a1 = zero;
+                        continue;
+                }
                 if (*a1 & 01) {
                         *a1 &= ~01;
                         dot = a1;
                         globp = globuf;
                         commands();
-                        a1 = zero;
+                        wrapped = 0;
+                        continue;
                 }
+                a1++;
         }
 }
 
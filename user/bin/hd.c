@@ -8,6 +8,82 @@
 #include <unistd.h>
 
 #define LINE_LEN 16
+/* input is read, and output written, in chunks of this size */
+#define CHUNK_LEN 65536
+/* the longest a formatted line can be */
+#define OUT_LINE_MAX 80
+
+static char inbuf[CHUNK_LEN];
+static char outbuf[CHUNK_LEN + OUT_LINE_MAX];
+static int outlen = 0;
+
+static const char hexdigits[] = "0123456789abcdef";
+
+static void flush_out(void) {
+  int off = 0, n;
+  while (off < outlen) {
+    if ((n = write(1, outbuf + off, outlen - off)) <= 0) {
+      break;
+    }
+    off += n;
+  }
+  outlen = 0;
+}
+
+static void put_hex32(char *p, unsigned int v) {
+  int i;
+  for (i = 7; i >= 0; --i) {
+    p[i] = hexdigits[v & 0xf];
+    v >>= 4;
+  }
+}
+
+/* Formats one line of up to LINE_LEN bytes at offset off into outbuf */
+static void put_line(const unsigned char *line, int bytes, unsigned int off) {
+  char *p = outbuf + outlen;
+  int i;
+
+  put_hex32(p, off);
+  p += 8;
+  *p++ = ' ';
+  *p++ = ' ';
+  /* print bytes */
+  for (i = 0; i < LINE_LEN; ++i) {
+    if (i < bytes) {
+      *p++ = hexdigits[line[i] >> 4];
+      *p++ = hexdigits[line[i] & 0xf];
+    } else {
+      *p++ = ' ';
+      *p++ = ' ';
+    }
+    *p++ = ' ';
+    if (i == 7) {
+      *p++ = ' ';
+    }
+  }
+  /* show printable characters */
+  *p++ = '|';
+  for (i = 0; i < bytes; ++i) {
+    unsigned char c = line[i];
+    *p++ = (c < 32 || c > 126) ? '.' : (char)c;
+  }
+  *p++ = '|';
+  *p++ = '\n';
+
+  outlen = p - outbuf;
+  if (outlen >= CHUNK_LEN) {
+    flush_out();
+  }
+}
+
+static void put_str(const char *s) {
+  int len = strlen(s);
+  memcpy(outbuf + outlen, s, len);
+  outlen += len;
+  if (outlen >= CHUNK_LEN) {
+    flush_out();
+  }
+}
 
 int main(int argc, char **argv) {
   int readfd = 0;
@@ -22,50 +98,44 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  char lastbuf[LINE_LEN];
-  char curbuf[LINE_LEN];
-  int off = 0;
+  unsigned char lastbuf[LINE_LEN];
+  unsigned int off = 0;
   int lastrep = 0;
-  int bytes;
+  int have = 0; /* bytes in inbuf, a partial line carried over at the front */
+  int bytes, pos, eof = 0;
+  char tail[12];
 
-  int i;
-  while ((bytes = read(readfd, curbuf, LINE_LEN)) > 0) {
-    if (off > 0 && !memcmp(lastbuf, curbuf, LINE_LEN)) {
-      if (!lastrep) {
-        printf("*\n");
-        lastrep = 1;
-      }
-      off += bytes;
-      continue;
+  while (!eof) {
+    if ((bytes = read(readfd, inbuf + have, CHUNK_LEN - have)) <= 0) {
+      eof = 1;
+    } else {
+      have += bytes;
     }
-    lastrep = 0;
-    printf("%08x  ", off);
-    off += bytes;
-    /* print bytes */
-    for (i = 0; i < LINE_LEN; ++i) {
-      if (i < bytes) {
-        printf("%02x ", (unsigned char)curbuf[i]);
-      } else {
-        printf("   ");
-      }
-      if (i == 7) {
-        printf(" ");
-      }
-    }
-    /* show printable characters */
-    printf("|");
-    for (i = 0; i < bytes; ++i) {
-      char c = curbuf[i];
-      if (c < 32 || c > 126) {
-        printf(".");
-      } else {
-        printf("%c",c);
+    /* whole lines, and the last partial one once there is no more */
+    for (pos = 0; have - pos >= LINE_LEN || (eof && have > pos); pos += bytes) {
+      const unsigned char *line = (const unsigned char *)inbuf + pos;
+      bytes = (have - pos < LINE_LEN) ? have - pos : LINE_LEN;
+      if (off > 0 && bytes == LINE_LEN && !memcmp(lastbuf, line, LINE_LEN)) {
+        if (!lastrep) {
+          put_str("*\n");
+          lastrep = 1;
+        }
+        off += bytes;
+        continue;
       }
+      lastrep = 0;
+      put_line(line, bytes, off);
+      off += bytes;
+      memcpy(lastbuf, line, bytes);
     }
-    printf("|\n");
-    memcpy(lastbuf, curbuf, LINE_LEN);
+    memmove(inbuf, inbuf + pos, have - pos);
+    have -= pos;
   }
-  printf("%08x\n", off);
+  put_hex32(tail, off);
+  tail[8] = '\n';
+  tail[9] = '\0';
+  put_str(tail);
+  flush_out();
 
   if (readfd > 0) {
     close(readfd);
@@ -12,7 +12,6 @@ static int do_ls(const char *dir)
         int             fd;
         struct dirent   *dirent;
         int             nbytes;
-        char            tmpbuf[256];
         struct stat     sbuf;
 
         union {
@@ -42,8 +41,9 @@ static int do_ls(const char *dir)
                         int reclen;
                         int size;
 
-                        snprintf(tmpbuf, 256, "%s/%s", dir, dirent->d_name);
-                        if (0 == stat(tmpbuf, &sbuf))
+                        /* relative to the directory we have open, so
+                         * its path is not walked again for each entry */
+                        if (0 == fstatat(fd, dirent->d_name, &sbuf, 0))
                                 size = sbuf.st_size;
                         else
                                 size = 0;
@@ -7,6 +7,7 @@
 #endif
 
 #include <unistd.h>
+#include <sys/stat.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +24,12 @@
 #define ARGV_MAX        256
 #define REDIR_MAX       10
 
+/* Where commands are looked for when PATH is not in the environment: the
+ * current directory, then /usr/bin */
+#define DEFAULT_PATH    ".:/usr/bin"
+#define PATH_MAX        256
+#define HASH_SIZE       64              /* power of 2 */
+
 typedef struct redirect {
         int             r_sfd;
         int             r_dfd;
@@ -39,10 +46,35 @@ typedef struct ioenv {
 } ioenv_t;
 
 static char **my_envp;
+static int my_envp_alloced;             /* my_envp was malloc'd by export */
+
+/* The directory cd last went to, for pwd (there is no getcwd) */
+static char cwd[PATH_MAX] = ROOT;
+
+/*
+ * Where commands found by searching PATH are, as bash's hash: each
+ * command is searched for once, after which it is exec'd straight from
+ * where it was found. Commands found through a relative directory in
+ * PATH (such as ".") are not remembered, as they move with cd. An entry
+ * whose file has gone is dropped when exec finds it gone, and all are
+ * dropped when PATH changes.
+ */
+typedef struct hash_ent {
+        char                    *h_name;
+        char                    *h_path;
+        int                      h_hits;
+        struct hash_ent         *h_next;
+} hash_ent_t;
+
+static hash_ent_t *hash_table[HASH_SIZE];
 
 static void parse(char *line);
 static int execute(int argc, char *argv[], redirect_map_t *map);
 static void add_redirect(redirect_map_t *map, int sfd, int dfd);
+static void cwd_follow(const char *dir);
+static int env_set(const char *var);
+static void hash_clear(void);
+static const char *path_search(const char *name);
 
 #define DECL_CMD(x) static int cmd_ ## x (int argc, char *argv[], ioenv_t *io)
 
@@ -63,6 +95,10 @@ DECL_CMD(sync);
 DECL_CMD(check);
 DECL_CMD(repeat);
 DECL_CMD(parallel);
+DECL_CMD(export);
+DECL_CMD(hash);
+DECL_CMD(pwd);
+DECL_CMD(test);
 
 typedef struct {
         const char      *cmd_name;
@@ -72,6 +108,7 @@ typedef struct {
 
 static cmd_t builtin_cmds[] = {
         { "?",        cmd_help,     "list shell commands" },
+        { "[",        cmd_test,     "evaluate a condition" },
         { "cat",      cmd_cat,      "display file" },
         { "env",      cmd_env,      "display environment"},
         { "cd",       cmd_cd,       "change directory" },
@@ -80,14 +117,18 @@ static cmd_t builtin_cmds[] = {
         { "cp",       cmd_cp,       "copy file" },
         { "echo",     cmd_echo,     "print arguments" },
         { "exit",     cmd_exit,     "exit shell" },
+        { "export",   cmd_export,   "set environment variables" },
+        { "hash",     cmd_hash,     "remember or list where commands are" },
         { "help",     cmd_help,     "list shell commands" },
         { "ln",       cmd_ln,       "link file" },
         { "mkdir",    cmd_mkdir,    "create a directory" },
         { "mv",       cmd_mv,       "move file" },
+        { "pwd",      cmd_pwd,      "print working directory" },
         { "quit",     cmd_exit,     "exit shell" },
         { "rm",       cmd_rm,       "remove file(s)" },
         { "rmdir",    cmd_rmdir,    "remove a directory" },
         { "sync",     cmd_sync,     "sync filesystems" },
+        { "test",     cmd_test,     "evaluate a condition" },
         { "repeat",   cmd_repeat,   "repeat a command" },
         { "parallel", cmd_parallel, "run multiple commands in parallel" },
         { NULL,       NULL,         NULL }
@@ -1034,9 +1075,146 @@ DECL_CMD(cd)
                         dir, strerror(errno));
                 return 1;
         }
+        cwd_follow(dir);
+        return 0;
+}
+
+DECL_CMD(pwd)
+{
+        fprintf(stdout, "%s\n", cwd);
         return 0;
 }
 
+DECL_CMD(export)
+{
+        int                     argn;
+
+        if (argc == 1)
+                return cmd_env(argc, argv, io);
+
+        for (argn = 1; argn < argc; argn++) {
+                if (NULL == strchr(argv[argn], '=') || '=' == argv[argn][0]) {
+                        fprintf(stderr, "usage: export NAME=value ...\n");
+                        return 1;
+                }
+                if (0 > env_set(argv[argn])) {
+                        fprintf(stderr, "export: %s\n", strerror(errno));
+                        return 1;
+                }
+                if (!strncmp(argv[argn], "PATH=", 5))
+                        hash_clear();
+        }
+        return 0;
+}
+
+DECL_CMD(hash)
+{
+        hash_ent_t              *h;
+        int                     argn, i, ret = 0;
+
+        if (argc == 1) {
+                for (i = 0; i < HASH_SIZE; i++) {
+                        for (h = hash_table[i]; h; h = h->h_next)
+                                fprintf(stdout, "%4d %s\n", h->h_hits, h->h_path);
+                }
+                return 0;
+        }
+        if (argc == 2 && !strcmp(argv[1], "-r")) {
+                hash_clear();
+                return 0;
+        }
+        for (argn = 1; argn < argc; argn++) {
+                if (NULL == path_search(argv[argn])) {
+                        fprintf(stderr, "hash: %s: not found\n", argv[argn]);
+                        ret = 1;
+                }
+        }
+        return ret;
+}
+
+/* test (and [): the unary file and string tests, string comparisons, and
+ * integer comparisons, any of them negated with !. Exits 0 if the
+ * condition holds, 1 if it does not and 2 if it cannot be understood. */
+DECL_CMD(test)
+{
+        struct stat             sb;
+        int                     neg = 0, res;
+
+        if (!strcmp(argv[0], "[")) {
+                if (strcmp(argv[argc - 1], "]")) {
+                        fprintf(stderr, "[: missing ]\n");
+                        return 2;
+                }
+                argc--;
+        }
+        argv++;
+        argc--;
+        if (argc > 0 && !strcmp(argv[0], "!")) {
+                neg = 1;
+                argv++;
+                argc--;
+        }
+
+        if (argc == 0) {
+                res = 0;
+        } else if (argc == 1) {
+                res = ('\0' != argv[0][0]);
+        } else if (argc == 2 && '-' == argv[0][0] && '\0' != argv[0][1]
+                   && '\0' == argv[0][2]) {
+                switch (argv[0][1]) {
+                        case 'n':
+                                res = ('\0' != argv[1][0]);
+                                break;
+                        case 'z':
+                                res = ('\0' == argv[1][0]);
+                                break;
+                        case 'e':
+                                res = (0 == stat(argv[1], &sb));
+                                break;
+                        case 'f':
+                                res = (0 == stat(argv[1], &sb) && S_ISREG(sb.st_mode));
+                                break;
+                        case 'd':
+                                res = (0 == stat(argv[1], &sb) && S_ISDIR(sb.st_mode));
+                                break;
+                        case 's':
+                                res = (0 == stat(argv[1], &sb) && 0 < sb.st_size);
+                                break;
+                        default:
+                                fprintf(stderr, "test: unknown operator %s\n", argv[0]);
+                                return 2;
+                }
+        } else if (argc == 3) {
+                const char *op = argv[1];
+                long a = strtol(argv[0], NULL, 10), b = strtol(argv[2], NULL, 10);
+
+                if (!strcmp(op, "=")) {
+                        res = !strcmp(argv[0], argv[2]);
+                } else if (!strcmp(op, "!=")) {
+                        res = !!strcmp(argv[0], argv[2]);
+                } else if (!strcmp(op, "-eq")) {
+                        res = (a == b);
+                } else if (!strcmp(op, "-ne")) {
+                        res = (a != b);
+                } else if (!strcmp(op, "-lt")) {
+                        res = (a < b);
+                } else if (!strcmp(op, "-le")) {
+                        res = (a <= b);
+                } else if (!strcmp(op, "-gt")) {
+                        res = (a > b);
+                } else if (!strcmp(op, "-ge")) {
+                        res = (a >= b);
+                } else {
+                        fprintf(stderr, "test: unknown operator %s\n", op);
+                        return 2;
+                }
+        } else {
+                fprintf(stderr, "test: too many arguments\n");
+                return 2;
+        }
+        return (res ^ neg) ? 0 : 1;
+}
+
 DECL_CMD(repeat)
 {
         long            ntimes;
@@ -1198,6 +1376,253 @@ static void destroy_ioenv(ioenv_t *io)
 {
 }
 
+static char *sh_strdup(const char *s)
+{
+        char *d;
+
+        if (NULL != (d = malloc(strlen(s) + 1)))
+                strcpy(d, s);
+        return d;
+}
+
+/* Follows dir from cwd, as chdir just has, to keep cwd up to date */
+static void cwd_follow(const char *dir)
+{
+        char            buf[PATH_MAX];
+        const char      *comp, *end;
+        size_t          len = 0, n;
+
+        if ('/' != dir[0]) {
+                len = strlen(cwd);
+                memcpy(buf, cwd, len);
+                if (1 == len)
+                        len = 0;
+        }
+        buf[len] = '\0';
+
+        for (comp = dir; '\0' != *comp; comp = end) {
+                while ('/' == *comp)
+                        comp++;
+                if ('\0' == *comp)
+                        break;
+                for (end = comp; '\0' != *end && '/' != *end; end++)
+                        ;
+                n = end - comp;
+                if (1 == n && '.' == comp[0])
+                        continue;
+                if (2 == n && !strncmp(comp, "..", 2)) {
+                        while (len > 0 && '/' != buf[--len])
+                                ;
+                        buf[len] = '\0';
+                        continue;
+                }
+                if (len + 1 + n >= PATH_MAX)
+                        return;
+                buf[len++] = '/';
+                memcpy(buf + len, comp, n);
+                len += n;
+                buf[len] = '\0';
+        }
+        if (0 == len)
+                strcpy(buf, ROOT);
+        strcpy(cwd, buf);
+}
+
+static const char *env_get(const char *name)
+{
+        size_t          len = strlen(name);
+        int             i;
+
+        for (i = 0; my_envp && my_envp[i]; i++) {
+                if (!strncmp(my_envp[i], name, len) && '=' == my_envp[i][len])
+                        return my_envp[i] + len + 1;
+        }
+        return NULL;
+}
+
+/* Sets var, NAME=value, in the environment passed on to commands. The
+ * vector is copied to the heap when it has to grow; a string it replaces
+ * is not freed, as it may be one the shell was started with. */
+static int env_set(const char *var)
+{
+        size_t          len = strchr(var, '=') - var;
+        char            *copy, **envp;
+        int             i;
+
+        if (NULL == (copy = sh_strdup(var))) {
+                errno = ENOMEM;
+                return -1;
+        }
+        for (i = 0; my_envp && my_envp[i]; i++) {
+                if (!strncmp(my_envp[i], var, len) && '=' == my_envp[i][len]) {
+                        my_envp[i] = copy;
+                        return 0;
+                }
+        }
+        if (NULL == (envp = malloc((i + 2) * sizeof(char *)))) {
+                free(copy);
+                errno = ENOMEM;
+                return -1;
+        }
+        if (i > 0)
+                memcpy(envp, my_envp, i * sizeof(char *));
+        envp[i] = copy;
+        envp[i + 1] = NULL;
+        if (my_envp_alloced)
+                free(my_envp);
+        my_envp = envp;
+        my_envp_alloced = 1;
+        return 0;
+}
+
+static unsigned int hash_name(const char *name)
+{
+        unsigned int    h = 0;
+
+        while ('\0' != *name)
+                h = h * 31 + (unsigned char) *name++;
+        return h & (HASH_SIZE - 1);
+}
+
+static hash_ent_t *hash_find(const char *name)
+{
+        hash_ent_t      *h;
+
+        for (h = hash_table[hash_name(name)]; h; h = h->h_next) {
+                if (!strcmp(h->h_name, name))
+                        return h;
+        }
+        return NULL;
+}
+
+static void hash_free(hash_ent_t *h)
+{
+        free(h->h_name);
+        free(h->h_path);
+        free(h);
+}
+
+static void hash_drop(const char *name)
+{
+        hash_ent_t      **hp, *h;
+
+        for (hp = &hash_table[hash_name(name)]; NULL != (h = *hp); hp = &h->h_next) {
+                if (!strcmp(h->h_name, name)) {
+                        *hp = h->h_next;
+                        hash_free(h);
+                        return;
+                }
+        }
+}
+
+static void hash_clear(void)
+{
+        hash_ent_t      *h;
+        int             i;
+
+        for (i = 0; i < HASH_SIZE; i++) {
+                while (NULL != (h = hash_table[i])) {
+                        hash_table[i] = h->h_next;
+                        hash_free(h);
+                }
+        }
+}
+
+static void hash_add(const char *name, const char *path)
+{
+        hash_ent_t      *h;
+        unsigned int    i = hash_name(name);
+
+        if (NULL == (h = malloc(sizeof(*h))))
+                return;
+        h->h_name = sh_strdup(name);
+        h->h_path = sh_strdup(path);
+        if (NULL == h->h_name || NULL == h->h_path) {
+                if (NULL != h->h_name)
+                        free(h->h_name);
+                if (NULL != h->h_path)
+                        free(h->h_path);
+                free(h);
+                return;
+        }
+        h->h_hits = 0;
+        h->h_next = hash_table[i];
+        hash_table[i] = h;
+}
+
+/* Looks for the command name in each directory of PATH in turn (an empty
+ * one being the current directory), remembering where it is found if
+ * that is through an absolute directory. Returns the path to it, in a
+ * static buffer, or NULL if it is nowhere. */
+static const char *path_search(const char *name)
+{
+        static char     buf[PATH_MAX];
+        const char      *path, *dir, *end;
+        struct stat     sb;
+        size_t          n;
+
+        if (NULL == (path = env_get("PATH")))
+                path = DEFAULT_PATH;
+        hash_drop(name);
+
+        for (dir = path; ; dir = end + 1) {
+                for (end = dir; '\0' != *end && ':' != *end; end++)
+                        ;
+                n = end - dir;
+                if (n + 1 + strlen(name) < PATH_MAX) {
+                        if (0 == n) {
+                                strcpy(buf, name);
+                        } else {
+                                memcpy(buf, dir, n);
+                                buf[n] = '/';
+                                strcpy(buf + n + 1, name);
+                        }
+                        if (0 == stat(buf, &sb) && S_ISREG(sb.st_mode)) {
+                                if (0 < n && '/' == dir[0])
+                                        hash_add(name, buf);
+                                return buf;
+                        }
+                }
+                if ('\0' == *end)
+                        break;
+        }
+        return NULL;
+}
+
+/* Runs argv[0] from where it is: itself if it has a / in it, else where
+ * the hash says or PATH has it, looking again if a remembered command has
+ * gone. Spawns it and returns the pid if spawning, otherwise execs it in
+ * place. Returns -1 with errno set if it could not be run. */
+static int command_exec(char *argv[], int spawning)
+{
+        const char      *path;
+        hash_ent_t      *h;
+        int             ret, retried = 0;
+
+        if (NULL != strchr(argv[0], '/'))
+                return spawning ? spawn(argv[0], argv, my_envp) : execve(argv[0], argv, my_envp);
+
+        if (NULL != (h = hash_find(argv[0]))) {
+                path = h->h_path;
+        } else {
+                path = path_search(argv[0]);
+                retried = 1;
+        }
+        while (1) {
+                if (NULL == path) {
+                        errno = ENOENT;
+                        return -1;
+                }
+                if (NULL != (h = hash_find(argv[0])))
+                        h->h_hits++;
+                ret = spawning ? spawn(path, argv, my_envp) : execve(path, argv, my_envp);
+                if (0 <= ret || ENOENT != errno || retried)
+                        return ret;
+                path = path_search(argv[0]);
+                retried = 1;
+        }
+}
+
 static int builtin_exec(cmd_t *cmd, int argc, char *argv[], ioenv_t *io)
 {
         return (*cmd->cmd_func)(argc, argv, io);
@@ -1222,17 +1647,26 @@ static int execute(int argc, char *argv[], redirect_map_t *map)
                 return 0;
         }
 
-        if (!(pid = fork())) {
+        /* Without redirections there is nothing to do between fork and
+         * execve, so have the kernel create the child directly instead of
+         * copying the shell's address space only to throw it away */
+        if (0 == map->rm_nfds) {
+                if (0 > (pid = command_exec(argv, 1))) {
+                        if (errno == ENOENT)
+                                fprintf(stderr, "sh: command not found: %s\n", argv[0]);
+                        else
+                                fprintf(stderr, "sh: exec failed for %s: %s\n",
+                                        argv[0], strerror(errno));
+                        return 1;
+                }
+        } else if (!(pid = fork())) {
                 if (do_redirect(map) < 0)
                         exit(1);
 
-                execve(argv[0], argv, my_envp);
-                if (errno == ENOENT) {
-                        char buf[256];
-                        snprintf(buf, 255, "/usr/bin/%s", argv[0]);
-                        execve(buf, argv, my_envp);
+                command_exec(argv, 0);
+                if (errno == ENOENT)
                         fprintf(stderr, "sh: command not found: %s\n", argv[0]);
-                } else
+                else
                         fprintf(stderr, "sh: exec failed for %s: %s\n",
                                 argv[0], strerror(errno));
                 exit(1);
@@ -0,0 +1 @@
+../../kernel/include/fs/aio.h
\ No newline at end of file
@@ -1,12 +1,27 @@
 #pragma once
 
+#include "sys/types.h"
+
 struct pthread;
-struct pthread_cond;
-struct pthread_mutex;
 
 typedef struct pthread          *pthread_t;
-typedef struct pthread_mutex    *pthread_mutex_t;
-typedef struct pthread_cond     *pthread_cond_t;
+
+/*
+ * Mutexes and condition variables are a word of user memory each, which
+ * threads only wait on in the kernel (with futex(2)) when contended; an
+ * uncontended lock or unlock is a single atomic instruction.
+ */
+typedef struct pthread_mutex {
+        volatile uint32_t m_state;      /* 0 unlocked, 1 locked, 2 locked and waited on */
+} pthread_mutex_t;
+
+typedef struct pthread_cond {
+        volatile uint32_t c_seq;        /* bumped by each signal and broadcast */
+        volatile uint32_t c_waiters;    /* so a signal with none need not trap */
+} pthread_cond_t;
+
+#define PTHREAD_MUTEX_INITIALIZER       { 0 }
+#define PTHREAD_COND_INITIALIZER        { 0, 0 }
 
 /* Attributes NYI */
 typedef int pthread_attr_t;
@@ -28,6 +43,7 @@ int             pthread_detach(pthread_t thr);
 int             pthread_equal(pthread_t, pthread_t);
 void            pthread_exit(void *retval);
 int             pthread_join(pthread_t thr, void **retval);
+int             pthread_mutex_destroy(pthread_mutex_t *mtx);
 int             pthread_mutex_init(pthread_mutex_t *mtx,
                                    const pthread_mutexattr_t *);
 int             pthread_mutex_lock(pthread_mutex_t *mtx);
@@ -57,7 +73,6 @@ int             pthread_mutexattr_init(pthread_mutexattr_t *);
 int             pthread_mutexattr_destroy(pthread_mutexattr_t *);
 int             pthread_mutexattr_gettype(pthread_mutexattr_t *, int *);
 int             pthread_mutexattr_settype(pthread_mutexattr_t *, int);
-int             pthread_mutex_destroy(pthread_mutex_t *);
 int             pthread_attr_getstacksize(const pthread_attr_t *, size_t *);
 int             pthread_attr_getstackaddr(const pthread_attr_t *, void **);
 int             pthread_attr_getguardsize(const pthread_attr_t *, size_t *);
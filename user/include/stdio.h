@@ -5,8 +5,13 @@
 #include "stdarg.h"
 #include "sys/types.h"
 
-/* Output not buffered */
-#define __IONBF 1
+/* Buffering modes, see setvbuf */
+#define _IOFBF  0       /* fully buffered */
+#define _IOLBF  1       /* line buffered */
+#define _IONBF  2       /* not buffered */
+
+/* The default buffer size, unless the file's st_blksize is larger */
+#define BUFSIZ  4096
 
 #ifndef EOF
 #define EOF     (-1)
@@ -16,8 +21,23 @@
 #define NULL    0
 #endif
 
-/* For now, just store a file descriptor */
-typedef int FILE;
+/*
+ * A stream is a file descriptor with an output buffer. Until the first
+ * write (or setvbuf) its mode is unknown: then, streams on character
+ * devices (terminals) are line buffered, except stderr which is never
+ * buffered, and everything else is fully buffered.
+ */
+typedef struct __FILE {
+        int             _fd;
+        int             _mode;          /* _IO?BF, or -1 if not chosen yet */
+        int             _flags;         /* __S* below */
+        char           *_buf;
+        size_t          _size;          /* of _buf */
+        size_t          _len;           /* bytes waiting in _buf */
+} FILE;
+
+#define __SMALLOC       0x1             /* _buf was malloc'ed by us */
+#define __SERR          0x2             /* a write failed */
 typedef off_t fpos_t;
 extern FILE *stdin;
 extern FILE *stdout;
@@ -35,6 +55,14 @@ int sprintf(char *buf, const char *fmt, ...)
         __attribute__((__nonnull__(2)));
 
 int fflush(FILE *stream);
+int setvbuf(FILE *stream, char *buf, int mode, size_t size);
+void setbuf(FILE *stream, char *buf);
+
+int fputc(int c, FILE *stream);
+int fputs(const char *s, FILE *stream);
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream);
+int ferror(FILE *stream);
+void clearerr(FILE *stream);
 
 int vprintf(const char *fmt, va_list args)
         __attribute__((__format__(printf, 1, 0)))
@@ -46,6 +74,9 @@ int vsprintf(char *buf, const char *fmt, va_list args)
         __attribute__((__format__(printf, 2, 0)))
         __attribute__((__nonnull__(2)));
 
+/* POSIX */
+int fileno(FILE *stream);
+
 /* Other */
 int snprintf(char *buf, size_t size, const char *fmt, ...)
         __attribute__((__format__(printf, 3, 4)))
@@ -59,3 +90,7 @@ int sscanf(const char *buf, const char *fmt, ...)
         __attribute__((__nonnull__(2)));
 int vsscanf(const char *buf, const char *fmt, va_list args)
         __attribute__((__nonnull__(2)));
+
+/* Used by libc itself: write out line buffered streams before reading
+ * (so that prompts appear) */
+void __stdio_flushlbf(void);
@@ -4,7 +4,7 @@
 #include "errno.h"
 
 /* ANSI C89 */
-void    *memchr(const void *, int, size_t); /* NYI */
+void    *memchr(const void *s, int c, size_t count);
 int      memcmp(const void *cs, const void *ct, size_t count);
 void    *memcpy(void *dest, const void *src, size_t count);
 void    *memmove(void *dest, const void *src, size_t count);
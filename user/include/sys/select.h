@@ -0,0 +1,30 @@
+/*
+ *  select.h - select(2), which libc builds on poll(2)
+ */
+#pragma once
+
+#include "sys/types.h"
+#include "weenix/config.h"
+
+/* A process cannot have more descriptors open than this */
+#define FD_SETSIZE      NFILES
+
+#define _FD_WORD(fd)    ((fd) / 32)
+#define _FD_BIT(fd)     (1U << ((fd) % 32))
+
+typedef struct fd_set {
+        uint32_t fds_bits[(FD_SETSIZE + 31) / 32];
+} fd_set;
+
+#define FD_ZERO(set)    memset((set), 0, sizeof(fd_set))
+#define FD_SET(fd, set) ((set)->fds_bits[_FD_WORD(fd)] |= _FD_BIT(fd))
+#define FD_CLR(fd, set) ((set)->fds_bits[_FD_WORD(fd)] &= ~_FD_BIT(fd))
+#define FD_ISSET(fd, set) (0 != ((set)->fds_bits[_FD_WORD(fd)] & _FD_BIT(fd)))
+
+struct timeval {
+        int32_t tv_sec;
+        int32_t tv_usec;
+};
+
+int     select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+               struct timeval *timeout);
@@ -14,6 +14,11 @@
 #endif
 
 struct dirent;
+struct iovec;
+struct rusage;
+struct timespec;
+struct pollfd;
+struct sysbatch_ent;
 
 /* User exec-related */
 int     fork(void);
@@ -21,6 +26,7 @@ int     execl(const char *filename, const char *arg, ...); /* NYI */
 int     execle(const char *filename, const char *arg, ...); /* NYI */
 int     execv(const char *filename, char *const argv[]); /* NYI */
 int     execve(const char *filename, char *const argv[], char *const envp[]);
+int     spawn(const char *filename, char *const argv[], char *const envp[]);
 
 /* Kern-related */
 void    _exit(int status);
@@ -31,32 +37,64 @@ int     thr_errno(void);
 void    thr_set_errno(int n);
 void    yield(void);
 pid_t   getpid(void);
+int     nice(int inc);
+int     sched_setaffinity(pid_t pid, uint32_t mask);
+int     sched_getaffinity(pid_t pid, uint32_t *mask);
+int     nanosleep(const struct timespec *req, struct timespec *rem);
+int     usleep(unsigned int usecs);
+int     sysbatch(struct sysbatch_ent *ents, int count, int flags);
+int     futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout);
 int     halt(void);
 void    sync(void);
+int     fsync(int fd);
+int     fdatasync(int fd);
 
 size_t  get_free_mem(void);
 
 /* VFS-related */
 int     open(const char *filename, int flags, int mode);
+int     openat(int dirfd, const char *filename, int flags, int mode);
 int     close(int fd);
 int     read(int fd, void *buf, size_t nbytes);
 int     write(int fd, const void *buf, size_t nbytes);
+int     pread(int fd, void *buf, size_t nbytes, off_t off);
+int     pwrite(int fd, const void *buf, size_t nbytes, off_t off);
+int     readv(int fd, const struct iovec *iov, int iovcnt);
+int     writev(int fd, const struct iovec *iov, int iovcnt);
+int     poll(struct pollfd *fds, unsigned int nfds, int timeout);
+int     preadv(int fd, const struct iovec *iov, int iovcnt, off_t off);
+int     pwritev(int fd, const struct iovec *iov, int iovcnt, off_t off);
 off_t   lseek(int fd, off_t offset, int whence);
 int     dup(int fd);
 int     dup2(int ofd, int nfd);
 int     mkdir(const char *path, int mode);
 int     rmdir(const char *path);
 int     unlink(const char *path);
+int     unlinkat(int dirfd, const char *path, int flags);
 int     link(const char *to, const char *from);
 int     rename(const char *oldname, const char *newname);
 int     chdir(const char *path);
 int     getdents(int fd, struct dirent *dir, size_t size);
 int     stat(const char *path, struct stat *buf);
+int     fstat(int fd, struct stat *buf);
+int     fstatat(int dirfd, const char *path, struct stat *buf, int flags);
+int     fcntl(int fd, int cmd, ...);
 int     pipe(int pipefd[2]);
+int     splice(int fdin, int fdout, size_t len);
+int     sendfile(int out_fd, int in_fd, off_t *off, size_t count);
+int     copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                        size_t len, unsigned int flags);
 
 /* VM-related */
 void    *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off);
 int     munmap(void *addr, size_t len);
+int     shm_open(const char *name, int oflag, int mode);
+int     shm_unlink(const char *name);
+int     mlock(const void *addr, size_t len);
+int     munlock(const void *addr, size_t len);
+int     madvise(void *addr, size_t len, int advice);
+int     posix_fadvise(int fd, off_t off, off_t len, int advice);
+int     getrusage(int who, struct rusage *usage);
 int     brk(void *addr);
 void    *sbrk(int incr);
 
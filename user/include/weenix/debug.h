@@ -1,6 +1,7 @@
 #include "stdio.h"
 
 int debug(const char *str);
+int dbgmodes(const char *modes, char *buf, size_t len);
 
 #define dbg(fmt, args...) \
         do { \
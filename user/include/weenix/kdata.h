@@ -0,0 +1 @@
+../../../kernel/include/api/kdata.h
\ No newline at end of file
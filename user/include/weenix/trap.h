@@ -7,9 +7,34 @@
 
 #define TRAP_INTR_STRING QUOTE(INTR_SYSCALL)
 
+/* Whether syscalls go through sysenter rather than int; -1 until the
+ * first one, when _trap_init looks at the processor */
+extern int _trap_sysenter;
+void _trap_init(void);
+
 static inline int trap(uint32_t num, uint32_t arg)
 {
         int ret;
+
+        if (0 > _trap_sysenter)
+                _trap_init();
+        if (_trap_sysenter) {
+                /* The kernel returns to edx with the stack in ecx, and
+                 * hands errno back in esi */
+                __asm__ volatile(
+                        "call 0f\n"
+                        "0:\n\t"
+                        "popl %%edx\n\t"
+                        "addl $1f-0b, %%edx\n\t"
+                        "movl %%esp, %%ecx\n\t"
+                        "sysenter\n"
+                        "1:\n"
+                        : "=a"(ret), "=S"(errno)
+                        : "a"(num), "S"(arg)
+                        : "ecx", "edx", "cc", "memory"
+                );
+                return ret;
+        }
         __asm__ volatile(
                 "int $" TRAP_INTR_STRING
                 : "=a"(ret)
@@ -13,23 +13,30 @@
 #include <sys/mman.h>
 
 
+/* A block given back by _ldfree, kept for the next allocation which
+ * fits in it */
+typedef struct ldfree ldfree_t;
+struct ldfree {
+        unsigned long   size;
+        ldfree_t        *next;
+};
+
 static unsigned long start;
 static unsigned long pos;
 static unsigned long amount;
+static unsigned long pagesz;
+static ldfree_t *freelist;
 
 
-/* This function initializes the simple memory allocator.  We basically
- * allocate a specified number of pages to use as scratch memory for
- * the linker itself.  No deallocation functionality is provided; the
- * amount of memory used should be small, and is usually needed for the
- * duration of the program's execution, anyway.
- *
- * All this function does is mmap the specified number of pages of
- * /dev/zero to provide the memory for our little memory-wading-pool. */
+/* Maps another pool of at least the given size, putting what is left of
+ * the old one on the free list */
 
-void _ldainit(unsigned long pagesize, unsigned long pages)
+static void _ldamap(unsigned long size)
 {
-        amount = pagesize * pages;
+        if (amount - pos >= sizeof(ldfree_t))
+                _ldfree((void *)(start + pos), amount - pos);
+
+        amount = (size + pagesz - 1) & ~(pagesz - 1);
         pos = 0;
 
         start = (unsigned long)mmap(NULL, amount, PROT_READ | PROT_WRITE,
@@ -41,25 +48,68 @@ void _ldainit(unsigned long pagesize, unsigned long pages)
 }
 
 
-/* This function allocates a block of memory of the specified size from
- * our memory pool.  The memory is word-aligned, and cannot be freed. */
+/* This function initializes the simple memory allocator.  We basically
+ * allocate a specified number of pages to use as scratch memory for
+ * the linker itself, and map more pages should those run out.  Memory
+ * which is freed is handed out again before any more of the pool is
+ * used; the amount of memory used should be small, and is usually needed
+ * for the duration of the program's execution, anyway.
+ *
+ * All this function does is mmap the specified number of pages of
+ * /dev/zero to provide the memory for our little memory-wading-pool. */
+
+void _ldainit(unsigned long pagesize, unsigned long pages)
+{
+        pagesz = pagesize;
+        freelist = NULL;
+        amount = pos = 0;
+        _ldamap(pagesize * pages);
+}
+
+
+/* This function allocates a block of memory of the specified size, from
+ * the first freed block it fits in, or else from our memory pool.  The
+ * memory is word-aligned. */
 
 void *_ldalloc(unsigned long size)
 {
+        ldfree_t        **fp, *f;
         unsigned long   next;
 
-        if (size & 3) {
-                size = (size&~3) + 4;
-        }
+        size = (size + sizeof(ldfree_t) - 1) & ~(sizeof(ldfree_t) - 1);
 
-        if (pos + size > amount) {
-                fprintf(stderr, "ld.so.1: panic - unable to allocate %lu bytes (_ldalloc)\n", size);
-                exit(1);
+        for (fp = &freelist; (f = *fp); fp = &f->next) {
+                if (f->size < size)
+                        continue;
+                /* hand out the end of a block which is bigger */
+                if (f->size - size >= sizeof(ldfree_t)) {
+                        f->size -= size;
+                        return (char *)f + f->size;
+                }
+                *fp = f->next;
+                return f;
         }
 
+        if (pos + size > amount)
+                _ldamap(size);
+
         next = start + pos;
         pos += size;
 
         return (void *)next;
 }
 
+
+/* Gives the block of the given size back, to be handed out again by
+ * _ldalloc */
+
+void _ldfree(void *addr, unsigned long size)
+{
+        ldfree_t        *f = addr;
+
+        size = (size + sizeof(ldfree_t) - 1) & ~(sizeof(ldfree_t) - 1);
+        f->size = size;
+        f->next = freelist;
+        freelist = f;
+}
+
@@ -0,0 +1,147 @@
+/*
+ *  File: ldcache.c
+ *  Desc: The library cache
+ *
+ *  A library named without a '/' is looked for in each directory of a
+ *  search path, and every directory it is not in costs a failed open.
+ *  tools/ldcache/ldcache.py writes LDCACHE_PATH when the disk image is
+ *  built: a table, sorted by name, of the names the libraries on the
+ *  image may be asked for by and each one's absolute path. ld-weenix
+ *  maps it while it loads the libraries, and opens what it gives
+ *  straight away rather than going through the default path.
+ */
+
+#include "sys/types.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdio.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "sys/mman.h"
+
+#include "ldutil.h"
+#include "ldtypes.h"
+#include "ldcache.h"
+
+#define LDCACHE_PATH    "/lib/ld.so.cache"
+#define LDCACHE_MAGIC   0x43444c57      /* "WLDC" */
+#define LDCACHE_VERSION 1
+
+/* The file is these, one after the other, all of them little-endian
+ * 32 bit words, and then lh_strsize bytes of strings */
+typedef struct ldcache_header {
+        Elf32_Word      lh_magic;
+        Elf32_Word      lh_version;
+        Elf32_Word      lh_nentries;
+        Elf32_Word      lh_strsize;
+} ldcache_header_t;
+
+/* Offsets into the strings, sorted by name */
+typedef struct ldcache_entry {
+        Elf32_Word      le_name;
+        Elf32_Word      le_path;
+} ldcache_entry_t;
+
+static ldcache_header_t *_ldcache;
+static Elf32_Word _ldcache_size;
+
+
+static ldcache_entry_t *_ldcache_entries(void)
+{
+        return (ldcache_entry_t *)(_ldcache + 1);
+}
+
+static const char *_ldcache_strings(void)
+{
+        return (const char *)(_ldcache_entries() + _ldcache->lh_nentries);
+}
+
+
+/* Maps the cache, if there is one and it is well formed */
+
+void _ldcache_open(void)
+{
+        ldcache_entry_t *le;
+        off_t size;
+        void *data;
+        Elf32_Word i;
+        int fd;
+
+        if (_ldenv.ld_no_cache)
+                return;
+        if ((fd = open(LDCACHE_PATH, O_RDONLY, 0)) < 0)
+                return;
+        size = lseek(fd, 0, SEEK_END);
+        if (size < (off_t) sizeof(ldcache_header_t)) {
+                close(fd);
+                return;
+        }
+        data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (MAP_FAILED == data)
+                return;
+
+        _ldcache = data;
+        _ldcache_size = size;
+        if (LDCACHE_MAGIC != _ldcache->lh_magic
+            || LDCACHE_VERSION != _ldcache->lh_version
+            || 0 == _ldcache->lh_strsize
+            || sizeof(ldcache_header_t)
+            + _ldcache->lh_nentries * sizeof(ldcache_entry_t)
+            + _ldcache->lh_strsize != (Elf32_Word) size
+            || '\0' != _ldcache_strings()[_ldcache->lh_strsize - 1])
+                goto bad;
+        le = _ldcache_entries();
+        for (i = 0; i < _ldcache->lh_nentries; i++) {
+                if (le[i].le_name >= _ldcache->lh_strsize
+                    || le[i].le_path >= _ldcache->lh_strsize)
+                        goto bad;
+        }
+        return;
+
+bad:
+        munmap(data, size);
+        _ldcache = NULL;
+}
+
+
+/* The absolute path of the library the cache has for name, or NULL.
+ * The path is good until _ldcache_close */
+
+const char *_ldcache_lookup(const char *name)
+{
+        ldcache_entry_t *le;
+        const char *strings;
+        Elf32_Word lo, hi, mid;
+        int cmp;
+
+        if (!_ldcache || strchr(name, '/'))
+                return NULL;
+
+        le = _ldcache_entries();
+        strings = _ldcache_strings();
+        lo = 0;
+        hi = _ldcache->lh_nentries;
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                cmp = strcmp(name, strings + le[mid].le_name);
+                if (0 == cmp)
+                        return strings + le[mid].le_path;
+                if (cmp < 0)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+        return NULL;
+}
+
+
+/* Unmaps the cache once every library is loaded */
+
+void _ldcache_close(void)
+{
+        if (!_ldcache)
+                return;
+        munmap(_ldcache, _ldcache_size);
+        _ldcache = NULL;
+}
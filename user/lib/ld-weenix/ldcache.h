@@ -0,0 +1,22 @@
+/*
+ *  File: ldcache.h
+ *  Desc: The library cache, written at build time by
+ *        tools/ldcache/ldcache.py
+ */
+
+#ifndef _ldcache_h_
+#define _ldcache_h_
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+        void _ldcache_open(void);
+        const char *_ldcache_lookup(const char *name);
+        void _ldcache_close(void);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _ldcache_h_ */
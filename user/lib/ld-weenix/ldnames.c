@@ -41,6 +41,20 @@ void _ldaddname(const char *name)
 }
 
 
+/* This function empties the name list, once every library is loaded
+ * and there are no more names to check, freeing its entries. */
+
+void _ldclrnames(void)
+{
+        modent_t        *curent;
+
+        while ((curent = names)) {
+                names = curent->next;
+                _ldfree(curent, sizeof(*curent));
+        }
+}
+
+
 /* This function checks to see if the specified name has already been
  * added to the name list (via _ldaddname).  If so, 1 is returned.
  * Otherwise, 0 is returned. */
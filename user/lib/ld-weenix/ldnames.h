@@ -15,6 +15,7 @@ extern "C" {
 
         void _ldaddname(const char *name);
         int _ldchkname(const char *name);
+        void _ldclrnames(void);
 
 
 #ifdef  __cplusplus
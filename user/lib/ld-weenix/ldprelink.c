@@ -0,0 +1,204 @@
+/*
+ *  File: ldprelink.c
+ *  Desc: Applies prelinked relocations
+ *
+ *  The shared libraries are linked at fixed addresses which do not
+ *  overlap, so if each is mapped where it was linked, every relocation
+ *  of a program and its libraries always gets the same value. For each
+ *  dynamic executable, tools/prelink/prelink.py writes those values to
+ *  PRELINK_DIR/<checksum of the executable>, along with the address and
+ *  checksum of each module they were computed for. If every module is
+ *  still the same and was mapped at its address, storing the values is
+ *  all the relocation the program needs: no symbol is looked up, and
+ *  the PLT is bound before the program starts. Otherwise the program is
+ *  relocated as usual.
+ */
+
+#include "sys/types.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdio.h"
+#include "unistd.h"
+#include "fcntl.h"
+#include "sys/mman.h"
+
+#include "ldutil.h"
+#include "ldtypes.h"
+#include "ldprelink.h"
+
+#define PRELINK_DIR     "/lib/prelink/"
+#define PRELINK_MAGIC   0x4b4c5057      /* "WPLK" */
+#define PRELINK_VERSION 1
+
+/* The file is these, one after the other, all of them little-endian
+ * 32 bit words */
+typedef struct prelink_header {
+        Elf32_Word      ph_magic;
+        Elf32_Word      ph_version;
+        Elf32_Word      ph_nmodules;
+        Elf32_Word      ph_nfixups;
+        Elf32_Word      ph_ncopies;
+} prelink_header_t;
+
+/* In the order the modules are linked, executable first */
+typedef struct prelink_module {
+        Elf32_Addr      pm_addr;        /* where it was linked (0 for the executable) */
+        Elf32_Word      pm_checksum;
+} prelink_module_t;
+
+/* Store pf_value at pf_addr */
+typedef struct prelink_fixup {
+        Elf32_Addr      pf_addr;
+        Elf32_Word      pf_value;
+} prelink_fixup_t;
+
+/* R_386_COPY relocations, which are done after the fixups */
+typedef struct prelink_copy {
+        Elf32_Addr      pc_dest;
+        Elf32_Addr      pc_src;
+        Elf32_Word      pc_size;
+} prelink_copy_t;
+
+static const char *warn_stale =
+        "ld.so.1: prelink data for \"%s\" is out of date\n";
+
+static prelink_header_t *_ldprelink;
+static Elf32_Word _ldprelink_size;
+
+
+/* The checksum the prelinker records for a module: of its dynamic
+ * symbols and its relocations, which between them determine every
+ * value the prelinker worked out */
+
+static Elf32_Word _ldprelink_checksum(module_t *module)
+{
+        Elf32_Word h = LD_CHECKSUM_INIT;
+
+        if (module->hash)
+                h = _ldchecksum(h, module->dynsym, module->hash[1] * sizeof(Elf32_Sym));
+        h = _ldchecksum(h, module->reloc, module->nreloc * sizeof(Elf32_Rel));
+        h = _ldchecksum(h, module->pltreloc, module->npltreloc * sizeof(Elf32_Rel));
+        return h;
+}
+
+static prelink_module_t *_ldprelink_modules(void)
+{
+        return (prelink_module_t *)(_ldprelink + 1);
+}
+
+
+/* Maps the prelink data for the executable, if there is any. Nothing
+ * is mapped at its address yet */
+
+void _ldprelink_open(module_t *exe)
+{
+        static const char hex[] = "0123456789abcdef";
+        char path[sizeof(PRELINK_DIR) + 8];
+        Elf32_Word h;
+        off_t size;
+        void *data;
+        int fd, i;
+
+        if (_ldenv.ld_no_prelink)
+                return;
+
+        h = _ldprelink_checksum(exe);
+        strcpy(path, PRELINK_DIR);
+        for (i = 0; i < 8; i++)
+                path[sizeof(PRELINK_DIR) - 1 + i] = hex[(h >> (28 - 4 * i)) & 0xf];
+        path[sizeof(PRELINK_DIR) - 1 + 8] = '\0';
+
+        if ((fd = open(path, O_RDONLY, 0)) < 0)
+                return;
+        size = lseek(fd, 0, SEEK_END);
+        if (size < (off_t) sizeof(prelink_header_t)) {
+                close(fd);
+                return;
+        }
+        data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (MAP_FAILED == data)
+                return;
+
+        _ldprelink = data;
+        _ldprelink_size = size;
+        if (PRELINK_MAGIC != _ldprelink->ph_magic
+            || PRELINK_VERSION != _ldprelink->ph_version
+            || 0 == _ldprelink->ph_nmodules
+            || sizeof(prelink_header_t)
+            + _ldprelink->ph_nmodules * sizeof(prelink_module_t)
+            + _ldprelink->ph_nfixups * sizeof(prelink_fixup_t)
+            + _ldprelink->ph_ncopies * sizeof(prelink_copy_t) != (Elf32_Word) size
+            || _ldprelink_modules()[0].pm_checksum != h) {
+                munmap(data, size);
+                _ldprelink = NULL;
+        }
+}
+
+
+/* The address the module should be mapped at, or 0 if anywhere will
+ * do. Library addresses are reserved by convention (see user/Makefile),
+ * so the range is free when ld-weenix starts */
+
+unsigned long _ldprelink_base(module_t *module)
+{
+        module_t *m;
+        Elf32_Word i = 0;
+
+        if (!_ldprelink)
+                return 0;
+        for (m = module->first; m != module; m = m->next)
+                i++;
+        if (i >= _ldprelink->ph_nmodules)
+                return 0;
+        return _ldprelink_modules()[i].pm_addr;
+}
+
+
+/* Applies the prelinked relocations if they still hold for every
+ * module, returning 1 if the program is then fully relocated and 0 if
+ * it must be relocated as usual */
+
+int _ldprelink_apply(module_t *first)
+{
+        prelink_module_t *pm;
+        prelink_fixup_t *pf;
+        prelink_copy_t *pc;
+        module_t *m;
+        Elf32_Word i;
+        int ok = 1;
+
+        if (!_ldprelink)
+                return 0;
+
+        pm = _ldprelink_modules();
+        for (m = first, i = 0; m; m = m->next, i++) {
+                /* a module which was not mapped at its address has a
+                 * nonzero load bias */
+                if (i >= _ldprelink->ph_nmodules || 0 != m->base
+                    || pm[i].pm_checksum != _ldprelink_checksum(m)) {
+                        ok = 0;
+                        break;
+                }
+        }
+        if (ok && i != _ldprelink->ph_nmodules)
+                ok = 0;
+        if (!ok) {
+                if (_ldenv.ld_debug)
+                        fprintf(stderr, warn_stale, (m && m->name) ? m->name : "the executable");
+                munmap(_ldprelink, _ldprelink_size);
+                _ldprelink = NULL;
+                return 0;
+        }
+
+        pf = (prelink_fixup_t *)(pm + _ldprelink->ph_nmodules);
+        for (i = 0; i < _ldprelink->ph_nfixups; i++)
+                *(Elf32_Word *) pf[i].pf_addr = pf[i].pf_value;
+        pc = (prelink_copy_t *)(pf + _ldprelink->ph_nfixups);
+        for (i = 0; i < _ldprelink->ph_ncopies; i++)
+                memcpy((void *) pc[i].pc_dest, (void *) pc[i].pc_src, pc[i].pc_size);
+
+        munmap(_ldprelink, _ldprelink_size);
+        _ldprelink = NULL;
+        return 1;
+}
@@ -0,0 +1,24 @@
+/*
+ *  File: ldprelink.h
+ *  Desc: Prelinked relocations, computed at build time by
+ *        tools/prelink/prelink.py
+ */
+
+#ifndef _ldprelink_h_
+#define _ldprelink_h_
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include "ldtypes.h"
+
+        void _ldprelink_open(module_t *exe);
+        unsigned long _ldprelink_base(module_t *module);
+        int _ldprelink_apply(module_t *first);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _ldprelink_h_ */
@@ -10,20 +10,60 @@
 #include "ldresolve.h"
 #include "ldutil.h"
 
+static const char *err_unresolved =
+        "ld.so.1: panic - unresolved PLT symbol\n";
+
 #define H_nbucket       0
 #define H_nchain        1
 #define H_bucket        2
 
-/* This function looks up the specified symbol in the specified
- * module.  If the symbol is present, it returns the symbol's index in
- * the dynamic symbol table, otherwise STN_UNDEF is returned. */
+/* The header of a GNU hash table, which is followed by the bloom
+ * filter (G_bloomsize words), the buckets and the hash chains */
+#define G_nbucket       0
+#define G_symoffset     1
+#define G_bloomsize     2
+#define G_bloomshift    3
+#define G_bloom         4
+
+/* Returns the index of the symbol in the module's GNU hash table with
+ * the given name and hash, or STN_UNDEF. The bloom filter answers most
+ * lookups in modules which don't define the symbol without touching the
+ * table itself. Symbols are sorted by bucket, and within a bucket each
+ * chain entry holds its symbol's hash with the low bit marking the end
+ * of the chain. */
+
+static int _ldgnulookup(module_t *module, const char *name, unsigned long h)
+{
+        const Elf32_Word *gh = module->gnuhash;
+        const Elf32_Word *buckets = gh + G_bloom + gh[G_bloomsize];
+        const Elf32_Word *chain = buckets + gh[G_nbucket];
+        Elf32_Word      word, mask;
+        unsigned long   y;
 
-int _ldlookup(module_t *module, const char *name)
+        word = gh[G_bloom + (h / 32) % gh[G_bloomsize]];
+        mask = (1U << (h % 32)) | (1U << ((h >> gh[G_bloomshift]) % 32));
+        if ((word & mask) != mask)
+                return STN_UNDEF;
+
+        y = buckets[h % gh[G_nbucket]];
+        if (y < gh[G_symoffset])
+                return STN_UNDEF;
+
+        for (;; y++) {
+                Elf32_Word h2 = chain[y - gh[G_symoffset]];
+
+                if ((h | 1) == (h2 | 1) &&
+                    !strcmp(module->dynstr + module->dynsym[y].st_name, name))
+                        return y;
+                if (h2 & 1)
+                        return STN_UNDEF;
+        }
+}
+
+static int _ldelflookup(module_t *module, const char *name, unsigned long hashval)
 {
-        unsigned long   hashval;
         unsigned long   y;
 
-        hashval = _ldelfhash(name);
         hashval %= module->hash[H_nbucket];
 
         y = module->hash[H_bucket + hashval];
@@ -36,6 +76,46 @@ int _ldlookup(module_t *module, const char *name)
         return y;
 }
 
+/* A name with its hashes, which are computed once per resolution
+ * rather than once per module searched. */
+
+typedef struct ldname_t {
+        const char      *name;
+        unsigned long   gnuhash;
+        unsigned long   elfhash;
+        int             have_elfhash;
+} ldname_t;
+
+static void _ldname_init(ldname_t *n, const char *name)
+{
+        n->name = name;
+        n->gnuhash = _ldgnuhash(name);
+        n->have_elfhash = 0;
+}
+
+static int _ldnamelookup(module_t *module, ldname_t *n)
+{
+        if (module->gnuhash)
+                return _ldgnulookup(module, n->name, n->gnuhash);
+        if (!n->have_elfhash) {
+                n->elfhash = _ldelfhash(n->name);
+                n->have_elfhash = 1;
+        }
+        return _ldelflookup(module, n->name, n->elfhash);
+}
+
+/* This function looks up the specified symbol in the specified
+ * module.  If the symbol is present, it returns the symbol's index in
+ * the dynamic symbol table, otherwise STN_UNDEF is returned. */
+
+int _ldlookup(module_t *module, const char *name)
+{
+        ldname_t        n;
+
+        _ldname_init(&n, name);
+        return _ldnamelookup(module, &n);
+}
+
 
 /* This looks up the specified symbol in the given module, subject to
  * the provided binding and type restrictions (a value of -1 will
@@ -44,13 +124,13 @@ int _ldlookup(module_t *module, const char *name)
  * location pointed to by 'size', if it is non-null.  0 is returned if
  * a symbol matching all the requirements is not found. */
 
-ldsym_t _ldsymbol(module_t *module, const char *name, int binding, int type,
-                  Elf32_Word *size)
+static ldsym_t _ldnamesymbol(module_t *module, ldname_t *n, int binding,
+                            int type, Elf32_Word *size)
 {
         int     result;
 
         /* LINTED */
-        if (((result = _ldlookup(module, name)) != STN_UNDEF) &&
+        if (((result = _ldnamelookup(module, n)) != STN_UNDEF) &&
             ((binding < 0) ||
              (ELF32_ST_BIND(module->dynsym[result].st_info) == binding)) &&
             ((type < 0) ||
@@ -65,6 +145,32 @@ ldsym_t _ldsymbol(module_t *module, const char *name, int binding, int type,
         return 0;
 }
 
+ldsym_t _ldsymbol(module_t *module, const char *name, int binding, int type,
+                  Elf32_Word *size)
+{
+        ldname_t        n;
+
+        _ldname_init(&n, name);
+        return _ldnamesymbol(module, &n, binding, type, size);
+}
+
+
+/* The most recent global and weak resolutions, by hash. The same names
+ * are resolved over and over: by every module which refers to them, and
+ * for both their GOT and their PLT entries. These results don't depend
+ * on which module asked, since every module shares one link chain. */
+
+#define LDCACHE_SIZE    64
+
+typedef struct ldcache_t {
+        const char      *name;          /* NULL if the entry is free    */
+        unsigned long   hash;
+        int             type;
+        ldsym_t         sym;
+        Elf32_Word      size;
+} ldcache_t;
+
+static ldcache_t _ldcache[LDCACHE_SIZE];
 
 /* Given a module and a symbol name, this function attempts to find the
  * symbol through the process' link chain.  It first checks for its
@@ -79,25 +185,52 @@ ldsym_t _ldresolve(module_t *module, const char *name, int type,
 {
         module_t        *curmod;
         ldsym_t         sym;
+        ldname_t        n;
+        ldcache_t       *c;
+        Elf32_Word      symsize;
+
+        _ldname_init(&n, name);
+
+        /* copy relocations skip the module itself, and so must not use
+         * (or fill) the cache */
+        c = &_ldcache[n.gnuhash % LDCACHE_SIZE];
+        if (!exclude && c->name && c->hash == n.gnuhash && c->type == type &&
+            !strcmp(c->name, name)) {
+                if (size)
+                        *size = c->size;
+                return c->sym;
+        }
 
         curmod = module->first;
 
         while (curmod) {
                 if (!exclude || curmod != module) {
-                        if ((sym = _ldsymbol(curmod, name, STB_GLOBAL, type, size)))
-                                return sym;
+                        if ((sym = _ldnamesymbol(curmod, &n, STB_GLOBAL, type, &symsize)))
+                                goto found;
                 }
                 curmod = curmod->next;
         }
 
         curmod = module->first;
         while (curmod) {
-                if ((sym = _ldsymbol(curmod, name, STB_WEAK, type, size)))
-                        return sym;
+                if ((sym = _ldnamesymbol(curmod, &n, STB_WEAK, type, &symsize)))
+                        goto found;
                 curmod = curmod->next;
         }
 
-        return _ldsymbol(module, name, STB_LOCAL, type, size);
+        return _ldnamesymbol(module, &n, STB_LOCAL, type, size);
+
+found:
+        if (!exclude) {
+                c->name = name;
+                c->hash = n.gnuhash;
+                c->type = type;
+                c->sym = sym;
+                c->size = symsize;
+        }
+        if (size)
+                *size = symsize;
+        return sym;
 }
 
 Elf32_Addr _rtresolve(module_t *mod, Elf32_Word reloff)
@@ -106,6 +239,8 @@ Elf32_Addr _rtresolve(module_t *mod, Elf32_Word reloff)
         int             sym = ELF32_R_SYM(rel->r_info);
         const char     *name = mod->dynstr + mod->dynsym[sym].st_name;
         ldsym_t         symbol = _ldresolve(mod, name, -1, 0, 0);
+
+        _ldverify(!symbol, err_unresolved);
         *(Elf32_Addr *)(mod->base + rel->r_offset) = (Elf32_Addr)symbol;
         return (Elf32_Addr)symbol;
 }
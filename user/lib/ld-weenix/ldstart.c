@@ -25,6 +25,8 @@
 #include "ldresolve.h"
 #include "ldnames.h"
 #include "ldalloc.h"
+#include "ldcache.h"
+#include "ldprelink.h"
 
 #ifndef DEFAULT_RUNPATH
 #define DEFAULT_RUNPATH "/lib:/usr/lib"
@@ -43,6 +45,8 @@ static const char *err_mapping =
         "ld.so.1: panic - failure to map section of length 0x%x at 0x%x\n";
 static const char *err_zeromap =
         "ld.so.1: panic - failure to map /dev/zero\n";
+static const char *warn_textrel =
+        "ld.so.1: warning - \"%s\" has text relocations, its text will not be shared\n";
 
 static module_t *_ldfirst;
 static module_t **_ldlast;
@@ -80,6 +84,12 @@ static void _ldenv_init(char **environ)
         if (_ldgetenv("LD_DEBUG")) {
                 _ldenv.ld_debug = 1;
         }
+        if (_ldgetenv("LD_NO_PRELINK")) {
+                _ldenv.ld_no_prelink = 1;
+        }
+        if (_ldgetenv("LD_NO_CACHE")) {
+                _ldenv.ld_no_cache = 1;
+        }
         _ldenv.ld_preload = _ldgetenv("LD_PRELOAD");
         _ldenv.ld_library_path = _ldgetenv("LD_LIBRARY_PATH");
 }
@@ -115,6 +125,9 @@ static module_t *_ldlinkobj(module_t *info, char *baseaddr, Elf32_Dyn *dyn)
                         case DT_HASH:
                                 info->hash = (void *)(info->base + curdyn->d_un.d_ptr);
                                 break;
+                        case DT_GNU_HASH:
+                                info->gnuhash = (void *)(info->base + curdyn->d_un.d_ptr);
+                                break;
                         case DT_SYMTAB:
                                 info->dynsym = (void *)(info->base + curdyn->d_un.d_ptr);
                                 break;
@@ -190,7 +203,6 @@ static module_t *_ldlinkobj(module_t *info, char *baseaddr, Elf32_Dyn *dyn)
                         _ldaddname(name);
                         *curmod = (module_t *)_ldalloc(sizeof(module_t));
                         (**curmod).name = name;
-                        _ldaddname((**curmod).name);
                         if (d_rpath) {
                                 (**curmod).runpath =
                                         info->dynstr + d_rpath;
@@ -352,17 +364,21 @@ void _ldmapsect(int fd, unsigned long baseaddr, Elf32_Phdr *phdr, int textrel)
 
 void _ldloadobj(module_t *module)
 {
-        unsigned long   bottom, top, size;
+        unsigned long   bottom, top, size, fixed;
         Elf32_Ehdr      *hdr;
         Elf32_Phdr      *phdr;
         Elf32_Dyn       *dyn = 0;
         char            *loc;
+        const char      *path;
         int             fd, i;
 
-        /* attempt to open library */
+        /* attempt to open library: the library cache stands in for the
+         * default path, which it was made from */
         fd = _ldtryopen(module->name, _ldenv.ld_library_path);
         if (fd == -1)
                 fd = _ldtryopen(module->name, module->runpath);
+        if (fd == -1 && (path = _ldcache_lookup(module->name)))
+                fd = open(path, O_RDONLY, 0);
         if (fd == -1)
                 fd = _ldtryopen(module->name, default_runpath);
         if (fd == -1) {
@@ -390,8 +406,15 @@ void _ldloadobj(module_t *module)
         top = round_page(top);
         size = top - bottom;
 
-        loc = (char *)mmap(NULL, size, PROT_NONE, MAP_SHARED, fd, 0);
-        munmap(loc, size);
+        /* A prelinked library goes where it was linked, which makes its
+         * load bias 0; anything else goes wherever there is room */
+        fixed = _ldprelink_base(module);
+        if (fixed && fixed == bottom) {
+                loc = (char *) bottom;
+        } else {
+                loc = (char *)mmap(NULL, size, PROT_NONE, MAP_SHARED, fd, 0);
+                munmap(loc, size);
+        }
 
         /* Figure out whether or not things marked readonly need to
          * be writeable (find DT_TEXTREL). This is kind of a mess,
@@ -417,6 +440,12 @@ void _ldloadobj(module_t *module)
                 }
         } while (curdyn.d_tag != DT_NULL);
 
+        /* Sections are mapped writable only if they must be: read-only
+         * ones are then shared with every other process using the
+         * library, until (unless) written */
+        if (textrel && _ldenv.ld_debug)
+                fprintf(stderr, warn_textrel, module->name);
+
         for (i = 0; i < hdr->e_phnum; i++) {
                 if (phdr[i].p_type == PT_LOAD)
                         _ldmapsect(fd, (unsigned long)loc - bottom, phdr + i, textrel);
@@ -487,11 +516,21 @@ ldinit_t _ldstart(char **environ, auxv_t *auxv)
                 }
         }
 
+        _ldprelink_open(_ldfirst);
+        _ldcache_open();
+
         curmod = _ldfirst->next;
         while (curmod) {
                 _ldloadobj(curmod);
                 curmod = curmod->next;
         }
+        _ldcache_close();
+        _ldclrnames();
+
+        /* If the program was prelinked, it is now fully relocated and
+         * bound */
+        if (_ldprelink_apply(_ldfirst))
+                goto relocated;
 
         /* Perform all necessary relocations */
         /* We relocate the current module (executable) last, as it is the only one that will
@@ -519,6 +558,8 @@ ldinit_t _ldstart(char **environ, auxv_t *auxv)
                 }
         }
 
+relocated:
+
         /* Call .init functions */  /* XXX: fix ordering */
         curmod = _ldfirst->next;
         while (curmod) {
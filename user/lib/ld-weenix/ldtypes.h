@@ -21,6 +21,8 @@ typedef void (*ldinit_t)(int argc, char **argv, char **environ, auxv_t *auxv);
 typedef struct ldenv_t {
         int ld_bind_now;
         int ld_debug;
+        int ld_no_prelink;
+        int ld_no_cache;
         const char *ld_preload;
         const char *ld_library_path;
 } ldenv_t;
@@ -34,6 +36,7 @@ struct module_t {
 
         unsigned long   base;           /* base address of module       */
         Elf32_Word      *hash;          /* the module's hash table      */
+        Elf32_Word      *gnuhash;       /* its GNU hash table, if any   */
         Elf32_Sym       *dynsym;        /* the dynamic symbol table     */
         char            *dynstr;        /* the dynamic string table     */
 
@@ -66,3 +66,31 @@ unsigned long _ldelfhash(const char *name)
         return h;
 }
 
+
+/* This is the hash used by GNU-style (DT_GNU_HASH) hash tables, which
+ * is the djb2 string hash. */
+
+unsigned long _ldgnuhash(const char *name)
+{
+        unsigned long h = 5381;
+
+        while (*name)
+                h = (h << 5) + h + (unsigned char) *name++;
+
+        return h;
+}
+
+
+/* FNV-1a, continuing from h (LD_CHECKSUM_INIT to start). Used to tell
+ * whether a module is the one prelink data was computed for; it must
+ * match the checksum in tools/prelink/prelink.py. */
+
+Elf32_Word _ldchecksum(Elf32_Word h, const void *data, size_t len)
+{
+        const unsigned char *p = data;
+
+        while (len--)
+                h = (h ^ *p++) * 0x01000193;
+
+        return h;
+}
@@ -16,6 +16,9 @@ extern "C" {
         int _ldzero();
 
         unsigned long _ldelfhash(const char *name);
+        unsigned long _ldgnuhash(const char *name);
+#define LD_CHECKSUM_INIT 0x811c9dc5
+        Elf32_Word _ldchecksum(Elf32_Word h, const void *data, size_t len);
         int _ldtryopen(const char *filename, const char *path);
         void _ldmapsect(int fd, unsigned long baseaddr, Elf32_Phdr *phdr, int textrel);
         void _ldloadobj(module_t *module);
@@ -9,6 +9,7 @@
  */
 #include "sys/types.h"
 #include "sys/mman.h"
+#include "sys/uio.h"
 #include "fcntl.h"
 #include "errno.h"
 #include "stddef.h"
@@ -69,6 +70,7 @@ static int fdzero;
 #define INIT_MMAP() \
         { if ((fdzero = _open("/dev/zero", O_RDWR, 0000)) == -1) \
                         wrterror("open of /dev/zero"); }
+#define HAS_MADVISE
 #define MADV_FREE                       MADV_DONTNEED
 
 /*
@@ -167,6 +169,9 @@ static int malloc_active;
 /* Number of free pages we cache */
 static unsigned malloc_cache = 16;
 
+/* Most pages the break is moved ahead of what is needed, see map_pages */
+static unsigned malloc_ahead = 256;
+
 /* The offset from pagenumber to index into the page directory */
 static u_long malloc_origo;
 
@@ -192,7 +197,7 @@ static int suicide;
 static int malloc_realloc;
 
 /* pass the kernel a hint on free pages ?  */
-static int malloc_hint = 0;
+static int malloc_hint = 1;
 
 /* xmalloc behaviour ?  */
 static int malloc_xmalloc;
@@ -206,6 +211,9 @@ static int malloc_zero;
 /* junk fill ?  */
 static int malloc_junk;
 
+/* thread caches for small requests ?  */
+static int malloc_tcache = 1;
+
 #ifdef HAS_UTRACE
 
 /* utrace ?  */
@@ -229,6 +237,9 @@ void utrace __P((struct ut *, int));
 /* my last break. */
 static void *malloc_brk;
 
+/* where the break really is, at or above malloc_brk */
+static void *malloc_top;
+
 /* one location cache for free-list holders */
 static struct pgfree *px;
 
@@ -250,6 +261,7 @@ static int extend_pgdir(u_long index);
 static void *imalloc(size_t size);
 static void ifree(void *ptr);
 static void *irealloc(void *ptr, size_t size);
+static void tcache_init(void);
 
 #ifdef HAS_PROGNAME
 extern char *__progname;
@@ -261,14 +273,27 @@ static char *__progname = "";
 #define abort() exit(1)
 #endif
 
+/* Writes the whole message in one go, so that it cannot be interleaved */
+static void
+wrtmessage(char *q, char *p)
+{
+        struct iovec iov[4];
+
+        iov[0].iov_base = __progname;
+        iov[0].iov_len = strlen(__progname);
+        iov[1].iov_base = malloc_func;
+        iov[1].iov_len = strlen(malloc_func);
+        iov[2].iov_base = q;
+        iov[2].iov_len = strlen(q);
+        iov[3].iov_base = p;
+        iov[3].iov_len = strlen(p);
+        writev(STDERR_FILENO, iov, 4);
+}
+
 static void
 wrterror(char *p)
 {
-        char *q = " error: ";
-        _write(STDERR_FILENO, __progname, strlen(__progname));
-        _write(STDERR_FILENO, malloc_func, strlen(malloc_func));
-        _write(STDERR_FILENO, q, strlen(q));
-        _write(STDERR_FILENO, p, strlen(p));
+        wrtmessage(" error: ", p);
         suicide = 1;
         abort();
 }
@@ -276,31 +301,44 @@ wrterror(char *p)
 static void
 wrtwarning(char *p)
 {
-        char *q = " warning: ";
         if (malloc_abort)
                 wrterror(p);
-        _write(STDERR_FILENO, __progname, strlen(__progname));
-        _write(STDERR_FILENO, malloc_func, strlen(malloc_func));
-        _write(STDERR_FILENO, q, strlen(q));
-        _write(STDERR_FILENO, p, strlen(p));
+        wrtmessage(" warning: ", p);
 }
 
 /*
  * Allocate a number of pages from the OS
+ *
+ * The break is moved ahead of what is needed, by as many pages again as
+ * the heap already has (up to malloc_ahead), so that a growing heap
+ * needs only a few calls of brk(2); the pages between malloc_brk and the
+ * break are handed out by the calls after.  If someone else has moved
+ * the break, we start again from where they left it.
  */
 static void *
 map_pages(int pages)
 {
-        caddr_t result, tail;
+        caddr_t result, tail, top;
+        u_long ahead;
 
-        result = (caddr_t)pageround((u_long)sbrk(0));
+        if (malloc_top && malloc_top == sbrk(0))
+                result = (caddr_t)malloc_brk;
+        else
+                result = (caddr_t)pageround((u_long)sbrk(0));
         tail = result + (pages << malloc_pageshift);
 
-        if (brk(tail)) {
+        if (tail > (caddr_t)sbrk(0)) {
+                ahead = ptr2index(tail);
+                if (ahead > malloc_ahead)
+                        ahead = malloc_ahead;
+                top = tail + (ahead << malloc_pageshift);
+                if (brk(top) && brk(top = tail)) {
 #ifdef EXTRA_SANITY
-                wrterror("(ES): map_pages fails\n");
+                        wrterror("(ES): map_pages fails\n");
 #endif /* EXTRA_SANITY */
-                return 0;
+                        return 0;
+                }
+                malloc_top = top;
         }
 
         last_index = ptr2index(tail) - 1;
@@ -412,6 +450,8 @@ malloc_init()
                                 case 'H': malloc_hint    = 1; break;
                                 case 'r': malloc_realloc = 0; break;
                                 case 'R': malloc_realloc = 1; break;
+                                case 't': malloc_tcache  = 0; break;
+                                case 'T': malloc_tcache  = 1; break;
                                 case 'j': malloc_junk    = 0; break;
                                 case 'J': malloc_junk    = 1; break;
 #ifdef HAS_UTRACE
@@ -450,6 +490,9 @@ malloc_init()
         if (malloc_junk)
                 malloc_realloc = 1;
 
+        if (malloc_tcache)
+                tcache_init();
+
         /* Allocate one page for the page directory */
         page_dir = (struct pginfo **) MMAP(malloc_pagesize);
 
@@ -694,6 +737,275 @@ malloc_bytes(size_t size)
         return (u_char *)bp->page + k;
 }
 
+/*
+ * Thread-caching mode ('T', the default; 't' turns it off).
+ *
+ * Requests of up to malloc_maxsize bytes are rounded up to one of
+ * TCACHE_NCLASSES size classes and served from runs: TCACHE_RUN_PAGES
+ * pages mmap'ed from /dev/zero, carved into objects of a single class.
+ * Each thread keeps a cache of free objects of every class, so that
+ * allocating or freeing one is a pop or a push on a list. Only when a
+ * cache runs dry, or grows too long, does it take objects from the runs
+ * (or give them back) TCACHE_BATCH at a time, under the central lock.
+ * Larger requests bypass the caches and get pages as before.
+ *
+ * tc_pagemap, a two-level table indexed by page number, says which run
+ * (if any) each page belongs to, so ifree tells objects from runs apart
+ * from everything else without a search.
+ *
+ * This libc has no threads yet, so there is one cache and TCACHE_LOCK
+ * does nothing; tcache_self() is where each thread would find its own.
+ */
+#define TCACHE_NCLASSES         24
+#define TCACHE_RUN_PAGES        4
+#define TCACHE_RUN_SIZE         (TCACHE_RUN_PAGES << malloc_pageshift)
+#define TCACHE_BATCH            16      /* objects moved at once */
+#define TCACHE_MAX_CACHED       64      /* more than this, and half go back */
+
+#define TCACHE_MAP_SHIFT        10
+#define TCACHE_MAP_SIZE         (1 << TCACHE_MAP_SHIFT)
+
+#ifndef TCACHE_LOCK
+#define TCACHE_LOCK()
+#endif
+
+#ifndef TCACHE_UNLOCK
+#define TCACHE_UNLOCK()
+#endif
+
+/* The header at the start of each run */
+struct tc_run {
+        struct tc_run   *r_next;        /* on tc_partial[r_class] */
+        struct tc_run  **r_prevp;       /* NULL if the run has no free objects */
+        void            *r_free;        /* free objects, linked through their first word */
+        u_short          r_class;
+        u_short          r_nfree;
+        u_short          r_nobjs;
+        u_short          r_offset;      /* where the first object is */
+};
+
+struct tc_cache {
+        void            *c_free[TCACHE_NCLASSES];
+        u_int            c_count[TCACHE_NCLASSES];
+};
+
+static const u_short tc_sizes[TCACHE_NCLASSES] = {
+        16, 32, 48, 64, 80, 96, 112, 128,
+        160, 192, 224, 256, 320, 384, 448, 512,
+        640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+
+/* The class of a request of n bytes is tc_class_of[(n + 15) >> 4] */
+static u_char tc_class_of[(malloc_maxsize >> 4) + 1];
+
+/* Runs with free objects, by class */
+static struct tc_run *tc_partial[TCACHE_NCLASSES];
+
+/* page number -> run, see tcache_lookup */
+static struct tc_run **tc_pagemap[TCACHE_MAP_SIZE];
+
+static struct tc_cache tc_main;
+#define tcache_self()   (&tc_main)
+
+static void
+tcache_init(void)
+{
+        u_int i, cls = 0;
+
+        for (i = 0; i <= (malloc_maxsize >> 4); i++) {
+                while ((i << 4) > tc_sizes[cls])
+                        cls++;
+                tc_class_of[i] = cls;
+        }
+}
+
+#define tcache_class(size)      (tc_class_of[((size) + 15) >> 4])
+
+/* The run ptr belongs to, or NULL if it is not from one */
+static __inline__ struct tc_run *
+tcache_lookup(void *ptr)
+{
+        u_long page = (u_long)ptr >> malloc_pageshift;
+        struct tc_run **map = tc_pagemap[(page >> TCACHE_MAP_SHIFT) % TCACHE_MAP_SIZE];
+
+        return map ? map[page & (TCACHE_MAP_SIZE - 1)] : 0;
+}
+
+/* Points the pagemap entries of a run's pages at run (or at nothing) */
+static int
+tcache_map_run(void *addr, struct tc_run *run)
+{
+        u_long page = (u_long)addr >> malloc_pageshift;
+        u_long i;
+
+        for (i = page; i < page + TCACHE_RUN_PAGES; i++) {
+                struct tc_run ***map = &tc_pagemap[(i >> TCACHE_MAP_SHIFT) % TCACHE_MAP_SIZE];
+
+                if (!*map) {
+                        if (!run)
+                                continue;
+                        *map = (struct tc_run **) MMAP(TCACHE_MAP_SIZE * sizeof **map);
+                        if (*map == (struct tc_run **) MAP_FAILED) {
+                                *map = 0;
+                                return -1;
+                        }
+                }
+                (*map)[i & (TCACHE_MAP_SIZE - 1)] = run;
+        }
+        return 0;
+}
+
+static void
+tcache_unlink(struct tc_run *run)
+{
+        if ((*run->r_prevp = run->r_next))
+                run->r_next->r_prevp = run->r_prevp;
+        run->r_prevp = 0;
+}
+
+static void
+tcache_link(struct tc_run *run)
+{
+        struct tc_run **head = &tc_partial[run->r_class];
+
+        if ((run->r_next = *head))
+                (*head)->r_prevp = &run->r_next;
+        run->r_prevp = head;
+        *head = run;
+}
+
+/* Maps, carves up and links a new run of the given class */
+static struct tc_run *
+tcache_new_run(int cls)
+{
+        struct tc_run *run;
+        u_int size = tc_sizes[cls];
+        char *obj;
+        int i;
+
+        run = (struct tc_run *) MMAP(TCACHE_RUN_SIZE);
+        if (run == (struct tc_run *) MAP_FAILED)
+                return 0;
+        if (tcache_map_run(run, run)) {
+                tcache_map_run(run, 0);
+                munmap(run, TCACHE_RUN_SIZE);
+                return 0;
+        }
+
+        run->r_class = cls;
+        run->r_offset = (sizeof * run + 15) & ~15;
+        run->r_nobjs = (TCACHE_RUN_SIZE - run->r_offset) / size;
+        run->r_nfree = run->r_nobjs;
+        run->r_free = 0;
+        for (i = run->r_nobjs - 1; i >= 0; i--) {
+                obj = (char *)run + run->r_offset + i * size;
+                *(void **)obj = run->r_free;
+                run->r_free = obj;
+        }
+        tcache_link(run);
+        return run;
+}
+
+/* Moves up to TCACHE_BATCH objects of a class from the runs to a cache,
+ * returning how many */
+static int
+tcache_refill(struct tc_cache *c, int cls)
+{
+        struct tc_run *run;
+        void *obj;
+        int n = 0;
+
+        TCACHE_LOCK();
+        while (n < TCACHE_BATCH) {
+                if (!(run = tc_partial[cls]) && !(run = tcache_new_run(cls)))
+                        break;
+                while (run->r_nfree && n < TCACHE_BATCH) {
+                        obj = run->r_free;
+                        run->r_free = *(void **)obj;
+                        run->r_nfree--;
+                        *(void **)obj = c->c_free[cls];
+                        c->c_free[cls] = obj;
+                        n++;
+                }
+                if (!run->r_nfree)
+                        tcache_unlink(run);
+        }
+        TCACHE_UNLOCK();
+
+        c->c_count[cls] += n;
+        return n;
+}
+
+/* Gives n objects of a class back from a cache to their runs. A run
+ * which ends up with every object free is unmapped, unless it is the
+ * only one of its class with free objects. */
+static void
+tcache_release(struct tc_cache *c, int cls, int n)
+{
+        struct tc_run *run;
+        void *obj;
+
+        TCACHE_LOCK();
+        for (; n > 0 && c->c_free[cls]; n--) {
+                obj = c->c_free[cls];
+                c->c_free[cls] = *(void **)obj;
+                c->c_count[cls]--;
+
+                run = tcache_lookup(obj);
+                *(void **)obj = run->r_free;
+                run->r_free = obj;
+                if (!run->r_nfree++)
+                        tcache_link(run);
+
+                if (run->r_nfree == run->r_nobjs
+                    && (tc_partial[cls] != run || run->r_next)) {
+                        tcache_unlink(run);
+                        tcache_map_run(run, 0);
+                        munmap(run, TCACHE_RUN_SIZE);
+                }
+        }
+        TCACHE_UNLOCK();
+}
+
+static void *
+tcache_malloc(size_t size)
+{
+        struct tc_cache *c = tcache_self();
+        int cls = tcache_class(size);
+        void *obj;
+
+        if (!c->c_free[cls] && !tcache_refill(c, cls))
+                return 0;
+
+        obj = c->c_free[cls];
+        c->c_free[cls] = *(void **)obj;
+        c->c_count[cls]--;
+
+        if (malloc_junk)
+                memset(obj, SOME_JUNK, tc_sizes[cls]);
+        return obj;
+}
+
+static void
+tcache_free(void *ptr, struct tc_run *run)
+{
+        struct tc_cache *c = tcache_self();
+        int cls = run->r_class;
+
+        if (((char *)ptr - ((char *)run + run->r_offset)) % tc_sizes[cls]) {
+                wrtwarning("modified (chunk-) pointer.\n");
+                return;
+        }
+
+        if (malloc_junk)
+                memset(ptr, SOME_JUNK, tc_sizes[cls]);
+
+        *(void **)ptr = c->c_free[cls];
+        c->c_free[cls] = ptr;
+        if (++c->c_count[cls] > TCACHE_MAX_CACHED)
+                tcache_release(c, cls, TCACHE_MAX_CACHED / 2);
+}
+
 /*
  * Allocate a piece of memory
  */
@@ -707,6 +1019,8 @@ imalloc(size_t size)
 
         if ((size + malloc_pagesize) < size)        /* Check for overflow */
                 result = 0;
+        else if (size <= malloc_maxsize && malloc_tcache)
+                result =  tcache_malloc(size);
         else if (size <= malloc_maxsize)
                 result =  malloc_bytes(size);
         else
@@ -730,11 +1044,27 @@ irealloc(void *ptr, size_t size)
         void *p;
         u_long osize, index;
         struct pginfo **mp;
+        struct tc_run *run;
         int i;
 
         if (suicide)
                 abort();
 
+        if ((run = tcache_lookup(ptr))) {           /* Thread-cached object */
+                osize = tc_sizes[run->r_class];
+
+                /* Same class: Don't do anything (unless we have to) */
+                if (!malloc_realloc && size <= malloc_maxsize &&
+                    tcache_class(size) == run->r_class)
+                        return ptr;
+
+                if ((p = imalloc(size))) {
+                        memcpy(p, ptr, MIN(size, osize));
+                        ifree(ptr);
+                }
+                return p;
+        }
+
         index = ptr2index(ptr);
 
         if (index < malloc_pageshift) {
@@ -921,7 +1251,7 @@ free_pages(void *ptr, int index, struct pginfo *info)
         if (!pf->next &&                            /* If we're the last one, */
             pf->size > malloc_cache &&                /* ..and the cache is full, */
             pf->end == malloc_brk &&                  /* ..and none behind us, */
-            malloc_brk == sbrk(0)) {                  /* ..and it's OK to do... */
+            malloc_top == sbrk(0)) {                  /* ..and it's OK to do... */
 
                 /*
                  * Keep the cache intact.  Notice that the '>' above guarantees that
@@ -931,7 +1261,7 @@ free_pages(void *ptr, int index, struct pginfo *info)
                 pf->size = malloc_cache;
 
                 brk(pf->end);
-                malloc_brk = pf->end;
+                malloc_brk = malloc_top = pf->end;
 
                 index = ptr2index(pf->end);
                 last_index = index - 1;
@@ -1015,6 +1345,7 @@ static void
 ifree(void *ptr)
 {
         struct pginfo *info;
+        struct tc_run *run;
         unsigned int index;
 
         /* This is legal */
@@ -1030,6 +1361,11 @@ ifree(void *ptr)
         if (suicide)
                 return;
 
+        if ((run = tcache_lookup(ptr))) {
+                tcache_free(ptr, run);
+                return;
+        }
+
         index = ptr2index(ptr);
 
         if (index < malloc_pageshift) {
@@ -113,7 +113,10 @@ int vfprintf(FILE *stream, const char *fmt, va_list args)
         char buf[__LIBC_PRINTF_BUFSIZE];
         int ret = vsnprintf(buf, __LIBC_PRINTF_BUFSIZE, fmt, args);
         if (ret > 0) {
-                write(*stream, buf, ret);
+                /* anything longer was cut short */
+                size_t len = (ret < __LIBC_PRINTF_BUFSIZE) ? ret : __LIBC_PRINTF_BUFSIZE - 1;
+                if (fwrite(buf, 1, len, stream) != len)
+                        return -1;
         }
         return ret;
 }
@@ -122,9 +125,3 @@ int vsprintf(char *buf, const char *fmt, va_list args)
 {
         return vsnprintf(buf, 0xffffffffUL, fmt, args);
 }
-
-int fflush(FILE *stream)
-{
-        /* no-op */
-        return 0;
-}
@@ -0,0 +1,132 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <pthread/pthread.h>
+#include <weenix/syscall.h>
+
+/*
+ * Mutexes and condition variables over futex(2), after Drepper's
+ * "Futexes Are Tricky". The kernel is only asked to sleep or wake when
+ * a mutex has (or may have) waiters, and a condition variable is only
+ * signalled through the kernel when somebody waits on it.
+ *
+ * A contended lock does not spin before sleeping: there is only the one
+ * processor, so the holder cannot let go of the lock until the spinner
+ * gives up the processor anyway.
+ */
+
+#define FUTEX_WAKE_ALL  0x7fffffff
+
+/* The old value of *p, having set it to v if it was old */
+static __inline__ uint32_t
+cmpxchg(volatile uint32_t *p, uint32_t old, uint32_t v)
+{
+        uint32_t prev;
+
+        __asm__ volatile("lock; cmpxchgl %2, %1"
+                         : "=a"(prev), "+m"(*p) : "r"(v), "0"(old) : "memory");
+        return prev;
+}
+
+/* The old value of *p, having set it to v */
+static __inline__ uint32_t
+xchg(volatile uint32_t *p, uint32_t v)
+{
+        __asm__ volatile("xchgl %0, %1" : "+r"(v), "+m"(*p) :: "memory");
+        return v;
+}
+
+static __inline__ void
+atomic_add(volatile uint32_t *p, int v)
+{
+        __asm__ volatile("lock; addl %1, %0" : "+m"(*p) : "ir"(v) : "memory");
+}
+
+int pthread_mutex_init(pthread_mutex_t *mtx, const pthread_mutexattr_t *attr)
+{
+        mtx->m_state = 0;
+        return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mtx)
+{
+        return (0 == mtx->m_state) ? 0 : EBUSY;
+}
+
+/* Takes the lock, once it is known to be contended: it is left at 2
+ * whoever has it, so that its unlock wakes the next waiter */
+static void mutex_lock_contended(pthread_mutex_t *mtx)
+{
+        while (0 != xchg(&mtx->m_state, 2))
+                futex((uint32_t *) &mtx->m_state, FUTEX_WAIT, 2, NULL);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mtx)
+{
+        uint32_t c;
+
+        if (0 == (c = cmpxchg(&mtx->m_state, 0, 1)))
+                return 0;
+        if (2 != c && 0 == xchg(&mtx->m_state, 2))
+                return 0;
+        mutex_lock_contended(mtx);
+        return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mtx)
+{
+        return (0 == cmpxchg(&mtx->m_state, 0, 1)) ? 0 : EBUSY;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mtx)
+{
+        if (2 == xchg(&mtx->m_state, 0))
+                futex((uint32_t *) &mtx->m_state, FUTEX_WAKE, 1, NULL);
+        return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+        cond->c_seq = 0;
+        cond->c_waiters = 0;
+        return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond)
+{
+        return (0 == cond->c_waiters) ? 0 : EBUSY;
+}
+
+/* A wakeup between unlocking the mutex and sleeping changes c_seq, so
+ * the sleep does not happen and cannot miss it */
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mtx)
+{
+        uint32_t seq = cond->c_seq;
+
+        atomic_add(&cond->c_waiters, 1);
+        pthread_mutex_unlock(mtx);
+        futex((uint32_t *) &cond->c_seq, FUTEX_WAIT, seq, NULL);
+        atomic_add(&cond->c_waiters, -1);
+        /* others may have been woken alongside */
+        mutex_lock_contended(mtx);
+        return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+        if (0 == cond->c_waiters)
+                return 0;
+        atomic_add(&cond->c_seq, 1);
+        futex((uint32_t *) &cond->c_seq, FUTEX_WAKE, 1, NULL);
+        return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+        if (0 == cond->c_waiters)
+                return 0;
+        atomic_add(&cond->c_seq, 1);
+        futex((uint32_t *) &cond->c_seq, FUTEX_WAKE, FUTEX_WAKE_ALL, NULL);
+        return 0;
+}
@@ -1,7 +1,219 @@
 #include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "errno.h"
 
-static int stdstreams[3] = { 0, 1, 2 };
+/*
+ * Buffered output streams. Output collects in the stream's buffer and
+ * is written when the buffer fills, when (line buffered streams only) a
+ * newline is written, on fflush, before a read() and before fork()
+ * (lest the child write the same output again) and at exit.
+ */
+
+#define NSTREAMS 3
+
+static FILE stdstreams[NSTREAMS] = {
+        { 0, -1, 0, NULL, 0, 0 },
+        { 1, -1, 0, NULL, 0, 0 },
+        { 2, -1, 0, NULL, 0, 0 }
+};
 
 FILE *stdin = &stdstreams[0];
 FILE *stdout = &stdstreams[1];
 FILE *stderr = &stdstreams[2];
+
+/* Writes all of buf, retrying short writes */
+static int
+__swrite(FILE *stream, const char *buf, size_t len)
+{
+        int n;
+
+        while (len > 0) {
+                if ((n = write(stream->_fd, buf, len)) <= 0) {
+                        stream->_flags |= __SERR;
+                        return EOF;
+                }
+                buf += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/* Chooses the mode and buffer of a stream which has not had them set
+ * by setvbuf, see the comment in stdio.h */
+static void
+__smakebuf(FILE *stream)
+{
+        struct stat st;
+        size_t size = BUFSIZ;
+
+        if (stream == stderr) {
+                stream->_mode = _IONBF;
+                return;
+        }
+
+        if (0 == fstat(stream->_fd, &st)) {
+                if (S_ISCHR(st.st_mode))
+                        stream->_mode = _IOLBF;
+                else
+                        stream->_mode = _IOFBF;
+                if (st.st_blksize > BUFSIZ)
+                        size = st.st_blksize;
+        } else {
+                stream->_mode = _IOFBF;
+        }
+
+        if (NULL == (stream->_buf = malloc(size))) {
+                stream->_mode = _IONBF;
+                return;
+        }
+        stream->_size = size;
+        stream->_flags |= __SMALLOC;
+}
+
+int
+setvbuf(FILE *stream, char *buf, int mode, size_t size)
+{
+        if (_IOFBF != mode && _IOLBF != mode && _IONBF != mode) {
+                errno = EINVAL;
+                return EOF;
+        }
+        if (EOF == fflush(stream))
+                return EOF;
+
+        if (stream->_flags & __SMALLOC)
+                free(stream->_buf);
+        stream->_flags &= ~__SMALLOC;
+        stream->_buf = NULL;
+        stream->_size = 0;
+        stream->_mode = mode;
+
+        if (_IONBF == mode)
+                return 0;
+        if (0 == size)
+                size = BUFSIZ;
+        if (NULL == buf) {
+                if (NULL == (buf = malloc(size))) {
+                        stream->_mode = _IONBF;
+                        return EOF;
+                }
+                stream->_flags |= __SMALLOC;
+        }
+        stream->_buf = buf;
+        stream->_size = size;
+        return 0;
+}
+
+void
+setbuf(FILE *stream, char *buf)
+{
+        setvbuf(stream, buf, buf ? _IOFBF : _IONBF, BUFSIZ);
+}
+
+int
+fflush(FILE *stream)
+{
+        int i, ret = 0;
+        size_t len;
+
+        if (NULL == stream) {
+                for (i = 0; i < NSTREAMS; i++) {
+                        if (EOF == fflush(&stdstreams[i]))
+                                ret = EOF;
+                }
+                return ret;
+        }
+
+        if (0 == (len = stream->_len))
+                return 0;
+        stream->_len = 0;
+        return __swrite(stream, stream->_buf, len);
+}
+
+void
+__stdio_flushlbf(void)
+{
+        int i;
+
+        for (i = 0; i < NSTREAMS; i++) {
+                if (_IOLBF == stdstreams[i]._mode && stdstreams[i]._len > 0)
+                        fflush(&stdstreams[i]);
+        }
+}
+
+size_t
+fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+        const char *p = ptr;
+        size_t len = size * nmemb;
+        size_t n;
+
+        if (0 == len)
+                return 0;
+        if (-1 == stream->_mode)
+                __smakebuf(stream);
+
+        if (_IONBF == stream->_mode)
+                return __swrite(stream, p, len) ? 0 : nmemb;
+
+        /* Something which would fill the buffer anyway goes straight
+         * out, after whatever is already waiting */
+        if (len >= stream->_size) {
+                if (EOF == fflush(stream) || EOF == __swrite(stream, p, len))
+                        return 0;
+                return nmemb;
+        }
+
+        while (len > 0) {
+                if (stream->_len == stream->_size && EOF == fflush(stream))
+                        return 0;
+                n = stream->_size - stream->_len;
+                if (n > len)
+                        n = len;
+                memcpy(stream->_buf + stream->_len, p, n);
+                stream->_len += n;
+                p += n;
+                len -= n;
+        }
+
+        if (_IOLBF == stream->_mode && NULL != memchr(ptr, '\n', size * nmemb)) {
+                if (EOF == fflush(stream))
+                        return 0;
+        }
+        return nmemb;
+}
+
+int
+fputc(int c, FILE *stream)
+{
+        unsigned char ch = (unsigned char) c;
+
+        return (1 == fwrite(&ch, 1, 1, stream)) ? ch : EOF;
+}
+
+int
+fputs(const char *s, FILE *stream)
+{
+        size_t len = strlen(s);
+
+        return (len == fwrite(s, 1, len, stream)) ? 0 : EOF;
+}
+
+int
+ferror(FILE *stream)
+{
+        return stream->_flags & __SERR;
+}
+
+void
+clearerr(FILE *stream)
+{
+        stream->_flags &= ~__SERR;
+}
+
+int
+fileno(FILE *stream)
+{
+        return stream->_fd;
+}
@@ -3,6 +3,84 @@
 #include "string.h"
 #include "errno.h"
 
+/*
+ * The routines which scan or copy a lot of memory do so a word at a
+ * time. A string's terminating NUL (or the byte being searched for) is
+ * found among the four bytes of a word with WORD_HAS_ZERO, which is
+ * nonzero exactly when one of them is zero; XORing the word with the
+ * byte repeated four times first turns that byte into zero. Only
+ * aligned words are read, so a scan never strays onto the next page
+ * past the end of a string.
+ */
+#define WORD_SIZE               sizeof(uint32_t)
+#define WORD_MASK               (WORD_SIZE - 1)
+#define WORD_ONES               0x01010101U
+#define WORD_HIGHS              0x80808080U
+#define WORD_HAS_ZERO(w)        (((w) - WORD_ONES) & ~(w) & WORD_HIGHS)
+#define WORD_ALIGNED(p)         (0 == ((uintptr_t)(p) & WORD_MASK))
+
+/* Below this many bytes, copies are not worth aligning */
+#define COPY_WORDS_MIN          16
+
+/* Copies forwards, which is also safe for overlapping regions with dest
+ * below src */
+static void copy_forward(char *d, const char *s, size_t count)
+{
+        if (count >= COPY_WORDS_MIN && WORD_ALIGNED((uintptr_t) d ^ (uintptr_t) s)) {
+                uint32_t *dw;
+                const uint32_t *sw;
+
+                for (; !WORD_ALIGNED(d); count--)
+                        *d++ = *s++;
+                dw = (uint32_t *) d;
+                sw = (const uint32_t *) s;
+                for (; count >= 4 * WORD_SIZE; count -= 4 * WORD_SIZE) {
+                        dw[0] = sw[0];
+                        dw[1] = sw[1];
+                        dw[2] = sw[2];
+                        dw[3] = sw[3];
+                        dw += 4;
+                        sw += 4;
+                }
+                for (; count >= WORD_SIZE; count -= WORD_SIZE)
+                        *dw++ = *sw++;
+                d = (char *) dw;
+                s = (const char *) sw;
+        }
+        while (count--)
+                *d++ = *s++;
+}
+
+/* Copies backwards, for overlapping regions with dest above src */
+static void copy_backward(char *d, const char *s, size_t count)
+{
+        d += count;
+        s += count;
+        if (count >= COPY_WORDS_MIN && WORD_ALIGNED((uintptr_t) d ^ (uintptr_t) s)) {
+                uint32_t *dw;
+                const uint32_t *sw;
+
+                for (; !WORD_ALIGNED(d); count--)
+                        *--d = *--s;
+                dw = (uint32_t *) d;
+                sw = (const uint32_t *) s;
+                for (; count >= 4 * WORD_SIZE; count -= 4 * WORD_SIZE) {
+                        dw -= 4;
+                        sw -= 4;
+                        dw[3] = sw[3];
+                        dw[2] = sw[2];
+                        dw[1] = sw[1];
+                        dw[0] = sw[0];
+                }
+                for (; count >= WORD_SIZE; count -= WORD_SIZE)
+                        *--dw = *--sw;
+                d = (char *) dw;
+                s = (const char *) sw;
+        }
+        while (count--)
+                *--d = *--s;
+}
+
 int memcmp(const void *cs, const void *ct, size_t count)
 {
         const unsigned char *su1, *su2;
@@ -16,15 +94,42 @@ int memcmp(const void *cs, const void *ct, size_t count)
 
 void *memcpy(void *dest, const void *src, size_t count)
 {
-        char *tmp = (char *) dest;
-        const char *s = src;
+        copy_forward((char *) dest, (const char *) src, count);
+        return dest;
+}
 
-        while (count--)
-                *tmp++ = *s++;
+void *memmove(void *dest, const void *src, size_t count)
+{
+        char *d = (char *) dest;
+        const char *s = src;
 
+        if (d <= s || d >= s + count)
+                copy_forward(d, s, count);
+        else
+                copy_backward(d, s, count);
         return dest;
 }
 
+void *memchr(const void *s, int c, size_t count)
+{
+        const unsigned char *p = s;
+        unsigned char ch = (unsigned char) c;
+        uint32_t mask = ch * WORD_ONES;
+
+        for (; count && !WORD_ALIGNED(p); count--, p++)
+                if (*p == ch)
+                        return (void *) p;
+        for (; count >= WORD_SIZE; count -= WORD_SIZE, p += WORD_SIZE) {
+                uint32_t w = *(const uint32_t *) p ^ mask;
+                if (WORD_HAS_ZERO(w))
+                        break;
+        }
+        for (; count; count--, p++)
+                if (*p == ch)
+                        return (void *) p;
+        return NULL;
+}
+
 int strncmp(const char *cs, const char *ct, size_t count)
 {
         register signed char __res = 0;
@@ -104,15 +209,33 @@ char *strcat(char *dest, const char *src)
 size_t strlen(const char *s)
 {
         const char *sc;
+        const uint32_t *w;
 
-        for (sc = s; *sc != '\0'; ++sc)
+        for (sc = s; !WORD_ALIGNED(sc); ++sc)
+                if (*sc == '\0')
+                        return sc - s;
+        for (w = (const uint32_t *) sc; !WORD_HAS_ZERO(*w); ++w)
+                /* nothing */;
+        for (sc = (const char *) w; *sc != '\0'; ++sc)
                 /* nothing */;
         return sc - s;
 }
 
 char *strchr(const char *s, int c)
 {
-        for (; *s != (char) c; ++s)
+        uint32_t mask = (unsigned char) c * WORD_ONES;
+        const uint32_t *w;
+
+        for (; !WORD_ALIGNED(s); ++s) {
+                if (*s == (char) c)
+                        return (char *)s;
+                if (*s == '\0')
+                        return NULL;
+        }
+        /* stop at the word holding either c or the NUL, whichever it is */
+        for (w = (const uint32_t *) s; !WORD_HAS_ZERO(*w) && !WORD_HAS_ZERO(*w ^ mask); ++w)
+                /* nothing */;
+        for (s = (const char *) w; *s != (char) c; ++s)
                 if (*s == '\0')
                         return NULL;
         return (char *)s;
@@ -5,9 +5,37 @@
 #include "stdlib.h"
 
 #include "unistd.h"
+#include "stdio.h"
+#include "weenix/kdata.h"
 #include "weenix/trap.h"
 
 #include "dirent.h"
+#include "fcntl.h"
+#include "time.h"
+#include "poll.h"
+#include "aio.h"
+#include "sys/select.h"
+
+int _trap_sysenter = -1;
+
+/* Use sysenter if the processor has it, as the kernel then does too. The
+ * first Pentium Pros claimed SEP even though they could not do it */
+void _trap_init(void)
+{
+        uint32_t eax, edx;
+
+        /* cpuid clobbers ebx, which may hold the GOT */
+        __asm__ volatile(
+                "pushl %%ebx\n\t"
+                "cpuid\n\t"
+                "popl %%ebx\n"
+                : "=a"(eax), "=d"(edx)
+                : "a"(1)
+                : "ecx"
+        );
+        _trap_sysenter = (edx & (1 << 11))
+                         && !(0x600 == (eax & 0xf00) && (eax & 0xff) < 0x33);
+}
 
 static void *__curbrk = NULL;
 #define MAX_EXIT_HANDLERS 32
@@ -56,9 +84,18 @@ int brk(void *addr)
         return 0;
 }
 
+/* The process's pid, once getpid has asked for it. Only fork changes
+ * it, in the child. */
+static pid_t self_pid = 0;
+
 int fork(void)
 {
-        return trap(SYS_fork, 0);
+        int ret;
+
+        fflush(NULL);
+        if (0 == (ret = trap(SYS_fork, 0)))
+                self_pid = 0;
+        return ret;
 }
 
 int atexit(void (*func)(void))
@@ -85,6 +122,7 @@ void exit(int status)
         while (atexit_handlers--) {
                 atexit_func[atexit_handlers]();
         }
+        fflush(NULL);
 
         _exit(status);
         exit(status); /* gcc doesn't realize that _exit() exits */
@@ -127,7 +165,9 @@ void thr_exit(int status)
 
 pid_t getpid(void)
 {
-        return trap(SYS_getpid, 0);
+        if (0 == self_pid)
+                self_pid = trap(SYS_getpid, 0);
+        return self_pid;
 }
 
 int halt(void)
@@ -159,11 +199,190 @@ int munmap(void *addr, size_t len)
         return trap(SYS_munmap, (uint32_t) &args);
 }
 
+int shm_open(const char *name, int oflag, int mode)
+{
+        open_args_t args;
+
+        args.filename.as_len = strlen(name);
+        args.filename.as_str = name;
+        args.flags = oflag;
+        args.mode = mode;
+
+        return trap(SYS_shm_open, (uint32_t) &args);
+}
+
+int shm_unlink(const char *name)
+{
+        argstr_t args;
+        args.as_len = strlen(name);
+        args.as_str = name;
+        return trap(SYS_shm_unlink, (uint32_t) &args);
+}
+
+int mlock(const void *addr, size_t len)
+{
+        mlock_args_t args;
+
+        args.addr = addr;
+        args.len = len;
+
+        return trap(SYS_mlock, (uint32_t) &args);
+}
+
+int munlock(const void *addr, size_t len)
+{
+        mlock_args_t args;
+
+        args.addr = addr;
+        args.len = len;
+
+        return trap(SYS_munlock, (uint32_t) &args);
+}
+
+int madvise(void *addr, size_t len, int advice)
+{
+        madvise_args_t args;
+
+        args.addr = addr;
+        args.len = len;
+        args.advice = advice;
+
+        return trap(SYS_madvise, (uint32_t) &args);
+}
+
+int getrusage(int who, struct rusage *usage)
+{
+        getrusage_args_t args;
+
+        args.who = who;
+        args.usage = usage;
+
+        return trap(SYS_getrusage, (uint32_t) &args);
+}
+
+int nice(int inc)
+{
+        return trap(SYS_nice, (uint32_t) inc);
+}
+
+int sched_setaffinity(pid_t pid, uint32_t mask)
+{
+        sched_setaffinity_args_t args;
+
+        args.pid = pid;
+        args.mask = mask;
+
+        return trap(SYS_sched_setaffinity, (uint32_t) &args);
+}
+
+int sched_getaffinity(pid_t pid, uint32_t *mask)
+{
+        sched_getaffinity_args_t args;
+
+        args.pid = pid;
+        args.mask = mask;
+
+        return trap(SYS_sched_getaffinity, (uint32_t) &args);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+        nanosleep_args_t args;
+
+        args.req = req;
+        args.rem = rem;
+
+        return trap(SYS_nanosleep, (uint32_t) &args);
+}
+
+int futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+        futex_args_t args;
+
+        args.uaddr = uaddr;
+        args.op = op;
+        args.val = val;
+        args.timeout = timeout;
+
+        return trap(SYS_futex, (uint32_t) &args);
+}
+
+int sysbatch(sysbatch_ent_t *ents, int count, int flags)
+{
+        sysbatch_args_t args;
+
+        args.ents = ents;
+        args.count = count;
+        args.flags = flags;
+
+        return trap(SYS_batch, (uint32_t) &args);
+}
+
+int usleep(unsigned int usecs)
+{
+        struct timespec ts;
+
+        ts.tv_sec = usecs / 1000000;
+        ts.tv_nsec = (usecs % 1000000) * 1000;
+
+        return nanosleep(&ts, NULL);
+}
+
 void sync(void)
 {
         trap(SYS_sync, 0);
 }
 
+int fsync(int fd)
+{
+        return trap(SYS_fsync, (uint32_t) fd);
+}
+
+int fdatasync(int fd)
+{
+        return trap(SYS_fdatasync, (uint32_t) fd);
+}
+
+/* Hands back the error rather than setting errno, as POSIX has it */
+int posix_fadvise(int fd, off_t off, off_t len, int advice)
+{
+        fadvise_args_t args;
+
+        args.fd = fd;
+        args.off = off;
+        args.len = len;
+        args.advice = advice;
+
+        return (0 > trap(SYS_fadvise, (uint32_t) &args)) ? errno : 0;
+}
+
+int sendfile(int out_fd, int in_fd, off_t *off, size_t count)
+{
+        sendfile_args_t args;
+
+        args.out_fd = out_fd;
+        args.in_fd = in_fd;
+        args.off = off;
+        args.count = count;
+
+        return trap(SYS_sendfile, (uint32_t) &args);
+}
+
+int copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                    size_t len, unsigned int flags)
+{
+        copy_file_range_args_t args;
+
+        args.fd_in = fd_in;
+        args.off_in = off_in;
+        args.fd_out = fd_out;
+        args.off_out = off_out;
+        args.len = len;
+        args.flags = flags;
+
+        return trap(SYS_copy_file_range, (uint32_t) &args);
+}
+
 int open(const char *filename, int flags, int mode)
 {
         open_args_t args;
@@ -176,6 +395,19 @@ int open(const char *filename, int flags, int mode)
         return trap(SYS_open, (uint32_t) &args);
 }
 
+int openat(int dirfd, const char *filename, int flags, int mode)
+{
+        openat_args_t args;
+
+        args.dirfd = dirfd;
+        args.filename.as_len = strlen(filename);
+        args.filename.as_str = filename;
+        args.flags = flags;
+        args.mode = mode;
+
+        return trap(SYS_openat, (uint32_t) &args);
+}
+
 off_t lseek(int fd, off_t offset, int whence)
 {
         lseek_args_t args;
@@ -192,6 +424,8 @@ int read(int fd, void *buf, size_t nbytes)
 {
         read_args_t args;
 
+        __stdio_flushlbf();
+
         args.fd = fd;
         args.buf = buf;
         args.nbytes = nbytes;
@@ -211,6 +445,140 @@ int write(int fd, const void *buf, size_t nbytes)
         return trap(SYS_write, (uint32_t) &args);
 }
 
+static int
+iov_trap(int sysnum, int fd, const struct iovec *iov, int iovcnt, off_t off)
+{
+        iov_args_t args;
+
+        args.fd = fd;
+        args.iov = iov;
+        args.iovcnt = iovcnt;
+        args.off = off;
+
+        return trap(sysnum, (uint32_t) &args);
+}
+
+int readv(int fd, const struct iovec *iov, int iovcnt)
+{
+        return iov_trap(SYS_readv, fd, iov, iovcnt, 0);
+}
+
+int writev(int fd, const struct iovec *iov, int iovcnt)
+{
+        return iov_trap(SYS_writev, fd, iov, iovcnt, 0);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+        poll_args_t args;
+
+        args.fds = fds;
+        args.nfds = nfds;
+        args.timeout = timeout;
+
+        return trap(SYS_poll, (uint32_t) &args);
+}
+
+/* select(2) by way of poll, a pollfd for each descriptor in any of the
+ * sets. An exceptional condition is an error or hangup. */
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+           struct timeval *timeout)
+{
+        struct pollfd fds[FD_SETSIZE];
+        int i, n, ret, ms = -1;
+
+        if (0 > nfds || FD_SETSIZE < nfds) {
+                errno = EINVAL;
+                return -1;
+        }
+        for (i = n = 0; i < nfds; i++) {
+                short events = 0;
+
+                if (NULL != readfds && FD_ISSET(i, readfds))
+                        events |= POLLIN;
+                if (NULL != writefds && FD_ISSET(i, writefds))
+                        events |= POLLOUT;
+                if (0 == events && (NULL == exceptfds || !FD_ISSET(i, exceptfds)))
+                        continue;
+                fds[n].fd = i;
+                fds[n].events = events;
+                fds[n].revents = 0;
+                n++;
+        }
+        if (NULL != timeout)
+                ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+
+        if (0 > (ret = poll(fds, n, ms)))
+                return -1;
+        for (i = 0; i < n; i++) {
+                if (fds[i].revents & POLLNVAL) {
+                        errno = EBADF;
+                        return -1;
+                }
+        }
+
+        if (NULL != readfds)
+                FD_ZERO(readfds);
+        if (NULL != writefds)
+                FD_ZERO(writefds);
+        if (NULL != exceptfds)
+                FD_ZERO(exceptfds);
+        /* a descriptor counts once for each set it is left in */
+        for (i = ret = 0; i < n; i++) {
+                int fd = fds[i].fd;
+
+                if (NULL != readfds && (fds[i].revents & (POLLIN | POLLHUP))
+                    && (fds[i].events & POLLIN)) {
+                        FD_SET(fd, readfds);
+                        ret++;
+                }
+                if (NULL != writefds && (fds[i].revents & (POLLOUT | POLLERR))
+                    && (fds[i].events & POLLOUT)) {
+                        FD_SET(fd, writefds);
+                        ret++;
+                }
+                if (NULL != exceptfds && (fds[i].revents & (POLLERR | POLLHUP))) {
+                        FD_SET(fd, exceptfds);
+                        ret++;
+                }
+        }
+        return ret;
+}
+
+int preadv(int fd, const struct iovec *iov, int iovcnt, off_t off)
+{
+        return iov_trap(SYS_preadv, fd, iov, iovcnt, off);
+}
+
+int pwritev(int fd, const struct iovec *iov, int iovcnt, off_t off)
+{
+        return iov_trap(SYS_pwritev, fd, iov, iovcnt, off);
+}
+
+int pread(int fd, void *buf, size_t nbytes, off_t off)
+{
+        pread_args_t args;
+
+        args.fd = fd;
+        args.buf = buf;
+        args.nbytes = nbytes;
+        args.off = off;
+
+        return trap(SYS_pread, (uint32_t) &args);
+}
+
+int pwrite(int fd, const void *buf, size_t nbytes, off_t off)
+{
+        pread_args_t args;
+
+        args.fd = fd;
+        args.buf = (void *) buf;
+        args.nbytes = nbytes;
+        args.off = off;
+
+        return trap(SYS_pwrite, (uint32_t) &args);
+}
+
 int close(int fd)
 {
         return trap(SYS_close, (uint32_t) fd);
@@ -258,6 +626,17 @@ int unlink(const char *path)
         return trap(SYS_unlink, (uint32_t) &args);
 }
 
+int unlinkat(int dirfd, const char *path, int flags)
+{
+        unlinkat_args_t args;
+
+        args.dirfd = dirfd;
+        args.path.as_len = strlen(path);
+        args.path.as_str = path;
+        args.flags = flags;
+        return trap(SYS_unlinkat, (uint32_t) &args);
+}
+
 int link(const char *from, const char *to)
 {
         link_args_t args;
@@ -290,9 +669,10 @@ int chdir(const char *path)
         return trap(SYS_chdir, (uint32_t) &args);
 }
 
+/* Read off the kernel data page, so it is as of the last clock tick */
 size_t get_free_mem(void)
 {
-        return (size_t) trap(SYS_get_free_mem, 0);
+        return (size_t) KDATA->kd_free_pages * KDATA->kd_page_size;
 }
 
 int execve(const char *filename, char *const argv[], char *const envp[])
@@ -334,6 +714,52 @@ int execve(const char *filename, char *const argv[], char *const envp[])
         return trap(SYS_execve, (uint32_t) &args);
 }
 
+/* Creates a child running filename, without copying this process the way
+ * fork() and execve() do. The child gets this process's open files.
+ * Returns the child's pid. */
+int spawn(const char *filename, char *const argv[], char *const envp[])
+{
+        execve_args_t           args;
+        int                     i, ret;
+
+        args.filename.as_len = strlen(filename);
+        args.filename.as_str = filename;
+
+        for (i = 0; argv[i] != NULL; i++)
+                ;
+        args.argv.av_len = i;
+        args.argv.av_vec = malloc((args.argv.av_len + 1) * sizeof(argstr_t));
+        for (i = 0; envp[i] != NULL; i++)
+                ;
+        args.envp.av_len = i;
+        args.envp.av_vec = malloc((args.envp.av_len + 1) * sizeof(argstr_t));
+        if (NULL == args.argv.av_vec || NULL == args.envp.av_vec) {
+                free(args.argv.av_vec);
+                free(args.envp.av_vec);
+                errno = ENOMEM;
+                return -1;
+        }
+
+        for (i = 0; argv[i] != NULL; i++) {
+                args.argv.av_vec[i].as_len = strlen(argv[i]);
+                args.argv.av_vec[i].as_str = argv[i];
+        }
+        args.argv.av_vec[i].as_len = 0;
+        args.argv.av_vec[i].as_str = NULL;
+        for (i = 0; envp[i] != NULL; i++) {
+                args.envp.av_vec[i].as_len = strlen(envp[i]);
+                args.envp.av_vec[i].as_str = envp[i];
+        }
+        args.envp.av_vec[i].as_len = 0;
+        args.envp.av_vec[i].as_str = NULL;
+
+        ret = trap(SYS_spawn, (uint32_t) &args);
+
+        free(args.argv.av_vec);
+        free(args.envp.av_vec);
+        return ret;
+}
+
 void thr_set_errno(int n)
 {
         trap(SYS_set_errno, (uint32_t) n);
@@ -395,12 +821,101 @@ stat(const char *path, struct stat *buf)
         return trap(SYS_stat, (uint32_t) &args);
 }
 
+int
+fstat(int fd, struct stat *buf)
+{
+        fstat_args_t args;
+
+        args.fd = fd;
+        args.buf = buf;
+
+        return trap(SYS_fstat, (uint32_t) &args);
+}
+
+int aio_setup(void)
+{
+        return trap(SYS_aio_setup, 0);
+}
+
+int aio_read(struct aiocb *cb)
+{
+        return trap(SYS_aio_read, (uint32_t) cb);
+}
+
+int aio_write(struct aiocb *cb)
+{
+        return trap(SYS_aio_write, (uint32_t) cb);
+}
+
+int aio_error(const struct aiocb *cb)
+{
+        return trap(SYS_aio_error, (uint32_t) cb);
+}
+
+int aio_return(struct aiocb *cb)
+{
+        return trap(SYS_aio_return, (uint32_t) cb);
+}
+
+int aio_suspend(const struct aiocb *const list[], int nent,
+                const struct timespec *timeout)
+{
+        aio_suspend_args_t args;
+
+        args.list = list;
+        args.nent = nent;
+        args.timeout = timeout;
+
+        return trap(SYS_aio_suspend, (uint32_t) &args);
+}
+
+int
+fstatat(int dirfd, const char *path, struct stat *buf, int flags)
+{
+        fstatat_args_t args;
+
+        args.dirfd = dirfd;
+        args.path.as_len = strlen(path);
+        args.path.as_str = path;
+        args.buf = buf;
+        args.flags = flags;
+
+        return trap(SYS_fstatat, (uint32_t) &args);
+}
+
+int
+fcntl(int fd, int cmd, ...)
+{
+        fcntl_args_t args;
+        va_list ap;
+
+        va_start(ap, cmd);
+        args.fd = fd;
+        args.cmd = cmd;
+        args.arg = (F_SETFL == cmd) ? va_arg(ap, int) : 0;
+        va_end(ap);
+
+        return trap(SYS_fcntl, (uint32_t) &args);
+}
+
 int
 pipe(int pipefd[2])
 {
         return trap(SYS_pipe, (uint32_t) pipefd);
 }
 
+int
+splice(int fdin, int fdout, size_t len)
+{
+        splice_args_t args;
+
+        args.fdin = fdin;
+        args.fdout = fdout;
+        args.len = len;
+
+        return trap(SYS_splice, (uint32_t) &args);
+}
+
 int
 uname(struct utsname *buf)
 {
@@ -415,3 +930,14 @@ debug(const char *str)
         argstr.as_str = str;
         return trap(SYS_debug, (uint32_t) &argstr);
 }
+
+int
+dbgmodes(const char *modes, char *buf, size_t len)
+{
+        dbgmodes_args_t args;
+        args.dma_modes.as_str = modes;
+        args.dma_modes.as_len = modes ? strlen(modes) : 0;
+        args.dma_buf = buf;
+        args.dma_len = len;
+        return trap(SYS_dbgmodes, (uint32_t) &args);
+}
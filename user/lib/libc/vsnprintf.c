@@ -78,12 +78,19 @@ static int skip_atoi(const char **s)
 #define SPECIAL 32              /* 0x */
 #define LARGE   64              /* use 'ABCDEF' instead of 'abcdef' */
 
+/* "00" to "99", for converting decimal two digits at a time */
+static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324"
+        "25262728293031323334353637383940414243444546474849"
+        "50515253545556575859606162636465666768697071727374"
+        "75767778798081828384858687888990919293949596979899";
+
 static char *number(char *buf, char *end, long long num, int base, int size, int precision, int type)
 {
         char c, sign, tmp[66];
         const char *digits;
-        const char small_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
-        const char large_digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+        static const char small_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+        static const char large_digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
         int i;
 
         digits = (type & LARGE) ? large_digits : small_digits;
@@ -115,15 +122,48 @@ static char *number(char *buf, char *end, long long num, int base, int size, int
         i = 0;
         if (num == 0) {
                 tmp[i++] = '0';
+        } else if (!(base & (base - 1))) {
+                /* a power of two needs no division at all */
+                unsigned long long num2 = (unsigned long long)num;
+                int shift = 0;
+                while ((1 << shift) < base)
+                        shift++;
+                while (num2 != 0) {
+                        tmp[i++] = digits[num2 & (base - 1)];
+                        num2 >>= shift;
+                }
         } else {
                 /* XXX KAF: force unsigned mod and div. */
-                /* XXX kernel does not support long long division */
+                /* the long long division is done in software, so only the
+                 * top of a number too big for 32 bits is done with it */
                 unsigned long long num2 = (unsigned long long)num;
                 unsigned int base2 = (unsigned int)base;
-                while (num2 != 0) {
+                unsigned int n;
+                while (num2 > 0xffffffffULL) {
                         tmp[i++] = digits[num2 % base2];
                         num2 /= base2;
                 }
+                n = (unsigned int)num2;
+                if (base2 == 10) {
+                        /* two digits a division */
+                        while (n >= 100) {
+                                const char *pair = &digit_pairs[2 * (n % 100)];
+                                n /= 100;
+                                tmp[i++] = pair[1];
+                                tmp[i++] = pair[0];
+                        }
+                        if (n >= 10) {
+                                tmp[i++] = digit_pairs[2 * n + 1];
+                                tmp[i++] = digit_pairs[2 * n];
+                        } else if (n != 0) {
+                                tmp[i++] = '0' + n;
+                        }
+                } else {
+                        while (n != 0) {
+                                tmp[i++] = digits[n % base2];
+                                n /= base2;
+                        }
+                }
         }
         if (i > precision)
                 precision = i;
@@ -197,7 +237,7 @@ int vsnprintf(char *buf, size_t size, const char *fmt, va_list args)
 {
         int len;
         unsigned long long num;
-        int i, base;
+        int base;
         char *str, *end, c;
         const char *s;
 
@@ -319,11 +359,9 @@ repeat:
                                                 ++str;
                                         }
                                 }
-                                for (i = 0; i < len; ++i) {
-                                        if (str <= end)
-                                                *str = *s;
-                                        ++str; ++s;
-                                }
+                                if (str <= end)
+                                        memcpy(str, s, MIN((size_t) len, (size_t) (end - str) + 1));
+                                str += len;
                                 while (len < field_width--) {
                                         if (str <= end)
                                                 *str = ' ';
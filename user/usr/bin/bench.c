@@ -0,0 +1,474 @@
+/*
+ * lmbench-style benchmarks of the system calls, the file system and the
+ * virtual memory system.
+ *
+ * bench                   run every benchmark
+ * bench <name> ...        run just the ones named
+ * bench -l                list them
+ *
+ * Each result is one line,
+ *
+ *      bench: <name> <value> <unit>
+ *
+ * the unit being cycles/op for the latencies and KB/Mcycle (kilobytes
+ * per million cycles) for the bandwidths, so that tools/bench/run.sh can
+ * pick them out of the rest of the console output. The times come from
+ * the time stamp counter, and each measurement is the best of a few
+ * runs, to leave out the ones a disk interrupt or the pager landed in.
+ *
+ * The file benchmarks work in BENCH_DIR, on whatever file system is
+ * mounted at /.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_PATH      "/usr/bin/bench"
+#define BENCH_DIR       "/bench.d"
+#define BENCH_FILE      BENCH_DIR "/data"
+
+/* The runs each measurement is the best of */
+#define BENCH_RUNS      3
+
+#define PAGE_SIZE       4096
+#define IO_SIZE         PAGE_SIZE
+#define FILE_SIZE       (1024 * 1024)
+#define MAP_PAGES       256
+#define PIPE_CHUNK      PAGE_SIZE
+#define PIPE_BYTES      (1024 * 1024)
+#define BENCH_NFILES    128
+
+static char buf[PIPE_CHUNK];
+/* "volatile" keeps the compiler from discarding reads of a mapping */
+static volatile char sink;
+
+static uint64_t
+rdtsc(void)
+{
+        uint32_t lo, hi;
+
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return ((uint64_t)hi << 32) | lo;
+}
+
+static void
+fail(const char *name, const char *what)
+{
+        fprintf(stderr, "bench: %s: %s: %s\n", name, what, strerror(errno));
+        exit(1);
+}
+
+static void
+report_latency(const char *name, uint64_t cycles, uint32_t ops)
+{
+        printf("bench: %s %llu cycles/op\n", name,
+               (unsigned long long)(cycles / ops));
+}
+
+static void
+report_bandwidth(const char *name, uint64_t cycles, uint32_t bytes)
+{
+        if (0 == cycles)
+                cycles = 1;
+        printf("bench: %s %llu KB/Mcycle\n", name,
+               (unsigned long long)((uint64_t)bytes * 1000000 / 1024 / cycles));
+}
+
+static uint64_t
+best(uint64_t a, uint64_t b)
+{
+        return (a < b) ? a : b;
+}
+
+static void
+reap(const char *name)
+{
+        int status;
+
+        if (0 > wait(&status))
+                fail(name, "wait");
+        if (0 != status) {
+                fprintf(stderr, "bench: %s: child exited with %d\n", name, status);
+                exit(1);
+        }
+}
+
+/* Processes */
+
+static void
+b_null(void)
+{
+        uint64_t start, min = ~0ULL;
+        int r, i;
+
+        for (r = 0; r < BENCH_RUNS; r++) {
+                start = rdtsc();
+                for (i = 0; i < 10000; i++)
+                        getpid();
+                min = best(min, rdtsc() - start);
+        }
+        report_latency("null_syscall", min, 10000);
+}
+
+static void
+b_fork(const char *name, int doexec)
+{
+        static char *argv[] = { "bench", "-x", NULL };
+        static char *envp[] = { NULL };
+        uint64_t start, min = ~0ULL;
+        int r, i, pid;
+
+        for (r = 0; r < BENCH_RUNS; r++) {
+                start = rdtsc();
+                for (i = 0; i < 100; i++) {
+                        if (0 > (pid = fork()))
+                                fail(name, "fork");
+                        if (0 == pid) {
+                                if (doexec)
+                                        execve(BENCH_PATH, argv, envp);
+                                _exit(0);
+                        }
+                        reap(name);
+                }
+                min = best(min, rdtsc() - start);
+        }
+        report_latency(name, min, 100);
+}
+
+static void
+b_fork_exit(void)
+{
+        b_fork("fork_exit", 0);
+}
+
+static void
+b_fork_exec(void)
+{
+        b_fork("fork_exec", 1);
+}
+
+/* Pipes */
+
+static void
+b_pipe_lat(void)
+{
+        uint64_t start, min = ~0ULL;
+        int there[2], back[2];
+        int r, i, pid;
+        char c = 0;
+
+        if (0 > pipe(there) || 0 > pipe(back))
+                fail("pipe_lat", "pipe");
+        if (0 > (pid = fork()))
+                fail("pipe_lat", "fork");
+        if (0 == pid) {
+                /* echo every byte back until the parent closes its end */
+                while (1 == read(there[0], &c, 1))
+                        write(back[1], &c, 1);
+                _exit(0);
+        }
+        for (r = 0; r < BENCH_RUNS; r++) {
+                start = rdtsc();
+                for (i = 0; i < 1000; i++) {
+                        if (1 != write(there[1], &c, 1) || 1 != read(back[0], &c, 1))
+                                fail("pipe_lat", "read/write");
+                }
+                min = best(min, rdtsc() - start);
+        }
+        close(there[1]);
+        reap("pipe_lat");
+        close(there[0]);
+        close(back[0]);
+        close(back[1]);
+        report_latency("pipe_lat", min, 1000);
+}
+
+static void
+b_pipe_bw(void)
+{
+        uint64_t start, min = ~0ULL;
+        int fds[2];
+        int r, n, left, pid;
+
+        for (r = 0; r < BENCH_RUNS; r++) {
+                if (0 > pipe(fds))
+                        fail("pipe_bw", "pipe");
+                if (0 > (pid = fork()))
+                        fail("pipe_bw", "fork");
+                if (0 == pid) {
+                        close(fds[0]);
+                        for (left = PIPE_BYTES; left > 0; left -= PIPE_CHUNK)
+                                write(fds[1], buf, PIPE_CHUNK);
+                        _exit(0);
+                }
+                close(fds[1]);
+                start = rdtsc();
+                for (left = PIPE_BYTES; left > 0; left -= n) {
+                        if (0 >= (n = read(fds[0], buf, PIPE_CHUNK)))
+                                fail("pipe_bw", "read");
+                }
+                min = best(min, rdtsc() - start);
+                close(fds[0]);
+                reap("pipe_bw");
+        }
+        report_bandwidth("pipe_bw", min, PIPE_BYTES);
+}
+
+/* Files */
+
+static void
+file_name(char *name, int i)
+{
+        sprintf(name, BENCH_DIR "/f%d", i);
+}
+
+static void
+b_create_delete(void)
+{
+        uint64_t start, cmin = ~0ULL, dmin = ~0ULL;
+        char name[32];
+        int r, i, fd;
+
+        for (r = 0; r < BENCH_RUNS; r++) {
+                start = rdtsc();
+                for (i = 0; i < BENCH_NFILES; i++) {
+                        file_name(name, i);
+                        if (0 > (fd = open(name, O_WRONLY | O_CREAT, 0)))
+                                fail("create", name);
+                        close(fd);
+                }
+                cmin = best(cmin, rdtsc() - start);
+
+                start = rdtsc();
+                for (i = 0; i < BENCH_NFILES; i++) {
+                        file_name(name, i);
+                        if (0 > unlink(name))
+                                fail("delete", name);
+                }
+                dmin = best(dmin, rdtsc() - start);
+        }
+        report_latency("create", cmin, BENCH_NFILES);
+        report_latency("delete", dmin, BENCH_NFILES);
+}
+
+/* The blocks of the file in a random order which visits every one */
+static void
+shuffle(int *blocks, int n)
+{
+        uint32_t seed = 12345;
+        int i, j, t;
+
+        for (i = 0; i < n; i++)
+                blocks[i] = i;
+        for (i = n - 1; i > 0; i--) {
+                seed = seed * 1103515245 + 12345;
+                j = (seed >> 8) % (i + 1);
+                t = blocks[i];
+                blocks[i] = blocks[j];
+                blocks[j] = t;
+        }
+}
+
+static void
+b_file_io(void)
+{
+        static int blocks[FILE_SIZE / IO_SIZE];
+        uint64_t start, swmin = ~0ULL, srmin = ~0ULL, rwmin = ~0ULL, rrmin = ~0ULL;
+        int r, i, fd;
+
+        shuffle(blocks, FILE_SIZE / IO_SIZE);
+        for (r = 0; r < BENCH_RUNS; r++) {
+                if (0 > (fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC, 0)))
+                        fail("file_io", BENCH_FILE);
+
+                start = rdtsc();
+                for (i = 0; i < FILE_SIZE / IO_SIZE; i++) {
+                        if (IO_SIZE != write(fd, buf, IO_SIZE))
+                                fail("seq_write", "write");
+                }
+                swmin = best(swmin, rdtsc() - start);
+
+                lseek(fd, 0, SEEK_SET);
+                start = rdtsc();
+                for (i = 0; i < FILE_SIZE / IO_SIZE; i++) {
+                        if (IO_SIZE != read(fd, buf, IO_SIZE))
+                                fail("seq_read", "read");
+                }
+                srmin = best(srmin, rdtsc() - start);
+
+                start = rdtsc();
+                for (i = 0; i < FILE_SIZE / IO_SIZE; i++) {
+                        if (IO_SIZE != pwrite(fd, buf, IO_SIZE, blocks[i] * IO_SIZE))
+                                fail("rand_write", "pwrite");
+                }
+                rwmin = best(rwmin, rdtsc() - start);
+
+                start = rdtsc();
+                for (i = 0; i < FILE_SIZE / IO_SIZE; i++) {
+                        if (IO_SIZE != pread(fd, buf, IO_SIZE, blocks[i] * IO_SIZE))
+                                fail("rand_read", "pread");
+                }
+                rrmin = best(rrmin, rdtsc() - start);
+
+                close(fd);
+        }
+        unlink(BENCH_FILE);
+        report_bandwidth("seq_write", swmin, FILE_SIZE);
+        report_bandwidth("seq_read", srmin, FILE_SIZE);
+        report_bandwidth("rand_write", rwmin, FILE_SIZE);
+        report_bandwidth("rand_read", rrmin, FILE_SIZE);
+}
+
+/* Virtual memory */
+
+/* Writes a byte to each page of the mapping */
+static uint64_t
+touch(char *addr, int npages)
+{
+        uint64_t start = rdtsc();
+        int i;
+
+        for (i = 0; i < npages; i++)
+                addr[i * PAGE_SIZE] = 1;
+        return rdtsc() - start;
+}
+
+static void
+b_mmap_fault(void)
+{
+        uint64_t start, amin = ~0ULL, fmin = ~0ULL;
+        char *addr;
+        int r, i, fd;
+
+        /* anonymous memory: a zeroed page per fault */
+        for (r = 0; r < BENCH_RUNS; r++) {
+                addr = mmap(NULL, MAP_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANON, -1, 0);
+                if (MAP_FAILED == addr)
+                        fail("mmap_anon", "mmap");
+                amin = best(amin, touch(addr, MAP_PAGES));
+                munmap(addr, MAP_PAGES * PAGE_SIZE);
+        }
+
+        /* a file: its pages are cached after the first run, so this is
+         * the cost of mapping one in */
+        if (0 > (fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC, 0)))
+                fail("mmap_file", BENCH_FILE);
+        for (i = 0; i < MAP_PAGES; i++) {
+                if (PAGE_SIZE != write(fd, buf, PAGE_SIZE))
+                        fail("mmap_file", "write");
+        }
+        for (r = 0; r < BENCH_RUNS; r++) {
+                addr = mmap(NULL, MAP_PAGES * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+                if (MAP_FAILED == addr)
+                        fail("mmap_file", "mmap");
+                start = rdtsc();
+                for (i = 0; i < MAP_PAGES; i++)
+                        sink = addr[i * PAGE_SIZE];
+                fmin = best(fmin, rdtsc() - start);
+                munmap(addr, MAP_PAGES * PAGE_SIZE);
+        }
+        close(fd);
+        unlink(BENCH_FILE);
+
+        report_latency("mmap_anon", amin, MAP_PAGES);
+        report_latency("mmap_file", fmin, MAP_PAGES);
+}
+
+static void
+b_cow(void)
+{
+        uint64_t min = ~0ULL;
+        int fds[2];
+        char *addr;
+        uint64_t cycles;
+        int r, pid;
+
+        addr = mmap(NULL, MAP_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (MAP_FAILED == addr)
+                fail("cow", "mmap");
+        touch(addr, MAP_PAGES);
+
+        for (r = 0; r < BENCH_RUNS; r++) {
+                if (0 > pipe(fds))
+                        fail("cow", "pipe");
+                if (0 > (pid = fork()))
+                        fail("cow", "fork");
+                if (0 == pid) {
+                        /* every page is shared with the parent, so each
+                         * write copies one */
+                        cycles = touch(addr, MAP_PAGES);
+                        write(fds[1], &cycles, sizeof(cycles));
+                        _exit(0);
+                }
+                if (sizeof(cycles) != read(fds[0], &cycles, sizeof(cycles)))
+                        fail("cow", "read");
+                min = best(min, cycles);
+                close(fds[0]);
+                close(fds[1]);
+                reap("cow");
+        }
+        munmap(addr, MAP_PAGES * PAGE_SIZE);
+        report_latency("cow_fault", min, MAP_PAGES);
+}
+
+static struct {
+        const char *name;
+        void (*run)(void);
+} benches[] = {
+        { "null", b_null },
+        { "fork_exit", b_fork_exit },
+        { "fork_exec", b_fork_exec },
+        { "pipe_lat", b_pipe_lat },
+        { "pipe_bw", b_pipe_bw },
+        { "create", b_create_delete },
+        { "file_io", b_file_io },
+        { "mmap", b_mmap_fault },
+        { "cow", b_cow },
+};
+#define NBENCHES ((int)(sizeof(benches) / sizeof(benches[0])))
+
+int
+main(int argc, char **argv)
+{
+        int i, j;
+
+        /* what fork_exec runs */
+        if (2 == argc && !strcmp(argv[1], "-x"))
+                return 0;
+        if (2 == argc && !strcmp(argv[1], "-l")) {
+                for (i = 0; i < NBENCHES; i++)
+                        printf("%s\n", benches[i].name);
+                return 0;
+        }
+        for (i = 1; i < argc; i++) {
+                for (j = 0; j < NBENCHES; j++)
+                        if (!strcmp(argv[i], benches[j].name))
+                                break;
+                if (NBENCHES == j) {
+                        fprintf(stderr, "bench: no benchmark %s (bench -l lists them)\n", argv[i]);
+                        return 1;
+                }
+        }
+
+        if (0 > mkdir(BENCH_DIR, 0) && EEXIST != errno)
+                fail("bench", BENCH_DIR);
+        printf("bench: begin\n");
+        for (j = 0; j < NBENCHES; j++) {
+                for (i = 1; i < argc; i++)
+                        if (!strcmp(argv[i], benches[j].name))
+                                break;
+                if (1 == argc || i < argc)
+                        benches[j].run();
+        }
+        printf("bench: end\n");
+        rmdir(BENCH_DIR);
+        return 0;
+}
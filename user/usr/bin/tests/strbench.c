@@ -0,0 +1,197 @@
+/*
+ *  File: strbench.c
+ *  Desc: Microbenchmark for the libc string and memory routines. Each
+ *        routine is timed against the byte-at-a-time loop it replaced,
+ *        at a few sizes, and reported in bytes per cycle.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Roughly how many bytes each measurement processes, small enough to
+ * keep every measurement well within 32 bits of cycles */
+#define BENCH_BYTES     (256 * 1024)
+#define BENCH_BUFSIZE   8192
+
+static char srcbuf[BENCH_BUFSIZE + 16];
+static char dstbuf[BENCH_BUFSIZE + 16];
+
+static const size_t sizes[] = { 8, 64, 512, 4096 };
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* The low 32 bits of the time stamp counter */
+static uint32_t rdtsc(void)
+{
+        uint32_t lo, hi;
+
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return lo;
+}
+
+/* The old routines, for comparison */
+
+static size_t byte_strlen(const char *s)
+{
+        const char *sc;
+
+        for (sc = s; *sc != '\0'; ++sc)
+                /* nothing */;
+        return sc - s;
+}
+
+static char *byte_strchr(const char *s, int c)
+{
+        for (; *s != (char) c; ++s)
+                if (*s == '\0')
+                        return NULL;
+        return (char *)s;
+}
+
+static void *byte_memchr(const void *s, int c, size_t count)
+{
+        const unsigned char *p = s;
+
+        for (; count; count--, p++)
+                if (*p == (unsigned char) c)
+                        return (void *) p;
+        return NULL;
+}
+
+static void *byte_memcpy(void *dest, const void *src, size_t count)
+{
+        char *tmp = (char *) dest;
+        const char *s = src;
+
+        while (count--)
+                *tmp++ = *s++;
+        return dest;
+}
+
+static void *byte_memmove(void *dest, const void *src, size_t count)
+{
+        char *d = (char *) dest;
+        const char *s = src;
+
+        if (d <= s || d >= s + count) {
+                while (count--)
+                        *d++ = *s++;
+        } else {
+                d += count;
+                s += count;
+                while (count--)
+                        *--d = *--s;
+        }
+        return dest;
+}
+
+/* Each test runs its routine once over n bytes; "volatile" keeps the
+ * compiler from discarding the results */
+static volatile size_t sink;
+
+static void t_strlen(size_t (*fn)(const char *), size_t n)
+{
+        srcbuf[n] = '\0';
+        sink = fn(srcbuf);
+        srcbuf[n] = 'a';
+}
+
+static void t_strchr(char *(*fn)(const char *, int), size_t n)
+{
+        srcbuf[n] = '\0';
+        sink = (size_t) fn(srcbuf, 'z');
+        srcbuf[n] = 'a';
+}
+
+static void t_memchr(void *(*fn)(const void *, int, size_t), size_t n)
+{
+        sink = (size_t) fn(srcbuf, 'z', n);
+}
+
+static void t_memcpy(void *(*fn)(void *, const void *, size_t), size_t n)
+{
+        sink = (size_t) fn(dstbuf, srcbuf, n);
+}
+
+static void t_memmove(void *(*fn)(void *, const void *, size_t), size_t n)
+{
+        /* overlapping, with the destination above the source */
+        sink = (size_t) fn(srcbuf + 4, srcbuf, n);
+}
+
+typedef enum { STRLEN, STRCHR, MEMCHR, MEMCPY, MEMMOVE } routine_t;
+
+static void run(routine_t r, int old, size_t n)
+{
+        switch (r) {
+                case STRLEN:
+                        t_strlen(old ? byte_strlen : strlen, n);
+                        break;
+                case STRCHR:
+                        t_strchr(old ? byte_strchr : strchr, n);
+                        break;
+                case MEMCHR:
+                        t_memchr(old ? byte_memchr : memchr, n);
+                        break;
+                case MEMCPY:
+                        t_memcpy(old ? byte_memcpy : memcpy, n);
+                        break;
+                case MEMMOVE:
+                        t_memmove(old ? byte_memmove : memmove, n);
+                        break;
+        }
+}
+
+/* Returns the number of cycles taken to process BENCH_BYTES bytes, n at
+ * a time */
+static uint32_t measure(routine_t r, int old, size_t n)
+{
+        uint32_t iters = BENCH_BYTES / n;
+        uint32_t i, start;
+
+        run(r, old, n); /* warm up */
+        start = rdtsc();
+        for (i = 0; i < iters; i++)
+                run(r, old, n);
+        return rdtsc() - start;
+}
+
+/* Prints bytes per cycle with two decimals, without floating point */
+static void print_rate(uint32_t cycles)
+{
+        uint32_t hundredths;
+
+        if (0 == cycles)
+                cycles = 1;
+        hundredths = (BENCH_BYTES * 100U) / cycles;
+        printf(" %5u.%02u", hundredths / 100, hundredths % 100);
+}
+
+int main(int argc, char **argv)
+{
+        static const char *names[] = { "strlen", "strchr", "memchr", "memcpy", "memmove" };
+        int r;
+        size_t i;
+
+        memset(srcbuf, 'a', sizeof(srcbuf));
+
+        printf("bytes/cycle, byte loop (old) vs libc (new)\n");
+        printf("%-8s", "");
+        for (i = 0; i < NSIZES; i++)
+                printf("      old      new");
+        printf("\n%-8s", "size");
+        for (i = 0; i < NSIZES; i++)
+                printf("%18u", sizes[i]);
+        printf("\n");
+
+        for (r = STRLEN; r <= MEMMOVE; r++) {
+                printf("%-8s", names[r]);
+                for (i = 0; i < NSIZES; i++) {
+                        print_rate(measure((routine_t) r, 1, sizes[i]));
+                        print_rate(measure((routine_t) r, 0, sizes[i]));
+                }
+                printf("\n");
+        }
+        return 0;
+}
@@ -13,6 +13,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <weenix/kdata.h>
 
 static void check_failed(const char *cmd)
 {
@@ -403,8 +404,347 @@ void brk_test()
         (void) printf("-- brk test passed\n");
 }
 
+/*
+ * The load generator, stress -l [-w workers] [-t seconds] [-o op,op...]:
+ * workers processes at once each run the named (by default all) of the
+ * operations below in a random mix, back to back, for the given time,
+ * and then it reports each operation's count, rate, and the 50th, 90th
+ * and 99th percentile and worst of its latencies, and the total rate.
+ * The latencies are in cycles of the time stamp counter, as bench's are;
+ * the rates are per second of the kernel's clock, from the kernel data
+ * page. Each worker keeps up to LOAD_SAMPLES of its latencies of each
+ * operation, a uniform sample of them once it has done more, in memory
+ * shared with the parent (MAP_SHARED | MAP_ANON), which adds them up.
+ */
+
+#define LOAD_MAX_WORKERS        16
+#define LOAD_SAMPLES            512
+#define LOAD_PAGES              4
+#define LOAD_PAGE_SIZE          4096
+
+typedef struct load_worker {
+        int             lw_id;
+        int             lw_nullfd;
+        int             lw_zerofd;
+        int             lw_filefd;
+        char            lw_file[32];
+} load_worker_t;
+
+typedef struct load_op {
+        const char      *lo_name;
+        void            (*lo_func)(load_worker_t *lw);
+} load_op_t;
+
+typedef struct load_stats {
+        uint32_t        ls_count;
+        uint32_t        ls_max;
+        uint32_t        ls_samples[LOAD_SAMPLES];
+} load_stats_t;
+
+static void load_fork(load_worker_t *lw);
+static void load_zero(load_worker_t *lw);
+static void load_anon(load_worker_t *lw);
+static void load_brk(load_worker_t *lw);
+static void load_null(load_worker_t *lw);
+static void load_file(load_worker_t *lw);
+
+static load_op_t load_ops[] = {
+        { "fork",       load_fork },
+        { "zero",       load_zero },
+        { "anon",       load_anon },
+        { "brk",        load_brk },
+        { "null",       load_null },
+        { "file",       load_file }
+};
+#define LOAD_NOPS       ((int) (sizeof(load_ops) / sizeof(load_ops[0])))
+
+static uint64_t load_rdtsc(void)
+{
+        uint32_t lo, hi;
+
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return ((uint64_t)hi << 32) | lo;
+}
+
+static uint32_t load_msecs(void)
+{
+        return KDATA->kd_jiffies * KDATA->kd_tick_msecs;
+}
+
+/* Writes a word to each page, so that each is faulted in (or copied) */
+static void load_touch(char *addr, int npages)
+{
+        int i;
+
+        for (i = 0; i < npages; i++)
+                *(volatile int *)(addr + i * LOAD_PAGE_SIZE) = i;
+}
+
+/* cow_fork, without the printing: the child writes to a page it shares
+ * with the parent */
+static void load_fork(load_worker_t *lw)
+{
+        static int foo;
+        int status, pid;
+
+        if (0 > (pid = fork()))
+                check_failed("fork");
+        if (0 == pid) {
+                foo = 1;
+                exit(0);
+        }
+        if (0 > wait(&status))
+                check_failed("wait");
+        if (0 != status || foo)
+                check_failed("cow fork");
+}
+
+static void load_map(int flags, int fd)
+{
+        void *addr;
+
+        addr = mmap(0, LOAD_PAGES * LOAD_PAGE_SIZE, PROT_READ | PROT_WRITE, flags, fd, 0);
+        if (MAP_FAILED == addr)
+                check_failed("mmap");
+        load_touch((char *) addr, LOAD_PAGES);
+        if (munmap(addr, LOAD_PAGES * LOAD_PAGE_SIZE))
+                check_failed("munmap");
+}
+
+/* zero_test's mapping of /dev/zero */
+static void load_zero(load_worker_t *lw)
+{
+        load_map(MAP_PRIVATE, lw->lw_zerofd);
+}
+
+static void load_anon(load_worker_t *lw)
+{
+        load_map(MAP_PRIVATE | MAP_ANON, -1);
+}
+
+/* brk_test's growing and shrinking of the heap */
+static void load_brk(load_worker_t *lw)
+{
+        const void *brk_failed = (void *) - 1;
+        void *addr;
+
+        if (brk_failed == (addr = sbrk(LOAD_PAGES * LOAD_PAGE_SIZE)))
+                check_failed("sbrk alloc");
+        load_touch((char *) addr, LOAD_PAGES);
+        if (brk_failed == sbrk(-LOAD_PAGES * LOAD_PAGE_SIZE))
+                check_failed("sbrk dealloc");
+}
+
+/* null_test's write and read of /dev/null, and a read of /dev/zero */
+static void load_null(load_worker_t *lw)
+{
+        char buf[256];
+
+        if (sizeof(buf) != write(lw->lw_nullfd, buf, sizeof(buf)))
+                check_failed("write");
+        if (0 != read(lw->lw_nullfd, buf, sizeof(buf)))
+                check_failed("read");
+        if (sizeof(buf) != read(lw->lw_zerofd, buf, sizeof(buf)))
+                check_failed("read");
+}
+
+/* mmap_test's shared mapping of a file, which is written through */
+static void load_file(load_worker_t *lw)
+{
+        load_map(MAP_SHARED, lw->lw_filefd);
+}
+
+static void load_worker(int id, const int *ops, int nops, uint32_t msecs,
+                        load_stats_t *stats)
+{
+        static char page[LOAD_PAGE_SIZE];
+        load_worker_t lw;
+        load_stats_t *ls;
+        uint64_t start;
+        uint32_t until, t, j;
+        int i, op;
+
+        lw.lw_id = id;
+        if (0 > (lw.lw_nullfd = open("/dev/null", O_RDWR, 0)))
+                check_failed("open");
+        if (0 > (lw.lw_zerofd = open("/dev/zero", O_RDWR, 0)))
+                check_failed("open");
+        (void) snprintf(lw.lw_file, sizeof(lw.lw_file), "/stress-load.%d", id);
+        if (0 > (lw.lw_filefd = open(lw.lw_file, O_RDWR | O_CREAT, 0)))
+                check_failed("open");
+        for (i = 0; i < LOAD_PAGES; i++) {
+                if (sizeof(page) != write(lw.lw_filefd, page, sizeof(page)))
+                        check_failed("write");
+        }
+        srand(id + 1);
+
+        until = load_msecs() + msecs;
+        while ((int32_t)(until - load_msecs()) > 0) {
+                op = ops[rand() % nops];
+                ls = &stats[op];
+                start = load_rdtsc();
+                load_ops[op].lo_func(&lw);
+                t = (uint32_t)(load_rdtsc() - start);
+
+                if (t > ls->ls_max)
+                        ls->ls_max = t;
+                /* a uniform sample of the latencies, once there are
+                 * more than it holds */
+                if (ls->ls_count < LOAD_SAMPLES)
+                        ls->ls_samples[ls->ls_count] = t;
+                else if ((j = (uint32_t) rand() % (ls->ls_count + 1)) < LOAD_SAMPLES)
+                        ls->ls_samples[j] = t;
+                ls->ls_count++;
+        }
+
+        (void) close(lw.lw_nullfd);
+        (void) close(lw.lw_zerofd);
+        (void) close(lw.lw_filefd);
+        (void) unlink(lw.lw_file);
+}
+
+static void load_sort(uint32_t *v, int n)
+{
+        int gap, i, j;
+        uint32_t x;
+
+        for (gap = n / 2; gap > 0; gap /= 2) {
+                for (i = gap; i < n; i++) {
+                        x = v[i];
+                        for (j = i; j >= gap && v[j - gap] > x; j -= gap)
+                                v[j] = v[j - gap];
+                        v[j] = x;
+                }
+        }
+}
+
+static void load_report(load_stats_t *all, int nworkers, const int *ops,
+                        int nops, uint32_t msecs)
+{
+        static uint32_t samples[LOAD_MAX_WORKERS * LOAD_SAMPLES];
+        load_stats_t *ls;
+        uint32_t count, max, total = 0;
+        int i, w, n;
+
+        if (0 == msecs)
+                msecs = 1;
+        (void) printf("stress: %-6s %8s %8s %10s %10s %10s %10s\n", "op", "count",
+                      "ops/s", "p50", "p90", "p99", "max");
+        for (i = 0; i < nops; i++) {
+                count = max = 0;
+                n = 0;
+                for (w = 0; w < nworkers; w++) {
+                        ls = &all[w * LOAD_NOPS + ops[i]];
+                        count += ls->ls_count;
+                        if (ls->ls_max > max)
+                                max = ls->ls_max;
+                        memcpy(samples + n, ls->ls_samples,
+                               MIN(ls->ls_count, LOAD_SAMPLES) * sizeof(uint32_t));
+                        n += MIN(ls->ls_count, LOAD_SAMPLES);
+                }
+                total += count;
+                if (0 == n) {
+                        (void) printf("stress: %-6s %8u\n", load_ops[ops[i]].lo_name, count);
+                        continue;
+                }
+                /* (the workers' samples are weighted alike, whatever
+                 * their counts) */
+                load_sort(samples, n);
+                (void) printf("stress: %-6s %8u %8u %10u %10u %10u %10u\n",
+                              load_ops[ops[i]].lo_name, count,
+                              (uint32_t)((uint64_t) count * 1000 / msecs),
+                              samples[n / 2], samples[n * 9 / 10], samples[n * 99 / 100], max);
+        }
+        (void) printf("stress: %u ops in %u ms by %d workers, %u ops/s (latencies in cycles)\n",
+                      total, msecs, nworkers, (uint32_t)((uint64_t) total * 1000 / msecs));
+}
+
+/* Takes a comma-separated list of operation names into ops */
+static int load_parse_ops(const char *list, int *ops)
+{
+        const char *end;
+        size_t len;
+        int i, nops = 0;
+
+        for (; '\0' != *list; list = ('\0' == *end) ? end : end + 1) {
+                if (NULL == (end = strchr(list, ',')))
+                        end = list + strlen(list);
+                len = end - list;
+                for (i = 0; i < LOAD_NOPS; i++) {
+                        if (len == strlen(load_ops[i].lo_name)
+                            && 0 == strncmp(list, load_ops[i].lo_name, len))
+                                break;
+                }
+                if (LOAD_NOPS == i || LOAD_NOPS == nops)
+                        return -1;
+                ops[nops++] = i;
+        }
+        return nops;
+}
+
+static int load_main(int argc, char **argv)
+{
+        int ops[LOAD_NOPS];
+        int nworkers = 4, seconds = 10, nops = LOAD_NOPS;
+        int i, status, failed = 0;
+        load_stats_t *all;
+        size_t len;
+        uint32_t start;
+
+        for (i = 0; i < LOAD_NOPS; i++)
+                ops[i] = i;
+        for (i = 0; i < argc; i += 2) {
+                if (i + 1 == argc)
+                        goto usage;
+                if (!strcmp(argv[i], "-w"))
+                        nworkers = atoi(argv[i + 1]);
+                else if (!strcmp(argv[i], "-t"))
+                        seconds = atoi(argv[i + 1]);
+                else if (!strcmp(argv[i], "-o"))
+                        nops = load_parse_ops(argv[i + 1], ops);
+                else
+                        goto usage;
+        }
+        if (0 >= nworkers || LOAD_MAX_WORKERS < nworkers || 0 >= seconds
+            || 0 >= nops)
+                goto usage;
+
+        len = nworkers * LOAD_NOPS * sizeof(load_stats_t);
+        all = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+        if (MAP_FAILED == all)
+                check_failed("mmap");
+        memset(all, 0, len);
+
+        (void) printf("stress: %d workers for %d seconds\n", nworkers, seconds);
+        start = load_msecs();
+        for (i = 0; i < nworkers; i++) {
+                if (!myfork()) {
+                        load_worker(i, ops, nops, seconds * 1000, all + i * LOAD_NOPS);
+                        exit(0);
+                }
+        }
+        for (i = 0; i < nworkers; i++) {
+                if (0 > wait(&status))
+                        check_failed("wait");
+                if (0 != status)
+                        failed++;
+        }
+        load_report(all, nworkers, ops, nops, load_msecs() - start);
+        if (failed)
+                (void) printf("stress: %d workers failed\n", failed);
+        (void) munmap(all, len);
+        return failed ? 1 : 0;
+
+usage:
+        (void) printf("usage: stress -l [-w workers] [-t seconds] [-o op,op...]\n");
+        return 1;
+}
+
 int main(int argc, char **argv)
 {
+        if (1 < argc && !strcmp(argv[1], "-l"))
+                return load_main(argc - 2, argv + 2);
+
         (void) printf("Congrats!  You're running this executable.\n");
         (void) printf("Now let's see how you handle the tests...\n");
 
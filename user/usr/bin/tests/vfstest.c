@@ -9,9 +9,11 @@
 #include "util/debug.h"
 #include "util/string.h"
 #include "util/printf.h"
+#include "util/time.h"
 
 #include "proc/proc.h"
 #include "proc/kthread.h"
+#include "proc/sched.h"
 
 #include "fs/dirent.h"
 #include "fs/vfs_syscall.h"
@@ -22,6 +24,7 @@
 #include "mm/kmalloc.h"
 
 #include "test/usertest.h"
+#include "test/vfstest/main.h"
 #include "test/vfstest/vfstest.h"
 
 #undef __VM__
@@ -35,9 +38,12 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <weenix/kdata.h>
 #include <weenix/syscall.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <stdio.h>
 
 #include <test/test.h>
@@ -711,6 +717,442 @@ vfstest_read(void)
         syscall_success(chdir(".."));
 }
 
+#ifndef __KERNEL__
+static void
+vfstest_iov(void)
+{
+        int fd, ret;
+        char a[8], b[8], c[8];
+        struct iovec iov[3];
+        void *bad;
+
+        syscall_success(mkdir("iov", 0777));
+        syscall_success(chdir("iov"));
+
+        /* a page which is in user space but not mapped, so that a copy
+         * to or from it faults */
+        bad = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        test_assert(MAP_FAILED != bad, "mmap failed");
+        syscall_success(munmap(bad, 4096));
+
+        /* writev gathers the segments in order, skipping empty ones */
+        syscall_success(fd = open("file01", O_RDWR | O_CREAT, 0));
+        iov[0].iov_base = "hello";
+        iov[0].iov_len = 5;
+        iov[1].iov_base = NULL;
+        iov[1].iov_len = 0;
+        iov[2].iov_base = " world";
+        iov[2].iov_len = 6;
+        syscall_success(ret = writev(fd, iov, 3));
+        test_assert(11 == ret, "writev returned %d", ret);
+        test_fpos(fd, 11);
+
+        /* readv scatters, and a short file fills only the first segments */
+        syscall_success(lseek(fd, 0, SEEK_SET));
+        iov[0].iov_base = a;
+        iov[0].iov_len = 4;
+        iov[1].iov_base = b;
+        iov[1].iov_len = 4;
+        iov[2].iov_base = c;
+        iov[2].iov_len = sizeof(c);
+        syscall_success(ret = readv(fd, iov, 3));
+        test_assert(11 == ret, "readv returned %d", ret);
+        test_assert(0 == memcmp(a, "hell", 4) && 0 == memcmp(b, "o wo", 4)
+                    && 0 == memcmp(c, "rld", 3), "readv data incorrect");
+        syscall_success(ret = readv(fd, iov, 3));
+        test_assert(0 == ret, "readv at end of file returned %d", ret);
+
+        /* pread and pwrite leave the file position alone */
+        syscall_success(lseek(fd, 2, SEEK_SET));
+        syscall_success(ret = pwrite(fd, "J", 1, 0));
+        test_assert(1 == ret, "pwrite returned %d", ret);
+        syscall_success(ret = pread(fd, a, 5, 0));
+        test_assert(5 == ret && 0 == memcmp(a, "Jello", 5), "pread returned %d", ret);
+        syscall_success(ret = pread(fd, a, sizeof(a), 9));
+        test_assert(2 == ret && 0 == memcmp(a, "ld", 2), "short pread returned %d", ret);
+        syscall_success(ret = pread(fd, a, sizeof(a), 20));
+        test_assert(0 == ret, "pread past end of file returned %d", ret);
+        test_fpos(fd, 2);
+        syscall_fail(pread(fd, a, 1, -1), EINVAL);
+        syscall_fail(pwrite(fd, a, 1, -1), EINVAL);
+
+        /* bad vectors */
+        syscall_fail(readv(fd, iov, -1), EINVAL);
+        syscall_fail(readv(fd, iov, UIO_MAXIOV + 1), EINVAL);
+        syscall_fail(readv(fd, bad, 1), EFAULT);
+        iov[0].iov_base = a;
+        iov[0].iov_len = 0x7fffffff;
+        iov[1].iov_base = b;
+        iov[1].iov_len = 2;
+        syscall_fail(readv(fd, iov, 2), EINVAL);
+        syscall_fail(readv(-1, iov, 1), EBADF);
+
+        /* a segment which faults fails the whole call, and a writev
+         * writes nothing of it */
+        iov[0].iov_base = "more";
+        iov[0].iov_len = 4;
+        iov[1].iov_base = bad;
+        iov[1].iov_len = 4;
+        syscall_success(lseek(fd, 0, SEEK_END));
+        syscall_fail(writev(fd, iov, 2), EFAULT);
+        test_fpos(fd, 11);
+        syscall_fail(pwrite(fd, bad, 4, 0), EFAULT);
+        syscall_fail(pread(fd, bad, 4, 0), EFAULT);
+        syscall_success(close(fd));
+
+        syscall_success(unlink("file01"));
+        syscall_success(chdir(".."));
+}
+
+static void
+vfstest_at(void)
+{
+        int dfd, fd;
+        struct stat s;
+
+        syscall_success(mkdir("at", 0777));
+        syscall_success(chdir("at"));
+        syscall_success(mkdir("dir", 0777));
+        syscall_success(dfd = open("dir", O_RDONLY, 0));
+
+        /* paths are taken from the directory open as dirfd */
+        syscall_success(fd = openat(dfd, "file01", O_RDWR | O_CREAT, 0));
+        syscall_success(write(fd, "hello", 5));
+        syscall_success(close(fd));
+        syscall_success(fstatat(dfd, "file01", &s, 0));
+        test_assert(S_ISREG(s.st_mode) && 5 == s.st_size, "fstatat: size %d", s.st_size);
+        syscall_success(stat("dir/file01", &s));
+        test_assert(5 == s.st_size, "stat: size %d", s.st_size);
+        syscall_fail(fstatat(dfd, "dir", &s, 0), ENOENT);
+
+        /* and from the current directory for AT_FDCWD */
+        syscall_success(fd = openat(AT_FDCWD, "dir/file01", O_RDONLY, 0));
+        read_fd(fd, 10, "hello");
+        syscall_success(fstatat(AT_FDCWD, "dir", &s, 0));
+        test_assert(S_ISDIR(s.st_mode), "fstatat(AT_FDCWD) of a directory");
+
+        /* dirfd must be an open directory */
+        syscall_fail(openat(-1, "file01", O_RDONLY, 0), EBADF);
+        syscall_fail(fstatat(-1, "file01", &s, 0), EBADF);
+        syscall_fail(unlinkat(-1, "file01", 0), EBADF);
+        syscall_fail(openat(fd, "file01", O_RDONLY, 0), ENOTDIR);
+        syscall_fail(fstatat(fd, "file01", &s, 0), ENOTDIR);
+        syscall_fail(unlinkat(fd, "file01", 0), ENOTDIR);
+        syscall_success(close(fd));
+        syscall_fail(openat(fd, "file01", O_RDONLY, 0), EBADF);
+
+        /* bad flags */
+        syscall_fail(fstatat(dfd, "file01", &s, 1), EINVAL);
+        syscall_fail(unlinkat(dfd, "file01", ~AT_REMOVEDIR), EINVAL);
+
+        /* unlinkat removes files, and directories with AT_REMOVEDIR */
+        syscall_success(mkdir("dir/sub", 0777));
+        syscall_fail(unlinkat(dfd, "sub", 0), EISDIR);
+        syscall_success(unlinkat(dfd, "sub", AT_REMOVEDIR));
+        syscall_success(unlinkat(dfd, "file01", 0));
+        syscall_fail(fstatat(dfd, "file01", &s, 0), ENOENT);
+        syscall_fail(unlinkat(dfd, "file01", 0), ENOENT);
+        syscall_success(close(dfd));
+        syscall_success(unlinkat(AT_FDCWD, "dir", AT_REMOVEDIR));
+
+        syscall_success(chdir(".."));
+}
+
+static void
+vfstest_poll(void)
+{
+        struct pollfd fds[3];
+        int fd, closed, ret;
+#ifdef __PIPES__
+        int p[2];
+#endif
+
+        syscall_success(fd = open("poll01", O_RDWR | O_CREAT, 0));
+        syscall_success(closed = dup(fd));
+        syscall_success(close(closed));
+
+        /* a regular file is always ready, a negative fd is skipped and a
+         * closed one is POLLNVAL whatever was asked for */
+        fds[0].fd = fd;
+        fds[0].events = POLLIN | POLLOUT;
+        fds[1].fd = -1;
+        fds[1].events = POLLIN;
+        fds[2].fd = closed;
+        fds[2].events = POLLIN;
+        fds[1].revents = fds[2].revents = -1;
+        syscall_success(ret = poll(fds, 3, -1));
+        test_assert(2 == ret, "poll returned %d", ret);
+        test_assert((POLLIN | POLLOUT) == fds[0].revents, "revents %#x", fds[0].revents);
+        test_assert(0 == fds[1].revents, "revents %#x for fd -1", fds[1].revents);
+        test_assert(POLLNVAL == fds[2].revents, "revents %#x for a closed fd", fds[2].revents);
+
+        /* only what was asked for is reported */
+        fds[0].events = POLLOUT;
+        syscall_success(ret = poll(fds, 1, 0));
+        test_assert(1 == ret && POLLOUT == fds[0].revents, "revents %#x", fds[0].revents);
+        syscall_success(ret = poll(fds, 0, 0));
+        test_assert(0 == ret, "poll of nothing returned %d", ret);
+        syscall_fail(poll(fds, 0x10000, 0), EINVAL);
+        syscall_success(close(fd));
+        syscall_success(unlink("poll01"));
+
+#ifdef __PIPES__
+        /* an empty pipe is not ready to read, so the poll times out */
+        syscall_success(pipe(p));
+        fds[0].fd = p[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = p[1];
+        fds[1].events = POLLOUT;
+        syscall_success(ret = poll(fds, 1, 0));
+        test_assert(0 == ret && 0 == fds[0].revents, "poll of an empty pipe returned %d", ret);
+        syscall_success(ret = poll(fds, 1, 20));
+        test_assert(0 == ret, "poll of an empty pipe with a timeout returned %d", ret);
+        syscall_success(ret = poll(fds + 1, 1, 0));
+        test_assert(1 == ret && POLLOUT == fds[1].revents, "write end revents %#x", fds[1].revents);
+
+        syscall_success(write(p[1], "x", 1));
+        syscall_success(ret = poll(fds, 1, -1));
+        test_assert(1 == ret && POLLIN == fds[0].revents, "revents %#x", fds[0].revents);
+
+        /* with no writers left, the end is readable and POLLHUP */
+        syscall_success(close(p[1]));
+        syscall_success(ret = poll(fds, 1, -1));
+        test_assert(1 == ret && (POLLIN | POLLHUP) == fds[0].revents, "revents %#x", fds[0].revents);
+        syscall_success(close(p[0]));
+#endif
+}
+
+static void
+vfstest_nonblock(void)
+{
+        int fd, fd2, ret;
+#ifdef __PIPES__
+        int p[2], i;
+        char buf[512];
+#endif
+
+        /* F_GETFL gives the access mode and the flags the file was
+         * opened with, and dups share them */
+        syscall_success(fd = open("nonblock01", O_RDWR | O_CREAT | O_APPEND | O_NONBLOCK, 0));
+        syscall_success(ret = fcntl(fd, F_GETFL));
+        test_assert((O_RDWR | O_APPEND | O_NONBLOCK) == ret, "F_GETFL gave %#x", ret);
+        syscall_success(fd2 = dup(fd));
+        syscall_success(fcntl(fd2, F_SETFL, 0));
+        syscall_success(ret = fcntl(fd, F_GETFL));
+        test_assert(O_RDWR == ret, "F_GETFL gave %#x after F_SETFL 0 on a dup", ret);
+
+        /* F_SETFL leaves the access mode alone */
+        syscall_success(fcntl(fd, F_SETFL, O_RDONLY | O_NONBLOCK));
+        syscall_success(ret = fcntl(fd2, F_GETFL));
+        test_assert((O_RDWR | O_NONBLOCK) == ret, "F_GETFL gave %#x", ret);
+        syscall_success(close(fd2));
+
+        /* a regular file never blocks anyway */
+        syscall_success(write(fd, "hello", 5));
+        syscall_success(lseek(fd, 0, SEEK_SET));
+        read_fd(fd, 10, "hello");
+
+        syscall_fail(fcntl(fd, 99), EINVAL);
+        syscall_fail(fcntl(-1, F_GETFL), EBADF);
+        syscall_success(close(fd));
+        syscall_fail(fcntl(fd, F_GETFL), EBADF);
+
+        syscall_success(fd = open("nonblock01", O_WRONLY, 0));
+        syscall_success(ret = fcntl(fd, F_GETFL));
+        test_assert(O_WRONLY == ret, "F_GETFL gave %#x", ret);
+        syscall_success(close(fd));
+        syscall_success(unlink("nonblock01"));
+
+#ifdef __PIPES__
+        /* a nonblocking read of an empty pipe fails rather than waits,
+         * and a nonblocking write stops once the pipe is full */
+        syscall_success(pipe(p));
+        syscall_success(fcntl(p[0], F_SETFL, O_NONBLOCK));
+        syscall_success(fcntl(p[1], F_SETFL, O_NONBLOCK));
+        syscall_fail(read(p[0], buf, sizeof(buf)), EAGAIN);
+        syscall_success(write(p[1], "abc", 3));
+        syscall_success(ret = read(p[0], buf, sizeof(buf)));
+        test_assert(3 == ret && 0 == memcmp(buf, "abc", 3), "read returned %d", ret);
+
+        memset(buf, 'x', sizeof(buf));
+        for (i = 0; i < 4096; i++) {
+                if (0 > write(p[1], buf, sizeof(buf)))
+                        break;
+        }
+        test_assert(4096 > i && EAGAIN == errno, "a full pipe gave %s after %d writes",
+                    test_errstr(errno), i);
+        while (0 < (ret = read(p[0], buf, sizeof(buf))))
+                ;
+        test_assert(-1 == ret && EAGAIN == errno, "drained pipe read returned %d", ret);
+
+        /* at the end of the pipe there is nothing to wait for */
+        syscall_success(close(p[1]));
+        syscall_success(ret = read(p[0], buf, sizeof(buf)));
+        test_assert(0 == ret, "read at the end of a pipe returned %d", ret);
+        syscall_success(close(p[0]));
+#endif
+}
+
+static void
+vfstest_fsync(void)
+{
+        int fd, rfd;
+
+        /* fsync and fdatasync write back what was written, which is
+         * still there to be read */
+        syscall_success(fd = open("fsync01", O_RDWR | O_CREAT, 0));
+        syscall_success(write(fd, "hello", 5));
+        syscall_success(fsync(fd));
+        syscall_success(write(fd, " again", 6));
+        syscall_success(fdatasync(fd));
+        syscall_success(fsync(fd));
+
+        /* nor do they need the file to be open for writing */
+        syscall_success(rfd = open("fsync01", O_RDONLY, 0));
+        syscall_success(fsync(rfd));
+        read_fd(rfd, 20, "hello again");
+        syscall_success(close(rfd));
+
+        syscall_success(close(fd));
+        syscall_fail(fsync(fd), EBADF);
+        syscall_fail(fdatasync(-1), EBADF);
+        syscall_success(unlink("fsync01"));
+}
+
+static void
+vfstest_sendfile(void)
+{
+        int in, out, dir, ret;
+        off_t off, outoff;
+        char buf[32];
+
+        syscall_success(in = open("sendfile01", O_RDWR | O_CREAT, 0));
+        syscall_success(write(in, "hello world", 11));
+        syscall_success(lseek(in, 0, SEEK_SET));
+        syscall_success(out = open("sendfile02", O_RDWR | O_CREAT, 0));
+
+        /* sendfile moves both file positions, or *off rather than the
+         * input's */
+        syscall_success(ret = sendfile(out, in, NULL, 5));
+        test_assert(5 == ret, "sendfile returned %d", ret);
+        test_fpos(in, 5);
+        test_fpos(out, 5);
+        off = 6;
+        syscall_success(ret = sendfile(out, in, &off, 100));
+        test_assert(5 == ret && 11 == off, "sendfile returned %d, off %d", ret, off);
+        test_fpos(in, 5);
+        test_fpos(out, 10);
+        syscall_success(ret = sendfile(out, in, &off, 100));
+        test_assert(0 == ret, "sendfile at the end of the file returned %d", ret);
+        syscall_success(ret = pread(out, buf, sizeof(buf), 0));
+        test_assert(10 == ret && 0 == memcmp(buf, "helloworld", 10), "sendfile wrote %d bytes", ret);
+
+        /* copy_file_range does the same for both offsets */
+        off = 6;
+        outoff = 0;
+        syscall_success(ret = copy_file_range(in, &off, out, &outoff, 5, 0));
+        test_assert(5 == ret && 11 == off && 5 == outoff,
+                    "copy_file_range returned %d, offsets %d and %d", ret, off, outoff);
+        test_fpos(in, 5);
+        test_fpos(out, 10);
+        syscall_success(lseek(in, 0, SEEK_SET));
+        syscall_success(ret = copy_file_range(in, NULL, out, NULL, 100, 0));
+        test_assert(11 == ret, "copy_file_range returned %d", ret);
+        test_fpos(in, 11);
+        test_fpos(out, 21);
+        syscall_success(ret = pread(out, buf, sizeof(buf), 0));
+        test_assert(21 == ret && 0 == memcmp(buf, "worldworldhello world", 21),
+                    "copy_file_range left %d bytes", ret);
+
+        /* within one file, as long as the ranges do not overlap */
+        off = 0;
+        outoff = 2;
+        syscall_fail(copy_file_range(in, &off, in, &outoff, 5, 0), EINVAL);
+        outoff = 11;
+        syscall_success(ret = copy_file_range(in, &off, in, &outoff, 5, 0));
+        test_assert(5 == ret, "copy_file_range within a file returned %d", ret);
+        syscall_success(ret = pread(in, buf, sizeof(buf), 0));
+        test_assert(16 == ret && 0 == memcmp(buf, "hello worldhello", 16),
+                    "copy_file_range within a file left %d bytes", ret);
+
+        /* errors */
+        off = -1;
+        syscall_fail(sendfile(out, in, &off, 5), EINVAL);
+        syscall_fail(copy_file_range(in, &off, out, NULL, 5, 0), EINVAL);
+        syscall_fail(copy_file_range(in, NULL, out, NULL, 5, 1), EINVAL);
+        syscall_fail(sendfile(-1, in, NULL, 5), EBADF);
+        syscall_fail(sendfile(out, -1, NULL, 5), EBADF);
+        syscall_success(dir = open(".", O_RDONLY, 0));
+        syscall_fail(sendfile(out, dir, NULL, 5), EINVAL);
+        syscall_fail(copy_file_range(dir, NULL, out, NULL, 5, 0), EINVAL);
+        syscall_fail(sendfile(dir, in, NULL, 5), EBADF);
+        syscall_success(close(dir));
+        syscall_success(close(out));
+
+        /* the output must be open for writing, and copy_file_range's not
+         * appended to */
+        syscall_success(out = open("sendfile02", O_RDONLY, 0));
+        syscall_fail(sendfile(out, in, NULL, 5), EBADF);
+        syscall_success(close(out));
+        syscall_success(out = open("sendfile02", O_WRONLY | O_APPEND, 0));
+        syscall_fail(copy_file_range(in, NULL, out, NULL, 5, 0), EBADF);
+        syscall_fail(sendfile(in, out, NULL, 5), EBADF);
+        syscall_success(close(out));
+
+        syscall_success(close(in));
+        syscall_success(unlink("sendfile01"));
+        syscall_success(unlink("sendfile02"));
+}
+
+static void
+vfstest_shm(void)
+{
+        int fd, rfd, ret;
+        char buf[8], *addr;
+
+        /* (left over if an earlier run failed) */
+        shm_unlink("/vfstest");
+
+        syscall_success(fd = shm_open("/vfstest", O_RDWR | O_CREAT | O_EXCL, 0));
+        syscall_fail(shm_open("/vfstest", O_RDWR | O_CREAT | O_EXCL, 0), EEXIST);
+        syscall_success(write(fd, "hello", 5));
+
+        /* every open of the name is the same object, as is a shared
+         * mapping of it */
+        syscall_success(rfd = shm_open("/vfstest", O_RDONLY, 0));
+        syscall_success(ret = pread(rfd, buf, sizeof(buf), 0));
+        test_assert(5 == ret && 0 == memcmp(buf, "hello", 5), "pread returned %d", ret);
+        addr = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        test_assert(MAP_FAILED != addr, "mmap of a shared memory object failed");
+        if (MAP_FAILED != addr) {
+                test_assert(0 == memcmp(addr, "hello", 5), "mapping does not hold what was written");
+                addr[0] = 'J';
+                syscall_success(ret = pread(rfd, buf, 5, 0));
+                test_assert(5 == ret && 0 == memcmp(buf, "Jello", 5), "write to the mapping not read");
+                syscall_success(munmap(addr, 4096));
+        }
+        syscall_success(ret = pread(rfd, buf, sizeof(buf), 4096));
+        test_assert(0 == ret, "pread past the end returned %d", ret);
+
+        /* bad names and modes */
+        syscall_fail(shm_open("vfstest", O_RDWR | O_CREAT, 0), EINVAL);
+        syscall_fail(shm_open("/vfs/test", O_RDWR | O_CREAT, 0), EINVAL);
+        syscall_fail(shm_open("/", O_RDWR | O_CREAT, 0), EINVAL);
+        syscall_fail(shm_open("/" LONGNAME, O_RDWR | O_CREAT, 0), ENAMETOOLONG);
+        syscall_fail(shm_open("/vfstest", O_WRONLY, 0), EINVAL);
+        syscall_fail(shm_open("/vfstest-noent", O_RDWR, 0), ENOENT);
+
+        /* an unlinked object lasts while it is open */
+        syscall_success(shm_unlink("/vfstest"));
+        syscall_fail(shm_open("/vfstest", O_RDWR, 0), ENOENT);
+        syscall_fail(shm_unlink("/vfstest"), ENOENT);
+        syscall_success(ret = pread(rfd, buf, 5, 0));
+        test_assert(5 == ret && 0 == memcmp(buf, "Jello", 5), "unlinked object lost its data");
+        syscall_success(close(rfd));
+        syscall_success(close(fd));
+}
+#endif
+
 static void
 vfstest_getdents(void)
 {
@@ -891,6 +1333,320 @@ vfstest_s5fs_vm(void)
 }
 #endif
 
+/*
+ * The benchmark mode, vfstest -b. Each of nprocs processes, at once,
+ * does iters rounds in a directory of its own of: making a chain of
+ * depth directories, making nfiles files at the bottom of it, writing
+ * size bytes to each, stat()ing each by its whole path, reading the
+ * last directory, reading each file back, and taking it all down
+ * again. Each process reports the rate of each of those, and the first
+ * the wall time of the lot. The processes share nothing but the file
+ * system, so that what they wait on is the disk and its locks: the
+ * s5fs block and inode locks (s5f_block_mutex and s5f_inode_mutex) and
+ * the vn_lock of the directories they all go through.
+ *
+ * The times are in clock ticks (of TICK_MSECS each, read off jiffies in
+ * the kernel and off the kernel data page here), so a run wants to be
+ * a good many of them long.
+ */
+#ifdef __KERNEL__
+#define vfsbench_msecs()        (jiffies * TICK_MSECS)
+#else
+#define vfsbench_msecs()        (KDATA->kd_jiffies * KDATA->kd_tick_msecs)
+#endif
+
+#define VFSBENCH_MAX_PROCS      16
+#define VFSBENCH_MAX_DEPTH      16
+#define VFSBENCH_MAX_FILES      1024
+#define VFSBENCH_IO_SIZE        4096
+
+typedef struct vfsbench {
+        int     vb_nprocs;
+        int     vb_nfiles;
+        int     vb_depth;
+        int     vb_size;
+        int     vb_iters;
+} vfsbench_t;
+
+enum {
+        VB_MKDIR, VB_OPEN, VB_WRITE, VB_STAT, VB_GETDENTS,
+        VB_READ, VB_UNLINK, VB_RMDIR, VB_NPHASES
+};
+
+static const char *vfsbench_names[VB_NPHASES] = {
+        "mkdir", "open", "write", "stat", "getdents", "read", "unlink", "rmdir"
+};
+
+/* Counts bytes rather than operations */
+#define VFSBENCH_IS_IO(ph)      (VB_WRITE == (ph) || VB_READ == (ph))
+
+/* Only the contents of a file are read into it, so the processes (or
+ * kernel threads) may all share it */
+static char vfsbench_buf[VFSBENCH_IO_SIZE];
+
+/* n per msecs milliseconds, per second, without overflowing */
+static uint32_t
+vfsbench_rate(uint32_t n, uint32_t msecs)
+{
+        if (0 == msecs)
+                msecs = 1;
+        return (n / msecs) * 1000 + (n % msecs) * 1000 / msecs;
+}
+
+static int
+vfsbench_fail(int id, const char *what, const char *path)
+{
+        fprintf(stderr, "vfstest: bench %d: %s %s: %s\n", id, what, path, strerror(errno));
+        return -1;
+}
+
+static int
+vfsbench_round(const vfsbench_t *vb, int id, uint32_t *ops, uint32_t *msecs)
+{
+        char path[256];
+        dirent_t dirent;
+        uint32_t start;
+        int len, dirlen, i, n, fd;
+
+        start = vfsbench_msecs();
+        len = sprintf(path, "%s/b%d", root_dir, id);
+        for (i = 0; i <= vb->vb_depth; i++) {
+                if (0 != i)
+                        len += sprintf(path + len, "/d%d", i);
+                if (0 > mkdir(path, 0777))
+                        return vfsbench_fail(id, "mkdir", path);
+        }
+        dirlen = len;
+        ops[VB_MKDIR] += vb->vb_depth + 1;
+        msecs[VB_MKDIR] += vfsbench_msecs() - start;
+
+        start = vfsbench_msecs();
+        for (i = 0; i < vb->vb_nfiles; i++) {
+                sprintf(path + dirlen, "/f%d", i);
+                if (0 > (fd = open(path, O_WRONLY | O_CREAT, 0777)))
+                        return vfsbench_fail(id, "open", path);
+                close(fd);
+        }
+        ops[VB_OPEN] += vb->vb_nfiles;
+        msecs[VB_OPEN] += vfsbench_msecs() - start;
+
+        start = vfsbench_msecs();
+        for (i = 0; i < vb->vb_nfiles; i++) {
+                sprintf(path + dirlen, "/f%d", i);
+                if (0 > (fd = open(path, O_WRONLY, 0)))
+                        return vfsbench_fail(id, "open", path);
+                for (len = 0; len < vb->vb_size; len += n) {
+                        n = MIN(vb->vb_size - len, VFSBENCH_IO_SIZE);
+                        if (n != write(fd, vfsbench_buf, n)) {
+                                close(fd);
+                                return vfsbench_fail(id, "write", path);
+                        }
+                }
+                close(fd);
+        }
+        ops[VB_WRITE] += vb->vb_nfiles * vb->vb_size;
+        msecs[VB_WRITE] += vfsbench_msecs() - start;
+
+        start = vfsbench_msecs();
+        for (i = 0; i < vb->vb_nfiles; i++) {
+                struct stat s;
+
+                sprintf(path + dirlen, "/f%d", i);
+                if (0 > stat(path, &s))
+                        return vfsbench_fail(id, "stat", path);
+        }
+        ops[VB_STAT] += vb->vb_nfiles;
+        msecs[VB_STAT] += vfsbench_msecs() - start;
+
+        start = vfsbench_msecs();
+        path[dirlen] = '\0';
+        if (0 > (fd = open(path, O_RDONLY, 0)))
+                return vfsbench_fail(id, "open", path);
+        while (0 < (n = getdents(fd, &dirent, sizeof(dirent))))
+                ops[VB_GETDENTS]++;
+        close(fd);
+        if (0 > n)
+                return vfsbench_fail(id, "getdents", path);
+        msecs[VB_GETDENTS] += vfsbench_msecs() - start;
+
+        start = vfsbench_msecs();
+        for (i = 0; i < vb->vb_nfiles; i++) {
+                sprintf(path + dirlen, "/f%d", i);
+                if (0 > (fd = open(path, O_RDONLY, 0)))
+                        return vfsbench_fail(id, "open", path);
+                while (0 < (n = read(fd, vfsbench_buf, VFSBENCH_IO_SIZE)))
+                        ops[VB_READ] += n;
+                close(fd);
+                if (0 > n)
+                        return vfsbench_fail(id, "read", path);
+        }
+        msecs[VB_READ] += vfsbench_msecs() - start;
+
+        start = vfsbench_msecs();
+        for (i = 0; i < vb->vb_nfiles; i++) {
+                sprintf(path + dirlen, "/f%d", i);
+                if (0 > unlink(path))
+                        return vfsbench_fail(id, "unlink", path);
+        }
+        ops[VB_UNLINK] += vb->vb_nfiles;
+        msecs[VB_UNLINK] += vfsbench_msecs() - start;
+
+        start = vfsbench_msecs();
+        path[dirlen] = '\0';
+        for (i = vb->vb_depth; i >= 0; i--) {
+                if (0 > rmdir(path))
+                        return vfsbench_fail(id, "rmdir", path);
+                *strrchr(path, '/') = '\0';
+        }
+        ops[VB_RMDIR] += vb->vb_depth + 1;
+        msecs[VB_RMDIR] += vfsbench_msecs() - start;
+        return 0;
+}
+
+/* What one of the processes does: its rounds, then its report */
+static int
+vfsbench_run(const vfsbench_t *vb, int id)
+{
+        uint32_t ops[VB_NPHASES], msecs[VB_NPHASES], rate;
+        int i, ph;
+
+        memset(ops, 0, sizeof(ops));
+        memset(msecs, 0, sizeof(msecs));
+        for (i = 0; i < vb->vb_iters; i++) {
+                if (0 > vfsbench_round(vb, id, ops, msecs))
+                        return -1;
+        }
+
+        for (ph = 0; ph < VB_NPHASES; ph++) {
+                if (VFSBENCH_IS_IO(ph)) {
+                        /* in kilobytes, shown as megabytes to a decimal place */
+                        rate = vfsbench_rate(ops[ph] / 1024, msecs[ph]);
+                        printf("vfstest: bench %d: %s %u.%u MB/s (%u bytes in %u ms)\n",
+                               id, vfsbench_names[ph], rate / 1024, (rate % 1024) * 10 / 1024,
+                               ops[ph], msecs[ph]);
+                } else {
+                        printf("vfstest: bench %d: %s %u ops/s (%u ops in %u ms)\n",
+                               id, vfsbench_names[ph], vfsbench_rate(ops[ph], msecs[ph]),
+                               ops[ph], msecs[ph]);
+                }
+        }
+        return 0;
+}
+
+#ifdef __KERNEL__
+/* The thread's return value is the process's exit status, as exit()'s
+ * argument is for a forked one */
+static void *
+vfsbench_thread(int id, void *arg)
+{
+        return (void *)(0 > vfsbench_run((const vfsbench_t *) arg, id) ? 1 : 0);
+}
+#endif
+
+/* Starts the processes, and returns how many of them failed */
+static int
+vfsbench_spawn(const vfsbench_t *vb)
+{
+        int i, status, failed = 0;
+
+        for (i = 0; i < vb->vb_nprocs; i++) {
+#ifdef __KERNEL__
+                proc_t *p;
+                kthread_t *thr;
+
+                if (NULL == (p = proc_create("vfsbench"))) {
+                        failed++;
+                        continue;
+                }
+                thr = kthread_create(p, vfsbench_thread, i, (void *) vb);
+                KASSERT(NULL != thr);
+                sched_make_runnable(thr);
+#else
+                pid_t pid;
+
+                if (0 > (pid = fork())) {
+                        failed++;
+                        continue;
+                }
+                if (0 == pid)
+                        exit(0 > vfsbench_run(vb, i) ? 1 : 0);
+#endif
+        }
+
+        for (i = failed; i < vb->vb_nprocs; i++) {
+#ifdef __KERNEL__
+                if (0 > do_waitpid(-1, 0, &status))
+#else
+                if (0 > wait(&status))
+#endif
+                        break;
+                if (0 != status)
+                        failed++;
+        }
+        return failed;
+}
+
+/* A flag's value, or -1 if it is not a whole number */
+static int
+vfsbench_arg(const char *s)
+{
+        int n = 0;
+
+        if ('\0' == *s)
+                return -1;
+        for (; '\0' != *s; s++) {
+                if ('0' > *s || '9' < *s || n > (INT_MAX - 9) / 10)
+                        return -1;
+                n = n * 10 + (*s - '0');
+        }
+        return n;
+}
+
+static int
+vfstest_bench(int argc, char **argv)
+{
+        vfsbench_t vb;
+        uint32_t start, msecs;
+        int i, n, failed;
+
+        vb.vb_nprocs = 1;
+        vb.vb_nfiles = 32;
+        vb.vb_depth = 4;
+        vb.vb_size = 16 * 1024;
+        vb.vb_iters = 4;
+        for (i = 0; i < argc; i += 2) {
+                if (i + 1 == argc || '-' != argv[i][0] || '\0' == argv[i][1]
+                    || '\0' != argv[i][2] || 0 > (n = vfsbench_arg(argv[i + 1])))
+                        goto usage;
+                switch (argv[i][1]) {
+                        case 'p': vb.vb_nprocs = n; break;
+                        case 'f': vb.vb_nfiles = n; break;
+                        case 'd': vb.vb_depth = n; break;
+                        case 's': vb.vb_size = n; break;
+                        case 'i': vb.vb_iters = n; break;
+                        default: goto usage;
+                }
+        }
+        if (0 == vb.vb_nprocs || VFSBENCH_MAX_PROCS < vb.vb_nprocs
+            || VFSBENCH_MAX_FILES < vb.vb_nfiles || VFSBENCH_MAX_DEPTH < vb.vb_depth
+            || 0 == vb.vb_iters)
+                goto usage;
+
+        vfstest_start();
+        printf("vfstest: bench: %d procs, %d files of %d bytes, depth %d, %d rounds\n",
+               vb.vb_nprocs, vb.vb_nfiles, vb.vb_size, vb.vb_depth, vb.vb_iters);
+        start = vfsbench_msecs();
+        failed = vfsbench_spawn(&vb);
+        msecs = vfsbench_msecs() - start;
+        printf("vfstest: bench: %u ms in all, %d procs failed\n", msecs, failed);
+        vfstest_term();
+        return (0 == failed) ? 0 : 1;
+
+usage:
+        fprintf(stderr, "USAGE: vfstest -b [-p procs] [-f files] [-d depth] [-s size] [-i rounds]\n");
+        return 1;
+}
+
 /*
  * Finally, the main function.
  */
@@ -900,8 +1656,10 @@ int main(int argc, char **argv)
 int vfstest_main(int argc, char **argv)
 #endif
 {
+        if (1 < argc && 0 == strcmp(argv[1], "-b"))
+                return vfstest_bench(argc - 2, argv + 2);
         if (argc != 1) {
-                fprintf(stderr, "USAGE: vfstest\n");
+                fprintf(stderr, "USAGE: vfstest [-b ...]\n");
                 return 1;
         }
 
@@ -917,6 +1675,15 @@ int vfstest_main(int argc, char **argv)
         vfstest_fd();
         vfstest_open();
         vfstest_read();
+#ifndef __KERNEL__
+        vfstest_iov();
+        vfstest_at();
+        vfstest_poll();
+        vfstest_nonblock();
+        vfstest_fsync();
+        vfstest_sendfile();
+        vfstest_shm();
+#endif
         vfstest_getdents();
 
 #ifdef __VM__
@@ -0,0 +1,142 @@
+/*
+ * Controls the kernel tracepoints and prints what they recorded.
+ *
+ * trace on [class,...]    start recording (every class if none are named)
+ * trace off               stop recording
+ * trace reset             empty the rings
+ * trace                   print the events still in the rings, oldest first
+ *
+ * The times are in cycles since the oldest event printed.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <weenix/trace.h>
+
+#define TRACE_DEV "/dev/trace"
+
+typedef struct trace_seg {
+        trace_hdr_t ts_hdr;
+        trace_ent_t ts_ents[TRACE_RING_ENTS];
+} trace_seg_t;
+
+static trace_seg_t segs[TRACE_NCLASSES];
+/* the next entry of each ring to print, and the one past its newest */
+static uint32_t next[TRACE_NCLASSES];
+static uint32_t end[TRACE_NCLASSES];
+
+static const char *
+event_name(uint16_t event)
+{
+        switch (event) {
+                case TRACE_PAGE_ALLOC: return "page_alloc";
+                case TRACE_PAGE_FREE: return "page_free";
+                case TRACE_SLAB_ALLOC: return "slab_alloc";
+                case TRACE_SLAB_FREE: return "slab_free";
+                case TRACE_PFRAME_GET: return "pframe_get";
+                case TRACE_FAULT: return "fault";
+                case TRACE_SWITCH: return "switch";
+                case TRACE_SYSCALL_ENTER: return "syscall";
+                case TRACE_SYSCALL_EXIT: return "sysret";
+                default: return "?";
+        }
+}
+
+static int
+control(const char *cmd)
+{
+        int fd;
+
+        if (0 > (fd = open(TRACE_DEV, O_WRONLY, 0))) {
+                fprintf(stderr, "trace: %s: %s\n", TRACE_DEV, strerror(errno));
+                return 1;
+        }
+        if (0 > write(fd, cmd, strlen(cmd))) {
+                fprintf(stderr, "trace: %s: %s\n", cmd, strerror(errno));
+                close(fd);
+                return 1;
+        }
+        close(fd);
+        return 0;
+}
+
+static int
+dump(void)
+{
+        uint64_t first = 0;
+        char *p = (char *)segs;
+        int left = sizeof(segs);
+        int fd, n, i, best;
+
+        if (0 > (fd = open(TRACE_DEV, O_RDONLY, 0))) {
+                fprintf(stderr, "trace: %s: %s\n", TRACE_DEV, strerror(errno));
+                return 1;
+        }
+        while (left > 0 && 0 < (n = read(fd, p, left))) {
+                p += n;
+                left -= n;
+        }
+        close(fd);
+        if (0 != left) {
+                fprintf(stderr, "trace: %s is short\n", TRACE_DEV);
+                return 1;
+        }
+
+        for (i = 0; i < TRACE_NCLASSES; i++) {
+                trace_hdr_t *th = &segs[i].ts_hdr;
+                if (TRACE_MAGIC != th->th_magic || TRACE_RING_ENTS != th->th_size) {
+                        fprintf(stderr, "trace: %s does not match this program\n", TRACE_DEV);
+                        return 1;
+                }
+                end[i] = th->th_head;
+                next[i] = (th->th_head > th->th_size) ? th->th_head - th->th_size : 0;
+        }
+
+        /* merge the rings by time */
+        printf("%12s %5s %-10s %10s %10s %10s\n", "cycles", "pid", "event", "arg0", "arg1", "arg2");
+        while (1) {
+                trace_ent_t *te, *bte = NULL;
+                best = -1;
+                for (i = 0; i < TRACE_NCLASSES; i++) {
+                        if (next[i] == end[i])
+                                continue;
+                        te = &segs[i].ts_ents[next[i] % TRACE_RING_ENTS];
+                        if (NULL == bte || te->te_time < bte->te_time) {
+                                bte = te;
+                                best = i;
+                        }
+                }
+                if (0 > best)
+                        break;
+                next[best]++;
+                if (0 == first)
+                        first = bte->te_time;
+                printf("%12llu %5d %-10s 0x%08x 0x%08x 0x%08x\n",
+                       (unsigned long long)(bte->te_time - first), bte->te_pid,
+                       event_name(bte->te_event), bte->te_args[0],
+                       bte->te_args[1], bte->te_args[2]);
+        }
+        return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+        char cmd[128];
+
+        if (1 == argc)
+                return dump();
+        if (2 == argc && (!strcmp(argv[1], "on") || !strcmp(argv[1], "off")
+                          || !strcmp(argv[1], "reset")))
+                return control(argv[1]);
+        if (3 == argc && !strcmp(argv[1], "on")) {
+                snprintf(cmd, sizeof(cmd), "on %s", argv[2]);
+                return control(cmd);
+        }
+        fprintf(stderr, "usage: trace [on [class,...] | off | reset]\n");
+        return 1;
+}
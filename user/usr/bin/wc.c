@@ -5,7 +5,7 @@
 #include <string.h>
 #include <unistd.h>
 
-#define BUFFER_SIZE 1024
+#define BUFFER_SIZE 65536
 
 typedef struct count_results {
     unsigned long long        n_chars;
@@ -13,7 +13,48 @@ typedef struct count_results {
     unsigned long long        n_lines;
 } count_results_t;
 
-char buf[BUFFER_SIZE];
+/* word-aligned, so that newlines can be counted a word at a time */
+unsigned int buf_words[BUFFER_SIZE / sizeof(unsigned int)];
+#define buf ((char *) buf_words)
+
+/* 1 for each byte which isspace() */
+static unsigned char space_table[256];
+
+static void
+init_space_table(void)
+{
+    int c;
+
+    for (c = 0; c < 256; c++)
+        space_table[c] = isspace(c) ? 1 : 0;
+}
+
+/*
+ * The number of '\n' bytes in the n words at w: a byte of x = w ^ "\n\n\n\n"
+ * is zero exactly where w has a newline, and the top bit of each byte of
+ * ~(((x & 0x7f..) + 0x7f..) | x | 0x7f..) is set exactly where x is zero.
+ * Those bits are summed a byte per lane, flushed before a lane can
+ * overflow.
+ */
+static unsigned long long
+count_newlines(const unsigned int *w, size_t n)
+{
+    unsigned long long total = 0;
+    unsigned int lanes = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        unsigned int x = w[i] ^ 0x0a0a0a0aU;
+        unsigned int y = ~(((x & 0x7f7f7f7fU) + 0x7f7f7f7fU) | x | 0x7f7f7f7fU);
+
+        lanes += y >> 7;
+        if ((i & 0xff) == 0xfe) {
+            total += (lanes * 0x01010101U) >> 24;
+            lanes = 0;
+        }
+    }
+    return total + ((lanes * 0x01010101U) >> 24);
+}
 
 void
 print_counts(count_results_t *results, char *name)
@@ -36,28 +77,35 @@ print_counts(count_results_t *results, char *name)
 void
 count(int fd, char *name, count_results_t *results)
 {
-    size_t bytes_read;
-    unsigned int in_word, i;
+    int bytes_read;
+    unsigned int in_word, words, i, nwords;
+    const unsigned char *p;
 
     in_word = 0;
     while ((bytes_read = read(fd, buf, BUFFER_SIZE)) > 0)
     {
-        for (i = 0; i < bytes_read; ++i) {
-            if (isspace(buf[i])) {
-                if (in_word) {
-                    results->n_words++;
-                    in_word = 0;
-                }
-            } else {
-                in_word = 1;
-            }
+        /* a word ends where a space follows a non-space; no branches */
+        p = (const unsigned char *) buf;
+        words = 0;
+        for (i = 0; i < (unsigned int) bytes_read; ++i) {
+            unsigned int space = space_table[p[i]];
+
+            words += in_word & space;
+            in_word = space ^ 1;
+        }
+        results->n_words += words;
 
+        nwords = bytes_read / sizeof(unsigned int);
+        results->n_lines += count_newlines(buf_words, nwords);
+        for (i = nwords * sizeof(unsigned int); i < (unsigned int) bytes_read; ++i) {
             if (buf[i] == '\n')
                 results->n_lines++;
         }
 
         results->n_chars += bytes_read;
     }
+    if (in_word)
+        results->n_words++;
 
     print_counts(results, name);
 }
@@ -69,6 +117,8 @@ main(int argc, char **argv)
     count_results_t total_counts = { .n_chars = 0, .n_words = 0, .n_lines = 0 };
     count_results_t local_counts = { .n_chars = 0, .n_words = 0, .n_lines = 0 };
 
+    init_space_table();
+
     if (argc == 1)
     {
         /* Reading from standard input. */